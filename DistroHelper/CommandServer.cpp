@@ -0,0 +1,758 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "CommandServer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace {
+    // How much of a command's output is read at once, and how much may wait
+    // for a slow client before the commands of that client stop being read.
+    constexpr size_t ReadSize = 64 << 10;
+    constexpr size_t MaxPending = 4 << 20;
+
+    // How often exits are checked for when SIGCHLD could not be caught, and
+    // when a command has closed its output but not exited yet.
+    constexpr int ReapInterval = 1000;
+    constexpr int ExitInterval = 5;
+
+    void SetNonBlocking(int fd)
+    {
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    bool SameToken(const std::string &expected, const std::string &given)
+    {
+        // Compare in constant time, so that timing tells nothing of the token.
+        unsigned char difference = (expected.size() == given.size()) ? 0 : 1;
+        for (size_t i = 0; i < expected.size(); i += 1) {
+            difference |= static_cast<unsigned char>(expected[i] ^ ((i < given.size()) ? given[i] : 0));
+        }
+
+        return difference == 0;
+    }
+}
+
+struct CommandServer::Watch
+{
+    enum Kind
+    {
+        Tcp,
+        Unix,
+        Wakeup,
+        Signals,
+        Client,
+        Stream,
+    };
+
+    Kind kind;
+    Connection *connection = nullptr;
+    Command *command = nullptr;
+
+    // For Stream: 0 for the input, 1 for the output, 2 for the error stream.
+    int stream = 0;
+};
+
+struct CommandServer::Connection
+{
+    int fd = -1;
+    bool authenticated = false;
+    bool broken = false;
+    bool throttled = false;
+    bool writing = false;
+    FrameReader reader;
+    std::string outbox;
+    size_t sent = 0;
+    Watch watch;
+    std::map<uint32_t, Command *> commands;
+};
+
+struct CommandServer::Command
+{
+    uint32_t id = 0;
+    pid_t pid = -1;
+    Connection *connection = nullptr;
+    int fds[3] = {-1, -1, -1};
+    Watch watches[3];
+    std::string input;
+    bool inputWatched = false;
+    bool closeInput = false;
+    bool exited = false;
+    int status = 0;
+};
+
+CommandServer::CommandServer(std::string token) :
+    _token(std::move(token))
+{
+}
+
+CommandServer::~CommandServer()
+{
+    while (!_connections.empty()) {
+        Drop(_connections.begin()->first);
+    }
+
+    for (int fd : {_epoll, _wakeup, _signals, _tcp, _unix}) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    if (!_unixPath.empty()) {
+        ::unlink(_unixPath.c_str());
+    }
+}
+
+bool CommandServer::Fail(const std::string &error)
+{
+    _error = error;
+    return false;
+}
+
+bool CommandServer::Add(int fd, Watch *watch, uint32_t events)
+{
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.ptr = watch;
+    if (::epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+        return Fail(std::string("cannot watch a descriptor: ") + std::strerror(errno));
+    }
+
+    return true;
+}
+
+bool CommandServer::Setup()
+{
+    if (_epoll >= 0) {
+        return true;
+    }
+
+    _epoll = ::epoll_create1(EPOLL_CLOEXEC);
+    _wakeup = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if ((_epoll < 0) || (_wakeup < 0)) {
+        return Fail(std::string("cannot set up the event loop: ") + std::strerror(errno));
+    }
+
+    // Exits are caught with a signalfd when SIGCHLD is blocked in every
+    // thread, as it is in wsl-helper; otherwise they are polled for.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    ::pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    ::signal(SIGPIPE, SIG_IGN);
+    _signals = ::signalfd(-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK);
+    const Watch::Kind kinds[4] = {Watch::Tcp, Watch::Unix, Watch::Wakeup, Watch::Signals};
+    for (int i = 0; i < 4; i += 1) {
+        _serverWatches[i] = std::make_unique<Watch>();
+        _serverWatches[i]->kind = kinds[i];
+    }
+
+    return Add(_wakeup, _serverWatches[2].get(), EPOLLIN) && ((_signals < 0) || Add(_signals, _serverWatches[3].get(), EPOLLIN));
+}
+
+bool CommandServer::ListenTcp(uint16_t port)
+{
+    if (!Setup()) {
+        return false;
+    }
+
+    _tcp = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (_tcp < 0) {
+        return Fail(std::string("cannot create a socket: ") + std::strerror(errno));
+    }
+
+    int reuse = 1;
+    ::setsockopt(_tcp, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(address);
+    if ((::bind(_tcp, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) || (::listen(_tcp, 64) != 0) ||
+        (::getsockname(_tcp, reinterpret_cast<sockaddr *>(&address), &size) != 0)) {
+        return Fail("cannot listen on port " + std::to_string(port) + ": " + std::strerror(errno));
+    }
+
+    _port = ntohs(address.sin_port);
+    return Add(_tcp, _serverWatches[0].get(), EPOLLIN);
+}
+
+bool CommandServer::ListenUnix(const std::string &path)
+{
+    if (!Setup()) {
+        return false;
+    }
+
+    sockaddr_un address = {};
+    if (path.size() >= sizeof(address.sun_path)) {
+        return Fail("socket path too long: " + path);
+    }
+
+    _unix = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (_unix < 0) {
+        return Fail(std::string("cannot create a socket: ") + std::strerror(errno));
+    }
+
+    // A socket left behind by a server that is gone is replaced.
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+    struct stat status;
+    if ((::lstat(path.c_str(), &status) == 0) && S_ISSOCK(status.st_mode)) {
+        ::unlink(path.c_str());
+    }
+
+    const mode_t mask = ::umask(077);
+    const bool bound = ::bind(_unix, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0;
+    ::umask(mask);
+    if (!bound || (::listen(_unix, 64) != 0)) {
+        return Fail("cannot listen on " + path + ": " + std::strerror(errno));
+    }
+
+    _unixPath = path;
+    return Add(_unix, _serverWatches[1].get(), EPOLLIN);
+}
+
+void CommandServer::Stop()
+{
+    const uint64_t one = 1;
+    if (::write(_wakeup, &one, sizeof(one)) < 0) {
+        // The counter can only be full if Stop was already called.
+    }
+}
+
+bool CommandServer::Serve(std::chrono::seconds idleTimeout)
+{
+    if ((_tcp < 0) && (_unix < 0)) {
+        return Fail("not listening");
+    }
+
+    auto idleSince = std::chrono::steady_clock::now();
+    for (;;) {
+        int wait = -1;
+        if (_connections.empty() && _commands.empty()) {
+            const auto left = idleTimeout - (std::chrono::steady_clock::now() - idleSince);
+            if (left <= std::chrono::seconds(0)) {
+                return true;
+            }
+
+            wait = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(left).count()) + 1;
+
+        } else {
+            wait = (_signals < 0) ? ReapInterval : -1;
+            for (const auto &entry : _commands) {
+                const Command &command = *entry.second;
+                if ((command.fds[1] < 0) && (command.fds[2] < 0)) {
+                    wait = ExitInterval;
+                    break;
+                }
+            }
+        }
+
+        struct epoll_event events[64];
+        const int count = ::epoll_wait(_epoll, events, 64, wait);
+        if ((count < 0) && (errno != EINTR)) {
+            return Fail(std::string("cannot wait for events: ") + std::strerror(errno));
+        }
+
+        for (int i = 0; i < count; i += 1) {
+            Watch *watch = static_cast<Watch *>(events[i].data.ptr);
+            switch (watch->kind) {
+            case Watch::Tcp:
+                Accept(_tcp);
+                break;
+
+            case Watch::Unix:
+                Accept(_unix);
+                break;
+
+            case Watch::Wakeup:
+                return true;
+
+            case Watch::Signals: {
+                signalfd_siginfo info;
+                while (::read(_signals, &info, sizeof(info)) > 0) {
+                }
+
+                break;
+            }
+
+            case Watch::Client:
+                OnConnection(watch->connection, events[i].events);
+                break;
+
+            case Watch::Stream:
+                if (watch->stream == 0) {
+                    OnInput(watch->command);
+
+                } else {
+                    OnOutput(watch->command, watch->stream);
+                }
+
+                break;
+            }
+        }
+
+        Reap();
+        std::vector<Connection *> broken;
+        for (const auto &entry : _connections) {
+            if (entry.second->broken) {
+                broken.push_back(entry.first);
+            }
+        }
+
+        for (Connection *connection : broken) {
+            Drop(connection);
+        }
+
+        if (!_connections.empty() || !_commands.empty()) {
+            idleSince = std::chrono::steady_clock::now();
+        }
+    }
+}
+
+void CommandServer::Accept(int listener)
+{
+    for (;;) {
+        const int fd = ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+
+        if (listener == _tcp) {
+            int noDelay = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        }
+
+        auto connection = std::make_unique<Connection>();
+        connection->fd = fd;
+        connection->watch.kind = Watch::Client;
+        connection->watch.connection = connection.get();
+        if (!Add(fd, &connection->watch, EPOLLIN)) {
+            ::close(fd);
+            continue;
+        }
+
+        Connection *key = connection.get();
+        _connections[key] = std::move(connection);
+    }
+}
+
+void CommandServer::OnConnection(Connection *connection, uint32_t events)
+{
+    if (connection->broken) {
+        return;
+    }
+
+    if (events & EPOLLOUT) {
+        Flush(connection);
+    }
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        char buffer[ReadSize];
+        const ssize_t count = ::recv(connection->fd, buffer, sizeof(buffer), 0);
+        if ((count < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+            return;
+        }
+
+        if (count <= 0) {
+            connection->broken = true;
+            return;
+        }
+
+        connection->reader.Feed(buffer, static_cast<size_t>(count));
+        Frame frame;
+        while (!connection->broken && connection->reader.Next(&frame)) {
+            OnFrame(connection, frame);
+        }
+
+        connection->broken = connection->broken || connection->reader.Broken();
+    }
+}
+
+void CommandServer::OnFrame(Connection *connection, Frame &frame)
+{
+    if (!connection->authenticated) {
+        connection->authenticated = (frame.type == FrameType::Hello) && SameToken(_token, frame.payload);
+        connection->broken = !connection->authenticated;
+        if (connection->authenticated) {
+            Send(connection, FrameType::Hello, 0, nullptr, 0);
+        }
+
+        return;
+    }
+
+    if (frame.type == FrameType::Run) {
+        Start(connection, frame.command, frame.payload);
+
+    } else if (frame.type == FrameType::Input) {
+        const auto it = connection->commands.find(frame.command);
+        if (it == connection->commands.end()) {
+            return;
+        }
+
+        Command *command = it->second;
+        if (frame.payload.empty()) {
+            command->closeInput = true;
+
+        } else if (command->fds[0] >= 0) {
+            command->input += frame.payload;
+        }
+
+        OnInput(command);
+
+    } else {
+        connection->broken = true;
+    }
+}
+
+std::string CommandServer::Translate(const std::string &directory) const
+{
+    // Drive paths are under the automount root, "/mnt/" unless wsl.conf
+    // says otherwise; paths of the distribution itself come as UNC paths.
+    std::string path;
+    if ((directory.size() >= 2) && std::isalpha(static_cast<unsigned char>(directory[0])) && (directory[1] == ':')) {
+        std::string root = "/mnt/";
+        std::ifstream config("/etc/wsl.conf");
+        std::string line;
+        bool automount = false;
+        while (std::getline(config, line)) {
+            line.erase(std::remove_if(line.begin(), line.end(), [](char c) { return std::isspace(static_cast<unsigned char>(c)); }), line.end());
+            if (!line.empty() && (line[0] == '[')) {
+                automount = (line == "[automount]");
+
+            } else if (automount && (line.compare(0, 5, "root=") == 0) && (line.size() > 5)) {
+                root = line.substr(5);
+                if (root.back() != '/') {
+                    root += '/';
+                }
+            }
+        }
+
+        path = root + static_cast<char>(std::tolower(static_cast<unsigned char>(directory[0]))) + directory.substr(2);
+
+    } else {
+        for (const char *prefix : {"\\\\wsl$\\", "\\\\wsl.localhost\\"}) {
+            const size_t length = std::strlen(prefix);
+            if ((directory.size() > length) && std::equal(prefix, prefix + length, directory.begin(), [](char a, char b) {
+                    return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+                })) {
+                const size_t slash = directory.find('\\', length);
+                path = (slash == std::string::npos) ? "/" : directory.substr(slash);
+            }
+        }
+
+        if (path.empty() && (directory.compare(0, 1, "/") == 0)) {
+            path = directory;
+        }
+    }
+
+    std::replace(path.begin(), path.end(), '\\', '/');
+    return path;
+}
+
+void CommandServer::Start(Connection *connection, uint32_t id, const std::string &payload)
+{
+    const auto fail = [&](const std::string &error) { Send(connection, FrameType::Failed, id, error.data(), error.size()); };
+    if ((payload.size() < 4) || (CommandProtocol::ReadU32(payload.data()) > payload.size() - 4)) {
+        connection->broken = true;
+        return;
+    }
+
+    if (connection->commands.count(id) != 0) {
+        fail("command " + std::to_string(id) + " is already running");
+        return;
+    }
+
+    const size_t directorySize = CommandProtocol::ReadU32(payload.data());
+    const std::string directory = Translate(payload.substr(4, directorySize));
+    const std::string commandLine = payload.substr(4 + directorySize);
+    const char *home = std::getenv("HOME");
+
+    int pipes[3][2];
+    int created = 0;
+    for (; created < 3; created += 1) {
+        if (::pipe2(pipes[created], O_CLOEXEC) != 0) {
+            break;
+        }
+    }
+
+    const pid_t pid = (created == 3) ? ::fork() : -1;
+    if (pid == 0) {
+        // Only async-signal-safe calls from here on.
+        sigset_t signals;
+        sigemptyset(&signals);
+        ::sigprocmask(SIG_SETMASK, &signals, nullptr);
+        ::signal(SIGPIPE, SIG_DFL);
+        ::setsid();
+        ::dup2(pipes[0][0], STDIN_FILENO);
+        ::dup2(pipes[1][1], STDOUT_FILENO);
+        ::dup2(pipes[2][1], STDERR_FILENO);
+        if (directory.empty() || (::chdir(directory.c_str()) != 0)) {
+            if ((home == nullptr) || (::chdir(home) != 0)) {
+                if (::chdir("/") != 0) {
+                    ::_exit(127);
+                }
+            }
+        }
+
+        ::execl("/bin/sh", "sh", "-c", commandLine.c_str(), static_cast<char *>(nullptr));
+        ::_exit(127);
+    }
+
+    const int error = errno;
+    for (int i = 0; i < created; i += 1) {
+        ::close(pipes[i][(i == 0) ? 0 : 1]);
+        if (pid < 0) {
+            ::close(pipes[i][(i == 0) ? 1 : 0]);
+        }
+    }
+
+    if (pid < 0) {
+        fail(std::string("cannot start the command: ") + std::strerror(error));
+        return;
+    }
+
+    auto command = std::make_unique<Command>();
+    command->id = id;
+    command->pid = pid;
+    command->connection = connection;
+    command->fds[0] = pipes[0][1];
+    command->fds[1] = pipes[1][0];
+    command->fds[2] = pipes[2][0];
+    for (int stream = 0; stream < 3; stream += 1) {
+        SetNonBlocking(command->fds[stream]);
+        command->watches[stream].kind = Watch::Stream;
+        command->watches[stream].command = command.get();
+        command->watches[stream].stream = stream;
+    }
+
+    const uint32_t events = connection->throttled ? 0u : static_cast<uint32_t>(EPOLLIN);
+    Add(command->fds[1], &command->watches[1], events);
+    Add(command->fds[2], &command->watches[2], events);
+    connection->commands[id] = command.get();
+    _commands[pid] = std::move(command);
+}
+
+void CommandServer::OnInput(Command *command)
+{
+    while (!command->input.empty() && (command->fds[0] >= 0)) {
+        const ssize_t count = ::write(command->fds[0], command->input.data(), command->input.size());
+        if ((count < 0) && (errno == EINTR)) {
+            continue;
+        }
+
+        if ((count < 0) && (errno == EAGAIN)) {
+            if (!command->inputWatched) {
+                Add(command->fds[0], &command->watches[0], EPOLLOUT);
+                command->inputWatched = true;
+            }
+
+            return;
+        }
+
+        if (count < 0) {
+            // The command does not read its input any more.
+            command->input.clear();
+            CloseStream(command, 0);
+            return;
+        }
+
+        command->input.erase(0, static_cast<size_t>(count));
+    }
+
+    if (command->inputWatched) {
+        ::epoll_ctl(_epoll, EPOLL_CTL_DEL, command->fds[0], nullptr);
+        command->inputWatched = false;
+    }
+
+    if (command->closeInput) {
+        CloseStream(command, 0);
+    }
+}
+
+void CommandServer::OnOutput(Command *command, int stream)
+{
+    // One read per event, so that a command writing without pause does not
+    // keep the others waiting.
+    char buffer[ReadSize + 1];
+    buffer[0] = static_cast<char>(stream);
+    const ssize_t count = ::read(command->fds[stream], buffer + 1, ReadSize);
+    if ((count < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+        return;
+    }
+
+    if (count <= 0) {
+        CloseStream(command, stream);
+        return;
+    }
+
+    if (command->connection != nullptr) {
+        Send(command->connection, FrameType::Output, command->id, buffer, static_cast<size_t>(count) + 1);
+    }
+}
+
+void CommandServer::CloseStream(Command *command, int stream)
+{
+    int &fd = command->fds[stream];
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+
+    if (stream == 0) {
+        command->inputWatched = false;
+    }
+}
+
+void CommandServer::Reap()
+{
+    // A command is over once it has exited and its output has been read to
+    // the end, which the children it left behind may keep open. Commands are
+    // only finished here, between batches of events that may point to them.
+    std::vector<Command *> over;
+    for (const auto &entry : _commands) {
+        Command *command = entry.second.get();
+        int status;
+        if (!command->exited && (::waitpid(command->pid, &status, WNOHANG) == command->pid)) {
+            command->exited = true;
+            command->status = WIFSIGNALED(status) ? (128 + WTERMSIG(status)) : WEXITSTATUS(status);
+        }
+
+        if (command->exited && (command->fds[1] < 0) && (command->fds[2] < 0)) {
+            over.push_back(command);
+        }
+    }
+
+    for (Command *command : over) {
+        Finish(command);
+    }
+}
+
+void CommandServer::Finish(Command *command)
+{
+    Connection *connection = command->connection;
+    if (connection != nullptr) {
+        std::string payload;
+        CommandProtocol::AppendU32(&payload, static_cast<uint32_t>(command->status));
+        Send(connection, FrameType::Exit, command->id, payload.data(), payload.size());
+        connection->commands.erase(command->id);
+    }
+
+    for (int stream = 0; stream < 3; stream += 1) {
+        CloseStream(command, stream);
+    }
+
+    _commands.erase(command->pid);
+}
+
+void CommandServer::Send(Connection *connection, FrameType type, uint32_t id, const void *payload, size_t size)
+{
+    if (connection->broken) {
+        return;
+    }
+
+    CommandProtocol::AppendFrame(&connection->outbox, type, id, payload, size);
+    Flush(connection);
+}
+
+void CommandServer::Flush(Connection *connection)
+{
+    while (connection->sent < connection->outbox.size()) {
+        const ssize_t count = ::send(connection->fd,
+                                     connection->outbox.data() + connection->sent,
+                                     connection->outbox.size() - connection->sent,
+                                     MSG_NOSIGNAL | MSG_DONTWAIT);
+        if ((count < 0) && (errno == EINTR)) {
+            continue;
+        }
+
+        if ((count < 0) && (errno == EAGAIN)) {
+            break;
+        }
+
+        if (count < 0) {
+            connection->broken = true;
+            return;
+        }
+
+        connection->sent += static_cast<size_t>(count);
+    }
+
+    if (connection->sent == connection->outbox.size()) {
+        connection->outbox.clear();
+        connection->sent = 0;
+
+    } else if (connection->sent > MaxPending) {
+        connection->outbox.erase(0, connection->sent);
+        connection->sent = 0;
+    }
+
+    const bool writing = !connection->outbox.empty();
+    if (writing != connection->writing) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN | (writing ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+        event.data.ptr = &connection->watch;
+        ::epoll_ctl(_epoll, EPOLL_CTL_MOD, connection->fd, &event);
+        connection->writing = writing;
+    }
+
+    Throttle(connection, connection->outbox.size() - connection->sent > MaxPending);
+}
+
+void CommandServer::Throttle(Connection *connection, bool throttled)
+{
+    if (throttled == connection->throttled) {
+        return;
+    }
+
+    connection->throttled = throttled;
+    for (const auto &entry : connection->commands) {
+        Command *command = entry.second;
+        for (int stream = 1; stream < 3; stream += 1) {
+            if (command->fds[stream] >= 0) {
+                struct epoll_event event = {};
+                event.events = throttled ? 0u : static_cast<uint32_t>(EPOLLIN);
+                event.data.ptr = &command->watches[stream];
+                ::epoll_ctl(_epoll, EPOLL_CTL_MOD, command->fds[stream], &event);
+            }
+        }
+    }
+}
+
+void CommandServer::Drop(Connection *connection)
+{
+    // Commands of a client gone away are hung up on, like those of a closed
+    // terminal, and forgotten once they have exited.
+    for (const auto &entry : connection->commands) {
+        Command *command = entry.second;
+        ::kill(-command->pid, SIGHUP);
+        command->connection = nullptr;
+        for (int stream = 0; stream < 3; stream += 1) {
+            CloseStream(command, stream);
+        }
+    }
+
+    ::close(connection->fd);
+    _connections.erase(connection);
+}
@@ -0,0 +1,88 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+
+#include "CommandProtocol.h"
+
+// Runs commands for launcher clients without a WSL launch each: the server
+// stays in the distribution, and each command is one fork and exec of
+// /bin/sh -c behind a connection that is already open. Connections speak the
+// protocol CommandProtocol.h describes; a client can have many commands
+// running at once, their input and output multiplexed over its connection.
+//
+// Commands run with the server's credentials and environment, in a session
+// of their own, with pipes for their three streams; they have no terminal.
+// Everything happens on the thread calling Serve, in one epoll loop.
+class CommandServer
+{
+  public:
+    explicit CommandServer(std::string token);
+    ~CommandServer();
+
+    CommandServer(const CommandServer &) = delete;
+    CommandServer &operator=(const CommandServer &) = delete;
+
+    // Listens on the loopback interface, where WSL forwards connections
+    // from Windows; port 0 picks a free port, which Port() then tells.
+    bool ListenTcp(uint16_t port);
+
+    // Listens on a socket only the current user can connect to.
+    bool ListenUnix(const std::string &path);
+
+    uint16_t Port() const { return _port; }
+
+    // Serves clients until the server has had no connection and no command
+    // running for the idle timeout, or until Stop is called.
+    bool Serve(std::chrono::seconds idleTimeout);
+
+    // Makes Serve return; can be called from any thread.
+    void Stop();
+
+    const std::string &Error() const { return _error; }
+
+  private:
+    struct Connection;
+    struct Command;
+    struct Watch;
+
+    bool Setup();
+    bool Add(int fd, Watch *watch, uint32_t events);
+    void Accept(int listener);
+    void OnConnection(Connection *connection, uint32_t events);
+    void OnFrame(Connection *connection, Frame &frame);
+    void Start(Connection *connection, uint32_t id, const std::string &payload);
+    void OnOutput(Command *command, int stream);
+    void OnInput(Command *command);
+    void Reap();
+    void Finish(Command *command);
+    void Send(Connection *connection, FrameType type, uint32_t id, const void *payload, size_t size);
+    void Flush(Connection *connection);
+    void Throttle(Connection *connection, bool throttled);
+    void Drop(Connection *connection);
+    void CloseStream(Command *command, int stream);
+    std::string Translate(const std::string &directory) const;
+    bool Fail(const std::string &error);
+
+    std::string _token;
+    int _epoll = -1;
+    int _wakeup = -1;
+    int _signals = -1;
+    int _tcp = -1;
+    int _unix = -1;
+    uint16_t _port = 0;
+    std::string _unixPath;
+    std::map<Connection *, std::unique_ptr<Connection>> _connections;
+    std::map<pid_t, std::unique_ptr<Command>> _commands;
+    std::unique_ptr<Watch> _serverWatches[4];
+    std::string _error;
+};
@@ -0,0 +1,371 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "RootfsDelta.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "Decompress.h"
+#include "InputBuffer.h"
+#include "Sha256.h"
+
+namespace {
+    const char DeltaMagic[] = "WSLDELTA";
+    constexpr uint32_t DeltaVersion = 1;
+
+    class VectorSink : public ByteSink
+    {
+      public:
+        explicit VectorSink(std::vector<uint8_t> &output) :
+            _output(output)
+        {
+        }
+
+        bool Write(const uint8_t *data, size_t size) override
+        {
+            _output.insert(_output.end(), data, data + size);
+            return true;
+        }
+
+      private:
+        std::vector<uint8_t> &_output;
+    };
+
+    // Decodes the little-endian fields of delta records.
+    class RecordReader
+    {
+      public:
+        RecordReader(const uint8_t *data, size_t size) :
+            _data(data),
+            _end(data + size)
+        {
+        }
+
+        bool Bytes(size_t size, const uint8_t **data)
+        {
+            if (static_cast<size_t>(_end - _data) < size) {
+                return false;
+            }
+
+            *data = _data;
+            _data += size;
+            return true;
+        }
+
+        bool U8(uint8_t *value)
+        {
+            const uint8_t *data;
+            if (!Bytes(1, &data)) {
+                return false;
+            }
+
+            *value = data[0];
+            return true;
+        }
+
+        bool U32(uint32_t *value)
+        {
+            const uint8_t *data;
+            if (!Bytes(4, &data)) {
+                return false;
+            }
+
+            *value = 0;
+            for (int index = 3; index >= 0; index -= 1) {
+                *value = (*value << 8) | data[index];
+            }
+
+            return true;
+        }
+
+        bool U64(uint64_t *value)
+        {
+            const uint8_t *data;
+            if (!Bytes(8, &data)) {
+                return false;
+            }
+
+            *value = 0;
+            for (int index = 7; index >= 0; index -= 1) {
+                *value = (*value << 8) | data[index];
+            }
+
+            return true;
+        }
+
+        bool String(std::string *value)
+        {
+            uint32_t size;
+            const uint8_t *data;
+            if (!U32(&size) || !Bytes(size, &data)) {
+                return false;
+            }
+
+            value->assign(reinterpret_cast<const char *>(data), size);
+            return true;
+        }
+
+        // Reads the metadata shared by entry records into a tar entry, with
+        // extended attributes stored as their pax records.
+        bool Meta(TarEntry *entry)
+        {
+            uint8_t type;
+            uint64_t mtime;
+            uint32_t attributes;
+            if (!String(&entry->path) || !U8(&type) || !U32(&entry->mode) || !U32(&entry->uid) || !U32(&entry->gid) ||
+                !U64(&mtime) || !String(&entry->linkTarget) || !U32(&attributes)) {
+                return false;
+            }
+
+            entry->type = static_cast<char>(type);
+            entry->mtime = static_cast<int64_t>(mtime);
+            entry->paxRecords.clear();
+            for (uint32_t index = 0; index < attributes; index += 1) {
+                std::string name;
+                std::string value;
+                if (!String(&name) || !String(&value)) {
+                    return false;
+                }
+
+                entry->paxRecords.emplace_back("SCHILY.xattr." + name, std::move(value));
+            }
+
+            return true;
+        }
+
+      private:
+        const uint8_t *_data;
+        const uint8_t *_end;
+    };
+
+    void Hash(const uint8_t *data, size_t size, uint8_t *digest)
+    {
+        Sha256 hash;
+        hash.Update(data, size);
+        hash.Final(digest);
+    }
+}
+
+DeltaApplier::DeltaApplier(std::filesystem::path root) :
+    _tree(std::move(root))
+{
+}
+
+DeltaStatus DeltaApplier::Fail(DeltaStatus status, const std::string &error)
+{
+    _error = error;
+    return status;
+}
+
+DeltaStatus DeltaApplier::Apply(const std::filesystem::path &delta)
+{
+    // Deltas are small by design, so they are decoded in memory.
+    std::ifstream file(delta, std::ios::binary);
+    std::vector<uint8_t> compressed((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!file || compressed.empty()) {
+        return Fail(DeltaStatus::IoError, "cannot read " + delta.filename().u8string());
+    }
+
+    std::vector<uint8_t> records;
+    MemorySource source(compressed.data(), compressed.size());
+    VectorSink sink(records);
+    Decompressor decompressor(source);
+    if (decompressor.Decode(sink) != InflateStatus::Ok) {
+        return Fail(DeltaStatus::CorruptDelta, decompressor.Error());
+    }
+
+    _stats.deltaBytes = compressed.size();
+    return Apply(records.data(), records.size());
+}
+
+DeltaStatus DeltaApplier::Apply(const uint8_t *data, size_t size)
+{
+    const uint64_t deltaBytes = _stats.deltaBytes;
+    _stats = {};
+    _stats.deltaBytes = deltaBytes;
+    _error.clear();
+    DeltaStatus status = Run(data, size, false);
+    if (status == DeltaStatus::Ok) {
+        status = Run(data, size, true);
+    }
+
+    if ((status == DeltaStatus::Ok) && !_tree.Finish()) {
+        return Fail(DeltaStatus::IoError, _tree.Error());
+    }
+
+    return status;
+}
+
+DeltaStatus DeltaApplier::Run(const uint8_t *data, size_t size, bool apply)
+{
+    RecordReader reader(data, size);
+    const uint8_t *magic;
+    uint32_t version;
+    if (!reader.Bytes(sizeof(DeltaMagic) - 1, &magic) || (std::memcmp(magic, DeltaMagic, sizeof(DeltaMagic) - 1) != 0) ||
+        !reader.U32(&version)) {
+        return Fail(DeltaStatus::CorruptDelta, "not a rootfs delta");
+    }
+
+    if (version != DeltaVersion) {
+        return Fail(DeltaStatus::CorruptDelta, "unsupported rootfs delta version " + std::to_string(version));
+    }
+
+    const auto corrupt = [this](const std::string &what) {
+        return Fail(DeltaStatus::CorruptDelta, "corrupt rootfs delta: " + what);
+    };
+
+    TarEntry entry;
+    std::string normalized;
+    std::vector<uint8_t> base;
+    std::vector<uint8_t> result;
+    for (;;) {
+        uint8_t op;
+        if (!reader.U8(&op)) {
+            return corrupt("truncated");
+        }
+
+        if (op == '.') {
+            return DeltaStatus::Ok;
+        }
+
+        switch (op) {
+        case 'D':
+            if (!reader.String(&entry.path) || !NormalizeTreePath(entry.path, &normalized)) {
+                return corrupt("bad removal");
+            }
+
+            if (apply) {
+                if (!_tree.Remove(entry.path)) {
+                    return Fail(DeltaStatus::IoError, _tree.Error());
+                }
+
+                _stats.removed += 1;
+            }
+
+            break;
+
+        case 'E': {
+            uint64_t contentSize;
+            const uint8_t *content;
+            if (!reader.Meta(&entry) || !NormalizeTreePath(entry.path, &normalized) || !reader.U64(&contentSize) ||
+                !reader.Bytes(static_cast<size_t>(contentSize), &content)) {
+                return corrupt("bad entry");
+            }
+
+            if (apply) {
+                const bool written = entry.IsRegularFile()
+                                         ? (_tree.BeginFile(entry) && _tree.WriteFile(content, contentSize) &&
+                                            _tree.EndFile())
+                                         : _tree.Create(entry);
+                if (!written) {
+                    return Fail(DeltaStatus::IoError, _tree.Error());
+                }
+
+                _stats.created += 1;
+            }
+
+            break;
+        }
+
+        case 'M':
+            if (!reader.Meta(&entry) || !NormalizeTreePath(entry.path, &normalized)) {
+                return corrupt("bad metadata update");
+            }
+
+            if (apply) {
+                if (!_tree.SetMetadata(entry)) {
+                    return Fail(DeltaStatus::IoError, _tree.Error());
+                }
+
+                _stats.updated += 1;
+            }
+
+            break;
+
+        case 'P': {
+            const uint8_t *baseHash;
+            const uint8_t *resultHash;
+            uint64_t resultSize;
+            if (!reader.Meta(&entry) || !NormalizeTreePath(entry.path, &normalized) || !entry.IsRegularFile() ||
+                !reader.Bytes(Sha256::DigestSize, &baseHash) || !reader.U64(&resultSize) ||
+                !reader.Bytes(Sha256::DigestSize, &resultHash)) {
+                return corrupt("bad patch");
+            }
+
+            uint8_t digest[Sha256::DigestSize];
+            if (!_tree.ReadFile(entry.path, &base)) {
+                return Fail(DeltaStatus::BaseMismatch, _tree.Error());
+            }
+
+            if (!apply) {
+                Hash(base.data(), base.size(), digest);
+                if (std::memcmp(digest, baseHash, sizeof(digest)) != 0) {
+                    return Fail(DeltaStatus::BaseMismatch, entry.path + " is not the version the delta applies to");
+                }
+            }
+
+            result.clear();
+            for (;;) {
+                uint8_t instruction;
+                uint64_t offset;
+                uint64_t length;
+                const uint8_t *inserted;
+                if (!reader.U8(&instruction)) {
+                    return corrupt("truncated patch");
+                }
+
+                if (instruction == '.') {
+                    break;
+                }
+
+                if (instruction == 'C') {
+                    if (!reader.U64(&offset) || !reader.U64(&length) || (offset > base.size()) ||
+                        (length > base.size() - offset)) {
+                        return corrupt("patch of " + entry.path + " copies past its end");
+                    }
+
+                    result.insert(result.end(), base.begin() + offset, base.begin() + offset + length);
+
+                } else if (instruction == 'I') {
+                    if (!reader.U64(&length) || !reader.Bytes(static_cast<size_t>(length), &inserted)) {
+                        return corrupt("truncated patch");
+                    }
+
+                    result.insert(result.end(), inserted, inserted + length);
+
+                } else {
+                    return corrupt("unknown patch instruction");
+                }
+
+                if (result.size() > resultSize) {
+                    return corrupt("patch of " + entry.path + " overflows");
+                }
+            }
+
+            Hash(result.data(), result.size(), digest);
+            if ((result.size() != resultSize) || (std::memcmp(digest, resultHash, sizeof(digest)) != 0)) {
+                return corrupt("patch of " + entry.path + " does not produce the expected content");
+            }
+
+            if (apply) {
+                if (!_tree.BeginFile(entry) || !_tree.WriteFile(result.data(), result.size()) || !_tree.EndFile()) {
+                    return Fail(DeltaStatus::IoError, _tree.Error());
+                }
+
+                _stats.patched += 1;
+            }
+
+            break;
+        }
+
+        default:
+            return corrupt("unknown record");
+        }
+    }
+}
@@ -0,0 +1,61 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include "TreeWriter.h"
+
+enum class DeltaStatus
+{
+    Ok,
+    IoError,
+    CorruptDelta,
+    BaseMismatch,
+};
+
+struct DeltaStats
+{
+    uint64_t deltaBytes = 0;
+    uint64_t removed = 0;
+    uint64_t created = 0;
+    uint64_t updated = 0;
+    uint64_t patched = 0;
+};
+
+// Applies a delta written by `prepare-build delta` to a tree extracted from
+// the rootfs it was computed from, turning it in place into the newer rootfs.
+// See delta.go for the format.
+//
+// The delta is checked in full before the tree is touched: every record must
+// be well formed, and every file it patches must hash to the content the
+// delta was computed against. Patched files are hashed again once rebuilt.
+class DeltaApplier
+{
+  public:
+    explicit DeltaApplier(std::filesystem::path root);
+
+    // Applies a delta file, compressed with gzip, zstd or xz.
+    DeltaStatus Apply(const std::filesystem::path &delta);
+
+    // Applies the decompressed records of a delta.
+    DeltaStatus Apply(const uint8_t *data, size_t size);
+
+    const DeltaStats &Stats() const { return _stats; }
+    const TreeWriterStats &TreeStats() const { return _tree.Stats(); }
+    const std::string &Error() const { return _error; }
+
+  private:
+    DeltaStatus Run(const uint8_t *data, size_t size, bool apply);
+    DeltaStatus Fail(DeltaStatus status, const std::string &error);
+
+    TreeWriter _tree;
+    DeltaStats _stats;
+    std::string _error;
+};
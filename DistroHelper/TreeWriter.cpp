@@ -0,0 +1,518 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "TreeWriter.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <utility>
+
+namespace {
+    const char XattrPrefix[] = "SCHILY.xattr.";
+
+    bool Exists(const std::string &path, struct stat *status)
+    {
+        return ::lstat(path.c_str(), status) == 0;
+    }
+}
+
+bool NormalizeTreePath(const std::string &path, std::string *normalized)
+{
+    normalized->clear();
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+
+        const std::string component = path.substr(start, end - start);
+        start = end + 1;
+        if (component.empty() || (component == ".")) {
+            continue;
+        }
+
+        if (component == "..") {
+            return false;
+        }
+
+        if (!normalized->empty()) {
+            *normalized += '/';
+        }
+
+        *normalized += component;
+    }
+
+    return true;
+}
+
+TreeWriter::TreeWriter(std::filesystem::path root) :
+    _root(std::move(root)),
+    _setOwners(::geteuid() == 0)
+{
+}
+
+TreeWriter::~TreeWriter()
+{
+    AbortFile();
+}
+
+bool TreeWriter::Fail(const std::string &error)
+{
+    _error = error;
+    return false;
+}
+
+bool TreeWriter::FailErrno(const std::string &what, const std::string &path)
+{
+    return Fail("cannot " + what + " " + path + ": " + std::strerror(errno));
+}
+
+bool TreeWriter::Resolve(const std::string &path, std::string *full)
+{
+    std::string relative;
+    if (!NormalizeTreePath(path, &relative)) {
+        return Fail("path " + path + " leaves the tree");
+    }
+
+    *full = _root.string();
+    if (relative.empty()) {
+        return true;
+    }
+
+    // Check every parent once per run of entries in the same directory,
+    // creating the missing ones like tar does.
+    const size_t slash = relative.rfind('/');
+    const std::string parent = (slash == std::string::npos) ? std::string() : relative.substr(0, slash);
+    if (!parent.empty() && (parent != _checkedDirectory)) {
+        std::string current = *full;
+        size_t start = 0;
+        while (start < parent.size()) {
+            size_t end = parent.find('/', start);
+            if (end == std::string::npos) {
+                end = parent.size();
+            }
+
+            current += '/';
+            current.append(parent, start, end - start);
+            start = end + 1;
+            struct stat status;
+            if (!Exists(current, &status)) {
+                if (errno != ENOENT) {
+                    return FailErrno("inspect", current);
+                }
+
+                KeepParentTime(current);
+                if ((::mkdir(current.c_str(), 0755) != 0) && (errno != EEXIST)) {
+                    return FailErrno("create directory", current);
+                }
+
+            } else if (!S_ISDIR(status.st_mode)) {
+                return Fail("path " + path + " goes through " + current + ", which is not a directory");
+            }
+        }
+
+        _checkedDirectory = parent;
+    }
+
+    *full += '/';
+    *full += relative;
+    return true;
+}
+
+bool TreeWriter::RemoveExisting(const std::string &full, bool keepDirectory)
+{
+    struct stat status;
+    if (!Exists(full, &status)) {
+        return (errno == ENOENT) || FailErrno("inspect", full);
+    }
+
+    if (S_ISDIR(status.st_mode) && keepDirectory) {
+        return true;
+    }
+
+    KeepParentTime(full);
+    if (S_ISDIR(status.st_mode)) {
+        std::error_code error;
+        std::filesystem::remove_all(full, error);
+        _checkedDirectory.clear();
+        if (error) {
+            return Fail("cannot remove " + full + ": " + error.message());
+        }
+
+        // Times kept for the directory or below would otherwise be set on
+        // whatever takes its place.
+        _directoryTimes.erase(full);
+        const std::string prefix = full + '/';
+        auto it = _directoryTimes.lower_bound(prefix);
+        while ((it != _directoryTimes.end()) && (it->first.compare(0, prefix.size(), prefix) == 0)) {
+            it = _directoryTimes.erase(it);
+        }
+
+        return true;
+    }
+
+    if (::unlink(full.c_str()) != 0) {
+        return FailErrno("remove", full);
+    }
+
+    return true;
+}
+
+void TreeWriter::KeepParentTime(const std::string &full)
+{
+    const size_t slash = full.rfind('/');
+    if ((slash == std::string::npos) || (full.size() <= _root.string().size())) {
+        return;
+    }
+
+    const std::string parent = full.substr(0, slash);
+    struct stat status;
+    if ((_directoryTimes.find(parent) == _directoryTimes.end()) && Exists(parent, &status)) {
+        _directoryTimes.emplace(parent, status.st_mtim);
+    }
+}
+
+bool TreeWriter::Remove(const std::string &path)
+{
+    std::string full;
+    if (!Resolve(path, &full)) {
+        return false;
+    }
+
+    if (full == _root.string()) {
+        return Fail("cannot remove the root of the tree");
+    }
+
+    if (!RemoveExisting(full, false)) {
+        return false;
+    }
+
+    _stats.removed += 1;
+    return true;
+}
+
+bool TreeWriter::ApplyMetadata(const std::string &full, const TarEntry &entry)
+{
+    // Changing the owner clears the set-id bits and file capabilities, so it
+    // comes before the mode and the extended attributes.
+    const bool isLink = (entry.type == '2');
+    if (_setOwners && (::lchown(full.c_str(), entry.uid, entry.gid) != 0)) {
+        return FailErrno("change the owner of", full);
+    }
+
+    for (const auto &record : entry.paxRecords) {
+        if (record.first.compare(0, sizeof(XattrPrefix) - 1, XattrPrefix) != 0) {
+            continue;
+        }
+
+        // Unprivileged runs cannot set most namespaces; neither can file
+        // systems without extended attributes.
+        const std::string name = record.first.substr(sizeof(XattrPrefix) - 1);
+        if ((::lsetxattr(full.c_str(), name.c_str(), record.second.data(), record.second.size(), 0) != 0) &&
+            _setOwners && (errno != ENOTSUP)) {
+            return FailErrno("set attribute " + name + " on", full);
+        }
+    }
+
+    if (!isLink && (::chmod(full.c_str(), entry.mode & 07777) != 0)) {
+        return FailErrno("change the mode of", full);
+    }
+
+    if (entry.type == '5') {
+        struct timespec time;
+        time.tv_sec = static_cast<time_t>(entry.mtime);
+        time.tv_nsec = 0;
+        _directoryTimes[full] = time;
+        return true;
+    }
+
+    struct timespec times[2];
+    times[0].tv_sec = static_cast<time_t>(entry.mtime);
+    times[0].tv_nsec = 0;
+    times[1] = times[0];
+    if (::utimensat(AT_FDCWD, full.c_str(), times, AT_SYMLINK_NOFOLLOW) != 0) {
+        return FailErrno("set the time of", full);
+    }
+
+    return true;
+}
+
+bool TreeWriter::SetMetadata(const TarEntry &entry)
+{
+    std::string full;
+    if (!Resolve(entry.path, &full)) {
+        return false;
+    }
+
+    struct stat status;
+    if (!Exists(full, &status)) {
+        return FailErrno("update", full);
+    }
+
+    return ApplyMetadata(full, entry);
+}
+
+bool TreeWriter::Create(const TarEntry &entry)
+{
+    if (entry.IsRegularFile()) {
+        return BeginFile(entry) && EndFile();
+    }
+
+    std::string full;
+    if (!Resolve(entry.path, &full)) {
+        return false;
+    }
+
+    switch (entry.type) {
+    case '5': {
+        struct stat status;
+        if (!RemoveExisting(full, true)) {
+            return false;
+        }
+
+        if (!Exists(full, &status)) {
+            KeepParentTime(full);
+            if (::mkdir(full.c_str(), 0700) != 0) {
+                return FailErrno("create directory", full);
+            }
+        }
+
+        break;
+    }
+
+    case '2':
+        if (!RemoveExisting(full, false)) {
+            return false;
+        }
+
+        KeepParentTime(full);
+        if (::symlink(entry.linkTarget.c_str(), full.c_str()) != 0) {
+            return FailErrno("create symbolic link", full);
+        }
+
+        break;
+
+    case '1': {
+        // Hard links share the metadata of their target.
+        std::string target;
+        if (!Resolve(entry.linkTarget, &target) || !RemoveExisting(full, false)) {
+            return false;
+        }
+
+        KeepParentTime(full);
+        if (::link(target.c_str(), full.c_str()) != 0) {
+            return FailErrno("create hard link", full);
+        }
+
+        _stats.written += 1;
+        return true;
+    }
+
+    case '6':
+        if (!RemoveExisting(full, false)) {
+            return false;
+        }
+
+        KeepParentTime(full);
+        if (::mkfifo(full.c_str(), 0600) != 0) {
+            return FailErrno("create fifo", full);
+        }
+
+        break;
+
+    default:
+        _stats.skipped += 1;
+        return true;
+    }
+
+    if (!ApplyMetadata(full, entry)) {
+        return false;
+    }
+
+    _stats.written += 1;
+    return true;
+}
+
+bool TreeWriter::BeginFile(const TarEntry &entry)
+{
+    AbortFile();
+    if (!Resolve(entry.path, &_filePath)) {
+        return false;
+    }
+
+    if (_filePath == _root.string()) {
+        return Fail("the root of the tree cannot be a file");
+    }
+
+    const size_t slash = _filePath.rfind('/');
+    std::string temporary = _filePath.substr(0, slash + 1) + "." + _filePath.substr(slash + 1) + ".wsl-XXXXXX";
+    KeepParentTime(_filePath);
+    _file = ::mkstemp(&temporary[0]);
+    if (_file < 0) {
+        return FailErrno("create", temporary);
+    }
+
+    _temporaryPath = temporary;
+    _fileEntry = entry;
+    return true;
+}
+
+bool TreeWriter::WriteFile(const uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t written = ::write(_file, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            const bool result = FailErrno("write", _filePath);
+            AbortFile();
+            return result;
+        }
+
+        data += written;
+        size -= static_cast<size_t>(written);
+        _stats.bytes += static_cast<uint64_t>(written);
+    }
+
+    return true;
+}
+
+bool TreeWriter::EndFile()
+{
+    const int file = _file;
+    _file = -1;
+    if (::close(file) != 0) {
+        const bool result = FailErrno("write", _filePath);
+        ::unlink(_temporaryPath.c_str());
+        return result;
+    }
+
+    // A directory in the way is replaced too.
+    struct stat status;
+    if (Exists(_filePath, &status) && S_ISDIR(status.st_mode) && !RemoveExisting(_filePath, false)) {
+        ::unlink(_temporaryPath.c_str());
+        return false;
+    }
+
+    if (::rename(_temporaryPath.c_str(), _filePath.c_str()) != 0) {
+        const bool result = FailErrno("replace", _filePath);
+        ::unlink(_temporaryPath.c_str());
+        return result;
+    }
+
+    if (!ApplyMetadata(_filePath, _fileEntry)) {
+        return false;
+    }
+
+    _stats.written += 1;
+    return true;
+}
+
+void TreeWriter::AbortFile()
+{
+    if (_file >= 0) {
+        ::close(_file);
+        ::unlink(_temporaryPath.c_str());
+        _file = -1;
+    }
+}
+
+bool TreeWriter::ReadFile(const std::string &path, std::vector<uint8_t> *content)
+{
+    std::string full;
+    if (!Resolve(path, &full)) {
+        return false;
+    }
+
+    const int file = ::open(full.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (file < 0) {
+        return FailErrno("open", full);
+    }
+
+    struct stat status;
+    if ((::fstat(file, &status) != 0) || !S_ISREG(status.st_mode)) {
+        ::close(file);
+        return Fail(full + " is not a regular file");
+    }
+
+    content->resize(static_cast<size_t>(status.st_size));
+    size_t done = 0;
+    while (done < content->size()) {
+        const ssize_t count = ::read(file, content->data() + done, content->size() - done);
+        if ((count < 0) && (errno == EINTR)) {
+            continue;
+        }
+
+        if (count <= 0) {
+            const bool result = (count == 0) ? Fail(full + " shrank while being read") : FailErrno("read", full);
+            ::close(file);
+            return result;
+        }
+
+        done += static_cast<size_t>(count);
+    }
+
+    ::close(file);
+    return true;
+}
+
+bool TreeWriter::Finish()
+{
+    for (const auto &directory : _directoryTimes) {
+        struct timespec times[2];
+        times[0] = directory.second;
+        times[1] = directory.second;
+        if ((::utimensat(AT_FDCWD, directory.first.c_str(), times, AT_SYMLINK_NOFOLLOW) != 0) && (errno != ENOENT)) {
+            return FailErrno("set the time of", directory.first);
+        }
+    }
+
+    _directoryTimes.clear();
+    return true;
+}
+
+TreeExtractor::TreeExtractor(TreeWriter &tree) :
+    _tree(tree)
+{
+}
+
+bool TreeExtractor::OnEntry(const TarEntry &entry)
+{
+    if (entry.IsRegularFile()) {
+        _inFile = _tree.BeginFile(entry);
+        return _inFile;
+    }
+
+    return _tree.Create(entry);
+}
+
+bool TreeExtractor::OnData(const uint8_t *data, size_t size)
+{
+    return !_inFile || _tree.WriteFile(data, size);
+}
+
+bool TreeExtractor::OnEntryEnd()
+{
+    if (!_inFile) {
+        return true;
+    }
+
+    _inFile = false;
+    return _tree.EndFile();
+}
+
+bool TreeExtractor::OnArchiveEnd()
+{
+    return _tree.Finish();
+}
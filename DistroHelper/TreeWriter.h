@@ -0,0 +1,113 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+#include "TarStream.h"
+
+// Turns an archive path into one relative to the root of a tree: leading
+// slashes and "." components are dropped. Fails on ".." components, which
+// would point outside the tree. The root itself is the empty path.
+bool NormalizeTreePath(const std::string &path, std::string *normalized);
+
+struct TreeWriterStats
+{
+    uint64_t removed = 0;
+    uint64_t written = 0;
+    uint64_t bytes = 0;
+    uint64_t skipped = 0;
+};
+
+// Creates, replaces and removes the nodes of an extracted rootfs tree, from
+// entries described as in a tar archive. Files are written to a temporary
+// name next to their destination and renamed over it, so that a file is
+// either in its previous or its new state. Intermediate components of a path
+// must be real directories: a tree is never written through a symbolic link.
+//
+// Owners are only applied when running as root. Device nodes are skipped, as
+// WSL populates /dev when the distribution starts. Directory times are set
+// by Finish(), once their content no longer changes; directories that are
+// modified without being given a time get their previous one back.
+class TreeWriter
+{
+  public:
+    explicit TreeWriter(std::filesystem::path root);
+    ~TreeWriter();
+
+    TreeWriter(const TreeWriter &) = delete;
+    TreeWriter &operator=(const TreeWriter &) = delete;
+
+    // Removes a node, with its content if it is a directory. A missing node is not an error.
+    bool Remove(const std::string &path);
+
+    // Creates or replaces a node other than a regular file, and applies the
+    // metadata of entry to it. Directories that already exist are kept.
+    bool Create(const TarEntry &entry);
+
+    // Creates or replaces a regular file, written in between by WriteFile().
+    bool BeginFile(const TarEntry &entry);
+    bool WriteFile(const uint8_t *data, size_t size);
+    bool EndFile();
+
+    // Applies the mode, owner, extended attributes and time of entry to an existing node.
+    bool SetMetadata(const TarEntry &entry);
+
+    bool ReadFile(const std::string &path, std::vector<uint8_t> *content);
+
+    // Sets the times of the directories written so far.
+    bool Finish();
+
+    const std::filesystem::path &Root() const { return _root; }
+    const TreeWriterStats &Stats() const { return _stats; }
+    const std::string &Error() const { return _error; }
+
+  private:
+    bool Resolve(const std::string &path, std::string *full);
+    bool RemoveExisting(const std::string &full, bool keepDirectory);
+    bool ApplyMetadata(const std::string &full, const TarEntry &entry);
+    void KeepParentTime(const std::string &full);
+    void AbortFile();
+    bool Fail(const std::string &error);
+    bool FailErrno(const std::string &what, const std::string &path);
+
+    std::filesystem::path _root;
+    bool _setOwners = false;
+    std::string _checkedDirectory;
+    std::map<std::string, struct timespec> _directoryTimes;
+
+    int _file = -1;
+    std::string _filePath;
+    std::string _temporaryPath;
+    TarEntry _fileEntry;
+
+    TreeWriterStats _stats;
+    std::string _error;
+};
+
+// Extracts the entries of a tar stream into a tree, the last of duplicate
+// entries winning as with tar itself.
+class TreeExtractor : public TarSink
+{
+  public:
+    explicit TreeExtractor(TreeWriter &tree);
+
+    bool OnEntry(const TarEntry &entry) override;
+    bool OnData(const uint8_t *data, size_t size) override;
+    bool OnEntryEnd() override;
+    bool OnArchiveEnd() override;
+
+  private:
+    TreeWriter &_tree;
+    bool _inFile = false;
+};
@@ -0,0 +1,629 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "UserDatabase.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+namespace {
+    // How long to wait for another tool to release the files, like lckpwdf().
+    constexpr auto LockTimeout = std::chrono::seconds(15);
+
+    std::vector<std::string> Split(const std::string &text, char separator)
+    {
+        std::vector<std::string> fields;
+        size_t start = 0;
+        for (;;) {
+            const size_t end = text.find(separator, start);
+            fields.push_back(text.substr(start, end - start));
+            if (end == std::string::npos) {
+                return fields;
+            }
+
+            start = end + 1;
+        }
+    }
+
+    std::string Join(const std::vector<std::string> &fields, char separator)
+    {
+        std::string text;
+        for (size_t i = 0; i < fields.size(); i += 1) {
+            if (i != 0) {
+                text += separator;
+            }
+
+            text += fields[i];
+        }
+
+        return text;
+    }
+
+    // Returns the index of the line whose first field is name, or -1.
+    ptrdiff_t Find(const std::vector<std::string> &lines, const std::string &name)
+    {
+        for (size_t i = 0; i < lines.size(); i += 1) {
+            if ((lines[i].compare(0, name.size(), name) == 0) && (lines[i].size() > name.size()) &&
+                (lines[i][name.size()] == ':')) {
+                return static_cast<ptrdiff_t>(i);
+            }
+        }
+
+        return -1;
+    }
+
+    // Collects the numeric IDs in one field of every line.
+    std::set<uint32_t> UsedIds(const std::vector<std::string> &lines, size_t field)
+    {
+        std::set<uint32_t> ids;
+        for (const std::string &line : lines) {
+            const std::vector<std::string> fields = Split(line, ':');
+            if (fields.size() > field) {
+                ids.insert(static_cast<uint32_t>(std::strtoul(fields[field].c_str(), nullptr, 10)));
+            }
+        }
+
+        return ids;
+    }
+
+    bool FirstFree(const std::set<uint32_t> &used, uint32_t first, uint32_t last, uint32_t *id)
+    {
+        for (uint32_t candidate = first; candidate <= last; candidate += 1) {
+            if (used.count(candidate) == 0) {
+                *id = candidate;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Adds or removes name in the comma-separated list of a field, creating
+    // the field if the line is short of it.
+    bool EditMembers(std::string *line, size_t field, const std::string &name, bool add)
+    {
+        std::vector<std::string> fields = Split(*line, ':');
+        if (fields.size() <= field) {
+            fields.resize(field + 1);
+        }
+
+        std::vector<std::string> members;
+        if (!fields[field].empty()) {
+            members = Split(fields[field], ',');
+        }
+
+        const auto it = std::find(members.begin(), members.end(), name);
+        if (add == (it != members.end())) {
+            return false;
+        }
+
+        if (add) {
+            members.push_back(name);
+
+        } else {
+            members.erase(it);
+        }
+
+        fields[field] = Join(members, ',');
+        *line = Join(fields, ':');
+        return true;
+    }
+}
+
+bool IsValidUserName(const std::string &name)
+{
+    if (name.empty() || (name.size() > 32) || !(((name[0] >= 'a') && (name[0] <= 'z')) || (name[0] == '_'))) {
+        return false;
+    }
+
+    for (size_t i = 1; i < name.size(); i += 1) {
+        const char c = name[i];
+        const bool valid = ((c >= 'a') && (c <= 'z')) || ((c >= '0') && (c <= '9')) || (c == '-') || (c == '_') ||
+                           ((c == '$') && (i == name.size() - 1));
+        if (!valid) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// One of the account files, as read and as it is to be written.
+struct UserDatabase::File
+{
+    explicit File(const char *fileName) :
+        name(fileName)
+    {
+    }
+
+    std::string name;
+    std::string path;
+    std::string original;
+    std::vector<std::string> lines;
+    bool exists = false;
+    bool changed = false;
+    mode_t mode = 0644;
+    uid_t owner = 0;
+    gid_t group = 0;
+};
+
+UserDatabase::UserDatabase(std::filesystem::path root) :
+    _root(std::move(root))
+{
+}
+
+UserDatabase::~UserDatabase()
+{
+    Unlock();
+}
+
+UserStatus UserDatabase::Fail(UserStatus status, const std::string &error)
+{
+    _error = error;
+    return status;
+}
+
+UserStatus UserDatabase::FailErrno(const std::string &what, const std::string &path)
+{
+    return Fail(UserStatus::IoError, "cannot " + what + " " + path + ": " + std::strerror(errno));
+}
+
+bool UserDatabase::Lock()
+{
+    const std::string path = (_root / "etc/.pwd.lock").string();
+    _lock = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+    if (_lock < 0) {
+        FailErrno("open", path);
+        return false;
+    }
+
+    struct flock lock = {};
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    const auto deadline = std::chrono::steady_clock::now() + LockTimeout;
+    while (::fcntl(_lock, F_SETLK, &lock) != 0) {
+        if (((errno != EACCES) && (errno != EAGAIN)) || (std::chrono::steady_clock::now() >= deadline)) {
+            FailErrno("lock", path);
+            Unlock();
+            return false;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    return true;
+}
+
+void UserDatabase::Unlock()
+{
+    if (_lock >= 0) {
+        ::close(_lock);
+        _lock = -1;
+    }
+}
+
+bool UserDatabase::Load(File *file)
+{
+    file->path = (_root / "etc" / file->name).string();
+    struct stat status;
+    if (::stat(file->path.c_str(), &status) != 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+
+        FailErrno("stat", file->path);
+        return false;
+    }
+
+    std::ifstream stream(file->path, std::ios::binary);
+    std::ostringstream content;
+    if (!(content << stream.rdbuf()) && (status.st_size != 0)) {
+        FailErrno("read", file->path);
+        return false;
+    }
+
+    file->exists = true;
+    file->mode = status.st_mode & 07777;
+    file->owner = status.st_uid;
+    file->group = status.st_gid;
+    file->original = content.str();
+    for (const std::string &line : Split(file->original, '\n')) {
+        if (!line.empty()) {
+            file->lines.push_back(line);
+        }
+    }
+
+    return true;
+}
+
+std::string UserDatabase::Setting(const char *file, const char *key, const std::string &fallback)
+{
+    // Reads both "KEY value" (login.defs) and KEY="value" (adduser.conf).
+    std::ifstream stream(_root / "etc" / file);
+    const size_t length = std::strlen(key);
+    std::string line;
+    std::string value = fallback;
+    while (std::getline(stream, line)) {
+        const size_t start = line.find_first_not_of(" \t");
+        if ((start == std::string::npos) || (line.compare(start, length, key) != 0)) {
+            continue;
+        }
+
+        size_t next = start + length;
+        if ((next >= line.size()) || ((line[next] != '=') && (line[next] != ' ') && (line[next] != '\t'))) {
+            continue;
+        }
+
+        next = line.find_first_not_of(" \t=", next);
+        if (next == std::string::npos) {
+            continue;
+        }
+
+        value = line.substr(next, line.find_first_of(" \t#", next) - next);
+        value.erase(std::remove(value.begin(), value.end(), '"'), value.end());
+    }
+
+    return value;
+}
+
+bool UserDatabase::Commit(std::vector<File *> files)
+{
+    // Write every changed file and its backup before renaming any of them,
+    // so that a failure rarely leaves the files inconsistent with each other.
+    const auto write = [this](const std::string &path, const File &file, const std::string &content) {
+        const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600);
+        if (fd < 0) {
+            FailErrno("create", path);
+            return false;
+        }
+
+        bool written = (::geteuid() != 0) || (::fchown(fd, file.owner, file.group) == 0);
+        written = written && (::fchmod(fd, file.mode) == 0);
+        for (size_t offset = 0; written && (offset < content.size());) {
+            const ssize_t count = ::write(fd, content.data() + offset, content.size() - offset);
+            if ((count < 0) && (errno == EINTR)) {
+                continue;
+            }
+
+            written = count > 0;
+            offset += written ? static_cast<size_t>(count) : 0;
+        }
+
+        written = written && (::fsync(fd) == 0);
+        if (!written) {
+            FailErrno("write", path);
+        }
+
+        ::close(fd);
+        if (!written) {
+            ::unlink(path.c_str());
+        }
+
+        return written;
+    };
+
+    files.erase(std::remove_if(files.begin(), files.end(), [](const File *file) { return !file->changed; }),
+                files.end());
+    for (const File *file : files) {
+        std::string content;
+        for (const std::string &line : file->lines) {
+            content += line;
+            content += '\n';
+        }
+
+        if (!write(file->path + "-", *file, file->original) || !write(file->path + "+", *file, content)) {
+            for (const File *written : files) {
+                ::unlink((written->path + "+").c_str());
+            }
+
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < files.size(); i += 1) {
+        if (::rename((files[i]->path + "+").c_str(), files[i]->path.c_str()) != 0) {
+            FailErrno("replace", files[i]->path);
+            for (size_t j = 0; j < files.size(); j += 1) {
+                if (j < i) {
+                    ::rename((files[j]->path + "-").c_str(), files[j]->path.c_str());
+
+                } else {
+                    ::unlink((files[j]->path + "+").c_str());
+                }
+            }
+
+            return false;
+        }
+    }
+
+    const std::string directory = (_root / "etc").string();
+    const int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+
+    return true;
+}
+
+bool UserDatabase::CreateHome(const std::string &home, uint32_t uid, uint32_t gid)
+{
+    const std::filesystem::path path = _root / std::filesystem::path(home).relative_path();
+    struct stat status;
+    if (::lstat(path.c_str(), &status) == 0) {
+        return true;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    const mode_t mode = static_cast<mode_t>(std::strtoul(Setting("adduser.conf", "DIR_MODE", "0750").c_str(), nullptr, 8));
+    if (::mkdir(path.c_str(), 0700) != 0) {
+        FailErrno("create", path.string());
+        return false;
+    }
+
+    const bool setOwners = ::geteuid() == 0;
+    const std::filesystem::path skel = _root / std::filesystem::path(Setting("adduser.conf", "SKEL", "/etc/skel")).relative_path();
+    auto entries = std::filesystem::recursive_directory_iterator(skel, error);
+    for (; !error && (entries != std::filesystem::recursive_directory_iterator()); entries.increment(error)) {
+        const std::filesystem::path target = path / std::filesystem::relative(entries->path(), skel);
+        if (::lstat(entries->path().c_str(), &status) != 0) {
+            continue;
+        }
+
+        if (S_ISDIR(status.st_mode)) {
+            std::filesystem::create_directory(target, error);
+
+        } else if (S_ISLNK(status.st_mode)) {
+            std::filesystem::copy_symlink(entries->path(), target, error);
+
+        } else if (S_ISREG(status.st_mode)) {
+            std::filesystem::copy_file(entries->path(), target, error);
+        }
+
+        if (error) {
+            break;
+        }
+
+        if (setOwners && (::lchown(target.c_str(), uid, gid) != 0)) {
+            FailErrno("change the owner of", target.string());
+            return false;
+        }
+
+        if (!S_ISLNK(status.st_mode)) {
+            ::chmod(target.c_str(), status.st_mode & 07777);
+        }
+    }
+
+    if (error && (error != std::errc::no_such_file_or_directory)) {
+        Fail(UserStatus::IoError, "cannot copy " + skel.string() + ": " + error.message());
+        return false;
+    }
+
+    if ((setOwners && (::chown(path.c_str(), uid, gid) != 0)) || (::chmod(path.c_str(), mode & 07777) != 0)) {
+        FailErrno("set up", path.string());
+        return false;
+    }
+
+    return true;
+}
+
+UserStatus UserDatabase::AddUser(const NewUser &user, uint32_t *uid)
+{
+    _skippedGroups.clear();
+    if (!IsValidUserName(user.name)) {
+        return Fail(UserStatus::InvalidName, "invalid user name " + user.name);
+    }
+
+    if (!Lock()) {
+        return UserStatus::IoError;
+    }
+
+    File passwd("passwd");
+    File shadow("shadow");
+    File group("group");
+    File gshadow("gshadow");
+    for (File *file : {&passwd, &shadow, &group, &gshadow}) {
+        if (!Load(file)) {
+            Unlock();
+            return UserStatus::IoError;
+        }
+    }
+
+    if (!passwd.exists || !group.exists) {
+        Unlock();
+        return Fail(UserStatus::IoError, "the tree has no " + std::string(passwd.exists ? group.path : passwd.path));
+    }
+
+    if ((Find(passwd.lines, user.name) >= 0) || (Find(group.lines, user.name) >= 0)) {
+        Unlock();
+        return Fail(UserStatus::Exists, "user or group " + user.name + " already exists");
+    }
+
+    // Like adduser, pick the first free UID, and the GID equal to it if free.
+    const auto number = [this](const char *key, const char *loginKey, const char *fallback) {
+        return static_cast<uint32_t>(std::strtoul(Setting("adduser.conf", key, Setting("login.defs", loginKey, fallback)).c_str(), nullptr, 10));
+    };
+
+    const std::set<uint32_t> usedUids = UsedIds(passwd.lines, 2);
+    const std::set<uint32_t> usedGids = UsedIds(group.lines, 2);
+    uint32_t newUid;
+    uint32_t newGid;
+    if (!FirstFree(usedUids, number("FIRST_UID", "UID_MIN", "1000"), number("LAST_UID", "UID_MAX", "59999"), &newUid)) {
+        Unlock();
+        return Fail(UserStatus::NoFreeId, "no free UID left");
+    }
+
+    if ((usedGids.count(newUid) == 0) && (newUid >= number("FIRST_GID", "GID_MIN", "1000")) &&
+        (newUid <= number("LAST_GID", "GID_MAX", "59999"))) {
+        newGid = newUid;
+
+    } else if (!FirstFree(usedGids, number("FIRST_GID", "GID_MIN", "1000"), number("LAST_GID", "GID_MAX", "59999"), &newGid)) {
+        Unlock();
+        return Fail(UserStatus::NoFreeId, "no free GID left");
+    }
+
+    const std::string home = Setting("adduser.conf", "DHOME", "/home") + "/" + user.name;
+    const std::string shell = Setting("adduser.conf", "DSHELL", "/bin/bash");
+    const std::string days = std::to_string(std::time(nullptr) / 86400);
+    passwd.lines.push_back(user.name + (shadow.exists ? ":x:" : ":!:") + std::to_string(newUid) + ":" +
+                           std::to_string(newGid) + ":,,,:" + home + ":" + shell);
+    passwd.changed = true;
+    if (shadow.exists) {
+        shadow.lines.push_back(user.name + ":!:" + days + ":" + Setting("login.defs", "PASS_MIN_DAYS", "0") + ":" +
+                               Setting("login.defs", "PASS_MAX_DAYS", "99999") + ":" +
+                               Setting("login.defs", "PASS_WARN_AGE", "7") + ":::");
+        shadow.changed = true;
+    }
+
+    group.lines.push_back(user.name + ":x:" + std::to_string(newGid) + ":");
+    group.changed = true;
+    if (gshadow.exists) {
+        gshadow.lines.push_back(user.name + ":!::");
+        gshadow.changed = true;
+    }
+
+    for (const std::string &name : user.groups) {
+        const ptrdiff_t line = Find(group.lines, name);
+        if (!IsValidUserName(name) || (line < 0)) {
+            _skippedGroups.push_back(name);
+            continue;
+        }
+
+        EditMembers(&group.lines[line], 3, user.name, true);
+        const ptrdiff_t shadowLine = Find(gshadow.lines, name);
+        if (shadowLine >= 0) {
+            EditMembers(&gshadow.lines[shadowLine], 3, user.name, true);
+        }
+    }
+
+    // The home directory comes first, so that a failure leaves no account
+    // behind; one that already exists is left as it is, like adduser does.
+    const std::filesystem::path homePath = _root / std::filesystem::path(home).relative_path();
+    const bool homeExisted = std::filesystem::exists(std::filesystem::symlink_status(homePath));
+    if (!CreateHome(home, newUid, newGid)) {
+        Unlock();
+        return UserStatus::IoError;
+    }
+
+    if (!Commit({&group, &gshadow, &passwd, &shadow})) {
+        if (!homeExisted) {
+            std::error_code error;
+            std::filesystem::remove_all(homePath, error);
+        }
+
+        Unlock();
+        return UserStatus::IoError;
+    }
+
+    Unlock();
+    *uid = newUid;
+    return UserStatus::Ok;
+}
+
+UserStatus UserDatabase::RemoveUser(const std::string &name, bool removeHome)
+{
+    if (!IsValidUserName(name)) {
+        return Fail(UserStatus::InvalidName, "invalid user name " + name);
+    }
+
+    if (!Lock()) {
+        return UserStatus::IoError;
+    }
+
+    File passwd("passwd");
+    File shadow("shadow");
+    File group("group");
+    File gshadow("gshadow");
+    for (File *file : {&passwd, &shadow, &group, &gshadow}) {
+        if (!Load(file)) {
+            Unlock();
+            return UserStatus::IoError;
+        }
+    }
+
+    const ptrdiff_t line = Find(passwd.lines, name);
+    if (line < 0) {
+        Unlock();
+        return Fail(UserStatus::NotFound, "no user " + name);
+    }
+
+    const std::vector<std::string> fields = Split(passwd.lines[line], ':');
+    const std::string gid = (fields.size() > 3) ? fields[3] : std::string();
+    const std::string home = (fields.size() > 5) ? fields[5] : std::string();
+    passwd.lines.erase(passwd.lines.begin() + line);
+    passwd.changed = true;
+    const ptrdiff_t shadowLine = Find(shadow.lines, name);
+    if (shadowLine >= 0) {
+        shadow.lines.erase(shadow.lines.begin() + shadowLine);
+        shadow.changed = true;
+    }
+
+    // The group of the same name goes too when it is the user's own: its
+    // primary group, which no other user has as theirs.
+    const ptrdiff_t ownGroup = Find(group.lines, name);
+    bool removeGroup = false;
+    if (ownGroup >= 0) {
+        const std::vector<std::string> groupFields = Split(group.lines[ownGroup], ':');
+        removeGroup = (groupFields.size() > 2) && (groupFields[2] == gid);
+        for (const std::string &other : passwd.lines) {
+            const std::vector<std::string> otherFields = Split(other, ':');
+            removeGroup = removeGroup && !((otherFields.size() > 3) && (otherFields[3] == gid));
+        }
+    }
+
+    if (removeGroup) {
+        group.lines.erase(group.lines.begin() + ownGroup);
+        const ptrdiff_t ownShadow = Find(gshadow.lines, name);
+        if (ownShadow >= 0) {
+            gshadow.lines.erase(gshadow.lines.begin() + ownShadow);
+        }
+
+        group.changed = true;
+        gshadow.changed = gshadow.changed || (ownShadow >= 0);
+    }
+
+    for (std::string &entry : group.lines) {
+        group.changed = EditMembers(&entry, 3, name, false) || group.changed;
+    }
+
+    for (std::string &entry : gshadow.lines) {
+        const bool administrator = EditMembers(&entry, 2, name, false);
+        const bool member = EditMembers(&entry, 3, name, false);
+        gshadow.changed = administrator || member || gshadow.changed;
+    }
+
+    // Rewriting the groups last keeps the user's own group for as long as
+    // the user is there.
+    if (!Commit({&passwd, &shadow, &group, &gshadow})) {
+        Unlock();
+        return UserStatus::IoError;
+    }
+
+    Unlock();
+    if (removeHome && !home.empty() && (std::filesystem::path(home).relative_path() != "")) {
+        std::error_code error;
+        const std::filesystem::path homePath = _root / std::filesystem::path(home).relative_path();
+        std::filesystem::remove_all(homePath, error);
+        if (error) {
+            return Fail(UserStatus::IoError, "cannot remove " + homePath.string() + ": " + error.message());
+        }
+    }
+
+    return UserStatus::Ok;
+}
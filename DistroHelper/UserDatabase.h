@@ -0,0 +1,84 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+enum class UserStatus
+{
+    Ok,
+    IoError,
+    InvalidName,
+    Exists,
+    NotFound,
+    NoFreeId,
+};
+
+struct NewUser
+{
+    std::string name;
+
+    // Supplementary groups; those the tree does not have are skipped.
+    std::vector<std::string> groups;
+};
+
+// Creates and removes user accounts in a tree by editing /etc/passwd,
+// /etc/shadow, /etc/group and /etc/gshadow directly, as adduser would
+// through useradd and usermod but without starting either.
+//
+// The files are locked the way lckpwdf() locks them, so that shadow-utils
+// running at the same time waits for us and the other way around. Every
+// file is written to a temporary name, synced and renamed over the
+// original, after saving the original as "<file>-" like shadow-utils does;
+// should one of them fail, those already replaced are restored.
+//
+// Defaults are read from the tree: /etc/adduser.conf for the home and shell
+// (DHOME, DSHELL, SKEL, DIR_MODE) and the ID ranges (FIRST_UID and the like),
+// falling back to /etc/login.defs, which also gives the password ageing.
+class UserDatabase
+{
+  public:
+    explicit UserDatabase(std::filesystem::path root = "/");
+    ~UserDatabase();
+
+    UserDatabase(const UserDatabase &) = delete;
+    UserDatabase &operator=(const UserDatabase &) = delete;
+
+    // Creates the user with a locked password, a group of its own, and a
+    // home directory populated from the skeleton directory.
+    UserStatus AddUser(const NewUser &user, uint32_t *uid);
+
+    // Removes the user, its own group, and its memberships. The home
+    // directory is only removed when asked to.
+    UserStatus RemoveUser(const std::string &name, bool removeHome);
+
+    // Groups the last AddUser() skipped because the tree does not have them.
+    const std::vector<std::string> &SkippedGroups() const { return _skippedGroups; }
+    const std::string &Error() const { return _error; }
+
+  private:
+    struct File;
+
+    bool Lock();
+    void Unlock();
+    bool Load(File *file);
+    bool Commit(std::vector<File *> files);
+    bool CreateHome(const std::string &home, uint32_t uid, uint32_t gid);
+    std::string Setting(const char *file, const char *key, const std::string &fallback);
+    UserStatus Fail(UserStatus status, const std::string &error);
+    UserStatus FailErrno(const std::string &what, const std::string &path);
+
+    std::filesystem::path _root;
+    int _lock = -1;
+    std::vector<std::string> _skippedGroups;
+    std::string _error;
+};
+
+// Tells whether a name is one adduser accepts with its default NAME_REGEX.
+bool IsValidUserName(const std::string &name);
@@ -0,0 +1,213 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Checks the command server over loopback connections and measures what a
+// command costs through it:
+//
+//     command-server-bench [commands]
+//
+// A server runs on a thread of the bench, listening on a Unix socket and on
+// a loopback TCP port like it does for the launcher. The checks cover the
+// handshake, output and error streams, exit codes and signals, input, working
+// directories, and commands running at once over one connection. The given
+// number of commands is then run one after the other through the server, and
+// for comparison with a fork and exec of the shell each.
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+#include "CommandClient.h"
+#include "CommandServer.h"
+
+namespace {
+    const char Token[] = "bench-token";
+
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    struct Result
+    {
+        std::string output;
+        std::string error;
+        int exitCode = -1;
+        bool failed = false;
+    };
+
+    // Reads events until every command started has ended.
+    bool Collect(CommandClient &client, std::map<uint32_t, Result> *results)
+    {
+        size_t running = results->size();
+        while (running > 0) {
+            CommandEvent event;
+            if (!client.Next(&event)) {
+                return false;
+            }
+
+            Result &result = (*results)[event.command];
+            if (event.type == FrameType::Output) {
+                ((event.stream == 1) ? result.output : result.error) += event.data;
+
+            } else {
+                result.exitCode = event.exitCode;
+                result.failed = (event.type == FrameType::Failed);
+                running -= 1;
+            }
+        }
+
+        return true;
+    }
+
+    Result RunOne(CommandClient &client, const std::string &command, const std::string &input = "", const std::string &directory = "")
+    {
+        std::map<uint32_t, Result> results;
+        const uint32_t id = client.Run(command, directory);
+        if (id == 0) {
+            return Result();
+        }
+
+        results[id];
+        if (!input.empty()) {
+            client.SendInput(id, input.data(), input.size());
+        }
+
+        client.CloseInput(id);
+        return Collect(client, &results) ? results[id] : Result();
+    }
+
+    bool Check(bool passed, const char *what, int *failures)
+    {
+        std::printf("  %-48s %s\n", what, passed ? "ok" : "FAILED");
+        *failures += passed ? 0 : 1;
+        return passed;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const int commands = (argc > 1) ? std::atoi(argv[1]) : 500;
+    if ((argc > 2) || (commands <= 0)) {
+        std::fprintf(stderr, "usage: %s [commands]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Blocked before the server thread starts, so that it is blocked in
+    // every thread and the server catches exits with its signalfd.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    ::pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    char directory[] = "/tmp/command-server-bench-XXXXXX";
+    if (::mkdtemp(directory) == nullptr) {
+        std::perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    const std::string socket = std::string(directory) + "/server.sock";
+    CommandServer server(Token);
+    if (!server.ListenUnix(socket) || !server.ListenTcp(0)) {
+        std::fprintf(stderr, "%s\n", server.Error().c_str());
+        return EXIT_FAILURE;
+    }
+
+    std::thread serving([&] { server.Serve(std::chrono::seconds(60)); });
+    int failures = 0;
+    {
+        CommandClient intruder;
+        Check(!intruder.ConnectUnix(socket, "wrong token"), "wrong token refused", &failures);
+
+        CommandClient client;
+        if (!Check(client.ConnectUnix(socket, Token), "handshake over the Unix socket", &failures)) {
+            std::fprintf(stderr, "%s\n", client.Error().c_str());
+            server.Stop();
+            serving.join();
+            return EXIT_FAILURE;
+        }
+
+        Result result = RunOne(client, "echo out; echo err >&2; exit 3");
+        Check((result.output == "out\n") && (result.error == "err\n") && (result.exitCode == 3), "streams and exit code", &failures);
+
+        result = RunOne(client, "kill -KILL $$");
+        Check(result.exitCode == 128 + SIGKILL, "killed by a signal", &failures);
+
+        const std::string input(8 << 20, 'x');
+        result = RunOne(client, "wc -c", input);
+        Check(std::atol(result.output.c_str()) == static_cast<long>(input.size()), "8 MiB of input", &failures);
+
+        result = RunOne(client, "head -c 16777216 /dev/zero");
+        Check(result.output.size() == (16u << 20), "16 MiB of output", &failures);
+
+        result = RunOne(client, "pwd", "", directory);
+        Check(result.output == std::string(directory) + "\n", "working directory", &failures);
+
+        const char *home = std::getenv("HOME");
+        result = RunOne(client, "read line || pwd", "", "C:\\no\\such\\directory");
+        Check(result.output == std::string((home != nullptr) ? home : "/") + "\n", "closed input, home directory fallback", &failures);
+
+        std::map<uint32_t, Result> results;
+        for (int i = 0; i < 32; i += 1) {
+            const uint32_t id = client.Run("sleep 0.2; echo " + std::to_string(i), "");
+            client.CloseInput(id);
+            results[id];
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        bool concurrent = Collect(client, &results);
+        const double parallelSeconds = Seconds(start);
+        int index = 0;
+        for (const auto &entry : results) {
+            concurrent = concurrent && (entry.second.output == std::to_string(index) + "\n");
+            index += 1;
+        }
+
+        Check(concurrent && (parallelSeconds < 2.0), "32 commands at once on one connection", &failures);
+
+        CommandClient tcp;
+        Check(tcp.ConnectTcp(server.Port(), Token) && (RunOne(tcp, "echo tcp").output == "tcp\n"),
+              "loopback TCP connection",
+              &failures);
+
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < commands; i += 1) {
+            if (RunOne(client, "true").exitCode != 0) {
+                failures += 1;
+                break;
+            }
+        }
+
+        const double serverSeconds = Seconds(begin);
+        begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < commands; i += 1) {
+            const pid_t child = ::fork();
+            if (child == 0) {
+                ::execl("/bin/sh", "sh", "-c", "true", static_cast<char *>(nullptr));
+                ::_exit(127);
+            }
+
+            ::waitpid(child, nullptr, 0);
+        }
+
+        const double spawnSeconds = Seconds(begin);
+        std::printf("%d commands: %.3f ms each through the server, %.3f ms each with fork and exec\n",
+                    commands,
+                    1000.0 * serverSeconds / commands,
+                    1000.0 * spawnSeconds / commands);
+    }
+
+    server.Stop();
+    serving.join();
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,682 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Checks and measures a rootfs delta against the two releases it joins:
+//
+//     delta-bench [<old archive> <new archive> <delta> [work directory]]
+//
+// The delta comes from `prepare-build delta <old> <new> <delta>`. The old
+// rootfs is extracted into the work directory (a temporary one by default),
+// the delta is applied to it, and the resulting tree is compared entry by
+// entry with the new archive: type, mode, time, owner when running as root,
+// link targets and content. Nodes the new archive does not have are reported too.
+//
+// Without archives, two small releases are made up instead, with a delta
+// encoded here the way delta.go does, and the tree the delta leads to is
+// compared byte for byte with the newer release extracted afresh.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Deflate.h"
+#include "RootfsDelta.h"
+#include "RootfsImporter.h"
+#include "Sha256.h"
+#include "TreeWriter.h"
+
+namespace {
+    struct Expected
+    {
+        TarEntry entry;
+        uint8_t digest[Sha256::DigestSize] = {};
+    };
+
+    // Records what every path of an archive should look like, the last of
+    // duplicate entries winning.
+    class ExpectationSink : public TarSink
+    {
+      public:
+        bool OnEntry(const TarEntry &entry) override
+        {
+            if (!NormalizeTreePath(entry.path, &_path)) {
+                return false;
+            }
+
+            Expected &expected = expectations[_path];
+            expected.entry = entry;
+            expected.entry.rawHeader.clear();
+            _hash = Sha256();
+            return true;
+        }
+
+        bool OnData(const uint8_t *data, size_t size) override
+        {
+            _hash.Update(data, size);
+            return true;
+        }
+
+        bool OnEntryEnd() override
+        {
+            _hash.Final(expectations[_path].digest);
+            return true;
+        }
+
+        bool OnArchiveEnd() override { return true; }
+
+        std::map<std::string, Expected> expectations;
+
+      private:
+        std::string _path;
+        Sha256 _hash;
+    };
+
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool SameContent(const std::string &path, const uint8_t *digest)
+    {
+        FILE *file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr) {
+            return false;
+        }
+
+        Sha256 hash;
+        uint8_t buffer[1 << 16];
+        size_t count;
+        while ((count = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            hash.Update(buffer, count);
+        }
+
+        std::fclose(file);
+        uint8_t actual[Sha256::DigestSize];
+        hash.Final(actual);
+        return std::memcmp(actual, digest, sizeof(actual)) == 0;
+    }
+
+    // Returns what differs between a node of the tree and its expected state, if anything.
+    std::string Compare(const std::string &root, const std::string &path, const Expected &expected)
+    {
+        const TarEntry &entry = expected.entry;
+        const std::string full = path.empty() ? root : root + "/" + path;
+        struct stat status;
+        if (::lstat(full.c_str(), &status) != 0) {
+            return "missing";
+        }
+
+        if (entry.type == '1') {
+            std::string target;
+            struct stat targetStatus;
+            if (!NormalizeTreePath(entry.linkTarget, &target) || (::lstat((root + "/" + target).c_str(), &targetStatus) != 0) ||
+                (targetStatus.st_ino != status.st_ino)) {
+                return "not linked to " + entry.linkTarget;
+            }
+
+            return std::string();
+        }
+
+        const bool typeMatches = entry.IsRegularFile() ? S_ISREG(status.st_mode)
+                               : (entry.type == '5')   ? S_ISDIR(status.st_mode)
+                               : (entry.type == '2')   ? S_ISLNK(status.st_mode)
+                               : (entry.type == '6')   ? S_ISFIFO(status.st_mode)
+                                                       : true;
+        if (!typeMatches) {
+            return "wrong type";
+        }
+
+        if (!S_ISLNK(status.st_mode) && ((status.st_mode & 07777) != (entry.mode & 07777))) {
+            return "wrong mode";
+        }
+
+        if (status.st_mtime != entry.mtime) {
+            return "wrong time";
+        }
+
+        if ((::geteuid() == 0) && ((status.st_uid != entry.uid) || (status.st_gid != entry.gid))) {
+            return "wrong owner";
+        }
+
+        if (S_ISLNK(status.st_mode)) {
+            std::string target(static_cast<size_t>(status.st_size) + 1, '\0');
+            const ssize_t size = ::readlink(full.c_str(), &target[0], target.size());
+            if ((size < 0) || (target.compare(0, static_cast<size_t>(size), entry.linkTarget) != 0) ||
+                (static_cast<size_t>(size) != entry.linkTarget.size())) {
+                return "wrong link target";
+            }
+        }
+
+        if (S_ISREG(status.st_mode) && !SameContent(full, expected.digest)) {
+            return "wrong content";
+        }
+
+        return std::string();
+    }
+
+    struct Node
+    {
+        TarEntry entry;
+        std::string content;
+    };
+
+    Node MakeNode(const std::string &path, char type, uint32_t mode, int64_t mtime, const std::string &content = {},
+                  const std::string &linkTarget = {})
+    {
+        Node node;
+        node.entry.path = path;
+        node.entry.type = type;
+        node.entry.mode = mode;
+        node.entry.mtime = mtime;
+        node.entry.linkTarget = linkTarget;
+        node.entry.size = (type == '0') ? content.size() : 0;
+        node.content = content;
+        return node;
+    }
+
+    std::vector<uint8_t> EncodeTar(const std::vector<Node> &nodes)
+    {
+        std::vector<uint8_t> tar;
+        for (const Node &node : nodes) {
+            const std::vector<uint8_t> header = EncodeTarHeader(node.entry);
+            tar.insert(tar.end(), header.begin(), header.end());
+            tar.insert(tar.end(), node.content.begin(), node.content.end());
+            tar.resize((tar.size() + TarEntry::BlockSize - 1) / TarEntry::BlockSize * TarEntry::BlockSize);
+        }
+
+        tar.resize(tar.size() + (2 * TarEntry::BlockSize));
+        return tar;
+    }
+
+    bool WriteGzip(const std::string &path, const std::vector<uint8_t> &data)
+    {
+        FileSink file(path);
+        GzipBlockWriter gzip(file, 1);
+        return file.IsOpen() && gzip.Write(data.data(), data.size()) && gzip.Close() && file.Close();
+    }
+
+    std::string Digest(const std::string &content)
+    {
+        Sha256 hash;
+        hash.Update(reinterpret_cast<const uint8_t *>(content.data()), content.size());
+        std::string digest(Sha256::DigestSize, '\0');
+        hash.Final(reinterpret_cast<uint8_t *>(&digest[0]));
+        return digest;
+    }
+
+    // Encodes delta records the way deltaWriter in delta.go does.
+    struct DeltaEncoder
+    {
+        void U8(uint8_t value) { bytes.push_back(value); }
+
+        void U32(uint32_t value)
+        {
+            for (unsigned shift = 0; shift < 32; shift += 8) {
+                U8(static_cast<uint8_t>(value >> shift));
+            }
+        }
+
+        void U64(uint64_t value)
+        {
+            U32(static_cast<uint32_t>(value));
+            U32(static_cast<uint32_t>(value >> 32));
+        }
+
+        void Bytes(const std::string &data) { bytes.insert(bytes.end(), data.begin(), data.end()); }
+
+        void String(const std::string &value)
+        {
+            U32(static_cast<uint32_t>(value.size()));
+            Bytes(value);
+        }
+
+        void Meta(const TarEntry &entry, const std::string &path, const std::string &linkTarget)
+        {
+            String(path);
+            U8(static_cast<uint8_t>(entry.type));
+            U32(entry.mode);
+            U32(entry.uid);
+            U32(entry.gid);
+            U64(static_cast<uint64_t>(entry.mtime));
+            String(linkTarget);
+            U32(0);
+        }
+
+        std::vector<uint8_t> bytes;
+    };
+
+    // Patch instructions copying what new shares with old at either end, and
+    // inserting the rest: simpler than the block matching of delta.go, but
+    // made of the same instructions.
+    std::string EncodePatch(const std::string &old, const std::string &updated)
+    {
+        size_t prefix = 0;
+        while ((prefix < old.size()) && (prefix < updated.size()) && (old[prefix] == updated[prefix])) {
+            prefix += 1;
+        }
+
+        size_t suffix = 0;
+        while ((suffix < old.size() - prefix) && (suffix < updated.size() - prefix) &&
+               (old[old.size() - 1 - suffix] == updated[updated.size() - 1 - suffix])) {
+            suffix += 1;
+        }
+
+        DeltaEncoder patch;
+        if (prefix > 0) {
+            patch.U8('C');
+            patch.U64(0);
+            patch.U64(prefix);
+        }
+
+        if (updated.size() > prefix + suffix) {
+            patch.U8('I');
+            patch.U64(updated.size() - prefix - suffix);
+            patch.Bytes(updated.substr(prefix, updated.size() - prefix - suffix));
+        }
+
+        if (suffix > 0) {
+            patch.U8('C');
+            patch.U64(old.size() - suffix);
+            patch.U64(suffix);
+        }
+
+        patch.U8('.');
+        return std::string(patch.bytes.begin(), patch.bytes.end());
+    }
+
+    std::string TreePath(const std::string &path)
+    {
+        std::string normalized;
+        NormalizeTreePath(path, &normalized);
+        return normalized;
+    }
+
+    // Computes the records turning the tree of old into the one of updated,
+    // following the rules of computeRootfsDelta.
+    std::vector<uint8_t> BuildDelta(const std::vector<Node> &old, const std::vector<Node> &updated)
+    {
+        std::map<std::string, const Node *> oldNodes;
+        std::map<std::string, const Node *> newNodes;
+        for (const Node &node : old) {
+            oldNodes[TreePath(node.entry.path)] = &node;
+        }
+
+        for (const Node &node : updated) {
+            newNodes[TreePath(node.entry.path)] = &node;
+        }
+
+        DeltaEncoder delta;
+        delta.Bytes("WSLDELTA");
+        delta.U32(1);
+        for (auto it = oldNodes.rbegin(); it != oldNodes.rend(); ++it) {
+            const auto found = newNodes.find(it->first);
+            const TarEntry &entry = it->second->entry;
+            if ((found == newNodes.end()) ||
+                ((found->second->entry.type != entry.type) && !(found->second->entry.IsRegularFile() && entry.IsRegularFile()))) {
+                delta.U8('D');
+                delta.String(it->first);
+            }
+        }
+
+        std::set<std::string> rewritten;
+        for (const Node &node : updated) {
+            const std::string path = TreePath(node.entry.path);
+            const std::string linkTarget = (node.entry.type == '1') ? TreePath(node.entry.linkTarget) : node.entry.linkTarget;
+            const auto found = oldNodes.find(path);
+            const Node *previous = ((found != oldNodes.end()) && (found->second->entry.type == node.entry.type)) ? found->second : nullptr;
+            const bool sameNode = (previous != nullptr) && (previous->content == node.content) &&
+                                  (previous->entry.linkTarget == node.entry.linkTarget);
+            const bool sameMeta = sameNode && (previous->entry.mode == node.entry.mode) && (previous->entry.mtime == node.entry.mtime);
+            if (sameMeta && !((node.entry.type == '1') && (rewritten.count(linkTarget) != 0))) {
+                continue;
+            }
+
+            if (sameNode && (node.entry.type != '1')) {
+                delta.U8('M');
+                delta.Meta(node.entry, path, linkTarget);
+                continue;
+            }
+
+            rewritten.insert(path);
+            if ((previous != nullptr) && node.entry.IsRegularFile()) {
+                const std::string patch = EncodePatch(previous->content, node.content);
+                if (patch.size() < node.content.size()) {
+                    delta.U8('P');
+                    delta.Meta(node.entry, path, linkTarget);
+                    delta.Bytes(Digest(previous->content));
+                    delta.U64(node.content.size());
+                    delta.Bytes(Digest(node.content));
+                    delta.Bytes(patch);
+                    continue;
+                }
+            }
+
+            delta.U8('E');
+            delta.Meta(node.entry, path, linkTarget);
+            delta.U64(node.content.size());
+            delta.Bytes(node.content);
+        }
+
+        delta.U8('.');
+        return delta.bytes;
+    }
+
+    bool Extract(const std::string &archive, const std::string &root)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(root, error);
+        TreeWriter tree(root);
+        TreeExtractor extractor(tree);
+        RootfsImporter importer;
+        return importer.Import(archive, extractor) == RootfsStatus::Ok;
+    }
+
+    std::string ReadAll(const std::string &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    }
+
+    // Returns the first difference between two trees, comparing every node:
+    // type, mode, time, owner, link target, hard links and content, byte for byte.
+    std::string CompareTrees(const std::string &left, const std::string &right)
+    {
+        std::map<std::string, std::string> paths[2];
+        const std::string roots[2] = {left, right};
+        for (size_t side = 0; side < 2; side += 1) {
+            std::map<ino_t, std::string> inodes;
+            std::error_code error;
+            for (auto it = std::filesystem::recursive_directory_iterator(roots[side], error);
+                 !error && (it != std::filesystem::recursive_directory_iterator());
+                 it.increment(error)) {
+                const std::string path = it->path().lexically_relative(roots[side]).generic_u8string();
+                struct stat status;
+                if (::lstat(it->path().c_str(), &status) != 0) {
+                    return path + ": cannot be read";
+                }
+
+                // Hard links are told apart by the first path of their inode.
+                const std::string first = inodes.emplace(status.st_ino, path).first->second;
+                paths[side][path] = S_ISDIR(status.st_mode) ? std::string() : first;
+            }
+        }
+
+        if (paths[0].size() != paths[1].size()) {
+            return "different number of nodes";
+        }
+
+        for (const auto &path : paths[0]) {
+            const auto other = paths[1].find(path.first);
+            if ((other == paths[1].end()) || (other->second != path.second)) {
+                return path.first + ": missing or linked differently";
+            }
+
+            struct stat status[2];
+            const std::string full[2] = {left + "/" + path.first, right + "/" + path.first};
+            if ((::lstat(full[0].c_str(), &status[0]) != 0) || (::lstat(full[1].c_str(), &status[1]) != 0) ||
+                (status[0].st_mode != status[1].st_mode) || (status[0].st_uid != status[1].st_uid) ||
+                (status[0].st_gid != status[1].st_gid) || (status[0].st_mtime != status[1].st_mtime)) {
+                return path.first + ": different metadata";
+            }
+
+            if (S_ISLNK(status[0].st_mode)) {
+                char targets[2][256];
+                const ssize_t sizes[2] = {::readlink(full[0].c_str(), targets[0], sizeof(targets[0])),
+                                          ::readlink(full[1].c_str(), targets[1], sizeof(targets[1]))};
+                if ((sizes[0] < 0) || (sizes[0] != sizes[1]) || (std::memcmp(targets[0], targets[1], static_cast<size_t>(sizes[0])) != 0)) {
+                    return path.first + ": different link target";
+                }
+            }
+
+            if (S_ISREG(status[0].st_mode) && (ReadAll(full[0]) != ReadAll(full[1]))) {
+                return path.first + ": different content";
+            }
+        }
+
+        return std::string();
+    }
+
+    bool Check(bool passed, const std::string &what, int *failures)
+    {
+        std::printf("  %-56s %s\n", what.c_str(), passed ? "ok" : "FAILED");
+        *failures += passed ? 0 : 1;
+        return passed;
+    }
+
+    // Two releases differing by every kind of record: removed files and
+    // directories, a directory turned into a link, files replaced, patched
+    // and given a new mode, a retargeted link, and a hard link to a patched file.
+    void CheckDelta(int *failures)
+    {
+        std::printf("checks:\n");
+        char temporary[] = "/tmp/delta-bench-XXXXXX";
+        if (!Check(::mkdtemp(temporary) != nullptr, "work directory created", failures)) {
+            return;
+        }
+
+        const std::string work = temporary;
+        std::string tool;
+        for (uint32_t value = 1; tool.size() < (64 << 10); value = (value * 1103515245) + 12345) {
+            tool += "symbol_" + std::to_string(value >> 8) + "\n";
+        }
+
+        std::string patchedTool = tool;
+        patchedTool.replace(tool.size() / 2, 20, "patched in the middle");
+        patchedTool += "appended at the end\n";
+
+        const int64_t before = 1700000000;
+        const int64_t after = 1710000000;
+        const std::vector<Node> old = {
+            MakeNode("./", '5', 0755, before),
+            MakeNode("./etc/", '5', 0755, before),
+            MakeNode("./etc/hostname", '0', 0644, before, "old-host\n"),
+            MakeNode("./etc/motd", '0', 0644, before, "Welcome\n"),
+            MakeNode("./etc/mode.conf", '0', 0644, before, "mode=1\n"),
+            MakeNode("./etc/alternatives", '2', 0777, before, {}, "../usr/bin/tool"),
+            MakeNode("./usr/", '5', 0755, before),
+            MakeNode("./usr/bin/", '5', 0755, before),
+            MakeNode("./usr/bin/tool", '0', 0755, before, tool),
+            MakeNode("./usr/bin/tool-link", '1', 0755, before, {}, "./usr/bin/tool"),
+            MakeNode("./usr/lib/", '5', 0755, before),
+            MakeNode("./usr/lib/old/", '5', 0755, before),
+            MakeNode("./usr/lib/old/library", '0', 0644, before, "gone\n"),
+            MakeNode("./usr/share/", '5', 0755, before),
+            MakeNode("./usr/share/data", '0', 0644, before, std::string(4096, 'd')),
+            MakeNode("./var/", '5', 0755, before),
+            MakeNode("./var/run/", '5', 0755, before),
+            MakeNode("./var/run/pid", '0', 0644, before, "1\n"),
+        };
+
+        const std::vector<Node> updated = {
+            MakeNode("./", '5', 0755, before),
+            MakeNode("./etc/", '5', 0755, after),
+            MakeNode("./etc/hostname", '0', 0644, after, "new-host\n"),
+            MakeNode("./etc/mode.conf", '0', 0600, after, "mode=1\n"),
+            MakeNode("./etc/new.conf", '0', 0644, after, "fresh\n"),
+            MakeNode("./etc/alternatives", '2', 0777, after, {}, "/usr/bin/tool"),
+            MakeNode("./usr/", '5', 0755, before),
+            MakeNode("./usr/bin/", '5', 0755, after),
+            MakeNode("./usr/bin/tool", '0', 0755, after, patchedTool),
+            MakeNode("./usr/bin/tool-link", '1', 0755, after, {}, "./usr/bin/tool"),
+            MakeNode("./usr/lib/", '5', 0755, after),
+            MakeNode("./usr/share/", '5', 0755, before),
+            MakeNode("./usr/share/data", '0', 0644, before, std::string(4096, 'd')),
+            MakeNode("./var/", '5', 0755, after),
+            MakeNode("./var/run", '2', 0777, after, {}, "/run"),
+        };
+
+        const std::string oldArchive = work + "/old.tar.gz";
+        const std::string newArchive = work + "/new.tar.gz";
+        const std::string deltaPath = work + "/update.delta";
+        const std::vector<uint8_t> delta = BuildDelta(old, updated);
+        Check(WriteGzip(oldArchive, EncodeTar(old)) && WriteGzip(newArchive, EncodeTar(updated)) && WriteGzip(deltaPath, delta),
+              "releases and delta written", failures);
+
+        const std::string applied = work + "/applied";
+        const std::string expected = work + "/expected";
+        Check(Extract(oldArchive, applied) && Extract(newArchive, expected), "releases extracted", failures);
+
+        DeltaApplier applier(applied);
+        const DeltaStatus status = applier.Apply(deltaPath);
+        if (status != DeltaStatus::Ok) {
+            std::printf("  %s\n", applier.Error().c_str());
+        }
+
+        const DeltaStats &stats = applier.Stats();
+        Check(status == DeltaStatus::Ok, "delta applied", failures);
+        Check((stats.removed == 5) && (stats.created == 5) && (stats.updated == 5) && (stats.patched == 1),
+              "every kind of record used", failures);
+        std::string difference = CompareTrees(applied, expected);
+        Check(difference.empty(), "tree matches the newer release" + (difference.empty() ? "" : ": " + difference), failures);
+
+        // The patched file is no longer the one the delta applies to, which
+        // is found before the tree is touched.
+        DeltaApplier again(applied);
+        Check(again.Apply(delta.data(), delta.size()) == DeltaStatus::BaseMismatch, "delta applied twice rejected", failures);
+        Check(CompareTrees(applied, expected).empty(), "tree left as it was", failures);
+
+        // A delta cut short is found before the tree is touched as well.
+        const std::string base = work + "/base";
+        const std::string untouched = work + "/untouched";
+        std::vector<uint8_t> truncated(delta.begin(), delta.end() - 1);
+        DeltaApplier damaged(base);
+        Check(Extract(oldArchive, base) && Extract(oldArchive, untouched) &&
+                  (damaged.Apply(truncated.data(), truncated.size()) == DeltaStatus::CorruptDelta),
+              "truncated delta rejected", failures);
+        Check(CompareTrees(base, untouched).empty(), "older release left as it was", failures);
+
+        std::error_code error;
+        std::filesystem::remove_all(work, error);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if ((argc != 1) && (argc != 4) && (argc != 5)) {
+        std::fprintf(stderr, "usage: %s [<old archive> <new archive> <delta> [work directory]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (argc == 1) {
+        int failures = 0;
+        CheckDelta(&failures);
+        return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    char temporary[] = "/tmp/delta-bench-XXXXXX";
+    const bool ownWorkDirectory = (argc == 4);
+    if (ownWorkDirectory && (::mkdtemp(temporary) == nullptr)) {
+        std::perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    const std::string root = ownWorkDirectory ? temporary : argv[4];
+    const auto cleanUp = [&] {
+        if (ownWorkDirectory) {
+            std::error_code error;
+            std::filesystem::remove_all(root, error);
+        }
+    };
+
+    {
+        std::error_code error;
+        std::filesystem::create_directories(root, error);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        TreeWriter tree(root);
+        TreeExtractor extractor(tree);
+        RootfsImporter importer;
+        if (importer.Import(argv[1], extractor) != RootfsStatus::Ok) {
+            std::fprintf(stderr, "%s: %s\n", argv[1], tree.Error().empty() ? importer.Error().c_str() : tree.Error().c_str());
+            cleanUp();
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::printf("extracted %s in %.3f s\n", argv[1], Seconds(start));
+
+    start = std::chrono::steady_clock::now();
+    DeltaApplier applier(root);
+    if (applier.Apply(argv[3]) != DeltaStatus::Ok) {
+        std::fprintf(stderr, "%s: %s\n", argv[3], applier.Error().c_str());
+        cleanUp();
+        return EXIT_FAILURE;
+    }
+
+    const double applySeconds = Seconds(start);
+    const DeltaStats &stats = applier.Stats();
+    std::error_code error;
+    const uintmax_t newSize = std::filesystem::file_size(argv[2], error);
+    std::printf("applied %s in %.3f s: %llu bytes (%.2f%% of the new archive), %llu removed, %llu created or replaced, "
+                "%llu metadata updates, %llu patched, %llu bytes written\n",
+                argv[3],
+                applySeconds,
+                static_cast<unsigned long long>(stats.deltaBytes),
+                (newSize > 0) ? 100.0 * static_cast<double>(stats.deltaBytes) / static_cast<double>(newSize) : 0.0,
+                static_cast<unsigned long long>(stats.removed),
+                static_cast<unsigned long long>(stats.created),
+                static_cast<unsigned long long>(stats.updated),
+                static_cast<unsigned long long>(stats.patched),
+                static_cast<unsigned long long>(applier.TreeStats().bytes));
+
+    ExpectationSink expected;
+    RootfsImporter importer;
+    if (importer.Import(argv[2], expected) != RootfsStatus::Ok) {
+        std::fprintf(stderr, "%s: %s\n", argv[2], importer.Error().c_str());
+        cleanUp();
+        return EXIT_FAILURE;
+    }
+
+    uint64_t mismatches = 0;
+    for (const auto &path : expected.expectations) {
+        const std::string difference = Compare(root, path.first, path.second);
+        if (!difference.empty()) {
+            if (mismatches < 20) {
+                std::printf("  /%s: %s\n", path.first.c_str(), difference.c_str());
+            }
+
+            mismatches += 1;
+        }
+    }
+
+    // Archives need not list the directories their entries are in.
+    std::set<std::string> implied;
+    for (const auto &path : expected.expectations) {
+        for (size_t slash = path.first.find('/'); slash != std::string::npos; slash = path.first.find('/', slash + 1)) {
+            implied.insert(path.first.substr(0, slash));
+        }
+    }
+
+    uint64_t extra = 0;
+    for (auto it = std::filesystem::recursive_directory_iterator(root, error);
+         !error && (it != std::filesystem::recursive_directory_iterator());
+         it.increment(error)) {
+        const std::string path = it->path().lexically_relative(root).generic_u8string();
+        if ((expected.expectations.find(path) == expected.expectations.end()) && (implied.count(path) == 0)) {
+            if (extra < 20) {
+                std::printf("  /%s: not in the new archive\n", path.c_str());
+            }
+
+            extra += 1;
+        }
+    }
+
+    std::printf("verified %zu entries: %llu mismatches, %llu extra nodes\n",
+                expected.expectations.size(),
+                static_cast<unsigned long long>(mismatches),
+                static_cast<unsigned long long>(extra));
+    cleanUp();
+    return ((mismatches == 0) && (extra == 0) && !error) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,211 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Checks and measures account creation and removal in a scratch tree:
+//
+//     user-bench [users] [work directory]
+//
+// The tree gets a copy of the account files of the host (empty shadow files
+// when they cannot be read) and a small skeleton directory. The users are
+// added one after the other, like the launcher adds its first user, then
+// removed with their home directories; the account files must then be what
+// they were at the start, and each step is checked along the way.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "UserDatabase.h"
+
+namespace {
+    const char *const AccountFiles[] = {"passwd", "shadow", "group", "gshadow"};
+
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::string ReadFile(const std::filesystem::path &path)
+    {
+        std::ifstream stream(path, std::ios::binary);
+        std::ostringstream content;
+        content << stream.rdbuf();
+        return content.str();
+    }
+
+    void WriteFile(const std::filesystem::path &path, const std::string &content)
+    {
+        std::ofstream(path, std::ios::binary) << content;
+    }
+
+    // Returns the line of an account file for name, or an empty string.
+    std::string Entry(const std::filesystem::path &path, const std::string &name)
+    {
+        std::istringstream lines(ReadFile(path));
+        std::string line;
+        while (std::getline(lines, line)) {
+            if (line.compare(0, name.size() + 1, name + ":") == 0) {
+                return line;
+            }
+        }
+
+        return std::string();
+    }
+
+    std::string Field(const std::string &line, size_t field)
+    {
+        size_t start = 0;
+        for (size_t i = 0; i < field; i += 1) {
+            start = line.find(':', start);
+            if (start == std::string::npos) {
+                return std::string();
+            }
+
+            start += 1;
+        }
+
+        return line.substr(start, line.find(':', start) - start);
+    }
+
+    std::string Check(const std::filesystem::path &root, const std::string &name, uint32_t uid)
+    {
+        const std::string user = Entry(root / "etc/passwd", name);
+        if (user.empty() || (Field(user, 2) != std::to_string(uid))) {
+            return "no passwd entry with the UID printed";
+        }
+
+        const std::string group = Entry(root / "etc/group", name);
+        if (group.empty() || (Field(user, 3) != Field(group, 2))) {
+            return "no group of its own";
+        }
+
+        if (Field(Entry(root / "etc/shadow", name), 1) != "!") {
+            return "password not locked";
+        }
+
+        const std::string sudo = Field(Entry(root / "etc/group", "sudo"), 3);
+        if (("," + sudo + ",").find("," + name + ",") == std::string::npos) {
+            return "not a member of sudo";
+        }
+
+        struct stat status;
+        if ((::stat((root / "home" / name / ".profile").c_str(), &status) != 0) ||
+            ((::geteuid() == 0) && (status.st_uid != uid))) {
+            return "home directory not populated from the skeleton";
+        }
+
+        return std::string();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const int users = (argc > 1) ? std::atoi(argv[1]) : 200;
+    if ((argc > 3) || (users <= 0)) {
+        std::fprintf(stderr, "usage: %s [users] [work directory]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char temporary[] = "/tmp/user-bench-XXXXXX";
+    const bool ownWorkDirectory = (argc < 3);
+    if (ownWorkDirectory && (::mkdtemp(temporary) == nullptr)) {
+        std::perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    const std::filesystem::path root = ownWorkDirectory ? temporary : argv[2];
+    const auto cleanUp = [&] {
+        if (ownWorkDirectory) {
+            std::error_code error;
+            std::filesystem::remove_all(root, error);
+        }
+    };
+
+    std::error_code error;
+    std::filesystem::create_directories(root / "etc/skel", error);
+    std::filesystem::create_directories(root / "home", error);
+    WriteFile(root / "etc/skel/.profile", "# ~/.profile\n");
+    WriteFile(root / "etc/skel/.bashrc", "# ~/.bashrc\n");
+    std::vector<std::string> original;
+    for (const char *file : AccountFiles) {
+        std::string content = ReadFile(std::filesystem::path("/etc") / file);
+        if ((std::string(file) == "group") && (Entry("/etc/group", "sudo").empty())) {
+            content += "sudo:x:27:\n";
+        }
+
+        WriteFile(root / "etc" / file, content);
+        original.push_back(content);
+    }
+
+    UserDatabase database(root);
+    std::vector<std::string> names;
+    std::set<uint32_t> uids;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < users; i += 1) {
+        const std::string name = "bench" + std::to_string(i);
+        uint32_t uid;
+        if (database.AddUser({name, {"adm", "sudo", "no-such-group"}}, &uid) != UserStatus::Ok) {
+            std::fprintf(stderr, "%s: %s\n", name.c_str(), database.Error().c_str());
+            cleanUp();
+            return EXIT_FAILURE;
+        }
+
+        const std::string problem = uids.insert(uid).second ? Check(root, name, uid) : "UID given twice";
+        if (!problem.empty()) {
+            std::fprintf(stderr, "%s: %s\n", name.c_str(), problem.c_str());
+            cleanUp();
+            return EXIT_FAILURE;
+        }
+
+        names.push_back(name);
+    }
+
+    const double addSeconds = Seconds(start);
+    uint32_t uid;
+    if (database.AddUser({names[0], {}}, &uid) != UserStatus::Exists) {
+        std::fprintf(stderr, "%s: added twice\n", names[0].c_str());
+        cleanUp();
+        return EXIT_FAILURE;
+    }
+
+    start = std::chrono::steady_clock::now();
+    for (const std::string &name : names) {
+        if (database.RemoveUser(name, true) != UserStatus::Ok) {
+            std::fprintf(stderr, "%s: %s\n", name.c_str(), database.Error().c_str());
+            cleanUp();
+            return EXIT_FAILURE;
+        }
+    }
+
+    const double removeSeconds = Seconds(start);
+    int differences = 0;
+    for (size_t i = 0; i < std::size(AccountFiles); i += 1) {
+        if (ReadFile(root / "etc" / AccountFiles[i]) != original[i]) {
+            std::printf("  /etc/%s differs from the original\n", AccountFiles[i]);
+            differences += 1;
+        }
+    }
+
+    if (!std::filesystem::is_empty(root / "home", error)) {
+        std::printf("  home directories left behind\n");
+        differences += 1;
+    }
+
+    std::printf("added %d users in %.3f s (%.3f ms each), removed them in %.3f s (%.3f ms each)\n",
+                users,
+                addSeconds,
+                1000.0 * addSeconds / users,
+                removeSeconds,
+                1000.0 * removeSeconds / users);
+    cleanUp();
+    return (differences == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,264 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// wsl-helper runs inside the distribution, where it maintains the rootfs
+// on behalf of the launcher and of administrators.
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+#include "CommandServer.h"
+#include "RootfsDelta.h"
+#include "RootfsImporter.h"
+#include "TreeWriter.h"
+#include "UserDatabase.h"
+
+namespace {
+    void Usage(const char *program)
+    {
+        std::fprintf(stderr,
+                     "usage: %s <command> [arguments]\n"
+                     "\n"
+                     "commands:\n"
+                     "  apply-delta <root> <delta>  update the rootfs tree at root to the release a delta leads to\n"
+                     "  extract <root> <archive>    extract a rootfs archive into root\n"
+                     "  add-user [--root <root>] [--groups <group,...>] <name>\n"
+                     "                              create a user with a locked password and print its UID\n"
+                     "  remove-user [--root <root>] [--remove-home] <name>\n"
+                     "                              remove a user and its own group\n"
+                     "  serve [--port <port>] [--socket <path>] [--idle <seconds>] [--foreground]\n"
+                     "                              run commands for the launcher, with the token read from\n"
+                     "                              the first line of input; prints the port and detaches\n",
+                     program);
+    }
+
+    int ApplyDelta(const char *root, const char *delta)
+    {
+        DeltaApplier applier(root);
+        if (applier.Apply(delta) != DeltaStatus::Ok) {
+            std::fprintf(stderr, "%s: %s\n", delta, applier.Error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        const DeltaStats &stats = applier.Stats();
+        std::printf("%llu removed, %llu created or replaced, %llu metadata updates, %llu patched\n",
+                    static_cast<unsigned long long>(stats.removed),
+                    static_cast<unsigned long long>(stats.created),
+                    static_cast<unsigned long long>(stats.updated),
+                    static_cast<unsigned long long>(stats.patched));
+        return EXIT_SUCCESS;
+    }
+
+    int Extract(const char *root, const char *archive)
+    {
+        TreeWriter tree(root);
+        TreeExtractor extractor(tree);
+        RootfsImporter importer;
+        if (importer.Import(archive, extractor) != RootfsStatus::Ok) {
+            std::fprintf(stderr, "%s: %s\n", archive, tree.Error().empty() ? importer.Error().c_str() : tree.Error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    int AddUser(int argc, char *argv[])
+    {
+        const char *root = "/";
+        NewUser user;
+        int i = 2;
+        for (; (i + 1 < argc) && (argv[i][0] == '-'); i += 2) {
+            if (std::strcmp(argv[i], "--root") == 0) {
+                root = argv[i + 1];
+
+            } else if (std::strcmp(argv[i], "--groups") == 0) {
+                const char *groups = argv[i + 1];
+                while (*groups != '\0') {
+                    const char *end = std::strchr(groups, ',');
+                    const size_t length = (end == nullptr) ? std::strlen(groups) : static_cast<size_t>(end - groups);
+                    if (length != 0) {
+                        user.groups.emplace_back(groups, length);
+                    }
+
+                    groups += length + ((end == nullptr) ? 0 : 1);
+                }
+
+            } else {
+                break;
+            }
+        }
+
+        if (i + 1 != argc) {
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        user.name = argv[i];
+        UserDatabase database(root);
+        uint32_t uid;
+        if (database.AddUser(user, &uid) != UserStatus::Ok) {
+            std::fprintf(stderr, "%s: %s\n", argv[0], database.Error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        for (const std::string &group : database.SkippedGroups()) {
+            std::fprintf(stderr, "%s: no group %s, skipped\n", argv[0], group.c_str());
+        }
+
+        std::printf("%u\n", uid);
+        return EXIT_SUCCESS;
+    }
+
+    int RemoveUser(int argc, char *argv[])
+    {
+        const char *root = "/";
+        bool removeHome = false;
+        int i = 2;
+        for (; (i + 1 < argc) && (argv[i][0] == '-'); i += 1) {
+            if ((std::strcmp(argv[i], "--root") == 0) && (i + 2 < argc)) {
+                i += 1;
+                root = argv[i];
+
+            } else if (std::strcmp(argv[i], "--remove-home") == 0) {
+                removeHome = true;
+
+            } else {
+                break;
+            }
+        }
+
+        if (i + 1 != argc) {
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        UserDatabase database(root);
+        if (database.RemoveUser(argv[i], removeHome) != UserStatus::Ok) {
+            std::fprintf(stderr, "%s: %s\n", argv[0], database.Error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    int Serve(int argc, char *argv[])
+    {
+        long port = -1;
+        const char *socket = nullptr;
+        long idle = 900;
+        bool foreground = false;
+        for (int i = 2; i < argc; i += 1) {
+            if ((std::strcmp(argv[i], "--port") == 0) && (i + 1 < argc)) {
+                port = std::strtol(argv[++i], nullptr, 10);
+
+            } else if ((std::strcmp(argv[i], "--socket") == 0) && (i + 1 < argc)) {
+                socket = argv[++i];
+
+            } else if ((std::strcmp(argv[i], "--idle") == 0) && (i + 1 < argc)) {
+                idle = std::strtol(argv[++i], nullptr, 10);
+
+            } else if (std::strcmp(argv[i], "--foreground") == 0) {
+                foreground = true;
+
+            } else {
+                Usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+
+        if ((port > 65535) || (idle <= 0)) {
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        // The token comes through the input rather than the command line,
+        // which every user of the distribution can read.
+        char line[256];
+        std::string token = (std::fgets(line, sizeof(line), stdin) != nullptr) ? line : "";
+        while (!token.empty() && ((token.back() == '\n') || (token.back() == '\r'))) {
+            token.pop_back();
+        }
+
+        if (token.empty()) {
+            std::fprintf(stderr, "%s: no token given\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        // SIGCHLD is blocked before anything else, so that the server can
+        // wait for it with a signalfd.
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGCHLD);
+        ::sigprocmask(SIG_BLOCK, &signals, nullptr);
+
+        CommandServer server(token);
+        if (((socket != nullptr) && !server.ListenUnix(socket)) ||
+            (((socket == nullptr) || (port >= 0)) && !server.ListenTcp(static_cast<uint16_t>((port < 0) ? 0 : port)))) {
+            std::fprintf(stderr, "%s: %s\n", argv[0], server.Error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        if (!foreground) {
+            const pid_t child = ::fork();
+            if (child < 0) {
+                std::perror("fork");
+                return EXIT_FAILURE;
+            }
+
+            if (child > 0) {
+                std::printf("%u\n", server.Port());
+                return EXIT_SUCCESS;
+            }
+
+            // The server outlives the launch that started it.
+            ::setsid();
+            const int null = ::open("/dev/null", O_RDWR | O_CLOEXEC);
+            for (int fd = 0; fd < 3; fd += 1) {
+                ::dup2(null, fd);
+            }
+
+        } else {
+            std::printf("%u\n", server.Port());
+            std::fflush(stdout);
+        }
+
+        if (!server.Serve(std::chrono::seconds(idle))) {
+            std::fprintf(stderr, "%s: %s\n", argv[0], server.Error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if ((argc == 4) && (std::strcmp(argv[1], "apply-delta") == 0)) {
+        return ApplyDelta(argv[2], argv[3]);
+    }
+
+    if ((argc == 4) && (std::strcmp(argv[1], "extract") == 0)) {
+        return Extract(argv[2], argv[3]);
+    }
+
+    if ((argc >= 3) && (std::strcmp(argv[1], "add-user") == 0)) {
+        return AddUser(argc, argv);
+    }
+
+    if ((argc >= 3) && (std::strcmp(argv[1], "remove-user") == 0)) {
+        return RemoveUser(argc, argv);
+    }
+
+    if ((argc >= 2) && (std::strcmp(argv[1], "serve") == 0)) {
+        return Serve(argc, argv);
+    }
+
+    Usage(argv[0]);
+    return EXIT_FAILURE;
+}
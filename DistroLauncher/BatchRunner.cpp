@@ -0,0 +1,125 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "BatchRunner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+
+BatchRunner::BatchRunner(BatchBackend &backend, unsigned int parallelism) :
+    _backend(backend),
+    _parallelism(std::max(parallelism, 1u))
+{
+}
+
+bool BatchRunner::Load(const std::filesystem::path &manifest)
+{
+    std::ifstream file(manifest, std::ios::binary);
+    if (!file) {
+        _error = "cannot open " + manifest.u8string();
+        return false;
+    }
+
+    const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (file.bad()) {
+        _error = "cannot read " + manifest.u8string();
+        return false;
+    }
+
+    Parse(text);
+    return true;
+}
+
+void BatchRunner::Parse(const std::string &text)
+{
+    // Manifests written with Notepad may start with a byte order mark and
+    // end their lines with CRLF.
+    size_t offset = (text.compare(0, 3, "\xEF\xBB\xBF") == 0) ? 3 : 0;
+    size_t line = 0;
+    _commands.clear();
+    while (offset < text.size()) {
+        size_t end = text.find('\n', offset);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+
+        line += 1;
+        size_t first = text.find_first_not_of(" \t", offset);
+        size_t last = end;
+        while ((last > offset) && ((text[last - 1] == '\r') || (text[last - 1] == ' ') || (text[last - 1] == '\t'))) {
+            last -= 1;
+        }
+
+        if ((first < last) && (text[first] != '#')) {
+            _commands.push_back(Command{line, text.substr(first, last - first)});
+        }
+
+        offset = end + 1;
+    }
+}
+
+void BatchRunner::Run(std::chrono::milliseconds timeout, const ResultCallback &callback)
+{
+    _results.assign(_commands.size(), BatchResult());
+    std::atomic<size_t> next{0};
+    std::mutex reportLock;
+    const auto work = [&] {
+        for (size_t index = next++; index < _commands.size(); index = next++) {
+            const auto start = std::chrono::steady_clock::now();
+            BatchResult result = _backend.Run(_commands[index].text, timeout);
+            result.duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+            std::lock_guard<std::mutex> lock(reportLock);
+            _results[index] = std::move(result);
+            if (callback) {
+                callback(index, _commands[index], _results[index]);
+            }
+        }
+    };
+
+    // The calling thread is one of the workers.
+    const size_t workers = std::min<size_t>(_parallelism, _commands.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers; i += 1) {
+        threads.emplace_back(work);
+    }
+
+    work();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+size_t BatchRunner::Failures() const
+{
+    return static_cast<size_t>(std::count_if(_results.begin(), _results.end(), [](const BatchResult &result) {
+        return !result.Succeeded();
+    }));
+}
+
+std::string BatchRunner::Tag(const std::string &tag, const std::string &output)
+{
+    std::string tagged;
+    tagged.reserve(output.size() + tag.size() * 4);
+    size_t offset = 0;
+    while (offset < output.size()) {
+        size_t end = output.find('\n', offset);
+        end = (end == std::string::npos) ? output.size() : end + 1;
+        tagged += tag;
+        tagged.append(output, offset, end - offset);
+        offset = end;
+    }
+
+    // Output not ending with a newline still ends its line in the batch.
+    if (!tagged.empty() && (tagged.back() != '\n')) {
+        tagged += '\n';
+    }
+
+    return tagged;
+}
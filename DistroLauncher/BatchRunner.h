@@ -0,0 +1,89 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+enum class BatchStatus
+{
+    Ok,
+    LaunchFailed,
+    TimedOut,
+    IoError,
+};
+
+struct BatchResult
+{
+    BatchStatus status = BatchStatus::LaunchFailed;
+    unsigned long exitCode = 0;
+    std::string output;
+    std::string errorOutput;
+    std::string error;
+    std::chrono::milliseconds duration{0};
+
+    bool Succeeded() const { return (status == BatchStatus::Ok) && (exitCode == 0); }
+};
+
+// Runs one command of a batch to completion, capturing both of its streams.
+// Called from several threads at once, one command on each.
+class BatchBackend
+{
+  public:
+    virtual ~BatchBackend() = default;
+
+    virtual BatchResult Run(const std::string &command, std::chrono::milliseconds timeout) = 0;
+};
+
+// Runs the commands of a manifest, a few at a time, through a backend: WSL
+// launches in the launcher, anything else where the scheduling itself is
+// being checked.
+//
+// A manifest is a UTF-8 text file with one shell command line per line;
+// blank lines and lines starting with # are skipped.
+class BatchRunner
+{
+  public:
+    struct Command
+    {
+        size_t line;
+        std::string text;
+    };
+
+    // Called once for each command as it ends, in the order they end, never
+    // for two commands at once.
+    using ResultCallback = std::function<void(size_t index, const Command &command, const BatchResult &result)>;
+
+    BatchRunner(BatchBackend &backend, unsigned int parallelism);
+
+    bool Load(const std::filesystem::path &manifest);
+    void Parse(const std::string &text);
+
+    // Runs every command, with at most the given number running at once,
+    // each stopped after the timeout.
+    void Run(std::chrono::milliseconds timeout, const ResultCallback &callback = nullptr);
+
+    const std::vector<Command> &Commands() const { return _commands; }
+    const std::vector<BatchResult> &Results() const { return _results; }
+    size_t Failures() const;
+    unsigned int Parallelism() const { return _parallelism; }
+    const std::string &Error() const { return _error; }
+
+    // Prefixes every line of a command's output with its tag, so that the
+    // output of a batch can be told apart once it is all in one stream.
+    static std::string Tag(const std::string &tag, const std::string &output);
+
+  private:
+    BatchBackend &_backend;
+    unsigned int _parallelism;
+    std::vector<Command> _commands;
+    std::vector<BatchResult> _results;
+    std::string _error;
+};
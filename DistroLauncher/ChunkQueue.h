@@ -0,0 +1,114 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// A block of bytes handed from one pipeline stage to the next.
+using Chunk = std::vector<uint8_t>;
+
+// Bounded single-producer/single-consumer queue connecting two pipeline stages.
+// The producer blocks while the queue is full so that a slow consumer keeps
+// memory usage at roughly capacity * chunk size.
+template <typename T>
+class BoundedQueue
+{
+  public:
+    explicit BoundedQueue(size_t capacity) :
+        _capacity(capacity == 0 ? 1 : capacity)
+    {
+    }
+
+    // Returns false if the queue was cancelled before the item could be queued.
+    bool Push(T item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notFull.wait(lock, [this] { return _cancelled || (_items.size() < _capacity); });
+        if (_cancelled) {
+            return false;
+        }
+
+        _items.push_back(std::move(item));
+        _notEmpty.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and drained, or cancelled.
+    bool Pop(T *item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notEmpty.wait(lock, [this] { return _cancelled || _closed || !_items.empty(); });
+        if (_cancelled || _items.empty()) {
+            return false;
+        }
+
+        *item = std::move(_items.front());
+        _items.pop_front();
+        _notFull.notify_one();
+        return true;
+    }
+
+    // Queues an item only if there is room, without waiting.
+    bool TryPush(T item)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_cancelled || (_items.size() >= _capacity)) {
+            return false;
+        }
+
+        _items.push_back(std::move(item));
+        _notEmpty.notify_one();
+        return true;
+    }
+
+    // Takes an item only if one is queued, without waiting.
+    bool TryPop(T *item)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_cancelled || _items.empty()) {
+            return false;
+        }
+
+        *item = std::move(_items.front());
+        _items.pop_front();
+        _notFull.notify_one();
+        return true;
+    }
+
+    // Signals that no more items will be pushed.
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _notEmpty.notify_all();
+    }
+
+    // Aborts the queue: blocked producers and consumers return immediately.
+    void Cancel()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _cancelled = true;
+        _items.clear();
+        _notEmpty.notify_all();
+        _notFull.notify_all();
+    }
+
+  private:
+    std::mutex _mutex;
+    std::condition_variable _notEmpty;
+    std::condition_variable _notFull;
+    std::deque<T> _items;
+    size_t _capacity;
+    bool _closed = false;
+    bool _cancelled = false;
+};
+
+using ChunkQueue = BoundedQueue<Chunk>;
@@ -0,0 +1,350 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "ChunkStore.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#include "ChunkQueue.h"
+#include "InputBuffer.h"
+
+namespace {
+    const char ManifestHeader[] = "wsl-chunk-manifest 1";
+
+    // Number of decompressed chunks loaded ahead of the one being written out.
+    constexpr size_t PrefetchDepth = 16;
+
+    std::string ToHex(const uint8_t *data, size_t size)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        hex.reserve(size * 2);
+        for (size_t index = 0; index < size; index += 1) {
+            hex += digits[data[index] >> 4];
+            hex += digits[data[index] & 0x0f];
+        }
+
+        return hex;
+    }
+
+    bool ParseSize(const std::string &text, uint64_t *value)
+    {
+        if (text.empty() || (text.size() > 19)) {
+            return false;
+        }
+
+        *value = 0;
+        for (char c : text) {
+            if ((c < '0') || (c > '9')) {
+                return false;
+            }
+
+            *value = (*value * 10) + static_cast<uint64_t>(c - '0');
+        }
+
+        return true;
+    }
+
+    bool ReadWholeFile(const std::filesystem::path &path, std::vector<uint8_t> *contents)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        contents->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return !file.bad();
+    }
+
+    class VectorSink : public ByteSink
+    {
+      public:
+        explicit VectorSink(std::vector<uint8_t> &output) :
+            _output(output)
+        {
+        }
+
+        bool Write(const uint8_t *data, size_t size) override
+        {
+            _output.insert(_output.end(), data, data + size);
+            return true;
+        }
+
+      private:
+        std::vector<uint8_t> &_output;
+    };
+
+    // Feeds the assembled stream to a tar parser.
+    class ParserSink : public ByteSink
+    {
+      public:
+        explicit ParserSink(TarSink &sink) :
+            parser(sink)
+        {
+        }
+
+        bool Write(const uint8_t *data, size_t size) override
+        {
+            status = parser.Feed(data, size);
+            return status == TarStatus::Ok;
+        }
+
+        TarParser parser;
+        TarStatus status = TarStatus::Ok;
+    };
+}
+
+bool ChunkManifest::Fail(const std::string &error)
+{
+    _chunks.clear();
+    _error = error;
+    return false;
+}
+
+bool ChunkManifest::Load(const std::filesystem::path &path)
+{
+    std::vector<uint8_t> contents;
+    if (!ReadWholeFile(path, &contents)) {
+        return Fail("cannot read " + path.filename().u8string());
+    }
+
+    return Parse(std::string(contents.begin(), contents.end()));
+}
+
+bool ChunkManifest::Parse(const std::string &text)
+{
+    _chunks.clear();
+    _error.clear();
+    std::istringstream lines(text);
+    std::string line;
+    if (!std::getline(lines, line) || (line != ManifestHeader)) {
+        return Fail("not a chunk manifest");
+    }
+
+    std::string key;
+    std::string value;
+    if (!std::getline(lines, line) || !(std::istringstream(line) >> key >> value) || (key != "size") ||
+        !ParseSize(value, &_size)) {
+        return Fail("chunk manifest has no valid size");
+    }
+
+    if (!std::getline(lines, line) || !(std::istringstream(line) >> key >> value) || (key != "sha256") ||
+        !Sha256::ParseHex(value, _sha256)) {
+        return Fail("chunk manifest has no valid hash");
+    }
+
+    uint64_t total = 0;
+    while (std::getline(lines, line)) {
+        if (line.empty()) {
+            continue;
+        }
+
+        ChunkRef chunk;
+        std::string hash;
+        std::string size;
+        if (!(std::istringstream(line) >> hash >> size) || !Sha256::ParseHex(hash, chunk.sha256) ||
+            !ParseSize(size, &chunk.size) || (chunk.size == 0)) {
+            return Fail("invalid chunk manifest line: " + line);
+        }
+
+        total += chunk.size;
+        _chunks.push_back(chunk);
+    }
+
+    if (total != _size) {
+        return Fail("chunk manifest sizes do not add up");
+    }
+
+    return true;
+}
+
+ChunkStore::ChunkStore(std::filesystem::path root) :
+    _root(std::move(root))
+{
+}
+
+void ChunkStore::AddSeed(std::filesystem::path directory)
+{
+    _seeds.push_back(std::move(directory));
+}
+
+std::filesystem::path ChunkStore::ChunkPath(const ChunkRef &chunk)
+{
+    const std::string hex = ToHex(chunk.sha256, sizeof(chunk.sha256));
+    return std::filesystem::path(hex.substr(0, 2)) / hex;
+}
+
+RootfsStatus ChunkStore::Fail(RootfsStatus status, const std::string &error)
+{
+    _error = error;
+    return status;
+}
+
+std::vector<ChunkRef> ChunkStore::Missing(const ChunkManifest &manifest) const
+{
+    std::vector<ChunkRef> missing;
+    std::error_code error;
+    for (const ChunkRef &chunk : manifest.Chunks()) {
+        const std::filesystem::path path = ChunkPath(chunk);
+        bool found = std::filesystem::exists(_root / path, error);
+        for (size_t index = 0; !found && (index < _seeds.size()); index += 1) {
+            found = std::filesystem::exists(_seeds[index] / path, error);
+        }
+
+        if (!found) {
+            missing.push_back(chunk);
+        }
+    }
+
+    return missing;
+}
+
+RootfsStatus ChunkStore::ReadChunk(const ChunkRef &chunk, std::vector<uint8_t> *data)
+{
+    const std::filesystem::path relative = ChunkPath(chunk);
+    const std::filesystem::path stored = _root / relative;
+    std::vector<uint8_t> compressed;
+    bool seeded = false;
+    if (!ReadWholeFile(stored, &compressed)) {
+        for (const std::filesystem::path &seed : _seeds) {
+            if (ReadWholeFile(seed / relative, &compressed)) {
+                seeded = true;
+                break;
+            }
+        }
+
+        if (!seeded) {
+            return Fail(RootfsStatus::IoError, "chunk " + relative.filename().u8string() + " is missing");
+        }
+    }
+
+    data->clear();
+    data->reserve(static_cast<size_t>(chunk.size));
+    MemorySource source(compressed.data(), compressed.size());
+    VectorSink sink(*data);
+    GzipDecoder decoder(source);
+    bool valid = (decoder.Decode(sink) == InflateStatus::Ok) && (data->size() == chunk.size);
+    if (valid) {
+        uint8_t digest[Sha256::DigestSize];
+        Sha256 hash;
+        hash.Update(data->data(), data->size());
+        hash.Final(digest);
+        valid = (std::memcmp(digest, chunk.sha256, sizeof(digest)) == 0);
+    }
+
+    if (!valid) {
+        // Drop a damaged copy so that it can be fetched again.
+        if (!seeded) {
+            std::error_code error;
+            std::filesystem::remove(stored, error);
+        }
+
+        return Fail(RootfsStatus::CorruptArchive, "chunk " + relative.filename().u8string() + " is corrupt");
+    }
+
+    // Copy seeded chunks into the store through a temporary file, so that a
+    // partially written chunk is never picked up. Failing to cache is harmless.
+    if (seeded) {
+        std::error_code error;
+        std::filesystem::path temporary = stored;
+        temporary += ".tmp";
+        std::filesystem::create_directories(stored.parent_path(), error);
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(compressed.data()), static_cast<std::streamsize>(compressed.size()));
+        file.close();
+        if (file) {
+            std::filesystem::rename(temporary, stored, error);
+        }
+
+        std::filesystem::remove(temporary, error);
+        _stats.seededChunks += 1;
+    }
+
+    _stats.chunks += 1;
+    _stats.compressedBytes += compressed.size();
+    _stats.uncompressedBytes += data->size();
+    return RootfsStatus::Ok;
+}
+
+RootfsStatus ChunkStore::Assemble(const ChunkManifest &manifest, ByteSink &sink)
+{
+    _stats = {};
+    _error.clear();
+
+    // Chunks are read and decompressed on a separate thread, ahead of the
+    // sink consuming them.
+    BoundedQueue<Chunk> chunks(PrefetchDepth);
+    RootfsStatus loadStatus = RootfsStatus::Ok;
+    std::thread loader([&] {
+        for (const ChunkRef &ref : manifest.Chunks()) {
+            Chunk chunk;
+            loadStatus = ReadChunk(ref, &chunk);
+            if ((loadStatus != RootfsStatus::Ok) || !chunks.Push(std::move(chunk))) {
+                chunks.Cancel();
+                return;
+            }
+        }
+
+        chunks.Close();
+    });
+
+    Sha256 hash;
+    Chunk chunk;
+    bool sinkFailed = false;
+    while (chunks.Pop(&chunk)) {
+        hash.Update(chunk.data(), chunk.size());
+        if (!sink.Write(chunk.data(), chunk.size())) {
+            sinkFailed = true;
+            chunks.Cancel();
+            break;
+        }
+    }
+
+    loader.join();
+    if (sinkFailed) {
+        return Fail(RootfsStatus::SinkFailed, "assembled rootfs rejected");
+    }
+
+    if (loadStatus != RootfsStatus::Ok) {
+        return loadStatus;
+    }
+
+    uint8_t digest[Sha256::DigestSize];
+    hash.Final(digest);
+    if (std::memcmp(digest, manifest.Hash(), sizeof(digest)) != 0) {
+        return Fail(RootfsStatus::CorruptArchive, "assembled rootfs does not match its manifest");
+    }
+
+    return RootfsStatus::Ok;
+}
+
+RootfsStatus ChunkStore::Import(const ChunkManifest &manifest, TarSink &sink)
+{
+    ParserSink parser(sink);
+    const RootfsStatus status = Assemble(manifest, parser);
+    if (parser.status != TarStatus::Ok) {
+        return Fail((parser.status == TarStatus::Corrupt) ? RootfsStatus::CorruptArchive : RootfsStatus::SinkFailed,
+                    parser.parser.Error());
+    }
+
+    if (status != RootfsStatus::Ok) {
+        return status;
+    }
+
+    if (parser.parser.Finish() != TarStatus::Ok) {
+        return Fail(RootfsStatus::CorruptArchive, parser.parser.Error());
+    }
+
+    if (!sink.OnArchiveEnd()) {
+        return Fail(RootfsStatus::SinkFailed, "archive end rejected");
+    }
+
+    return RootfsStatus::Ok;
+}
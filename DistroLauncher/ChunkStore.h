@@ -0,0 +1,97 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "Inflate.h"
+#include "RootfsImporter.h"
+#include "Sha256.h"
+#include "TarStream.h"
+
+// One chunk of a rootfs tar stream, named by the hash of its content.
+struct ChunkRef
+{
+    uint8_t sha256[Sha256::DigestSize] = {};
+    uint64_t size = 0;
+};
+
+// The ordered list of chunks making up a rootfs tar stream, as written by
+// `prepare-build chunk`. See chunk.go for the format.
+class ChunkManifest
+{
+  public:
+    bool Load(const std::filesystem::path &path);
+    bool Parse(const std::string &text);
+
+    const std::vector<ChunkRef> &Chunks() const { return _chunks; }
+    uint64_t Size() const { return _size; }
+    const uint8_t *Hash() const { return _sha256; }
+    const std::string &Error() const { return _error; }
+
+  private:
+    bool Fail(const std::string &error);
+
+    std::vector<ChunkRef> _chunks;
+    uint64_t _size = 0;
+    uint8_t _sha256[Sha256::DigestSize] = {};
+    std::string _error;
+};
+
+struct ChunkStoreStats
+{
+    uint64_t chunks = 0;
+    uint64_t seededChunks = 0;
+    uint64_t compressedBytes = 0;
+    uint64_t uncompressedBytes = 0;
+};
+
+// A directory of gzip-compressed chunks named by the hash of their content,
+// shared by every release installed on the machine. Chunks missing from it
+// are looked up in seed directories, such as the chunks bundled with an
+// application, and copied into the store as they are used, so that each
+// chunk is stored once however many releases contain it.
+//
+// Only the tools and benches use it so far: the launcher installs from the
+// bundled archive until packages ship a shared store and a way to fetch the
+// chunks it is missing.
+class ChunkStore
+{
+  public:
+    explicit ChunkStore(std::filesystem::path root);
+
+    void AddSeed(std::filesystem::path directory);
+
+    // Where a chunk is stored, relative to a store or seed directory.
+    static std::filesystem::path ChunkPath(const ChunkRef &chunk);
+
+    // Lists the chunks of a manifest found neither in the store nor in any seed.
+    std::vector<ChunkRef> Missing(const ChunkManifest &manifest) const;
+
+    // Writes the tar stream of a manifest to sink, checking every chunk and
+    // the whole stream against their hashes.
+    RootfsStatus Assemble(const ChunkManifest &manifest, ByteSink &sink);
+
+    // Assembles the tar stream of a manifest and forwards its validated
+    // entries to sink, like RootfsImporter::Import does for an archive.
+    RootfsStatus Import(const ChunkManifest &manifest, TarSink &sink);
+
+    const ChunkStoreStats &Stats() const { return _stats; }
+    const std::string &Error() const { return _error; }
+
+  private:
+    RootfsStatus ReadChunk(const ChunkRef &chunk, std::vector<uint8_t> *data);
+    RootfsStatus Fail(RootfsStatus status, const std::string &error);
+
+    std::filesystem::path _root;
+    std::vector<std::filesystem::path> _seeds;
+    ChunkStoreStats _stats;
+    std::string _error;
+};
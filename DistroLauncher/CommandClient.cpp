@@ -0,0 +1,291 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "CommandClient.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef _WIN32
+    const CommandClient::Socket NoSocket = INVALID_SOCKET;
+    const int SendFlags = 0;
+
+    std::string LastError()
+    {
+        return "error " + std::to_string(WSAGetLastError());
+    }
+
+    void CloseSocket(CommandClient::Socket socket)
+    {
+        ::closesocket(socket);
+    }
+
+    bool Startup()
+    {
+        static const bool started = [] {
+            WSADATA data;
+            return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+        }();
+
+        return started;
+    }
+#else
+    const CommandClient::Socket NoSocket = -1;
+
+    // A server gone away is reported by send, not by a signal.
+    const int SendFlags = MSG_NOSIGNAL;
+
+    std::string LastError()
+    {
+        return std::strerror(errno);
+    }
+
+    void CloseSocket(CommandClient::Socket socket)
+    {
+        ::close(socket);
+    }
+
+    bool Startup()
+    {
+        return true;
+    }
+#endif
+}
+
+CommandClient::CommandClient() :
+    _socket(NoSocket)
+{
+}
+
+CommandClient::~CommandClient()
+{
+    Close();
+}
+
+bool CommandClient::Fail(const std::string &error)
+{
+    _error = error;
+    return false;
+}
+
+void CommandClient::Close()
+{
+    if (_socket != NoSocket) {
+        CloseSocket(_socket);
+        _socket = NoSocket;
+    }
+}
+
+bool CommandClient::ConnectTcp(uint16_t port, const std::string &token)
+{
+    Close();
+    if (!Startup()) {
+        return Fail("cannot start Winsock");
+    }
+
+    _socket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (_socket == NoSocket) {
+        return Fail("cannot create a socket: " + LastError());
+    }
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(_socket, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+        Fail("cannot connect to port " + std::to_string(port) + ": " + LastError());
+        Close();
+        return false;
+    }
+
+    // Frames are small and answered at once, so they must not wait for more.
+    int noDelay = 1;
+    ::setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&noDelay), sizeof(noDelay));
+    return Handshake(token);
+}
+
+#ifndef _WIN32
+bool CommandClient::ConnectUnix(const std::string &path, const std::string &token)
+{
+    Close();
+    sockaddr_un address = {};
+    if (path.size() >= sizeof(address.sun_path)) {
+        return Fail("socket path too long: " + path);
+    }
+
+    _socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_socket == NoSocket) {
+        return Fail("cannot create a socket: " + LastError());
+    }
+
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+    if (::connect(_socket, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+        Fail("cannot connect to " + path + ": " + LastError());
+        Close();
+        return false;
+    }
+
+    return Handshake(token);
+}
+#endif
+
+bool CommandClient::Handshake(const std::string &token)
+{
+    std::string hello;
+    CommandProtocol::AppendFrame(&hello, FrameType::Hello, 0, token.data(), token.size());
+    Frame frame;
+    if (!Send(hello) || !Receive(&frame)) {
+        Close();
+        return false;
+    }
+
+    if (frame.type != FrameType::Hello) {
+        Close();
+        return Fail("unexpected answer to the handshake");
+    }
+
+    return true;
+}
+
+bool CommandClient::Send(const std::string &bytes)
+{
+    std::lock_guard<std::mutex> lock(_sendLock);
+    for (size_t offset = 0; offset < bytes.size();) {
+        const int chunk = static_cast<int>(std::min<size_t>(bytes.size() - offset, 1 << 30));
+        const auto sent = ::send(_socket, bytes.data() + offset, chunk, SendFlags);
+        if (sent <= 0) {
+            return Fail("cannot send to the command server: " + LastError());
+        }
+
+        offset += static_cast<size_t>(sent);
+    }
+
+    return true;
+}
+
+bool CommandClient::Receive(Frame *frame)
+{
+    char buffer[64 << 10];
+    while (!_reader.Next(frame)) {
+        if (_reader.Broken()) {
+            return Fail("the command server sent a malformed frame");
+        }
+
+        const auto received = ::recv(_socket, buffer, sizeof(buffer), 0);
+        if (received == 0) {
+            return Fail("the command server closed the connection");
+        }
+
+        if (received < 0) {
+            return Fail("cannot receive from the command server: " + LastError());
+        }
+
+        _reader.Feed(buffer, static_cast<size_t>(received));
+    }
+
+    return true;
+}
+
+uint32_t CommandClient::Run(const std::string &command, const std::string &directory)
+{
+    std::string payload;
+    CommandProtocol::AppendU32(&payload, static_cast<uint32_t>(directory.size()));
+    payload += directory;
+    payload += command;
+    if (payload.size() > CommandProtocol::MaxPayload) {
+        Fail("command too long");
+        return 0;
+    }
+
+    const uint32_t id = _nextCommand;
+    _nextCommand += 1;
+    std::string frame;
+    CommandProtocol::AppendFrame(&frame, FrameType::Run, id, payload.data(), payload.size());
+    return Send(frame) ? id : 0;
+}
+
+bool CommandClient::SendInput(uint32_t command, const char *data, size_t size)
+{
+    while (size > 0) {
+        const size_t chunk = std::min(size, CommandProtocol::MaxPayload);
+        std::string frame;
+        CommandProtocol::AppendFrame(&frame, FrameType::Input, command, data, chunk);
+        if (!Send(frame)) {
+            return false;
+        }
+
+        data += chunk;
+        size -= chunk;
+    }
+
+    return true;
+}
+
+bool CommandClient::CloseInput(uint32_t command)
+{
+    std::string frame;
+    CommandProtocol::AppendFrame(&frame, FrameType::Input, command, nullptr, 0);
+    return Send(frame);
+}
+
+bool CommandClient::Next(CommandEvent *event)
+{
+    Frame frame;
+    if (!Receive(&frame)) {
+        return false;
+    }
+
+    event->type = frame.type;
+    event->command = frame.command;
+    event->stream = 0;
+    event->exitCode = 0;
+    event->data.clear();
+    switch (frame.type) {
+    case FrameType::Output:
+        if (frame.payload.empty()) {
+            return Fail("the command server sent a malformed frame");
+        }
+
+        event->stream = static_cast<uint8_t>(frame.payload[0]);
+        event->data.assign(frame.payload, 1, std::string::npos);
+        return true;
+
+    case FrameType::Exit:
+        if (frame.payload.size() != 4) {
+            return Fail("the command server sent a malformed frame");
+        }
+
+        event->exitCode = static_cast<int32_t>(CommandProtocol::ReadU32(frame.payload.data()));
+        return true;
+
+    case FrameType::Failed:
+        event->data = std::move(frame.payload);
+        return true;
+
+    default:
+        return Fail("the command server sent an unexpected frame");
+    }
+}
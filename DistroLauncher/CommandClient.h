@@ -0,0 +1,78 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "CommandProtocol.h"
+
+struct CommandEvent
+{
+    // Output, Exit or Failed.
+    FrameType type;
+    uint32_t command;
+
+    // For Output: 1 for the output stream, 2 for the error stream.
+    int stream = 0;
+
+    // Output data, or why a command failed.
+    std::string data;
+    int32_t exitCode = 0;
+};
+
+// A connection to the command server wsl-helper runs in the distribution,
+// over which commands are started without a launch each. It can be used from
+// two threads: one sending input, the other starting commands and reading
+// events.
+class CommandClient
+{
+  public:
+#ifdef _WIN32
+    using Socket = uintptr_t;
+#else
+    using Socket = int;
+#endif
+
+    CommandClient();
+    ~CommandClient();
+
+    CommandClient(const CommandClient &) = delete;
+    CommandClient &operator=(const CommandClient &) = delete;
+
+    // Connects to a server listening on the loopback interface, which WSL
+    // forwards between Windows and the distribution.
+    bool ConnectTcp(uint16_t port, const std::string &token);
+#ifndef _WIN32
+    bool ConnectUnix(const std::string &path, const std::string &token);
+#endif
+    void Close();
+
+    // Starts a command and returns its identifier, or 0 on failure.
+    uint32_t Run(const std::string &command, const std::string &directory);
+
+    bool SendInput(uint32_t command, const char *data, size_t size);
+    bool CloseInput(uint32_t command);
+
+    // Waits for the next event about any of the commands started.
+    bool Next(CommandEvent *event);
+
+    const std::string &Error() const { return _error; }
+
+  private:
+    bool Handshake(const std::string &token);
+    bool Send(const std::string &bytes);
+    bool Receive(Frame *frame);
+    bool Fail(const std::string &error);
+
+    Socket _socket;
+    std::mutex _sendLock;
+    FrameReader _reader;
+    uint32_t _nextCommand = 1;
+    std::string _error;
+};
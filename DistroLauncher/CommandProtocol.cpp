@@ -0,0 +1,69 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "CommandProtocol.h"
+
+void CommandProtocol::AppendU32(std::string *out, uint32_t value)
+{
+    for (int shift = 0; shift < 32; shift += 8) {
+        out->push_back(static_cast<char>((value >> shift) & 0xff));
+    }
+}
+
+uint32_t CommandProtocol::ReadU32(const char *data)
+{
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i -= 1) {
+        value = (value << 8) | static_cast<uint8_t>(data[i]);
+    }
+
+    return value;
+}
+
+void CommandProtocol::AppendFrame(std::string *out, FrameType type, uint32_t command, const void *payload, size_t size)
+{
+    AppendU32(out, static_cast<uint32_t>(size));
+    out->push_back(static_cast<char>(type));
+    AppendU32(out, command);
+    out->append(static_cast<const char *>(payload), size);
+}
+
+void FrameReader::Feed(const char *data, size_t size)
+{
+    // Consumed frames are only dropped once they are most of the buffer,
+    // so that draining many small frames does not move the rest each time.
+    if (_offset > (_buffer.size() / 2)) {
+        _buffer.erase(0, _offset);
+        _offset = 0;
+    }
+
+    _buffer.append(data, size);
+}
+
+bool FrameReader::Next(Frame *frame)
+{
+    if (_broken || (_buffer.size() - _offset < CommandProtocol::HeaderSize)) {
+        return false;
+    }
+
+    const char *header = _buffer.data() + _offset;
+    const uint32_t size = CommandProtocol::ReadU32(header);
+    const uint8_t type = static_cast<uint8_t>(header[4]);
+    if ((size > CommandProtocol::MaxPayload) || (type < static_cast<uint8_t>(FrameType::Hello)) ||
+        (type > static_cast<uint8_t>(FrameType::Failed))) {
+        _broken = true;
+        return false;
+    }
+
+    if (_buffer.size() - _offset < CommandProtocol::HeaderSize + size) {
+        return false;
+    }
+
+    frame->type = static_cast<FrameType>(type);
+    frame->command = CommandProtocol::ReadU32(header + 5);
+    frame->payload.assign(header + CommandProtocol::HeaderSize, size);
+    _offset += CommandProtocol::HeaderSize + size;
+    return true;
+}
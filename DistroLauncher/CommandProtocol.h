@@ -0,0 +1,81 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// The protocol between the launcher and the command server wsl-helper runs
+// in the distribution. Everything goes through one connection, as frames:
+//
+//     u32 payload size | u8 type | u32 command | payload
+//
+// in little-endian order. The client first sends Hello with the token the
+// server was started with, and waits for Hello back. It then sends Run frames,
+// each with an identifier of its choosing, and as many commands may be
+// running at once as the client likes; frames about a command carry its
+// identifier. Closing the connection kills the commands it started.
+enum class FrameType : uint8_t
+{
+    // Client: the token. Server: empty, once the token is accepted.
+    Hello = 1,
+
+    // Client: u32 directory size, the working directory (a Windows path is
+    // translated), then the command line for /bin/sh -c.
+    Run = 2,
+
+    // Client: data for the command's input; empty to close it.
+    Input = 3,
+
+    // Server: u8 stream (1 for output, 2 for error), then data.
+    Output = 4,
+
+    // Server: i32 exit code, 128 + the signal number if killed. The last
+    // frame about a command.
+    Exit = 5,
+
+    // Server: why the command could not be started. The last frame about it.
+    Failed = 6,
+};
+
+struct Frame
+{
+    FrameType type;
+    uint32_t command;
+    std::string payload;
+};
+
+namespace CommandProtocol
+{
+    constexpr size_t HeaderSize = 9;
+
+    // Frames carry at most this much; larger input and output are split.
+    constexpr size_t MaxPayload = 1 << 20;
+
+    void AppendFrame(std::string *out, FrameType type, uint32_t command, const void *payload, size_t size);
+
+    uint32_t ReadU32(const char *data);
+    void AppendU32(std::string *out, uint32_t value);
+}
+
+// Cuts a byte stream into frames, however it was split on the way.
+class FrameReader
+{
+  public:
+    void Feed(const char *data, size_t size);
+
+    // Takes the next complete frame; false when there is none yet, or when
+    // the stream is broken (see Broken()).
+    bool Next(Frame *frame);
+
+    bool Broken() const { return _broken; }
+
+  private:
+    std::string _buffer;
+    size_t _offset = 0;
+    bool _broken = false;
+};
@@ -0,0 +1,230 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "stdafx.h"
+#include "CommandClient.h"
+#include "StreamRelay.h"
+#include "Trace.h"
+
+#include <bcrypt.h>
+#include <fstream>
+#include <thread>
+
+namespace {
+    std::string ToUtf8(std::wstring_view text)
+    {
+        if (text.empty()) {
+            return std::string();
+        }
+
+        const int size = WideCharToMultiByte(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), nullptr, 0, nullptr, nullptr);
+        std::string converted(static_cast<size_t>(size), '\0');
+        WideCharToMultiByte(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), converted.data(), size, nullptr, nullptr);
+        return converted;
+    }
+
+    // Where the port and token of the running server are kept, readable by
+    // the current user only, like the rest of their local application data.
+    std::filesystem::path StatePath()
+    {
+        wchar_t buffer[MAX_PATH + 1];
+        const DWORD length = GetEnvironmentVariableW(L"LOCALAPPDATA", buffer, ARRAYSIZE(buffer));
+        if ((length == 0) || (length >= ARRAYSIZE(buffer))) {
+            return std::filesystem::path();
+        }
+
+        return std::filesystem::path(buffer) / DistributionInfo::Name / L"command-server";
+    }
+
+    bool LoadState(uint16_t *port, std::string *token)
+    {
+        const std::filesystem::path path = StatePath();
+        std::ifstream state(path);
+        unsigned int value = 0;
+        if (path.empty() || !(state >> value >> *token) || (value == 0) || (value > 65535)) {
+            return false;
+        }
+
+        *port = static_cast<uint16_t>(value);
+        return true;
+    }
+
+    void SaveState(uint16_t port, const std::string &token)
+    {
+        const std::filesystem::path path = StatePath();
+        if (path.empty()) {
+            return;
+        }
+
+        std::error_code error;
+        std::filesystem::create_directories(path.parent_path(), error);
+        std::ofstream(path, std::ios::trunc) << port << " " << token << "\n";
+    }
+
+    // Starts a server in the distribution. The token goes through the
+    // server's input, and the server answers with its port once listening.
+    HRESULT StartServer(uint16_t *port, std::string *token)
+    {
+        unsigned char random[16];
+        if (!BCRYPT_SUCCESS(BCryptGenRandom(nullptr, random, sizeof(random), BCRYPT_USE_SYSTEM_PREFERRED_RNG))) {
+            return E_FAIL;
+        }
+
+        token->clear();
+        for (const unsigned char byte : random) {
+            const char digits[] = "0123456789abcdef";
+            *token += digits[byte >> 4];
+            *token += digits[byte & 0xf];
+        }
+
+        HANDLE inputRead;
+        HANDLE inputWrite;
+        HANDLE outputRead;
+        HANDLE outputWrite;
+        SECURITY_ATTRIBUTES sa{sizeof(sa), nullptr, true};
+        if (!CreatePipe(&inputRead, &inputWrite, &sa, 0)) {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        if (!CreatePipe(&outputRead, &outputWrite, &sa, 0)) {
+            const HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+            CloseHandle(inputRead);
+            CloseHandle(inputWrite);
+            return hr;
+        }
+
+        HANDLE child;
+        HRESULT hr = g_wslApi.WslLaunch(ROOTFS_HELPER_PATH L" serve", false, inputRead, outputWrite, GetStdHandle(STD_ERROR_HANDLE), &child);
+        CloseHandle(inputRead);
+        CloseHandle(outputWrite);
+        std::string answer;
+        if (SUCCEEDED(hr)) {
+            const std::string line = *token + "\n";
+            DWORD count;
+            WriteFile(inputWrite, line.data(), static_cast<DWORD>(line.size()), &count, nullptr);
+            CloseHandle(inputWrite);
+            inputWrite = nullptr;
+
+            // The server detaches once it has answered, so this ends quickly.
+            char buffer[64];
+            while ((answer.find('\n') == std::string::npos) && ReadFile(outputRead, buffer, sizeof(buffer), &count, nullptr) &&
+                   (count > 0)) {
+                answer.append(buffer, count);
+            }
+
+            WaitForSingleObject(child, INFINITE);
+            CloseHandle(child);
+        }
+
+        if (inputWrite != nullptr) {
+            CloseHandle(inputWrite);
+        }
+
+        CloseHandle(outputRead);
+        if (FAILED(hr)) {
+            return hr;
+        }
+
+        const unsigned long value = std::strtoul(answer.c_str(), nullptr, 10);
+        if ((value == 0) || (value > 65535)) {
+            return HRESULT_FROM_WIN32(ERROR_CONNECTION_REFUSED);
+        }
+
+        *port = static_cast<uint16_t>(value);
+        return S_OK;
+    }
+
+    bool Connect(CommandClient &client)
+    {
+        uint16_t port;
+        std::string token;
+        if (LoadState(&port, &token) && client.ConnectTcp(port, token)) {
+            return true;
+        }
+
+        if (FAILED(StartServer(&port, &token)) || !client.ConnectTcp(port, token)) {
+            return false;
+        }
+
+        SaveState(port, token);
+        return true;
+    }
+
+    void Write(HANDLE handle, const std::string &data)
+    {
+        for (size_t offset = 0; offset < data.size();) {
+            DWORD written;
+            if (!WriteFile(handle, data.data() + offset, static_cast<DWORD>(data.size() - offset), &written, nullptr)) {
+                return;
+            }
+
+            offset += written;
+        }
+    }
+}
+
+bool CommandRelay::Enabled()
+{
+    wchar_t value[8];
+    const DWORD length = GetEnvironmentVariableW(COMMAND_RELAY_ENVIRONMENT, value, ARRAYSIZE(value));
+    return (length > 0) && (length < ARRAYSIZE(value)) && (std::wstring_view(value) == L"1");
+}
+
+HRESULT CommandRelay::Run(const std::wstring &command, DWORD *exitCode)
+{
+    TraceSpan span("CommandRelay::Run");
+
+    // The client is shared with the input thread, which may still be blocked
+    // reading when the command has ended.
+    auto client = std::make_shared<CommandClient>();
+    if (!Connect(*client)) {
+        return HRESULT_FROM_WIN32(ERROR_CONNECTION_REFUSED);
+    }
+
+    std::wstring directory(MAX_PATH + 1, L'\0');
+    DWORD length = GetCurrentDirectoryW(static_cast<DWORD>(directory.size()), directory.data());
+    if (length >= directory.size()) {
+        directory.resize(length);
+        length = GetCurrentDirectoryW(static_cast<DWORD>(directory.size()), directory.data());
+    }
+
+    directory.resize((length < directory.size()) ? length : 0);
+    const uint32_t id = client->Run(ToUtf8(command), ToUtf8(directory));
+    if (id == 0) {
+        return HRESULT_FROM_WIN32(ERROR_CONNECTION_ABORTED);
+    }
+
+    HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+    if ((input == nullptr) || (input == INVALID_HANDLE_VALUE) || (GetFileType(input) == FILE_TYPE_CHAR)) {
+        client->CloseInput(id);
+
+    } else {
+        std::thread([client, id, input] {
+            // Input is sent on as it is read, with no text-mode conversion.
+            StreamRelay relay;
+            relay.Copy(input, [&](const char *data, size_t size) { return client->SendInput(id, data, size); });
+            client->CloseInput(id);
+        }).detach();
+    }
+
+    const HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+    const HANDLE error = GetStdHandle(STD_ERROR_HANDLE);
+    CommandEvent event;
+    while (client->Next(&event)) {
+        if (event.type == FrameType::Output) {
+            Write((event.stream == 2) ? error : output, event.data);
+
+        } else if (event.type == FrameType::Exit) {
+            *exitCode = static_cast<DWORD>(event.exitCode);
+            return S_OK;
+
+        } else {
+            Write(error, event.data + "\n");
+            return HRESULT_FROM_WIN32(ERROR_CONNECTION_ABORTED);
+        }
+    }
+
+    return HRESULT_FROM_WIN32(ERROR_CONNECTION_ABORTED);
+}
@@ -0,0 +1,26 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+// Set to 1 to have `run` go through the command server.
+#define COMMAND_RELAY_ENVIRONMENT L"WSL_LAUNCHER_SERVER"
+
+// Runs commands through the command server wsl-helper keeps running in the
+// distribution, instead of a WSL launch each, for callers running many short
+// commands. The first command starts the server; later ones, from this and
+// other launcher processes, connect to it on the loopback interface with the
+// port and token kept in the user's local application data. Commands run
+// without a terminal: piped input is relayed, console input is not.
+namespace CommandRelay
+{
+    // Whether the caller asked for commands to go through the server.
+    bool Enabled();
+
+    // Runs a command in the current working directory, relaying its output.
+    // Fails with ERROR_CONNECTION_REFUSED, before the command is started,
+    // when the server can neither be reached nor started.
+    HRESULT Run(const std::wstring &command, DWORD *exitCode);
+}
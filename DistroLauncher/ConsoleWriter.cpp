@@ -0,0 +1,239 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "ConsoleWriter.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+namespace {
+    constexpr uint32_t Replacement = 0xfffd;
+
+    bool IsSurrogate(uint32_t value)
+    {
+        return (value >= 0xd800) && (value <= 0xdfff);
+    }
+
+    ConsoleWriter::Encoding HandleEncoding(ConsoleWriter::Handle handle)
+    {
+#ifdef _WIN32
+        DWORD mode;
+        return GetConsoleMode(handle, &mode) ? ConsoleWriter::Encoding::Utf16 : ConsoleWriter::Encoding::Utf8;
+#else
+        (void)handle;
+        return ConsoleWriter::Encoding::Utf8;
+#endif
+    }
+}
+
+ConsoleWriter::ConsoleWriter(Handle handle, size_t capacity) :
+    ConsoleWriter(handle, HandleEncoding(handle), capacity)
+{
+}
+
+ConsoleWriter::ConsoleWriter(Handle handle, Encoding encoding, size_t capacity) :
+    _handle(handle),
+    _encoding(encoding),
+    _capacity(std::max<size_t>(capacity, 4))
+{
+    if (_encoding == Encoding::Utf8) {
+        _bytes.reserve(_capacity);
+
+    } else {
+        _units.reserve(_capacity);
+    }
+}
+
+ConsoleWriter::~ConsoleWriter()
+{
+    Flush();
+}
+
+void ConsoleWriter::Append(const wchar_t *text, size_t length)
+{
+    for (size_t index = 0; index < length; index += 1) {
+        uint32_t value = static_cast<uint32_t>(text[index]);
+        if constexpr (sizeof(wchar_t) == 2) {
+            if ((value >= 0xd800) && (value <= 0xdbff) && ((index + 1) < length)) {
+                const uint32_t low = static_cast<uint32_t>(text[index + 1]);
+                if ((low >= 0xdc00) && (low <= 0xdfff)) {
+                    value = 0x10000 + ((value - 0xd800) << 10) + (low - 0xdc00);
+                    index += 1;
+                }
+            }
+        }
+
+        Put((IsSurrogate(value) || (value > 0x10ffff)) ? Replacement : value);
+    }
+}
+
+void ConsoleWriter::AppendUtf8(const char *text, size_t size)
+{
+    if (_encoding == Encoding::Utf8) {
+        while (size > 0) {
+            if (_bytes.size() >= _capacity) {
+                Flush();
+            }
+
+            const size_t count = std::min(size, _capacity - _bytes.size());
+            _bytes.append(text, count);
+            text += count;
+            size -= count;
+        }
+
+        return;
+    }
+
+    size_t index = 0;
+    while (index < size) {
+        const uint32_t byte = static_cast<unsigned char>(text[index]);
+        if (_needed > 0) {
+            // A sequence cut short is replaced, and the byte that cut it
+            // short starts over.
+            if ((byte & 0xc0) != 0x80) {
+                _needed = 0;
+                Put(Replacement);
+                continue;
+            }
+
+            _codePoint = (_codePoint << 6) | (byte & 0x3f);
+            _needed -= 1;
+            if (_needed == 0) {
+                const bool valid = (_codePoint >= _minimum) && (_codePoint <= 0x10ffff) && !IsSurrogate(_codePoint);
+                Put(valid ? _codePoint : Replacement);
+            }
+
+        } else if (byte < 0x80) {
+            Put(byte);
+
+        } else if ((byte >= 0xc2) && (byte <= 0xdf)) {
+            _codePoint = byte & 0x1f;
+            _needed = 1;
+            _minimum = 0x80;
+
+        } else if ((byte & 0xf0) == 0xe0) {
+            _codePoint = byte & 0x0f;
+            _needed = 2;
+            _minimum = 0x800;
+
+        } else if ((byte >= 0xf0) && (byte <= 0xf4)) {
+            _codePoint = byte & 0x07;
+            _needed = 3;
+            _minimum = 0x10000;
+
+        } else {
+            Put(Replacement);
+        }
+
+        index += 1;
+    }
+}
+
+bool ConsoleWriter::Flush()
+{
+    bool written = true;
+    if (_encoding == Encoding::Utf8) {
+        written = _bytes.empty() || Write(_bytes.data(), _bytes.size());
+        _bytes.clear();
+
+    } else {
+        written = _units.empty() || Write(_units.data(), _units.size());
+        _units.clear();
+    }
+
+    return written;
+}
+
+void ConsoleWriter::Put(uint32_t codePoint)
+{
+    // Flushing before a character rather than in the middle of one keeps
+    // every write whole text.
+    if ((Pending() + 4) > _capacity) {
+        Flush();
+    }
+
+    if (_encoding == Encoding::Utf16) {
+        if (codePoint < 0x10000) {
+            _units.push_back(static_cast<char16_t>(codePoint));
+
+        } else {
+            codePoint -= 0x10000;
+            _units.push_back(static_cast<char16_t>(0xd800 + (codePoint >> 10)));
+            _units.push_back(static_cast<char16_t>(0xdc00 + (codePoint & 0x3ff)));
+        }
+
+    } else if (codePoint < 0x80) {
+        _bytes.push_back(static_cast<char>(codePoint));
+
+    } else if (codePoint < 0x800) {
+        _bytes.push_back(static_cast<char>(0xc0 | (codePoint >> 6)));
+        _bytes.push_back(static_cast<char>(0x80 | (codePoint & 0x3f)));
+
+    } else if (codePoint < 0x10000) {
+        _bytes.push_back(static_cast<char>(0xe0 | (codePoint >> 12)));
+        _bytes.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f)));
+        _bytes.push_back(static_cast<char>(0x80 | (codePoint & 0x3f)));
+
+    } else {
+        _bytes.push_back(static_cast<char>(0xf0 | (codePoint >> 18)));
+        _bytes.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f)));
+        _bytes.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f)));
+        _bytes.push_back(static_cast<char>(0x80 | (codePoint & 0x3f)));
+    }
+}
+
+// Takes a size in code units for UTF-16 and in bytes for UTF-8.
+bool ConsoleWriter::Write(const void *data, size_t size)
+{
+#ifdef _WIN32
+    const size_t unit = (_encoding == Encoding::Utf16) ? sizeof(char16_t) : 1;
+    const char *next = static_cast<const char *>(data);
+    while (size > 0) {
+        DWORD written = 0;
+        _writes += 1;
+        const BOOL result = (_encoding == Encoding::Utf16)
+                                ? WriteConsoleW(_handle, next, static_cast<DWORD>(size), &written, nullptr)
+                                : WriteFile(_handle, next, static_cast<DWORD>(size), &written, nullptr);
+
+        if (!result || (written == 0)) {
+            return false;
+        }
+
+        next += written * unit;
+        size -= written;
+    }
+#else
+    const char *next = static_cast<const char *>(data);
+    size *= (_encoding == Encoding::Utf16) ? sizeof(char16_t) : 1;
+    while (size > 0) {
+        _writes += 1;
+        const ssize_t written = ::write(_handle, next, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        next += written;
+        size -= static_cast<size_t>(written);
+    }
+#endif
+
+    return true;
+}
@@ -0,0 +1,86 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Collects what the launcher prints and writes it at once when flushed,
+// rather than a write for every message: on a console every write is a round
+// trip to the console host, and into a redirected log every write is a
+// system call. Text is kept the way the handle takes it, UTF-16 for a
+// console, written with WriteConsoleW, and UTF-8 for anything else, so that
+// flushing converts nothing. The buffer is allocated once and kept between
+// flushes; text that does not fit in it is written as it fills.
+class ConsoleWriter
+{
+  public:
+#ifdef _WIN32
+    using Handle = void *;
+#else
+    using Handle = int;
+#endif
+
+    enum class Encoding
+    {
+        Utf8,
+        Utf16,
+    };
+
+    // In UTF-16 code units or bytes. Consoles have taken writes this large
+    // at once since long before WriteConsoleW took any size.
+    static constexpr size_t DefaultCapacity = 32 << 10;
+
+    // Writes in the encoding the handle takes.
+    explicit ConsoleWriter(Handle handle, size_t capacity = DefaultCapacity);
+    ConsoleWriter(Handle handle, Encoding encoding, size_t capacity = DefaultCapacity);
+
+    // Writes what is left.
+    ~ConsoleWriter();
+
+    ConsoleWriter(const ConsoleWriter &) = delete;
+    ConsoleWriter &operator=(const ConsoleWriter &) = delete;
+
+    // Unpaired surrogates and values that are not characters are written as
+    // U+FFFD.
+    void Append(const wchar_t *text, size_t length);
+    void Append(const std::wstring &text) { Append(text.data(), text.size()); }
+
+    // UTF-8 text, such as output from the distribution. It is written as it
+    // is where the handle takes UTF-8; converted, invalid sequences become
+    // U+FFFD and a character split between two appends is put back together.
+    void AppendUtf8(const char *text, size_t size);
+
+    // Writes everything appended so far; false if writing failed, in which
+    // case it is dropped.
+    bool Flush();
+
+    Encoding TextEncoding() const { return _encoding; }
+
+    // Code units or bytes waiting for the next flush.
+    size_t Pending() const { return (_encoding == Encoding::Utf8) ? _bytes.size() : _units.size(); }
+
+    // Writes made so far, for benchmarks.
+    uint64_t Writes() const { return _writes; }
+
+  private:
+    void Put(uint32_t codePoint);
+    bool Write(const void *data, size_t size);
+
+    Handle _handle;
+    Encoding _encoding;
+    size_t _capacity;
+    std::string _bytes;
+    std::u16string _units;
+    uint64_t _writes = 0;
+
+    // A UTF-8 sequence still being decoded: its value so far, the bytes it
+    // still needs and the smallest value it may encode.
+    uint32_t _codePoint = 0;
+    unsigned int _needed = 0;
+    uint32_t _minimum = 0;
+};
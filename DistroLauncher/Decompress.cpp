@@ -0,0 +1,123 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "Decompress.h"
+
+#include <cstring>
+#include <utility>
+
+#include "InputBuffer.h"
+#include "ParallelInflate.h"
+#include "Xz.h"
+#include "Zstd.h"
+
+namespace {
+    const uint8_t GzipMagic[] = {0x1f, 0x8b};
+    const uint8_t ZstdMagic[] = {0x28, 0xb5, 0x2f, 0xfd};
+    const uint8_t XzMagic[] = {0xfd, '7', 'z', 'X', 'Z', 0x00};
+
+    template <size_t Size>
+    bool HasMagic(const uint8_t *data, size_t size, const uint8_t (&magic)[Size])
+    {
+        return (size >= Size) && (std::memcmp(data, magic, Size) == 0);
+    }
+}
+
+CompressionFormat DetectCompression(const uint8_t *data, size_t size)
+{
+    if (HasMagic(data, size, GzipMagic)) {
+        return CompressionFormat::Gzip;
+    }
+
+    if (HasMagic(data, size, ZstdMagic)) {
+        return CompressionFormat::Zstd;
+    }
+
+    if (HasMagic(data, size, XzMagic)) {
+        return CompressionFormat::Xz;
+    }
+
+    return CompressionFormat::Unknown;
+}
+
+const char *CompressionName(CompressionFormat format)
+{
+    switch (format) {
+    case CompressionFormat::Gzip:
+        return "gzip";
+
+    case CompressionFormat::Zstd:
+        return "zstd";
+
+    case CompressionFormat::Xz:
+        return "xz";
+
+    default:
+        return "unknown";
+    }
+}
+
+Decompressor::Decompressor(ByteSource &source, DecompressOptions options) :
+    _source(source),
+    _options(std::move(options))
+{
+}
+
+InflateStatus Decompressor::Decode(ByteSink &sink)
+{
+    // Pull just enough input to recognize the format, then replay it.
+    std::vector<uint8_t> prefix;
+    while (prefix.size() < CompressionMagicSize) {
+        const uint8_t *data = nullptr;
+        size_t size = 0;
+        if (!_source.Next(&data, &size)) {
+            break;
+        }
+
+        prefix.insert(prefix.end(), data, data + size);
+    }
+
+    if (prefix.empty()) {
+        _error = "empty archive";
+        return InflateStatus::Truncated;
+    }
+
+    _format = DetectCompression(prefix.data(), prefix.size());
+    ReplaySource source(std::move(prefix), _source);
+    InflateStatus status;
+    switch (_format) {
+    case CompressionFormat::Gzip: {
+        ParallelGzipDecoder decoder(source, _options.threads, _options.flushSize);
+        status = decoder.Decode(sink);
+        _error = decoder.Error();
+        break;
+    }
+
+    case CompressionFormat::Zstd: {
+        ZstdDecoder decoder(source, _options.flushSize);
+        if (!_options.dictionary.empty() && !decoder.SetDictionary(_options.dictionary)) {
+            _error = "invalid zstd dictionary";
+            return InflateStatus::Corrupt;
+        }
+
+        status = decoder.Decode(sink);
+        _error = decoder.Error();
+        break;
+    }
+
+    case CompressionFormat::Xz: {
+        XzDecoder decoder(source, _options.flushSize);
+        status = decoder.Decode(sink);
+        _error = decoder.Error();
+        break;
+    }
+
+    default:
+        _error = "unrecognized archive compression";
+        return InflateStatus::Corrupt;
+    }
+
+    return status;
+}
@@ -0,0 +1,60 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Inflate.h"
+
+enum class CompressionFormat
+{
+    Unknown,
+    Gzip,
+    Zstd,
+    Xz,
+};
+
+// Number of leading bytes DetectCompression() needs to tell formats apart.
+constexpr size_t CompressionMagicSize = 6;
+
+// Identifies the compression of a stream from its magic bytes.
+CompressionFormat DetectCompression(const uint8_t *data, size_t size);
+
+const char *CompressionName(CompressionFormat format);
+
+struct DecompressOptions
+{
+    // Size of the blocks of decompressed data handed to the sink.
+    size_t flushSize = 1 << 20;
+
+    // Threads decoding block-indexed gzip archives; 0 uses one per hardware thread.
+    unsigned threads = 0;
+
+    // Dictionary zstd streams were compressed with, if any.
+    std::vector<uint8_t> dictionary;
+};
+
+// Decodes a gzip, zstd or xz stream, picking the decoder from the magic bytes
+// at the start of the stream rather than from a file name.
+class Decompressor
+{
+  public:
+    Decompressor(ByteSource &source, DecompressOptions options = {});
+
+    InflateStatus Decode(ByteSink &sink);
+
+    CompressionFormat Format() const { return _format; }
+    const std::string &Error() const { return _error; }
+
+  private:
+    ByteSource &_source;
+    DecompressOptions _options;
+    CompressionFormat _format = CompressionFormat::Unknown;
+    std::string _error;
+};
@@ -0,0 +1,796 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "Deflate.h"
+
+#include <algorithm>
+#include <array>
+#include <thread>
+#include <utility>
+
+namespace {
+    const uint16_t LengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                     35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    const uint8_t LengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                     3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    const uint16_t DistanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                       257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                       8193, 12289, 16385, 24577};
+    const uint8_t DistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                       7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    const uint8_t CodeLengthOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    constexpr unsigned LiteralCodes = 286;
+    constexpr unsigned DistanceCodes = 30;
+    constexpr unsigned CodeLengthCodes = 19;
+    constexpr unsigned EndOfBlock = 256;
+
+    constexpr size_t MinMatch = 3;
+    constexpr size_t MaxMatch = 258;
+
+    // A slot of the chains is reused every window, so matches reach back one
+    // byte less than the window, and a reused slot is never followed.
+    constexpr size_t WindowSize = 32768;
+    constexpr size_t MaxDistance = WindowSize - 1;
+    constexpr unsigned HashBits = 15;
+
+    // How hard matches are looked for, as zlib's default level has it: a
+    // match this long is taken without looking for a longer one at the next
+    // byte, chains are followed a quarter as far once a match this good is
+    // found, a match this long ends the search, and no chain is followed
+    // further than this.
+    constexpr size_t LazyLength = 16;
+    constexpr size_t GoodLength = 8;
+    constexpr size_t NiceLength = 128;
+    constexpr unsigned MaxChain = 128;
+
+    // Three-byte matches further back than this take more bits than the
+    // literals they replace.
+    constexpr size_t TooFar = 4096;
+
+    // Symbols collected before a block is written: enough for its codes to
+    // pay for themselves, few enough for them to follow the data.
+    constexpr size_t BlockSymbols = 1 << 15;
+
+    constexpr size_t MaxStoredSize = 65535;
+
+    // A literal, or a match of length bytes when distance is not 0.
+    struct Symbol
+    {
+        uint16_t value;
+        uint16_t distance;
+    };
+
+    class BitWriter
+    {
+      public:
+        explicit BitWriter(std::vector<uint8_t> *output) : _output(output) {}
+
+        void Put(uint32_t bits, unsigned count)
+        {
+            _bits |= static_cast<uint64_t>(bits) << _count;
+            _count += count;
+            while (_count >= 8) {
+                _output->push_back(static_cast<uint8_t>(_bits));
+                _bits >>= 8;
+                _count -= 8;
+            }
+        }
+
+        void Align()
+        {
+            if (_count > 0) {
+                _output->push_back(static_cast<uint8_t>(_bits));
+                _bits = 0;
+                _count = 0;
+            }
+        }
+
+        void PutBytes(const uint8_t *data, size_t size) { _output->insert(_output->end(), data, data + size); }
+
+      private:
+        std::vector<uint8_t> *_output;
+        uint64_t _bits = 0;
+        unsigned _count = 0;
+    };
+
+    const std::array<uint8_t, MaxMatch + 1> &LengthCodes()
+    {
+        static const std::array<uint8_t, MaxMatch + 1> codes = [] {
+            std::array<uint8_t, MaxMatch + 1> c{};
+            for (unsigned code = 0; code < 29; code += 1) {
+                const unsigned end = (code == 28) ? (MaxMatch + 1) : LengthBase[code + 1];
+                for (unsigned length = LengthBase[code]; length < end; length += 1) {
+                    c[length] = static_cast<uint8_t>(code);
+                }
+            }
+
+            // 258 has a code of its own rather than being 227 plus 31.
+            c[MaxMatch] = 28;
+            return c;
+        }();
+
+        return codes;
+    }
+
+    unsigned DistanceCode(unsigned distance)
+    {
+        const unsigned value = distance - 1;
+        if (value < 4) {
+            return value;
+        }
+
+        unsigned bit = 2;
+        while ((value >> (bit + 1)) != 0) {
+            bit += 1;
+        }
+
+        return (2 * bit) + ((value >> (bit - 1)) & 1);
+    }
+
+    uint16_t Reverse(unsigned code, unsigned length)
+    {
+        unsigned reversed = 0;
+        for (unsigned i = 0; i < length; i += 1) {
+            reversed = (reversed << 1) | ((code >> i) & 1);
+        }
+
+        return static_cast<uint16_t>(reversed);
+    }
+
+    // Code lengths of at most maxLength bits for the given frequencies:
+    // optimal ones, computed in place as Moffat and Katajainen do, then
+    // limited the way miniz limits them, shortening the longest codes and
+    // lengthening the shortest that keep the code complete.
+    void BuildLengths(const uint32_t *frequencies, unsigned count, unsigned maxLength, uint8_t *lengths)
+    {
+        std::vector<std::pair<uint32_t, uint16_t>> symbols;
+        for (unsigned symbol = 0; symbol < count; symbol += 1) {
+            lengths[symbol] = 0;
+            if (frequencies[symbol] != 0) {
+                symbols.emplace_back(frequencies[symbol], static_cast<uint16_t>(symbol));
+            }
+        }
+
+        const size_t n = symbols.size();
+        if (n == 0) {
+            return;
+        }
+
+        if (n == 1) {
+            lengths[symbols[0].second] = 1;
+            return;
+        }
+
+        std::sort(symbols.begin(), symbols.end());
+        std::vector<uint32_t> a(n);
+        for (size_t i = 0; i < n; i += 1) {
+            a[i] = symbols[i].first;
+        }
+
+        // The tree, leaves and internal nodes merged in order of weight,
+        // with each internal node then pointing to its parent.
+        a[0] += a[1];
+        size_t root = 0;
+        size_t leaf = 2;
+        for (size_t next = 1; next < (n - 1); next += 1) {
+            if ((leaf >= n) || (a[root] < a[leaf])) {
+                a[next] = a[root];
+                a[root] = static_cast<uint32_t>(next);
+                root += 1;
+
+            } else {
+                a[next] = a[leaf];
+                leaf += 1;
+            }
+
+            if ((leaf >= n) || ((root < next) && (a[root] < a[leaf]))) {
+                a[next] += a[root];
+                a[root] = static_cast<uint32_t>(next);
+                root += 1;
+
+            } else {
+                a[next] += a[leaf];
+                leaf += 1;
+            }
+        }
+
+        // The depth of every internal node, then of every leaf.
+        a[n - 2] = 0;
+        for (size_t next = n - 2; next > 0; next -= 1) {
+            a[next - 1] = a[a[next - 1]] + 1;
+        }
+
+        size_t available = 1;
+        size_t used = 0;
+        uint32_t depth = 0;
+        ptrdiff_t node = static_cast<ptrdiff_t>(n) - 2;
+        ptrdiff_t next = static_cast<ptrdiff_t>(n) - 1;
+        while (available > 0) {
+            while ((node >= 0) && (a[node] == depth)) {
+                used += 1;
+                node -= 1;
+            }
+
+            while (available > used) {
+                a[next] = depth;
+                next -= 1;
+                available -= 1;
+            }
+
+            available = 2 * used;
+            depth += 1;
+            used = 0;
+        }
+
+        unsigned counts[33] = {};
+        for (size_t i = 0; i < n; i += 1) {
+            counts[std::min<uint32_t>(a[i], 32)] += 1;
+        }
+
+        for (unsigned length = maxLength + 1; length <= 32; length += 1) {
+            counts[maxLength] += counts[length];
+            counts[length] = 0;
+        }
+
+        uint32_t total = 0;
+        for (unsigned length = 1; length <= maxLength; length += 1) {
+            total += counts[length] << (maxLength - length);
+        }
+
+        while (total != (1u << maxLength)) {
+            counts[maxLength] -= 1;
+            for (unsigned length = maxLength - 1; length > 0; length -= 1) {
+                if (counts[length] != 0) {
+                    counts[length] -= 1;
+                    counts[length + 1] += 2;
+                    break;
+                }
+            }
+
+            total -= 1;
+        }
+
+        // The least frequent symbols, first in the sorted order, get the
+        // longest codes.
+        size_t index = 0;
+        for (unsigned length = maxLength; length > 0; length -= 1) {
+            for (unsigned k = counts[length]; k > 0; k -= 1) {
+                lengths[symbols[index].second] = static_cast<uint8_t>(length);
+                index += 1;
+            }
+        }
+    }
+
+    // Canonical codes for the lengths, bit-reversed as DEFLATE writes them.
+    void BuildCodes(const uint8_t *lengths, unsigned count, uint16_t *codes)
+    {
+        unsigned sizes[16] = {};
+        for (unsigned symbol = 0; symbol < count; symbol += 1) {
+            sizes[lengths[symbol]] += 1;
+        }
+
+        sizes[0] = 0;
+        unsigned nextCode[16] = {};
+        unsigned code = 0;
+        for (unsigned length = 1; length < 16; length += 1) {
+            code = (code + sizes[length - 1]) << 1;
+            nextCode[length] = code;
+        }
+
+        for (unsigned symbol = 0; symbol < count; symbol += 1) {
+            const unsigned length = lengths[symbol];
+            codes[symbol] = (length == 0) ? 0 : Reverse(nextCode[length]++, length);
+        }
+    }
+
+    // Lengths and codes for the literal and length alphabet, then the
+    // distance alphabet.
+    struct Codes
+    {
+        uint8_t lengths[LiteralCodes + DistanceCodes];
+        uint16_t codes[LiteralCodes + DistanceCodes];
+
+        const uint8_t *DistanceLengths() const { return lengths + LiteralCodes; }
+        const uint16_t *DistanceTable() const { return codes + LiteralCodes; }
+    };
+
+    const Codes &FixedCodes()
+    {
+        static const Codes fixed = [] {
+            // The fixed code has 288 literal and length symbols, the last
+            // two never used but taking their place among the 8-bit codes.
+            uint8_t lengths[288];
+            uint16_t codes[288];
+            for (unsigned symbol = 0; symbol < 288; symbol += 1) {
+                lengths[symbol] = (symbol < 144) ? 8 : (symbol < 256) ? 9 : (symbol < 280) ? 7 : 8;
+            }
+
+            BuildCodes(lengths, 288, codes);
+            Codes c{};
+            std::copy(lengths, lengths + LiteralCodes, c.lengths);
+            std::copy(codes, codes + LiteralCodes, c.codes);
+            std::fill(c.lengths + LiteralCodes, c.lengths + LiteralCodes + DistanceCodes, static_cast<uint8_t>(5));
+            BuildCodes(c.DistanceLengths(), DistanceCodes, c.codes + LiteralCodes);
+            return c;
+        }();
+
+        return fixed;
+    }
+
+    class Encoder
+    {
+      public:
+        Encoder(const uint8_t *data, size_t size, std::vector<uint8_t> *output) :
+            _data(data),
+            _size(size),
+            _writer(output),
+            _head(size_t{1} << HashBits, -1),
+            _chain(WindowSize, -1)
+        {
+            _symbols.reserve(BlockSymbols);
+        }
+
+        void Run()
+        {
+            // Matches are looked for at every byte, but taken only if the
+            // next byte does not start a longer one.
+            size_t pos = 0;
+            bool pending = false;
+            size_t pendingLength = 0;
+            size_t pendingDistance = 0;
+            while (pos < _size) {
+                Insert(pos);
+                size_t length = 0;
+                size_t distance = 0;
+                if (!pending || (pendingLength < LazyLength)) {
+                    FindMatch(pos, pending ? pendingLength : 0, &length, &distance);
+                }
+
+                if (pending && (pendingLength >= MinMatch) && (length <= pendingLength)) {
+                    AddMatch(pendingLength, pendingDistance);
+                    const size_t end = pos - 1 + pendingLength;
+                    for (pos += 1; pos < end; pos += 1) {
+                        Insert(pos);
+                    }
+
+                    pending = false;
+                    continue;
+                }
+
+                if (pending) {
+                    AddLiteral(_data[pos - 1]);
+                }
+
+                pending = true;
+                pendingLength = length;
+                pendingDistance = distance;
+                pos += 1;
+            }
+
+            if (pending) {
+                if (pendingLength >= MinMatch) {
+                    AddMatch(pendingLength, pendingDistance);
+
+                } else {
+                    AddLiteral(_data[pos - 1]);
+                }
+            }
+
+            WriteBlock(true);
+            _writer.Align();
+        }
+
+      private:
+        uint32_t Hash(size_t pos) const
+        {
+            const uint8_t *p = _data + pos;
+            return ((static_cast<uint32_t>(p[0]) << 10) ^ (static_cast<uint32_t>(p[1]) << 5) ^ p[2]) & ((1u << HashBits) - 1);
+        }
+
+        void Insert(size_t pos)
+        {
+            if ((pos + MinMatch) <= _size) {
+                const uint32_t hash = Hash(pos);
+                _chain[pos & (WindowSize - 1)] = _head[hash];
+                _head[hash] = static_cast<int32_t>(pos);
+            }
+        }
+
+        // The longest match for the bytes at pos, if longer than minimum;
+        // pos must have been inserted.
+        void FindMatch(size_t pos, size_t minimum, size_t *length, size_t *distance) const
+        {
+            const size_t limit = std::min(MaxMatch, _size - pos);
+            size_t best = std::max(minimum, MinMatch - 1);
+            if (best >= limit) {
+                return;
+            }
+
+            unsigned chain = (minimum >= GoodLength) ? (MaxChain >> 2) : MaxChain;
+            const int64_t lowest = static_cast<int64_t>(pos) - static_cast<int64_t>(MaxDistance);
+            const uint8_t *current = _data + pos;
+            int64_t candidate = _chain[pos & (WindowSize - 1)];
+            while ((candidate >= 0) && (candidate >= lowest) && (chain > 0)) {
+                chain -= 1;
+                const uint8_t *match = _data + candidate;
+                if ((match[best] == current[best]) && (match[0] == current[0]) && (match[1] == current[1])) {
+                    size_t matched = 2;
+                    while ((matched < limit) && (match[matched] == current[matched])) {
+                        matched += 1;
+                    }
+
+                    if (matched > best) {
+                        best = matched;
+                        *length = matched;
+                        *distance = pos - static_cast<size_t>(candidate);
+                        if ((matched >= NiceLength) || (matched == limit)) {
+                            break;
+                        }
+                    }
+                }
+
+                const int64_t next = _chain[static_cast<size_t>(candidate) & (WindowSize - 1)];
+                if (next >= candidate) {
+                    break;
+                }
+
+                candidate = next;
+            }
+
+            if ((*length == MinMatch) && (*distance > TooFar)) {
+                *length = 0;
+                *distance = 0;
+            }
+        }
+
+        void AddLiteral(uint8_t value)
+        {
+            _symbols.push_back(Symbol{value, 0});
+            _covered += 1;
+            if (_symbols.size() == BlockSymbols) {
+                WriteBlock(false);
+            }
+        }
+
+        void AddMatch(size_t length, size_t distance)
+        {
+            _symbols.push_back(Symbol{static_cast<uint16_t>(length), static_cast<uint16_t>(distance)});
+            _covered += length;
+            if (_symbols.size() == BlockSymbols) {
+                WriteBlock(false);
+            }
+        }
+
+        // Bits the symbols of the block take with the given codes.
+        uint64_t DataBits(const uint32_t *frequencies, const uint8_t *lengths) const
+        {
+            uint64_t bits = 0;
+            for (unsigned symbol = 0; symbol < (LiteralCodes + DistanceCodes); symbol += 1) {
+                bits += static_cast<uint64_t>(frequencies[symbol]) * lengths[symbol];
+                if ((symbol > EndOfBlock) && (symbol < LiteralCodes)) {
+                    bits += static_cast<uint64_t>(frequencies[symbol]) * LengthExtra[symbol - EndOfBlock - 1];
+
+                } else if (symbol >= LiteralCodes) {
+                    bits += static_cast<uint64_t>(frequencies[symbol]) * DistanceExtra[symbol - LiteralCodes];
+                }
+            }
+
+            return bits;
+        }
+
+        void WriteBlock(bool last)
+        {
+            const auto &lengthCodes = LengthCodes();
+            uint32_t frequencies[LiteralCodes + DistanceCodes] = {};
+            for (const Symbol &symbol : _symbols) {
+                if (symbol.distance == 0) {
+                    frequencies[symbol.value] += 1;
+
+                } else {
+                    frequencies[EndOfBlock + 1 + lengthCodes[symbol.value]] += 1;
+                    frequencies[LiteralCodes + DistanceCode(symbol.distance)] += 1;
+                }
+            }
+
+            frequencies[EndOfBlock] = 1;
+
+            // Every alphabet gets at least two codes, as zlib gives them, so
+            // that no decoder meets a code of a single symbol.
+            uint32_t forced[LiteralCodes + DistanceCodes];
+            std::copy(frequencies, frequencies + LiteralCodes + DistanceCodes, forced);
+            ForceTwo(forced, LiteralCodes);
+            ForceTwo(forced + LiteralCodes, DistanceCodes);
+
+            Codes dynamic;
+            BuildLengths(forced, LiteralCodes, 15, dynamic.lengths);
+            BuildLengths(forced + LiteralCodes, DistanceCodes, 15, dynamic.lengths + LiteralCodes);
+            BuildCodes(dynamic.lengths, LiteralCodes, dynamic.codes);
+            BuildCodes(dynamic.DistanceLengths(), DistanceCodes, dynamic.codes + LiteralCodes);
+
+            unsigned literalCount = LiteralCodes;
+            while ((literalCount > 257) && (dynamic.lengths[literalCount - 1] == 0)) {
+                literalCount -= 1;
+            }
+
+            unsigned distanceCount = DistanceCodes;
+            while ((distanceCount > 1) && (dynamic.lengths[LiteralCodes + distanceCount - 1] == 0)) {
+                distanceCount -= 1;
+            }
+
+            // The code lengths, run-length encoded as the block header has them.
+            std::vector<uint8_t> all(dynamic.lengths, dynamic.lengths + literalCount);
+            all.insert(all.end(), dynamic.lengths + LiteralCodes, dynamic.lengths + LiteralCodes + distanceCount);
+            std::vector<std::pair<uint8_t, uint8_t>> runs;
+            for (size_t i = 0; i < all.size();) {
+                const uint8_t length = all[i];
+                size_t run = 1;
+                while (((i + run) < all.size()) && (all[i + run] == length)) {
+                    run += 1;
+                }
+
+                i += run;
+                if (length == 0) {
+                    while (run >= 11) {
+                        const size_t repeat = std::min<size_t>(run, 138);
+                        runs.emplace_back(18, static_cast<uint8_t>(repeat - 11));
+                        run -= repeat;
+                    }
+
+                    if (run >= 3) {
+                        runs.emplace_back(17, static_cast<uint8_t>(run - 3));
+                        run = 0;
+                    }
+
+                } else {
+                    runs.emplace_back(length, 0);
+                    run -= 1;
+                    while (run >= 3) {
+                        const size_t repeat = std::min<size_t>(run, 6);
+                        runs.emplace_back(16, static_cast<uint8_t>(repeat - 3));
+                        run -= repeat;
+                    }
+                }
+
+                for (; run > 0; run -= 1) {
+                    runs.emplace_back(length, 0);
+                }
+            }
+
+            uint32_t runFrequencies[CodeLengthCodes] = {};
+            for (const auto &run : runs) {
+                runFrequencies[run.first] += 1;
+            }
+
+            ForceTwo(runFrequencies, CodeLengthCodes);
+            uint8_t runLengths[CodeLengthCodes];
+            uint16_t runCodes[CodeLengthCodes];
+            BuildLengths(runFrequencies, CodeLengthCodes, 7, runLengths);
+            BuildCodes(runLengths, CodeLengthCodes, runCodes);
+            unsigned orderCount = CodeLengthCodes;
+            while ((orderCount > 4) && (runLengths[CodeLengthOrder[orderCount - 1]] == 0)) {
+                orderCount -= 1;
+            }
+
+            uint64_t dynamicBits = 3 + 5 + 5 + 4 + (3 * orderCount) + DataBits(frequencies, dynamic.lengths);
+            for (const auto &run : runs) {
+                dynamicBits += runLengths[run.first] + ((run.first == 16) ? 2 : (run.first == 17) ? 3 : (run.first == 18) ? 7 : 0);
+            }
+
+            const uint64_t fixedBits = 3 + DataBits(frequencies, FixedCodes().lengths);
+            const size_t bytes = _covered - _blockStart;
+            const size_t storedBlocks = std::max<size_t>(1, (bytes + MaxStoredSize - 1) / MaxStoredSize);
+            const uint64_t storedBits = (storedBlocks * (3 + 7 + 32)) + (8 * static_cast<uint64_t>(bytes));
+
+            if ((storedBits < dynamicBits) && (storedBits < fixedBits)) {
+                WriteStored(last);
+
+            } else if (fixedBits <= dynamicBits) {
+                _writer.Put(last ? 1 : 0, 1);
+                _writer.Put(1, 2);
+                WriteSymbols(FixedCodes());
+
+            } else {
+                _writer.Put(last ? 1 : 0, 1);
+                _writer.Put(2, 2);
+                _writer.Put(literalCount - 257, 5);
+                _writer.Put(distanceCount - 1, 5);
+                _writer.Put(orderCount - 4, 4);
+                for (unsigned i = 0; i < orderCount; i += 1) {
+                    _writer.Put(runLengths[CodeLengthOrder[i]], 3);
+                }
+
+                for (const auto &run : runs) {
+                    _writer.Put(runCodes[run.first], runLengths[run.first]);
+                    if (run.first == 16) {
+                        _writer.Put(run.second, 2);
+
+                    } else if (run.first == 17) {
+                        _writer.Put(run.second, 3);
+
+                    } else if (run.first == 18) {
+                        _writer.Put(run.second, 7);
+                    }
+                }
+
+                WriteSymbols(dynamic);
+            }
+
+            _symbols.clear();
+            _blockStart = _covered;
+        }
+
+        static void ForceTwo(uint32_t *frequencies, unsigned count)
+        {
+            unsigned used = 0;
+            for (unsigned symbol = 0; symbol < count; symbol += 1) {
+                used += (frequencies[symbol] != 0) ? 1 : 0;
+            }
+
+            for (unsigned symbol = 0; (symbol < count) && (used < 2); symbol += 1) {
+                if (frequencies[symbol] == 0) {
+                    frequencies[symbol] = 1;
+                    used += 1;
+                }
+            }
+        }
+
+        void WriteSymbols(const Codes &codes)
+        {
+            const auto &lengthCodes = LengthCodes();
+            for (const Symbol &symbol : _symbols) {
+                if (symbol.distance == 0) {
+                    _writer.Put(codes.codes[symbol.value], codes.lengths[symbol.value]);
+                    continue;
+                }
+
+                const unsigned lengthCode = lengthCodes[symbol.value];
+                _writer.Put(codes.codes[EndOfBlock + 1 + lengthCode], codes.lengths[EndOfBlock + 1 + lengthCode]);
+                if (LengthExtra[lengthCode] != 0) {
+                    _writer.Put(symbol.value - LengthBase[lengthCode], LengthExtra[lengthCode]);
+                }
+
+                const unsigned distanceCode = DistanceCode(symbol.distance);
+                _writer.Put(codes.DistanceTable()[distanceCode], codes.DistanceLengths()[distanceCode]);
+                if (DistanceExtra[distanceCode] != 0) {
+                    _writer.Put(symbol.distance - DistanceBase[distanceCode], DistanceExtra[distanceCode]);
+                }
+            }
+
+            _writer.Put(codes.codes[EndOfBlock], codes.lengths[EndOfBlock]);
+        }
+
+        void WriteStored(bool last)
+        {
+            size_t offset = _blockStart;
+            do {
+                const size_t size = std::min(MaxStoredSize, _covered - offset);
+                const bool final = last && ((offset + size) == _covered);
+                _writer.Put(final ? 1 : 0, 1);
+                _writer.Put(0, 2);
+                _writer.Align();
+                const uint8_t header[4] = {static_cast<uint8_t>(size), static_cast<uint8_t>(size >> 8),
+                                           static_cast<uint8_t>(~size), static_cast<uint8_t>(~size >> 8)};
+                _writer.PutBytes(header, sizeof(header));
+                _writer.PutBytes(_data + offset, size);
+                offset += size;
+
+            } while (offset < _covered);
+        }
+
+        const uint8_t *_data;
+        size_t _size;
+        BitWriter _writer;
+        std::vector<int32_t> _head;
+        std::vector<int32_t> _chain;
+        std::vector<Symbol> _symbols;
+        size_t _blockStart = 0;
+        size_t _covered = 0;
+    };
+
+    void PutLittleEndian32(std::vector<uint8_t> *output, size_t offset, uint32_t value)
+    {
+        for (unsigned i = 0; i < 4; i += 1) {
+            (*output)[offset + i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    }
+
+    // A gzip member holding data, with its total size in a "WS" subfield.
+    std::vector<uint8_t> GzipMember(const std::vector<uint8_t> &data)
+    {
+        // ID1, ID2, CM=deflate, FLG=FEXTRA, MTIME, XFL, OS=unknown, XLEN,
+        // then the subfield and its length.
+        std::vector<uint8_t> member = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 255, 8, 0, 'W', 'S', 4, 0, 0, 0, 0, 0};
+        member.reserve(member.size() + (data.size() / 2) + 64);
+        const size_t sizeOffset = member.size() - 4;
+        Deflate(data.data(), data.size(), &member);
+        const size_t trailer = member.size();
+        member.resize(trailer + 8);
+        PutLittleEndian32(&member, trailer, Crc32(0, data.data(), data.size()));
+        PutLittleEndian32(&member, trailer + 4, static_cast<uint32_t>(data.size()));
+        PutLittleEndian32(&member, sizeOffset, static_cast<uint32_t>(member.size()));
+        return member;
+    }
+}
+
+void Deflate(const uint8_t *data, size_t size, std::vector<uint8_t> *output)
+{
+    Encoder encoder(data, size, output);
+    encoder.Run();
+}
+
+GzipBlockWriter::GzipBlockWriter(ByteSink &output, unsigned threads, size_t blockSize) :
+    _output(output),
+    _threads((threads == 0) ? std::max(1u, std::thread::hardware_concurrency()) : threads),
+    _blockSize(std::max<size_t>(blockSize, 1))
+{
+    _block.reserve(_blockSize);
+}
+
+GzipBlockWriter::~GzipBlockWriter()
+{
+    for (auto &member : _pending) {
+        member.wait();
+    }
+}
+
+bool GzipBlockWriter::Write(const uint8_t *data, size_t size)
+{
+    while ((size > 0) && !_failed) {
+        const size_t count = std::min(size, _blockSize - _block.size());
+        _block.insert(_block.end(), data, data + count);
+        _uncompressed += count;
+        data += count;
+        size -= count;
+        if ((_block.size() == _blockSize) && !Submit()) {
+            return false;
+        }
+    }
+
+    return !_failed;
+}
+
+bool GzipBlockWriter::Close()
+{
+    // An empty stream is still one member, which decoders take for empty.
+    if ((!_block.empty() || ((_members == 0) && _pending.empty())) && !Submit()) {
+        return false;
+    }
+
+    while (!_pending.empty()) {
+        if (!WriteNext()) {
+            return false;
+        }
+    }
+
+    return !_failed;
+}
+
+bool GzipBlockWriter::Submit()
+{
+    // At most one block a thread is in flight; the oldest is written first.
+    if ((_pending.size() >= _threads) && !WriteNext()) {
+        return false;
+    }
+
+    std::vector<uint8_t> block;
+    block.reserve(_blockSize);
+    std::swap(block, _block);
+    _pending.push_back(std::async(std::launch::async, [data = std::move(block)] { return GzipMember(data); }));
+    return true;
+}
+
+bool GzipBlockWriter::WriteNext()
+{
+    const std::vector<uint8_t> member = _pending.front().get();
+    _pending.pop_front();
+    _compressed += member.size();
+    _members += 1;
+    if (!_output.Write(member.data(), member.size())) {
+        _failed = true;
+    }
+
+    return !_failed;
+}
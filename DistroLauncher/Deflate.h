@@ -0,0 +1,61 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <vector>
+
+#include "Inflate.h"
+
+// Compresses data as one raw DEFLATE stream (RFC 1951), appending it to
+// output. Matches are found with hash chains and lazy matching, much as
+// zlib does at its default level, and every block is written with dynamic
+// Huffman codes, the fixed codes or stored, whichever is smallest.
+void Deflate(const uint8_t *data, size_t size, std::vector<uint8_t> *output);
+
+// Writes a gzip stream of independent members, each holding a block of the
+// input and recording its own size in a "WS" extra subfield, the way
+// `prepare-build repack` does, so that ParallelGzipDecoder can inflate them
+// on several threads. Blocks are compressed on several threads as well, and
+// written in order.
+class GzipBlockWriter : public ByteSink
+{
+  public:
+    static constexpr size_t DefaultBlockSize = 4 << 20;
+
+    // A thread count of 0 uses one thread per hardware thread.
+    GzipBlockWriter(ByteSink &output, unsigned threads = 0, size_t blockSize = DefaultBlockSize);
+
+    // Waits for the blocks being compressed; Close() should have been called.
+    ~GzipBlockWriter() override;
+
+    bool Write(const uint8_t *data, size_t size) override;
+
+    // Compresses what is left and writes every member; false if any write
+    // failed.
+    bool Close();
+
+    uint64_t UncompressedBytes() const { return _uncompressed; }
+    uint64_t CompressedBytes() const { return _compressed; }
+    uint64_t Members() const { return _members; }
+
+  private:
+    bool Submit();
+    bool WriteNext();
+
+    ByteSink &_output;
+    unsigned _threads;
+    size_t _blockSize;
+    std::vector<uint8_t> _block;
+    std::deque<std::future<std::vector<uint8_t>>> _pending;
+    uint64_t _uncompressed = 0;
+    uint64_t _compressed = 0;
+    uint64_t _members = 0;
+    bool _failed = false;
+};
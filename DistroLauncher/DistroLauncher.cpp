@@ -4,73 +4,106 @@
 //
 
 #include "stdafx.h"
+#include "StartupTiming.h"
+#include "Trace.h"
 
-// Commandline arguments: 
-#define ARG_CONFIG              L"config"
-#define ARG_CONFIG_DEFAULT_USER L"--default-user"
-#define ARG_INSTALL             L"install"
-#define ARG_INSTALL_ROOT        L"--root"
-#define ARG_RUN                 L"run"
-#define ARG_RUN_C               L"-c"
-#define ARG_HELP                L"help"
+// Set to 1 to have startup timings printed on exit.
+#define TIMING_ENVIRONMENT      L"WSL_LAUNCHER_TIMING"
+
+// Set to a file name to have a Chrome trace written there on exit.
+#define TRACE_ENVIRONMENT       L"WSL_LAUNCHER_TRACE"
 
 // Helper class for calling WSL Functions:
 // https://msdn.microsoft.com/en-us/library/windows/desktop/mt826874(v=vs.85).aspx
 WslApiLoader g_wslApi(DistributionInfo::Name);
 
-static HRESULT InstallDistribution(bool createUser);
-static HRESULT SetDefaultUser(std::wstring_view userName);
+namespace {
+    // Marks the phases of the launcher's startup, from the creation of the
+    // process, and prints them on standard error when the process exits; see
+    // StartupTiming.h. Does nothing unless asked to.
+    class StartupReport
+    {
+      public:
+        StartupReport()
+        {
+            wchar_t value[8];
+            const DWORD length = GetEnvironmentVariableW(TIMING_ENVIRONMENT, value, ARRAYSIZE(value));
+            if ((length == 0) || (length >= ARRAYSIZE(value)) || (std::wstring_view(value) != L"1")) {
+                return;
+            }
 
-HRESULT InstallDistribution(bool createUser)
-{
-    // Register the distribution.
-    Helpers::PrintMessage(MSG_STATUS_INSTALLING);
-    HRESULT hr = g_wslApi.WslRegisterDistribution();
-    if (FAILED(hr)) {
-        return hr;
-    }
+            // Static initialization and the loader's work come before wmain.
+            FILETIME creation;
+            FILETIME exit;
+            FILETIME kernel;
+            FILETIME user;
+            FILETIME now;
+            GetSystemTimePreciseAsFileTime(&now);
+            auto origin = StartupTiming::Clock::now();
+            if (GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+                origin -= std::chrono::microseconds((Ticks(now) - Ticks(creation)) / 10);
+            }
 
-    // Delete /etc/resolv.conf to allow WSL to generate a version based on Windows networking information.
-    DWORD exitCode;
-    hr = g_wslApi.WslLaunchInteractive(L"rm /etc/resolv.conf", true, &exitCode);
-    if (FAILED(hr)) {
-        return hr;
-    }
+            _timing = std::make_unique<StartupTiming>(origin);
+            _timing->Mark("main");
+        }
 
-    // Create a user account.
-    if (createUser) {
-        Helpers::PrintMessage(MSG_CREATE_USER_PROMPT);
-        std::wstring userName;
-        do {
-            userName = Helpers::GetUserInput(MSG_ENTER_USERNAME, 32);
+        ~StartupReport()
+        {
+            if (_timing != nullptr) {
+                _timing->Mark("exit");
+                fprintf(stderr, "%s\n", _timing->Format().c_str());
+            }
+        }
 
-        } while (!DistributionInfo::CreateUser(userName));
+        void Mark(const char *phase)
+        {
+            if (_timing != nullptr) {
+                _timing->Mark(phase);
+            }
+        }
 
-        // Set this user account as the default.
-        hr = SetDefaultUser(userName);
-        if (FAILED(hr)) {
-            return hr;
+        // For the launcher to mark the phases it goes through.
+        StartupTiming *Timing() const
+        {
+            return _timing.get();
         }
-    }
 
-    return hr;
-}
+      private:
+        // FILETIME counts 100 ns intervals.
+        static ULONGLONG Ticks(const FILETIME &time)
+        {
+            return (static_cast<ULONGLONG>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+        }
 
-HRESULT SetDefaultUser(std::wstring_view userName)
-{
-    // Query the UID of the given user name and configure the distribution
-    // to use this UID as the default.
-    ULONG uid = DistributionInfo::QueryUid(userName);
-    if (uid == UID_INVALID) {
-        return E_INVALIDARG;
-    }
+        std::unique_ptr<StartupTiming> _timing;
+    };
+
+    // Traces the launcher when asked to, writing the trace on exit; see
+    // Trace.h.
+    class TraceFile
+    {
+      public:
+        TraceFile()
+        {
+            wchar_t path[MAX_PATH + 1];
+            const DWORD length = GetEnvironmentVariableW(TRACE_ENVIRONMENT, path, ARRAYSIZE(path));
+            if ((length > 0) && (length < ARRAYSIZE(path))) {
+                _path = path;
+                Trace::Start();
+            }
+        }
 
-    HRESULT hr = g_wslApi.WslConfigureDistribution(uid, WSL_DISTRIBUTION_FLAGS_DEFAULT);
-    if (FAILED(hr)) {
-        return hr;
-    }
+        ~TraceFile()
+        {
+            if (!_path.empty()) {
+                Trace::WriteChromeJson(_path);
+            }
+        }
 
-    return hr;
+      private:
+        std::filesystem::path _path;
+    };
 }
 
 int DebugReportHook(int reportType, char *message, int *returnValue)
@@ -95,106 +128,26 @@ int DebugReportHook(int reportType, char *message, int *returnValue)
 int wmain(int argc, wchar_t const *argv[])
 {
     _CrtSetReportHook(DebugReportHook);
+    StartupReport timing;
+    TraceFile trace;
+    TraceSpan span("wmain");
 
     // Update the title bar of the console window.
     SetConsoleTitleW(DistributionInfo::WindowTitle.c_str());
 
     // Initialize a vector of arguments.
-    std::vector<std::wstring_view> arguments;
+    std::vector<std::wstring> arguments;
     for (int index = 1; index < argc; index += 1) {
         arguments.push_back(argv[index]);
     }
 
-    // Deal with possible help flag.
-    if (!arguments.empty() && arguments.front() == ARG_HELP) {
-        Helpers::PrintMessage(MSG_USAGE);
-        return 0;
-    }
-
-    // Ensure that the Windows Subsystem for Linux optional component is installed.
-    DWORD exitCode = 1;
-    if (!g_wslApi.WslIsOptionalComponentInstalled()) {
-        Helpers::PrintErrorMessage(HRESULT_FROM_WIN32(ERROR_LINUX_SUBSYSTEM_NOT_PRESENT));
-        if (arguments.empty()) {
-            Helpers::PromptForInput();
-        }
-
-        return exitCode;
-    }
-
-    // Install the distribution if it is not already.
-    bool installOnly = ((arguments.size() > 0) && (arguments[0] == ARG_INSTALL));
-    HRESULT hr = S_OK;
-    if (!g_wslApi.WslIsDistributionRegistered()) {
-
-        // If the "--root" option is specified, do not create a user account.
-        bool useRoot = ((installOnly) && (arguments.size() > 1) && (arguments[1] == ARG_INSTALL_ROOT));
-        hr = InstallDistribution(!useRoot);
-        if (FAILED(hr)) {
-            if (hr == HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS)) {
-                Helpers::PrintMessage(MSG_INSTALL_ALREADY_EXISTS);
-            }
-
-        } else {
-            Helpers::PrintMessage(MSG_INSTALL_SUCCESS);
-        }
-
-        exitCode = SUCCEEDED(hr) ? 0 : 1;
-    }
-
-    // Parse the command line arguments.
-    if ((SUCCEEDED(hr)) && (!installOnly)) {
-        if (arguments.empty()) {
-            hr = g_wslApi.WslLaunchInteractive(L"", false, &exitCode);
-
-            // Check exitCode to see if wsl.exe returned that it could not start the Linux process
-            // then prompt users for input so they can view the error message.
-            if (SUCCEEDED(hr) && exitCode == UINT_MAX) {
-                Helpers::PromptForInput();
-            }
-
-        } else if ((arguments[0] == ARG_RUN) ||
-                   (arguments[0] == ARG_RUN_C)) {
-
-            std::wstring command;
-            for (size_t index = 1; index < arguments.size(); index += 1) {
-                command += L" ";
-                command += arguments[index];
-            }
-
-            hr = g_wslApi.WslLaunchInteractive(command.c_str(), true, &exitCode);
-
-        } else if (arguments[0] == ARG_CONFIG) {
-            hr = E_INVALIDARG;
-            if (arguments.size() == 3) {
-                if (arguments[1] == ARG_CONFIG_DEFAULT_USER) {
-                    hr = SetDefaultUser(arguments[2]);
-                }
-            }
-
-            if (SUCCEEDED(hr)) {
-                exitCode = 0;
-            }
-
-        } else {
-            Helpers::PrintMessage(MSG_USAGE);
-            return exitCode;
-        }
-    }
-
-    // If an error was encountered, print an error message.
-    if (FAILED(hr)) {
-        if (hr == HCS_E_HYPERV_NOT_INSTALLED) {
-            Helpers::PrintMessage(MSG_ENABLE_VIRTUALIZATION);
-
-        } else {
-            Helpers::PrintErrorMessage(hr);
-        }
-
-        if (arguments.empty()) {
-            Helpers::PromptForInput();
-        }
-    }
+    timing.Mark("args");
 
-    return SUCCEEDED(hr) ? exitCode : 1;
+    // The rest is the same whatever the launcher runs on; see Launcher.h.
+    WindowsConsole console;
+    WindowsWsl wsl;
+    Launcher launcher(console, wsl, timing.Timing());
+    const uint32_t exitCode = launcher.Main(arguments);
+    console.Flush();
+    return static_cast<int>(exitCode);
 }
@@ -4,15 +4,46 @@
 //
 
 #include "stdafx.h"
+#include "JsonEvent.h"
+
+#include <cctype>
 
 namespace {
-    HRESULT FormatMessageHelperVa(DWORD messageId, va_list vaList, std::wstring* message);
-    HRESULT PrintMessageVa(DWORD messageId, va_list vaList);
+    bool JsonOutput = false;
+
+    // What --output=json calls a message: MSG_WSL_LAUNCH_FAILED is
+    // wslLaunchFailed.
+    std::string EventName(DWORD messageId)
+    {
+        std::string name;
+        for (const MessageEntry &entry : MessageCatalog::Entries) {
+            if (entry.id != messageId) {
+                continue;
+            }
+
+            bool upper = false;
+            for (const char *c = entry.name + 4; *c != '\0'; c += 1) {
+                if (*c == '_') {
+                    upper = true;
+
+                } else {
+                    name += upper ? *c : static_cast<char>(std::tolower(static_cast<unsigned char>(*c)));
+                    upper = false;
+                }
+            }
+        }
+
+        return name;
+    }
 }
 
 std::wstring Helpers::GetUserInput(DWORD promptMsg, DWORD maxCharacters)
 {
-    Helpers::PrintMessage(promptMsg);
+    if (promptMsg != 0) {
+        Helpers::PrintMessageValues(promptMsg, nullptr, 0);
+    }
+
+    Helpers::Output().Flush();
     size_t bufferSize = maxCharacters + 1;
     std::unique_ptr<wchar_t[]> inputBuffer(new wchar_t[bufferSize]);
     std::wstring input;
@@ -32,66 +63,90 @@ std::wstring Helpers::GetUserInput(DWORD promptMsg, DWORD maxCharacters)
 
 void Helpers::PrintErrorMessage(HRESULT error)
 {
-    PWSTR buffer = nullptr; 
-    ::FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER,
-                     nullptr,
-                     error,
-                     0,
-                     (PWSTR)&buffer,
-                     0,
-                     nullptr);
-
-    Helpers::PrintMessage(MSG_ERROR_CODE, error, buffer);
-    if (buffer != nullptr) {
-        HeapFree(GetProcessHeap(), 0, buffer);
+    // System messages are a sentence or two; one that does not fit is left out.
+    wchar_t buffer[1024];
+    if (::FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+                         nullptr,
+                         error,
+                         0,
+                         buffer,
+                         ARRAYSIZE(buffer),
+                         nullptr) == 0) {
+
+        buffer[0] = L'\0';
     }
 
+    Helpers::PrintMessage<MSG_ERROR_CODE>(error, buffer);
     return;
 }
 
-HRESULT Helpers::PrintMessage(DWORD messageId, ...)
+HRESULT Helpers::PrintMessageValues(DWORD messageId, const MessageValue *values, size_t count)
 {
-    va_list argList;
-    va_start(argList, messageId);
-    HRESULT hr = PrintMessageVa(messageId, argList);
-    va_end(argList);
-    return hr;
+    const wchar_t *text = MessageCatalog::Text(messageId);
+    if (text == nullptr) {
+        return HRESULT_FROM_WIN32(ERROR_MR_MID_NOT_FOUND);
+    }
+
+    if (JsonOutput) {
+        const std::string event =
+            JsonEvent("message").Add("message", EventName(messageId)).Add("text", MessageText(messageId, values, count)).Line();
+        Output().AppendUtf8(event.data(), event.size());
+        return S_OK;
+    }
+
+    // Only inserts longer than the rest of the buffer take the heap.
+    wchar_t buffer[MessageFormat::BufferSize];
+    const size_t length = MessageFormat::Format(text, values, count, buffer, ARRAYSIZE(buffer));
+    if (length < ARRAYSIZE(buffer)) {
+        Output().Append(buffer, length);
+        return S_OK;
+    }
+
+    std::unique_ptr<wchar_t[]> message(new wchar_t[length + 1]);
+    MessageFormat::Format(text, values, count, message.get(), length + 1);
+    Output().Append(message.get(), length);
+    return S_OK;
 }
 
-void Helpers::PromptForInput()
+std::wstring Helpers::MessageText(DWORD messageId, const MessageValue *values, size_t count)
 {
-    Helpers::PrintMessage(MSG_PRESS_A_KEY);
-    _getwch();
-    return;
-}
+    const wchar_t *text = MessageCatalog::Text(messageId);
+    if (text == nullptr) {
+        return std::wstring();
+    }
 
-namespace {
-    HRESULT FormatMessageHelperVa(DWORD messageId, va_list vaList, std::wstring* message)
-    {
-        PWSTR buffer = nullptr; 
-        DWORD written = ::FormatMessageW(FORMAT_MESSAGE_FROM_HMODULE | FORMAT_MESSAGE_ALLOCATE_BUFFER,
-                                         nullptr,
-                                         messageId,
-                                         0,
-                                         (PWSTR)&buffer,
-                                         10,
-                                         &vaList);
-        *message = buffer;
-        if (buffer != nullptr) {
-            HeapFree(GetProcessHeap(), 0, buffer);
+    std::wstring message(MessageFormat::Format(text, values, count, nullptr, 0), L'\0');
+    MessageFormat::Format(text, values, count, message.data(), message.size() + 1);
+    std::wstring converted;
+    converted.reserve(message.size());
+    for (const wchar_t c : message) {
+        if (c != L'\r') {
+            converted += c;
         }
+    }
 
-        return (written > 0) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+    while (!converted.empty() && (converted.back() == L'\n')) {
+        converted.pop_back();
     }
 
-    HRESULT PrintMessageVa(DWORD messageId, va_list vaList)
-    {
-        std::wstring message;
-        HRESULT hr = FormatMessageHelperVa(messageId, vaList, &message);
-        if (SUCCEEDED(hr)) {
-            wprintf(L"%ls", message.c_str());
-        }
+    return converted;
+}
 
-        return hr;
-    }
+void Helpers::SetJsonOutput(bool json)
+{
+    JsonOutput = json;
+}
+
+ConsoleWriter &Helpers::Output()
+{
+    static ConsoleWriter output(GetStdHandle(STD_OUTPUT_HANDLE));
+    return output;
+}
+
+void Helpers::PromptForInput()
+{
+    Helpers::PrintMessage<MSG_PRESS_A_KEY>();
+    Helpers::Output().Flush();
+    _getwch();
+    return;
 }
@@ -5,12 +5,41 @@
 
 #pragma once
 
-#define UID_INVALID ((ULONG)-1)
-
 namespace Helpers
 {
+    // Reads a word after printing the prompt, if it is not 0.
     std::wstring GetUserInput(DWORD promptMsg, DWORD maxCharacters);
     void PrintErrorMessage(HRESULT hr);
-    HRESULT PrintMessage(DWORD messageId, ...);
+
+    // Prints a message with arguments only known at run time, such as those
+    // of LauncherConsole::Print.
+    HRESULT PrintMessageValues(DWORD messageId, const MessageValue *values, size_t count);
+
+    // A message as the events of --output=json have it: its line breaks are
+    // \n, and there is none at the end.
+    std::wstring MessageText(DWORD messageId, const MessageValue *values, size_t count);
+
+    // With --output=json, messages are printed as "message" events named
+    // after them; see LauncherConsole::SetJsonOutput.
+    void SetJsonOutput(bool json);
+
+    // Prints a message of messages.mc, formatted on the stack from
+    // MessageCatalog.h. Arguments that do not match the inserts of the
+    // message do not compile.
+    template <DWORD MessageId, typename... Args>
+    HRESULT PrintMessage(Args... args)
+    {
+        static_assert(MessageFormat::Accepts<Args...>(MessageCatalog::Text(MessageId)),
+                      "the arguments do not match the inserts of the message");
+
+        const MessageValue values[] = {MessageValue(args)..., MessageValue()};
+        return PrintMessageValues(MessageId, values, sizeof...(Args));
+    }
+
     void PromptForInput();
+
+    // Standard output, where messages are printed. What is printed is
+    // written when flushed: on prompts, before WSL is given the console, and
+    // once the launcher is done; see LauncherConsole::Flush.
+    ConsoleWriter &Output();
 }
\ No newline at end of file
@@ -0,0 +1,700 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "Inflate.h"
+
+#include <array>
+#include <cstring>
+
+namespace {
+    const uint16_t LengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                     35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    const uint8_t LengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                     3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    const uint16_t DistanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                       257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                       8193, 12289, 16385, 24577};
+    const uint8_t DistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                       7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    const uint8_t CodeLengthOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    // Largest match, used to keep room at the end of the output buffer.
+    constexpr size_t MaxMatch = 258;
+
+    // gzip header flags.
+    constexpr uint8_t FlagHeaderCrc = 0x02;
+    constexpr uint8_t FlagExtra = 0x04;
+    constexpr uint8_t FlagName = 0x08;
+    constexpr uint8_t FlagComment = 0x10;
+    constexpr uint8_t FlagReserved = 0xe0;
+
+    using CrcTables = std::array<std::array<uint32_t, 256>, 8>;
+
+    // Slicing-by-8 tables for the reflected 0xEDB88320 polynomial.
+    const CrcTables &GetCrcTables()
+    {
+        static const CrcTables tables = [] {
+            CrcTables t{};
+            for (uint32_t i = 0; i < 256; i += 1) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k += 1) {
+                    c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+                }
+
+                t[0][i] = c;
+            }
+
+            for (uint32_t i = 0; i < 256; i += 1) {
+                for (size_t k = 1; k < 8; k += 1) {
+                    t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+                }
+            }
+
+            return t;
+        }();
+
+        return tables;
+    }
+
+    uint32_t BitReverse(uint32_t value, unsigned bits)
+    {
+        uint32_t result = 0;
+        for (unsigned i = 0; i < bits; i += 1) {
+            result = (result << 1) | (value & 1);
+            value >>= 1;
+        }
+
+        return result;
+    }
+
+    // Returns the next symbol, or -1 if the input does not contain a valid code.
+    int DecodeSymbol(BitReader &reader, const HuffmanTable &table)
+    {
+        if (reader.BitCount() < 16) {
+            reader.Refill();
+        }
+
+        const uint16_t fast = table.fast[reader.Peek(HuffmanTable::FastBits)];
+        if (fast != 0) {
+            const unsigned length = fast >> 9;
+            if (length > reader.BitCount()) {
+                return -1;
+            }
+
+            reader.Drop(length);
+            return fast & 0x1ff;
+        }
+
+        const uint32_t code = BitReverse(reader.Peek(16), 16);
+        unsigned length = HuffmanTable::FastBits + 1;
+        while (code >= table.maxCode[length]) {
+            length += 1;
+        }
+
+        if ((length >= 16) || (length > reader.BitCount())) {
+            return -1;
+        }
+
+        const uint32_t index = (code >> (16 - length)) - table.firstCode[length] + table.firstSymbol[length];
+        if ((index >= HuffmanTable::MaxSymbols) || (table.size[index] != length)) {
+            return -1;
+        }
+
+        reader.Drop(length);
+        return table.value[index];
+    }
+
+    const HuffmanTable &FixedLiterals()
+    {
+        static const HuffmanTable table = [] {
+            uint8_t lengths[288];
+            std::memset(lengths, 8, 144);
+            std::memset(lengths + 144, 9, 112);
+            std::memset(lengths + 256, 7, 24);
+            std::memset(lengths + 280, 8, 8);
+            HuffmanTable t;
+            t.Build(lengths, 288);
+            return t;
+        }();
+
+        return table;
+    }
+
+    const HuffmanTable &FixedDistances()
+    {
+        static const HuffmanTable table = [] {
+            uint8_t lengths[30];
+            std::memset(lengths, 5, sizeof(lengths));
+            HuffmanTable t;
+            t.Build(lengths, 30);
+            return t;
+        }();
+
+        return table;
+    }
+}
+
+uint32_t Crc32(uint32_t crc, const uint8_t *data, size_t size)
+{
+    const CrcTables &t = GetCrcTables();
+    crc = ~crc;
+    while (size >= 8) {
+        const uint32_t low = crc ^ (uint32_t{data[0]} | (uint32_t{data[1]} << 8) |
+                                    (uint32_t{data[2]} << 16) | (uint32_t{data[3]} << 24));
+        crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+              t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+        data += 8;
+        size -= 8;
+    }
+
+    while (size > 0) {
+        crc = t[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+        data += 1;
+        size -= 1;
+    }
+
+    return ~crc;
+}
+
+BitReader::BitReader(ByteSource &source) :
+    _source(source)
+{
+}
+
+bool BitReader::NextChunk()
+{
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    do {
+        if (!_source.Next(&data, &size)) {
+            return false;
+        }
+
+    } while (size == 0);
+
+    _cursor = data;
+    _end = data + size;
+    return true;
+}
+
+void BitReader::Refill()
+{
+    if (_bitCount > 56) {
+        return;
+    }
+
+    // Fast path: load up to seven bytes at once.
+    if ((_end - _cursor) >= 8) {
+        const unsigned count = (63 - _bitCount) >> 3;
+        uint64_t word = 0;
+        for (unsigned i = 0; i < count; i += 1) {
+            word |= uint64_t{_cursor[i]} << (8 * i);
+        }
+
+        _bits |= word << _bitCount;
+        _bitCount += 8 * count;
+        _cursor += count;
+        return;
+    }
+
+    while (_bitCount <= 56) {
+        if ((_cursor == _end) && !NextChunk()) {
+            return;
+        }
+
+        _bits |= uint64_t{*_cursor} << _bitCount;
+        _bitCount += 8;
+        _cursor += 1;
+    }
+}
+
+bool BitReader::ReadBits(unsigned count, uint32_t *value)
+{
+    if (_bitCount < count) {
+        Refill();
+        if (_bitCount < count) {
+            return false;
+        }
+    }
+
+    *value = Peek(count);
+    Drop(count);
+    return true;
+}
+
+bool BitReader::ReadByte(uint8_t *value)
+{
+    uint32_t bits;
+    if (!ReadBits(8, &bits)) {
+        return false;
+    }
+
+    *value = static_cast<uint8_t>(bits);
+    return true;
+}
+
+bool BitReader::ReadBytes(uint8_t *data, size_t size)
+{
+    // Drain whole bytes still held in the bit buffer first.
+    while ((size > 0) && (_bitCount >= 8)) {
+        *data = static_cast<uint8_t>(_bits);
+        Drop(8);
+        data += 1;
+        size -= 1;
+    }
+
+    while (size > 0) {
+        if ((_cursor == _end) && !NextChunk()) {
+            return false;
+        }
+
+        const size_t available = static_cast<size_t>(_end - _cursor);
+        const size_t count = (size < available) ? size : available;
+        std::memcpy(data, _cursor, count);
+        _cursor += count;
+        data += count;
+        size -= count;
+    }
+
+    return true;
+}
+
+bool BitReader::AtEnd()
+{
+    if (_bitCount >= 8) {
+        return false;
+    }
+
+    return (_cursor == _end) && !NextChunk();
+}
+
+bool HuffmanTable::Build(const uint8_t *lengths, unsigned count)
+{
+    unsigned sizes[16] = {};
+    unsigned nextCode[16] = {};
+    std::memset(fast, 0, sizeof(fast));
+    for (unsigned i = 0; i < count; i += 1) {
+        sizes[lengths[i]] += 1;
+    }
+
+    sizes[0] = 0;
+    unsigned code = 0;
+    unsigned symbol = 0;
+    for (unsigned i = 1; i < 16; i += 1) {
+        if (sizes[i] > (1u << i)) {
+            return false;
+        }
+
+        nextCode[i] = code;
+        firstCode[i] = static_cast<uint16_t>(code);
+        firstSymbol[i] = static_cast<uint16_t>(symbol);
+        code += sizes[i];
+        if ((sizes[i] != 0) && ((code - 1) >= (1u << i))) {
+            return false;
+        }
+
+        maxCode[i] = code << (16 - i);
+        code <<= 1;
+        symbol += sizes[i];
+    }
+
+    maxCode[16] = 0x10000;
+    for (unsigned i = 0; i < count; i += 1) {
+        const unsigned length = lengths[i];
+        if (length == 0) {
+            continue;
+        }
+
+        const unsigned index = nextCode[length] - firstCode[length] + firstSymbol[length];
+        size[index] = static_cast<uint8_t>(length);
+        value[index] = static_cast<uint16_t>(i);
+        if (length <= FastBits) {
+            const uint16_t entry = static_cast<uint16_t>((length << 9) | i);
+            for (uint32_t j = BitReverse(nextCode[length], length); j < (1u << FastBits); j += (1u << length)) {
+                fast[j] = entry;
+            }
+        }
+
+        nextCode[length] += 1;
+    }
+
+    return true;
+}
+
+Inflater::Inflater(size_t flushSize) :
+    _buffer(WindowSize + flushSize + MaxMatch),
+    _flushSize(flushSize)
+{
+}
+
+InflateStatus Inflater::Inflate(BitReader &reader, ByteSink &sink)
+{
+    _sink = &sink;
+    _pos = 0;
+    _flushed = 0;
+    _crc = 0;
+    _total = 0;
+
+    uint32_t header = 0;
+    do {
+        if (!reader.ReadBits(3, &header)) {
+            return InflateStatus::Truncated;
+        }
+
+        InflateStatus status;
+        switch (header >> 1) {
+        case 0:
+            status = Stored(reader);
+            break;
+
+        case 1:
+            status = Codes(reader, FixedLiterals(), FixedDistances());
+            break;
+
+        case 2:
+            status = Dynamic(reader);
+            break;
+
+        default:
+            return InflateStatus::Corrupt;
+        }
+
+        if (status != InflateStatus::Ok) {
+            return status;
+        }
+
+    } while ((header & 1) == 0);
+
+    return Flush() ? InflateStatus::Ok : InflateStatus::SinkFailed;
+}
+
+bool Inflater::Flush()
+{
+    if (_pos > _flushed) {
+        const uint8_t *data = _buffer.data() + _flushed;
+        const size_t size = _pos - _flushed;
+        _crc = Crc32(_crc, data, size);
+        _total += size;
+        if (!_sink->Write(data, size)) {
+            return false;
+        }
+    }
+
+    // Keep the last window of output around for back-references.
+    if (_pos > WindowSize) {
+        std::memmove(_buffer.data(), _buffer.data() + _pos - WindowSize, WindowSize);
+        _pos = WindowSize;
+    }
+
+    _flushed = _pos;
+    return true;
+}
+
+InflateStatus Inflater::Stored(BitReader &reader)
+{
+    reader.AlignToByte();
+    uint32_t length;
+    uint32_t complement;
+    if (!reader.ReadBits(16, &length) || !reader.ReadBits(16, &complement)) {
+        return InflateStatus::Truncated;
+    }
+
+    if ((length ^ 0xffff) != complement) {
+        return InflateStatus::Corrupt;
+    }
+
+    const size_t limit = WindowSize + _flushSize;
+    while (length > 0) {
+        if ((_pos >= limit) && !Flush()) {
+            return InflateStatus::SinkFailed;
+        }
+
+        const size_t room = limit - _pos;
+        const size_t count = (length < room) ? length : room;
+        if (!reader.ReadBytes(_buffer.data() + _pos, count)) {
+            return InflateStatus::Truncated;
+        }
+
+        _pos += count;
+        length -= static_cast<uint32_t>(count);
+    }
+
+    return InflateStatus::Ok;
+}
+
+InflateStatus Inflater::Dynamic(BitReader &reader)
+{
+    uint32_t literalCount;
+    uint32_t distanceCount;
+    uint32_t codeLengthCount;
+    if (!reader.ReadBits(5, &literalCount) ||
+        !reader.ReadBits(5, &distanceCount) ||
+        !reader.ReadBits(4, &codeLengthCount)) {
+        return InflateStatus::Truncated;
+    }
+
+    literalCount += 257;
+    distanceCount += 1;
+    codeLengthCount += 4;
+    if ((literalCount > 286) || (distanceCount > 30)) {
+        return InflateStatus::Corrupt;
+    }
+
+    uint8_t codeLengths[19] = {};
+    for (uint32_t i = 0; i < codeLengthCount; i += 1) {
+        uint32_t length;
+        if (!reader.ReadBits(3, &length)) {
+            return InflateStatus::Truncated;
+        }
+
+        codeLengths[CodeLengthOrder[i]] = static_cast<uint8_t>(length);
+    }
+
+    HuffmanTable codeLengthTable;
+    if (!codeLengthTable.Build(codeLengths, 19)) {
+        return InflateStatus::Corrupt;
+    }
+
+    uint8_t lengths[286 + 30] = {};
+    const uint32_t total = literalCount + distanceCount;
+    uint32_t index = 0;
+    while (index < total) {
+        const int symbol = DecodeSymbol(reader, codeLengthTable);
+        if (symbol < 0) {
+            return InflateStatus::Corrupt;
+        }
+
+        if (symbol < 16) {
+            lengths[index++] = static_cast<uint8_t>(symbol);
+            continue;
+        }
+
+        uint8_t repeated = 0;
+        uint32_t count;
+        if (symbol == 16) {
+            if ((index == 0) || !reader.ReadBits(2, &count)) {
+                return InflateStatus::Corrupt;
+            }
+
+            repeated = lengths[index - 1];
+            count += 3;
+
+        } else if (symbol == 17) {
+            if (!reader.ReadBits(3, &count)) {
+                return InflateStatus::Truncated;
+            }
+
+            count += 3;
+
+        } else {
+            if (!reader.ReadBits(7, &count)) {
+                return InflateStatus::Truncated;
+            }
+
+            count += 11;
+        }
+
+        if ((index + count) > total) {
+            return InflateStatus::Corrupt;
+        }
+
+        std::memset(lengths + index, repeated, count);
+        index += count;
+    }
+
+    // The end-of-block code must be present.
+    if (lengths[256] == 0) {
+        return InflateStatus::Corrupt;
+    }
+
+    if (!_literals.Build(lengths, literalCount) ||
+        !_distances.Build(lengths + literalCount, distanceCount)) {
+        return InflateStatus::Corrupt;
+    }
+
+    return Codes(reader, _literals, _distances);
+}
+
+InflateStatus Inflater::Codes(BitReader &reader, const HuffmanTable &literals, const HuffmanTable &distances)
+{
+    const size_t limit = WindowSize + _flushSize;
+    uint8_t *buffer = _buffer.data();
+    for (;;) {
+        if ((_pos >= limit) && !Flush()) {
+            return InflateStatus::SinkFailed;
+        }
+
+        const int symbol = DecodeSymbol(reader, literals);
+        if (symbol < 0) {
+            return InflateStatus::Corrupt;
+        }
+
+        if (symbol < 256) {
+            buffer[_pos++] = static_cast<uint8_t>(symbol);
+            continue;
+        }
+
+        if (symbol == 256) {
+            return InflateStatus::Ok;
+        }
+
+        const unsigned lengthCode = static_cast<unsigned>(symbol) - 257;
+        if (lengthCode >= 29) {
+            return InflateStatus::Corrupt;
+        }
+
+        uint32_t extra = 0;
+        if ((LengthExtra[lengthCode] != 0) && !reader.ReadBits(LengthExtra[lengthCode], &extra)) {
+            return InflateStatus::Truncated;
+        }
+
+        const size_t length = LengthBase[lengthCode] + extra;
+        const int distanceCode = DecodeSymbol(reader, distances);
+        if ((distanceCode < 0) || (distanceCode >= 30)) {
+            return InflateStatus::Corrupt;
+        }
+
+        extra = 0;
+        if ((DistanceExtra[distanceCode] != 0) && !reader.ReadBits(DistanceExtra[distanceCode], &extra)) {
+            return InflateStatus::Truncated;
+        }
+
+        const size_t distance = DistanceBase[distanceCode] + extra;
+        if (distance > _pos) {
+            return InflateStatus::Corrupt;
+        }
+
+        uint8_t *destination = buffer + _pos;
+        const uint8_t *source = destination - distance;
+        if (distance >= length) {
+            std::memcpy(destination, source, length);
+
+        } else {
+            for (size_t i = 0; i < length; i += 1) {
+                destination[i] = source[i];
+            }
+        }
+
+        _pos += length;
+    }
+}
+
+GzipDecoder::GzipDecoder(ByteSource &source, size_t flushSize) :
+    _reader(source),
+    _inflater(flushSize)
+{
+}
+
+InflateStatus GzipDecoder::Fail(InflateStatus status, const char *error)
+{
+    _error = error;
+    return status;
+}
+
+InflateStatus GzipDecoder::Decode(ByteSink &sink)
+{
+    for (;;) {
+        uint8_t magic[2];
+        if (_reader.AtEnd()) {
+            if (_members == 0) {
+                return Fail(InflateStatus::Truncated, "empty gzip stream");
+            }
+
+            return InflateStatus::Ok;
+        }
+
+        if (!_reader.ReadByte(&magic[0])) {
+            return Fail(InflateStatus::Truncated, "truncated gzip header");
+        }
+
+        // Some tools pad the last member with zeros; accept those, as gzip does.
+        if ((_members > 0) && (magic[0] == 0)) {
+            uint8_t padding = 0;
+            while (!_reader.AtEnd()) {
+                if (!_reader.ReadByte(&padding) || (padding != 0)) {
+                    return Fail(InflateStatus::Corrupt, "trailing garbage after gzip stream");
+                }
+            }
+
+            return InflateStatus::Ok;
+        }
+
+        uint8_t header[8];
+        if (!_reader.ReadByte(&magic[1]) || !_reader.ReadBytes(header, sizeof(header))) {
+            return Fail(InflateStatus::Truncated, "truncated gzip header");
+        }
+
+        if ((magic[0] != 0x1f) || (magic[1] != 0x8b) || (header[0] != 8)) {
+            return Fail(InflateStatus::Corrupt, "not a gzip stream");
+        }
+
+        const uint8_t flags = header[1];
+        if ((flags & FlagReserved) != 0) {
+            return Fail(InflateStatus::Corrupt, "unsupported gzip header flags");
+        }
+
+        if ((flags & FlagExtra) != 0) {
+            uint8_t lengthBytes[2];
+            if (!_reader.ReadBytes(lengthBytes, sizeof(lengthBytes))) {
+                return Fail(InflateStatus::Truncated, "truncated gzip header");
+            }
+
+            std::vector<uint8_t> extra(lengthBytes[0] | (lengthBytes[1] << 8));
+            if (!_reader.ReadBytes(extra.data(), extra.size())) {
+                return Fail(InflateStatus::Truncated, "truncated gzip header");
+            }
+        }
+
+        for (const uint8_t field : {FlagName, FlagComment}) {
+            if ((flags & field) == 0) {
+                continue;
+            }
+
+            uint8_t c;
+            do {
+                if (!_reader.ReadByte(&c)) {
+                    return Fail(InflateStatus::Truncated, "truncated gzip header");
+                }
+
+            } while (c != 0);
+        }
+
+        if ((flags & FlagHeaderCrc) != 0) {
+            uint8_t headerCrc[2];
+            if (!_reader.ReadBytes(headerCrc, sizeof(headerCrc))) {
+                return Fail(InflateStatus::Truncated, "truncated gzip header");
+            }
+        }
+
+        const InflateStatus status = _inflater.Inflate(_reader, sink);
+        switch (status) {
+        case InflateStatus::Ok:
+            break;
+
+        case InflateStatus::Truncated:
+            return Fail(status, "truncated deflate stream");
+
+        case InflateStatus::Corrupt:
+            return Fail(status, "invalid deflate stream");
+
+        default:
+            return Fail(status, "output rejected");
+        }
+
+        _reader.AlignToByte();
+        uint8_t trailer[8];
+        if (!_reader.ReadBytes(trailer, sizeof(trailer))) {
+            return Fail(InflateStatus::Truncated, "truncated gzip trailer");
+        }
+
+        const uint32_t crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (uint32_t{trailer[3]} << 24);
+        const uint32_t size = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) | (uint32_t{trailer[7]} << 24);
+        if ((crc != _inflater.Crc()) || (size != static_cast<uint32_t>(_inflater.Total()))) {
+            return Fail(InflateStatus::Corrupt, "gzip checksum mismatch");
+        }
+
+        _members += 1;
+    }
+}
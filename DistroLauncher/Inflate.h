@@ -0,0 +1,143 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Supplies compressed input to a decoder, one chunk at a time.
+class ByteSource
+{
+  public:
+    virtual ~ByteSource() = default;
+
+    // Returns false once there is no more input.
+    virtual bool Next(const uint8_t **data, size_t *size) = 0;
+};
+
+// Receives decompressed output from a decoder.
+class ByteSink
+{
+  public:
+    virtual ~ByteSink() = default;
+
+    // Returns false to abort decoding.
+    virtual bool Write(const uint8_t *data, size_t size) = 0;
+};
+
+enum class InflateStatus
+{
+    Ok,
+    Truncated,
+    Corrupt,
+    SinkFailed,
+};
+
+// Computes the CRC-32 used by gzip, continuing from a previous value.
+uint32_t Crc32(uint32_t crc, const uint8_t *data, size_t size);
+
+// Little-endian bit reader on top of a ByteSource, as required by DEFLATE.
+class BitReader
+{
+  public:
+    explicit BitReader(ByteSource &source);
+
+    // Loads as many whole bytes as fit into the bit buffer.
+    void Refill();
+
+    unsigned BitCount() const { return _bitCount; }
+    uint32_t Peek(unsigned count) const { return static_cast<uint32_t>(_bits & ((uint64_t{1} << count) - 1)); }
+    void Drop(unsigned count) { _bits >>= count; _bitCount -= count; }
+
+    bool ReadBits(unsigned count, uint32_t *value);
+    bool ReadByte(uint8_t *value);
+    bool ReadBytes(uint8_t *data, size_t size);
+    void AlignToByte() { Drop(_bitCount & 7); }
+
+    // Returns true when all input has been consumed.
+    bool AtEnd();
+
+  private:
+    bool NextChunk();
+
+    ByteSource &_source;
+    const uint8_t *_cursor = nullptr;
+    const uint8_t *_end = nullptr;
+    uint64_t _bits = 0;
+    unsigned _bitCount = 0;
+};
+
+// Canonical Huffman decoding table for one DEFLATE alphabet.
+struct HuffmanTable
+{
+    static constexpr unsigned FastBits = 10;
+    static constexpr unsigned MaxSymbols = 288;
+
+    bool Build(const uint8_t *lengths, unsigned count);
+
+    uint16_t fast[1 << FastBits];
+    uint16_t firstCode[16];
+    uint16_t firstSymbol[16];
+    uint32_t maxCode[17];
+    uint8_t size[MaxSymbols];
+    uint16_t value[MaxSymbols];
+};
+
+// Decodes raw DEFLATE streams (RFC 1951), keeping the 32 KiB history window
+// and flushing decompressed data to a ByteSink in large blocks.
+class Inflater
+{
+  public:
+    static constexpr size_t WindowSize = 32768;
+
+    explicit Inflater(size_t flushSize = 1 << 20);
+
+    // Decodes one complete DEFLATE stream. Crc() and Total() describe the
+    // output of the last call.
+    InflateStatus Inflate(BitReader &reader, ByteSink &sink);
+
+    uint32_t Crc() const { return _crc; }
+    uint64_t Total() const { return _total; }
+
+  private:
+    InflateStatus Stored(BitReader &reader);
+    InflateStatus Dynamic(BitReader &reader);
+    InflateStatus Codes(BitReader &reader, const HuffmanTable &literals, const HuffmanTable &distances);
+    bool Flush();
+
+    std::vector<uint8_t> _buffer;
+    size_t _flushSize;
+    size_t _pos = 0;
+    size_t _flushed = 0;
+    ByteSink *_sink = nullptr;
+    uint32_t _crc = 0;
+    uint64_t _total = 0;
+    HuffmanTable _literals;
+    HuffmanTable _distances;
+};
+
+// Decodes a gzip stream (RFC 1952) made of one or more members, verifying
+// the CRC-32 and size recorded in every member trailer.
+class GzipDecoder
+{
+  public:
+    explicit GzipDecoder(ByteSource &source, size_t flushSize = 1 << 20);
+
+    InflateStatus Decode(ByteSink &sink);
+
+    const std::string &Error() const { return _error; }
+    uint64_t Members() const { return _members; }
+
+  private:
+    InflateStatus Fail(InflateStatus status, const char *error);
+
+    BitReader _reader;
+    Inflater _inflater;
+    std::string _error;
+    uint64_t _members = 0;
+};
@@ -0,0 +1,118 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "Inflate.h"
+
+// Accumulates the chunks of a ByteSource so that block-oriented decoders can
+// look at a whole block of known size in one contiguous buffer.
+class InputBuffer
+{
+  public:
+    explicit InputBuffer(ByteSource &source) :
+        _source(source)
+    {
+    }
+
+    // Makes at least size bytes available at Data(). Returns false if the
+    // input ends first.
+    bool Ensure(size_t size)
+    {
+        while (Available() < size) {
+            const uint8_t *data = nullptr;
+            size_t count = 0;
+            if (!_source.Next(&data, &count)) {
+                return false;
+            }
+
+            // Drop consumed bytes once they make up half of the buffer, which
+            // keeps compaction cost linear in the input size.
+            if ((_pos > 0) && (_pos >= _buffer.size() / 2)) {
+                _buffer.erase(_buffer.begin(), _buffer.begin() + static_cast<std::ptrdiff_t>(_pos));
+                _pos = 0;
+            }
+
+            _buffer.insert(_buffer.end(), data, data + count);
+        }
+
+        return true;
+    }
+
+    const uint8_t *Data() const { return _buffer.data() + _pos; }
+    size_t Available() const { return _buffer.size() - _pos; }
+    void Skip(size_t size) { _pos += size; }
+
+    // Returns true when all input has been consumed.
+    bool AtEnd() { return !Ensure(1); }
+
+  private:
+    ByteSource &_source;
+    std::vector<uint8_t> _buffer;
+    size_t _pos = 0;
+};
+
+// Replays bytes already pulled from a source before continuing with it.
+class ReplaySource : public ByteSource
+{
+  public:
+    ReplaySource(std::vector<uint8_t> prefix, ByteSource &rest) :
+        _prefix(std::move(prefix)),
+        _rest(rest)
+    {
+    }
+
+    bool Next(const uint8_t **data, size_t *size) override
+    {
+        if (!_replayed) {
+            _replayed = true;
+            if (!_prefix.empty()) {
+                *data = _prefix.data();
+                *size = _prefix.size();
+                return true;
+            }
+        }
+
+        return _rest.Next(data, size);
+    }
+
+  private:
+    std::vector<uint8_t> _prefix;
+    ByteSource &_rest;
+    bool _replayed = false;
+};
+
+// Presents a single in-memory buffer as a ByteSource.
+class MemorySource : public ByteSource
+{
+  public:
+    MemorySource(const uint8_t *data, size_t size) :
+        _data(data),
+        _size(size)
+    {
+    }
+
+    bool Next(const uint8_t **data, size_t *size) override
+    {
+        if (_done) {
+            return false;
+        }
+
+        _done = true;
+        *data = _data;
+        *size = _size;
+        return true;
+    }
+
+  private:
+    const uint8_t *_data;
+    size_t _size;
+    bool _done = false;
+};
@@ -0,0 +1,197 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "JsonEvent.h"
+
+#include <cstdio>
+
+namespace {
+    void AppendCodePoint(std::string *json, uint32_t codePoint)
+    {
+        if (codePoint == '\n') {
+            *json += "\\n";
+
+        } else if (codePoint == '\r') {
+            *json += "\\r";
+
+        } else if (codePoint == '\t') {
+            *json += "\\t";
+
+        } else if (codePoint < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned int>(codePoint));
+            *json += escaped;
+
+        } else if ((codePoint == '"') || (codePoint == '\\')) {
+            *json += '\\';
+            *json += static_cast<char>(codePoint);
+
+        } else if (codePoint < 0x80) {
+            *json += static_cast<char>(codePoint);
+
+        } else if (codePoint < 0x800) {
+            *json += static_cast<char>(0xc0 | (codePoint >> 6));
+            *json += static_cast<char>(0x80 | (codePoint & 0x3f));
+
+        } else if (codePoint < 0x10000) {
+            *json += static_cast<char>(0xe0 | (codePoint >> 12));
+            *json += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+            *json += static_cast<char>(0x80 | (codePoint & 0x3f));
+
+        } else {
+            *json += static_cast<char>(0xf0 | (codePoint >> 18));
+            *json += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f));
+            *json += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+            *json += static_cast<char>(0x80 | (codePoint & 0x3f));
+        }
+    }
+
+    bool IsCharacter(uint32_t codePoint)
+    {
+        return (codePoint <= 0x10ffff) && ((codePoint < 0xd800) || (codePoint > 0xdfff));
+    }
+
+    // The length of the UTF-8 sequence at the start of the text and what it
+    // encodes, or 0 if it is not one.
+    size_t Decode(const unsigned char *text, size_t size, uint32_t *codePoint)
+    {
+        const unsigned char lead = text[0];
+        size_t length;
+        uint32_t minimum;
+        if (lead < 0x80) {
+            *codePoint = lead;
+            return 1;
+
+        } else if ((lead >= 0xc2) && (lead <= 0xdf)) {
+            length = 2;
+            minimum = 0x80;
+            *codePoint = lead & 0x1f;
+
+        } else if ((lead & 0xf0) == 0xe0) {
+            length = 3;
+            minimum = 0x800;
+            *codePoint = lead & 0x0f;
+
+        } else if ((lead >= 0xf0) && (lead <= 0xf4)) {
+            length = 4;
+            minimum = 0x10000;
+            *codePoint = lead & 0x07;
+
+        } else {
+            return 0;
+        }
+
+        if (length > size) {
+            return 0;
+        }
+
+        for (size_t index = 1; index < length; index += 1) {
+            if ((text[index] & 0xc0) != 0x80) {
+                return 0;
+            }
+
+            *codePoint = (*codePoint << 6) | (text[index] & 0x3f);
+        }
+
+        return ((*codePoint >= minimum) && IsCharacter(*codePoint)) ? length : 0;
+    }
+
+    void AppendUtf8(std::string *json, const std::string &value)
+    {
+        *json += '"';
+        const unsigned char *text = reinterpret_cast<const unsigned char *>(value.data());
+        size_t size = value.size();
+        while (size > 0) {
+            uint32_t codePoint;
+            size_t length = Decode(text, size, &codePoint);
+            if (length == 0) {
+                codePoint = 0xfffd;
+                length = 1;
+            }
+
+            AppendCodePoint(json, codePoint);
+            text += length;
+            size -= length;
+        }
+
+        *json += '"';
+    }
+
+    void AppendWide(std::string *json, const std::wstring &value)
+    {
+        *json += '"';
+        for (size_t index = 0; index < value.size(); index += 1) {
+            uint32_t codePoint = static_cast<uint32_t>(value[index]);
+            if constexpr (sizeof(wchar_t) == 2) {
+                if ((codePoint >= 0xd800) && (codePoint <= 0xdbff) && ((index + 1) < value.size())) {
+                    const uint32_t low = static_cast<uint32_t>(value[index + 1]);
+                    if ((low >= 0xdc00) && (low <= 0xdfff)) {
+                        codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+                        index += 1;
+                    }
+                }
+            }
+
+            AppendCodePoint(json, IsCharacter(codePoint) ? codePoint : 0xfffd);
+        }
+
+        *json += '"';
+    }
+}
+
+JsonEvent::JsonEvent(const char *name) :
+    _json("{\"event\":")
+{
+    AppendUtf8(&_json, name);
+}
+
+JsonEvent &JsonEvent::Add(const char *key, const char *value)
+{
+    return Add(key, std::string(value));
+}
+
+JsonEvent &JsonEvent::Add(const char *key, const std::string &value)
+{
+    Key(key);
+    AppendUtf8(&_json, value);
+    return *this;
+}
+
+JsonEvent &JsonEvent::Add(const char *key, const std::wstring &value)
+{
+    Key(key);
+    AppendWide(&_json, value);
+    return *this;
+}
+
+JsonEvent &JsonEvent::Add(const char *key, uint64_t value)
+{
+    Key(key);
+    _json += std::to_string(value);
+    return *this;
+}
+
+JsonEvent &JsonEvent::Add(const char *key, bool value)
+{
+    Key(key);
+    _json += value ? "true" : "false";
+    return *this;
+}
+
+JsonEvent &JsonEvent::Add(const char *key, double value)
+{
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.3f", value);
+    Key(key);
+    _json += text;
+    return *this;
+}
+
+void JsonEvent::Key(const char *key)
+{
+    _json += ',';
+    AppendUtf8(&_json, key);
+    _json += ':';
+}
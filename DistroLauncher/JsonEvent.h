@@ -0,0 +1,41 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// One event of `--output=json`: a JSON object on a line of its own, named by
+// its "event" member, so that a streaming parser can take the events as
+// they come:
+//
+//     {"event":"install","hresult":"0x00000000","ms":5321.402}
+//
+// Text is written as UTF-8, wide text converted to it; bytes that are not
+// UTF-8, such as from a command's output, become U+FFFD.
+class JsonEvent
+{
+  public:
+    explicit JsonEvent(const char *name);
+
+    JsonEvent &Add(const char *key, const char *value);
+    JsonEvent &Add(const char *key, const std::string &value);
+    JsonEvent &Add(const char *key, const std::wstring &value);
+    JsonEvent &Add(const char *key, uint64_t value);
+    JsonEvent &Add(const char *key, uint32_t value) { return Add(key, static_cast<uint64_t>(value)); }
+    JsonEvent &Add(const char *key, bool value);
+
+    // Milliseconds, to the microsecond.
+    JsonEvent &Add(const char *key, double value);
+
+    // The event with its line break.
+    std::string Line() const { return _json + "}\n"; }
+
+  private:
+    void Key(const char *key);
+
+    std::string _json;
+};
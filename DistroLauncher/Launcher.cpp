@@ -0,0 +1,980 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "Launcher.h"
+#include "PipeCapture.h"
+#include "RootfsImporter.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cwchar>
+#include <thread>
+
+// Commandline arguments:
+#define ARG_CONFIG              L"config"
+#define ARG_CONFIG_DEFAULT_USER L"--default-user"
+#define ARG_INSTALL             L"install"
+#define ARG_INSTALL_ROOT        L"--root"
+#define ARG_INSTALL_CONFIG      L"--config"
+#define ARG_RUN                 L"run"
+#define ARG_RUN_C               L"-c"
+#define ARG_RUN_BATCH           L"--batch"
+#define ARG_RUN_JOBS            L"--jobs"
+#define ARG_RUN_TIMEOUT         L"--timeout"
+#define ARG_SNAPSHOT            L"snapshot"
+#define ARG_CLONE               L"clone"
+#define ARG_HELP                L"help"
+#define ARG_OUTPUT              L"--output="
+#define ARG_OUTPUT_JSON         L"json"
+#define ARG_OUTPUT_TEXT         L"text"
+
+namespace {
+    // Groups new user accounts are added to.
+    const wchar_t *const UserGroups = L"adm,dialout,cdrom,floppy,sudo,audio,dip,video,plugdev,netdev";
+
+    // How long queries that need no input may take; the first launch of a
+    // distribution includes starting it.
+    constexpr std::chrono::milliseconds QueryTimeout = std::chrono::seconds(60);
+
+    // Sets the keys of /etc/wsl.conf given as "<section>.<key>=<value>"
+    // lines in $settings, replacing those it has, adding the others at the
+    // end of their section, and keeping everything else as it is.
+    const char *const WslConfMerge =
+        "BEGIN { count = split(ENVIRON[\"settings\"], lines, \"\\n\"); for (i = 1; i <= count; i++) { dot = index(lines[i], \".\"); "
+        "equals = index(lines[i], \"=\"); section[i] = substr(lines[i], 1, dot - 1); key[i] = substr(lines[i], dot + 1, equals - dot - 1); "
+        "value[i] = substr(lines[i], equals + 1) } } "
+        "function finish(i) { for (i = 1; i <= count; i++) if (!done[i] && (section[i] == current)) { print key[i] \"=\" value[i]; done[i] = 1 } } "
+        "/^[ \\t]*$/ { blanks += 1; next } "
+        "/^[ \\t]*\\[/ { finish(); current = $0; sub(/^[ \\t]*\\[[ \\t]*/, \"\", current); sub(/[ \\t]*\\].*$/, \"\", current) } "
+        "{ for (; blanks > 0; blanks -= 1) print \"\"; name = $0; sub(/^[ \\t]*/, \"\", name); sub(/[ \\t]*=.*$/, \"\", name); "
+        "for (i = 1; i <= count; i++) if ((section[i] == current) && (key[i] == name) && index($0, \"=\")) { if (!done[i]) print key[i] \"=\" value[i]; done[i] = 1; next } "
+        "print } "
+        "END { finish(); for (i = 1; i <= count; i++) if (!done[i]) { if ((NR > 0) || wrote) print \"\"; print \"[\" section[i] \"]\"; wrote = 1; "
+        "for (j = i; j <= count; j++) if (!done[j] && (section[j] == section[i])) { print key[j] \"=\" value[j]; done[j] = 1 } } }";
+
+    // Archives the root file system, and no other, as root, with numeric
+    // owners, extended attributes (file capabilities among them) and no
+    // times but modification times. tar exits with 1 when files changed as
+    // they were read, which they do in a distribution in use; the archive
+    // is whole all the same.
+    const wchar_t *const SnapshotCommand =
+        L"[ \"$(id -u)\" = 0 ] || { echo 'not running as root' >&2; exit 1; }; "
+        L"tar -C / -cf - --one-file-system --numeric-owner --format=posix --pax-option=delete=atime,delete=ctime "
+        L"--xattrs --xattrs-include='*' --warning=no-file-changed --warning=no-file-ignored .; "
+        L"status=$?; [ \"$status\" -le 1 ] || exit \"$status\"";
+
+    // Makes the SSH host keys and the machine ID a snapshot leaves out (see
+    // SnapshotWriter) for a clone of its own, with whichever of the tools is
+    // installed.
+    const wchar_t *const CloneIdentityCommand =
+        L"if command -v ssh-keygen >/dev/null; then ssh-keygen -A; fi; "
+        L"if [ ! -s /etc/machine-id ]; then "
+        L"if command -v systemd-machine-id-setup >/dev/null; then systemd-machine-id-setup; "
+        L"elif command -v dbus-uuidgen >/dev/null; then dbus-uuidgen --ensure=/etc/machine-id; fi; fi";
+
+    // Quotes a value for the shell WSL runs launched commands with.
+    template<typename String>
+    String ShellQuote(const String &value)
+    {
+        String quoted(1, '\'');
+        for (const auto c : value) {
+            if (c == '\'') {
+                quoted += {'\'', '\\', '\'', '\''};
+
+            } else {
+                quoted += c;
+            }
+        }
+
+        quoted += '\'';
+        return quoted;
+    }
+
+    uint32_t ParseUid(const std::string &output)
+    {
+        uint32_t uid = Launcher::UidInvalid;
+        try {
+            const unsigned long value = std::stoul(output, nullptr, 10);
+            if (value < Launcher::UidInvalid) {
+                uid = static_cast<uint32_t>(value);
+            }
+
+        } catch( ... ) { }
+
+        return uid;
+    }
+
+    // What --output=json calls a message.
+    const char *MessageName(LauncherMessage message)
+    {
+        switch (message) {
+        case LauncherMessage::Usage:
+            return "usage";
+        case LauncherMessage::Installing:
+            return "installing";
+        case LauncherMessage::InstallSuccess:
+            return "installSuccess";
+        case LauncherMessage::CreateUserPrompt:
+            return "createUserPrompt";
+        case LauncherMessage::EnterUserName:
+            return "enterUserName";
+        case LauncherMessage::InstallAlreadyExists:
+            return "installAlreadyExists";
+        case LauncherMessage::EnableVirtualization:
+            return "enableVirtualization";
+        case LauncherMessage::BatchExitCode:
+            return "batchExitCode";
+        case LauncherMessage::BatchTimedOut:
+            return "batchTimedOut";
+        case LauncherMessage::BatchLaunchFailed:
+            return "batchLaunchFailed";
+        case LauncherMessage::BatchSummary:
+            return "batchSummary";
+        case LauncherMessage::ProvisionInvalid:
+            return "provisionInvalid";
+        case LauncherMessage::ProvisionFailed:
+            return "provisionFailed";
+        case LauncherMessage::SnapshotInvalid:
+            return "snapshotInvalid";
+        case LauncherMessage::SnapshotFailed:
+            return "snapshotFailed";
+        case LauncherMessage::SnapshotSuccess:
+            return "snapshotSuccess";
+        case LauncherMessage::CloneAlreadyInstalled:
+            return "cloneAlreadyInstalled";
+        }
+
+        return "unknown";
+    }
+
+    const char *StatusName(BatchStatus status)
+    {
+        switch (status) {
+        case BatchStatus::Ok:
+            return "ok";
+        case BatchStatus::LaunchFailed:
+            return "launchFailed";
+        case BatchStatus::TimedOut:
+            return "timedOut";
+        case BatchStatus::IoError:
+            return "ioError";
+        }
+
+        return "unknown";
+    }
+
+    std::string HresultText(LauncherResult result)
+    {
+        char text[16];
+        std::snprintf(text, sizeof(text), "0x%08x", static_cast<unsigned int>(result));
+        return text;
+    }
+
+    // Drops what it is given, for commands whose output the launcher has no
+    // use for.
+    class NullSink : public ByteSink
+    {
+      public:
+        bool Write(const uint8_t *, size_t) override { return true; }
+    };
+
+    // Hands the output of a command on as "output" events, as soon as it
+    // comes. Each event ends on a line break unless a line grows long, and
+    // is then cut between two characters, so that none is split.
+    class OutputEvents : public ByteSink
+    {
+      public:
+        static constexpr size_t MaxLine = 64 << 10;
+
+        explicit OutputEvents(LauncherConsole &console) :
+            _console(console)
+        {
+        }
+
+        bool Write(const uint8_t *data, size_t size) override
+        {
+            _pending.append(reinterpret_cast<const char *>(data), size);
+            size_t end = _pending.rfind('\n');
+            end = (end == std::string::npos) ? 0 : (end + 1);
+            if ((end == 0) && (_pending.size() >= MaxLine)) {
+                end = _pending.size();
+                while ((end > 0) && ((static_cast<uint8_t>(_pending[end - 1]) & 0xC0) == 0x80)) {
+                    end -= 1;
+                }
+
+                // A lead byte whose character is not complete yet waits too.
+                end -= ((end > 0) && ((static_cast<uint8_t>(_pending[end - 1]) & 0xC0) == 0xC0)) ? 1 : 0;
+                end = (end == 0) ? _pending.size() : end;
+            }
+
+            if (end > 0) {
+                Emit(_pending.substr(0, end));
+                _pending.erase(0, end);
+            }
+
+            return true;
+        }
+
+        // Emits what is left once the command has ended.
+        void Finish()
+        {
+            if (!_pending.empty()) {
+                Emit(_pending);
+                _pending.clear();
+            }
+        }
+
+      private:
+        void Emit(const std::string &output)
+        {
+            _console.Write(LauncherConsole::Stream::Output, JsonEvent("output").Add("output", output).Line());
+            _console.Flush();
+        }
+
+        LauncherConsole &_console;
+        std::string _pending;
+    };
+
+    bool IsCommand(const std::wstring &argument)
+    {
+        return ((argument == ARG_INSTALL) ||
+                (argument == ARG_RUN) ||
+                (argument == ARG_RUN_C) ||
+                (argument == ARG_CONFIG) ||
+                (argument == ARG_SNAPSHOT) ||
+                (argument == ARG_CLONE));
+    }
+}
+
+Launcher::Launcher(LauncherConsole &console, WslBackend &wsl, StartupTiming *timing) :
+    _console(console),
+    _wsl(wsl),
+    _timing(timing),
+    _start(StartupTiming::Clock::now())
+{
+}
+
+uint32_t Launcher::Main(const std::vector<std::wstring> &arguments)
+{
+    std::vector<std::wstring> rest(arguments);
+    if (!rest.empty() && (rest.front().compare(0, std::wcslen(ARG_OUTPUT), ARG_OUTPUT) == 0)) {
+        const std::wstring format = rest.front().substr(std::wcslen(ARG_OUTPUT));
+        if ((format != ARG_OUTPUT_JSON) && (format != ARG_OUTPUT_TEXT)) {
+            Print(LauncherMessage::Usage);
+            return 1;
+        }
+
+        _json = (format == ARG_OUTPUT_JSON);
+        _console.SetJsonOutput(_json);
+        rest.erase(rest.begin());
+    }
+
+    const uint32_t exitCode = Run(rest);
+    if (_json) {
+        Emit(JsonEvent("exit").Add("exitCode", exitCode).Add("ms", Milliseconds()));
+    }
+
+    return exitCode;
+}
+
+uint32_t Launcher::Run(const std::vector<std::wstring> &arguments)
+{
+    // Deal with possible help flag.
+    if (!arguments.empty() && arguments.front() == ARG_HELP) {
+        Print(LauncherMessage::Usage);
+        return 0;
+    }
+
+    // Anything else not understood gets the usage too. Neither needs WSL,
+    // so both return before wslapi.dll is loaded.
+    if (!arguments.empty() && !IsCommand(arguments.front())) {
+        Print(LauncherMessage::Usage);
+        return 1;
+    }
+
+    // A provisioning file is read in full before anything else, so that a
+    // mistake in it is found before minutes of installing rather than after.
+    bool installOnly = ((arguments.size() > 0) && (arguments[0] == ARG_INSTALL));
+    ProvisionConfig config;
+    const bool provision = ((installOnly) && (arguments.size() > 1) && (arguments[1] == ARG_INSTALL_CONFIG));
+    if (provision) {
+        if (arguments.size() != 3) {
+            Print(LauncherMessage::Usage);
+            return 1;
+        }
+
+        // Where file names are narrow, a name the locale cannot encode
+        // names no file.
+        std::filesystem::path file;
+        try {
+            file = arguments[2];
+
+        } catch( ... ) { }
+
+        if (!config.Load(file)) {
+            if (_json) {
+                Emit(JsonEvent("provision").Add("hresult", HresultText(LauncherResults::InvalidArgument)).Add("error", config.Error()));
+            }
+
+            Print(LauncherMessage::ProvisionInvalid, {config.Error()});
+            return 1;
+        }
+    }
+
+    // So is the record of a snapshot to clone.
+    const bool clone = ((arguments.size() > 0) && (arguments[0] == ARG_CLONE));
+    std::filesystem::path snapshotFile;
+    SnapshotInfo snapshotInfo;
+    if (clone || ((arguments.size() > 0) && (arguments[0] == ARG_SNAPSHOT))) {
+        if (arguments.size() != 2) {
+            Print(LauncherMessage::Usage);
+            return 1;
+        }
+
+        try {
+            snapshotFile = arguments[1];
+
+        } catch( ... ) { }
+    }
+
+    if (clone) {
+        SnapshotReader reader;
+        if (!reader.Load(snapshotFile)) {
+            if (_json) {
+                Emit(JsonEvent("snapshot").Add("hresult", HresultText(LauncherResults::InvalidArgument)).Add("error", reader.Error()));
+            }
+
+            Print(LauncherMessage::SnapshotInvalid, {reader.Error()});
+            return 1;
+        }
+
+        snapshotInfo = reader.Info();
+    }
+
+    // Ensure that the Windows Subsystem for Linux optional component is installed.
+    uint32_t exitCode = 1;
+    const bool installed = _wsl.IsOptionalComponentInstalled();
+    Mark("wslapi");
+    if (!installed) {
+        if (_json) {
+            Emit(JsonEvent("state").Add("subsystemInstalled", false));
+        }
+
+        PrintError(LauncherResults::SubsystemNotPresent);
+        if (arguments.empty()) {
+            WaitForKey();
+        }
+
+        return exitCode;
+    }
+
+    // Install the distribution if it is not already.
+    LauncherResult hr = LauncherResults::Ok;
+    const bool registered = _wsl.IsDistributionRegistered();
+    Mark("registered");
+    if (_json) {
+        Emit(JsonEvent("state").Add("subsystemInstalled", true).Add("registered", registered));
+    }
+
+    if (!registered) {
+
+        // If the "--root" option is specified, do not create a user account.
+        bool useRoot = ((installOnly) && (arguments.size() > 1) && (arguments[1] == ARG_INSTALL_ROOT));
+        const double installStart = Milliseconds();
+        hr = clone ? Clone(snapshotFile, snapshotInfo) : InstallDistribution(!useRoot, provision ? &config : nullptr);
+        if (_json) {
+            Emit(JsonEvent("install").Add("hresult", HresultText(hr)).Add("ms", Milliseconds() - installStart));
+        }
+
+        if (LauncherResults::Failed(hr)) {
+            if (hr == LauncherResults::AlreadyExists) {
+                Print(LauncherMessage::InstallAlreadyExists);
+            }
+
+        } else {
+            Print(LauncherMessage::InstallSuccess);
+        }
+
+        exitCode = LauncherResults::Failed(hr) ? 1 : 0;
+
+    } else if (clone) {
+        Print(LauncherMessage::CloneAlreadyInstalled);
+        return 1;
+    }
+
+    // Parse the command line arguments.
+    if ((!LauncherResults::Failed(hr)) && (!installOnly) && (!clone)) {
+        _console.Flush();
+        if (arguments.empty() && _json) {
+            hr = RunCommand(L"", &exitCode);
+
+        } else if (arguments.empty()) {
+            hr = _wsl.LaunchInteractive(L"", false, &exitCode);
+
+            // Check exitCode to see if wsl.exe returned that it could not start the Linux process
+            // then prompt users for input so they can view the error message.
+            if (!LauncherResults::Failed(hr) && exitCode == UINT32_MAX) {
+                WaitForKey();
+            }
+
+        } else if (((arguments[0] == ARG_RUN) || (arguments[0] == ARG_RUN_C)) &&
+                   (arguments.size() > 1) && (arguments[1] == ARG_RUN_BATCH)) {
+
+            hr = RunBatch(arguments, &exitCode);
+
+        } else if ((arguments[0] == ARG_RUN) ||
+                   (arguments[0] == ARG_RUN_C)) {
+
+            std::wstring command;
+            for (size_t index = 1; index < arguments.size(); index += 1) {
+                command += L" ";
+                command += arguments[index];
+            }
+
+            hr = RunCommand(command, &exitCode);
+
+        } else if (arguments[0] == ARG_CONFIG) {
+            hr = LauncherResults::InvalidArgument;
+            if (arguments.size() == 3) {
+                if (arguments[1] == ARG_CONFIG_DEFAULT_USER) {
+                    hr = SetDefaultUser(arguments[2]);
+                }
+            }
+
+            if (!LauncherResults::Failed(hr)) {
+                exitCode = 0;
+            }
+
+        } else if (arguments[0] == ARG_SNAPSHOT) {
+            hr = Snapshot(snapshotFile);
+            if (!LauncherResults::Failed(hr)) {
+                exitCode = 0;
+            }
+
+        } else {
+            Print(LauncherMessage::Usage);
+            return exitCode;
+        }
+    }
+
+    Mark("launched");
+
+    // If an error was encountered, print an error message.
+    if (LauncherResults::Failed(hr)) {
+        if (hr == LauncherResults::HyperVNotInstalled) {
+            Print(LauncherMessage::EnableVirtualization);
+
+        } else {
+            PrintError(hr);
+        }
+
+        if (arguments.empty()) {
+            WaitForKey();
+        }
+    }
+
+    return LauncherResults::Failed(hr) ? 1 : exitCode;
+}
+
+LauncherResult Launcher::InstallDistribution(bool createUser, const ProvisionConfig *config)
+{
+    TraceSpan span("InstallDistribution");
+
+    // Register the distribution.
+    Print(LauncherMessage::Installing);
+    _console.Flush();
+    LauncherResult hr = _wsl.RegisterDistribution();
+    if (LauncherResults::Failed(hr)) {
+        return hr;
+    }
+
+    // Apply the provisioning file, setting the user it created as the default.
+    if (config != nullptr) {
+        uint32_t uid;
+        hr = Provision(*config, &uid);
+        if ((LauncherResults::Failed(hr)) || (uid == UidInvalid)) {
+            return hr;
+        }
+
+        hr = _wsl.ConfigureDistribution(uid);
+        if (LauncherResults::Failed(hr)) {
+            return hr;
+        }
+
+        if (_json) {
+            Emit(JsonEvent("user").Add("name", config->UserName()).Add("uid", uid));
+        }
+
+    } else if (createUser) {
+        // Create a user account, asking for its name.
+        Print(LauncherMessage::CreateUserPrompt);
+        std::wstring userName;
+        uint32_t uid;
+        do {
+            userName = ReadWord(LauncherMessage::EnterUserName, 32);
+
+        } while (!CreateUser(userName, &uid));
+
+        // Set this user account as the default.
+        hr = _wsl.ConfigureDistribution(uid);
+        if (LauncherResults::Failed(hr)) {
+            return hr;
+        }
+
+        if (_json) {
+            Emit(JsonEvent("user").Add("name", userName).Add("uid", uid));
+        }
+    }
+
+    return hr;
+}
+
+LauncherResult Launcher::SetDefaultUser(const std::wstring &userName)
+{
+    TraceSpan span("SetDefaultUser");
+
+    // Query the UID of the given user name and configure the distribution
+    // to use this UID as the default.
+    uint32_t uid = QueryUid(userName);
+    if (uid == UidInvalid) {
+        return LauncherResults::InvalidArgument;
+    }
+
+    const LauncherResult hr = _wsl.ConfigureDistribution(uid);
+    if (_json && !LauncherResults::Failed(hr)) {
+        Emit(JsonEvent("user").Add("name", userName).Add("uid", uid));
+    }
+
+    return hr;
+}
+
+bool Launcher::CreateUser(const std::wstring &userName, uint32_t *uid)
+{
+    TraceSpan span("Launcher::CreateUser");
+
+    // Create the user account, set its password, add it to any relevant
+    // groups and delete it again if that fails, in an interactive launch so
+    // that passwd reads the password from the terminal without echoing it.
+    // The output of the commands goes to the error stream, which keeps the
+    // output stream to events with --output=json. Distributions the package
+    // installed wsl-helper in create the account with it, which edits the
+    // account files directly instead of going through adduser, useradd and
+    // usermod, and prints nothing but the UID.
+    std::wstring commandLine = L"user=";
+    commandLine += ShellQuote(userName);
+    commandLine += L"; helper=" ROOTFS_HELPER_PATH L"; if [ -x \"$helper\" ]; then ";
+    commandLine += L"\"$helper\" add-user --groups ";
+    commandLine += UserGroups;
+    commandLine += L" \"$user\" >/dev/null || exit 1; ";
+    commandLine += L"if ! passwd \"$user\" >&2; then \"$helper\" remove-user --remove-home \"$user\"; exit 1; fi; ";
+    commandLine += L"exit 0; fi; ";
+    commandLine += L"adduser --quiet --gecos '' \"$user\" >&2 || exit 1; ";
+    commandLine += L"if ! usermod -aG ";
+    commandLine += UserGroups;
+    commandLine += L" \"$user\" >&2; then deluser \"$user\" >&2; exit 1; fi";
+
+    uint32_t exitCode;
+    _console.Flush();
+    LauncherResult hr = _wsl.LaunchInteractive(commandLine, false, &exitCode);
+    if ((LauncherResults::Failed(hr)) || (exitCode != 0)) {
+        return false;
+    }
+
+    // Only the UID is captured, in a launch of its own.
+    *uid = QueryUid(userName);
+    return *uid != UidInvalid;
+}
+
+LauncherResult Launcher::Provision(const ProvisionConfig &config, uint32_t *uid)
+{
+    TraceSpan span("Launcher::Provision");
+
+    // Everything is applied in a single launch that has no input: the user
+    // account created as CreateUser creates it, but with its password locked
+    // or set from the hash, then its shell changed, the skipped packages
+    // that are installed purged and wsl.conf updated. The output of the
+    // commands goes to the error stream, leaving the output stream to the UID.
+    std::string script;
+    if (!config.UserName().empty()) {
+        std::string groups = config.Groups();
+        if (groups.empty()) {
+            for (const wchar_t *group = UserGroups; *group != L'\0'; group += 1) {
+                groups += static_cast<char>(*group);
+            }
+        }
+
+        script += "user=" + ShellQuote(config.UserName());
+        script += "; groups=" + ShellQuote(groups);
+        script += "; helper=" ROOTFS_HELPER_PATH_UTF8 "; if [ -x \"$helper\" ]; then ";
+        script += "uid=$(\"$helper\" add-user --groups \"$groups\" \"$user\") || exit 1; else ";
+        script += "adduser --quiet --disabled-password --gecos '' \"$user\" >&2 || exit 1; ";
+        script += "uid=$(id -u \"$user\") || exit 1; IFS=,; for group in $groups; do ";
+        script += "if getent group \"$group\" >/dev/null; then usermod -aG \"$group\" \"$user\" >&2 || exit 1; ";
+        script += "else echo \"no group $group, skipped\" >&2; fi; done; unset IFS; fi; ";
+        if (!config.Shell().empty()) {
+            script += "usermod -s " + ShellQuote(config.Shell()) + " \"$user\" >&2 || exit 1; ";
+        }
+
+        if (!config.PasswordHash().empty()) {
+            script += "usermod -p " + ShellQuote(config.PasswordHash()) + " \"$user\" >&2 || exit 1; ";
+        }
+    }
+
+    if (!config.SkippedPackages().empty()) {
+        script += "installed=; for package in";
+        for (const std::string &package : config.SkippedPackages()) {
+            script += " " + ShellQuote(package);
+        }
+
+        script += "; do if dpkg -s \"$package\" >/dev/null 2>&1; then installed=\"$installed $package\"; fi; done; ";
+        script += "[ -z \"$installed\" ] || DEBIAN_FRONTEND=noninteractive apt-get purge -y -q $installed >&2 || exit 1; ";
+    }
+
+    if (!config.WslConf().empty()) {
+        std::string settings;
+        for (const ProvisionConfig::Setting &setting : config.WslConf()) {
+            settings += (settings.empty() ? "" : "\n") + setting.section + "." + setting.key + "=" + setting.value;
+        }
+
+        script += "[ -e /etc/wsl.conf ] || : > /etc/wsl.conf; settings=" + ShellQuote(settings);
+        script += " awk " + ShellQuote(std::string(WslConfMerge)) + " /etc/wsl.conf > /etc/wsl.conf.new && ";
+        script += "mv /etc/wsl.conf.new /etc/wsl.conf || exit 1; ";
+    }
+
+    script += config.UserName().empty() ? "exit 0" : "echo \"$uid\"";
+
+    const double start = Milliseconds();
+    const BatchResult result = _wsl.Run(script, PipeCapture::Forever);
+    *uid = config.UserName().empty() ? UidInvalid : ParseUid(result.output);
+    const bool succeeded = result.Succeeded() && (config.UserName().empty() || (*uid != UidInvalid));
+    const LauncherResult hr = succeeded ? LauncherResults::Ok : LauncherResults::Fail;
+    if (_json) {
+        Emit(JsonEvent("provision")
+                 .Add("hresult", HresultText(hr))
+                 .Add("exitCode", static_cast<uint64_t>(result.exitCode))
+                 .Add("errorOutput", result.errorOutput)
+                 .Add("error", result.error)
+                 .Add("ms", Milliseconds() - start));
+
+    } else {
+        _console.Write(LauncherConsole::Stream::Error, result.errorOutput);
+    }
+
+    if (!succeeded) {
+        Print(LauncherMessage::ProvisionFailed, {result.error.empty() ? "exit code " + std::to_string(result.exitCode) : result.error});
+    }
+
+    return hr;
+}
+
+uint32_t Launcher::QueryUid(const std::wstring &userName)
+{
+    TraceSpan span("Launcher::QueryUid");
+
+    // Query the UID of the supplied username.
+    std::wstring command = L"id -u ";
+    command += ShellQuote(userName);
+    std::string output;
+    uint32_t exitCode;
+    LauncherResult hr = _wsl.LaunchForOutput(command, &output, &exitCode, QueryTimeout);
+    if ((LauncherResults::Failed(hr)) || (exitCode != 0)) {
+        return UidInvalid;
+    }
+
+    return ParseUid(output);
+}
+
+LauncherResult Launcher::Snapshot(const std::filesystem::path &file)
+{
+    TraceSpan span("Launcher::Snapshot");
+
+    // The default user is recorded by UID and by name, the name only for
+    // whoever reads the snapshot.
+    const double start = Milliseconds();
+    SnapshotInfo info;
+    LauncherResult hr = _wsl.GetDefaultUid(&info.defaultUid);
+    if (LauncherResults::Failed(hr)) {
+        return hr;
+    }
+
+    std::string output;
+    uint32_t exitCode;
+    hr = _wsl.LaunchForOutput(L"id -nu " + std::to_wstring(info.defaultUid), &output, &exitCode, QueryTimeout);
+    if (LauncherResults::Failed(hr)) {
+        return hr;
+    }
+
+    if (exitCode == 0) {
+        info.defaultUser = output.substr(0, output.find_first_of(" \t\r\n"));
+    }
+
+    // Every file can only be read as root, which tar runs as without the
+    // default user changing.
+    std::filesystem::path partial = file;
+    partial += ".partial";
+    FileSink sink(partial);
+    std::string error;
+    SnapshotWriter writer(sink, info);
+    if (!sink.IsOpen()) {
+        error = "cannot create " + partial.filename().u8string();
+
+    } else {
+        _console.Flush();
+        hr = _wsl.LaunchForStreamAsRoot(SnapshotCommand, writer, &exitCode);
+        if (!writer.Error().empty()) {
+            error = writer.Error();
+
+        } else if (!LauncherResults::Failed(hr) && (exitCode != 0)) {
+            error = "tar exited with " + std::to_string(exitCode);
+
+        } else if (!LauncherResults::Failed(hr) && !writer.Close()) {
+            error = writer.Error();
+        }
+
+        if (!sink.Close() && error.empty() && !LauncherResults::Failed(hr)) {
+            error = "cannot write " + partial.filename().u8string();
+        }
+    }
+
+    std::error_code errorCode;
+    if (error.empty() && !LauncherResults::Failed(hr)) {
+        std::filesystem::rename(partial, file, errorCode);
+        if (errorCode) {
+            error = "cannot rename " + partial.filename().u8string() + " to " + file.filename().u8string();
+        }
+    }
+
+    if (!error.empty() || LauncherResults::Failed(hr)) {
+        std::filesystem::remove(partial, errorCode);
+        hr = LauncherResults::Failed(hr) ? hr : LauncherResults::Fail;
+    }
+
+    if (_json) {
+        Emit(JsonEvent("snapshot")
+                 .Add("hresult", HresultText(hr))
+                 .Add("uid", info.defaultUid)
+                 .Add("user", info.defaultUser)
+                 .Add("entries", writer.Entries())
+                 .Add("bytes", writer.UncompressedBytes())
+                 .Add("compressedBytes", writer.CompressedBytes())
+                 .Add("error", error)
+                 .Add("ms", Milliseconds() - start));
+    }
+
+    if (!error.empty()) {
+        Print(LauncherMessage::SnapshotFailed, {error});
+
+    } else if (!LauncherResults::Failed(hr)) {
+        const uint64_t megabytes = (writer.CompressedBytes() + (1 << 20) - 1) >> 20;
+        Print(LauncherMessage::SnapshotSuccess, {static_cast<uint32_t>(writer.Entries()), static_cast<uint32_t>(megabytes)});
+    }
+
+    return hr;
+}
+
+LauncherResult Launcher::Clone(const std::filesystem::path &file, const SnapshotInfo &info)
+{
+    TraceSpan span("Launcher::Clone");
+
+    // The snapshot has everything provisioned already: registering it and
+    // setting the default user it recorded is all there is to do, besides
+    // giving the clone an identity of its own. That is done as well as the
+    // tools installed allow, and a clone without one is still a clone.
+    Print(LauncherMessage::Installing);
+    _console.Flush();
+    LauncherResult hr = _wsl.RegisterSnapshot(file);
+    if (LauncherResults::Failed(hr)) {
+        return hr;
+    }
+
+    NullSink discarded;
+    uint32_t exitCode;
+    hr = _wsl.LaunchForStreamAsRoot(CloneIdentityCommand, discarded, &exitCode);
+    if (LauncherResults::Failed(hr)) {
+        return hr;
+    }
+
+    hr = _wsl.ConfigureDistribution(info.defaultUid);
+    if (_json && !LauncherResults::Failed(hr)) {
+        Emit(JsonEvent("user").Add("name", info.defaultUser).Add("uid", info.defaultUid));
+    }
+
+    return hr;
+}
+
+LauncherResult Launcher::RunBatch(const std::vector<std::wstring> &arguments, uint32_t *exitCode)
+{
+    TraceSpan span("RunBatch");
+
+    // run --batch <file> [--jobs <count>] [--timeout <seconds>]
+    std::filesystem::path manifest;
+    unsigned int parallelism = DefaultParallelism();
+    std::chrono::milliseconds timeout = PipeCapture::Forever;
+    for (size_t index = 1; index < arguments.size(); index += 2) {
+        if ((index + 1) >= arguments.size()) {
+            return LauncherResults::InvalidArgument;
+        }
+
+        const std::wstring &value = arguments[index + 1];
+        const unsigned long number = std::wcstoul(value.c_str(), nullptr, 10);
+        if (arguments[index] == ARG_RUN_BATCH) {
+            // Where file names are narrow, a name the locale cannot encode
+            // names no file.
+            try {
+                manifest = value;
+
+            } catch( ... ) {
+                return LauncherResults::FileNotFound;
+            }
+
+        } else if ((arguments[index] == ARG_RUN_JOBS) && (number > 0) && (number <= 64)) {
+            parallelism = static_cast<unsigned int>(number);
+
+        } else if ((arguments[index] == ARG_RUN_TIMEOUT) && (number > 0)) {
+            timeout = std::chrono::seconds(number);
+
+        } else {
+            return LauncherResults::InvalidArgument;
+        }
+    }
+
+    if (manifest.empty()) {
+        return LauncherResults::InvalidArgument;
+    }
+
+    BatchRunner runner(_wsl, parallelism);
+    if (!runner.Load(manifest)) {
+        return LauncherResults::FileNotFound;
+    }
+
+    // As each command ends, its output and error output are printed with
+    // every line tagged with the command's line in the manifest; a summary
+    // follows once all have ended.
+    runner.Run(timeout, [&](size_t, const BatchRunner::Command &command, const BatchResult &result) {
+        if (_json) {
+            Emit(JsonEvent("command")
+                     .Add("line", static_cast<uint64_t>(command.line))
+                     .Add("status", StatusName(result.status))
+                     .Add("exitCode", static_cast<uint64_t>(result.exitCode))
+                     .Add("output", result.output)
+                     .Add("errorOutput", result.errorOutput)
+                     .Add("error", result.error)
+                     .Add("ms", std::chrono::duration<double, std::milli>(result.duration).count()));
+
+            _console.Flush();
+            return;
+        }
+
+        const std::string tag = "[" + std::to_string(command.line) + "] ";
+        _console.Write(LauncherConsole::Stream::Output, BatchRunner::Tag(tag, result.output));
+        _console.Write(LauncherConsole::Stream::Error, BatchRunner::Tag(tag, result.errorOutput));
+        const uint32_t line = static_cast<uint32_t>(command.line);
+        if (result.status == BatchStatus::TimedOut) {
+            _console.Print(LauncherMessage::BatchTimedOut, {line});
+
+        } else if (result.status != BatchStatus::Ok) {
+            _console.Print(LauncherMessage::BatchLaunchFailed, {line, result.error});
+
+        } else if (result.exitCode != 0) {
+            _console.Print(LauncherMessage::BatchExitCode, {line, static_cast<uint32_t>(result.exitCode)});
+        }
+
+        _console.Flush();
+    });
+
+    const size_t failures = runner.Failures();
+    if (_json) {
+        Emit(JsonEvent("batch")
+                 .Add("commands", static_cast<uint64_t>(runner.Commands().size()))
+                 .Add("succeeded", static_cast<uint64_t>(runner.Commands().size() - failures)));
+
+    } else {
+        _console.Print(LauncherMessage::BatchSummary,
+                       {static_cast<uint32_t>(runner.Commands().size() - failures),
+                        static_cast<uint32_t>(runner.Commands().size())});
+    }
+
+    *exitCode = (failures == 0) ? 0 : 1;
+    return LauncherResults::Ok;
+}
+
+unsigned int Launcher::DefaultParallelism()
+{
+    // Each command is a wsl.exe process on Windows and a session in the
+    // distribution; more than a few at once mostly adds contention.
+    const unsigned int processors = std::thread::hardware_concurrency();
+    return std::clamp(processors, 1u, 8u);
+}
+
+void Launcher::Print(LauncherMessage message, const std::vector<MessageArgument> &arguments)
+{
+    if (_json) {
+        Emit(JsonEvent("message").Add("message", MessageName(message)).Add("text", _console.Format(message, arguments)));
+
+    } else {
+        _console.Print(message, arguments);
+    }
+}
+
+LauncherResult Launcher::RunCommand(const std::wstring &command, uint32_t *exitCode)
+{
+    if (!_json) {
+        return _wsl.RunCommand(command, exitCode);
+    }
+
+    OutputEvents output(_console);
+    const LauncherResult hr = _wsl.RunCommandForStream(command, output, exitCode);
+    output.Finish();
+    return hr;
+}
+
+void Launcher::PrintError(LauncherResult result)
+{
+    if (_json) {
+        Emit(JsonEvent("error").Add("hresult", HresultText(result)));
+
+    } else {
+        _console.PrintError(result);
+    }
+}
+
+std::wstring Launcher::ReadWord(LauncherMessage prompt, size_t maxCharacters)
+{
+    if (_json) {
+        Emit(JsonEvent("prompt").Add("message", MessageName(prompt)));
+    }
+
+    return _console.ReadWord(prompt, maxCharacters, !_json);
+}
+
+// Nobody is looking at a console window when the output is parsed.
+void Launcher::WaitForKey()
+{
+    if (!_json) {
+        _console.WaitForKey();
+    }
+}
+
+void Launcher::Emit(const JsonEvent &event)
+{
+    _console.Write(LauncherConsole::Stream::Output, event.Line());
+}
+
+double Launcher::Milliseconds() const
+{
+    return std::chrono::duration<double, std::milli>(StartupTiming::Clock::now() - _start).count();
+}
+
+void Launcher::Mark(const char *phase)
+{
+    if (_timing != nullptr) {
+        _timing->Mark(phase);
+    }
+
+    if (_json) {
+        Emit(JsonEvent("phase").Add("phase", phase).Add("ms", Milliseconds()));
+    }
+}
@@ -0,0 +1,262 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "BatchRunner.h"
+#include "Inflate.h"
+#include "JsonEvent.h"
+#include "ProvisionConfig.h"
+#include "SnapshotArchive.h"
+#include "StartupTiming.h"
+
+// Where Rootfs::Stage installs the wsl-helper the package ships, if it ships one.
+#define ROOTFS_HELPER_PATH_UTF8 "/usr/libexec/wsl-helper"
+#define ROOTFS_HELPER_PATH L"" ROOTFS_HELPER_PATH_UTF8
+
+// HRESULTs, kept as they are so that Windows reports them as usual.
+using LauncherResult = int32_t;
+
+namespace LauncherResults
+{
+    constexpr LauncherResult Ok = 0;
+    constexpr LauncherResult Fail = static_cast<LauncherResult>(0x80004005);
+    constexpr LauncherResult InvalidArgument = static_cast<LauncherResult>(0x80070057);
+    constexpr LauncherResult FileNotFound = static_cast<LauncherResult>(0x80070002);
+    constexpr LauncherResult AlreadyExists = static_cast<LauncherResult>(0x800700B7);
+    constexpr LauncherResult SubsystemNotPresent = static_cast<LauncherResult>(0x8007019E);
+    constexpr LauncherResult HyperVNotInstalled = static_cast<LauncherResult>(0x80370102);
+
+    inline bool Failed(LauncherResult result) { return result < 0; }
+}
+
+// The messages the launcher prints, from messages.mc on Windows.
+enum class LauncherMessage
+{
+    Usage,
+    Installing,
+    InstallSuccess,
+    CreateUserPrompt,
+    EnterUserName,
+    InstallAlreadyExists,
+    EnableVirtualization,
+    BatchExitCode,
+    BatchTimedOut,
+    BatchLaunchFailed,
+    BatchSummary,
+    ProvisionInvalid,
+    ProvisionFailed,
+    SnapshotInvalid,
+    SnapshotFailed,
+    SnapshotSuccess,
+    CloneAlreadyInstalled,
+};
+
+// An insert for a message: a number, or UTF-8 text, as its format asks for.
+struct MessageArgument
+{
+    MessageArgument(uint32_t value) : number(value) {}
+    MessageArgument(std::string value) : text(std::move(value)), isText(true) {}
+
+    uint32_t number = 0;
+    std::string text;
+    bool isText = false;
+};
+
+// The console the launcher talks to the user through.
+class LauncherConsole
+{
+  public:
+    enum class Stream
+    {
+        Output,
+        Error,
+    };
+
+    virtual ~LauncherConsole() = default;
+
+    virtual void Print(LauncherMessage message, const std::vector<MessageArgument> &arguments = {}) = 0;
+
+    // The text Print prints, for the events of --output=json: line breaks are
+    // \n, and there is none at the end.
+    virtual std::wstring Format(LauncherMessage message, const std::vector<MessageArgument> &arguments = {}) = 0;
+
+    // With --output=json, messages printed other than through the launcher,
+    // such as by the Windows backend when a WSL call fails, are printed as
+    // "message" events too, so that nothing but events is written.
+    virtual void SetJsonOutput(bool json) = 0;
+
+    // Describes a failure the way the system words it.
+    virtual void PrintError(LauncherResult result) = 0;
+
+    // Writes output from the distribution as it is.
+    virtual void Write(Stream stream, const std::string &data) = 0;
+
+    // Prompts for and reads one word, of at most the given length. Without
+    // the prompt printed, whoever reads the output was asked some other way.
+    virtual std::wstring ReadWord(LauncherMessage prompt, size_t maxCharacters, bool showPrompt = true) = 0;
+
+    // Asks for a key press before going on, so that a console window opened
+    // just for the launcher stays until what it printed has been read.
+    virtual void WaitForKey() = 0;
+
+    // Writes what was printed so far. Printing is buffered, so that a phase
+    // of the launcher takes one write; the launcher flushes before WSL is
+    // given the console, and whoever runs it flushes once it returns.
+    // Prompting flushes too.
+    virtual void Flush() = 0;
+};
+
+// WSL, for the distribution the launcher is for. Batch commands go through
+// BatchBackend::Run.
+class WslBackend : public BatchBackend
+{
+  public:
+    virtual bool IsOptionalComponentInstalled() = 0;
+    virtual bool IsDistributionRegistered() = 0;
+    virtual LauncherResult RegisterDistribution() = 0;
+
+    // Registers the distribution from a file written by `snapshot` rather
+    // than from the rootfs the package ships.
+    virtual LauncherResult RegisterSnapshot(const std::filesystem::path &snapshot) = 0;
+
+    // Sets the default user, leaving the distribution flags as they are.
+    virtual LauncherResult ConfigureDistribution(uint32_t defaultUid) = 0;
+
+    virtual LauncherResult GetDefaultUid(uint32_t *defaultUid) = 0;
+
+    // Runs a command on the console; an empty one starts the default shell
+    // in the user's home directory.
+    virtual LauncherResult LaunchInteractive(const std::wstring &command, bool useCurrentWorkingDirectory, uint32_t *exitCode) = 0;
+
+    // Runs a command with the console as its input and error streams,
+    // collecting its output; commands still running after the timeout are
+    // stopped.
+    virtual LauncherResult LaunchForOutput(const std::wstring &command,
+                                           std::string *output,
+                                           uint32_t *exitCode,
+                                           std::chrono::milliseconds timeout) = 0;
+
+    // Runs a command as root, whatever the default user is, which is left as
+    // it is. The command has no input and the console as its error stream,
+    // and its output is handed to the sink as it comes, however much there
+    // is; a sink that fails stops the command.
+    virtual LauncherResult LaunchForStreamAsRoot(const std::wstring &command, ByteSink &output, uint32_t *exitCode) = 0;
+
+    // Runs the command line given to `run`, in the current working directory.
+    virtual LauncherResult RunCommand(const std::wstring &command, uint32_t *exitCode)
+    {
+        return LaunchInteractive(command, true, exitCode);
+    }
+
+    // Runs the command line given to `run` with --output=json: in the current
+    // working directory, with the launcher's input and error output, and its
+    // output handed to the sink rather than mixed with the events.
+    virtual LauncherResult RunCommandForStream(const std::wstring &command, ByteSink &output, uint32_t *exitCode) = 0;
+};
+
+// What the launcher does with its command line, whatever it runs on: wmain
+// on Windows hands it the real console and WSL, benchmarks and checks on
+// other systems hand it fakes.
+class Launcher
+{
+  public:
+    static constexpr uint32_t UidInvalid = UINT32_MAX;
+
+    // The timing, if any, gets the marks of the phases Main goes through.
+    Launcher(LauncherConsole &console, WslBackend &wsl, StartupTiming *timing = nullptr);
+
+    // Runs a command line, without the program name, returning the exit code.
+    //
+    // With --output=json before everything else, messages are replaced by
+    // events for scripts to parse, one JSON object a line; see JsonEvent.h.
+    // Every event has an "event" member naming it:
+    //
+    //     phase      a phase of the launcher ended: "phase", "ms"
+    //     state      "subsystemInstalled", and "registered" when it is
+    //     install    "hresult", "ms"
+    //     provision  the provisioning file was applied, or could not be
+    //                read: "hresult", "exitCode", "errorOutput", "error", "ms"
+    //     snapshot   a snapshot was written, or one to clone could not be
+    //                read: "hresult", "uid", "user", "entries", "bytes",
+    //                "compressedBytes", "error", "ms"
+    //     user       the default user was set: "name", "uid"
+    //     command    a batch command ended: "line", "status", "exitCode",
+    //                "output", "errorOutput", "error", "ms"
+    //     batch      "commands", "succeeded"
+    //     message    what would have been printed: "message", "text"
+    //     output     output of a command run with `run`, a line or more
+    //                at a time: "output"
+    //     prompt     input is read next: "message"
+    //     error      "hresult"
+    //     exit       always last: "exitCode", "ms"
+    //
+    // HRESULTs are hexadecimal strings. Times are in milliseconds: since the
+    // launcher started for phases and the exit, how long it took for the
+    // install and batch commands. Commands run with `run`, or the shell run
+    // without arguments, keep the launcher's input and error output, but
+    // their output comes as events.
+    uint32_t Main(const std::vector<std::wstring> &arguments);
+
+    // With a provisioning file, applies it instead of prompting for a user.
+    LauncherResult InstallDistribution(bool createUser, const ProvisionConfig *config = nullptr);
+    LauncherResult SetDefaultUser(const std::wstring &userName);
+
+    // Creates and configures a user account, reporting its UID.
+    bool CreateUser(const std::wstring &userName, uint32_t *uid);
+
+    // Applies a provisioning file in a single launch that reads no input,
+    // reporting the UID of the user it created, or UidInvalid if it names
+    // none.
+    LauncherResult Provision(const ProvisionConfig &config, uint32_t *uid);
+
+    // The UID of a user account, or UidInvalid.
+    uint32_t QueryUid(const std::wstring &userName);
+
+    // Writes the distribution, with its default user, to a snapshot file.
+    // The tar stream of its root file system is compressed as it is read
+    // from the distribution, into the file with .partial appended, which is
+    // renamed once complete. Commands launched meanwhile run as root.
+    LauncherResult Snapshot(const std::filesystem::path &file);
+
+    // Registers the distribution from a snapshot whose record was read, and
+    // sets the default user it recorded.
+    LauncherResult Clone(const std::filesystem::path &file, const SnapshotInfo &info);
+
+    // run --batch <file> [--jobs <count>] [--timeout <seconds>]; see BatchRunner.h.
+    LauncherResult RunBatch(const std::vector<std::wstring> &arguments, uint32_t *exitCode);
+
+    // How many batch commands run at once unless told otherwise.
+    static unsigned int DefaultParallelism();
+
+  private:
+    uint32_t Run(const std::vector<std::wstring> &arguments);
+
+    // Runs the command line given to `run`, with its output as events with
+    // --output=json.
+    LauncherResult RunCommand(const std::wstring &command, uint32_t *exitCode);
+
+    // Messages, or their events with --output=json.
+    void Print(LauncherMessage message, const std::vector<MessageArgument> &arguments = {});
+    void PrintError(LauncherResult result);
+    std::wstring ReadWord(LauncherMessage prompt, size_t maxCharacters);
+    void WaitForKey();
+    void Emit(const JsonEvent &event);
+
+    double Milliseconds() const;
+    void Mark(const char *phase);
+
+    LauncherConsole &_console;
+    WslBackend &_wsl;
+    StartupTiming *_timing;
+    StartupTiming::Clock::time_point _start;
+    bool _json = false;
+};
@@ -0,0 +1,243 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "MappedFile.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifndef _WIN32
+    // madvise wants page-aligned addresses, so ranges are widened to whole pages.
+    void Advise(const uint8_t *data, uint64_t mappedSize, uint64_t offset, uint64_t size, int advice)
+    {
+        if ((data == nullptr) || (offset >= mappedSize)) {
+            return;
+        }
+
+        static const uint64_t pageSize = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+        const uint64_t end = std::min(mappedSize, offset + size);
+        const uint64_t start = offset - (offset % pageSize);
+        ::madvise(const_cast<uint8_t *>(data) + start, static_cast<size_t>(end - start), advice);
+    }
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Fail(const std::string &error)
+{
+    Close();
+    _error = error;
+    return false;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::filesystem::path &path)
+{
+    Close();
+    _error.clear();
+    const std::string name = path.filename().u8string();
+    HANDLE file = CreateFileW(path.c_str(),
+                              GENERIC_READ,
+                              FILE_SHARE_READ,
+                              nullptr,
+                              OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                              nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return Fail("cannot open " + name);
+    }
+
+    _file = file;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        return Fail("cannot read " + name);
+    }
+
+    _size = static_cast<uint64_t>(size.QuadPart);
+    _open = true;
+
+    // Empty files cannot be mapped, and have nothing to read anyway.
+    if (_size == 0) {
+        return true;
+    }
+
+    _mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (_mapping == nullptr) {
+        return Fail("cannot map " + name);
+    }
+
+    _data = static_cast<const uint8_t *>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (_data == nullptr) {
+        return Fail("cannot map " + name);
+    }
+
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (_data != nullptr) {
+        UnmapViewOfFile(_data);
+        _data = nullptr;
+    }
+
+    if (_mapping != nullptr) {
+        CloseHandle(_mapping);
+        _mapping = nullptr;
+    }
+
+    if (_file != nullptr) {
+        CloseHandle(_file);
+        _file = nullptr;
+    }
+
+    _size = 0;
+    _open = false;
+}
+
+void MappedFile::Prefetch(uint64_t offset, uint64_t size) const
+{
+    if ((_data == nullptr) || (offset >= _size)) {
+        return;
+    }
+
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = const_cast<uint8_t *>(_data) + offset;
+    range.NumberOfBytes = static_cast<SIZE_T>(std::min(size, _size - offset));
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+void MappedFile::Release(uint64_t, uint64_t) const
+{
+    // Windows trims the pages of a read-only view as it needs them; there is
+    // no cheaper hint than leaving them be.
+}
+
+#else
+
+bool MappedFile::Open(const std::filesystem::path &path)
+{
+    Close();
+    _error.clear();
+    const std::string name = path.filename().u8string();
+    const int descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (descriptor < 0) {
+        return Fail("cannot open " + name);
+    }
+
+    struct stat status;
+    if ((::fstat(descriptor, &status) != 0) || !S_ISREG(status.st_mode)) {
+        ::close(descriptor);
+        return Fail("cannot read " + name);
+    }
+
+    _size = static_cast<uint64_t>(status.st_size);
+    _open = true;
+
+    // Empty files cannot be mapped, and have nothing to read anyway.
+    if (_size == 0) {
+        ::close(descriptor);
+        return true;
+    }
+
+    void *data = ::mmap(nullptr, static_cast<size_t>(_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+    ::close(descriptor);
+    if (data == MAP_FAILED) {
+        return Fail("cannot map " + name);
+    }
+
+    _data = static_cast<const uint8_t *>(data);
+    ::madvise(data, static_cast<size_t>(_size), MADV_SEQUENTIAL);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (_data != nullptr) {
+        ::munmap(const_cast<uint8_t *>(_data), static_cast<size_t>(_size));
+        _data = nullptr;
+    }
+
+    _size = 0;
+    _open = false;
+}
+
+void MappedFile::Prefetch(uint64_t offset, uint64_t size) const
+{
+    Advise(_data, _size, offset, size, MADV_WILLNEED);
+}
+
+void MappedFile::Release(uint64_t offset, uint64_t size) const
+{
+    // Only whole pages behind the range can go: the page holding its end may
+    // still be read.
+    if ((_data == nullptr) || (offset >= _size)) {
+        return;
+    }
+
+    static const uint64_t pageSize = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+    const uint64_t end = std::min(_size, offset + size);
+    const uint64_t start = offset + (pageSize - offset % pageSize) % pageSize;
+    const uint64_t last = (end == _size) ? end : end - (end % pageSize);
+    if (last > start) {
+        ::madvise(const_cast<uint8_t *>(_data) + start, static_cast<size_t>(last - start), MADV_DONTNEED);
+    }
+}
+
+#endif
+
+MappedSource::MappedSource(const MappedFile &file, uint64_t offset, size_t window, size_t readAhead) :
+    _file(file),
+    _offset(offset),
+    _prefetched(offset),
+    _window((window == 0) ? DefaultWindow : window),
+    _readAhead(readAhead)
+{
+}
+
+bool MappedSource::Next(const uint8_t **data, size_t *size)
+{
+    if (_offset >= _file.Size()) {
+        return false;
+    }
+
+    // Ask for the next stretch once the reader is halfway through the last one,
+    // so that the disk keeps ahead of the decoder.
+    if ((_readAhead > 0) && (_prefetched < _file.Size()) && (_prefetched < _offset + _readAhead / 2 + _window)) {
+        const uint64_t start = std::max(_prefetched, _offset);
+        _file.Prefetch(start, _readAhead);
+        _prefetched = start + _readAhead;
+    }
+
+    // The previous window has been consumed by now.
+    if (_offset >= _window) {
+        _file.Release(_offset - _window, _window);
+    }
+
+    *data = _file.Data() + _offset;
+    *size = static_cast<size_t>(std::min<uint64_t>(_window, _file.Size() - _offset));
+    _offset += *size;
+    return true;
+}
@@ -0,0 +1,80 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include "Inflate.h"
+
+// A read-only mapping of a whole file (MapViewOfFile on Windows, mmap
+// elsewhere), so that decoders read the archive in place instead of through
+// copies into read buffers. Pages are faulted in by the system; the hints
+// below let it read ahead of the consumer and drop what is behind it.
+//
+// Reading a mapping whose file is truncated by someone else faults, so only
+// files that do not change while mapped, such as package content, should be mapped.
+class MappedFile
+{
+  public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool Open(const std::filesystem::path &path);
+    void Close();
+
+    bool IsOpen() const { return _open; }
+    const uint8_t *Data() const { return _data; }
+    uint64_t Size() const { return _size; }
+
+    // Hints that a range will be read soon, so that it is read ahead of use.
+    void Prefetch(uint64_t offset, uint64_t size) const;
+
+    // Hints that a range has been consumed, so that its pages can go first.
+    void Release(uint64_t offset, uint64_t size) const;
+
+    const std::string &Error() const { return _error; }
+
+  private:
+    bool Fail(const std::string &error);
+
+    const uint8_t *_data = nullptr;
+    uint64_t _size = 0;
+    bool _open = false;
+#ifdef _WIN32
+    void *_file = nullptr;
+    void *_mapping = nullptr;
+#endif
+    std::string _error;
+};
+
+// Hands out a mapped file as successive windows pointing into the mapping,
+// prefetching the windows ahead of the reader and releasing those behind it.
+class MappedSource : public ByteSource
+{
+  public:
+    static constexpr size_t DefaultWindow = 2 << 20;
+    static constexpr size_t DefaultReadAhead = 8 << 20;
+
+    explicit MappedSource(const MappedFile &file,
+                          uint64_t offset = 0,
+                          size_t window = DefaultWindow,
+                          size_t readAhead = DefaultReadAhead);
+
+    bool Next(const uint8_t **data, size_t *size) override;
+
+  private:
+    const MappedFile &_file;
+    uint64_t _offset;
+    uint64_t _prefetched;
+    size_t _window;
+    size_t _readAhead;
+};
@@ -0,0 +1,172 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Generated from messages.mc by tools/MessageCatalogGen.cpp; do not edit.
+
+#pragma once
+
+#include "MessageFormat.h"
+
+namespace MessageCatalog
+{
+    constexpr MessageEntry Entries[] = {
+        {1001,
+         "MSG_WSL_REGISTER_DISTRIBUTION_FAILED",
+         L"WslRegisterDistribution failed with error: 0x%1!x!\r\n"},
+        {1002,
+         "MSG_WSL_CONFIGURE_DISTRIBUTION_FAILED",
+         L"WslConfigureDistribution failed with error: 0x%1!x!\r\n"},
+        {1003,
+         "MSG_WSL_LAUNCH_INTERACTIVE_FAILED",
+         L"WslLaunchInteractive %1 failed with error: 0x%2!x!\r\n"},
+        {1004,
+         "MSG_WSL_LAUNCH_FAILED",
+         L"WslLaunch %1 failed with error: 0x%2!x!\r\n"},
+        {1005,
+         "MSG_USAGE",
+         L"Launches or configures a Linux distribution.\r\n"
+         L"\r\n"
+         L"Usage: \r\n"
+         L"    <no args> \r\n"
+         L"        Launches the user's default shell in the user's home directory.\r\n"
+         L"\r\n"
+         L"    install [--root | --config <file>]\r\n"
+         L"        Install the distribuiton and do not launch the shell when complete.\r\n"
+         L"          --root\r\n"
+         L"              Do not create a user account and leave the default user set to root.\r\n"
+         L"          --config <file>\r\n"
+         L"              Provision the distribution from the file without reading any\r\n"
+         L"              input. Each line of the file is a directive:\r\n"
+         L"                user <name>             create the default user\r\n"
+         L"                groups <group,...>      add it to these groups instead\r\n"
+         L"                shell <path>            give it this login shell\r\n"
+         L"                password-hash <hash>    give it this password, as crypt(3)\r\n"
+         L"                                        hashes it, rather than none\r\n"
+         L"                skip-package <name...>  purge these packages if installed\r\n"
+         L"                wsl-conf <section>.<key> <value>\r\n"
+         L"                                        set this key of /etc/wsl.conf\r\n"
+         L"              Lines starting with # are skipped.\r\n"
+         L"\r\n"
+         L"    snapshot <file>\r\n"
+         L"        Write the distribution as it is, with its default user, to the file,\r\n"
+         L"        for clone to install again. SSH host keys and the machine ID are\r\n"
+         L"        left out.\r\n"
+         L"\r\n"
+         L"    clone <file>\r\n"
+         L"        Install the distribution from a file written by snapshot, with the\r\n"
+         L"        default user it recorded, and do not launch the shell when complete.\r\n"
+         L"        The clone gets SSH host keys and a machine ID of its own.\r\n"
+         L"\r\n"
+         L"    run <command line> \r\n"
+         L"        Run the provided command line in the current working directory. If no\r\n"
+         L"        command line is provided, the default shell is launched.\r\n"
+         L"        Redirected input and output are handed to the command as they are,\r\n"
+         L"        without going through the console.\r\n"
+         L"        With WSL_LAUNCHER_SERVER=1, commands run through a server kept\r\n"
+         L"        running in the distribution, which is faster for many short commands;\r\n"
+         L"        they have no terminal.\r\n"
+         L"\r\n"
+         L"    run --batch <file> [--jobs <count>] [--timeout <seconds>]\r\n"
+         L"        Run each line of the file as a command line, several at once, without\r\n"
+         L"        input. The output of each command is printed once it has ended, every\r\n"
+         L"        line tagged with the command's line number in the file. Blank lines\r\n"
+         L"        and lines starting with # are skipped.\r\n"
+         L"          --jobs <count>\r\n"
+         L"              Run at most <count> commands at once.\r\n"
+         L"          --timeout <seconds>\r\n"
+         L"              Stop any command still running after <seconds>.\r\n"
+         L"\r\n"
+         L"    config [setting [value]] \r\n"
+         L"        Configure settings for this distribution.\r\n"
+         L"        Settings:\r\n"
+         L"          --default-user <username>\r\n"
+         L"              Sets the default user to <username>. This must be an existing user.\r\n"
+         L"\r\n"
+         L"    --output=json <command>\r\n"
+         L"        Print events for scripts instead of messages, one JSON object a line,\r\n"
+         L"        for any of the commands above.\r\n"
+         L"\r\n"
+         L"    help \r\n"
+         L"        Print usage information and exit.\r\n"},
+        {1006,
+         "MSG_STATUS_INSTALLING",
+         L"Installing, this may take a few minutes...\r\n"},
+        {1007,
+         "MSG_INSTALL_SUCCESS",
+         L"Installation successful!\r\n"},
+        {1008,
+         "MSG_ERROR_CODE",
+         L"Error: 0x%1!x! %2\r\n"},
+        {1009,
+         "MSG_ENTER_USERNAME",
+         L"Enter new UNIX username: %0\r\n"},
+        {1010,
+         "MSG_CREATE_USER_PROMPT",
+         L"Please create a default UNIX user account. The username does not need to match your Windows username.\r\n"
+         L"For more information visit: https://aka.ms/wslusers\r\n"},
+        {1011,
+         "MSG_PRESS_A_KEY",
+         L"Press any key to continue...\r\n"},
+        {1013,
+         "MSG_INSTALL_ALREADY_EXISTS",
+         L"The distribution installation has become corrupted.\r\n"
+         L"Please select Reset from App Settings or uninstall and reinstall the app.\r\n"},
+        {1014,
+         "MSG_ENABLE_VIRTUALIZATION",
+         L"Please enable the Virtual Machine Platform Windows feature and ensure virtualization is enabled in the BIOS.\r\n"
+         L"For information please visit https://aka.ms/enablevirtualization\r\n"},
+        {1015,
+         "MSG_ROOTFS_IMPORT_FAILED",
+         L"Preparing the root file system failed: %1 (0x%2!x!)\r\n"},
+        {1016,
+         "MSG_BATCH_EXIT_CODE",
+         L"[%1!u!] exited with %2!u!\r\n"},
+        {1017,
+         "MSG_BATCH_TIMED_OUT",
+         L"[%1!u!] timed out and was stopped\r\n"},
+        {1018,
+         "MSG_BATCH_LAUNCH_FAILED",
+         L"[%1!u!] could not be run: %2\r\n"},
+        {1019,
+         "MSG_BATCH_SUMMARY",
+         L"%1!u! of %2!u! commands succeeded.\r\n"},
+        {1020,
+         "MSG_WSL_GET_DISTRIBUTION_CONFIGURATION_FAILED",
+         L"WslGetDistributionConfiguration failed with error: 0x%1!x!\r\n"},
+        {1021,
+         "MSG_PROVISION_INVALID",
+         L"The provisioning file cannot be used: %1\r\n"},
+        {1022,
+         "MSG_PROVISION_FAILED",
+         L"Provisioning the distribution failed: %1\r\n"},
+        {1023,
+         "MSG_SNAPSHOT_INVALID",
+         L"The snapshot cannot be used: %1\r\n"},
+        {1024,
+         "MSG_SNAPSHOT_FAILED",
+         L"Taking the snapshot failed: %1\r\n"},
+        {1025,
+         "MSG_SNAPSHOT_SUCCESS",
+         L"Snapshot written: %1!u! files in %2!u! MB.\r\n"},
+        {1026,
+         "MSG_CLONE_ALREADY_INSTALLED",
+         L"The distribution is already installed. Unregister it before cloning a snapshot into it.\r\n"},
+        {1027,
+         "MSG_ROOTFS_NO_SPACE",
+         L"Installing needs %1!u! MB free in %2 to unpack the root file system, but only %3!u! MB are available.\r\n"
+         L"Free up space there, or point TEMP at a drive with more room, and try again.\r\n"},
+    };
+
+    // The text of a message, or null if there is none with the id.
+    constexpr const wchar_t *Text(uint32_t id)
+    {
+        for (const MessageEntry &entry : Entries) {
+            if (entry.id == id) {
+                return entry.text;
+            }
+        }
+
+        return nullptr;
+    }
+}
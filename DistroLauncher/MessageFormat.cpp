@@ -0,0 +1,182 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "MessageFormat.h"
+
+namespace {
+    // Writes into the buffer as far as it goes, always leaving room for the
+    // terminator, and counts every character whether it fitted or not.
+    class Output
+    {
+      public:
+        Output(wchar_t *buffer, size_t capacity) : _buffer(buffer), _capacity(capacity) {}
+
+        void Put(wchar_t c)
+        {
+            if ((_length + 1) < _capacity) {
+                _buffer[_length] = c;
+            }
+
+            _length += 1;
+        }
+
+        void Put(const wchar_t *text, size_t length)
+        {
+            for (size_t index = 0; index < length; index += 1) {
+                Put(text[index]);
+            }
+        }
+
+        void Pad(wchar_t c, size_t count)
+        {
+            for (size_t index = 0; index < count; index += 1) {
+                Put(c);
+            }
+        }
+
+        size_t Finish()
+        {
+            if (_capacity > 0) {
+                _buffer[(_length < _capacity) ? _length : (_capacity - 1)] = L'\0';
+            }
+
+            return _length;
+        }
+
+      private:
+        wchar_t *_buffer;
+        size_t _capacity;
+        size_t _length = 0;
+    };
+
+    size_t Length(const wchar_t *text)
+    {
+        size_t length = 0;
+        while (text[length] != L'\0') {
+            length += 1;
+        }
+
+        return length;
+    }
+
+    // Writes the digits of a number into the end of the digits buffer and
+    // returns where they start.
+    wchar_t *Digits(uint32_t number, unsigned int base, bool upper, wchar_t *end)
+    {
+        const wchar_t *digits = upper ? L"0123456789ABCDEF" : L"0123456789abcdef";
+        do {
+            end -= 1;
+            *end = digits[number % base];
+            number /= base;
+        } while (number != 0);
+
+        return end;
+    }
+
+    void PutInsert(Output *output, const MessageFormat::Insert &insert, const MessageValue &value)
+    {
+        wchar_t digits[16];
+        const wchar_t *text = L"";
+        size_t length = 0;
+        bool negative = false;
+        if (insert.conversion == L's') {
+            if ((value.kind == MessageValue::Kind::Text) && (value.text != nullptr)) {
+                text = value.text;
+                length = Length(text);
+            }
+
+        } else {
+            uint32_t number = value.number;
+            if (((insert.conversion == L'd') || (insert.conversion == L'i')) && (static_cast<int32_t>(number) < 0)) {
+                negative = true;
+                number = 0u - number;
+            }
+
+            const bool hex = (insert.conversion == L'x') || (insert.conversion == L'X');
+            wchar_t *const end = digits + (sizeof(digits) / sizeof(digits[0]));
+            text = Digits(number, hex ? 16 : 10, insert.conversion == L'X', end);
+            length = static_cast<size_t>(end - text);
+        }
+
+        const size_t used = length + (negative ? 1 : 0);
+        const size_t padding = (insert.width > used) ? (insert.width - used) : 0;
+        const bool zeroes = insert.zeroPad && !insert.leftAlign && (insert.conversion != L's');
+        if (!insert.leftAlign && !zeroes) {
+            output->Pad(L' ', padding);
+        }
+
+        if (negative) {
+            output->Put(L'-');
+        }
+
+        if (zeroes) {
+            output->Pad(L'0', padding);
+        }
+
+        output->Put(text, length);
+        if (insert.leftAlign) {
+            output->Pad(L' ', padding);
+        }
+    }
+}
+
+size_t MessageFormat::Format(const wchar_t *text, const MessageValue *values, size_t count, wchar_t *buffer, size_t capacity)
+{
+    Output output(buffer, capacity);
+    size_t offset = 0;
+    while (text[offset] != L'\0') {
+        const wchar_t c = text[offset];
+        if ((c != L'%') || (text[offset + 1] == L'\0')) {
+            output.Put(c);
+            offset += 1;
+            continue;
+        }
+
+        const wchar_t next = text[offset + 1];
+        if (next == L'0') {
+            break;
+        }
+
+        Insert insert;
+        if (ParseInsert(text, offset, &insert)) {
+            if (insert.slot <= count) {
+                PutInsert(&output, insert, values[insert.slot - 1]);
+
+            } else {
+                output.Put(text + offset, insert.end - offset);
+            }
+
+            offset = insert.end;
+            continue;
+        }
+
+        // The escapes, and any other character after a % stands for itself.
+        switch (next) {
+        case L'n':
+            output.Put(L"\r\n", 2);
+            break;
+
+        case L'r':
+            output.Put(L'\r');
+            break;
+
+        case L't':
+            output.Put(L'\t');
+            break;
+
+        case L'b':
+            output.Put(L' ');
+            break;
+
+        default:
+            output.Put(next);
+            break;
+        }
+
+        offset += 2;
+    }
+
+    return output.Finish();
+}
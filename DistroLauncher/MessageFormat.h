@@ -0,0 +1,238 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Formats the messages of messages.mc the way FormatMessageW does, from the
+// table MessageCatalog.h has them in, into a buffer the caller provides.
+//
+// Inserts are written %1 to %99, followed by a printf-style conversion
+// between exclamation marks, !s! when there is none; x, X, u, d, i and s are
+// understood, with flags and a width. %0 ends a message without its line
+// break, and %%, %n, %r, %t, %b, %. and %! stand for the characters they
+// escape.
+//
+// The inserts a message has are parsed at compile time too, so that printing
+// a message of the catalog with arguments that do not match its inserts does
+// not compile; see Accepts.
+
+// An entry of MessageCatalog.h, with its text as FormatMessageW would find it.
+struct MessageEntry
+{
+    uint32_t id;
+    const char *name;
+    const wchar_t *text;
+};
+
+// An argument for an insert: a number for numeric conversions, which are
+// 32-bit like FormatMessageW's, or text for %s.
+struct MessageValue
+{
+    enum class Kind
+    {
+        None,
+        Number,
+        Text,
+    };
+
+    constexpr MessageValue() = default;
+
+    template <typename T, std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>, int> = 0>
+    constexpr MessageValue(T value) : kind(Kind::Number), number(static_cast<uint32_t>(value))
+    {
+    }
+
+    constexpr MessageValue(const wchar_t *value) : kind(Kind::Text), text(value) {}
+
+    Kind kind = Kind::None;
+    uint32_t number = 0;
+    const wchar_t *text = nullptr;
+};
+
+namespace MessageFormat
+{
+    // The buffer messages are printed from, on the stack. Every message of
+    // the catalog fits in it with room to spare for its inserts; the
+    // generator refuses those that do not.
+    constexpr size_t BufferSize = 8192;
+
+    // An insert of a message text, from its % to the end of its conversion.
+    struct Insert
+    {
+        unsigned int slot = 0;
+        wchar_t conversion = L's';
+        bool leftAlign = false;
+        bool zeroPad = false;
+        unsigned int width = 0;
+        size_t end = 0;
+    };
+
+    constexpr bool IsDigit(wchar_t c)
+    {
+        return (c >= L'0') && (c <= L'9');
+    }
+
+    // Parses the insert starting at the % at the offset; false if there is
+    // none there, or if its conversion is not one that is understood.
+    constexpr bool ParseInsert(const wchar_t *text, size_t offset, Insert *insert)
+    {
+        if ((text[offset] != L'%') || !IsDigit(text[offset + 1]) || (text[offset + 1] == L'0')) {
+            return false;
+        }
+
+        size_t position = offset + 1;
+        insert->slot = 0;
+        while (IsDigit(text[position]) && (insert->slot < 10)) {
+            insert->slot = insert->slot * 10 + static_cast<unsigned int>(text[position] - L'0');
+            position += 1;
+        }
+
+        insert->conversion = L's';
+        insert->leftAlign = false;
+        insert->zeroPad = false;
+        insert->width = 0;
+        if (text[position] == L'!') {
+            position += 1;
+            for (; (text[position] == L'-') || (text[position] == L'0'); position += 1) {
+                insert->leftAlign = insert->leftAlign || (text[position] == L'-');
+                insert->zeroPad = insert->zeroPad || (text[position] == L'0');
+            }
+
+            for (; IsDigit(text[position]); position += 1) {
+                insert->width = insert->width * 10 + static_cast<unsigned int>(text[position] - L'0');
+            }
+
+            for (; (text[position] == L'l') || (text[position] == L'h'); position += 1) {
+            }
+
+            insert->conversion = text[position];
+            const bool known = (insert->conversion == L'x') || (insert->conversion == L'X') || (insert->conversion == L'u') ||
+                               (insert->conversion == L'd') || (insert->conversion == L'i') || (insert->conversion == L's');
+
+            if (!known || (text[position + 1] != L'!')) {
+                return false;
+            }
+
+            position += 2;
+        }
+
+        insert->end = position;
+        return true;
+    }
+
+    // The highest insert a message has, or -1 if one cannot be parsed.
+    constexpr int SlotCount(const wchar_t *text)
+    {
+        int count = 0;
+        for (size_t offset = 0; text[offset] != L'\0'; offset += 1) {
+            if ((text[offset] != L'%') || (text[offset + 1] == L'\0')) {
+                continue;
+            }
+
+            if (text[offset + 1] == L'0') {
+                break;
+            }
+
+            Insert insert;
+            if (!IsDigit(text[offset + 1])) {
+                offset += 1;
+
+            } else if (ParseInsert(text, offset, &insert)) {
+                count = (static_cast<int>(insert.slot) > count) ? static_cast<int>(insert.slot) : count;
+                offset = insert.end - 1;
+
+            } else {
+                return -1;
+            }
+        }
+
+        return count;
+    }
+
+    // What kind of argument every use of an insert takes, or None if the uses
+    // disagree or there are none.
+    constexpr MessageValue::Kind SlotKind(const wchar_t *text, unsigned int slot)
+    {
+        MessageValue::Kind kind = MessageValue::Kind::None;
+        bool used = false;
+        for (size_t offset = 0; text[offset] != L'\0'; offset += 1) {
+            if ((text[offset] != L'%') || (text[offset + 1] == L'\0')) {
+                continue;
+            }
+
+            if (text[offset + 1] == L'0') {
+                break;
+            }
+
+            Insert insert;
+            if (!ParseInsert(text, offset, &insert)) {
+                offset += 1;
+                continue;
+            }
+
+            const MessageValue::Kind use = (insert.conversion == L's') ? MessageValue::Kind::Text : MessageValue::Kind::Number;
+            if (insert.slot == slot) {
+                if (used && (use != kind)) {
+                    return MessageValue::Kind::None;
+                }
+
+                kind = use;
+                used = true;
+            }
+
+            offset = insert.end - 1;
+        }
+
+        return kind;
+    }
+
+    template <typename T>
+    constexpr MessageValue::Kind KindOf()
+    {
+        if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+            return MessageValue::Kind::Number;
+
+        } else if constexpr (std::is_convertible_v<T, const wchar_t *>) {
+            return MessageValue::Kind::Text;
+
+        } else {
+            return MessageValue::Kind::None;
+        }
+    }
+
+    // Whether a message takes arguments of these types, in this order: as
+    // many as it has inserts, numbers for numeric conversions and wide
+    // strings for %s.
+    template <typename... Args>
+    constexpr bool Accepts(const wchar_t *text)
+    {
+        if (text == nullptr) {
+            return false;
+        }
+
+        const MessageValue::Kind kinds[] = {KindOf<Args>()..., MessageValue::Kind::None};
+        if (SlotCount(text) != static_cast<int>(sizeof...(Args))) {
+            return false;
+        }
+
+        for (size_t index = 0; index < sizeof...(Args); index += 1) {
+            if ((kinds[index] == MessageValue::Kind::None) || (SlotKind(text, static_cast<unsigned int>(index + 1)) != kinds[index])) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Formats a message into the buffer, which always ends up terminated,
+    // and returns the length the whole message has, as snprintf does: a
+    // result no smaller than the capacity means it was cut short. Inserts
+    // without an argument are copied as they are.
+    size_t Format(const wchar_t *text, const MessageValue *values, size_t count, wchar_t *buffer, size_t capacity);
+}
@@ -0,0 +1,349 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "ParallelInflate.h"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ChunkQueue.h"
+#include "InputBuffer.h"
+
+namespace {
+    constexpr size_t GzipHeaderSize = 10;
+    constexpr uint8_t FlagExtra = 0x04;
+
+    class AppendSink : public ByteSink
+    {
+      public:
+        explicit AppendSink(Chunk &output) :
+            _output(output)
+        {
+        }
+
+        bool Write(const uint8_t *data, size_t size) override
+        {
+            _output.insert(_output.end(), data, data + size);
+            return true;
+        }
+
+      private:
+        Chunk &_output;
+    };
+
+    // Buffers the compressed stream so that whole members can be cut out of it.
+    class MemberSplitter
+    {
+      public:
+        explicit MemberSplitter(ByteSource &source) :
+            _source(source)
+        {
+        }
+
+        // Returns false if the input ends before count bytes are buffered.
+        bool Fill(size_t count)
+        {
+            while (Available() < count) {
+                const uint8_t *data;
+                size_t size;
+                if (!_source.Next(&data, &size)) {
+                    return false;
+                }
+
+                if ((_offset > 0) && (_offset >= _buffer.size() / 2)) {
+                    _buffer.erase(_buffer.begin(), _buffer.begin() + static_cast<std::ptrdiff_t>(_offset));
+                    _offset = 0;
+                }
+
+                _buffer.insert(_buffer.end(), data, data + size);
+            }
+
+            return true;
+        }
+
+        const uint8_t *Data() const { return _buffer.data() + _offset; }
+        size_t Available() const { return _buffer.size() - _offset; }
+        void Consume(size_t count) { _offset += count; }
+
+        std::vector<uint8_t> TakeAll()
+        {
+            std::vector<uint8_t> rest(_buffer.begin() + static_cast<std::ptrdiff_t>(_offset), _buffer.end());
+            _buffer.clear();
+            _offset = 0;
+            return rest;
+        }
+
+      private:
+        ByteSource &_source;
+        std::vector<uint8_t> _buffer;
+        size_t _offset = 0;
+    };
+
+    struct Job
+    {
+        uint64_t sequence = 0;
+        Chunk input;
+    };
+
+    struct Result
+    {
+        InflateStatus status = InflateStatus::Ok;
+        std::string error;
+        Chunk output;
+    };
+}
+
+ParallelGzipDecoder::ParallelGzipDecoder(ByteSource &source, unsigned threads, size_t flushSize) :
+    _source(source),
+    _threads(threads),
+    _flushSize(flushSize)
+{
+    if (_threads == 0) {
+        _threads = std::thread::hardware_concurrency();
+    }
+
+    if (_threads == 0) {
+        _threads = 1;
+    }
+}
+
+bool ParallelGzipDecoder::PeekMemberSize(const uint8_t *data, size_t size, size_t *memberSize)
+{
+    *memberSize = 0;
+    if (size < GzipHeaderSize) {
+        return false;
+    }
+
+    if ((data[0] != 0x1f) || (data[1] != 0x8b) || ((data[3] & FlagExtra) == 0)) {
+        return true;
+    }
+
+    if (size < GzipHeaderSize + 2) {
+        return false;
+    }
+
+    const size_t extraSize = data[10] | (data[11] << 8);
+    if (size < GzipHeaderSize + 2 + extraSize) {
+        return false;
+    }
+
+    const uint8_t *field = data + GzipHeaderSize + 2;
+    const uint8_t *end = field + extraSize;
+    while ((end - field) >= 4) {
+        const size_t length = field[2] | (field[3] << 8);
+        const uint8_t *payload = field + 4;
+        if (length > static_cast<size_t>(end - payload)) {
+            break;
+        }
+
+        if ((field[0] == 'B') && (field[1] == 'C') && (length == 2)) {
+            *memberSize = (payload[0] | (payload[1] << 8)) + size_t{1};
+            break;
+        }
+
+        if ((field[0] == 'W') && (field[1] == 'S') && (length == 4)) {
+            *memberSize = payload[0] | (payload[1] << 8) | (payload[2] << 16) | (size_t{payload[3]} << 24);
+            break;
+        }
+
+        field = payload + length;
+    }
+
+    return true;
+}
+
+InflateStatus ParallelGzipDecoder::Decode(ByteSink &sink)
+{
+    MemberSplitter splitter(_source);
+
+    // The first header tells whether the members can be decoded independently.
+    size_t memberSize = 0;
+    while (!PeekMemberSize(splitter.Data(), splitter.Available(), &memberSize)) {
+        if (!splitter.Fill(splitter.Available() + 1)) {
+            break;
+        }
+    }
+
+    if ((memberSize == 0) || (_threads == 1)) {
+        ReplaySource replay(splitter.TakeAll(), _source);
+        GzipDecoder decoder(replay, _flushSize);
+        const InflateStatus status = decoder.Decode(sink);
+        _error = decoder.Error();
+        _members = decoder.Members();
+        return status;
+    }
+
+    BoundedQueue<Job> jobs(_threads * 2);
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::map<uint64_t, Result> results;
+    const uint64_t maxInFlight = _threads * 2;
+    uint64_t dispatched = 0;
+    uint64_t emitted = 0;
+    bool dispatching = true;
+    bool failed = false;
+    InflateStatus dispatchStatus = InflateStatus::Ok;
+    std::string dispatchError;
+
+    std::vector<std::thread> workers;
+    for (unsigned index = 0; index < _threads; index += 1) {
+        workers.emplace_back([&] {
+            Job job;
+            while (jobs.Pop(&job)) {
+                Result result;
+                MemorySource source(job.input.data(), job.input.size());
+                AppendSink output(result.output);
+                GzipDecoder decoder(source, _flushSize);
+                result.status = decoder.Decode(output);
+                result.error = decoder.Error();
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    results.emplace(job.sequence, std::move(result));
+                }
+
+                changed.notify_all();
+            }
+        });
+    }
+
+    // Cut members out of the input and hand them to the workers, keeping at
+    // most maxInFlight members decoded but not yet written.
+    std::thread dispatcher([&] {
+        InflateStatus status = InflateStatus::Ok;
+        const char *error = "";
+        while (splitter.Fill(1)) {
+            // Accept zero padding after the last member, as gzip does.
+            if (splitter.Data()[0] == 0) {
+                do {
+                    for (size_t i = 0; i < splitter.Available(); i += 1) {
+                        if (splitter.Data()[i] != 0) {
+                            status = InflateStatus::Corrupt;
+                            error = "trailing garbage after gzip stream";
+                        }
+                    }
+
+                    splitter.Consume(splitter.Available());
+
+                } while ((status == InflateStatus::Ok) && splitter.Fill(1));
+
+                break;
+            }
+
+            size_t size;
+            while (!PeekMemberSize(splitter.Data(), splitter.Available(), &size)) {
+                if (!splitter.Fill(splitter.Available() + 1)) {
+                    status = InflateStatus::Truncated;
+                    error = "truncated gzip header";
+                    break;
+                }
+            }
+
+            if (status != InflateStatus::Ok) {
+                break;
+            }
+
+            if (size == 0) {
+                status = InflateStatus::Corrupt;
+                error = "gzip member without block size";
+                break;
+            }
+
+            if (!splitter.Fill(size)) {
+                status = InflateStatus::Truncated;
+                error = "truncated gzip member";
+                break;
+            }
+
+            Job job;
+            job.input.assign(splitter.Data(), splitter.Data() + size);
+            splitter.Consume(size);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return failed || ((dispatched - emitted) < maxInFlight); });
+                if (failed) {
+                    break;
+                }
+
+                job.sequence = dispatched++;
+            }
+
+            if (!jobs.Push(std::move(job))) {
+                break;
+            }
+        }
+
+        jobs.Close();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            dispatching = false;
+            dispatchStatus = status;
+            dispatchError = error;
+        }
+
+        changed.notify_all();
+    });
+
+    // Write decoded members out in order.
+    InflateStatus status = InflateStatus::Ok;
+    for (;;) {
+        Result result;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return (results.count(emitted) != 0) || (!dispatching && (emitted == dispatched)); });
+            const auto found = results.find(emitted);
+            if (found == results.end()) {
+                break;
+            }
+
+            result = std::move(found->second);
+            results.erase(found);
+        }
+
+        if (result.status != InflateStatus::Ok) {
+            status = result.status;
+            _error = result.error;
+            break;
+        }
+
+        if (!result.output.empty() && !sink.Write(result.output.data(), result.output.size())) {
+            status = InflateStatus::SinkFailed;
+            _error = "output rejected";
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            emitted += 1;
+        }
+
+        changed.notify_all();
+        _members += 1;
+    }
+
+    if (status != InflateStatus::Ok) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            failed = true;
+        }
+
+        changed.notify_all();
+        jobs.Cancel();
+    }
+
+    dispatcher.join();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    if ((status == InflateStatus::Ok) && (dispatchStatus != InflateStatus::Ok)) {
+        status = dispatchStatus;
+        _error = dispatchError;
+    }
+
+    return status;
+}
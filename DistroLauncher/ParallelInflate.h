@@ -0,0 +1,44 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "Inflate.h"
+
+// Decodes gzip streams made of independent members on several threads.
+//
+// Members can only be handed out to workers when their compressed size is
+// known up front, which is the case for block-indexed archives: BGZF ("BC"
+// extra subfield) and the launcher's own "WS" subfield, a 4-byte
+// little-endian total member size written by `prepare-build repack`.
+// Any other stream is decoded sequentially, exactly like GzipDecoder does.
+class ParallelGzipDecoder
+{
+  public:
+    // A thread count of 0 uses one thread per hardware thread.
+    ParallelGzipDecoder(ByteSource &source, unsigned threads = 0, size_t flushSize = 1 << 20);
+
+    InflateStatus Decode(ByteSink &sink);
+
+    const std::string &Error() const { return _error; }
+    unsigned Threads() const { return _threads; }
+    uint64_t Members() const { return _members; }
+
+    // Reads the member size recorded in the gzip header at data. Returns false
+    // if more bytes are needed to tell; *memberSize is 0 when the header does
+    // not record one.
+    static bool PeekMemberSize(const uint8_t *data, size_t size, size_t *memberSize);
+
+  private:
+    ByteSource &_source;
+    unsigned _threads;
+    size_t _flushSize;
+    std::string _error;
+    uint64_t _members = 0;
+};
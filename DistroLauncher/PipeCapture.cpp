@@ -0,0 +1,422 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "PipeCapture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    // How much room each read makes at the end of a stream's buffer.
+    constexpr size_t ReadSize = 64 << 10;
+
+#ifdef _WIN32
+    const PipeCapture::Handle InvalidHandle = nullptr;
+
+    std::string SystemError(DWORD error)
+    {
+        return "error " + std::to_string(error);
+    }
+#else
+    const PipeCapture::Handle InvalidHandle = -1;
+#endif
+}
+
+struct PipeCapture::Stream
+{
+    Handle reader = InvalidHandle;
+    Handle writer = InvalidHandle;
+    std::string data;
+
+    // Bytes of data that are read room rather than output.
+    size_t room = 0;
+#ifdef _WIN32
+    OVERLAPPED overlapped = {};
+    bool pending = false;
+#endif
+
+    bool IsOpen() const { return reader != InvalidHandle; }
+
+    // Makes room at the end of the buffer for the next read.
+    char *Room()
+    {
+        data.resize(data.size() - room + ReadSize);
+        room = ReadSize;
+        return &data[data.size() - ReadSize];
+    }
+
+    void Filled(size_t count)
+    {
+        data.resize(data.size() - room + count);
+        room = 0;
+    }
+};
+
+PipeCapture::PipeCapture() :
+    _port(InvalidHandle)
+{
+    _streams[0] = std::make_unique<Stream>();
+    _streams[1] = std::make_unique<Stream>();
+}
+
+PipeCapture::~PipeCapture()
+{
+    Close();
+}
+
+CaptureStatus PipeCapture::Fail(const std::string &error)
+{
+    _error = error;
+    return CaptureStatus::IoError;
+}
+
+PipeCapture::Handle PipeCapture::OutputWriter() const
+{
+    return _streams[0]->writer;
+}
+
+PipeCapture::Handle PipeCapture::ErrorWriter() const
+{
+    return _streams[1]->writer;
+}
+
+const std::string &PipeCapture::Output() const
+{
+    return _streams[0]->data;
+}
+
+const std::string &PipeCapture::ErrorOutput() const
+{
+    return _streams[1]->data;
+}
+
+CaptureStatus PipeCapture::Read(std::chrono::milliseconds timeout)
+{
+    const bool forever = (timeout == Forever);
+    const auto deadline = forever ? std::chrono::steady_clock::time_point::max() : std::chrono::steady_clock::now() + timeout;
+    return Drain(deadline, forever);
+}
+
+#ifdef _WIN32
+
+bool PipeCapture::Open(bool captureOutput, bool captureError)
+{
+    Close();
+    _port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+    if (_port == nullptr) {
+        Fail(SystemError(GetLastError()));
+        return false;
+    }
+
+    // Anonymous pipes cannot be read asynchronously, so each stream gets a
+    // named pipe of its own, with a name no other process can have taken.
+    static std::atomic<unsigned long> counter{0};
+    const bool capture[2] = {captureOutput, captureError};
+    for (ULONG_PTR i = 0; i < 2; i += 1) {
+        if (!capture[i]) {
+            continue;
+        }
+
+        Stream &stream = *_streams[i];
+        const std::wstring name = L"\\\\.\\pipe\\Local\\DistroLauncher-" + std::to_wstring(GetCurrentProcessId()) + L"-" +
+                                  std::to_wstring(counter.fetch_add(1));
+        stream.reader = CreateNamedPipeW(name.c_str(),
+                                         PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                                         PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                         1,
+                                         0,
+                                         ReadSize,
+                                         0,
+                                         nullptr);
+        if (stream.reader == INVALID_HANDLE_VALUE) {
+            stream.reader = InvalidHandle;
+            Fail(SystemError(GetLastError()));
+            Close();
+            return false;
+        }
+
+        SECURITY_ATTRIBUTES sa{sizeof(sa), nullptr, true};
+        stream.writer = CreateFileW(name.c_str(), GENERIC_WRITE, 0, &sa, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (stream.writer == INVALID_HANDLE_VALUE) {
+            stream.writer = InvalidHandle;
+            Fail(SystemError(GetLastError()));
+            Close();
+            return false;
+        }
+
+        if (CreateIoCompletionPort(stream.reader, _port, i, 0) == nullptr) {
+            Fail(SystemError(GetLastError()));
+            Close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void PipeCapture::CloseWriters()
+{
+    for (const std::unique_ptr<Stream> &stream : _streams) {
+        if (stream->writer != InvalidHandle) {
+            CloseHandle(stream->writer);
+            stream->writer = InvalidHandle;
+        }
+    }
+}
+
+void PipeCapture::Close()
+{
+    CloseWriters();
+    for (const std::unique_ptr<Stream> &stream : _streams) {
+        if (stream->pending) {
+            CancelIoEx(stream->reader, &stream->overlapped);
+            DWORD bytes;
+            GetOverlappedResult(stream->reader, &stream->overlapped, &bytes, true);
+            stream->pending = false;
+        }
+
+        if (stream->reader != InvalidHandle) {
+            CloseHandle(stream->reader);
+            stream->reader = InvalidHandle;
+        }
+    }
+
+    if (_port != InvalidHandle) {
+        CloseHandle(_port);
+        _port = InvalidHandle;
+    }
+}
+
+CaptureStatus PipeCapture::Drain(std::chrono::steady_clock::time_point deadline, bool forever)
+{
+    // Every read completes through the port, even those that complete at
+    // once, so there is a single place where data arrives.
+    const auto issue = [](Stream &stream) {
+        stream.overlapped = {};
+        if (!ReadFile(stream.reader, stream.Room(), ReadSize, nullptr, &stream.overlapped) &&
+            (GetLastError() != ERROR_IO_PENDING)) {
+            const DWORD error = GetLastError();
+            stream.Filled(0);
+            return error;
+        }
+
+        stream.pending = true;
+        return static_cast<DWORD>(ERROR_SUCCESS);
+    };
+
+    CaptureStatus status = CaptureStatus::Ok;
+    for (const std::unique_ptr<Stream> &stream : _streams) {
+        if (stream->IsOpen() && !stream->pending) {
+            const DWORD error = issue(*stream);
+            if (error == ERROR_BROKEN_PIPE) {
+                CloseHandle(stream->reader);
+                stream->reader = InvalidHandle;
+
+            } else if (error != ERROR_SUCCESS) {
+                status = Fail(SystemError(error));
+            }
+        }
+    }
+
+    for (;;) {
+        bool pending = false;
+        for (const std::unique_ptr<Stream> &stream : _streams) {
+            pending = pending || stream->pending;
+        }
+
+        if (!pending) {
+            return status;
+        }
+
+        DWORD wait = INFINITE;
+        if (!forever && (status == CaptureStatus::Ok)) {
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            wait = static_cast<DWORD>(std::max<long long>(0, std::min<long long>(left.count(), INFINITE - 1)));
+        }
+
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED *overlapped = nullptr;
+        const bool completed = GetQueuedCompletionStatus(_port, &bytes, &key, &overlapped, wait);
+        if (overlapped == nullptr) {
+            // The deadline has passed: the reads still pending are cancelled
+            // and their completions awaited, as they write into our buffers.
+            status = (GetLastError() == WAIT_TIMEOUT) ? CaptureStatus::TimedOut : Fail(SystemError(GetLastError()));
+            for (const std::unique_ptr<Stream> &stream : _streams) {
+                if (stream->pending) {
+                    CancelIoEx(stream->reader, &stream->overlapped);
+                }
+            }
+
+            continue;
+        }
+
+        Stream &stream = *_streams[key];
+        const DWORD error = completed ? ERROR_SUCCESS : GetLastError();
+        stream.pending = false;
+        stream.Filled(bytes);
+        if (error == ERROR_BROKEN_PIPE) {
+            CloseHandle(stream.reader);
+            stream.reader = InvalidHandle;
+
+        } else if ((error != ERROR_SUCCESS) && (error != ERROR_OPERATION_ABORTED)) {
+            status = Fail(SystemError(error));
+            for (const std::unique_ptr<Stream> &other : _streams) {
+                if (other->pending) {
+                    CancelIoEx(other->reader, &other->overlapped);
+                }
+            }
+
+        } else if ((error == ERROR_SUCCESS) && (status == CaptureStatus::Ok)) {
+            const DWORD issueError = issue(stream);
+            if (issueError == ERROR_BROKEN_PIPE) {
+                CloseHandle(stream.reader);
+                stream.reader = InvalidHandle;
+
+            } else if (issueError != ERROR_SUCCESS) {
+                status = Fail(SystemError(issueError));
+            }
+        }
+    }
+}
+
+#else
+
+bool PipeCapture::Open(bool captureOutput, bool captureError)
+{
+    Close();
+    _port = ::epoll_create1(EPOLL_CLOEXEC);
+    if (_port < 0) {
+        Fail(std::string("cannot create an epoll instance: ") + std::strerror(errno));
+        return false;
+    }
+
+    const bool capture[2] = {captureOutput, captureError};
+    for (uint32_t i = 0; i < 2; i += 1) {
+        if (!capture[i]) {
+            continue;
+        }
+
+        Stream &stream = *_streams[i];
+        int fds[2];
+        if (::pipe2(fds, O_CLOEXEC) != 0) {
+            Fail(std::string("cannot create a pipe: ") + std::strerror(errno));
+            Close();
+            return false;
+        }
+
+        stream.reader = fds[0];
+        stream.writer = fds[1];
+        ::fcntl(stream.reader, F_SETFL, O_NONBLOCK);
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        if (::epoll_ctl(_port, EPOLL_CTL_ADD, stream.reader, &event) != 0) {
+            Fail(std::string("cannot watch a pipe: ") + std::strerror(errno));
+            Close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void PipeCapture::CloseWriters()
+{
+    for (const std::unique_ptr<Stream> &stream : _streams) {
+        if (stream->writer != InvalidHandle) {
+            ::close(stream->writer);
+            stream->writer = InvalidHandle;
+        }
+    }
+}
+
+void PipeCapture::Close()
+{
+    CloseWriters();
+    for (const std::unique_ptr<Stream> &stream : _streams) {
+        if (stream->reader != InvalidHandle) {
+            ::close(stream->reader);
+            stream->reader = InvalidHandle;
+        }
+    }
+
+    if (_port != InvalidHandle) {
+        ::close(_port);
+        _port = InvalidHandle;
+    }
+}
+
+CaptureStatus PipeCapture::Drain(std::chrono::steady_clock::time_point deadline, bool forever)
+{
+    for (;;) {
+        if (!_streams[0]->IsOpen() && !_streams[1]->IsOpen()) {
+            return CaptureStatus::Ok;
+        }
+
+        int wait = -1;
+        if (!forever) {
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            wait = static_cast<int>(std::max<long long>(0, std::min<long long>(left.count(), INT_MAX)));
+        }
+
+        struct epoll_event events[2];
+        const int count = ::epoll_wait(_port, events, 2, wait);
+        if ((count < 0) && (errno != EINTR)) {
+            return Fail(std::string("cannot wait for the pipes: ") + std::strerror(errno));
+        }
+
+        if ((count == 0) && !forever && (std::chrono::steady_clock::now() >= deadline)) {
+            return CaptureStatus::TimedOut;
+        }
+
+        for (int i = 0; i < count; i += 1) {
+            // Read until the pipe is empty, so that one wakeup drains it.
+            Stream &stream = *_streams[events[i].data.u32];
+            for (;;) {
+                const ssize_t bytes = ::read(stream.reader, stream.Room(), ReadSize);
+                stream.Filled((bytes > 0) ? static_cast<size_t>(bytes) : 0);
+                if (bytes > 0) {
+                    continue;
+                }
+
+                if ((bytes < 0) && (errno == EINTR)) {
+                    continue;
+                }
+
+                if ((bytes < 0) && (errno != EAGAIN)) {
+                    return Fail(std::string("cannot read a pipe: ") + std::strerror(errno));
+                }
+
+                if (bytes == 0) {
+                    ::epoll_ctl(_port, EPOLL_CTL_DEL, stream.reader, nullptr);
+                    ::close(stream.reader);
+                    stream.reader = InvalidHandle;
+                }
+
+                break;
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,73 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+enum class CaptureStatus
+{
+    Ok,
+    TimedOut,
+    IoError,
+};
+
+// Collects what a child process writes to its output and error streams,
+// however much it writes. Both streams are read at once, with overlapped
+// reads on an I/O completion port on Windows and epoll elsewhere, so a child
+// filling one pipe is never stuck while the other is being drained.
+//
+// The write ends of the pipes are handed to the child (WslLaunch on Windows,
+// dup2 after fork elsewhere); once the child has them, the parent closes its
+// own copies so that reading ends when the child has exited.
+class PipeCapture
+{
+  public:
+#ifdef _WIN32
+    using Handle = void *;
+#else
+    using Handle = int;
+#endif
+
+    static constexpr std::chrono::milliseconds Forever = std::chrono::milliseconds::max();
+
+    PipeCapture();
+    ~PipeCapture();
+
+    PipeCapture(const PipeCapture &) = delete;
+    PipeCapture &operator=(const PipeCapture &) = delete;
+
+    // Creates a pipe for each stream to capture. On Windows the write ends
+    // are inheritable, as WslLaunch requires.
+    bool Open(bool captureOutput, bool captureError);
+
+    // The write ends to give the child; invalid for streams not captured.
+    Handle OutputWriter() const;
+    Handle ErrorWriter() const;
+
+    void CloseWriters();
+
+    // Reads until every captured stream has been closed by the child, or
+    // until the timeout has elapsed; after a timeout, reading can resume with
+    // another call. What has been read so far is kept either way.
+    CaptureStatus Read(std::chrono::milliseconds timeout = Forever);
+
+    const std::string &Output() const;
+    const std::string &ErrorOutput() const;
+    const std::string &Error() const { return _error; }
+
+  private:
+    struct Stream;
+
+    CaptureStatus Fail(const std::string &error);
+    CaptureStatus Drain(std::chrono::steady_clock::time_point deadline, bool forever);
+    void Close();
+
+    std::unique_ptr<Stream> _streams[2];
+    Handle _port;
+    std::string _error;
+};
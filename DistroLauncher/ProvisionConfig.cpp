@@ -0,0 +1,235 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "ProvisionConfig.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+namespace {
+    bool IsLower(char c)
+    {
+        return (c >= 'a') && (c <= 'z');
+    }
+
+    bool IsDigit(char c)
+    {
+        return (c >= '0') && (c <= '9');
+    }
+
+    // What adduser accepts by default, for users and groups alike.
+    bool ValidName(const std::string &name)
+    {
+        if (name.empty() || (name.size() > 32) || !(IsLower(name[0]) || (name[0] == '_'))) {
+            return false;
+        }
+
+        return std::all_of(name.begin(), name.end(), [](char c) {
+            return IsLower(c) || IsDigit(c) || (c == '_') || (c == '-');
+        });
+    }
+
+    // Package names as Debian policy has them, with an architecture if any.
+    bool ValidPackage(const std::string &name)
+    {
+        const size_t colon = name.find(':');
+        const std::string package = name.substr(0, colon);
+        if ((package.size() < 2) || !(IsLower(package[0]) || IsDigit(package[0]))) {
+            return false;
+        }
+
+        const bool valid = std::all_of(package.begin(), package.end(), [](char c) {
+            return IsLower(c) || IsDigit(c) || (c == '+') || (c == '-') || (c == '.');
+        });
+
+        if (!valid || (colon == std::string::npos)) {
+            return valid;
+        }
+
+        const std::string architecture = name.substr(colon + 1);
+        return !architecture.empty() && std::all_of(architecture.begin(), architecture.end(), [](char c) {
+            return IsLower(c) || IsDigit(c) || (c == '-');
+        });
+    }
+
+    // Sections and keys of wsl.conf.
+    bool ValidKey(const std::string &key)
+    {
+        return !key.empty() && std::all_of(key.begin(), key.end(), [](char c) {
+            return IsLower(c) || ((c >= 'A') && (c <= 'Z')) || IsDigit(c) || (c == '_') || (c == '-');
+        });
+    }
+
+    // A field of /etc/passwd or /etc/shadow, which cannot hold separators.
+    bool ValidField(const std::string &value)
+    {
+        return !value.empty() && (value.find_first_of(" \t:") == std::string::npos);
+    }
+}
+
+bool ProvisionConfig::Load(const std::filesystem::path &path)
+{
+    const std::string name = path.filename().u8string();
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return Fail("cannot open " + name);
+    }
+
+    const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (file.bad()) {
+        return Fail("cannot read " + name);
+    }
+
+    return Parse(text, name);
+}
+
+bool ProvisionConfig::Parse(const std::string &text, const std::string &name)
+{
+    // Files written with Notepad may start with a byte order mark and end
+    // their lines with CRLF.
+    size_t offset = (text.compare(0, 3, "\xEF\xBB\xBF") == 0) ? 3 : 0;
+    size_t number = 0;
+    while (offset < text.size()) {
+        size_t end = text.find('\n', offset);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+
+        number += 1;
+        const size_t first = text.find_first_not_of(" \t", offset);
+        size_t last = end;
+        while ((last > offset) && ((text[last - 1] == '\r') || (text[last - 1] == ' ') || (text[last - 1] == '\t'))) {
+            last -= 1;
+        }
+
+        offset = end + 1;
+        if ((first >= last) || (text[first] == '#')) {
+            continue;
+        }
+
+        const std::string line = text.substr(first, last - first);
+        const size_t split = line.find_first_of(" \t");
+        const std::string directive = line.substr(0, split);
+        const size_t start = (split == std::string::npos) ? std::string::npos : line.find_first_not_of(" \t", split);
+        const std::string argument = (start == std::string::npos) ? std::string() : line.substr(start);
+        const std::string where = name + " line " + std::to_string(number) + ": ";
+        if (argument.empty()) {
+            return Fail(where + directive + " needs a value");
+        }
+
+        if (directive == "user") {
+            if (!_userName.empty()) {
+                return Fail(where + "user given twice");
+            }
+
+            if (!ValidName(argument)) {
+                return Fail(where + "invalid user name " + argument);
+            }
+
+            _userName = argument;
+
+        } else if (directive == "groups") {
+            if (!_groups.empty()) {
+                return Fail(where + "groups given twice");
+            }
+
+            size_t next = 0;
+            while (next <= argument.size()) {
+                size_t comma = argument.find(',', next);
+                if (comma == std::string::npos) {
+                    comma = argument.size();
+                }
+
+                const std::string group = argument.substr(next, comma - next);
+                if (!ValidName(group)) {
+                    return Fail(where + "invalid group name " + group);
+                }
+
+                next = comma + 1;
+            }
+
+            _groups = argument;
+
+        } else if (directive == "shell") {
+            if (!_shell.empty()) {
+                return Fail(where + "shell given twice");
+            }
+
+            if ((argument[0] != '/') || !ValidField(argument)) {
+                return Fail(where + "invalid shell " + argument);
+            }
+
+            _shell = argument;
+
+        } else if (directive == "password-hash") {
+            if (!_passwordHash.empty()) {
+                return Fail(where + "password-hash given twice");
+            }
+
+            if (!ValidField(argument)) {
+                return Fail(where + "invalid password hash");
+            }
+
+            _passwordHash = argument;
+
+        } else if (directive == "skip-package") {
+            size_t next = 0;
+            while (next < argument.size()) {
+                const size_t space = std::min(argument.find_first_of(" \t", next), argument.size());
+                const std::string package = argument.substr(next, space - next);
+                if (!ValidPackage(package)) {
+                    return Fail(where + "invalid package name " + package);
+                }
+
+                if (std::find(_skippedPackages.begin(), _skippedPackages.end(), package) == _skippedPackages.end()) {
+                    _skippedPackages.push_back(package);
+                }
+
+                next = std::min(argument.find_first_not_of(" \t", space), argument.size());
+            }
+
+        } else if (directive == "wsl-conf") {
+            const size_t space = argument.find_first_of(" \t");
+            const std::string key = argument.substr(0, space);
+            const size_t dot = key.find('.');
+            const size_t value = (space == std::string::npos) ? std::string::npos : argument.find_first_not_of(" \t", space);
+            if ((dot == std::string::npos) || !ValidKey(key.substr(0, dot)) || !ValidKey(key.substr(dot + 1))) {
+                return Fail(where + "invalid wsl.conf key " + key + ", expected <section>.<key>");
+            }
+
+            if (value == std::string::npos) {
+                return Fail(where + "wsl-conf " + key + " needs a value");
+            }
+
+            Setting setting{key.substr(0, dot), key.substr(dot + 1), argument.substr(value)};
+            const auto same = std::find_if(_wslConf.begin(), _wslConf.end(), [&](const Setting &other) {
+                return (other.section == setting.section) && (other.key == setting.key);
+            });
+
+            if (same != _wslConf.end()) {
+                same->value = setting.value;
+
+            } else {
+                _wslConf.push_back(std::move(setting));
+            }
+
+        } else {
+            return Fail(where + "unknown directive " + directive);
+        }
+    }
+
+    if (_userName.empty() && (!_groups.empty() || !_shell.empty() || !_passwordHash.empty())) {
+        return Fail(name + ": groups, shell and password-hash need a user");
+    }
+
+    return true;
+}
+
+bool ProvisionConfig::Fail(const std::string &error)
+{
+    _error = error;
+    return false;
+}
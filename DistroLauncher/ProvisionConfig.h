@@ -0,0 +1,69 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// What `install --config <file>` sets up once the distribution is
+// registered, so that it can be installed without anyone at the console.
+//
+// A provisioning file is UTF-8 text, one directive per line:
+//
+//     # Build machines: no snaps, systemd on, docker for the build user.
+//     user builder
+//     groups adm,sudo,docker
+//     shell /usr/bin/zsh
+//     password-hash $6$rounds=4096$salt$hash
+//     skip-package snapd unattended-upgrades
+//     wsl-conf boot.systemd true
+//     wsl-conf boot.command service docker start
+//
+// user names the default user to create; without one, no account is created
+// and the default user stays root. groups replaces the groups the account is
+// added to, those the distribution does not have skipped. The account's
+// password is locked unless password-hash gives one, as crypt(3) writes it.
+// skip-package purges packages the image ships that the machine goes
+// without, and may be given any number of times. wsl-conf sets a key of
+// /etc/wsl.conf, keeping the others there; the rest of its line is the value.
+class ProvisionConfig
+{
+  public:
+    struct Setting
+    {
+        std::string section;
+        std::string key;
+        std::string value;
+    };
+
+    bool Load(const std::filesystem::path &path);
+
+    // Reads the directives of a file; name is what errors call it.
+    bool Parse(const std::string &text, const std::string &name);
+
+    const std::string &UserName() const { return _userName; }
+    const std::string &Groups() const { return _groups; }
+    const std::string &Shell() const { return _shell; }
+    const std::string &PasswordHash() const { return _passwordHash; }
+    const std::vector<std::string> &SkippedPackages() const { return _skippedPackages; }
+
+    // In the order given, a key given again replacing its value.
+    const std::vector<Setting> &WslConf() const { return _wslConf; }
+
+    const std::string &Error() const { return _error; }
+
+  private:
+    bool Fail(const std::string &error);
+
+    std::string _userName;
+    std::string _groups;
+    std::string _shell;
+    std::string _passwordHash;
+    std::vector<std::string> _skippedPackages;
+    std::vector<Setting> _wslConf;
+    std::string _error;
+};
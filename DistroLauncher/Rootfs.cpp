@@ -0,0 +1,220 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "stdafx.h"
+#include "RootfsDigest.h"
+#include "RootfsImporter.h"
+#include "Sha256.h"
+#include "TarFilter.h"
+#include "Trace.h"
+
+#include <fstream>
+#include <iterator>
+
+#define ROOTFS_FILTER L"install.filter"
+#define ROOTFS_HELPER L"wsl-helper"
+
+namespace {
+    // Archive names the build may ship, in order of preference: fastest to
+    // decode first, as decompress-bench measures them. The format is
+    // recognized from the content, so the extension only decides which wins.
+    const wchar_t *const RootfsArchives[] = {
+        L"install.tar.zst",
+        L"install.tar.gz",
+        L"install.tar.xz",
+    };
+
+    std::filesystem::path GetPackageDirectory()
+    {
+        std::vector<wchar_t> buffer(MAX_PATH);
+        for (;;) {
+            DWORD length = GetModuleFileNameW(nullptr, buffer.data(), static_cast<DWORD>(buffer.size()));
+            if (length == 0) {
+                return {};
+            }
+
+            if (length < buffer.size()) {
+                return std::filesystem::path(std::wstring(buffer.data(), length)).parent_path();
+            }
+
+            buffer.resize(buffer.size() * 2);
+        }
+    }
+
+    std::filesystem::path FindArchive(const std::filesystem::path &directory)
+    {
+        std::error_code error;
+        for (const wchar_t *name : RootfsArchives) {
+            const std::filesystem::path archive = directory / name;
+            if (std::filesystem::exists(archive, error)) {
+                return archive;
+            }
+        }
+
+        // None is there: name the one builds have always shipped in errors.
+        return directory / L"install.tar.gz";
+    }
+
+    RootfsStatus ImportArchive(const std::filesystem::path &packageDirectory, TarSink &sink, std::string *error)
+    {
+        // A zstd archive comes with its dictionary when it was compressed with one.
+        const std::filesystem::path archive = FindArchive(packageDirectory);
+        RootfsImportOptions options;
+        std::error_code errorCode;
+        std::filesystem::path dictionary = archive;
+        dictionary += L".dict";
+        if (std::filesystem::exists(dictionary, errorCode)) {
+            options.dictionary = dictionary;
+        }
+
+#ifdef ROOTFS_ARCHIVE_SHA256
+        // The archive is checked against the digest the build embedded, so
+        // that a damaged or substituted archive is never registered.
+        options.expectedSha256.resize(Sha256::DigestSize);
+        if (!Sha256::ParseHex(ROOTFS_ARCHIVE_SHA256, options.expectedSha256.data())) {
+            *error = "invalid embedded rootfs digest";
+            return RootfsStatus::CorruptArchive;
+        }
+#endif
+
+        RootfsImporter importer(options);
+        const RootfsStatus status = importer.Import(archive, sink);
+        *error = importer.Error();
+        return status;
+    }
+
+    // Fixes to the rootfs are made to the stream before registration rather
+    // than by commands run in the distribution afterwards. WSL generates
+    // /etc/resolv.conf from the Windows network configuration when the
+    // distribution has none; packages may ship further directives, and the
+    // files those name, as install.filter*.
+    bool LoadFilterPolicy(const std::filesystem::path &packageDirectory, TarFilterPolicy *policy, std::string *error)
+    {
+        policy->Remove("/etc/resolv.conf");
+
+        // The helper creates the first user without starting adduser.
+        std::error_code errorCode;
+        const std::filesystem::path helper = packageDirectory / ROOTFS_HELPER;
+        if (std::filesystem::exists(helper, errorCode)) {
+            std::ifstream stream(helper, std::ios::binary);
+            std::string content((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+            if (!stream && !stream.eof()) {
+                *error = "cannot read wsl-helper";
+                return false;
+            }
+
+            const std::wstring_view path = ROOTFS_HELPER_PATH;
+            policy->Replace(std::string(path.begin(), path.end()), std::move(content), 0755);
+        }
+
+        const std::filesystem::path file = packageDirectory / ROOTFS_FILTER;
+        if (std::filesystem::exists(file, errorCode) && !policy->Load(file)) {
+            *error = policy->Error();
+            return false;
+        }
+
+        return true;
+    }
+
+    // The tar stream is written out whole before WSL takes it, so the temporary
+    // directory must hold all of it: checking first fails in a moment with
+    // the sizes at hand, rather than once the disk is full.
+    HRESULT CheckFreeSpace(const wchar_t *directory, const std::filesystem::path &archive)
+    {
+        uint64_t needed = 0;
+        ULARGE_INTEGER available;
+        if (!EstimateTarSize(archive, &needed) || !GetDiskFreeSpaceExW(directory, &available, nullptr, nullptr)) {
+            // The import reports what goes wrong when neither is known.
+            return S_OK;
+        }
+
+        // Files the filter adds, such as wsl-helper, are far smaller than this.
+        constexpr uint64_t Margin = 64 << 20;
+        needed += Margin;
+        if (available.QuadPart >= needed) {
+            return S_OK;
+        }
+
+        const HRESULT hr = HRESULT_FROM_WIN32(ERROR_DISK_FULL);
+        Helpers::PrintMessage<MSG_ROOTFS_NO_SPACE>(static_cast<ULONG>(needed >> 20), directory,
+                                                   static_cast<ULONG>(available.QuadPart >> 20));
+        return hr;
+    }
+
+    HRESULT StatusToHresult(RootfsStatus status)
+    {
+        switch (status) {
+        case RootfsStatus::Ok:
+            return S_OK;
+
+        case RootfsStatus::CorruptArchive:
+            return HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+
+        case RootfsStatus::SinkFailed:
+            return HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+
+        default:
+            return HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+        }
+    }
+}
+
+HRESULT Rootfs::Stage(std::wstring *tarPath)
+{
+    TraceSpan span("Rootfs::Stage");
+
+    wchar_t tempDirectory[MAX_PATH + 1];
+    if (GetTempPathW(ARRAYSIZE(tempDirectory), tempDirectory) == 0) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    const std::filesystem::path packageDirectory = GetPackageDirectory();
+    const HRESULT spaceHr = CheckFreeSpace(tempDirectory, FindArchive(packageDirectory));
+    if (FAILED(spaceHr)) {
+        return spaceHr;
+    }
+
+    const std::filesystem::path target = std::filesystem::path(tempDirectory) / (DistributionInfo::Name + L"-install.tar");
+    FileSink file(target);
+    if (!file.IsOpen()) {
+        return HRESULT_FROM_WIN32(ERROR_CANNOT_MAKE);
+    }
+
+    TarFilterPolicy policy;
+    std::string policyError;
+    if (!LoadFilterPolicy(packageDirectory, &policy, &policyError)) {
+        const HRESULT hr = HRESULT_FROM_WIN32(ERROR_BAD_CONFIGURATION);
+        std::wstring error(policyError.begin(), policyError.end());
+        Helpers::PrintMessage<MSG_ROOTFS_IMPORT_FAILED>(error.c_str(), hr);
+        file.Close();
+        Cleanup(target.wstring());
+        return hr;
+    }
+
+    TarWriter writer(file);
+    TarFilter filter(policy, writer);
+    std::string importError;
+    RootfsStatus status = ImportArchive(packageDirectory, filter, &importError);
+
+    if (!file.Close() && (status == RootfsStatus::Ok)) {
+        status = RootfsStatus::SinkFailed;
+    }
+
+    HRESULT hr = StatusToHresult(status);
+    if (FAILED(hr)) {
+        std::wstring error(importError.begin(), importError.end());
+        Helpers::PrintMessage<MSG_ROOTFS_IMPORT_FAILED>(error.c_str(), hr);
+        Cleanup(target.wstring());
+        return hr;
+    }
+
+    *tarPath = target.wstring();
+    return hr;
+}
+
+void Rootfs::Cleanup(const std::wstring &tarPath)
+{
+    DeleteFileW(tarPath.c_str());
+}
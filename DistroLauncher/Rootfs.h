@@ -0,0 +1,17 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+namespace Rootfs
+{
+    // Streams the bundled rootfs tarball through the import pipeline, which
+    // decompresses and validates it, into a temporary tar file ready to be
+    // handed to WslRegisterDistribution.
+    HRESULT Stage(std::wstring *tarPath);
+
+    // Deletes a file created by Stage.
+    void Cleanup(const std::wstring &tarPath);
+}
@@ -0,0 +1,11 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// SHA-256 digests of the rootfs archives shipped with each architecture, as
+// lowercase hexadecimal. `prepare-build prepare` rewrites this file with the
+// digests of the archives it prepared; the launcher checks the archive it
+// imports against them before registering the distribution. Without a
+// digest, as in this default version, the check is skipped.
+
+#pragma once
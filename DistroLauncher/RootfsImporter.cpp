@@ -0,0 +1,410 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "RootfsImporter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iterator>
+#include <thread>
+
+#include "ChunkQueue.h"
+#include "MappedFile.h"
+#include "ParallelInflate.h"
+#include "Sha256.h"
+
+namespace {
+    // Feeds the decoder from the chunks queued by the reader stage.
+    class QueueSource : public ByteSource
+    {
+      public:
+        explicit QueueSource(ChunkQueue &queue) :
+            _queue(queue)
+        {
+        }
+
+        bool Next(const uint8_t **data, size_t *size) override
+        {
+            if (!_queue.Pop(&_current)) {
+                return false;
+            }
+
+            *data = _current.data();
+            *size = _current.size();
+            return true;
+        }
+
+      private:
+        ChunkQueue &_queue;
+        Chunk _current;
+    };
+
+    // Hands decompressed blocks over to the tar stage, in buffers the tar
+    // stage gave back when it could, so that steady state allocates nothing.
+    class QueueSink : public ByteSink
+    {
+      public:
+        QueueSink(ChunkQueue &queue, ChunkQueue &recycled) :
+            _queue(queue),
+            _recycled(recycled)
+        {
+        }
+
+        bool Write(const uint8_t *data, size_t size) override
+        {
+            Chunk chunk;
+            _recycled.TryPop(&chunk);
+            chunk.assign(data, data + size);
+            return _queue.Push(std::move(chunk));
+        }
+
+      private:
+        ChunkQueue &_queue;
+        ChunkQueue &_recycled;
+    };
+
+    // How many times larger than its archive a rootfs tarball is assumed to
+    // be when the archive does not say; Ubuntu images compress 3 to 5 times.
+    constexpr uint64_t ExpansionEstimate = 5;
+
+    bool ReadAt(std::ifstream &file, uint64_t offset, uint8_t *data, size_t size)
+    {
+        file.seekg(static_cast<std::streamoff>(offset));
+        file.read(reinterpret_cast<char *>(data), static_cast<std::streamsize>(size));
+        return file.gcount() == static_cast<std::streamsize>(size);
+    }
+
+    // Sums the sizes block-indexed gzip members end with, walking from member
+    // to member by the sizes their headers record.
+    bool SumGzipMembers(std::ifstream &file, uint64_t fileSize, uint64_t *total)
+    {
+        *total = 0;
+        uint64_t offset = 0;
+        while (offset < fileSize) {
+            uint8_t header[64];
+            const size_t headerSize = static_cast<size_t>(std::min<uint64_t>(sizeof(header), fileSize - offset));
+            size_t memberSize = 0;
+            if (!ReadAt(file, offset, header, headerSize) ||
+                !ParallelGzipDecoder::PeekMemberSize(header, headerSize, &memberSize) ||
+                (memberSize < 18) || (memberSize > fileSize - offset)) {
+                return false;
+            }
+
+            uint8_t trailer[4];
+            if (!ReadAt(file, offset + memberSize - 4, trailer, sizeof(trailer))) {
+                return false;
+            }
+
+            *total += trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (uint64_t{trailer[3]} << 24);
+            offset += memberSize;
+        }
+
+        return true;
+    }
+
+    // Sums the content sizes zstd frames record, walking each frame's block
+    // headers to find where the next one starts.
+    bool SumZstdFrames(std::ifstream &file, uint64_t fileSize, uint64_t *total)
+    {
+        *total = 0;
+        uint64_t offset = 0;
+        while (offset < fileSize) {
+            uint8_t header[18];
+            const size_t headerSize = static_cast<size_t>(std::min<uint64_t>(sizeof(header), fileSize - offset));
+            if ((headerSize < 5) || !ReadAt(file, offset, header, headerSize)) {
+                return false;
+            }
+
+            const uint32_t magic = header[0] | (header[1] << 8) | (header[2] << 16) | (uint32_t{header[3]} << 24);
+            if ((magic & 0xfffffff0) == 0x184d2a50) {
+                if (headerSize < 8) {
+                    return false;
+                }
+
+                offset += 8 + (header[4] | (header[5] << 8) | (header[6] << 16) | (uint64_t{header[7]} << 24));
+                continue;
+            }
+
+            if (magic != 0xfd2fb528) {
+                return false;
+            }
+
+            const unsigned descriptor = header[4];
+            const bool singleSegment = (descriptor & 0x20) != 0;
+            const size_t idSizes[4] = {0, 1, 2, 4};
+            const size_t contentSizeSizes[4] = {singleSegment ? 1u : 0u, 2, 4, 8};
+            const size_t idSize = idSizes[descriptor & 3];
+            const size_t contentSizeSize = contentSizeSizes[descriptor >> 6];
+            const size_t frameHeaderSize = 5 + (singleSegment ? 0 : 1) + idSize + contentSizeSize;
+            if ((contentSizeSize == 0) || (headerSize < frameHeaderSize)) {
+                return false;
+            }
+
+            uint64_t contentSize = 0;
+            const uint8_t *field = header + frameHeaderSize - contentSizeSize;
+            for (size_t index = 0; index < contentSizeSize; index += 1) {
+                contentSize |= uint64_t{field[index]} << (8 * index);
+            }
+
+            *total += contentSize + ((contentSizeSize == 2) ? 256 : 0);
+            offset += frameHeaderSize;
+            for (bool last = false; !last;) {
+                uint8_t block[3];
+                if (!ReadAt(file, offset, block, sizeof(block))) {
+                    return false;
+                }
+
+                const uint32_t blockHeader = block[0] | (block[1] << 8) | (uint32_t{block[2]} << 16);
+                const unsigned type = (blockHeader >> 1) & 3;
+                if (type == 3) {
+                    return false;
+                }
+
+                last = (blockHeader & 1) != 0;
+                offset += 3 + ((type == 1) ? 1 : (blockHeader >> 3));
+            }
+
+            offset += (descriptor & 0x04) ? 4 : 0;
+        }
+
+        return offset == fileSize;
+    }
+}
+
+RootfsImporter::RootfsImporter(RootfsImportOptions options) :
+    _options(options)
+{
+}
+
+RootfsStatus RootfsImporter::Fail(RootfsStatus status, const std::string &error)
+{
+    std::lock_guard<std::mutex> lock(_errorMutex);
+    if (_status == RootfsStatus::Ok) {
+        _status = status;
+        _error = error;
+    }
+
+    return _status;
+}
+
+RootfsStatus RootfsImporter::Import(const std::filesystem::path &archive, TarSink &sink)
+{
+    _stats = {};
+    _status = RootfsStatus::Ok;
+    _error.clear();
+
+    // Mapped archives are decoded in place; the buffered path remains for
+    // files that cannot be mapped.
+    MappedFile mapped;
+    const bool useMapping = _options.mapArchive && mapped.Open(archive);
+    std::ifstream file;
+    if (!useMapping) {
+        file.open(archive, std::ios::binary);
+        if (!file) {
+            return Fail(RootfsStatus::IoError, "cannot open " + archive.filename().u8string());
+        }
+    }
+
+    DecompressOptions decompress;
+    decompress.flushSize = _options.flushSize;
+    decompress.threads = _options.inflateThreads;
+    if (!_options.dictionary.empty()) {
+        std::ifstream dictionary(_options.dictionary, std::ios::binary);
+        decompress.dictionary.assign(std::istreambuf_iterator<char>(dictionary), std::istreambuf_iterator<char>());
+        if (!dictionary && !dictionary.eof()) {
+            return Fail(RootfsStatus::IoError, "cannot read " + _options.dictionary.filename().u8string());
+        }
+    }
+
+    ChunkQueue compressed(_options.queueDepth);
+    ChunkQueue decompressed(_options.queueDepth);
+    ChunkQueue recycled(_options.queueDepth + 2);
+    std::atomic<bool> cancelled(false);
+    const auto abort = [&] {
+        cancelled = true;
+        compressed.Cancel();
+        decompressed.Cancel();
+    };
+
+    if (!_options.expectedSha256.empty() && (_options.expectedSha256.size() != Sha256::DigestSize)) {
+        return Fail(RootfsStatus::IoError, "invalid expected digest");
+    }
+
+    // Stage 1: read the archive from disk, hashing it on the way when a
+    // digest is expected. A mapped archive needs no reading, so the stage only
+    // hashes it, which also faults its pages in ahead of the decoder.
+    const bool verify = !_options.expectedSha256.empty();
+    bool digestMatches = true;
+    const auto checkDigest = [&](Sha256 &hash) {
+        uint8_t digest[Sha256::DigestSize];
+        hash.Final(digest);
+        digestMatches = (std::memcmp(digest, _options.expectedSha256.data(), sizeof(digest)) == 0);
+    };
+
+    std::thread reader;
+    if (useMapping) {
+        _stats.compressedBytes = mapped.Size();
+        if (verify) {
+            reader = std::thread([&] {
+                Sha256 hash;
+                const uint64_t step = std::max<size_t>(_options.readSize, 1);
+                for (uint64_t offset = 0; offset < mapped.Size(); offset += step) {
+                    if (cancelled) {
+                        return;
+                    }
+
+                    const uint64_t size = std::min(step, mapped.Size() - offset);
+                    hash.Update(mapped.Data() + offset, static_cast<size_t>(size));
+                }
+
+                checkDigest(hash);
+            });
+        }
+
+    } else {
+        reader = std::thread([&] {
+            Sha256 hash;
+            for (;;) {
+                Chunk chunk(_options.readSize);
+                file.read(reinterpret_cast<char *>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+                const size_t count = static_cast<size_t>(file.gcount());
+                if (count == 0) {
+                    break;
+                }
+
+                chunk.resize(count);
+                _stats.compressedBytes += count;
+                if (verify) {
+                    hash.Update(chunk.data(), chunk.size());
+                }
+
+                if (!compressed.Push(std::move(chunk))) {
+                    return;
+                }
+            }
+
+            if (file.bad()) {
+                Fail(RootfsStatus::IoError, "cannot read " + archive.filename().u8string());
+                abort();
+                return;
+            }
+
+            if (verify) {
+                checkDigest(hash);
+            }
+
+            compressed.Close();
+        });
+    }
+
+    // Stage 2: decompress.
+    std::thread inflater([&] {
+        QueueSource queued(compressed);
+        MappedSource inPlace(mapped);
+        QueueSink output(decompressed, recycled);
+        Decompressor decoder(useMapping ? static_cast<ByteSource &>(inPlace) : queued, std::move(decompress));
+        const InflateStatus status = decoder.Decode(output);
+        _stats.format = decoder.Format();
+        if (status != InflateStatus::Ok) {
+            // A rejected write means a later stage already failed.
+            if (status != InflateStatus::SinkFailed) {
+                Fail(RootfsStatus::CorruptArchive, decoder.Error());
+            }
+
+            abort();
+            return;
+        }
+
+        decompressed.Close();
+    });
+
+    // Stage 3: parse and validate the tar stream on the calling thread.
+    TarParser parser(sink);
+    Chunk chunk;
+    while (decompressed.Pop(&chunk)) {
+        _stats.uncompressedBytes += chunk.size();
+        const TarStatus status = parser.Feed(chunk.data(), chunk.size());
+        if (status != TarStatus::Ok) {
+            Fail((status == TarStatus::Corrupt) ? RootfsStatus::CorruptArchive : RootfsStatus::SinkFailed, parser.Error());
+            abort();
+            break;
+        }
+
+        recycled.TryPush(std::move(chunk));
+    }
+
+    if (reader.joinable()) {
+        reader.join();
+    }
+
+    inflater.join();
+    _stats.entries = parser.Entries();
+    if (_status != RootfsStatus::Ok) {
+        return _status;
+    }
+
+    if (parser.Finish() != TarStatus::Ok) {
+        return Fail(RootfsStatus::CorruptArchive, parser.Error());
+    }
+
+    if (!digestMatches) {
+        return Fail(RootfsStatus::CorruptArchive, archive.filename().u8string() + " does not match its expected digest");
+    }
+
+    if (!sink.OnArchiveEnd()) {
+        return Fail(RootfsStatus::SinkFailed, "archive end rejected");
+    }
+
+    return RootfsStatus::Ok;
+}
+
+FileSink::FileSink(const std::filesystem::path &path) :
+    _file(path, std::ios::binary | std::ios::trunc)
+{
+}
+
+bool FileSink::Write(const uint8_t *data, size_t size)
+{
+    _file.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(size));
+    return _file.good();
+}
+
+bool FileSink::Close()
+{
+    _file.close();
+    return !_file.fail();
+}
+
+bool EstimateTarSize(const std::filesystem::path &archive, uint64_t *size)
+{
+    std::error_code error;
+    const uint64_t fileSize = std::filesystem::file_size(archive, error);
+    std::ifstream file(archive, std::ios::binary);
+    uint8_t magic[CompressionMagicSize];
+    if (error || !file || !ReadAt(file, 0, magic, sizeof(magic))) {
+        return false;
+    }
+
+    bool exact = false;
+    switch (DetectCompression(magic, sizeof(magic))) {
+    case CompressionFormat::Gzip:
+        exact = SumGzipMembers(file, fileSize, size);
+        break;
+
+    case CompressionFormat::Zstd:
+        exact = SumZstdFrames(file, fileSize, size);
+        break;
+
+    default:
+        break;
+    }
+
+    if (!exact) {
+        *size = fileSize * ExpansionEstimate;
+    }
+
+    return true;
+}
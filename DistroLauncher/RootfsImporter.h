@@ -0,0 +1,113 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Decompress.h"
+#include "Inflate.h"
+#include "TarStream.h"
+
+enum class RootfsStatus
+{
+    Ok,
+    IoError,
+    CorruptArchive,
+    SinkFailed,
+};
+
+struct RootfsImportOptions
+{
+    // Map the archive and decode it in place rather than reading it into
+    // buffers. Archives that cannot be mapped are read either way.
+    bool mapArchive = true;
+
+    // Size of the blocks read from the archive, or hashed when it is mapped.
+    size_t readSize = 1 << 20;
+
+    // Size of the blocks of decompressed data handed to the tar stage.
+    size_t flushSize = 1 << 20;
+
+    // Number of blocks that may be queued between two stages.
+    size_t queueDepth = 8;
+
+    // Threads decoding block-indexed archives; 0 uses one per hardware thread.
+    unsigned inflateThreads = 0;
+
+    // Dictionary a zstd archive was compressed with; empty when there is none.
+    std::filesystem::path dictionary;
+
+    // SHA-256 digest the archive file must have; empty to skip the check.
+    // The archive is hashed as it is read, so the check costs no extra pass.
+    std::vector<uint8_t> expectedSha256;
+};
+
+struct RootfsImportStats
+{
+    uint64_t compressedBytes = 0;
+    uint64_t uncompressedBytes = 0;
+    uint64_t entries = 0;
+    CompressionFormat format = CompressionFormat::Unknown;
+};
+
+// Streams a compressed rootfs tarball through a pipeline whose stages run on
+// separate threads: reading from disk, decompression, and tar parsing.
+// Archives are memory-mapped when possible, so that the decoder reads them
+// in place while the system reads ahead of it.
+// gzip, zstd and xz archives are recognized by their magic bytes, and
+// block-indexed gzip archives are decompressed by several threads at once.
+// Every entry is validated and forwarded to a TarSink, and the sink only sees
+// the end of the archive once the archive matched its expected digest, so the
+// archive is known to be intact before anything is registered.
+class RootfsImporter
+{
+  public:
+    explicit RootfsImporter(RootfsImportOptions options = {});
+
+    RootfsStatus Import(const std::filesystem::path &archive, TarSink &sink);
+
+    const RootfsImportStats &Stats() const { return _stats; }
+    const std::string &Error() const { return _error; }
+
+  private:
+    RootfsStatus Fail(RootfsStatus status, const std::string &error);
+
+    RootfsImportOptions _options;
+    RootfsImportStats _stats;
+    std::mutex _errorMutex;
+    RootfsStatus _status = RootfsStatus::Ok;
+    std::string _error;
+};
+
+// Estimates the size of the tar stream an archive decompresses to, so that
+// callers can check there is room for it before writing it out. Block-indexed
+// gzip archives give it exactly, since every member ends with its own size,
+// and so do zstd archives whose frames record their content size. Anything
+// else is estimated from its compressed size. Returns false if the archive
+// cannot be read.
+bool EstimateTarSize(const std::filesystem::path &archive, uint64_t *size);
+
+// Writes a byte stream to a file.
+class FileSink : public ByteSink
+{
+  public:
+    explicit FileSink(const std::filesystem::path &path);
+
+    bool IsOpen() const { return _file.is_open(); }
+    bool Write(const uint8_t *data, size_t size) override;
+
+    // Flushes and closes the file, returning false if any write failed.
+    bool Close();
+
+  private:
+    std::ofstream _file;
+};
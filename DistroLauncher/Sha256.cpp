@@ -0,0 +1,321 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "Sha256.h"
+
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define SHA256_X86_KERNEL
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SHA256_TARGET
+#else
+#include <cpuid.h>
+#define SHA256_TARGET __attribute__((target("sha,ssse3,sse4.1")))
+#endif
+#endif
+
+namespace {
+    const uint32_t RoundConstants[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+
+    const uint32_t InitialState[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    inline uint32_t Rotate(uint32_t value, unsigned count)
+    {
+        return (value >> count) | (value << (32 - count));
+    }
+
+    inline uint32_t LoadBigEndian32(const uint8_t *data)
+    {
+        return (uint32_t{data[0]} << 24) | (uint32_t{data[1]} << 16) | (uint32_t{data[2]} << 8) | uint32_t{data[3]};
+    }
+
+    void CompressPortable(uint32_t state[8], const uint8_t *blocks, size_t count)
+    {
+        uint32_t w[64];
+        for (; count > 0; count -= 1, blocks += Sha256::BlockSize) {
+            for (size_t index = 0; index < 16; index += 1) {
+                w[index] = LoadBigEndian32(blocks + 4 * index);
+            }
+
+            for (size_t index = 16; index < 64; index += 1) {
+                const uint32_t s0 = Rotate(w[index - 15], 7) ^ Rotate(w[index - 15], 18) ^ (w[index - 15] >> 3);
+                const uint32_t s1 = Rotate(w[index - 2], 17) ^ Rotate(w[index - 2], 19) ^ (w[index - 2] >> 10);
+                w[index] = w[index - 16] + s0 + w[index - 7] + s1;
+            }
+
+            uint32_t a = state[0];
+            uint32_t b = state[1];
+            uint32_t c = state[2];
+            uint32_t d = state[3];
+            uint32_t e = state[4];
+            uint32_t f = state[5];
+            uint32_t g = state[6];
+            uint32_t h = state[7];
+            for (size_t index = 0; index < 64; index += 1) {
+                const uint32_t t1 = h + (Rotate(e, 6) ^ Rotate(e, 11) ^ Rotate(e, 25)) + ((e & f) ^ (~e & g)) +
+                                    RoundConstants[index] + w[index];
+                const uint32_t t2 = (Rotate(a, 2) ^ Rotate(a, 13) ^ Rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+            state[5] += f;
+            state[6] += g;
+            state[7] += h;
+        }
+    }
+
+#ifdef SHA256_X86_KERNEL
+    // Four rounds per pair of SHA256RNDS2, with the message schedule computed
+    // by SHA256MSG1/MSG2 as it goes. The state is kept as ABEF and CDGH, the
+    // layout the instructions expect.
+    SHA256_TARGET void CompressShaNi(uint32_t state[8], const uint8_t *blocks, size_t count)
+    {
+        const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+        __m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[0])), 0xb1);
+        __m128i hgfe = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[4])), 0x1b);
+        __m128i abef = _mm_alignr_epi8(dcba, hgfe, 8);
+        __m128i cdgh = _mm_blend_epi16(hgfe, dcba, 0xf0);
+        for (; count > 0; count -= 1, blocks += Sha256::BlockSize) {
+            const __m128i savedAbef = abef;
+            const __m128i savedCdgh = cdgh;
+            __m128i message[4];
+            for (size_t index = 0; index < 4; index += 1) {
+                message[index] = _mm_shuffle_epi8(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(blocks + 16 * index)), byteSwap);
+            }
+
+            for (size_t group = 0; group < 16; group += 1) {
+                __m128i words = _mm_add_epi32(
+                    message[group % 4], _mm_loadu_si128(reinterpret_cast<const __m128i *>(&RoundConstants[4 * group])));
+                cdgh = _mm_sha256rnds2_epu32(cdgh, abef, words);
+                words = _mm_shuffle_epi32(words, 0x0e);
+                abef = _mm_sha256rnds2_epu32(abef, cdgh, words);
+
+                // W[4(g+1)..] from the four previous groups, replacing the oldest.
+                if ((group >= 3) && (group < 15)) {
+                    const __m128i &previous = message[(group + 3) % 4];
+                    __m128i &next = message[(group + 1) % 4];
+                    next = _mm_sha256msg1_epu32(next, message[(group + 2) % 4]);
+                    next = _mm_add_epi32(next, _mm_alignr_epi8(message[group % 4], previous, 4));
+                    next = _mm_sha256msg2_epu32(next, message[group % 4]);
+                }
+            }
+
+            abef = _mm_add_epi32(abef, savedAbef);
+            cdgh = _mm_add_epi32(cdgh, savedCdgh);
+        }
+
+        const __m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+        const __m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[0]), _mm_blend_epi16(feba, dchg, 0xf0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[4]), _mm_alignr_epi8(dchg, feba, 8));
+    }
+
+    bool HasShaExtensions()
+    {
+#if defined(_MSC_VER)
+        int features[4];
+        __cpuid(features, 0);
+        if (features[0] < 7) {
+            return false;
+        }
+
+        __cpuid(features, 1);
+        const bool sse = ((features[2] & (1 << 9)) != 0) && ((features[2] & (1 << 19)) != 0);
+        __cpuidex(features, 7, 0);
+        return sse && ((features[1] & (1 << 29)) != 0);
+#else
+        unsigned int eax;
+        unsigned int ebx;
+        unsigned int ecx;
+        unsigned int edx;
+        if ((__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) || ((ecx & (1u << 9)) == 0) || ((ecx & (1u << 19)) == 0)) {
+            return false;
+        }
+
+        return (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) != 0) && ((ebx & (1u << 29)) != 0);
+#endif
+    }
+#endif
+
+    using CompressFunction = void (*)(uint32_t state[8], const uint8_t *blocks, size_t count);
+
+    bool HasKernel(Sha256::Kernel kernel)
+    {
+        switch (kernel) {
+#ifdef SHA256_X86_KERNEL
+        case Sha256::Kernel::ShaNi: {
+            static const bool supported = HasShaExtensions();
+            return supported;
+        }
+#endif
+
+        case Sha256::Kernel::Auto:
+        case Sha256::Kernel::Portable:
+            return true;
+
+        default:
+            return false;
+        }
+    }
+
+    CompressFunction SelectCompress()
+    {
+#ifdef SHA256_X86_KERNEL
+        if (HasKernel(Sha256::Kernel::ShaNi)) {
+            return CompressShaNi;
+        }
+#endif
+
+        return CompressPortable;
+    }
+
+    // The block compression, picked once per process.
+    CompressFunction CompressBlocks()
+    {
+        static const CompressFunction compress = SelectCompress();
+        return compress;
+    }
+}
+
+Sha256::Sha256(Kernel kernel) :
+    _compress(CompressBlocks())
+{
+    if (kernel == Kernel::Portable) {
+        _compress = CompressPortable;
+    }
+
+#ifdef SHA256_X86_KERNEL
+    if ((kernel == Kernel::ShaNi) && HasKernel(kernel)) {
+        _compress = CompressShaNi;
+    }
+#endif
+
+    std::memcpy(_state, InitialState, sizeof(_state));
+}
+
+bool Sha256::Supports(Kernel kernel)
+{
+    return HasKernel(kernel);
+}
+
+void Sha256::Update(const uint8_t *data, size_t size)
+{
+    _length += size;
+    if (_blockFill > 0) {
+        const size_t count = ((BlockSize - _blockFill) < size) ? (BlockSize - _blockFill) : size;
+        std::memcpy(_block + _blockFill, data, count);
+        _blockFill += count;
+        data += count;
+        size -= count;
+        if (_blockFill < BlockSize) {
+            return;
+        }
+
+        Compress(_block, 1);
+        _blockFill = 0;
+    }
+
+    if (size >= BlockSize) {
+        Compress(data, size / BlockSize);
+        data += size - (size % BlockSize);
+        size %= BlockSize;
+    }
+
+    std::memcpy(_block, data, size);
+    _blockFill = size;
+}
+
+void Sha256::Final(uint8_t digest[DigestSize])
+{
+    const uint64_t bits = _length * 8;
+    _block[_blockFill] = 0x80;
+    _blockFill += 1;
+    if (_blockFill > BlockSize - 8) {
+        std::memset(_block + _blockFill, 0, BlockSize - _blockFill);
+        Compress(_block, 1);
+        _blockFill = 0;
+    }
+
+    std::memset(_block + _blockFill, 0, BlockSize - 8 - _blockFill);
+    for (size_t index = 0; index < 8; index += 1) {
+        _block[BlockSize - 1 - index] = static_cast<uint8_t>(bits >> (8 * index));
+    }
+
+    Compress(_block, 1);
+    for (size_t index = 0; index < 8; index += 1) {
+        digest[4 * index] = static_cast<uint8_t>(_state[index] >> 24);
+        digest[4 * index + 1] = static_cast<uint8_t>(_state[index] >> 16);
+        digest[4 * index + 2] = static_cast<uint8_t>(_state[index] >> 8);
+        digest[4 * index + 3] = static_cast<uint8_t>(_state[index]);
+    }
+}
+
+void Sha256::Compress(const uint8_t *blocks, size_t count)
+{
+    _compress(_state, blocks, count);
+}
+
+bool Sha256::ParseHex(const std::string &hex, uint8_t digest[DigestSize])
+{
+    if (hex.size() != DigestSize * 2) {
+        return false;
+    }
+
+    for (size_t index = 0; index < hex.size(); index += 1) {
+        const char c = hex[index];
+        uint8_t value;
+        if ((c >= '0') && (c <= '9')) {
+            value = static_cast<uint8_t>(c - '0');
+
+        } else if ((c >= 'a') && (c <= 'f')) {
+            value = static_cast<uint8_t>(c - 'a' + 10);
+
+        } else {
+            return false;
+        }
+
+        digest[index / 2] = static_cast<uint8_t>((index % 2 == 0) ? (value << 4) : (digest[index / 2] | value));
+    }
+
+    return true;
+}
+
+const char *Sha256::Implementation()
+{
+#ifdef SHA256_X86_KERNEL
+    if (CompressBlocks() == CompressShaNi) {
+        return "sha-ni";
+    }
+#endif
+
+    return "portable";
+}
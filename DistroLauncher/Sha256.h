@@ -0,0 +1,55 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Incremental SHA-256 (FIPS 180-4). Blocks are compressed with the SHA
+// extensions of x86 processors that have them, and in portable code otherwise.
+class Sha256
+{
+  public:
+    static constexpr size_t DigestSize = 32;
+    static constexpr size_t BlockSize = 64;
+
+    // Block compressions. Auto picks the fastest the processor supports; the
+    // others are there for tests to check each kernel on its own.
+    enum class Kernel
+    {
+        Auto,
+        Portable,
+        ShaNi,
+    };
+
+    // A kernel the processor does not support falls back to Auto.
+    explicit Sha256(Kernel kernel = Kernel::Auto);
+
+    static bool Supports(Kernel kernel);
+
+    void Update(const uint8_t *data, size_t size);
+
+    // Pads the message and writes its digest. The object must not be updated afterwards.
+    void Final(uint8_t digest[DigestSize]);
+
+    // Reads a digest written as lowercase hexadecimal, as sha256sum does.
+    static bool ParseHex(const std::string &hex, uint8_t digest[DigestSize]);
+
+    // Names the block compression in use, for benchmarks.
+    static const char *Implementation();
+
+  private:
+    using CompressFunction = void (*)(uint32_t state[8], const uint8_t *blocks, size_t count);
+
+    void Compress(const uint8_t *blocks, size_t count);
+
+    CompressFunction _compress;
+    uint32_t _state[8];
+    uint8_t _block[BlockSize];
+    size_t _blockFill = 0;
+    uint64_t _length = 0;
+};
@@ -0,0 +1,279 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "SnapshotArchive.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+
+namespace {
+    const std::string SnapshotTag = "wsl-launcher-snapshot";
+    constexpr unsigned long SnapshotVersion = 1;
+
+    class FileSource : public ByteSource
+    {
+      public:
+        explicit FileSource(std::ifstream &file) :
+            _file(file),
+            _buffer(1 << 16)
+        {
+        }
+
+        bool Next(const uint8_t **data, size_t *size) override
+        {
+            _file.read(reinterpret_cast<char *>(_buffer.data()), static_cast<std::streamsize>(_buffer.size()));
+            *data = _buffer.data();
+            *size = static_cast<size_t>(_file.gcount());
+            return *size > 0;
+        }
+
+      private:
+        std::ifstream &_file;
+        std::vector<uint8_t> _buffer;
+    };
+
+    // Keeps the global records of the first entry, and stops the stream there.
+    class FirstEntrySink : public TarSink
+    {
+      public:
+        bool OnEntry(const TarEntry &entry) override
+        {
+            records = entry.globalRecords;
+            return false;
+        }
+
+        bool OnData(const uint8_t *, size_t) override { return true; }
+        bool OnEntryEnd() override { return true; }
+        bool OnArchiveEnd() override { return true; }
+
+        std::vector<std::pair<std::string, std::string>> records;
+    };
+
+    class ParserSink : public ByteSink
+    {
+      public:
+        explicit ParserSink(TarSink &sink) :
+            parser(sink)
+        {
+        }
+
+        bool Write(const uint8_t *data, size_t size) override
+        {
+            return parser.Feed(data, size) == TarStatus::Ok;
+        }
+
+        TarParser parser;
+    };
+
+    std::string FormatComment(const SnapshotInfo &info)
+    {
+        return SnapshotTag + " version=" + std::to_string(SnapshotVersion) + " uid=" + std::to_string(info.defaultUid) +
+               " user=" + info.defaultUser;
+    }
+
+    // Reads the words after the tag; words it does not know are left for
+    // later versions to add.
+    bool ParseComment(const std::string &comment, unsigned long *version, SnapshotInfo *info)
+    {
+        if (comment.compare(0, SnapshotTag.size() + 1, SnapshotTag + " ") != 0) {
+            return false;
+        }
+
+        bool haveUid = false;
+        *version = 0;
+        size_t offset = SnapshotTag.size() + 1;
+        while (offset < comment.size()) {
+            const size_t end = std::min(comment.find(' ', offset), comment.size());
+            const std::string word = comment.substr(offset, end - offset);
+            const size_t equals = word.find('=');
+            const std::string key = word.substr(0, equals);
+            const std::string value = (equals == std::string::npos) ? std::string() : word.substr(equals + 1);
+            char *last = nullptr;
+            if (key == "version") {
+                *version = std::strtoul(value.c_str(), &last, 10);
+                if (value.empty() || (*last != '\0')) {
+                    return false;
+                }
+
+            } else if (key == "uid") {
+                const unsigned long long uid = std::strtoull(value.c_str(), &last, 10);
+                if (value.empty() || (*last != '\0') || (uid >= UINT32_MAX)) {
+                    return false;
+                }
+
+                info->defaultUid = static_cast<uint32_t>(uid);
+                haveUid = true;
+
+            } else if (key == "user") {
+                info->defaultUser = value;
+            }
+
+            offset = end + 1;
+        }
+
+        return haveUid && (*version != 0);
+    }
+
+    // How an entry that makes the distribution one host rather than another
+    // is written; see SnapshotWriter.
+    enum class HostIdentity
+    {
+        None,
+        Dropped,
+        Emptied,
+    };
+
+    HostIdentity HostIdentityOf(const TarEntry &entry)
+    {
+        if (!entry.IsRegularFile()) {
+            return HostIdentity::None;
+        }
+
+        std::string path = entry.path;
+        if (path.compare(0, 2, "./") == 0) {
+            path.erase(0, 2);
+
+        } else if (path.compare(0, 1, "/") == 0) {
+            path.erase(0, 1);
+        }
+
+        if (path == "etc/machine-id") {
+            return HostIdentity::Emptied;
+        }
+
+        if ((path == "var/lib/dbus/machine-id") || (path.compare(0, 17, "etc/ssh/ssh_host_") == 0)) {
+            return HostIdentity::Dropped;
+        }
+
+        return HostIdentity::None;
+    }
+}
+
+SnapshotWriter::SnapshotWriter(ByteSink &output, const SnapshotInfo &info, unsigned threads) :
+    _gzip(output, threads),
+    _tar(_gzip),
+    _parser(*this),
+    _info(info)
+{
+}
+
+bool SnapshotWriter::Write(const uint8_t *data, size_t size)
+{
+    return _parser.Feed(data, size) == TarStatus::Ok;
+}
+
+bool SnapshotWriter::Close()
+{
+    // The parser leaves the end-of-archive marker to whoever feeds it.
+    if (_parser.Finish() != TarStatus::Ok) {
+        return false;
+    }
+
+    return OnArchiveEnd() && Check(_gzip.Close());
+}
+
+bool SnapshotWriter::Start()
+{
+    _started = true;
+    const std::vector<uint8_t> header = EncodeTarGlobalHeader({{"comment", FormatComment(_info)}});
+    return _gzip.Write(header.data(), header.size());
+}
+
+bool SnapshotWriter::Check(bool written)
+{
+    if (!written && _error.empty()) {
+        _error = "cannot write the snapshot";
+    }
+
+    return written;
+}
+
+bool SnapshotWriter::OnEntry(const TarEntry &entry)
+{
+    if (!_started && !Check(Start())) {
+        return false;
+    }
+
+    const HostIdentity identity = HostIdentityOf(entry);
+    _dropEntry = (identity == HostIdentity::Dropped);
+    _dropData = (identity != HostIdentity::None);
+    if (_dropEntry) {
+        _dropped += 1;
+        return true;
+    }
+
+    if (identity == HostIdentity::Emptied) {
+        TarEntry copy = entry;
+        copy.size = 0;
+        copy.paxRecords.erase(std::remove_if(copy.paxRecords.begin(), copy.paxRecords.end(),
+                                             [](const std::pair<std::string, std::string> &record) { return record.first == "size"; }),
+                              copy.paxRecords.end());
+        copy.rawHeader = EncodeTarHeader(copy);
+        return Check(_tar.OnEntry(copy));
+    }
+
+    // Global headers in the stream would apply to the rest of the snapshot;
+    // entries that come after one are written again without it.
+    if (!entry.globalRecords.empty()) {
+        TarEntry copy = entry;
+        copy.rawHeader = EncodeTarHeader(entry);
+        return Check(_tar.OnEntry(copy));
+    }
+
+    return Check(_tar.OnEntry(entry));
+}
+
+bool SnapshotWriter::OnData(const uint8_t *data, size_t size)
+{
+    return _dropData || Check(_tar.OnData(data, size));
+}
+
+bool SnapshotWriter::OnEntryEnd()
+{
+    return _dropEntry || Check(_tar.OnEntryEnd());
+}
+
+bool SnapshotWriter::OnArchiveEnd()
+{
+    return Check((_started || Start()) && _tar.OnArchiveEnd());
+}
+
+bool SnapshotReader::Load(const std::filesystem::path &path)
+{
+    const std::string name = path.filename().u8string();
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return Fail("cannot open " + name);
+    }
+
+    FileSource source(file);
+    FirstEntrySink first;
+    ParserSink sink(first);
+    GzipDecoder decoder(source);
+    decoder.Decode(sink);
+    if (file.bad()) {
+        return Fail("cannot read " + name);
+    }
+
+    for (const auto &record : first.records) {
+        unsigned long version;
+        if ((record.first == "comment") && ParseComment(record.second, &version, &_info)) {
+            if (version > SnapshotVersion) {
+                return Fail(name + " was written by a newer launcher");
+            }
+
+            return true;
+        }
+    }
+
+    return Fail(name + " is not a snapshot");
+}
+
+bool SnapshotReader::Fail(const std::string &error)
+{
+    _error = error;
+    return false;
+}
@@ -0,0 +1,91 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include "Deflate.h"
+#include "TarStream.h"
+
+// What a snapshot records about the distribution it was taken from.
+struct SnapshotInfo
+{
+    uint32_t defaultUid = 0;
+    std::string defaultUser;
+};
+
+// Writes a snapshot of a distribution, written by `snapshot` and installed
+// again by `clone`: the tar stream of its root file system, compressed as
+// block-indexed gzip (see GzipBlockWriter), which WSL registers as it is and
+// RootfsImporter decodes on every core. The stream starts with a pax global
+// header whose comment records the default user:
+//
+//     comment=wsl-launcher-snapshot version=1 uid=1000 user=builder
+//
+// so that any tar still reads a snapshot as the archive it is.
+//
+// What makes the distribution one host rather than another is left out, for
+// every clone to make its own: the SSH host keys under /etc/ssh and the
+// machine ID. /etc/machine-id is kept empty, which systemd takes as one to
+// be made, and a copy of it in /var/lib/dbus is dropped.
+class SnapshotWriter : public ByteSink, private TarSink
+{
+  public:
+    // A thread count of 0 uses one thread per hardware thread.
+    SnapshotWriter(ByteSink &output, const SnapshotInfo &info, unsigned threads = 0);
+
+    // Takes the tar stream of the root file system as it comes, which is
+    // parsed and validated on the way.
+    bool Write(const uint8_t *data, size_t size) override;
+
+    // Checks that the tar stream ended on its end-of-archive marker, then
+    // compresses and writes what is left.
+    bool Close();
+
+    // What went wrong once Write or Close returned false.
+    const std::string &Error() const { return _error.empty() ? _parser.Error() : _error; }
+
+    uint64_t Entries() const { return _parser.Entries() - _dropped; }
+    uint64_t UncompressedBytes() const { return _gzip.UncompressedBytes(); }
+    uint64_t CompressedBytes() const { return _gzip.CompressedBytes(); }
+
+  private:
+    bool OnEntry(const TarEntry &entry) override;
+    bool OnData(const uint8_t *data, size_t size) override;
+    bool OnEntryEnd() override;
+    bool OnArchiveEnd() override;
+
+    bool Start();
+    bool Check(bool written);
+
+    GzipBlockWriter _gzip;
+    TarWriter _tar;
+    TarParser _parser;
+    SnapshotInfo _info;
+    bool _started = false;
+    bool _dropEntry = false;
+    bool _dropData = false;
+    uint64_t _dropped = 0;
+    std::string _error;
+};
+
+// Reads what a snapshot records, decoding no more of it than its first entry.
+class SnapshotReader
+{
+  public:
+    bool Load(const std::filesystem::path &path);
+
+    const SnapshotInfo &Info() const { return _info; }
+    const std::string &Error() const { return _error; }
+
+  private:
+    bool Fail(const std::string &error);
+
+    SnapshotInfo _info;
+    std::string _error;
+};
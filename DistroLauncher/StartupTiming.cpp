@@ -0,0 +1,72 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "StartupTiming.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+    const char Prefix[] = "startup:";
+}
+
+StartupTiming::StartupTiming(Clock::time_point origin) :
+    _origin(origin)
+{
+}
+
+void StartupTiming::Mark(const std::string &phase)
+{
+    const double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - _origin).count();
+    _marks.push_back(StartupMark{phase, milliseconds});
+}
+
+std::string StartupTiming::Format() const
+{
+    std::string line = Prefix;
+    for (const StartupMark &mark : _marks) {
+        char value[32];
+        std::snprintf(value, sizeof(value), "=%.3f", mark.milliseconds);
+        line += " ";
+        line += mark.phase;
+        line += value;
+    }
+
+    return line;
+}
+
+bool StartupTiming::Parse(const std::string &line, std::vector<StartupMark> *marks)
+{
+    if (line.compare(0, sizeof(Prefix) - 1, Prefix) != 0) {
+        return false;
+    }
+
+    marks->clear();
+    size_t offset = sizeof(Prefix) - 1;
+    while (offset < line.size()) {
+        const size_t start = line.find_first_not_of(" \r\n", offset);
+        if (start == std::string::npos) {
+            break;
+        }
+
+        const size_t equals = line.find('=', start);
+        const size_t end = line.find_first_of(" \r\n", start);
+        if ((equals == std::string::npos) || (equals > end) || (equals == start)) {
+            return false;
+        }
+
+        const std::string value = line.substr(equals + 1, (end == std::string::npos) ? std::string::npos : end - equals - 1);
+        char *parsed;
+        const double milliseconds = std::strtod(value.c_str(), &parsed);
+        if (value.empty() || (*parsed != '\0')) {
+            return false;
+        }
+
+        marks->push_back(StartupMark{line.substr(start, equals - start), milliseconds});
+        offset = (end == std::string::npos) ? line.size() : end;
+    }
+
+    return true;
+}
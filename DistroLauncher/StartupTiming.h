@@ -0,0 +1,45 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct StartupMark
+{
+    std::string phase;
+    double milliseconds;
+};
+
+// Records when the launcher gets through each phase of its startup, in
+// milliseconds since the process was created, and writes them as one line:
+//
+//     startup: main=1.204 args=1.210 wslapi=2.951 registered=9.870 ...
+//
+// The launcher prints that line on standard error when asked to, and
+// startup-bench reads it back from every run it makes.
+class StartupTiming
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit StartupTiming(Clock::time_point origin);
+
+    // Marks the end of a phase now.
+    void Mark(const std::string &phase);
+
+    const std::vector<StartupMark> &Marks() const { return _marks; }
+
+    std::string Format() const;
+
+    // Reads a line written by Format; false when it is not one.
+    static bool Parse(const std::string &line, std::vector<StartupMark> *marks);
+
+  private:
+    Clock::time_point _origin;
+    std::vector<StartupMark> _marks;
+};
@@ -0,0 +1,214 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "StreamRelay.h"
+
+#include <new>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef _WIN32
+    std::string SystemError(DWORD error)
+    {
+        return "error " + std::to_string(error);
+    }
+
+    // Reads what is there, up to the size; 0 at the end of the stream.
+    bool Read(StreamRelay::Handle source, char *buffer, size_t size, size_t *count, std::string *error)
+    {
+        // A pipe reads nothing when its writer wrote nothing, so only a
+        // broken pipe ends it; files end with an empty read.
+        const bool pipe = (GetFileType(source) == FILE_TYPE_PIPE);
+        for (;;) {
+            DWORD read = 0;
+            if (!ReadFile(source, buffer, static_cast<DWORD>(size), &read, nullptr)) {
+                const DWORD lastError = GetLastError();
+                if ((lastError == ERROR_BROKEN_PIPE) || (lastError == ERROR_HANDLE_EOF)) {
+                    *count = 0;
+                    return true;
+                }
+
+                *error = "cannot read: " + SystemError(lastError);
+                return false;
+            }
+
+            if ((read > 0) || !pipe) {
+                *count = read;
+                return true;
+            }
+        }
+    }
+
+    bool Write(StreamRelay::Handle destination, const char *data, size_t size, std::string *error)
+    {
+        while (size > 0) {
+            DWORD written = 0;
+            if (!WriteFile(destination, data, static_cast<DWORD>(size), &written, nullptr)) {
+                *error = "cannot write: " + SystemError(GetLastError());
+                return false;
+            }
+
+            data += written;
+            size -= written;
+        }
+
+        return true;
+    }
+#else
+    std::string SystemError(int error)
+    {
+        return std::strerror(error);
+    }
+
+    bool Read(StreamRelay::Handle source, char *buffer, size_t size, size_t *count, std::string *error)
+    {
+        for (;;) {
+            const ssize_t read = ::read(source, buffer, size);
+            if (read >= 0) {
+                *count = static_cast<size_t>(read);
+                return true;
+            }
+
+            if (errno != EINTR) {
+                *error = "cannot read: " + SystemError(errno);
+                return false;
+            }
+        }
+    }
+
+    bool Write(StreamRelay::Handle destination, const char *data, size_t size, std::string *error)
+    {
+        while (size > 0) {
+            const ssize_t written = ::write(destination, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                *error = "cannot write: " + SystemError(errno);
+                return false;
+            }
+
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+
+        return true;
+    }
+#endif
+}
+
+StreamRelay::StreamRelay(size_t bufferSize) :
+    _size(((bufferSize + Alignment - 1) / Alignment) * Alignment)
+{
+    _size = (_size == 0) ? Alignment : _size;
+    _buffer = static_cast<char *>(::operator new(_size, std::align_val_t(Alignment)));
+}
+
+StreamRelay::~StreamRelay()
+{
+    ::operator delete(_buffer, std::align_val_t(Alignment));
+}
+
+bool StreamRelay::Fail(const std::string &error)
+{
+    _error = error;
+    return false;
+}
+
+bool StreamRelay::Copy(Handle source, Handle destination)
+{
+    _error.clear();
+    bool spliced = false;
+    if (_splice && !Splice(source, destination, &spliced)) {
+        return false;
+    }
+
+    if (spliced) {
+        return true;
+    }
+
+    return Copy(source, [&](const char *data, size_t size) { return Write(destination, data, size, &_error); });
+}
+
+bool StreamRelay::Copy(Handle source, const Sink &sink)
+{
+    _error.clear();
+    for (;;) {
+        size_t count;
+        if (!Read(source, _buffer, _size, &count, &_error)) {
+            return false;
+        }
+
+        if (count == 0) {
+            return true;
+        }
+
+        if (!sink(_buffer, count)) {
+            return _error.empty() ? Fail("the copy was stopped") : false;
+        }
+
+        _bytes += count;
+    }
+}
+
+bool StreamRelay::Splice(Handle source, Handle destination, bool *spliced)
+{
+    *spliced = false;
+#if !defined(_WIN32) && defined(__linux__)
+    struct stat sourceStat;
+    struct stat destinationStat;
+    if ((::fstat(source, &sourceStat) != 0) || (::fstat(destination, &destinationStat) != 0) ||
+        (!S_ISFIFO(sourceStat.st_mode) && !S_ISFIFO(destinationStat.st_mode))) {
+        return true;
+    }
+
+    bool moved = false;
+    for (;;) {
+        const ssize_t count = ::splice(source, nullptr, destination, nullptr, _size, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (count > 0) {
+            moved = true;
+            _bytes += static_cast<uint64_t>(count);
+            continue;
+        }
+
+        if (count == 0) {
+            *spliced = true;
+            return true;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        }
+
+        // Not every pair of files can be spliced; those that cannot are
+        // found out before anything has been moved, and copied instead.
+        if (!moved && (errno == EINVAL)) {
+            return true;
+        }
+
+        return Fail("cannot splice: " + SystemError(errno));
+    }
+#else
+    (void)source;
+    (void)destination;
+    return true;
+#endif
+}
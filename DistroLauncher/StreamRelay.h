@@ -0,0 +1,64 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Copies a byte stream from one handle to another, or to a function, until
+// the source ends, for input and output that cannot be handed to the
+// distribution as they are. Bytes are moved as they are, with no text-mode
+// conversion, through one buffer aligned to the page size. The default size
+// takes in several pipe buffers' worth in one read while still fitting the
+// processor's cache: larger buffers made copies slower again (see
+// bench/RelayBench.cpp). On Linux, copies between a pipe and anything else
+// are spliced instead, and never leave the kernel.
+class StreamRelay
+{
+  public:
+#ifdef _WIN32
+    using Handle = void *;
+#else
+    using Handle = int;
+#endif
+
+    // Takes what was read and returns whether to go on.
+    using Sink = std::function<bool(const char *data, size_t size)>;
+
+    static constexpr size_t DefaultBufferSize = 256 << 10;
+    static constexpr size_t Alignment = 4096;
+
+    // The buffer size is rounded up to the alignment.
+    explicit StreamRelay(size_t bufferSize = DefaultBufferSize);
+    ~StreamRelay();
+
+    StreamRelay(const StreamRelay &) = delete;
+    StreamRelay &operator=(const StreamRelay &) = delete;
+
+    // Copies until the source ends; false if reading or writing failed, or
+    // the sink stopped the copy.
+    bool Copy(Handle source, Handle destination);
+    bool Copy(Handle source, const Sink &sink);
+
+    // Copies through the buffer even where splicing is possible.
+    void DisableSplice() { _splice = false; }
+
+    // Bytes copied so far, over every copy.
+    uint64_t Bytes() const { return _bytes; }
+    const std::string &Error() const { return _error; }
+
+  private:
+    bool Fail(const std::string &error);
+    bool Splice(Handle source, Handle destination, bool *spliced);
+
+    char *_buffer;
+    size_t _size;
+    bool _splice = true;
+    uint64_t _bytes = 0;
+    std::string _error;
+};
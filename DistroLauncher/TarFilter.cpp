@@ -0,0 +1,293 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "TarFilter.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <utility>
+
+namespace {
+    // Reduces archive member names and policy paths to one spelling:
+    // no leading "./" or "/", no trailing "/".
+    std::string Normalize(const std::string &path)
+    {
+        size_t start = 0;
+        for (;;) {
+            if (path.compare(start, 2, "./") == 0) {
+                start += 2;
+
+            } else if (path.compare(start, 1, "/") == 0) {
+                start += 1;
+
+            } else {
+                break;
+            }
+        }
+
+        size_t end = path.size();
+        while ((end > start) && (path[end - 1] == '/')) {
+            end -= 1;
+        }
+
+        return (path.compare(start, end - start, ".") == 0) ? std::string() : path.substr(start, end - start);
+    }
+
+    // Matches "*" against any run of characters and "?" against any one,
+    // backtracking only to the last star.
+    bool Matches(const std::string &pattern, const std::string &path)
+    {
+        size_t p = 0;
+        size_t s = 0;
+        size_t star = std::string::npos;
+        size_t resume = 0;
+        while (s < path.size()) {
+            if ((p < pattern.size()) && ((pattern[p] == '?') || (pattern[p] == path[s]))) {
+                p += 1;
+                s += 1;
+
+            } else if ((p < pattern.size()) && (pattern[p] == '*')) {
+                star = p;
+                p += 1;
+                resume = s;
+
+            } else if (star != std::string::npos) {
+                p = star + 1;
+                resume += 1;
+                s = resume;
+
+            } else {
+                return false;
+            }
+        }
+
+        while ((p < pattern.size()) && (pattern[p] == '*')) {
+            p += 1;
+        }
+
+        return p == pattern.size();
+    }
+}
+
+void TarFilterPolicy::Remove(const std::string &path)
+{
+    _removed.push_back(Normalize(path));
+}
+
+void TarFilterPolicy::Exclude(const std::string &pattern)
+{
+    _excluded.push_back(Normalize(pattern));
+}
+
+void TarFilterPolicy::Include(const std::string &pattern)
+{
+    _included.push_back(Normalize(pattern));
+}
+
+void TarFilterPolicy::Replace(const std::string &path, std::string content, uint32_t mode)
+{
+    _replacements.push_back({Normalize(path), std::move(content), mode});
+}
+
+bool TarFilterPolicy::Fail(const std::string &error)
+{
+    _error = error;
+    return false;
+}
+
+bool TarFilterPolicy::Load(const std::filesystem::path &path)
+{
+    const std::string name = path.filename().u8string();
+    std::ifstream file(path);
+    if (!file) {
+        return Fail("cannot open " + name);
+    }
+
+    std::string line;
+    for (size_t number = 1; std::getline(file, line); number += 1) {
+        std::istringstream words(line);
+        std::string directive;
+        std::string argument;
+        if (!(words >> directive) || (directive[0] == '#')) {
+            continue;
+        }
+
+        const std::string where = name + " line " + std::to_string(number);
+        if (!(words >> argument)) {
+            return Fail(where + ": " + directive + " needs a path");
+        }
+
+        if (directive == "remove") {
+            Remove(argument);
+
+        } else if (directive == "path-exclude") {
+            Exclude(argument);
+
+        } else if (directive == "path-include") {
+            Include(argument);
+
+        } else if (directive == "replace") {
+            std::string source;
+            std::string mode = "0644";
+            if (!(words >> source)) {
+                return Fail(where + ": replace needs the file to write");
+            }
+
+            words >> mode;
+            char *end;
+            const unsigned long bits = std::strtoul(mode.c_str(), &end, 8);
+            if ((*end != '\0') || (bits > 07777)) {
+                return Fail(where + ": invalid mode " + mode);
+            }
+
+            std::ifstream content(path.parent_path() / std::filesystem::u8path(source), std::ios::binary);
+            std::string data((std::istreambuf_iterator<char>(content)), std::istreambuf_iterator<char>());
+            if (!content && !content.eof()) {
+                return Fail(where + ": cannot read " + source);
+            }
+
+            Replace(argument, std::move(data), static_cast<uint32_t>(bits));
+
+        } else {
+            return Fail(where + ": unknown directive " + directive);
+        }
+    }
+
+    if (file.bad()) {
+        return Fail("cannot read " + name);
+    }
+
+    return true;
+}
+
+bool TarFilterPolicy::IsRemoved(const std::string &path) const
+{
+    for (const std::string &removed : _removed) {
+        if ((path.compare(0, removed.size(), removed) == 0) &&
+            ((path.size() == removed.size()) || (path[removed.size()] == '/') || removed.empty())) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool TarFilterPolicy::IsPruned(const std::string &path) const
+{
+    for (const std::string &excluded : _excluded) {
+        if (Matches(excluded, path)) {
+            for (const std::string &included : _included) {
+                if (Matches(included, path)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const TarFilterPolicy::Replacement *TarFilterPolicy::FindReplacement(const std::string &path) const
+{
+    // The last directive for a path wins.
+    for (auto it = _replacements.rbegin(); it != _replacements.rend(); ++it) {
+        if (it->path == path) {
+            return &*it;
+        }
+    }
+
+    return nullptr;
+}
+
+TarFilter::TarFilter(const TarFilterPolicy &policy, TarSink &output) :
+    _policy(policy),
+    _output(output)
+{
+}
+
+bool TarFilter::WriteReplacement(const TarFilterPolicy::Replacement &replacement, const std::string &path, int64_t mtime)
+{
+    TarEntry entry;
+    entry.path = path;
+    entry.type = '0';
+    entry.mode = replacement.mode;
+    entry.size = replacement.content.size();
+    entry.mtime = mtime;
+    entry.userName = "root";
+    entry.groupName = "root";
+    entry.rawHeader = EncodeTarHeader(entry);
+    _written.insert(replacement.path);
+    return _output.OnEntry(entry) &&
+           _output.OnData(reinterpret_cast<const uint8_t *>(replacement.content.data()), replacement.content.size()) &&
+           _output.OnEntryEnd();
+}
+
+bool TarFilter::OnEntry(const TarEntry &entry)
+{
+    _path = Normalize(entry.path);
+    if (_stats.entries == 0) {
+        _prefix = (entry.path.compare(0, 2, "./") == 0) ? "./" : "";
+    }
+
+    _stats.entries += 1;
+    if (entry.mtime > _newest) {
+        _newest = entry.mtime;
+    }
+
+    // Directories are never replaced, as their content would be left without them.
+    const TarFilterPolicy::Replacement *replacement = _policy.FindReplacement(_path);
+    if ((replacement != nullptr) && (entry.type == '5')) {
+        _written.insert(_path);
+
+    } else if (replacement != nullptr) {
+        _skipping = true;
+        _stats.replaced += 1;
+        return WriteReplacement(*replacement, entry.path, entry.mtime);
+    }
+
+    const bool dropped = _policy.IsRemoved(_path) || ((entry.type != '5') && _policy.IsPruned(_path)) ||
+                         ((entry.type == '1') && (_dropped.count(Normalize(entry.linkTarget)) != 0));
+    if (dropped) {
+        _skipping = true;
+        _dropped.insert(_path);
+        _stats.dropped += 1;
+        _stats.droppedBytes += entry.size;
+        return true;
+    }
+
+    _skipping = false;
+    return _output.OnEntry(entry);
+}
+
+bool TarFilter::OnData(const uint8_t *data, size_t size)
+{
+    return _skipping || _output.OnData(data, size);
+}
+
+bool TarFilter::OnEntryEnd()
+{
+    return _skipping || _output.OnEntryEnd();
+}
+
+bool TarFilter::OnArchiveEnd()
+{
+    // Replacements for paths the archive does not have are added, in policy
+    // order and spelled like the archive's own entries.
+    for (const TarFilterPolicy::Replacement &replacement : _policy._replacements) {
+        if ((_written.count(replacement.path) == 0) && (_policy.FindReplacement(replacement.path) == &replacement)) {
+            if (!WriteReplacement(replacement, _prefix + replacement.path, _newest)) {
+                return false;
+            }
+
+            _stats.added += 1;
+        }
+    }
+
+    return _output.OnArchiveEnd();
+}
@@ -0,0 +1,111 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "TarStream.h"
+
+// Changes to make to a rootfs before it is registered. Paths and patterns
+// are relative to the root of the distribution; a leading "/" is ignored.
+//
+// Policies can be written as text, one directive per line:
+//
+//     # Let WSL generate the resolver configuration.
+//     remove /etc/resolv.conf
+//     path-exclude /usr/share/doc/*
+//     path-include /usr/share/doc/*/copyright
+//     replace /etc/wsl.conf wsl.conf 0644
+//
+// The file a replace directive names is read relative to the policy file.
+class TarFilterPolicy
+{
+  public:
+    // Drops the entry at path, and everything beneath it if it is a directory.
+    void Remove(const std::string &path);
+
+    // Prunes files the way dpkg's path-exclude and path-include do: a
+    // non-directory entry matching an exclude pattern is dropped unless it
+    // also matches an include pattern. "*" matches any characters, slashes
+    // included, and "?" any one character. Directories are kept, so that the
+    // files included again still have them.
+    void Exclude(const std::string &pattern);
+    void Include(const std::string &pattern);
+
+    // Writes a regular file owned by root in place of the entry at path, or
+    // at the end of the archive when it has no such entry.
+    void Replace(const std::string &path, std::string content, uint32_t mode = 0644);
+
+    // Adds the directives of a policy file to those already set.
+    bool Load(const std::filesystem::path &path);
+
+    bool Empty() const { return _removed.empty() && _excluded.empty() && _replacements.empty(); }
+    const std::string &Error() const { return _error; }
+
+  private:
+    friend class TarFilter;
+
+    struct Replacement
+    {
+        std::string path;
+        std::string content;
+        uint32_t mode;
+    };
+
+    bool IsRemoved(const std::string &path) const;
+    bool IsPruned(const std::string &path) const;
+    const Replacement *FindReplacement(const std::string &path) const;
+    bool Fail(const std::string &error);
+
+    std::vector<std::string> _removed;
+    std::vector<std::string> _excluded;
+    std::vector<std::string> _included;
+    std::vector<Replacement> _replacements;
+    std::string _error;
+};
+
+struct TarFilterStats
+{
+    uint64_t entries = 0;
+    uint64_t dropped = 0;
+    uint64_t droppedBytes = 0;
+    uint64_t replaced = 0;
+    uint64_t added = 0;
+};
+
+// Applies a policy to a tar stream on its way to another sink, so that fixes
+// to the rootfs cost nothing more than the import already does. Hard links to
+// dropped entries are dropped too, since they would have nothing to link to.
+class TarFilter : public TarSink
+{
+  public:
+    TarFilter(const TarFilterPolicy &policy, TarSink &output);
+
+    bool OnEntry(const TarEntry &entry) override;
+    bool OnData(const uint8_t *data, size_t size) override;
+    bool OnEntryEnd() override;
+    bool OnArchiveEnd() override;
+
+    const TarFilterStats &Stats() const { return _stats; }
+
+  private:
+    bool WriteReplacement(const TarFilterPolicy::Replacement &replacement, const std::string &path, int64_t mtime);
+
+    const TarFilterPolicy &_policy;
+    TarSink &_output;
+    TarFilterStats _stats;
+    std::set<std::string> _dropped;
+    std::set<std::string> _written;
+    std::string _path;
+    std::string _prefix;
+    int64_t _newest = 0;
+    bool _skipping = false;
+};
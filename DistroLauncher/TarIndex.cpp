@@ -0,0 +1,486 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "TarIndex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+namespace {
+    const char IndexMagic[8] = {'W', 'S', 'L', 'T', 'A', 'R', 'I', 'X'};
+    constexpr uint32_t IndexVersion = 1;
+    constexpr size_t HeaderSize = 48;
+    constexpr size_t RestartSize = 16;
+    constexpr size_t EntrySize = 80;
+    constexpr size_t TrailerSize = 4;
+    constexpr size_t ReadSize = 256 << 10;
+
+    uint32_t Load32(const uint8_t *data)
+    {
+        return uint32_t{data[0]} | (uint32_t{data[1]} << 8) | (uint32_t{data[2]} << 16) | (uint32_t{data[3]} << 24);
+    }
+
+    uint64_t Load64(const uint8_t *data)
+    {
+        return uint64_t{Load32(data)} | (uint64_t{Load32(data + 4)} << 32);
+    }
+
+    // Splits a path into its components, dropping empty ones and ".".
+    std::vector<std::string> SplitPath(const std::string &path)
+    {
+        std::vector<std::string> components;
+        size_t start = 0;
+        while (start <= path.size()) {
+            size_t end = path.find('/', start);
+            if (end == std::string::npos) {
+                end = path.size();
+            }
+
+            std::string component = path.substr(start, end - start);
+            if (!component.empty() && (component != ".")) {
+                components.push_back(std::move(component));
+            }
+
+            start = end + 1;
+        }
+
+        return components;
+    }
+
+    std::string JoinPath(const std::vector<std::string> &components)
+    {
+        std::string path;
+        for (const std::string &component : components) {
+            if (!path.empty()) {
+                path += '/';
+            }
+
+            path += component;
+        }
+
+        return path;
+    }
+
+    // Reads the archive from an offset onwards.
+    class FileSource : public ByteSource
+    {
+      public:
+        explicit FileSource(std::ifstream &file) :
+            _file(file),
+            _buffer(ReadSize)
+        {
+        }
+
+        bool Next(const uint8_t **data, size_t *size) override
+        {
+            _file.read(reinterpret_cast<char *>(_buffer.data()), static_cast<std::streamsize>(_buffer.size()));
+            const size_t count = static_cast<size_t>(_file.gcount());
+            if (count == 0) {
+                return false;
+            }
+
+            *data = _buffer.data();
+            *size = count;
+            return true;
+        }
+
+      private:
+        std::ifstream &_file;
+        std::vector<uint8_t> _buffer;
+    };
+
+    // Skips the tar stream up to an entry, then hashes and forwards its
+    // content. Refuses any further data once the entry is complete, which
+    // stops the decoder.
+    class RangeSink : public ByteSink
+    {
+      public:
+        RangeSink(ByteSink &output, uint64_t skip, uint64_t size) :
+            _output(output),
+            _skip(skip),
+            _remaining(size)
+        {
+        }
+
+        bool Write(const uint8_t *data, size_t size) override
+        {
+            received += size;
+            if (_skip >= size) {
+                _skip -= size;
+                return true;
+            }
+
+            data += _skip;
+            size -= static_cast<size_t>(_skip);
+            _skip = 0;
+            const size_t count = (size < _remaining) ? size : static_cast<size_t>(_remaining);
+            _hash.Update(data, count);
+            if (!_output.Write(data, count)) {
+                outputFailed = true;
+                return false;
+            }
+
+            _remaining -= count;
+            return _remaining > 0;
+        }
+
+        bool Done() const { return !outputFailed && (_remaining == 0); }
+        void Final(uint8_t digest[Sha256::DigestSize]) { _hash.Final(digest); }
+
+        uint64_t received = 0;
+        bool outputFailed = false;
+
+      private:
+        ByteSink &_output;
+        uint64_t _skip;
+        uint64_t _remaining;
+        Sha256 _hash;
+    };
+
+    class StringSink : public ByteSink
+    {
+      public:
+        explicit StringSink(std::string &output) :
+            _output(output)
+        {
+        }
+
+        bool Write(const uint8_t *data, size_t size) override
+        {
+            _output.append(reinterpret_cast<const char *>(data), size);
+            return true;
+        }
+
+      private:
+        std::string &_output;
+    };
+}
+
+bool TarIndex::Fail(const char *error)
+{
+    _error = error;
+    return false;
+}
+
+bool TarIndex::Load(const std::filesystem::path &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        _error = "cannot open " + path.filename().u8string();
+        return false;
+    }
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (file.bad()) {
+        _error = "cannot read " + path.filename().u8string();
+        return false;
+    }
+
+    return Parse(std::move(data));
+}
+
+bool TarIndex::Parse(std::vector<uint8_t> data)
+{
+    _data.clear();
+    _entryCount = 0;
+    _restartCount = 0;
+    _error.clear();
+    if ((data.size() < HeaderSize + TrailerSize) || (std::memcmp(data.data(), IndexMagic, sizeof(IndexMagic)) != 0)) {
+        return Fail("not a tar index");
+    }
+
+    const uint8_t *header = data.data();
+    if ((Load32(header + 8) != IndexVersion) || (Load32(header + 12) != EntrySize)) {
+        return Fail("unsupported tar index version");
+    }
+
+    const size_t crcOffset = data.size() - TrailerSize;
+    if (Crc32(0, data.data(), crcOffset) != Load32(data.data() + crcOffset)) {
+        return Fail("tar index checksum mismatch");
+    }
+
+    // Each count is 32-bit, so the sizes below cannot overflow 64-bit arithmetic.
+    const uint64_t restartCount = Load32(header + 32);
+    const uint64_t entryCount = Load32(header + 36);
+    const uint64_t stringsSize = Load32(header + 40);
+    if (HeaderSize + (restartCount * RestartSize) + (entryCount * EntrySize) + stringsSize != crcOffset) {
+        return Fail("tar index has an invalid size");
+    }
+
+    _archiveSize = Load64(header + 16);
+    _tarSize = Load64(header + 24);
+    _restartCount = static_cast<size_t>(restartCount);
+    _entryCount = static_cast<size_t>(entryCount);
+    _restartsOffset = HeaderSize;
+    _entriesOffset = _restartsOffset + (_restartCount * RestartSize);
+    _stringsOffset = _entriesOffset + (_entryCount * EntrySize);
+    _stringsSize = static_cast<size_t>(stringsSize);
+    _data = std::move(data);
+
+    // Lookups rely on these invariants, so check them once here.
+    TarIndexRestart previous;
+    for (size_t index = 0; index < _restartCount; index += 1) {
+        const uint8_t *restart = _data.data() + _restartsOffset + (index * RestartSize);
+        const uint64_t compressed = Load64(restart);
+        const uint64_t tarOffset = Load64(restart + 8);
+        const bool first = (index == 0);
+        if ((first && ((compressed != 0) || (tarOffset != 0))) ||
+            (!first && ((compressed <= previous.compressedOffset) || (tarOffset < previous.tarOffset))) ||
+            (compressed > _archiveSize) || (tarOffset > _tarSize)) {
+            _restartCount = 0;
+            _entryCount = 0;
+            return Fail("tar index has invalid restart points");
+        }
+
+        previous.compressedOffset = compressed;
+        previous.tarOffset = tarOffset;
+    }
+
+    for (size_t index = 0; index < _entryCount; index += 1) {
+        const uint8_t *entry = _data.data() + _entriesOffset + (index * EntrySize);
+        const uint64_t pathEnd = uint64_t{Load32(entry)} + Load32(entry + 4);
+        const uint64_t linkEnd = uint64_t{Load32(entry + 8)} + Load32(entry + 12);
+        const uint64_t dataOffset = Load64(entry + 24);
+        const uint64_t size = Load64(entry + 32);
+        if ((pathEnd > _stringsSize) || (linkEnd > _stringsSize) || (dataOffset > _tarSize) ||
+            (size > _tarSize - dataOffset) || ((index > 0) && !(PathAt(index - 1) < PathAt(index)))) {
+            _restartCount = 0;
+            _entryCount = 0;
+            return Fail("tar index has invalid entries");
+        }
+    }
+
+    return true;
+}
+
+std::string TarIndex::PathAt(size_t index) const
+{
+    const uint8_t *entry = _data.data() + _entriesOffset + (index * EntrySize);
+    return std::string(reinterpret_cast<const char *>(_data.data() + _stringsOffset + Load32(entry)), Load32(entry + 4));
+}
+
+TarIndexEntry TarIndex::Entry(size_t index) const
+{
+    const uint8_t *entry = _data.data() + _entriesOffset + (index * EntrySize);
+    const char *strings = reinterpret_cast<const char *>(_data.data() + _stringsOffset);
+    TarIndexEntry result;
+    result.path.assign(strings + Load32(entry), Load32(entry + 4));
+    result.linkTarget.assign(strings + Load32(entry + 8), Load32(entry + 12));
+    result.headerOffset = Load64(entry + 16);
+    result.dataOffset = Load64(entry + 24);
+    result.size = Load64(entry + 32);
+    result.mode = Load32(entry + 40);
+    result.type = static_cast<char>(entry[44]);
+    std::memcpy(result.sha256, entry + 48, sizeof(result.sha256));
+    return result;
+}
+
+bool TarIndex::Find(const std::string &path, TarIndexEntry *entry) const
+{
+    const std::string key = JoinPath(SplitPath(path));
+    size_t low = 0;
+    size_t high = _entryCount;
+    while (low < high) {
+        const size_t middle = low + ((high - low) / 2);
+        if (PathAt(middle) < key) {
+            low = middle + 1;
+
+        } else {
+            high = middle;
+        }
+    }
+
+    if ((low == _entryCount) || (PathAt(low) != key)) {
+        return false;
+    }
+
+    *entry = Entry(low);
+    return true;
+}
+
+bool TarIndex::Resolve(const std::string &path, TarIndexEntry *entry) const
+{
+    // Components still to walk, the next one last, and the resolved directory.
+    std::vector<std::string> pending = SplitPath(path);
+    std::reverse(pending.begin(), pending.end());
+    std::vector<std::string> directory;
+    size_t links = 0;
+    while (!pending.empty()) {
+        const std::string component = std::move(pending.back());
+        pending.pop_back();
+        if (component == "..") {
+            if (!directory.empty()) {
+                directory.pop_back();
+            }
+
+            continue;
+        }
+
+        directory.push_back(component);
+        TarIndexEntry found;
+        if (!Find(JoinPath(directory), &found)) {
+            // Archives may leave out intermediate directories.
+            if (pending.empty()) {
+                return false;
+            }
+
+            continue;
+        }
+
+        if (found.IsSymbolicLink()) {
+            links += 1;
+            if (links > MaxLinks) {
+                return false;
+            }
+
+            directory.pop_back();
+            if (!found.linkTarget.empty() && (found.linkTarget[0] == '/')) {
+                directory.clear();
+            }
+
+            std::vector<std::string> target = SplitPath(found.linkTarget);
+            pending.insert(pending.end(), target.rbegin(), target.rend());
+            continue;
+        }
+
+        if (!pending.empty()) {
+            if (found.type != '5') {
+                return false;
+            }
+
+            continue;
+        }
+
+        // Hard link targets are archive member names, not paths to resolve.
+        while (found.IsHardLink()) {
+            links += 1;
+            if ((links > MaxLinks) || !Find(found.linkTarget, &found)) {
+                return false;
+            }
+        }
+
+        *entry = std::move(found);
+        return true;
+    }
+
+    return Find(JoinPath(directory), entry);
+}
+
+TarIndexRestart TarIndex::RestartBefore(uint64_t tarOffset) const
+{
+    size_t low = 0;
+    size_t high = _restartCount;
+    while (high - low > 1) {
+        const size_t middle = low + ((high - low) / 2);
+        if (Load64(_data.data() + _restartsOffset + (middle * RestartSize) + 8) <= tarOffset) {
+            low = middle;
+
+        } else {
+            high = middle;
+        }
+    }
+
+    TarIndexRestart restart;
+    if (_restartCount > 0) {
+        const uint8_t *data = _data.data() + _restartsOffset + (low * RestartSize);
+        restart.compressedOffset = Load64(data);
+        restart.tarOffset = Load64(data + 8);
+    }
+
+    return restart;
+}
+
+IndexedArchive::IndexedArchive(DecompressOptions options) :
+    _options(std::move(options))
+{
+    // Only a single member or frame is decoded, so extra threads would not help.
+    _options.threads = 1;
+}
+
+ExtractStatus IndexedArchive::Fail(ExtractStatus status, const std::string &error)
+{
+    _error = error;
+    return status;
+}
+
+ExtractStatus IndexedArchive::Open(const std::filesystem::path &archive, const std::filesystem::path &index)
+{
+    _error.clear();
+    if (!_index.Load(index)) {
+        return Fail(ExtractStatus::IoError, _index.Error());
+    }
+
+    std::error_code error;
+    const uintmax_t size = std::filesystem::file_size(archive, error);
+    if (error) {
+        return Fail(ExtractStatus::IoError, "cannot open " + archive.filename().u8string());
+    }
+
+    if (size != _index.ArchiveSize()) {
+        return Fail(ExtractStatus::CorruptArchive, index.filename().u8string() + " does not describe " + archive.filename().u8string());
+    }
+
+    _archive = archive;
+    return ExtractStatus::Ok;
+}
+
+ExtractStatus IndexedArchive::Extract(const std::string &path, ByteSink &sink)
+{
+    _error.clear();
+    _decodedBytes = 0;
+    TarIndexEntry entry;
+    if (!_index.Resolve(path, &entry)) {
+        return Fail(ExtractStatus::NotFound, path + " is not in the archive");
+    }
+
+    if (!entry.IsRegularFile()) {
+        return Fail(ExtractStatus::NotFound, path + " is not a regular file");
+    }
+
+    if (entry.size == 0) {
+        return ExtractStatus::Ok;
+    }
+
+    const TarIndexRestart restart = _index.RestartBefore(entry.dataOffset);
+    std::ifstream file(_archive, std::ios::binary);
+    if (!file || !file.seekg(static_cast<std::streamoff>(restart.compressedOffset))) {
+        return Fail(ExtractStatus::IoError, "cannot read " + _archive.filename().u8string());
+    }
+
+    FileSource source(file);
+    RangeSink range(sink, entry.dataOffset - restart.tarOffset, entry.size);
+    Decompressor decoder(source, _options);
+    const InflateStatus status = decoder.Decode(range);
+    _decodedBytes = range.received;
+    if (range.outputFailed) {
+        return Fail(ExtractStatus::SinkFailed, "content of " + path + " rejected");
+    }
+
+    if (!range.Done()) {
+        if (file.bad()) {
+            return Fail(ExtractStatus::IoError, "cannot read " + _archive.filename().u8string());
+        }
+
+        return Fail(ExtractStatus::CorruptArchive, (status == InflateStatus::Ok) ? "archive ends before " + path : decoder.Error());
+    }
+
+    uint8_t digest[Sha256::DigestSize];
+    range.Final(digest);
+    if (std::memcmp(digest, entry.sha256, sizeof(digest)) != 0) {
+        return Fail(ExtractStatus::CorruptArchive, "content of " + path + " does not match the index");
+    }
+
+    return ExtractStatus::Ok;
+}
+
+ExtractStatus IndexedArchive::ReadFile(const std::string &path, std::string *contents)
+{
+    contents->clear();
+    StringSink sink(*contents);
+    return Extract(path, sink);
+}
@@ -0,0 +1,134 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "Decompress.h"
+#include "Inflate.h"
+#include "Sha256.h"
+
+// One entry of a tar index. Offsets are in the uncompressed tar stream.
+struct TarIndexEntry
+{
+    std::string path;
+    std::string linkTarget;
+    char type = '0';
+    uint32_t mode = 0;
+    uint64_t headerOffset = 0;
+    uint64_t dataOffset = 0;
+    uint64_t size = 0;
+
+    // Hash of the content of regular files; all zeroes for other entries.
+    uint8_t sha256[Sha256::DigestSize] = {};
+
+    bool IsRegularFile() const { return (type == '0') || (type == '\0') || (type == '7'); }
+    bool IsHardLink() const { return type == '1'; }
+    bool IsSymbolicLink() const { return type == '2'; }
+};
+
+// A place where decompression of the archive can start afresh.
+struct TarIndexRestart
+{
+    uint64_t compressedOffset = 0;
+    uint64_t tarOffset = 0;
+};
+
+// Sidecar index of a rootfs archive, as written by `prepare-build --index`
+// next to it with an ".index" suffix. It lists the tar entries sorted by path,
+// with their offsets and content hash, and the offsets of the independent
+// gzip members or zstd frames of the archive. See index.go for the layout.
+class TarIndex
+{
+  public:
+    // Number of links followed by Resolve before giving up, as Linux does.
+    static constexpr size_t MaxLinks = 40;
+
+    bool Load(const std::filesystem::path &path);
+
+    // Validates and takes over the content of an index file.
+    bool Parse(std::vector<uint8_t> data);
+
+    uint64_t ArchiveSize() const { return _archiveSize; }
+    uint64_t TarSize() const { return _tarSize; }
+    size_t Entries() const { return _entryCount; }
+    size_t Restarts() const { return _restartCount; }
+
+    TarIndexEntry Entry(size_t index) const;
+
+    // Looks up an entry by its exact path. Leading "/" and "./" are ignored.
+    bool Find(const std::string &path, TarIndexEntry *entry) const;
+
+    // Looks up an entry the way the kernel resolves paths inside the
+    // distribution: symbolic links are followed in every component, relative
+    // to the root, and hard links lead to the entry holding the content.
+    bool Resolve(const std::string &path, TarIndexEntry *entry) const;
+
+    // Returns the last restart point at or before a tar offset.
+    TarIndexRestart RestartBefore(uint64_t tarOffset) const;
+
+    const std::string &Error() const { return _error; }
+
+  private:
+    std::string PathAt(size_t index) const;
+    bool Fail(const char *error);
+
+    std::vector<uint8_t> _data;
+    uint64_t _archiveSize = 0;
+    uint64_t _tarSize = 0;
+    size_t _restartCount = 0;
+    size_t _entryCount = 0;
+    size_t _restartsOffset = 0;
+    size_t _entriesOffset = 0;
+    size_t _stringsOffset = 0;
+    size_t _stringsSize = 0;
+    std::string _error;
+};
+
+enum class ExtractStatus
+{
+    Ok,
+    NotFound,
+    IoError,
+    CorruptArchive,
+    SinkFailed,
+};
+
+// Reads single files out of a rootfs archive through its index. Decompression
+// starts at the restart point closest to the file, so only the member or frame
+// holding it is decoded when the archive was repacked into blocks.
+class IndexedArchive
+{
+  public:
+    explicit IndexedArchive(DecompressOptions options = {});
+
+    // Loads the index and checks that it describes the archive.
+    ExtractStatus Open(const std::filesystem::path &archive, const std::filesystem::path &index);
+
+    // Streams the content of the regular file at path to sink, following links
+    // as TarIndex::Resolve does, and checks it against the hash in the index.
+    ExtractStatus Extract(const std::string &path, ByteSink &sink);
+    ExtractStatus ReadFile(const std::string &path, std::string *contents);
+
+    const TarIndex &Index() const { return _index; }
+    const std::string &Error() const { return _error; }
+
+    // Uncompressed bytes decoded by the last extraction.
+    uint64_t DecodedBytes() const { return _decodedBytes; }
+
+  private:
+    ExtractStatus Fail(ExtractStatus status, const std::string &error);
+
+    DecompressOptions _options;
+    std::filesystem::path _archive;
+    TarIndex _index;
+    uint64_t _decodedBytes = 0;
+    std::string _error;
+};
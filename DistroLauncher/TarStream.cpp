@@ -0,0 +1,600 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "TarStream.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace {
+    // ustar header field offsets and sizes.
+    constexpr size_t NameOffset = 0;
+    constexpr size_t NameSize = 100;
+    constexpr size_t ModeOffset = 100;
+    constexpr size_t UidOffset = 108;
+    constexpr size_t GidOffset = 116;
+    constexpr size_t IdSize = 8;
+    constexpr size_t SizeOffset = 124;
+    constexpr size_t MtimeOffset = 136;
+    constexpr size_t NumberSize = 12;
+    constexpr size_t ChecksumOffset = 148;
+    constexpr size_t ChecksumSize = 8;
+    constexpr size_t TypeOffset = 156;
+    constexpr size_t LinkOffset = 157;
+    constexpr size_t MagicOffset = 257;
+    constexpr size_t UserNameOffset = 265;
+    constexpr size_t GroupNameOffset = 297;
+    constexpr size_t OwnerNameSize = 32;
+    constexpr size_t PrefixOffset = 345;
+    constexpr size_t PrefixSize = 155;
+
+    // Extended headers larger than this are rejected rather than buffered.
+    constexpr uint64_t MaxExtendedSize = 1 << 20;
+
+    const uint8_t ZeroBlock[TarEntry::BlockSize] = {};
+
+    std::string ReadString(const uint8_t *field, size_t size)
+    {
+        const void *end = std::memchr(field, 0, size);
+        return std::string(reinterpret_cast<const char *>(field),
+                           (end != nullptr) ? static_cast<const uint8_t *>(end) - field : size);
+    }
+
+    // Parses an octal field, or a base-256 one when the high bit is set.
+    bool ReadNumber(const uint8_t *field, size_t size, uint64_t *value)
+    {
+        *value = 0;
+        if ((field[0] & 0x80) != 0) {
+            if ((field[0] & 0x40) != 0) {
+                return false;
+            }
+
+            uint64_t result = field[0] & 0x3f;
+            for (size_t i = 1; i < size; i += 1) {
+                if ((result >> 56) != 0) {
+                    return false;
+                }
+
+                result = (result << 8) | field[i];
+            }
+
+            *value = result;
+            return true;
+        }
+
+        size_t i = 0;
+        while ((i < size) && (field[i] == ' ')) {
+            i += 1;
+        }
+
+        uint64_t result = 0;
+        for (; (i < size) && (field[i] >= '0') && (field[i] <= '7'); i += 1) {
+            result = (result << 3) | static_cast<uint64_t>(field[i] - '0');
+        }
+
+        for (; i < size; i += 1) {
+            if ((field[i] != ' ') && (field[i] != 0)) {
+                return false;
+            }
+        }
+
+        *value = result;
+        return true;
+    }
+
+    bool ChecksumMatches(const uint8_t *block)
+    {
+        uint64_t expected;
+        if (!ReadNumber(block + ChecksumOffset, ChecksumSize, &expected)) {
+            return false;
+        }
+
+        // The checksum field itself is summed as if it were filled with spaces.
+        // Historic implementations summed signed chars, so accept both.
+        uint64_t unsignedSum = 0;
+        int64_t signedSum = 0;
+        for (size_t i = 0; i < TarEntry::BlockSize; i += 1) {
+            const bool inField = (i >= ChecksumOffset) && (i < ChecksumOffset + ChecksumSize);
+            const uint8_t byte = inField ? ' ' : block[i];
+            unsignedSum += byte;
+            signedSum += static_cast<int8_t>(byte);
+        }
+
+        return (expected == unsignedSum) || (static_cast<int64_t>(expected) == signedSum);
+    }
+
+    // Splits "<length> <key>=<value>\n" records of a pax extended header.
+    bool ParsePaxRecords(const std::vector<uint8_t> &data, std::vector<std::pair<std::string, std::string>> *records)
+    {
+        const char *cursor = reinterpret_cast<const char *>(data.data());
+        const char *end = cursor + data.size();
+        while (cursor < end) {
+            size_t length = 0;
+            const char *p = cursor;
+            while ((p < end) && (*p >= '0') && (*p <= '9')) {
+                length = (length * 10) + static_cast<size_t>(*p - '0');
+                p += 1;
+            }
+
+            if ((p == end) || (*p != ' ') || (length == 0) || (length > static_cast<size_t>(end - cursor))) {
+                return false;
+            }
+
+            const char *recordEnd = cursor + length;
+            const char *key = p + 1;
+            const char *equals = static_cast<const char *>(std::memchr(key, '=', recordEnd - key));
+            if ((equals == nullptr) || (recordEnd[-1] != '\n')) {
+                return false;
+            }
+
+            records->emplace_back(std::string(key, equals), std::string(equals + 1, recordEnd - 1));
+            cursor = recordEnd;
+        }
+
+        return true;
+    }
+
+    size_t PaddingFor(uint64_t size)
+    {
+        return static_cast<size_t>((TarEntry::BlockSize - (size % TarEntry::BlockSize)) % TarEntry::BlockSize);
+    }
+
+    // Octal fields hold size - 1 digits followed by a NUL.
+    bool FitsNumber(uint64_t value, size_t size)
+    {
+        return value < (uint64_t{1} << (3 * (size - 1)));
+    }
+
+    void WriteNumber(uint8_t *field, size_t size, uint64_t value)
+    {
+        field[size - 1] = 0;
+        for (size_t i = size - 1; i > 0; i -= 1) {
+            field[i - 1] = static_cast<uint8_t>('0' + (value & 7));
+            value >>= 3;
+        }
+    }
+
+    void WriteString(uint8_t *field, size_t size, const std::string &value)
+    {
+        std::memcpy(field, value.data(), (value.size() < size) ? value.size() : size);
+    }
+
+    // The length prefix of a pax record counts its own digits.
+    void AppendPaxRecord(std::string *records, const std::string &key, const std::string &value)
+    {
+        const size_t payload = key.size() + value.size() + 3;
+        size_t length = payload + 1;
+        while (std::to_string(length).size() + payload != length) {
+            length += 1;
+        }
+
+        *records += std::to_string(length) + " " + key + "=" + value + "\n";
+    }
+
+    void AppendHeaderBlock(std::vector<uint8_t> *header,
+                           const std::string &name,
+                           char type,
+                           uint64_t size,
+                           const TarEntry &entry)
+    {
+        uint8_t block[TarEntry::BlockSize] = {};
+        WriteString(block + NameOffset, NameSize, name);
+        WriteNumber(block + ModeOffset, IdSize, entry.mode & 07777);
+        WriteNumber(block + UidOffset, IdSize, FitsNumber(entry.uid, IdSize) ? entry.uid : 0);
+        WriteNumber(block + GidOffset, IdSize, FitsNumber(entry.gid, IdSize) ? entry.gid : 0);
+        WriteNumber(block + SizeOffset, NumberSize, FitsNumber(size, NumberSize) ? size : 0);
+        WriteNumber(block + MtimeOffset, NumberSize, (entry.mtime > 0) ? static_cast<uint64_t>(entry.mtime) : 0);
+        block[TypeOffset] = static_cast<uint8_t>(type);
+        if (type != 'x') {
+            WriteString(block + LinkOffset, NameSize, entry.linkTarget);
+            WriteString(block + UserNameOffset, OwnerNameSize, entry.userName);
+            WriteString(block + GroupNameOffset, OwnerNameSize, entry.groupName);
+        }
+
+        std::memcpy(block + MagicOffset, "ustar\0" "00", 8);
+        std::memset(block + ChecksumOffset, ' ', ChecksumSize);
+        uint64_t checksum = 0;
+        for (size_t i = 0; i < TarEntry::BlockSize; i += 1) {
+            checksum += block[i];
+        }
+
+        WriteNumber(block + ChecksumOffset, ChecksumSize - 1, checksum);
+        header->insert(header->end(), block, block + TarEntry::BlockSize);
+    }
+}
+
+std::vector<uint8_t> EncodeTarHeader(const TarEntry &entry)
+{
+    // Records this function derives from the entry replace any the entry carries.
+    std::string records;
+    for (const auto &record : entry.paxRecords) {
+        if ((record.first != "path") && (record.first != "linkpath") && (record.first != "size") &&
+            (record.first != "uid") && (record.first != "gid") && (record.first != "uname") && (record.first != "gname")) {
+            AppendPaxRecord(&records, record.first, record.second);
+        }
+    }
+
+    if (entry.path.size() > NameSize) {
+        AppendPaxRecord(&records, "path", entry.path);
+    }
+
+    if (entry.linkTarget.size() > NameSize) {
+        AppendPaxRecord(&records, "linkpath", entry.linkTarget);
+    }
+
+    if (!FitsNumber(entry.size, NumberSize)) {
+        AppendPaxRecord(&records, "size", std::to_string(entry.size));
+    }
+
+    if (!FitsNumber(entry.uid, IdSize)) {
+        AppendPaxRecord(&records, "uid", std::to_string(entry.uid));
+    }
+
+    if (!FitsNumber(entry.gid, IdSize)) {
+        AppendPaxRecord(&records, "gid", std::to_string(entry.gid));
+    }
+
+    if ((entry.userName.size() > OwnerNameSize) || (entry.groupName.size() > OwnerNameSize)) {
+        AppendPaxRecord(&records, "uname", entry.userName);
+        AppendPaxRecord(&records, "gname", entry.groupName);
+    }
+
+    std::vector<uint8_t> header;
+    if (!records.empty()) {
+        AppendHeaderBlock(&header, "././@PaxHeader", 'x', records.size(), entry);
+        header.insert(header.end(), records.begin(), records.end());
+        header.insert(header.end(), PaddingFor(records.size()), 0);
+    }
+
+    AppendHeaderBlock(&header, entry.path, entry.type, entry.size, entry);
+    return header;
+}
+
+std::vector<uint8_t> EncodeTarGlobalHeader(const std::vector<std::pair<std::string, std::string>> &records)
+{
+    std::string data;
+    for (const auto &record : records) {
+        AppendPaxRecord(&data, record.first, record.second);
+    }
+
+    // The name git archive gives its global header, which tar extracts as
+    // a file of that name should it not know the type.
+    TarEntry entry;
+    entry.mode = 0666;
+    std::vector<uint8_t> header;
+    AppendHeaderBlock(&header, "pax_global_header", 'g', data.size(), entry);
+    header.insert(header.end(), data.begin(), data.end());
+    header.insert(header.end(), PaddingFor(data.size()), 0);
+    return header;
+}
+
+TarParser::TarParser(TarSink &sink) :
+    _sink(sink)
+{
+}
+
+TarStatus TarParser::Fail(TarStatus status, const char *error)
+{
+    if (_error.empty()) {
+        _error = error;
+    }
+
+    return status;
+}
+
+TarStatus TarParser::Feed(const uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        switch (_state) {
+        case State::Header: {
+            const size_t count = (size < (TarEntry::BlockSize - _blockFill)) ? size : (TarEntry::BlockSize - _blockFill);
+            std::memcpy(_block + _blockFill, data, count);
+            _blockFill += count;
+            data += count;
+            size -= count;
+            if (_blockFill == TarEntry::BlockSize) {
+                _blockFill = 0;
+                const TarStatus status = ParseHeader();
+                if (status != TarStatus::Ok) {
+                    return status;
+                }
+            }
+
+            break;
+        }
+
+        case State::Extended: {
+            // Extended header data, followed by its padding, is kept verbatim
+            // so that the entry can be written back unchanged.
+            const uint64_t total = _remaining + _padding;
+            const size_t count = (size < total) ? size : static_cast<size_t>(total);
+            _pendingHeader.insert(_pendingHeader.end(), data, data + count);
+            const size_t payload = (count < _remaining) ? count : static_cast<size_t>(_remaining);
+            _extended.insert(_extended.end(), data, data + payload);
+            _remaining -= payload;
+            _padding -= (count - payload);
+            data += count;
+            size -= count;
+            if ((_remaining == 0) && (_padding == 0)) {
+                const TarStatus status = EndExtended();
+                if (status != TarStatus::Ok) {
+                    return status;
+                }
+            }
+
+            break;
+        }
+
+        case State::Data: {
+            const size_t count = (size < _remaining) ? size : static_cast<size_t>(_remaining);
+            if (!_sink.OnData(data, count)) {
+                return Fail(TarStatus::SinkFailed, "entry data rejected");
+            }
+
+            _remaining -= count;
+            data += count;
+            size -= count;
+            if (_remaining == 0) {
+                if (_padding > 0) {
+                    _state = State::Padding;
+
+                } else {
+                    const TarStatus status = EndEntry();
+                    if (status != TarStatus::Ok) {
+                        return status;
+                    }
+                }
+            }
+
+            break;
+        }
+
+        case State::Padding: {
+            const size_t count = (size < _padding) ? size : _padding;
+            _padding -= count;
+            data += count;
+            size -= count;
+            if (_padding == 0) {
+                const TarStatus status = EndEntry();
+                if (status != TarStatus::Ok) {
+                    return status;
+                }
+            }
+
+            break;
+        }
+
+        case State::Trailer:
+            // Archivers pad the end-of-archive marker to a full record; ignore it.
+            return TarStatus::Ok;
+        }
+    }
+
+    return TarStatus::Ok;
+}
+
+TarStatus TarParser::Finish()
+{
+    if ((_state == State::Trailer) || ((_state == State::Header) && (_blockFill == 0) && _zeroBlock)) {
+        return TarStatus::Ok;
+    }
+
+    return Fail(TarStatus::Corrupt, "missing end-of-archive marker");
+}
+
+TarStatus TarParser::ParseHeader()
+{
+    if (std::memcmp(_block, ZeroBlock, TarEntry::BlockSize) == 0) {
+        if (!_pendingHeader.empty()) {
+            return Fail(TarStatus::Corrupt, "extended header without entry");
+        }
+
+        if (_zeroBlock) {
+            _state = State::Trailer;
+        }
+
+        _zeroBlock = true;
+        return TarStatus::Ok;
+    }
+
+    _zeroBlock = false;
+    if ((std::memcmp(_block + MagicOffset, "ustar", 5) != 0) || !ChecksumMatches(_block)) {
+        return Fail(TarStatus::Corrupt, "invalid tar header");
+    }
+
+    uint64_t size;
+    if (!ReadNumber(_block + SizeOffset, NumberSize, &size)) {
+        return Fail(TarStatus::Corrupt, "invalid tar entry size");
+    }
+
+    const char type = static_cast<char>(_block[TypeOffset]);
+    _pendingHeader.insert(_pendingHeader.end(), _block, _block + TarEntry::BlockSize);
+    if ((type == 'L') || (type == 'K') || (type == 'x') || (type == 'g')) {
+        if (size > MaxExtendedSize) {
+            return Fail(TarStatus::Corrupt, "extended header too large");
+        }
+
+        _extendedType = type;
+        _extended.clear();
+        _remaining = size;
+        _padding = PaddingFor(size);
+        _state = State::Extended;
+        if (size == 0) {
+            return EndExtended();
+        }
+
+        return TarStatus::Ok;
+    }
+
+    TarEntry entry;
+    entry.type = type;
+    uint64_t number;
+    if (!ReadNumber(_block + ModeOffset, IdSize, &number)) {
+        return Fail(TarStatus::Corrupt, "invalid tar entry mode");
+    }
+
+    entry.mode = static_cast<uint32_t>(number);
+    if (!ReadNumber(_block + UidOffset, IdSize, &number)) {
+        return Fail(TarStatus::Corrupt, "invalid tar entry uid");
+    }
+
+    entry.uid = static_cast<uint32_t>(number);
+    if (!ReadNumber(_block + GidOffset, IdSize, &number)) {
+        return Fail(TarStatus::Corrupt, "invalid tar entry gid");
+    }
+
+    entry.gid = static_cast<uint32_t>(number);
+    if (!ReadNumber(_block + MtimeOffset, NumberSize, &number)) {
+        return Fail(TarStatus::Corrupt, "invalid tar entry mtime");
+    }
+
+    entry.mtime = static_cast<int64_t>(number);
+    entry.size = size;
+    entry.userName = ReadString(_block + UserNameOffset, OwnerNameSize);
+    entry.groupName = ReadString(_block + GroupNameOffset, OwnerNameSize);
+    entry.linkTarget = ReadString(_block + LinkOffset, NameSize);
+    entry.path = ReadString(_block + NameOffset, NameSize);
+
+    // POSIX ustar splits long names into a prefix; GNU tar uses that space for other fields.
+    if (std::memcmp(_block + MagicOffset, "ustar\0", 6) == 0) {
+        const std::string prefix = ReadString(_block + PrefixOffset, PrefixSize);
+        if (!prefix.empty()) {
+            entry.path = prefix + "/" + entry.path;
+        }
+    }
+
+    if (!_longName.empty()) {
+        entry.path = std::move(_longName);
+    }
+
+    if (!_longLink.empty()) {
+        entry.linkTarget = std::move(_longLink);
+    }
+
+    for (const auto &record : _pax) {
+        if (record.first == "path") {
+            entry.path = record.second;
+
+        } else if (record.first == "linkpath") {
+            entry.linkTarget = record.second;
+
+        } else if (record.first == "size") {
+            entry.size = std::strtoull(record.second.c_str(), nullptr, 10);
+
+        } else if (record.first == "uid") {
+            entry.uid = static_cast<uint32_t>(std::strtoul(record.second.c_str(), nullptr, 10));
+
+        } else if (record.first == "gid") {
+            entry.gid = static_cast<uint32_t>(std::strtoul(record.second.c_str(), nullptr, 10));
+
+        } else if (record.first == "uname") {
+            entry.userName = record.second;
+
+        } else if (record.first == "gname") {
+            entry.groupName = record.second;
+        }
+    }
+
+    // Links, devices, directories and fifos never carry data.
+    if ((type >= '1') && (type <= '6')) {
+        entry.size = 0;
+    }
+
+    entry.paxRecords = std::move(_pax);
+    entry.globalRecords = std::move(_global);
+    entry.rawHeader = std::move(_pendingHeader);
+    _longName.clear();
+    _longLink.clear();
+    _pax.clear();
+    _global.clear();
+    _pendingHeader.clear();
+
+    _entries += 1;
+    if (!_sink.OnEntry(entry)) {
+        return Fail(TarStatus::SinkFailed, "entry rejected");
+    }
+
+    _remaining = entry.size;
+    _padding = PaddingFor(entry.size);
+    if (_remaining == 0) {
+        return EndEntry();
+    }
+
+    _state = State::Data;
+    return TarStatus::Ok;
+}
+
+TarStatus TarParser::EndExtended()
+{
+    _state = State::Header;
+    switch (_extendedType) {
+    case 'L':
+        _longName = ReadString(_extended.data(), _extended.size());
+        break;
+
+    case 'K':
+        _longLink = ReadString(_extended.data(), _extended.size());
+        break;
+
+    case 'x':
+        if (!ParsePaxRecords(_extended, &_pax)) {
+            return Fail(TarStatus::Corrupt, "invalid pax header");
+        }
+
+        break;
+
+    case 'g':
+        // Global pax headers are carried along with the next entry, unapplied.
+        if (!ParsePaxRecords(_extended, &_global)) {
+            return Fail(TarStatus::Corrupt, "invalid pax global header");
+        }
+
+        break;
+
+    default:
+        break;
+    }
+
+    return TarStatus::Ok;
+}
+
+TarStatus TarParser::EndEntry()
+{
+    _state = State::Header;
+    if (!_sink.OnEntryEnd()) {
+        return Fail(TarStatus::SinkFailed, "entry rejected");
+    }
+
+    return TarStatus::Ok;
+}
+
+TarWriter::TarWriter(ByteSink &output) :
+    _output(output)
+{
+}
+
+bool TarWriter::OnEntry(const TarEntry &entry)
+{
+    _written = 0;
+    return _output.Write(entry.rawHeader.data(), entry.rawHeader.size());
+}
+
+bool TarWriter::OnData(const uint8_t *data, size_t size)
+{
+    _written += size;
+    return _output.Write(data, size);
+}
+
+bool TarWriter::OnEntryEnd()
+{
+    const size_t padding = PaddingFor(_written);
+    return (padding == 0) || _output.Write(ZeroBlock, padding);
+}
+
+bool TarWriter::OnArchiveEnd()
+{
+    return _output.Write(ZeroBlock, TarEntry::BlockSize) && _output.Write(ZeroBlock, TarEntry::BlockSize);
+}
@@ -0,0 +1,137 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Inflate.h"
+
+// One archive member, with GNU long names and pax extended headers applied.
+struct TarEntry
+{
+    static constexpr size_t BlockSize = 512;
+
+    std::string path;
+    std::string linkTarget;
+    char type = '0';
+    uint32_t mode = 0;
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    std::string userName;
+    std::string groupName;
+
+    // Records of the pax extended header (e.g. extended attributes), in archive order.
+    std::vector<std::pair<std::string, std::string>> paxRecords;
+
+    // Records of the pax global headers since the previous entry, which are
+    // left unapplied.
+    std::vector<std::pair<std::string, std::string>> globalRecords;
+
+    // The header blocks exactly as they appear in the archive, including any
+    // GNU long name and pax extended header blocks preceding the entry.
+    std::vector<uint8_t> rawHeader;
+
+    bool IsRegularFile() const { return (type == '0') || (type == '\0') || (type == '7'); }
+};
+
+// Builds the header blocks of an entry that was not parsed from an archive:
+// a ustar header, preceded by a pax extended header carrying the entry's pax
+// records and whatever does not fit the ustar fields.
+std::vector<uint8_t> EncodeTarHeader(const TarEntry &entry);
+
+// Builds a pax global header carrying the records, for a TarWriter to write
+// before the entries it applies to.
+std::vector<uint8_t> EncodeTarGlobalHeader(const std::vector<std::pair<std::string, std::string>> &records);
+
+// Receives the entries of a tar stream in archive order.
+class TarSink
+{
+  public:
+    virtual ~TarSink() = default;
+
+    // Each call returns false to abort the stream.
+    virtual bool OnEntry(const TarEntry &entry) = 0;
+    virtual bool OnData(const uint8_t *data, size_t size) = 0;
+    virtual bool OnEntryEnd() = 0;
+    virtual bool OnArchiveEnd() = 0;
+};
+
+enum class TarStatus
+{
+    Ok,
+    Corrupt,
+    SinkFailed,
+};
+
+// Incremental ustar/GNU/pax parser: bytes can be fed in chunks of any size.
+// Header checksums, numeric fields and the end-of-archive marker are validated.
+class TarParser
+{
+  public:
+    explicit TarParser(TarSink &sink);
+
+    TarStatus Feed(const uint8_t *data, size_t size);
+
+    // Checks that the stream ended on an end-of-archive marker.
+    TarStatus Finish();
+
+    const std::string &Error() const { return _error; }
+    uint64_t Entries() const { return _entries; }
+
+  private:
+    enum class State
+    {
+        Header,
+        Extended,
+        Data,
+        Padding,
+        Trailer,
+    };
+
+    TarStatus ParseHeader();
+    TarStatus EndExtended();
+    TarStatus EndEntry();
+    TarStatus Fail(TarStatus status, const char *error);
+
+    TarSink &_sink;
+    State _state = State::Header;
+    uint8_t _block[TarEntry::BlockSize];
+    size_t _blockFill = 0;
+    uint64_t _remaining = 0;
+    size_t _padding = 0;
+    char _extendedType = 0;
+    std::vector<uint8_t> _extended;
+    std::vector<uint8_t> _pendingHeader;
+    std::string _longName;
+    std::string _longLink;
+    std::vector<std::pair<std::string, std::string>> _pax;
+    std::vector<std::pair<std::string, std::string>> _global;
+    bool _zeroBlock = false;
+    uint64_t _entries = 0;
+    std::string _error;
+};
+
+// Serializes the entries it receives back into a tar stream.
+class TarWriter : public TarSink
+{
+  public:
+    explicit TarWriter(ByteSink &output);
+
+    bool OnEntry(const TarEntry &entry) override;
+    bool OnData(const uint8_t *data, size_t size) override;
+    bool OnEntryEnd() override;
+    bool OnArchiveEnd() override;
+
+  private:
+    ByteSink &_output;
+    uint64_t _written = 0;
+};
@@ -0,0 +1,178 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "Trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+    struct Event
+    {
+        const char *name;
+        uint64_t start;
+
+        // UINT64_MAX for an instant.
+        uint64_t duration;
+    };
+
+    // Written by its own thread only. Readers see the events below the
+    // head, which is published after the event it counts has been stored.
+    struct ThreadBuffer
+    {
+        uint32_t thread;
+        std::atomic<uint64_t> head{0};
+        Event events[Trace::Capacity];
+    };
+
+    std::atomic<bool> g_enabled{false};
+    std::chrono::steady_clock::time_point g_origin;
+
+    // Buffers are kept until the process exits, so that the events of
+    // threads that have ended still get written out.
+    std::mutex g_buffersLock;
+    std::vector<std::unique_ptr<ThreadBuffer>> g_buffers;
+    thread_local ThreadBuffer *t_buffer = nullptr;
+
+    ThreadBuffer *Buffer()
+    {
+        if (t_buffer == nullptr) {
+            auto buffer = std::make_unique<ThreadBuffer>();
+            std::lock_guard<std::mutex> lock(g_buffersLock);
+            buffer->thread = static_cast<uint32_t>(g_buffers.size() + 1);
+            t_buffer = buffer.get();
+            g_buffers.push_back(std::move(buffer));
+        }
+
+        return t_buffer;
+    }
+
+    void Record(const char *name, uint64_t start, uint64_t duration)
+    {
+        ThreadBuffer *buffer = Buffer();
+        const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+        buffer->events[head % Trace::Capacity] = Event{name, start, duration};
+        buffer->head.store(head + 1, std::memory_order_release);
+    }
+
+    unsigned long ProcessId()
+    {
+#ifdef _WIN32
+        return GetCurrentProcessId();
+#else
+        return static_cast<unsigned long>(::getpid());
+#endif
+    }
+
+    void AppendString(std::string *json, const char *text)
+    {
+        *json += '"';
+        for (const char *c = text; *c != '\0'; c += 1) {
+            if ((*c == '"') || (*c == '\\')) {
+                *json += '\\';
+                *json += *c;
+
+            } else if (static_cast<unsigned char>(*c) >= 0x20) {
+                *json += *c;
+            }
+        }
+
+        *json += '"';
+    }
+
+    // Chrome wants microseconds; three decimals keep the nanoseconds.
+    void AppendMicroseconds(std::string *json, uint64_t nanoseconds)
+    {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%llu.%03u", static_cast<unsigned long long>(nanoseconds / 1000), static_cast<unsigned int>(nanoseconds % 1000));
+        *json += text;
+    }
+}
+
+void Trace::Start()
+{
+    g_origin = std::chrono::steady_clock::now();
+    g_enabled.store(true);
+}
+
+bool Trace::Enabled()
+{
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+uint64_t Trace::Now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_origin).count());
+}
+
+void Trace::Instant(const char *name)
+{
+    if (Enabled()) {
+        Record(name, Now(), UINT64_MAX);
+    }
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (_start != NotTracing) {
+        Record(_name, _start, Trace::Now() - _start);
+    }
+}
+
+std::string Trace::ChromeJson()
+{
+    const std::string pid = std::to_string(ProcessId());
+    std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    std::lock_guard<std::mutex> lock(g_buffersLock);
+    for (const auto &buffer : g_buffers) {
+        const uint64_t head = buffer->head.load(std::memory_order_acquire);
+        const uint64_t oldest = (head > Capacity) ? head - Capacity : 0;
+        for (uint64_t index = oldest; index < head; index += 1) {
+            const Event &event = buffer->events[index % Capacity];
+            json += first ? "\n" : ",\n";
+            json += "{\"name\":";
+            AppendString(&json, event.name);
+            json += ",\"cat\":\"launcher\",\"ph\":";
+            json += (event.duration == UINT64_MAX) ? "\"i\",\"s\":\"t\"" : "\"X\"";
+            json += ",\"ts\":";
+            AppendMicroseconds(&json, event.start);
+            if (event.duration != UINT64_MAX) {
+                json += ",\"dur\":";
+                AppendMicroseconds(&json, event.duration);
+            }
+
+            json += ",\"pid\":" + pid + ",\"tid\":" + std::to_string(buffer->thread) + "}";
+            first = false;
+        }
+    }
+
+    return json + "\n]}\n";
+}
+
+bool Trace::WriteChromeJson(const std::filesystem::path &path)
+{
+    const std::string json = ChromeJson();
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(json.data(), static_cast<std::streamsize>(json.size()));
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,63 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+// Spans of time spent in the launcher, for finding out where install and
+// launch time goes on machines where it is slow. Tracing is off unless
+// started; a span then costs two clock reads and a store into a ring buffer
+// of the thread it ends on, with no lock, and no allocation after the
+// thread's first. Once done, the events are written out in the Chrome
+// trace_event format, which chrome://tracing and Perfetto open.
+//
+// Names are not copied: they must be string literals, or otherwise outlive
+// the trace.
+namespace Trace
+{
+    // How many events each thread keeps; older ones are overwritten.
+    constexpr size_t Capacity = 8192;
+
+    void Start();
+    bool Enabled();
+
+    // Marks a moment rather than a span.
+    void Instant(const char *name);
+
+    // Writes the events recorded so far, from every thread, as a JSON trace.
+    // Meant for once spans are over: a thread still recording may have its
+    // oldest event overwritten as it is read.
+    std::string ChromeJson();
+    bool WriteChromeJson(const std::filesystem::path &path);
+
+    // Nanoseconds since tracing started.
+    uint64_t Now();
+}
+
+// Records the time from its construction to its destruction as a span.
+class TraceSpan
+{
+  public:
+    explicit TraceSpan(const char *name) :
+        _name(name),
+        _start(Trace::Enabled() ? Trace::Now() : NotTracing)
+    {
+    }
+
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+  private:
+    static constexpr uint64_t NotTracing = UINT64_MAX;
+
+    const char *_name;
+    uint64_t _start;
+};
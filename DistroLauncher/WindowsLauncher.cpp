@@ -0,0 +1,520 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "stdafx.h"
+#include "PipeCapture.h"
+
+#include <algorithm>
+
+namespace {
+    std::wstring FromUtf8(const std::string &text)
+    {
+        if (text.empty()) {
+            return std::wstring();
+        }
+
+        const int size = MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), nullptr, 0);
+        std::wstring converted(static_cast<size_t>(size), L'\0');
+        MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), converted.data(), size);
+        return converted;
+    }
+
+    void WriteAll(HANDLE handle, const std::string &data)
+    {
+        for (size_t offset = 0; offset < data.size();) {
+            DWORD written;
+            if (!WriteFile(handle, data.data() + offset, static_cast<DWORD>(data.size() - offset), &written, nullptr)) {
+                return;
+            }
+
+            offset += written;
+        }
+    }
+
+    DWORD MessageId(LauncherMessage message)
+    {
+        switch (message) {
+        case LauncherMessage::Usage:
+            return MSG_USAGE;
+        case LauncherMessage::Installing:
+            return MSG_STATUS_INSTALLING;
+        case LauncherMessage::InstallSuccess:
+            return MSG_INSTALL_SUCCESS;
+        case LauncherMessage::CreateUserPrompt:
+            return MSG_CREATE_USER_PROMPT;
+        case LauncherMessage::EnterUserName:
+            return MSG_ENTER_USERNAME;
+        case LauncherMessage::InstallAlreadyExists:
+            return MSG_INSTALL_ALREADY_EXISTS;
+        case LauncherMessage::EnableVirtualization:
+            return MSG_ENABLE_VIRTUALIZATION;
+        case LauncherMessage::BatchExitCode:
+            return MSG_BATCH_EXIT_CODE;
+        case LauncherMessage::BatchTimedOut:
+            return MSG_BATCH_TIMED_OUT;
+        case LauncherMessage::BatchLaunchFailed:
+            return MSG_BATCH_LAUNCH_FAILED;
+        case LauncherMessage::BatchSummary:
+            return MSG_BATCH_SUMMARY;
+        case LauncherMessage::ProvisionInvalid:
+            return MSG_PROVISION_INVALID;
+        case LauncherMessage::ProvisionFailed:
+            return MSG_PROVISION_FAILED;
+        case LauncherMessage::SnapshotInvalid:
+            return MSG_SNAPSHOT_INVALID;
+        case LauncherMessage::SnapshotFailed:
+            return MSG_SNAPSHOT_FAILED;
+        case LauncherMessage::SnapshotSuccess:
+            return MSG_SNAPSHOT_SUCCESS;
+        case LauncherMessage::CloneAlreadyInstalled:
+            return MSG_CLONE_ALREADY_INSTALLED;
+        }
+
+        return MSG_USAGE;
+    }
+
+    // The values of message arguments; the text inserts are kept in texts,
+    // which must outlive the values that point at them.
+    std::vector<MessageValue> Values(const std::vector<MessageArgument> &arguments, std::vector<std::wstring> *texts)
+    {
+        texts->reserve(arguments.size());
+        std::vector<MessageValue> values;
+        values.reserve(arguments.size());
+        for (const MessageArgument &argument : arguments) {
+            if (argument.isText) {
+                texts->push_back(FromUtf8(argument.text));
+                values.emplace_back(texts->back().c_str());
+
+            } else {
+                values.emplace_back(argument.number);
+            }
+        }
+
+        return values;
+    }
+
+    // Whether input or output goes anywhere but the console.
+    bool Redirected()
+    {
+        return (GetFileType(GetStdHandle(STD_INPUT_HANDLE)) != FILE_TYPE_CHAR) ||
+               (GetFileType(GetStdHandle(STD_OUTPUT_HANDLE)) != FILE_TYPE_CHAR);
+    }
+
+    // A standard handle as wsl.exe can inherit it: the handle itself, or a
+    // duplicate of it when it was not made inheritable.
+    class StandardHandle
+    {
+      public:
+        explicit StandardHandle(DWORD which) :
+            _handle(GetStdHandle(which))
+        {
+            DWORD flags;
+            if ((_handle != nullptr) && (_handle != INVALID_HANDLE_VALUE) && GetHandleInformation(_handle, &flags) &&
+                ((flags & HANDLE_FLAG_INHERIT) == 0) &&
+                DuplicateHandle(GetCurrentProcess(), _handle, GetCurrentProcess(), &_duplicate, 0, true, DUPLICATE_SAME_ACCESS)) {
+
+                _handle = _duplicate;
+            }
+        }
+
+        ~StandardHandle()
+        {
+            if (_duplicate != nullptr) {
+                CloseHandle(_duplicate);
+            }
+        }
+
+        StandardHandle(const StandardHandle &) = delete;
+        StandardHandle &operator=(const StandardHandle &) = delete;
+
+        HANDLE Get() const { return _handle; }
+
+      private:
+        HANDLE _handle;
+        HANDLE _duplicate = nullptr;
+    };
+}
+
+void WindowsConsole::Print(LauncherMessage message, const std::vector<MessageArgument> &arguments)
+{
+    std::vector<std::wstring> texts;
+    const std::vector<MessageValue> values = Values(arguments, &texts);
+    Helpers::PrintMessageValues(MessageId(message), values.data(), values.size());
+}
+
+std::wstring WindowsConsole::Format(LauncherMessage message, const std::vector<MessageArgument> &arguments)
+{
+    std::vector<std::wstring> texts;
+    const std::vector<MessageValue> values = Values(arguments, &texts);
+    return Helpers::MessageText(MessageId(message), values.data(), values.size());
+}
+
+void WindowsConsole::SetJsonOutput(bool json)
+{
+    Helpers::SetJsonOutput(json);
+}
+
+void WindowsConsole::PrintError(LauncherResult result)
+{
+    Helpers::PrintErrorMessage(result);
+}
+
+void WindowsConsole::Write(Stream stream, const std::string &data)
+{
+    // Output is printed with the messages. Error output is written as it
+    // comes, after what was printed before it.
+    if (stream == Stream::Output) {
+        Helpers::Output().AppendUtf8(data.data(), data.size());
+        return;
+    }
+
+    Helpers::Output().Flush();
+    WriteAll(GetStdHandle(STD_ERROR_HANDLE), data);
+}
+
+void WindowsConsole::Flush()
+{
+    Helpers::Output().Flush();
+}
+
+std::wstring WindowsConsole::ReadWord(LauncherMessage prompt, size_t maxCharacters, bool showPrompt)
+{
+    return Helpers::GetUserInput(showPrompt ? MessageId(prompt) : 0, static_cast<DWORD>(maxCharacters));
+}
+
+void WindowsConsole::WaitForKey()
+{
+    Helpers::PromptForInput();
+}
+
+WindowsWsl::~WindowsWsl()
+{
+    if (_input != INVALID_HANDLE_VALUE) {
+        CloseHandle(_input);
+    }
+}
+
+bool WindowsWsl::IsOptionalComponentInstalled()
+{
+    return g_wslApi.WslIsOptionalComponentInstalled();
+}
+
+bool WindowsWsl::IsDistributionRegistered()
+{
+    return g_wslApi.WslIsDistributionRegistered();
+}
+
+LauncherResult WindowsWsl::RegisterDistribution()
+{
+    return g_wslApi.WslRegisterDistribution();
+}
+
+LauncherResult WindowsWsl::RegisterSnapshot(const std::filesystem::path &snapshot)
+{
+    return g_wslApi.WslRegisterDistribution(snapshot);
+}
+
+LauncherResult WindowsWsl::ConfigureDistribution(uint32_t defaultUid)
+{
+    // The flags are set along with the user, so they are set to what they
+    // are: the user may have changed them since the installation.
+    ULONG version;
+    ULONG uid;
+    WSL_DISTRIBUTION_FLAGS flags;
+    std::vector<std::string> environment;
+    const HRESULT hr = g_wslApi.WslGetDistributionConfiguration(&version, &uid, &flags, &environment);
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    return g_wslApi.WslConfigureDistribution(defaultUid, flags);
+}
+
+LauncherResult WindowsWsl::GetDefaultUid(uint32_t *defaultUid)
+{
+    ULONG version;
+    ULONG uid;
+    WSL_DISTRIBUTION_FLAGS flags;
+    std::vector<std::string> environment;
+    const HRESULT hr = g_wslApi.WslGetDistributionConfiguration(&version, &uid, &flags, &environment);
+    if (SUCCEEDED(hr)) {
+        *defaultUid = uid;
+    }
+
+    return hr;
+}
+
+LauncherResult WindowsWsl::LaunchInteractive(const std::wstring &command, bool useCurrentWorkingDirectory, uint32_t *exitCode)
+{
+    DWORD code = *exitCode;
+    const HRESULT hr = g_wslApi.WslLaunchInteractive(command.c_str(), useCurrentWorkingDirectory, &code);
+    *exitCode = code;
+    return hr;
+}
+
+LauncherResult WindowsWsl::LaunchForOutput(const std::wstring &command, std::string *output, uint32_t *exitCode, std::chrono::milliseconds timeout)
+{
+    PipeCapture capture;
+    if (!capture.Open(true, false)) {
+        return HRESULT_FROM_WIN32(ERROR_CANNOT_MAKE);
+    }
+
+    HANDLE child;
+    HRESULT hr = g_wslApi.WslLaunch(command.c_str(), true, GetStdHandle(STD_INPUT_HANDLE), capture.OutputWriter(), GetStdHandle(STD_ERROR_HANDLE), &child);
+
+    // The child has its own write end, so reads stop once it exits.
+    capture.CloseWriters();
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const CaptureStatus status = capture.Read(timeout);
+    if (status == CaptureStatus::Ok) {
+        DWORD wait = INFINITE;
+        if (timeout != PipeCapture::Forever) {
+            const auto left = timeout - std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            wait = static_cast<DWORD>(std::max<long long>(0, left.count()));
+        }
+
+        DWORD code;
+        if (WaitForSingleObject(child, wait) != WAIT_OBJECT_0) {
+            hr = HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+
+        } else if (GetExitCodeProcess(child, &code) == false) {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+
+        } else {
+            *exitCode = code;
+        }
+
+    } else {
+        hr = HRESULT_FROM_WIN32((status == CaptureStatus::TimedOut) ? ERROR_TIMEOUT : ERROR_READ_FAULT);
+    }
+
+    if (FAILED(hr)) {
+        TerminateProcess(child, 1);
+    }
+
+    CloseHandle(child);
+    *output = capture.Output();
+    return hr;
+}
+
+LauncherResult WindowsWsl::LaunchForStreamAsRoot(const std::wstring &command, ByteSink &output, uint32_t *exitCode)
+{
+    return LaunchPiped(command, false, output, exitCode);
+}
+
+LauncherResult WindowsWsl::RunCommandForStream(const std::wstring &command, ByteSink &output, uint32_t *exitCode)
+{
+    return LaunchPiped(command, true, output, exitCode);
+}
+
+LauncherResult WindowsWsl::LaunchPiped(const std::wstring &command, bool run, ByteSink &output, uint32_t *exitCode)
+{
+    HANDLE reader;
+    HANDLE child;
+    {
+        // Launched one command at a time, for the reasons Run gives.
+        std::lock_guard<std::mutex> lock(_launchLock);
+        SECURITY_ATTRIBUTES sa{sizeof(sa), nullptr, true};
+        HANDLE writer;
+        if (!CreatePipe(&reader, &writer, &sa, 1 << 16)) {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        SetHandleInformation(reader, HANDLE_FLAG_INHERIT, 0);
+        const StandardHandle input(STD_INPUT_HANDLE);
+        const StandardHandle error(STD_ERROR_HANDLE);
+        const HRESULT hr = run ? g_wslApi.WslLaunch(command.c_str(), true, input.Get(), writer, error.Get(), &child)
+                               : LaunchAsRoot(command, writer, error.Get(), &child);
+        CloseHandle(writer);
+        if (FAILED(hr)) {
+            CloseHandle(reader);
+            return hr;
+        }
+    }
+
+    // The pipe breaks once the command has closed its output.
+    HRESULT hr = S_OK;
+    std::vector<uint8_t> buffer(1 << 20);
+    for (;;) {
+        DWORD read;
+        if (!ReadFile(reader, buffer.data(), static_cast<DWORD>(buffer.size()), &read, nullptr)) {
+            const DWORD error = GetLastError();
+            hr = (error == ERROR_BROKEN_PIPE) ? S_OK : HRESULT_FROM_WIN32(error);
+            break;
+        }
+
+        if ((read > 0) && !output.Write(buffer.data(), read)) {
+            hr = HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+            break;
+        }
+    }
+
+    CloseHandle(reader);
+    if (FAILED(hr)) {
+        TerminateProcess(child, 1);
+    }
+
+    DWORD code;
+    WaitForSingleObject(child, INFINITE);
+    if (GetExitCodeProcess(child, &code) == false) {
+        hr = SUCCEEDED(hr) ? HRESULT_FROM_WIN32(GetLastError()) : hr;
+
+    } else {
+        *exitCode = code;
+    }
+
+    CloseHandle(child);
+    return hr;
+}
+
+HRESULT WindowsWsl::LaunchAsRoot(const std::wstring &command, HANDLE output, HANDLE error, HANDLE *child)
+{
+    // WslLaunch runs commands as the default user only, and wsl.exe, which
+    // it starts, can run them as another: the command line after -- goes to
+    // the user's shell as it is, as WslLaunch's command does.
+    wchar_t system[MAX_PATH];
+    const UINT length = GetSystemDirectoryW(system, MAX_PATH);
+    if ((length == 0) || (length >= MAX_PATH)) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    const std::wstring application = std::wstring(system, length) + L"\\wsl.exe";
+    std::wstring commandLine = L"wsl.exe --distribution " + DistributionInfo::Name + L" --user root -- " + command;
+    STARTUPINFOW startup{};
+    startup.cb = sizeof(startup);
+    startup.dwFlags = STARTF_USESTDHANDLES;
+    startup.hStdInput = NullInput();
+    startup.hStdOutput = output;
+    startup.hStdError = error;
+    PROCESS_INFORMATION process{};
+    if (!CreateProcessW(application.c_str(), commandLine.data(), nullptr, nullptr, true, 0, nullptr, nullptr, &startup, &process)) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    CloseHandle(process.hThread);
+    *child = process.hProcess;
+    return S_OK;
+}
+
+LauncherResult WindowsWsl::RunCommand(const std::wstring &command, uint32_t *exitCode)
+{
+    HRESULT hr = HRESULT_FROM_WIN32(ERROR_CONNECTION_REFUSED);
+    if (CommandRelay::Enabled()) {
+        DWORD code = *exitCode;
+        hr = CommandRelay::Run(command, &code);
+        *exitCode = code;
+    }
+
+    // Without a server to run it, the command gets a launch of its own.
+    if (hr == HRESULT_FROM_WIN32(ERROR_CONNECTION_REFUSED)) {
+        hr = Redirected() ? LaunchRedirected(command, exitCode) : LaunchInteractive(command, true, exitCode);
+    }
+
+    return hr;
+}
+
+LauncherResult WindowsWsl::LaunchRedirected(const std::wstring &command, uint32_t *exitCode)
+{
+    // The standard handles go to wsl.exe as they are, so that what is piped
+    // in and out never passes through the launcher, nor through the console
+    // and its text translation.
+    const StandardHandle input(STD_INPUT_HANDLE);
+    const StandardHandle output(STD_OUTPUT_HANDLE);
+    const StandardHandle error(STD_ERROR_HANDLE);
+    HANDLE child;
+    HRESULT hr = g_wslApi.WslLaunch(command.c_str(), true, input.Get(), output.Get(), error.Get(), &child);
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    DWORD code;
+    WaitForSingleObject(child, INFINITE);
+    if (GetExitCodeProcess(child, &code) == false) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+
+    } else {
+        *exitCode = code;
+    }
+
+    CloseHandle(child);
+    return hr;
+}
+
+BatchResult WindowsWsl::Run(const std::string &command, std::chrono::milliseconds timeout)
+{
+    BatchResult result;
+    PipeCapture capture;
+    HANDLE child;
+    {
+        // WslLaunch starts wsl.exe inheriting every inheritable handle of the
+        // launcher. Were pipes for another command open at that moment, this
+        // child would hold their write ends, and reading that command's output
+        // would not end before this one exits. Creating the pipes, launching
+        // and closing the parent's write ends are therefore done one command
+        // at a time.
+        std::lock_guard<std::mutex> lock(_launchLock);
+        if (!capture.Open(true, true)) {
+            result.error = capture.Error();
+            return result;
+        }
+
+        const HRESULT hr = g_wslApi.WslLaunch(FromUtf8(command).c_str(), true, NullInput(), capture.OutputWriter(), capture.ErrorWriter(), &child);
+        capture.CloseWriters();
+        if (FAILED(hr)) {
+            char message[64];
+            snprintf(message, sizeof(message), "WslLaunch failed with 0x%08lx", static_cast<unsigned long>(hr));
+            result.error = message;
+            return result;
+        }
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const CaptureStatus status = capture.Read(timeout);
+    result.status = (status == CaptureStatus::Ok) ? BatchStatus::Ok :
+                    (status == CaptureStatus::TimedOut) ? BatchStatus::TimedOut : BatchStatus::IoError;
+
+    if (result.status == BatchStatus::Ok) {
+        DWORD wait = INFINITE;
+        if (timeout != PipeCapture::Forever) {
+            const auto left = timeout - std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            wait = static_cast<DWORD>(std::max<long long>(0, left.count()));
+        }
+
+        DWORD exitCode;
+        if (WaitForSingleObject(child, wait) != WAIT_OBJECT_0) {
+            result.status = BatchStatus::TimedOut;
+
+        } else if (GetExitCodeProcess(child, &exitCode) == false) {
+            result.status = BatchStatus::IoError;
+
+        } else {
+            result.exitCode = exitCode;
+        }
+    }
+
+    if (result.status != BatchStatus::Ok) {
+        result.error = capture.Error();
+        TerminateProcess(child, 1);
+    }
+
+    CloseHandle(child);
+    result.output = capture.Output();
+    result.errorOutput = capture.ErrorOutput();
+    return result;
+}
+
+HANDLE WindowsWsl::NullInput()
+{
+    if (_input == INVALID_HANDLE_VALUE) {
+        SECURITY_ATTRIBUTES sa{sizeof(sa), nullptr, true};
+        _input = CreateFileW(L"NUL", GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+    }
+
+    return _input;
+}
@@ -0,0 +1,74 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+// The console of the launcher process, with the messages of messages.mc.
+class WindowsConsole : public LauncherConsole
+{
+  public:
+    void Print(LauncherMessage message, const std::vector<MessageArgument> &arguments = {}) override;
+    std::wstring Format(LauncherMessage message, const std::vector<MessageArgument> &arguments = {}) override;
+    void SetJsonOutput(bool json) override;
+    void PrintError(LauncherResult result) override;
+    void Write(Stream stream, const std::string &data) override;
+    std::wstring ReadWord(LauncherMessage prompt, size_t maxCharacters, bool showPrompt = true) override;
+    void WaitForKey() override;
+    void Flush() override;
+};
+
+// WSL through wslapi.dll, for DistributionInfo::Name.
+class WindowsWsl : public WslBackend
+{
+  public:
+    ~WindowsWsl() override;
+
+    bool IsOptionalComponentInstalled() override;
+    bool IsDistributionRegistered() override;
+    LauncherResult RegisterDistribution() override;
+    LauncherResult RegisterSnapshot(const std::filesystem::path &snapshot) override;
+    LauncherResult ConfigureDistribution(uint32_t defaultUid) override;
+    LauncherResult GetDefaultUid(uint32_t *defaultUid) override;
+    LauncherResult LaunchInteractive(const std::wstring &command, bool useCurrentWorkingDirectory, uint32_t *exitCode) override;
+    LauncherResult LaunchForOutput(const std::wstring &command,
+                                   std::string *output,
+                                   uint32_t *exitCode,
+                                   std::chrono::milliseconds timeout) override;
+
+    // Reads the output through a pipe of its own rather than a PipeCapture,
+    // which keeps everything it reads.
+    LauncherResult LaunchForStreamAsRoot(const std::wstring &command, ByteSink &output, uint32_t *exitCode) override;
+
+    // Through the command server when it is enabled; see CommandRelay.h.
+    // Otherwise, when input or output is redirected, the command gets the
+    // launcher's standard handles rather than the console.
+    LauncherResult RunCommand(const std::wstring &command, uint32_t *exitCode) override;
+
+    // Never through the command server, whose output is written as it comes.
+    LauncherResult RunCommandForStream(const std::wstring &command, ByteSink &output, uint32_t *exitCode) override;
+
+    // Runs a batch command in a WSL launch of its own, with its input from NUL
+    // so that commands running at once do not compete for the console.
+    BatchResult Run(const std::string &command, std::chrono::milliseconds timeout) override;
+
+  private:
+    // Runs a command with the launcher's standard handles; see RunCommand.
+    LauncherResult LaunchRedirected(const std::wstring &command, uint32_t *exitCode);
+
+    // Runs a command with its output read through a pipe into the sink: for
+    // `run`, in the current working directory and with the launcher's input,
+    // otherwise as root and with its input from NUL.
+    LauncherResult LaunchPiped(const std::wstring &command, bool run, ByteSink &output, uint32_t *exitCode);
+
+    // Starts wsl.exe running a command as root, with its input from NUL;
+    // called with _launchLock held.
+    HRESULT LaunchAsRoot(const std::wstring &command, HANDLE output, HANDLE error, HANDLE *child);
+
+    // NUL, opened the first time it is needed; called with _launchLock held.
+    HANDLE NullInput();
+
+    HANDLE _input = INVALID_HANDLE_VALUE;
+    std::mutex _launchLock;
+};
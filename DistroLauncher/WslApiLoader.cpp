@@ -5,47 +5,89 @@
 
 #include "stdafx.h"
 #include "WslApiLoader.h"
+#include "Trace.h"
 
 WslApiLoader::WslApiLoader(const std::wstring& distributionName) :
     _distributionName(distributionName)
 {
-    _wslApiDll = LoadLibraryEx(L"wslapi.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32);
-    if (_wslApiDll != nullptr) {
-        _isDistributionRegistered = (WSL_IS_DISTRIBUTION_REGISTERED)GetProcAddress(_wslApiDll, "WslIsDistributionRegistered");
-        _registerDistribution = (WSL_REGISTER_DISTRIBUTION)GetProcAddress(_wslApiDll, "WslRegisterDistribution");
-        _configureDistribution = (WSL_CONFIGURE_DISTRIBUTION)GetProcAddress(_wslApiDll, "WslConfigureDistribution");
-        _launchInteractive = (WSL_LAUNCH_INTERACTIVE)GetProcAddress(_wslApiDll, "WslLaunchInteractive");
-        _launch = (WSL_LAUNCH)GetProcAddress(_wslApiDll, "WslLaunch");
-    }
 }
 
 WslApiLoader::~WslApiLoader()
 {
-    if (_wslApiDll != nullptr) {
-        FreeLibrary(_wslApiDll);
+    if (_functions.dll != nullptr) {
+        FreeLibrary(_functions.dll);
     }
 }
 
+const WslApiLoader::Functions &WslApiLoader::Api()
+{
+    std::call_once(_loadOnce, [this] {
+        TraceSpan span("LoadLibrary wslapi.dll");
+        const auto start = std::chrono::steady_clock::now();
+        _functions.dll = LoadLibraryEx(L"wslapi.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32);
+        if (_functions.dll != nullptr) {
+            _functions.isDistributionRegistered = (WSL_IS_DISTRIBUTION_REGISTERED)GetProcAddress(_functions.dll, "WslIsDistributionRegistered");
+            _functions.registerDistribution = (WSL_REGISTER_DISTRIBUTION)GetProcAddress(_functions.dll, "WslRegisterDistribution");
+            _functions.configureDistribution = (WSL_CONFIGURE_DISTRIBUTION)GetProcAddress(_functions.dll, "WslConfigureDistribution");
+            _functions.getDistributionConfiguration = (WSL_GET_DISTRIBUTION_CONFIGURATION)GetProcAddress(_functions.dll, "WslGetDistributionConfiguration");
+            _functions.launchInteractive = (WSL_LAUNCH_INTERACTIVE)GetProcAddress(_functions.dll, "WslLaunchInteractive");
+            _functions.launch = (WSL_LAUNCH)GetProcAddress(_functions.dll, "WslLaunch");
+        }
+
+        _loadTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        _loaded.store(true);
+    });
+
+    return _functions;
+}
+
 BOOL WslApiLoader::WslIsOptionalComponentInstalled()
 {
-    return ((_wslApiDll != nullptr) && 
-            (_isDistributionRegistered != nullptr) &&
-            (_registerDistribution != nullptr) &&
-            (_configureDistribution != nullptr) &&
-            (_launchInteractive != nullptr) &&
-            (_launch != nullptr));
+    TraceSpan span("WslApiLoader::WslIsOptionalComponentInstalled");
+
+    const Functions &api = Api();
+    return ((api.dll != nullptr) &&
+            (api.isDistributionRegistered != nullptr) &&
+            (api.registerDistribution != nullptr) &&
+            (api.configureDistribution != nullptr) &&
+            (api.getDistributionConfiguration != nullptr) &&
+            (api.launchInteractive != nullptr) &&
+            (api.launch != nullptr));
 }
 
 BOOL WslApiLoader::WslIsDistributionRegistered()
 {
-    return _isDistributionRegistered(_distributionName.c_str());
+    TraceSpan span("WslApiLoader::WslIsDistributionRegistered");
+
+    return Api().isDistributionRegistered(_distributionName.c_str());
 }
 
-HRESULT WslApiLoader::WslRegisterDistribution()
+HRESULT WslApiLoader::WslRegisterDistribution(const std::filesystem::path &snapshot)
 {
-    HRESULT hr = _registerDistribution(_distributionName.c_str(), L"install.tar.gz");
+    TraceSpan span("WslApiLoader::WslRegisterDistribution");
+
+    // A snapshot is a tar.gz WSL takes as it is, once the clone verb has
+    // checked its record. The bundled rootfs is decompressed, validated and
+    // filtered before being handed over.
+    std::wstring tarPath;
+    if (!snapshot.empty()) {
+        std::error_code error;
+        tarPath = std::filesystem::absolute(snapshot, error).wstring();
+
+    } else {
+        const HRESULT hr = Rootfs::Stage(&tarPath);
+        if (FAILED(hr)) {
+            return hr;
+        }
+    }
+
+    HRESULT hr = Api().registerDistribution(_distributionName.c_str(), tarPath.c_str());
     if (FAILED(hr)) {
-        Helpers::PrintMessage(MSG_WSL_REGISTER_DISTRIBUTION_FAILED, hr);
+        Helpers::PrintMessage<MSG_WSL_REGISTER_DISTRIBUTION_FAILED>(hr);
+    }
+
+    if (snapshot.empty()) {
+        Rootfs::Cleanup(tarPath);
     }
 
     return hr;
@@ -53,19 +95,49 @@ HRESULT WslApiLoader::WslRegisterDistribution()
 
 HRESULT WslApiLoader::WslConfigureDistribution(ULONG defaultUID, WSL_DISTRIBUTION_FLAGS wslDistributionFlags)
 {
-    HRESULT hr = _configureDistribution(_distributionName.c_str(), defaultUID, wslDistributionFlags);
+    TraceSpan span("WslApiLoader::WslConfigureDistribution");
+
+    HRESULT hr = Api().configureDistribution(_distributionName.c_str(), defaultUID, wslDistributionFlags);
     if (FAILED(hr)) {
-        Helpers::PrintMessage(MSG_WSL_CONFIGURE_DISTRIBUTION_FAILED, hr);
+        Helpers::PrintMessage<MSG_WSL_CONFIGURE_DISTRIBUTION_FAILED>(hr);
     }
 
     return hr;
 }
 
+HRESULT WslApiLoader::WslGetDistributionConfiguration(ULONG *distributionVersion,
+                                                      ULONG *defaultUID,
+                                                      WSL_DISTRIBUTION_FLAGS *wslDistributionFlags,
+                                                      std::vector<std::string> *defaultEnvironmentVariables)
+{
+    TraceSpan span("WslApiLoader::WslGetDistributionConfiguration");
+
+    PSTR *environment = nullptr;
+    ULONG count = 0;
+    HRESULT hr = Api().getDistributionConfiguration(_distributionName.c_str(), distributionVersion, defaultUID, wslDistributionFlags, &environment, &count);
+    if (FAILED(hr)) {
+        Helpers::PrintMessage<MSG_WSL_GET_DISTRIBUTION_CONFIGURATION_FAILED>(hr);
+        return hr;
+    }
+
+    // The strings and the array holding them are allocated by WSL.
+    defaultEnvironmentVariables->clear();
+    for (ULONG index = 0; index < count; index += 1) {
+        defaultEnvironmentVariables->emplace_back(environment[index]);
+        CoTaskMemFree(environment[index]);
+    }
+
+    CoTaskMemFree(environment);
+    return hr;
+}
+
 HRESULT WslApiLoader::WslLaunchInteractive(PCWSTR command, BOOL useCurrentWorkingDirectory, DWORD *exitCode)
 {
-    HRESULT hr = _launchInteractive(_distributionName.c_str(), command, useCurrentWorkingDirectory, exitCode);
+    TraceSpan span("WslApiLoader::WslLaunchInteractive");
+
+    HRESULT hr = Api().launchInteractive(_distributionName.c_str(), command, useCurrentWorkingDirectory, exitCode);
     if (FAILED(hr)) {
-        Helpers::PrintMessage(MSG_WSL_LAUNCH_INTERACTIVE_FAILED, command, hr);
+        Helpers::PrintMessage<MSG_WSL_LAUNCH_INTERACTIVE_FAILED>(command, hr);
     }
 
     return hr;
@@ -73,9 +145,11 @@ HRESULT WslApiLoader::WslLaunchInteractive(PCWSTR command, BOOL useCurrentWorkin
 
 HRESULT WslApiLoader::WslLaunch(PCWSTR command, BOOL useCurrentWorkingDirectory, HANDLE stdIn, HANDLE stdOut, HANDLE stdErr, HANDLE *process)
 {
-    HRESULT hr = _launch(_distributionName.c_str(), command, useCurrentWorkingDirectory, stdIn, stdOut, stdErr, process);
+    TraceSpan span("WslApiLoader::WslLaunch");
+
+    HRESULT hr = Api().launch(_distributionName.c_str(), command, useCurrentWorkingDirectory, stdIn, stdOut, stdErr, process);
     if (FAILED(hr)) {
-        Helpers::PrintMessage(MSG_WSL_LAUNCH_FAILED, command, hr);
+        Helpers::PrintMessage<MSG_WSL_LAUNCH_FAILED>(command, hr);
     }
 
     return hr;
@@ -5,6 +5,11 @@
 
 #pragma once
 #include <wslapi.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
 
 // This error definition is present in the Spring Creators Update SDK.
 #ifndef ERROR_LINUX_SUBSYSTEM_NOT_PRESENT
@@ -18,6 +23,10 @@ typedef HRESULT (STDAPICALLTYPE* WSL_GET_DISTRIBUTION_CONFIGURATION)(PCWSTR, ULO
 typedef HRESULT (STDAPICALLTYPE* WSL_LAUNCH_INTERACTIVE)(PCWSTR, PCWSTR, BOOL, DWORD *);
 typedef HRESULT (STDAPICALLTYPE* WSL_LAUNCH)(PCWSTR, PCWSTR, BOOL, HANDLE, HANDLE, HANDLE, HANDLE *);
 
+// Calls into wslapi.dll for one distribution. The DLL is loaded and its entry
+// points looked up the first time any of them is needed, once, from whichever
+// thread gets there first; commands that never need WSL, like help, never
+// load it.
 class WslApiLoader
 {
   public:
@@ -28,11 +37,18 @@ class WslApiLoader
 
     BOOL WslIsDistributionRegistered();
 
-    HRESULT WslRegisterDistribution();
+    // Registers the distribution from the rootfs the package ships, or
+    // from a snapshot written by the launcher.
+    HRESULT WslRegisterDistribution(const std::filesystem::path &snapshot = {});
 
     HRESULT WslConfigureDistribution(ULONG defaultUID,
                                      WSL_DISTRIBUTION_FLAGS wslDistributionFlags);
 
+    HRESULT WslGetDistributionConfiguration(ULONG *distributionVersion,
+                                            ULONG *defaultUID,
+                                            WSL_DISTRIBUTION_FLAGS *wslDistributionFlags,
+                                            std::vector<std::string> *defaultEnvironmentVariables);
+
     HRESULT WslLaunchInteractive(PCWSTR command,
                                  BOOL useCurrentWorkingDirectory,
                                  DWORD *exitCode);
@@ -44,14 +60,30 @@ class WslApiLoader
                       HANDLE stdErr,
                       HANDLE *process);
 
+    // Whether the DLL has been loaded yet, and what loading it and looking
+    // up its entry points took, for startup timing.
+    bool IsLoaded() const { return _loaded.load(); }
+    std::chrono::microseconds LoadTime() const { return _loadTime; }
+
   private:
+    struct Functions
+    {
+        HMODULE dll = nullptr;
+        WSL_IS_DISTRIBUTION_REGISTERED isDistributionRegistered = nullptr;
+        WSL_REGISTER_DISTRIBUTION registerDistribution = nullptr;
+        WSL_CONFIGURE_DISTRIBUTION configureDistribution = nullptr;
+        WSL_GET_DISTRIBUTION_CONFIGURATION getDistributionConfiguration = nullptr;
+        WSL_LAUNCH_INTERACTIVE launchInteractive = nullptr;
+        WSL_LAUNCH launch = nullptr;
+    };
+
+    const Functions &Api();
+
     std::wstring _distributionName;
-    HMODULE _wslApiDll;
-    WSL_IS_DISTRIBUTION_REGISTERED _isDistributionRegistered;
-    WSL_REGISTER_DISTRIBUTION _registerDistribution;
-    WSL_CONFIGURE_DISTRIBUTION _configureDistribution;
-    WSL_LAUNCH_INTERACTIVE _launchInteractive;
-    WSL_LAUNCH _launch;
+    std::once_flag _loadOnce;
+    Functions _functions;
+    std::atomic<bool> _loaded{false};
+    std::chrono::microseconds _loadTime{0};
 };
 
 extern WslApiLoader g_wslApi;
@@ -0,0 +1,792 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "Xz.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace {
+    const uint8_t StreamMagic[6] = {0xfd, '7', 'z', 'X', 'Z', 0x00};
+    constexpr size_t StreamHeaderSize = 12;
+    constexpr uint64_t FilterLzma2 = 0x21;
+    constexpr size_t MaxChunkSize = size_t{1} << 21;
+
+    // Size of the block check for each check type.
+    const size_t CheckSizes[16] = {0, 4, 4, 4, 8, 8, 8, 16, 16, 16, 32, 32, 32, 64, 64, 64};
+    constexpr unsigned CheckCrc32 = 1;
+    constexpr unsigned CheckCrc64 = 4;
+
+    // LZMA model constants.
+    constexpr unsigned States = 12;
+    constexpr unsigned MaxPosStates = 16;
+    constexpr unsigned LiteralCoderSize = 0x300;
+    constexpr unsigned EndPosModelIndex = 14;
+    constexpr unsigned FullDistances = 128;
+
+    uint32_t Load32(const uint8_t *p)
+    {
+        return p[0] | (uint32_t{p[1]} << 8) | (uint32_t{p[2]} << 16) | (uint32_t{p[3]} << 24);
+    }
+
+    uint64_t Load64(const uint8_t *p) { return Load32(p) | (uint64_t{Load32(p + 4)} << 32); }
+    uint32_t LoadBigEndian16(const uint8_t *p) { return (uint32_t{p[0]} << 8) | p[1]; }
+
+    // CRC-64 with the reflected ECMA-182 polynomial, as used by xz.
+    uint64_t Crc64(uint64_t crc, const uint8_t *data, size_t size)
+    {
+        static const std::array<uint64_t, 256> table = [] {
+            std::array<uint64_t, 256> t{};
+            for (uint64_t i = 0; i < 256; i += 1) {
+                uint64_t c = i;
+                for (int k = 0; k < 8; k += 1) {
+                    c = (c & 1) ? (0xc96c5795d7870f42ull ^ (c >> 1)) : (c >> 1);
+                }
+
+                t[i] = c;
+            }
+
+            return t;
+        }();
+
+        crc = ~crc;
+        for (size_t i = 0; i < size; i += 1) {
+            crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        }
+
+        return ~crc;
+    }
+
+    bool ParseVli(const uint8_t *data, size_t size, size_t *pos, uint64_t *value)
+    {
+        *value = 0;
+        for (unsigned i = 0; (i < 9) && (*pos < size); i += 1) {
+            const uint8_t byte = data[(*pos)++];
+            *value |= uint64_t{byte & 0x7fu} << (7 * i);
+            if ((byte & 0x80) == 0) {
+                return (i == 0) || (byte != 0);
+            }
+        }
+
+        return false;
+    }
+
+    // LZMA range decoder over one LZMA2 chunk.
+    class RangeDecoder
+    {
+      public:
+        bool Init(const uint8_t *data, size_t size)
+        {
+            if ((size < 5) || (data[0] != 0)) {
+                return false;
+            }
+
+            _code = (uint32_t{data[1]} << 24) | (uint32_t{data[2]} << 16) | (uint32_t{data[3]} << 8) | data[4];
+            _next = data + 5;
+            _end = data + size;
+            return true;
+        }
+
+        unsigned Bit(uint16_t &probability)
+        {
+            const uint32_t bound = (_range >> 11) * probability;
+            unsigned bit;
+            if (_code < bound) {
+                _range = bound;
+                probability += (2048 - probability) >> 5;
+                bit = 0;
+
+            } else {
+                _range -= bound;
+                _code -= bound;
+                probability -= probability >> 5;
+                bit = 1;
+            }
+
+            Normalize();
+            return bit;
+        }
+
+        uint32_t Direct(unsigned count)
+        {
+            uint32_t result = 0;
+            for (unsigned i = 0; i < count; i += 1) {
+                _range >>= 1;
+                _code -= _range;
+                const uint32_t mask = 0 - (_code >> 31);
+                _code += _range & mask;
+                result = (result << 1) + (mask + 1);
+                Normalize();
+            }
+
+            return result;
+        }
+
+        uint32_t Tree(uint16_t *probabilities, unsigned bits)
+        {
+            uint32_t m = 1;
+            for (unsigned i = 0; i < bits; i += 1) {
+                m = (m << 1) | Bit(probabilities[m]);
+            }
+
+            return m - (1u << bits);
+        }
+
+        uint32_t ReverseTree(uint16_t *probabilities, unsigned bits)
+        {
+            uint32_t m = 1;
+            uint32_t symbol = 0;
+            for (unsigned i = 0; i < bits; i += 1) {
+                const unsigned bit = Bit(probabilities[m]);
+                m = (m << 1) | bit;
+                symbol |= bit << i;
+            }
+
+            return symbol;
+        }
+
+        // A chunk must end exactly where its compressed data does.
+        bool Finished() const { return !_overrun && (_next == _end) && (_code == 0); }
+        bool Overrun() const { return _overrun; }
+
+      private:
+        void Normalize()
+        {
+            if (_range < (1u << 24)) {
+                _range <<= 8;
+                if (_next < _end) {
+                    _code = (_code << 8) | *_next++;
+
+                } else {
+                    _code <<= 8;
+                    _overrun = true;
+                }
+            }
+        }
+
+        const uint8_t *_next = nullptr;
+        const uint8_t *_end = nullptr;
+        uint32_t _range = 0xffffffff;
+        uint32_t _code = 0;
+        bool _overrun = false;
+    };
+}
+
+// Probability model and coder state, which persist across LZMA2 chunks until
+// a chunk resets them.
+struct XzDecoder::Lzma
+{
+    struct Length
+    {
+        uint16_t choice;
+        uint16_t choice2;
+        uint16_t low[MaxPosStates][8];
+        uint16_t mid[MaxPosStates][8];
+        uint16_t high[256];
+    };
+
+    struct Probabilities
+    {
+        uint16_t isMatch[States][MaxPosStates];
+        uint16_t isRep[States];
+        uint16_t isRepG0[States];
+        uint16_t isRepG1[States];
+        uint16_t isRepG2[States];
+        uint16_t isRep0Long[States][MaxPosStates];
+        uint16_t posSlot[4][64];
+        uint16_t posSpecial[1 + FullDistances - EndPosModelIndex];
+        uint16_t align[16];
+        Length matchLength;
+        Length repLength;
+        uint16_t literal[LiteralCoderSize << 4];
+    };
+
+    void Reset()
+    {
+        uint16_t *begin = reinterpret_cast<uint16_t *>(&probabilities);
+        std::fill(begin, begin + sizeof(probabilities) / sizeof(uint16_t), uint16_t{1024});
+        state = 0;
+        std::fill(std::begin(reps), std::end(reps), 0u);
+    }
+
+    uint32_t DecodeLength(RangeDecoder &rc, Length &length, unsigned posState)
+    {
+        if (rc.Bit(length.choice) == 0) {
+            return rc.Tree(length.low[posState], 3);
+        }
+
+        if (rc.Bit(length.choice2) == 0) {
+            return 8 + rc.Tree(length.mid[posState], 3);
+        }
+
+        return 16 + rc.Tree(length.high, 8);
+    }
+
+    uint32_t DecodeDistance(RangeDecoder &rc, uint32_t length)
+    {
+        const uint32_t slot = rc.Tree(probabilities.posSlot[(length < 4) ? length : 3], 6);
+        if (slot < 4) {
+            return slot;
+        }
+
+        const unsigned directBits = (slot >> 1) - 1;
+        uint32_t distance = (2 | (slot & 1)) << directBits;
+        if (slot < EndPosModelIndex) {
+            return distance + rc.ReverseTree(probabilities.posSpecial + distance - slot, directBits);
+        }
+
+        distance += rc.Direct(directBits - 4) << 4;
+        return distance + rc.ReverseTree(probabilities.align, 4);
+    }
+
+    Probabilities probabilities;
+    unsigned lc = 0;
+    unsigned lp = 0;
+    unsigned pb = 0;
+    unsigned state = 0;
+    uint32_t reps[4] = {};
+    bool needDictionaryReset = true;
+    bool needProperties = true;
+};
+
+XzDecoder::XzDecoder(ByteSource &source, size_t flushSize) :
+    _input(source),
+    _flushSize(flushSize),
+    _lzma(std::make_unique<Lzma>())
+{
+}
+
+XzDecoder::~XzDecoder() = default;
+
+InflateStatus XzDecoder::Fail(InflateStatus status, const char *error)
+{
+    _error = error;
+    return status;
+}
+
+InflateStatus XzDecoder::Decode(ByteSink &sink)
+{
+    for (;;) {
+        if (_input.AtEnd()) {
+            if (_streams == 0) {
+                return Fail(InflateStatus::Truncated, "empty xz stream");
+            }
+
+            return InflateStatus::Ok;
+        }
+
+        // Concatenated streams may be separated by groups of four zero bytes.
+        if ((_streams > 0) && (_input.Data()[0] == 0)) {
+            if (!_input.Ensure(4) || (Load32(_input.Data()) != 0)) {
+                return Fail(InflateStatus::Corrupt, "invalid xz stream padding");
+            }
+
+            _input.Skip(4);
+            continue;
+        }
+
+        const InflateStatus status = DecodeStream(sink);
+        if (status != InflateStatus::Ok) {
+            return status;
+        }
+
+        _streams += 1;
+    }
+}
+
+InflateStatus XzDecoder::DecodeStream(ByteSink &sink)
+{
+    if (!_input.Ensure(StreamHeaderSize)) {
+        return Fail(InflateStatus::Truncated, "truncated xz stream header");
+    }
+
+    const uint8_t *header = _input.Data();
+    if (std::memcmp(header, StreamMagic, sizeof(StreamMagic)) != 0) {
+        return Fail(InflateStatus::Corrupt, "not an xz stream");
+    }
+
+    if ((Crc32(0, header + 6, 2) != Load32(header + 8))) {
+        return Fail(InflateStatus::Corrupt, "xz stream header checksum mismatch");
+    }
+
+    if ((header[6] != 0) || ((header[7] & 0xf0) != 0)) {
+        return Fail(InflateStatus::Corrupt, "unsupported xz stream flags");
+    }
+
+    const uint8_t flags[2] = {header[6], header[7]};
+    _checkType = header[7];
+    _input.Skip(StreamHeaderSize);
+    _records.clear();
+    for (;;) {
+        if (!_input.Ensure(1)) {
+            return Fail(InflateStatus::Truncated, "truncated xz block");
+        }
+
+        // A zero header size byte starts the index.
+        if (_input.Data()[0] == 0) {
+            break;
+        }
+
+        uint64_t unpaddedSize = 0;
+        uint64_t uncompressedSize = 0;
+        const InflateStatus status = DecodeBlock(sink, &unpaddedSize, &uncompressedSize);
+        if (status != InflateStatus::Ok) {
+            return status;
+        }
+
+        _records.emplace_back(unpaddedSize, uncompressedSize);
+    }
+
+    uint64_t indexSize = 0;
+    const InflateStatus status = DecodeIndex(&indexSize);
+    if (status != InflateStatus::Ok) {
+        return status;
+    }
+
+    if (!_input.Ensure(StreamHeaderSize)) {
+        return Fail(InflateStatus::Truncated, "truncated xz stream footer");
+    }
+
+    const uint8_t *footer = _input.Data();
+    if ((Crc32(0, footer + 4, 6) != Load32(footer)) ||
+        ((uint64_t{Load32(footer + 4)} + 1) * 4 != indexSize) ||
+        (footer[8] != flags[0]) || (footer[9] != flags[1]) ||
+        (footer[10] != 'Y') || (footer[11] != 'Z')) {
+        return Fail(InflateStatus::Corrupt, "invalid xz stream footer");
+    }
+
+    _input.Skip(StreamHeaderSize);
+    return InflateStatus::Ok;
+}
+
+InflateStatus XzDecoder::DecodeBlock(ByteSink &sink, uint64_t *unpaddedSize, uint64_t *uncompressedSize)
+{
+    const size_t headerSize = (size_t{_input.Data()[0]} + 1) * 4;
+    if (!_input.Ensure(headerSize)) {
+        return Fail(InflateStatus::Truncated, "truncated xz block header");
+    }
+
+    const uint8_t *header = _input.Data();
+    const size_t fieldsEnd = headerSize - 4;
+    if (Crc32(0, header, fieldsEnd) != Load32(header + fieldsEnd)) {
+        return Fail(InflateStatus::Corrupt, "xz block header checksum mismatch");
+    }
+
+    const uint8_t flags = header[1];
+    if ((flags & 0x3c) != 0) {
+        return Fail(InflateStatus::Corrupt, "unsupported xz block flags");
+    }
+
+    size_t pos = 2;
+    uint64_t compressedLimit = 0;
+    uint64_t uncompressedLimit = 0;
+    if (((flags & 0x40) != 0) && !ParseVli(header, fieldsEnd, &pos, &compressedLimit)) {
+        return Fail(InflateStatus::Corrupt, "invalid xz block header");
+    }
+
+    if (((flags & 0x80) != 0) && !ParseVli(header, fieldsEnd, &pos, &uncompressedLimit)) {
+        return Fail(InflateStatus::Corrupt, "invalid xz block header");
+    }
+
+    // Only a lone LZMA2 filter is supported; BCJ and delta filters are not.
+    uint64_t filter = 0;
+    uint64_t propertiesSize = 0;
+    if (((flags & 3) != 0) ||
+        !ParseVli(header, fieldsEnd, &pos, &filter) ||
+        !ParseVli(header, fieldsEnd, &pos, &propertiesSize) ||
+        (filter != FilterLzma2) || (propertiesSize != 1) || (pos >= fieldsEnd)) {
+        return Fail(InflateStatus::Corrupt, "unsupported xz filter");
+    }
+
+    const uint8_t dictionaryBits = header[pos++];
+    while (pos < fieldsEnd) {
+        if (header[pos++] != 0) {
+            return Fail(InflateStatus::Corrupt, "invalid xz block header");
+        }
+    }
+
+    if (dictionaryBits > 40) {
+        return Fail(InflateStatus::Corrupt, "invalid lzma2 dictionary size");
+    }
+
+    const uint64_t dictionarySize = (dictionaryBits == 40) ? 0xffffffffull
+                                                           : (uint64_t{2} | (dictionaryBits & 1)) << (dictionaryBits / 2 + 11);
+    if (dictionarySize > MaxDictionarySize) {
+        return Fail(InflateStatus::Corrupt, "xz dictionary too large");
+    }
+
+    // Small blocks do not need a full dictionary worth of history.
+    _history = static_cast<size_t>(dictionarySize);
+    if (((flags & 0x80) != 0) && (uncompressedLimit < _history)) {
+        _history = static_cast<size_t>(uncompressedLimit);
+    }
+
+    const size_t required = _history + _flushSize + MaxChunkSize;
+    if (_buffer.size() < required) {
+        _buffer.resize(required);
+    }
+
+    _input.Skip(headerSize);
+    _pos = 0;
+    _flushed = 0;
+    _sinceReset = 0;
+    _blockTotal = 0;
+    _crc32 = 0;
+    _crc64 = 0;
+    _lzma->needDictionaryReset = true;
+    _lzma->needProperties = true;
+
+    uint64_t compressed = 0;
+    for (;;) {
+        if (!_input.Ensure(1)) {
+            return Fail(InflateStatus::Truncated, "truncated lzma2 stream");
+        }
+
+        const uint8_t control = _input.Data()[0];
+        if (control == 0) {
+            _input.Skip(1);
+            compressed += 1;
+            break;
+        }
+
+        if ((control >= 0xe0) || (control == 1)) {
+            _lzma->needProperties = true;
+            _lzma->needDictionaryReset = false;
+            _sinceReset = 0;
+
+        } else if (_lzma->needDictionaryReset) {
+            return Fail(InflateStatus::Corrupt, "invalid lzma2 stream");
+        }
+
+        if (control >= 0x80) {
+            const size_t chunkHeaderSize = (control >= 0xc0) ? 6 : 5;
+            if (!_input.Ensure(chunkHeaderSize)) {
+                return Fail(InflateStatus::Truncated, "truncated lzma2 stream");
+            }
+
+            const uint8_t *chunk = _input.Data();
+            const size_t unpacked = ((size_t{control} & 0x1f) << 16) + LoadBigEndian16(chunk + 1) + 1;
+            const size_t packed = LoadBigEndian16(chunk + 3) + 1;
+            if (control >= 0xc0) {
+                unsigned properties = chunk[5];
+                if (properties >= (9 * 5 * 5)) {
+                    return Fail(InflateStatus::Corrupt, "invalid lzma2 properties");
+                }
+
+                _lzma->lc = properties % 9;
+                properties /= 9;
+                _lzma->lp = properties % 5;
+                _lzma->pb = properties / 5;
+                if ((_lzma->lc + _lzma->lp) > 4) {
+                    return Fail(InflateStatus::Corrupt, "invalid lzma2 properties");
+                }
+
+                _lzma->needProperties = false;
+
+            } else if (_lzma->needProperties) {
+                return Fail(InflateStatus::Corrupt, "invalid lzma2 stream");
+            }
+
+            if (control >= 0xa0) {
+                _lzma->Reset();
+            }
+
+            _input.Skip(chunkHeaderSize);
+            if (!_input.Ensure(packed)) {
+                return Fail(InflateStatus::Truncated, "truncated lzma2 stream");
+            }
+
+            const InflateStatus status = DecodeChunk(_input.Data(), packed, unpacked);
+            if (status != InflateStatus::Ok) {
+                return Fail(status, "invalid lzma2 stream");
+            }
+
+            _input.Skip(packed);
+            compressed += chunkHeaderSize + packed;
+
+        } else if (control <= 2) {
+            if (!_input.Ensure(3)) {
+                return Fail(InflateStatus::Truncated, "truncated lzma2 stream");
+            }
+
+            const size_t size = LoadBigEndian16(_input.Data() + 1) + 1;
+            _input.Skip(3);
+            if (!_input.Ensure(size)) {
+                return Fail(InflateStatus::Truncated, "truncated lzma2 stream");
+            }
+
+            std::memcpy(_buffer.data() + _pos, _input.Data(), size);
+            _input.Skip(size);
+            _pos += size;
+            _sinceReset += size;
+            compressed += 3 + size;
+
+        } else {
+            return Fail(InflateStatus::Corrupt, "invalid lzma2 stream");
+        }
+
+        if (!Flush(sink, false)) {
+            return Fail(InflateStatus::SinkFailed, "output rejected");
+        }
+    }
+
+    if (!Flush(sink, true)) {
+        return Fail(InflateStatus::SinkFailed, "output rejected");
+    }
+
+    if ((((flags & 0x40) != 0) && (compressed != compressedLimit)) ||
+        (((flags & 0x80) != 0) && (_blockTotal != uncompressedLimit))) {
+        return Fail(InflateStatus::Corrupt, "xz block size mismatch");
+    }
+
+    for (uint64_t padding = compressed; (padding % 4) != 0; padding += 1) {
+        if (!_input.Ensure(1)) {
+            return Fail(InflateStatus::Truncated, "truncated xz block");
+        }
+
+        if (_input.Data()[0] != 0) {
+            return Fail(InflateStatus::Corrupt, "invalid xz block padding");
+        }
+
+        _input.Skip(1);
+    }
+
+    // Checks other than CRC-32 and CRC-64 are skipped, as the format allows.
+    const size_t checkSize = CheckSizes[_checkType];
+    if (!_input.Ensure(checkSize)) {
+        return Fail(InflateStatus::Truncated, "truncated xz block check");
+    }
+
+    if (((_checkType == CheckCrc32) && (Load32(_input.Data()) != _crc32)) ||
+        ((_checkType == CheckCrc64) && (Load64(_input.Data()) != _crc64))) {
+        return Fail(InflateStatus::Corrupt, "xz checksum mismatch");
+    }
+
+    _input.Skip(checkSize);
+    *unpaddedSize = headerSize + compressed + checkSize;
+    *uncompressedSize = _blockTotal;
+    return InflateStatus::Ok;
+}
+
+bool XzDecoder::ReadVli(uint64_t *value, std::vector<uint8_t> *copy)
+{
+    *value = 0;
+    for (unsigned i = 0; i < 9; i += 1) {
+        if (!_input.Ensure(1)) {
+            return false;
+        }
+
+        const uint8_t byte = _input.Data()[0];
+        _input.Skip(1);
+        copy->push_back(byte);
+        *value |= uint64_t{byte & 0x7fu} << (7 * i);
+        if ((byte & 0x80) == 0) {
+            return (i == 0) || (byte != 0);
+        }
+    }
+
+    return false;
+}
+
+InflateStatus XzDecoder::DecodeIndex(uint64_t *size)
+{
+    // The index lists every block of the stream, which must match what was decoded.
+    std::vector<uint8_t> index(1, 0);
+    _input.Skip(1);
+    uint64_t count = 0;
+    if (!ReadVli(&count, &index) || (count != _records.size())) {
+        return Fail(InflateStatus::Corrupt, "invalid xz index");
+    }
+
+    for (const auto &record : _records) {
+        uint64_t unpaddedSize = 0;
+        uint64_t uncompressedSize = 0;
+        if (!ReadVli(&unpaddedSize, &index) || !ReadVli(&uncompressedSize, &index) ||
+            (unpaddedSize != record.first) || (uncompressedSize != record.second)) {
+            return Fail(InflateStatus::Corrupt, "invalid xz index");
+        }
+    }
+
+    while ((index.size() % 4) != 0) {
+        if (!_input.Ensure(1) || (_input.Data()[0] != 0)) {
+            return Fail(InflateStatus::Corrupt, "invalid xz index");
+        }
+
+        index.push_back(0);
+        _input.Skip(1);
+    }
+
+    if (!_input.Ensure(4) || (Load32(_input.Data()) != Crc32(0, index.data(), index.size()))) {
+        return Fail(InflateStatus::Corrupt, "xz index checksum mismatch");
+    }
+
+    _input.Skip(4);
+    *size = index.size() + 4;
+    return InflateStatus::Ok;
+}
+
+bool XzDecoder::Flush(ByteSink &sink, bool force)
+{
+    const size_t pending = _pos - _flushed;
+    if (!force && (pending < _flushSize)) {
+        return true;
+    }
+
+    if (pending > 0) {
+        const uint8_t *data = _buffer.data() + _flushed;
+        if (_checkType == CheckCrc32) {
+            _crc32 = Crc32(_crc32, data, pending);
+
+        } else if (_checkType == CheckCrc64) {
+            _crc64 = Crc64(_crc64, data, pending);
+        }
+
+        _blockTotal += pending;
+        if (!sink.Write(data, pending)) {
+            return false;
+        }
+    }
+
+    // Keep the last dictionary worth of output around for back-references.
+    if (_pos > _history) {
+        std::memmove(_buffer.data(), _buffer.data() + _pos - _history, _history);
+        _pos = _history;
+    }
+
+    _flushed = _pos;
+    return true;
+}
+
+InflateStatus XzDecoder::DecodeChunk(const uint8_t *data, size_t size, size_t unpacked)
+{
+    RangeDecoder rc;
+    if (!rc.Init(data, size)) {
+        return InflateStatus::Corrupt;
+    }
+
+    Lzma &lzma = *_lzma;
+    Lzma::Probabilities &p = lzma.probabilities;
+    uint8_t *const dictionary = _buffer.data();
+    const size_t start = _pos;
+    const size_t end = _pos + unpacked;
+    const uint64_t posMask = (uint64_t{1} << lzma.pb) - 1;
+    const uint64_t literalPosMask = (uint64_t{1} << lzma.lp) - 1;
+    size_t pos = _pos;
+    while (pos < end) {
+        const uint64_t position = _sinceReset + (pos - start);
+        const size_t available = (position < pos) ? static_cast<size_t>(position) : pos;
+        const unsigned posState = static_cast<unsigned>(position & posMask);
+        if (rc.Bit(p.isMatch[lzma.state][posState]) == 0) {
+            const unsigned previous = (available > 0) ? dictionary[pos - 1] : 0;
+            uint16_t *probabilities = p.literal + LiteralCoderSize * (((position & literalPosMask) << lzma.lc) + (previous >> (8 - lzma.lc)));
+            unsigned symbol = 1;
+            if (lzma.state >= 7) {
+                if (lzma.reps[0] >= available) {
+                    return InflateStatus::Corrupt;
+                }
+
+                // After a match, literals are coded relative to the byte at rep0.
+                unsigned matchByte = dictionary[pos - lzma.reps[0] - 1];
+                while (symbol < 0x100) {
+                    const unsigned matchBit = (matchByte >> 7) & 1;
+                    matchByte <<= 1;
+                    const unsigned bit = rc.Bit(probabilities[((1 + matchBit) << 8) + symbol]);
+                    symbol = (symbol << 1) | bit;
+                    if (matchBit != bit) {
+                        break;
+                    }
+                }
+            }
+
+            while (symbol < 0x100) {
+                symbol = (symbol << 1) | rc.Bit(probabilities[symbol]);
+            }
+
+            dictionary[pos++] = static_cast<uint8_t>(symbol);
+            lzma.state = (lzma.state < 4) ? 0 : ((lzma.state < 10) ? (lzma.state - 3) : (lzma.state - 6));
+            continue;
+        }
+
+        uint32_t length;
+        if (rc.Bit(p.isRep[lzma.state]) == 0) {
+            lzma.reps[3] = lzma.reps[2];
+            lzma.reps[2] = lzma.reps[1];
+            lzma.reps[1] = lzma.reps[0];
+            length = lzma.DecodeLength(rc, p.matchLength, posState);
+            lzma.state = (lzma.state < 7) ? 7 : 10;
+            lzma.reps[0] = lzma.DecodeDistance(rc, length);
+
+        } else {
+            if (available == 0) {
+                return InflateStatus::Corrupt;
+            }
+
+            if (rc.Bit(p.isRepG0[lzma.state]) == 0) {
+                if (rc.Bit(p.isRep0Long[lzma.state][posState]) == 0) {
+                    // Short rep: a single byte at rep0.
+                    if (lzma.reps[0] >= available) {
+                        return InflateStatus::Corrupt;
+                    }
+
+                    lzma.state = (lzma.state < 7) ? 9 : 11;
+                    dictionary[pos] = dictionary[pos - lzma.reps[0] - 1];
+                    pos += 1;
+                    continue;
+                }
+
+            } else {
+                uint32_t distance;
+                if (rc.Bit(p.isRepG1[lzma.state]) == 0) {
+                    distance = lzma.reps[1];
+
+                } else {
+                    if (rc.Bit(p.isRepG2[lzma.state]) == 0) {
+                        distance = lzma.reps[2];
+
+                    } else {
+                        distance = lzma.reps[3];
+                        lzma.reps[3] = lzma.reps[2];
+                    }
+
+                    lzma.reps[2] = lzma.reps[1];
+                }
+
+                lzma.reps[1] = lzma.reps[0];
+                lzma.reps[0] = distance;
+            }
+
+            length = lzma.DecodeLength(rc, p.repLength, posState);
+            lzma.state = (lzma.state < 7) ? 8 : 11;
+        }
+
+        // Matches never cross chunk boundaries, and LZMA2 has no end marker.
+        const size_t count = size_t{length} + 2;
+        if ((lzma.reps[0] >= available) || (count > (end - pos)) || rc.Overrun()) {
+            return InflateStatus::Corrupt;
+        }
+
+        uint8_t *destination = dictionary + pos;
+        const uint8_t *source = destination - lzma.reps[0] - 1;
+        if (lzma.reps[0] + 1 >= count) {
+            std::memcpy(destination, source, count);
+
+        } else {
+            for (size_t i = 0; i < count; i += 1) {
+                destination[i] = source[i];
+            }
+        }
+
+        pos += count;
+    }
+
+    if (!rc.Finished()) {
+        return InflateStatus::Corrupt;
+    }
+
+    _sinceReset += unpacked;
+    _pos = end;
+    return InflateStatus::Ok;
+}
@@ -0,0 +1,64 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Inflate.h"
+#include "InputBuffer.h"
+
+// Decodes .xz streams whose blocks use the LZMA2 filter alone, which is what
+// `xz` produces by default. CRC-32 and CRC-64 block checks are verified, as
+// are the block index and stream footer.
+class XzDecoder
+{
+  public:
+    // Largest dictionary accepted; `xz -9` uses 64 MiB.
+    static constexpr size_t MaxDictionarySize = size_t{1} << 27;
+
+    explicit XzDecoder(ByteSource &source, size_t flushSize = 1 << 20);
+    ~XzDecoder();
+
+    InflateStatus Decode(ByteSink &sink);
+
+    const std::string &Error() const { return _error; }
+    uint64_t Streams() const { return _streams; }
+
+  private:
+    struct Lzma;
+
+    InflateStatus DecodeStream(ByteSink &sink);
+    InflateStatus DecodeBlock(ByteSink &sink, uint64_t *unpaddedSize, uint64_t *uncompressedSize);
+    InflateStatus DecodeIndex(uint64_t *size);
+    InflateStatus DecodeChunk(const uint8_t *data, size_t size, size_t unpacked);
+    bool Flush(ByteSink &sink, bool force);
+    bool ReadVli(uint64_t *value, std::vector<uint8_t> *copy);
+    InflateStatus Fail(InflateStatus status, const char *error);
+
+    InputBuffer _input;
+    size_t _flushSize;
+    std::unique_ptr<Lzma> _lzma;
+
+    std::vector<uint8_t> _buffer;
+    size_t _history = 0;
+    size_t _pos = 0;
+    size_t _flushed = 0;
+    uint64_t _sinceReset = 0;
+
+    unsigned _checkType = 0;
+    uint32_t _crc32 = 0;
+    uint64_t _crc64 = 0;
+    uint64_t _blockTotal = 0;
+    std::vector<std::pair<uint64_t, uint64_t>> _records;
+
+    std::string _error;
+    uint64_t _streams = 0;
+};
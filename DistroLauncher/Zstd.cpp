@@ -0,0 +1,1291 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "Zstd.h"
+
+#include <cstring>
+
+namespace {
+    constexpr uint32_t FrameMagic = 0xfd2fb528;
+    constexpr uint32_t DictionaryMagic = 0xec30a437;
+    constexpr uint32_t SkippableMagic = 0x184d2a50;
+    constexpr uint32_t SkippableMask = 0xfffffff0;
+    constexpr size_t BlockHeaderSize = 3;
+    constexpr size_t MaxBlockSize = 128 * 1024;
+
+    // Literals and matches are copied 16 bytes at a time, reading and writing
+    // up to this many bytes past their end; the buffers leave room for it.
+    constexpr size_t CopyOverrun = 16;
+
+    constexpr unsigned MaxHuffmanBits = 11;
+    constexpr unsigned MaxFseLog = 9;
+    constexpr unsigned LiteralLengthMaxLog = 9;
+    constexpr unsigned MatchLengthMaxLog = 9;
+    constexpr unsigned OffsetMaxLog = 8;
+    constexpr unsigned MaxLiteralLengthCode = 35;
+    constexpr unsigned MaxMatchLengthCode = 52;
+    constexpr unsigned MaxOffsetCode = 31;
+
+    const uint32_t LiteralLengthBase[36] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                            16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512,
+                                            1024, 2048, 4096, 8192, 16384, 32768, 65536};
+    const uint8_t LiteralLengthBits[36] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                           1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+    const uint32_t MatchLengthBase[53] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+                                          19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+                                          35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515,
+                                          1027, 2051, 4099, 8195, 16387, 32771, 65539};
+    const uint8_t MatchLengthBits[53] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                         0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                         1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+
+    // Predefined distributions (RFC 8878, section 3.1.1.3.2.2).
+    const int16_t DefaultLiteralLengths[36] = {4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+                                               2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+                                               -1, -1, -1, -1};
+    const int16_t DefaultMatchLengths[53] = {1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+                                             1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                                             1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+                                             -1, -1, -1, -1, -1};
+    const int16_t DefaultOffsets[29] = {1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+                                        1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1};
+
+    uint32_t Load16(const uint8_t *p) { return p[0] | (uint32_t{p[1]} << 8); }
+    uint32_t Load24(const uint8_t *p) { return Load16(p) | (uint32_t{p[2]} << 16); }
+    uint32_t Load32(const uint8_t *p) { return Load24(p) | (uint32_t{p[3]} << 24); }
+    uint64_t Load64(const uint8_t *p) { return Load32(p) | (uint64_t{Load32(p + 4)} << 32); }
+
+    uint64_t LoadBytes(const uint8_t *p, size_t count)
+    {
+        uint64_t value = 0;
+        for (size_t i = 0; i < count; i += 1) {
+            value |= uint64_t{p[i]} << (8 * i);
+        }
+
+        return value;
+    }
+
+    unsigned HighBit(uint32_t value)
+    {
+        unsigned bit = 0;
+        while (value >>= 1) {
+            bit += 1;
+        }
+
+        return bit;
+    }
+
+    uint64_t Mask(unsigned count) { return (count >= 64) ? ~uint64_t{0} : ((uint64_t{1} << count) - 1); }
+
+    // Copies 16 bytes even when there are fewer, which most literal runs and
+    // matches are, before looping over the rest.
+    void CopyChunks(uint8_t *destination, const uint8_t *source, size_t count)
+    {
+        uint8_t *const end = destination + count;
+        std::memcpy(destination, source, 16);
+        destination += 16;
+        source += 16;
+        while (destination < end) {
+            std::memcpy(destination, source, 16);
+            destination += 16;
+            source += 16;
+        }
+    }
+
+    // Copies a match, which repeats the bytes `offset` back and so overlaps
+    // what it writes when shorter than its length.
+    void CopyMatch(uint8_t *destination, size_t offset, size_t length)
+    {
+        if (offset >= 16) {
+            CopyChunks(destination, destination - offset, length);
+            return;
+        }
+
+        // The first 16 bytes one at a time; the rest repeat bytes a whole
+        // number of offsets and at least 16 back, which are out by then.
+        const uint8_t *source = destination - offset;
+        const size_t head = (length < 16) ? length : 16;
+        for (size_t i = 0; i < head; i += 1) {
+            destination[i] = source[i];
+        }
+
+        if (length > 16) {
+            const size_t distance = offset * ((16 + offset - 1) / offset);
+            CopyChunks(destination + 16, destination + 16 - distance, length - 16);
+        }
+    }
+
+    // Reads the little-endian bit fields of an FSE table description.
+    class ForwardBitReader
+    {
+      public:
+        ForwardBitReader(const uint8_t *data, size_t size) :
+            _data(data),
+            _size(size)
+        {
+        }
+
+        uint32_t Peek(unsigned count) const
+        {
+            const size_t byte = _bit >> 3;
+            const uint64_t word = (byte >= _size) ? 0 : LoadBytes(_data + byte, (_size - byte < 4) ? (_size - byte) : 4);
+            return static_cast<uint32_t>((word >> (_bit & 7)) & Mask(count));
+        }
+
+        void Skip(unsigned count) { _bit += count; }
+        size_t BytesUsed() const { return (_bit + 7) >> 3; }
+
+      private:
+        const uint8_t *_data;
+        size_t _size;
+        size_t _bit = 0;
+    };
+
+    // Reads an FSE or Huffman coded bit stream, which is written backwards:
+    // decoding starts below the highest set bit of the last byte and moves
+    // towards the first byte. Reads past the beginning yield zeros. The bits
+    // are read out of a 64 bit window of the stream, which is loaded again
+    // only once fewer bits than asked for are left in it, so reads are of 56
+    // bits at most.
+    class ReverseBitReader
+    {
+      public:
+        bool Init(const uint8_t *data, size_t size)
+        {
+            if ((size == 0) || (data[size - 1] == 0)) {
+                return false;
+            }
+
+            _data = data;
+            _size = size;
+            _pos = static_cast<int64_t>(size) * 8 - 8 + HighBit(data[size - 1]);
+            Reload();
+            return true;
+        }
+
+        uint64_t Peek(unsigned count)
+        {
+            int64_t low = _pos - count - _windowStart;
+            if ((low < 0) && (_windowStart > 0)) {
+                Reload();
+                low = _pos - count - _windowStart;
+            }
+
+            if (low >= 0) {
+                return (_window >> low) & Mask(count);
+            }
+
+            // Only the window at the beginning of the stream is left.
+            if (_pos <= 0) {
+                return 0;
+            }
+
+            return (_window << -low) & Mask(count);
+        }
+
+        void Skip(unsigned count) { _pos -= count; }
+
+        uint64_t Read(unsigned count)
+        {
+            const uint64_t value = Peek(count);
+            Skip(count);
+            return value;
+        }
+
+        bool Overflowed() const { return _pos < 0; }
+        bool Finished() const { return _pos == 0; }
+
+      private:
+        // Loads the window ending as close above the next bit as whole bytes
+        // allow, keeping 56 to 63 bits below it unless at the beginning.
+        void Reload()
+        {
+            const size_t byte = (_pos >= 64) ? static_cast<size_t>((_pos - 56) >> 3) : 0;
+            _windowStart = static_cast<int64_t>(byte) * 8;
+            _window = ((byte + 8) <= _size) ? Load64(_data + byte) : LoadBytes(_data + byte, _size - byte);
+        }
+
+        const uint8_t *_data = nullptr;
+        size_t _size = 0;
+        int64_t _pos = 0;
+        int64_t _windowStart = 0;
+        uint64_t _window = 0;
+    };
+
+    struct FseEntry
+    {
+        uint16_t baseline;
+        uint8_t symbol;
+        uint8_t bits;
+    };
+
+    struct FseTable
+    {
+        unsigned log = 0;
+        FseEntry entries[1 << MaxFseLog];
+    };
+
+    bool BuildFseTable(FseTable &table, const int16_t *counts, unsigned symbols, unsigned log)
+    {
+        const uint32_t size = 1u << log;
+        uint32_t high = size - 1;
+        uint16_t next[256];
+        for (unsigned s = 0; s < symbols; s += 1) {
+            if (counts[s] == -1) {
+                table.entries[high].symbol = static_cast<uint8_t>(s);
+                high -= 1;
+                next[s] = 1;
+
+            } else {
+                next[s] = static_cast<uint16_t>(counts[s]);
+            }
+        }
+
+        const uint32_t step = (size >> 1) + (size >> 3) + 3;
+        uint32_t pos = 0;
+        for (unsigned s = 0; s < symbols; s += 1) {
+            for (int16_t i = 0; i < counts[s]; i += 1) {
+                table.entries[pos].symbol = static_cast<uint8_t>(s);
+                do {
+                    pos = (pos + step) & (size - 1);
+                } while (pos > high);
+            }
+        }
+
+        // A valid distribution spreads symbols over every cell exactly once.
+        if (pos != 0) {
+            return false;
+        }
+
+        for (uint32_t u = 0; u < size; u += 1) {
+            FseEntry &entry = table.entries[u];
+            const uint32_t state = next[entry.symbol]++;
+            entry.bits = static_cast<uint8_t>(log - HighBit(state));
+            entry.baseline = static_cast<uint16_t>((state << entry.bits) - size);
+        }
+
+        table.log = log;
+        return true;
+    }
+
+    void BuildRleTable(FseTable &table, uint8_t symbol)
+    {
+        table.log = 0;
+        table.entries[0] = {0, symbol, 0};
+    }
+
+    // Reads an FSE table description (RFC 8878, section 4.1.1).
+    bool ReadFseTable(const uint8_t *data, size_t size, unsigned maxSymbol, unsigned maxLog, FseTable &table, size_t *consumed)
+    {
+        if (size == 0) {
+            return false;
+        }
+
+        ForwardBitReader bits(data, size);
+        const unsigned log = bits.Peek(4) + 5;
+        bits.Skip(4);
+        if (log > maxLog) {
+            return false;
+        }
+
+        int16_t counts[256] = {};
+        int32_t remaining = (1 << log) + 1;
+        int32_t threshold = 1 << log;
+        unsigned width = log + 1;
+        unsigned symbol = 0;
+        bool previousZero = false;
+        while ((remaining > 1) && (symbol <= maxSymbol)) {
+            if (previousZero) {
+                uint32_t repeat;
+                do {
+                    repeat = bits.Peek(2);
+                    bits.Skip(2);
+                    symbol += repeat;
+                } while ((repeat == 3) && (symbol <= maxSymbol));
+
+                if ((symbol > maxSymbol) || (bits.BytesUsed() > size)) {
+                    return false;
+                }
+            }
+
+            const int32_t max = (2 * threshold - 1) - remaining;
+            int32_t value = static_cast<int32_t>(bits.Peek(width - 1));
+            if (value < max) {
+                bits.Skip(width - 1);
+
+            } else {
+                value = static_cast<int32_t>(bits.Peek(width));
+                if (value >= threshold) {
+                    value -= max;
+                }
+
+                bits.Skip(width);
+            }
+
+            value -= 1;
+            remaining -= (value < 0) ? -value : value;
+            counts[symbol] = static_cast<int16_t>(value);
+            symbol += 1;
+            previousZero = (value == 0);
+            if (remaining < 1) {
+                return false;
+            }
+
+            while (remaining < threshold) {
+                width -= 1;
+                threshold >>= 1;
+            }
+        }
+
+        if ((remaining != 1) || (bits.BytesUsed() > size)) {
+            return false;
+        }
+
+        *consumed = bits.BytesUsed();
+        return BuildFseTable(table, counts, symbol, log);
+    }
+
+    const FseTable &DefaultLiteralLengthTable()
+    {
+        static const FseTable table = [] {
+            FseTable t;
+            BuildFseTable(t, DefaultLiteralLengths, 36, 6);
+            return t;
+        }();
+
+        return table;
+    }
+
+    const FseTable &DefaultMatchLengthTable()
+    {
+        static const FseTable table = [] {
+            FseTable t;
+            BuildFseTable(t, DefaultMatchLengths, 53, 6);
+            return t;
+        }();
+
+        return table;
+    }
+
+    const FseTable &DefaultOffsetTable()
+    {
+        static const FseTable table = [] {
+            FseTable t;
+            BuildFseTable(t, DefaultOffsets, 29, 5);
+            return t;
+        }();
+
+        return table;
+    }
+
+    struct HuffmanEntry
+    {
+        uint8_t symbol;
+        uint8_t bits;
+    };
+
+    struct LiteralTable
+    {
+        unsigned maxBits = 0;
+        HuffmanEntry entries[1 << MaxHuffmanBits];
+    };
+
+    // Reads a Huffman tree description (RFC 8878, section 4.2.1).
+    bool ReadLiteralTable(const uint8_t *data, size_t size, LiteralTable &table, size_t *consumed)
+    {
+        if (size == 0) {
+            return false;
+        }
+
+        uint8_t weights[256] = {};
+        size_t count = 0;
+        const uint8_t header = data[0];
+        if (header >= 128) {
+            count = header - 127;
+            const size_t bytes = (count + 1) / 2;
+            if ((1 + bytes) > size) {
+                return false;
+            }
+
+            for (size_t i = 0; i < count; i += 1) {
+                const uint8_t pair = data[1 + i / 2];
+                weights[i] = (i & 1) ? (pair & 0xf) : (pair >> 4);
+            }
+
+            *consumed = 1 + bytes;
+
+        } else {
+            const size_t compressed = header;
+            size_t used = 0;
+            FseTable fse;
+            if ((compressed == 0) || ((1 + compressed) > size) ||
+                !ReadFseTable(data + 1, compressed, 255, 6, fse, &used)) {
+                return false;
+            }
+
+            // Two interleaved states share the stream until it runs out.
+            ReverseBitReader bits;
+            if ((used >= compressed) || !bits.Init(data + 1 + used, compressed - used)) {
+                return false;
+            }
+
+            uint32_t states[2];
+            states[0] = static_cast<uint32_t>(bits.Read(fse.log));
+            states[1] = static_cast<uint32_t>(bits.Read(fse.log));
+            for (unsigned turn = 0;; turn ^= 1) {
+                if (count >= 255) {
+                    return false;
+                }
+
+                const FseEntry &entry = fse.entries[states[turn]];
+                weights[count++] = entry.symbol;
+                states[turn] = entry.baseline + static_cast<uint32_t>(bits.Read(entry.bits));
+                if (bits.Overflowed()) {
+                    if (count >= 255) {
+                        return false;
+                    }
+
+                    weights[count++] = fse.entries[states[turn ^ 1]].symbol;
+                    break;
+                }
+            }
+
+            *consumed = 1 + compressed;
+        }
+
+        // The weight of the last symbol is implied by the others.
+        uint32_t ranks[MaxHuffmanBits + 2] = {};
+        uint32_t total = 0;
+        for (size_t i = 0; i < count; i += 1) {
+            if (weights[i] > MaxHuffmanBits) {
+                return false;
+            }
+
+            ranks[weights[i]] += 1;
+            total += (1u << weights[i]) >> 1;
+        }
+
+        if (total == 0) {
+            return false;
+        }
+
+        const unsigned maxBits = HighBit(total) + 1;
+        const uint32_t left = (1u << maxBits) - total;
+        if ((maxBits > MaxHuffmanBits) || ((left & (left - 1)) != 0)) {
+            return false;
+        }
+
+        const unsigned last = HighBit(left) + 1;
+        weights[count++] = static_cast<uint8_t>(last);
+        ranks[last] += 1;
+
+        uint32_t next[MaxHuffmanBits + 1] = {};
+        uint32_t start = 0;
+        for (unsigned w = 1; w <= maxBits; w += 1) {
+            next[w] = start;
+            start += ranks[w] << (w - 1);
+        }
+
+        for (size_t s = 0; s < count; s += 1) {
+            const unsigned w = weights[s];
+            if (w == 0) {
+                continue;
+            }
+
+            const HuffmanEntry entry = {static_cast<uint8_t>(s), static_cast<uint8_t>(maxBits + 1 - w)};
+            const uint32_t length = 1u << (w - 1);
+            for (uint32_t i = 0; i < length; i += 1) {
+                table.entries[next[w] + i] = entry;
+            }
+
+            next[w] += length;
+        }
+
+        table.maxBits = maxBits;
+        return true;
+    }
+
+    bool DecodeLiteralStream(const LiteralTable &table, const uint8_t *data, size_t size, uint8_t *output, size_t count)
+    {
+        ReverseBitReader bits;
+        if (!bits.Init(data, size)) {
+            return false;
+        }
+
+        for (size_t i = 0; i < count; i += 1) {
+            const HuffmanEntry entry = table.entries[bits.Peek(table.maxBits)];
+            output[i] = entry.symbol;
+            bits.Skip(entry.bits);
+        }
+
+        return bits.Finished();
+    }
+}
+
+// Entropy tables and repeat offsets, which carry over from block to block.
+struct ZstdDecoder::Entropy
+{
+    LiteralTable literals;
+    FseTable literalLengths;
+    FseTable offsets;
+    FseTable matchLengths;
+    bool hasLiterals = false;
+    bool hasLiteralLengths = false;
+    bool hasOffsets = false;
+    bool hasMatchLengths = false;
+    uint32_t repeats[3] = {1, 4, 8};
+};
+
+// Streaming XXH64, whose low 32 bits are the frame checksum.
+struct ZstdDecoder::Checksum
+{
+    static constexpr uint64_t Prime1 = 11400714785074694791ull;
+    static constexpr uint64_t Prime2 = 14029467366897019727ull;
+    static constexpr uint64_t Prime3 = 1609587929392839161ull;
+    static constexpr uint64_t Prime4 = 9650029242287828579ull;
+    static constexpr uint64_t Prime5 = 2870177450012600261ull;
+
+    static uint64_t Rotate(uint64_t value, unsigned bits) { return (value << bits) | (value >> (64 - bits)); }
+    static uint64_t Round(uint64_t accumulator, uint64_t input) { return Rotate(accumulator + input * Prime2, 31) * Prime1; }
+
+    void Reset()
+    {
+        lanes[0] = Prime1 + Prime2;
+        lanes[1] = Prime2;
+        lanes[2] = 0;
+        lanes[3] = 0 - Prime1;
+        total = 0;
+        pending = 0;
+    }
+
+    void Update(const uint8_t *data, size_t size)
+    {
+        total += size;
+        if (pending > 0) {
+            const size_t count = ((32 - pending) < size) ? (32 - pending) : size;
+            std::memcpy(stripe + pending, data, count);
+            pending += count;
+            data += count;
+            size -= count;
+            if (pending < 32) {
+                return;
+            }
+
+            Consume(stripe);
+            pending = 0;
+        }
+
+        // The lanes are kept in locals meanwhile: as far as the compiler
+        // knows, storing to them could change the data, so it would not keep
+        // them in registers.
+        uint64_t lane0 = lanes[0];
+        uint64_t lane1 = lanes[1];
+        uint64_t lane2 = lanes[2];
+        uint64_t lane3 = lanes[3];
+        while (size >= 32) {
+            lane0 = Round(lane0, Load64(data));
+            lane1 = Round(lane1, Load64(data + 8));
+            lane2 = Round(lane2, Load64(data + 16));
+            lane3 = Round(lane3, Load64(data + 24));
+            data += 32;
+            size -= 32;
+        }
+
+        lanes[0] = lane0;
+        lanes[1] = lane1;
+        lanes[2] = lane2;
+        lanes[3] = lane3;
+
+        std::memcpy(stripe, data, size);
+        pending = size;
+    }
+
+    uint32_t Digest() const
+    {
+        uint64_t hash;
+        if (total >= 32) {
+            hash = Rotate(lanes[0], 1) + Rotate(lanes[1], 7) + Rotate(lanes[2], 12) + Rotate(lanes[3], 18);
+            for (const uint64_t lane : lanes) {
+                hash = (hash ^ Round(0, lane)) * Prime1 + Prime4;
+            }
+
+        } else {
+            hash = Prime5;
+        }
+
+        hash += total;
+        size_t i = 0;
+        for (; (i + 8) <= pending; i += 8) {
+            hash = Rotate(hash ^ Round(0, Load64(stripe + i)), 27) * Prime1 + Prime4;
+        }
+
+        if ((i + 4) <= pending) {
+            hash = Rotate(hash ^ (Load32(stripe + i) * Prime1), 23) * Prime2 + Prime3;
+            i += 4;
+        }
+
+        for (; i < pending; i += 1) {
+            hash = Rotate(hash ^ (stripe[i] * Prime5), 11) * Prime1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= Prime2;
+        hash ^= hash >> 29;
+        hash *= Prime3;
+        hash ^= hash >> 32;
+        return static_cast<uint32_t>(hash);
+    }
+
+    void Consume(const uint8_t *data)
+    {
+        for (size_t i = 0; i < 4; i += 1) {
+            lanes[i] = Round(lanes[i], Load64(data + 8 * i));
+        }
+    }
+
+    uint64_t lanes[4];
+    uint64_t total = 0;
+    uint8_t stripe[32];
+    size_t pending = 0;
+};
+
+ZstdDecoder::ZstdDecoder(ByteSource &source, size_t flushSize) :
+    _input(source),
+    _flushSize(flushSize),
+    _entropy(std::make_unique<Entropy>()),
+    _checksum(std::make_unique<Checksum>()),
+    _literals(MaxBlockSize + CopyOverrun)
+{
+}
+
+ZstdDecoder::~ZstdDecoder() = default;
+
+InflateStatus ZstdDecoder::Fail(InflateStatus status, const char *error)
+{
+    _error = error;
+    return status;
+}
+
+bool ZstdDecoder::SetDictionary(std::vector<uint8_t> dictionary)
+{
+    auto entropy = std::make_unique<Entropy>();
+    uint32_t id = 0;
+    size_t pos = 0;
+    if ((dictionary.size() >= 8) && (Load32(dictionary.data()) == DictionaryMagic)) {
+        // Trained dictionaries start with entropy tables and repeat offsets.
+        id = Load32(dictionary.data() + 4);
+        pos = 8;
+        const uint8_t *data = dictionary.data();
+        const size_t size = dictionary.size();
+        size_t used = 0;
+        if (!ReadLiteralTable(data + pos, size - pos, entropy->literals, &used)) {
+            return false;
+        }
+
+        pos += used;
+        if (!ReadFseTable(data + pos, size - pos, MaxOffsetCode, OffsetMaxLog, entropy->offsets, &used)) {
+            return false;
+        }
+
+        pos += used;
+        if (!ReadFseTable(data + pos, size - pos, MaxMatchLengthCode, MatchLengthMaxLog, entropy->matchLengths, &used)) {
+            return false;
+        }
+
+        pos += used;
+        if (!ReadFseTable(data + pos, size - pos, MaxLiteralLengthCode, LiteralLengthMaxLog, entropy->literalLengths, &used)) {
+            return false;
+        }
+
+        pos += used;
+        if ((size - pos) < 12) {
+            return false;
+        }
+
+        for (size_t i = 0; i < 3; i += 1) {
+            entropy->repeats[i] = Load32(data + pos + 4 * i);
+            if ((entropy->repeats[i] == 0) || (entropy->repeats[i] > (size - pos - 12))) {
+                return false;
+            }
+        }
+
+        pos += 12;
+        entropy->hasLiterals = true;
+        entropy->hasLiteralLengths = true;
+        entropy->hasOffsets = true;
+        entropy->hasMatchLengths = true;
+    }
+
+    dictionary.erase(dictionary.begin(), dictionary.begin() + static_cast<std::ptrdiff_t>(pos));
+    _dictionaryContent = std::move(dictionary);
+    _dictionaryEntropy = std::move(entropy);
+    _dictionaryId = id;
+    return true;
+}
+
+InflateStatus ZstdDecoder::Decode(ByteSink &sink)
+{
+    for (;;) {
+        if (_input.AtEnd()) {
+            if (_frames == 0) {
+                return Fail(InflateStatus::Truncated, "empty zstd stream");
+            }
+
+            return InflateStatus::Ok;
+        }
+
+        if (!_input.Ensure(4)) {
+            return Fail(InflateStatus::Truncated, "truncated zstd frame header");
+        }
+
+        const uint32_t magic = Load32(_input.Data());
+        if ((magic & SkippableMask) == SkippableMagic) {
+            if (!_input.Ensure(8)) {
+                return Fail(InflateStatus::Truncated, "truncated zstd skippable frame");
+            }
+
+            size_t remaining = Load32(_input.Data() + 4);
+            _input.Skip(8);
+            while (remaining > 0) {
+                const size_t count = (remaining < _flushSize) ? remaining : _flushSize;
+                if (!_input.Ensure(count)) {
+                    return Fail(InflateStatus::Truncated, "truncated zstd skippable frame");
+                }
+
+                _input.Skip(count);
+                remaining -= count;
+            }
+
+            continue;
+        }
+
+        if (magic != FrameMagic) {
+            return Fail(InflateStatus::Corrupt, "not a zstd stream");
+        }
+
+        _input.Skip(4);
+        const InflateStatus status = DecodeFrame(sink);
+        if (status != InflateStatus::Ok) {
+            return status;
+        }
+
+        _frames += 1;
+    }
+}
+
+InflateStatus ZstdDecoder::DecodeFrame(ByteSink &sink)
+{
+    if (!_input.Ensure(1)) {
+        return Fail(InflateStatus::Truncated, "truncated zstd frame header");
+    }
+
+    const uint8_t descriptor = _input.Data()[0];
+    const unsigned contentSizeFlag = descriptor >> 6;
+    const bool singleSegment = (descriptor & 0x20) != 0;
+    const bool hasChecksum = (descriptor & 0x04) != 0;
+    if ((descriptor & 0x08) != 0) {
+        return Fail(InflateStatus::Corrupt, "reserved zstd frame header bit set");
+    }
+
+    const size_t idSizes[4] = {0, 1, 2, 4};
+    const size_t contentSizes[4] = {singleSegment ? 1u : 0u, 2, 4, 8};
+    const size_t idSize = idSizes[descriptor & 3];
+    const size_t contentSizeSize = contentSizes[contentSizeFlag];
+    const size_t headerSize = 1 + (singleSegment ? 0 : 1) + idSize + contentSizeSize;
+    if (!_input.Ensure(headerSize)) {
+        return Fail(InflateStatus::Truncated, "truncated zstd frame header");
+    }
+
+    const uint8_t *header = _input.Data() + 1;
+    uint64_t windowSize = 0;
+    if (!singleSegment) {
+        const unsigned exponent = header[0] >> 3;
+        const uint64_t base = uint64_t{1} << (10 + exponent);
+        windowSize = base + (base / 8) * (header[0] & 7);
+        header += 1;
+    }
+
+    const uint32_t id = static_cast<uint32_t>(LoadBytes(header, idSize));
+    header += idSize;
+    uint64_t contentSize = LoadBytes(header, contentSizeSize);
+    if (contentSizeSize == 2) {
+        contentSize += 256;
+    }
+
+    const bool hasContentSize = (contentSizeSize != 0);
+    _input.Skip(headerSize);
+    if (singleSegment) {
+        windowSize = contentSize;
+    }
+
+    if (windowSize > MaxWindowSize) {
+        return Fail(InflateStatus::Corrupt, "zstd window too large");
+    }
+
+    // A frame without a dictionary ID uses the dictionary if one was given,
+    // like the reference decoder does.
+    const bool useDictionary = (_dictionaryEntropy != nullptr);
+    if ((id != 0) && (!useDictionary || (id != _dictionaryId))) {
+        return Fail(InflateStatus::Corrupt, "zstd frame needs a dictionary that was not provided");
+    }
+
+    if (useDictionary) {
+        *_entropy = *_dictionaryEntropy;
+
+    } else {
+        *_entropy = Entropy{};
+    }
+
+    const size_t dictionarySize = useDictionary ? _dictionaryContent.size() : 0;
+    _history = (windowSize > dictionarySize) ? static_cast<size_t>(windowSize) : dictionarySize;
+
+    // Output piles up past the window until the buffer is full, so the
+    // window is moved back to the start once every window written at most
+    // instead of on every flush: with `--long=27` that was 128 MB moved per
+    // MB written.
+    const size_t slack = (_history > _flushSize) ? _history : _flushSize;
+    const size_t required = _history + slack + MaxBlockSize + CopyOverrun;
+    if (_buffer.size() < required) {
+        _buffer.resize(required);
+    }
+
+    if (dictionarySize > 0) {
+        std::memcpy(_buffer.data(), _dictionaryContent.data(), dictionarySize);
+    }
+
+    _pos = dictionarySize;
+    _flushed = _pos;
+    _frameTotal = 0;
+    _checksum->Reset();
+
+    const size_t blockLimit = (windowSize < MaxBlockSize) ? static_cast<size_t>(windowSize) : MaxBlockSize;
+    bool last = false;
+    while (!last) {
+        if (!_input.Ensure(BlockHeaderSize)) {
+            return Fail(InflateStatus::Truncated, "truncated zstd block");
+        }
+
+        const uint32_t blockHeader = Load24(_input.Data());
+        _input.Skip(BlockHeaderSize);
+        last = (blockHeader & 1) != 0;
+        const size_t blockSize = blockHeader >> 3;
+        if (blockSize > blockLimit) {
+            return Fail(InflateStatus::Corrupt, "zstd block too large");
+        }
+
+        switch ((blockHeader >> 1) & 3) {
+        case 0:
+            if (!_input.Ensure(blockSize)) {
+                return Fail(InflateStatus::Truncated, "truncated zstd block");
+            }
+
+            std::memcpy(_buffer.data() + _pos, _input.Data(), blockSize);
+            _input.Skip(blockSize);
+            _pos += blockSize;
+            break;
+
+        case 1:
+            if (!_input.Ensure(1)) {
+                return Fail(InflateStatus::Truncated, "truncated zstd block");
+            }
+
+            std::memset(_buffer.data() + _pos, _input.Data()[0], blockSize);
+            _input.Skip(1);
+            _pos += blockSize;
+            break;
+
+        case 2: {
+            if (!_input.Ensure(blockSize)) {
+                return Fail(InflateStatus::Truncated, "truncated zstd block");
+            }
+
+            const InflateStatus status = DecodeBlock(_input.Data(), blockSize);
+            if (status != InflateStatus::Ok) {
+                return Fail(status, "invalid zstd block");
+            }
+
+            _input.Skip(blockSize);
+            break;
+        }
+
+        default:
+            return Fail(InflateStatus::Corrupt, "reserved zstd block type");
+        }
+
+        if (!Flush(sink, last)) {
+            return Fail(InflateStatus::SinkFailed, "output rejected");
+        }
+    }
+
+    if (hasContentSize && (_frameTotal != contentSize)) {
+        return Fail(InflateStatus::Corrupt, "zstd content size mismatch");
+    }
+
+    if (hasChecksum) {
+        if (!_input.Ensure(4)) {
+            return Fail(InflateStatus::Truncated, "truncated zstd checksum");
+        }
+
+        if (Load32(_input.Data()) != _checksum->Digest()) {
+            return Fail(InflateStatus::Corrupt, "zstd checksum mismatch");
+        }
+
+        _input.Skip(4);
+    }
+
+    return InflateStatus::Ok;
+}
+
+bool ZstdDecoder::Flush(ByteSink &sink, bool force)
+{
+    const size_t pending = _pos - _flushed;
+    if (!force && (pending < _flushSize)) {
+        return true;
+    }
+
+    if (pending > 0) {
+        const uint8_t *data = _buffer.data() + _flushed;
+        _checksum->Update(data, pending);
+        _frameTotal += pending;
+        if (!sink.Write(data, pending)) {
+            return false;
+        }
+    }
+
+    // Keep the last window of output around for back-references, moving it
+    // back only once the blocks until the next flush might not fit.
+    if ((_pos + _flushSize + MaxBlockSize + CopyOverrun) > _buffer.size()) {
+        std::memmove(_buffer.data(), _buffer.data() + _pos - _history, _history);
+        _pos = _history;
+    }
+
+    _flushed = _pos;
+    return true;
+}
+
+InflateStatus ZstdDecoder::DecodeBlock(const uint8_t *data, size_t size)
+{
+    size_t used = 0;
+    const InflateStatus status = DecodeLiterals(data, size, &used);
+    if (status != InflateStatus::Ok) {
+        return status;
+    }
+
+    return DecodeSequences(data + used, size - used);
+}
+
+InflateStatus ZstdDecoder::DecodeLiterals(const uint8_t *data, size_t size, size_t *consumed)
+{
+    if (size == 0) {
+        return InflateStatus::Corrupt;
+    }
+
+    const unsigned type = data[0] & 3;
+    const unsigned sizeFormat = (data[0] >> 2) & 3;
+    if (type < 2) {
+        // Raw or RLE literals.
+        size_t headerSize;
+        size_t count;
+        switch (sizeFormat) {
+        case 1:
+            headerSize = 2;
+            count = (size < headerSize) ? 0 : (Load16(data) >> 4);
+            break;
+
+        case 3:
+            headerSize = 3;
+            count = (size < headerSize) ? 0 : (Load24(data) >> 4);
+            break;
+
+        default:
+            headerSize = 1;
+            count = data[0] >> 3;
+            break;
+        }
+
+        const size_t payload = (type == 0) ? count : 1;
+        if ((count > MaxBlockSize) || ((headerSize + payload) > size)) {
+            return InflateStatus::Corrupt;
+        }
+
+        if (type == 0) {
+            std::memcpy(_literals.data(), data + headerSize, count);
+
+        } else {
+            std::memset(_literals.data(), data[headerSize], count);
+        }
+
+        _literalCount = count;
+        *consumed = headerSize + payload;
+        return InflateStatus::Ok;
+    }
+
+    // Huffman coded literals, either with a new tree or reusing the last one.
+    size_t headerSize;
+    size_t count;
+    size_t compressed;
+    unsigned streams = 4;
+    if ((sizeFormat < 2) && (size >= 3)) {
+        const uint32_t fields = Load24(data);
+        headerSize = 3;
+        count = (fields >> 4) & 0x3ff;
+        compressed = (fields >> 14) & 0x3ff;
+        streams = (sizeFormat == 0) ? 1 : 4;
+
+    } else if ((sizeFormat == 2) && (size >= 4)) {
+        const uint32_t fields = Load32(data);
+        headerSize = 4;
+        count = (fields >> 4) & 0x3fff;
+        compressed = (fields >> 18) & 0x3fff;
+
+    } else if ((sizeFormat == 3) && (size >= 5)) {
+        const uint64_t fields = LoadBytes(data, 5);
+        headerSize = 5;
+        count = (fields >> 4) & 0x3ffff;
+        compressed = (fields >> 22) & 0x3ffff;
+
+    } else {
+        return InflateStatus::Corrupt;
+    }
+
+    if ((count > MaxBlockSize) || ((headerSize + compressed) > size)) {
+        return InflateStatus::Corrupt;
+    }
+
+    const uint8_t *stream = data + headerSize;
+    size_t remaining = compressed;
+    if (type == 2) {
+        size_t used = 0;
+        if (!ReadLiteralTable(stream, remaining, _entropy->literals, &used)) {
+            return InflateStatus::Corrupt;
+        }
+
+        _entropy->hasLiterals = true;
+        stream += used;
+        remaining -= used;
+
+    } else if (!_entropy->hasLiterals) {
+        return InflateStatus::Corrupt;
+    }
+
+    const LiteralTable &table = _entropy->literals;
+    if (streams == 1) {
+        if (!DecodeLiteralStream(table, stream, remaining, _literals.data(), count)) {
+            return InflateStatus::Corrupt;
+        }
+
+    } else {
+        if (remaining < 6) {
+            return InflateStatus::Corrupt;
+        }
+
+        size_t sizes[4] = {Load16(stream), Load16(stream + 2), Load16(stream + 4), 0};
+        const size_t jumpTotal = 6 + sizes[0] + sizes[1] + sizes[2];
+        const size_t segment = (count + 3) / 4;
+        if ((jumpTotal > remaining) || ((3 * segment) > count)) {
+            return InflateStatus::Corrupt;
+        }
+
+        sizes[3] = remaining - jumpTotal;
+        stream += 6;
+        uint8_t *output = _literals.data();
+        for (size_t i = 0; i < 4; i += 1) {
+            const size_t length = (i < 3) ? segment : (count - 3 * segment);
+            if (!DecodeLiteralStream(table, stream, sizes[i], output, length)) {
+                return InflateStatus::Corrupt;
+            }
+
+            stream += sizes[i];
+            output += length;
+        }
+    }
+
+    _literalCount = count;
+    *consumed = headerSize + compressed;
+    return InflateStatus::Ok;
+}
+
+InflateStatus ZstdDecoder::DecodeSequences(const uint8_t *data, size_t size)
+{
+    if (size == 0) {
+        return InflateStatus::Corrupt;
+    }
+
+    size_t pos;
+    size_t count;
+    if (data[0] < 128) {
+        count = data[0];
+        pos = 1;
+
+    } else if ((data[0] < 255) && (size >= 2)) {
+        count = ((data[0] - 128) << 8) + data[1];
+        pos = 2;
+
+    } else if (size >= 3) {
+        count = Load16(data + 1) + 0x7f00;
+        pos = 3;
+
+    } else {
+        return InflateStatus::Corrupt;
+    }
+
+    uint8_t *const buffer = _buffer.data();
+    const size_t blockStart = _pos;
+    size_t out = _pos;
+    const uint8_t *literals = _literals.data();
+    size_t literalsLeft = _literalCount;
+    if (count > 0) {
+        if (pos >= size) {
+            return InflateStatus::Corrupt;
+        }
+
+        const uint8_t modes = data[pos++];
+        if ((modes & 3) != 0) {
+            return InflateStatus::Corrupt;
+        }
+
+        struct TableSpec
+        {
+            unsigned mode;
+            FseTable &table;
+            bool &ready;
+            const FseTable &defaults;
+            unsigned maxSymbol;
+            unsigned maxLog;
+        };
+
+        Entropy &entropy = *_entropy;
+        TableSpec specs[3] = {
+            {static_cast<unsigned>(modes >> 6), entropy.literalLengths, entropy.hasLiteralLengths,
+             DefaultLiteralLengthTable(), MaxLiteralLengthCode, LiteralLengthMaxLog},
+            {static_cast<unsigned>((modes >> 4) & 3), entropy.offsets, entropy.hasOffsets,
+             DefaultOffsetTable(), MaxOffsetCode, OffsetMaxLog},
+            {static_cast<unsigned>((modes >> 2) & 3), entropy.matchLengths, entropy.hasMatchLengths,
+             DefaultMatchLengthTable(), MaxMatchLengthCode, MatchLengthMaxLog},
+        };
+
+        for (TableSpec &spec : specs) {
+            switch (spec.mode) {
+            case 0:
+                spec.table = spec.defaults;
+                break;
+
+            case 1:
+                if ((pos >= size) || (data[pos] > spec.maxSymbol)) {
+                    return InflateStatus::Corrupt;
+                }
+
+                BuildRleTable(spec.table, data[pos]);
+                pos += 1;
+                break;
+
+            case 2: {
+                size_t used = 0;
+                if (!ReadFseTable(data + pos, size - pos, spec.maxSymbol, spec.maxLog, spec.table, &used)) {
+                    return InflateStatus::Corrupt;
+                }
+
+                pos += used;
+                break;
+            }
+
+            default:
+                if (!spec.ready) {
+                    return InflateStatus::Corrupt;
+                }
+
+                break;
+            }
+
+            spec.ready = true;
+        }
+
+        ReverseBitReader bits;
+        if (!bits.Init(data + pos, size - pos)) {
+            return InflateStatus::Corrupt;
+        }
+
+        const FseTable &literalLengths = entropy.literalLengths;
+        const FseTable &offsets = entropy.offsets;
+        const FseTable &matchLengths = entropy.matchLengths;
+        uint32_t literalLengthState = static_cast<uint32_t>(bits.Read(literalLengths.log));
+        uint32_t offsetState = static_cast<uint32_t>(bits.Read(offsets.log));
+        uint32_t matchLengthState = static_cast<uint32_t>(bits.Read(matchLengths.log));
+        uint32_t *repeats = entropy.repeats;
+        for (size_t n = 0; n < count; n += 1) {
+            const FseEntry &literalLengthEntry = literalLengths.entries[literalLengthState];
+            const FseEntry &offsetEntry = offsets.entries[offsetState];
+            const FseEntry &matchLengthEntry = matchLengths.entries[matchLengthState];
+            const unsigned offsetCode = offsetEntry.symbol;
+            const uint64_t offsetValue = (uint64_t{1} << offsetCode) + bits.Read(offsetCode);
+            const size_t matchLength = MatchLengthBase[matchLengthEntry.symbol] +
+                                       static_cast<size_t>(bits.Read(MatchLengthBits[matchLengthEntry.symbol]));
+            const size_t literalLength = LiteralLengthBase[literalLengthEntry.symbol] +
+                                         static_cast<size_t>(bits.Read(LiteralLengthBits[literalLengthEntry.symbol]));
+
+            uint64_t offset;
+            if (offsetValue > 3) {
+                offset = offsetValue - 3;
+                repeats[2] = repeats[1];
+                repeats[1] = repeats[0];
+                repeats[0] = static_cast<uint32_t>(offset);
+
+            } else {
+                // Repeat offsets are shifted by one when there are no literals.
+                const unsigned index = static_cast<unsigned>(offsetValue - 1) + ((literalLength == 0) ? 1 : 0);
+                if (index == 0) {
+                    offset = repeats[0];
+
+                } else {
+                    offset = (index == 3) ? (uint64_t{repeats[0]} - 1) : repeats[index];
+                    if (index > 1) {
+                        repeats[2] = repeats[1];
+                    }
+
+                    repeats[1] = repeats[0];
+                    repeats[0] = static_cast<uint32_t>(offset);
+                }
+            }
+
+            if ((n + 1) < count) {
+                literalLengthState = literalLengthEntry.baseline + static_cast<uint32_t>(bits.Read(literalLengthEntry.bits));
+                matchLengthState = matchLengthEntry.baseline + static_cast<uint32_t>(bits.Read(matchLengthEntry.bits));
+                offsetState = offsetEntry.baseline + static_cast<uint32_t>(bits.Read(offsetEntry.bits));
+            }
+
+            if ((literalLength > literalsLeft) ||
+                ((out - blockStart + literalLength + matchLength) > MaxBlockSize)) {
+                return InflateStatus::Corrupt;
+            }
+
+            CopyChunks(buffer + out, literals, literalLength);
+            literals += literalLength;
+            literalsLeft -= literalLength;
+            out += literalLength;
+            if ((offset == 0) || (offset > out)) {
+                return InflateStatus::Corrupt;
+            }
+
+            CopyMatch(buffer + out, static_cast<size_t>(offset), matchLength);
+            out += matchLength;
+        }
+
+        if (!bits.Finished()) {
+            return InflateStatus::Corrupt;
+        }
+
+    } else if (pos != size) {
+        return InflateStatus::Corrupt;
+    }
+
+    // Literals left over after the last sequence end the block.
+    if ((out - blockStart + literalsLeft) > MaxBlockSize) {
+        return InflateStatus::Corrupt;
+    }
+
+    std::memcpy(buffer + out, literals, literalsLeft);
+    _pos = out + literalsLeft;
+    return InflateStatus::Ok;
+}
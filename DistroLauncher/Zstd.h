@@ -0,0 +1,66 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Inflate.h"
+#include "InputBuffer.h"
+
+// Decodes Zstandard streams (RFC 8878) made of one or more frames, verifying
+// the content size and checksum of every frame that records them. Skippable
+// frames are ignored.
+class ZstdDecoder
+{
+  public:
+    // Largest window accepted, the default limit of the reference decoder.
+    static constexpr size_t MaxWindowSize = size_t{1} << 27;
+
+    explicit ZstdDecoder(ByteSource &source, size_t flushSize = 1 << 20);
+    ~ZstdDecoder();
+
+    // Loads the dictionary the stream was compressed with: either one trained
+    // by `zstd --train` or raw content. Returns false if it is malformed.
+    bool SetDictionary(std::vector<uint8_t> dictionary);
+
+    InflateStatus Decode(ByteSink &sink);
+
+    const std::string &Error() const { return _error; }
+    uint64_t Frames() const { return _frames; }
+
+  private:
+    struct Entropy;
+    struct Checksum;
+
+    InflateStatus DecodeFrame(ByteSink &sink);
+    InflateStatus DecodeBlock(const uint8_t *data, size_t size);
+    InflateStatus DecodeLiterals(const uint8_t *data, size_t size, size_t *consumed);
+    InflateStatus DecodeSequences(const uint8_t *data, size_t size);
+    bool Flush(ByteSink &sink, bool force);
+    InflateStatus Fail(InflateStatus status, const char *error);
+
+    InputBuffer _input;
+    size_t _flushSize;
+    std::unique_ptr<Entropy> _entropy;
+    std::unique_ptr<Checksum> _checksum;
+    std::unique_ptr<Entropy> _dictionaryEntropy;
+    std::vector<uint8_t> _dictionaryContent;
+    uint32_t _dictionaryId = 0;
+
+    std::vector<uint8_t> _buffer;
+    size_t _history = 0;
+    size_t _pos = 0;
+    size_t _flushed = 0;
+    uint64_t _frameTotal = 0;
+    std::vector<uint8_t> _literals;
+    size_t _literalCount = 0;
+    std::string _error;
+    uint64_t _frames = 0;
+};
@@ -0,0 +1,194 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Compares reading a rootfs archive through buffers with reading it through
+// a memory mapping:
+//
+//     archive-read-bench <archive> [iterations] [--cold]
+//
+// Every strategy is measured twice: scanning the raw bytes, which isolates
+// the cost of getting them into memory, and decompressing them, which shows
+// what is left of the difference once the decoder runs. --cold asks the
+// system to drop the archive from the page cache before each run, so that
+// the disk and the read-ahead hints are part of the measurement.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "Decompress.h"
+#include "MappedFile.h"
+
+namespace {
+    class FileSource : public ByteSource
+    {
+      public:
+        FileSource(const char *path, size_t bufferSize) :
+            _file(path, std::ios::binary),
+            _buffer(bufferSize)
+        {
+        }
+
+        bool Next(const uint8_t **data, size_t *size) override
+        {
+            _file.read(reinterpret_cast<char *>(_buffer.data()), static_cast<std::streamsize>(_buffer.size()));
+            *data = _buffer.data();
+            *size = static_cast<size_t>(_file.gcount());
+            return *size > 0;
+        }
+
+      private:
+        std::ifstream _file;
+        std::vector<uint8_t> _buffer;
+    };
+
+    class NullSink : public ByteSink
+    {
+      public:
+        bool Write(const uint8_t *, size_t size) override
+        {
+            bytes += size;
+            return true;
+        }
+
+        uint64_t bytes = 0;
+    };
+
+    struct Result
+    {
+        uint64_t bytes = 0;
+        uint64_t checksum = 0;
+        bool ok = true;
+    };
+
+    // Touches every byte, so that neither strategy gets away with not reading.
+    Result Scan(ByteSource &source)
+    {
+        Result result;
+        const uint8_t *data;
+        size_t size;
+        while (source.Next(&data, &size)) {
+            uint64_t word = 0;
+            size_t index = 0;
+            for (; index + sizeof(word) <= size; index += sizeof(word)) {
+                std::memcpy(&word, data + index, sizeof(word));
+                result.checksum ^= word;
+            }
+
+            for (; index < size; index += 1) {
+                result.checksum ^= data[index];
+            }
+
+            result.bytes += size;
+        }
+
+        return result;
+    }
+
+    Result Decode(ByteSource &source)
+    {
+        NullSink sink;
+        Decompressor decoder(source);
+        Result result;
+        result.ok = (decoder.Decode(sink) == InflateStatus::Ok);
+        result.bytes = sink.bytes;
+        return result;
+    }
+
+    void DropCache(const char *path)
+    {
+        const int descriptor = ::open(path, O_RDONLY);
+        if (descriptor >= 0) {
+            ::posix_fadvise(descriptor, 0, 0, POSIX_FADV_DONTNEED);
+            ::close(descriptor);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s <archive> [iterations] [--cold]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int iterations = 3;
+    bool cold = false;
+    for (int index = 2; index < argc; index += 1) {
+        if (std::strcmp(argv[index], "--cold") == 0) {
+            cold = true;
+
+        } else {
+            iterations = std::atoi(argv[index]);
+        }
+    }
+
+    const char *path = argv[1];
+    struct Strategy
+    {
+        const char *name;
+        size_t bufferSize;
+    };
+
+    // A zero buffer size stands for the mapping.
+    const Strategy strategies[] = {
+        {"read 64 KiB", 64 << 10},
+        {"read 1 MiB", 1 << 20},
+        {"mapped", 0},
+    };
+
+    for (const bool decode : {false, true}) {
+        for (const Strategy &strategy : strategies) {
+            double best = 0;
+            Result result;
+            for (int iteration = 0; iteration < iterations; iteration += 1) {
+                if (cold) {
+                    DropCache(path);
+                }
+
+                const auto start = std::chrono::steady_clock::now();
+                if (strategy.bufferSize == 0) {
+                    MappedFile file;
+                    if (!file.Open(path)) {
+                        std::fprintf(stderr, "%s\n", file.Error().c_str());
+                        return EXIT_FAILURE;
+                    }
+
+                    MappedSource source(file);
+                    result = decode ? Decode(source) : Scan(source);
+
+                } else {
+                    FileSource source(path, strategy.bufferSize);
+                    result = decode ? Decode(source) : Scan(source);
+                }
+
+                const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if ((iteration == 0) || (seconds < best)) {
+                    best = seconds;
+                }
+            }
+
+            if (!result.ok) {
+                std::fprintf(stderr, "%s: cannot decompress %s\n", strategy.name, path);
+                return EXIT_FAILURE;
+            }
+
+            std::printf("%-6s %-12s %.1f MiB in %.3f s (%.1f MiB/s), checksum %016llx\n",
+                        decode ? "decode" : "scan",
+                        strategy.name,
+                        result.bytes / (1024.0 * 1024.0),
+                        best,
+                        (best > 0) ? (result.bytes / (1024.0 * 1024.0)) / best : 0.0,
+                        static_cast<unsigned long long>(result.checksum));
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,213 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Checks and measures the scheduling of `run --batch` with backends standing
+// in for WSL launches:
+//
+//     batch-bench [commands] [jobs]
+//
+// A scripted backend, whose commands name how long they take and how they
+// exit, checks manifest parsing, the bound on commands running at once, that
+// results end up with their commands and that reports are never concurrent.
+// A shell backend then runs real commands with fork and exec, capturing their
+// output like the launcher does, to check timeouts and to compare the given
+// number of short commands, which mostly wait like a WSL launch does, run one
+// at a time and with the given parallelism.
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+#include "BatchRunner.h"
+#include "PipeCapture.h"
+
+namespace {
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool Check(bool passed, const char *what, int *failures)
+    {
+        std::printf("  %-48s %s\n", what, passed ? "ok" : "FAILED");
+        *failures += passed ? 0 : 1;
+        return passed;
+    }
+
+    // Commands are "<milliseconds> <exit code>"; a negative exit code makes
+    // the launch fail.
+    class ScriptedBackend : public BatchBackend
+    {
+      public:
+        BatchResult Run(const std::string &command, std::chrono::milliseconds) override
+        {
+            const int running = _running.fetch_add(1) + 1;
+            int peak = _peak.load();
+            while ((running > peak) && !_peak.compare_exchange_weak(peak, running)) {
+            }
+
+            char *end;
+            const long milliseconds = std::strtol(command.c_str(), &end, 10);
+            const long exitCode = std::strtol(end, nullptr, 10);
+            std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+            _running.fetch_sub(1);
+
+            BatchResult result;
+            if (exitCode >= 0) {
+                result.status = BatchStatus::Ok;
+                result.exitCode = static_cast<unsigned long>(exitCode);
+                result.output = "ran " + command;
+            }
+
+            return result;
+        }
+
+        int Peak() const { return _peak.load(); }
+
+      private:
+        std::atomic<int> _running{0};
+        std::atomic<int> _peak{0};
+    };
+
+    class ShellBackend : public BatchBackend
+    {
+      public:
+        BatchResult Run(const std::string &command, std::chrono::milliseconds timeout) override
+        {
+            BatchResult result;
+            PipeCapture capture;
+            if (!capture.Open(true, true)) {
+                result.error = capture.Error();
+                return result;
+            }
+
+            const pid_t child = ::fork();
+            if (child == 0) {
+                ::dup2(capture.OutputWriter(), STDOUT_FILENO);
+                ::dup2(capture.ErrorWriter(), STDERR_FILENO);
+                ::execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char *>(nullptr));
+                ::_exit(127);
+            }
+
+            capture.CloseWriters();
+            const CaptureStatus status = capture.Read(timeout);
+            result.status = (status == CaptureStatus::Ok) ? BatchStatus::Ok :
+                            (status == CaptureStatus::TimedOut) ? BatchStatus::TimedOut : BatchStatus::IoError;
+
+            if (result.status != BatchStatus::Ok) {
+                ::kill(child, SIGKILL);
+            }
+
+            int wstatus = 0;
+            ::waitpid(child, &wstatus, 0);
+            result.exitCode = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+            result.output = capture.Output();
+            result.errorOutput = capture.ErrorOutput();
+            return result;
+        }
+    };
+}
+
+int main(int argc, char *argv[])
+{
+    const int commands = (argc > 1) ? std::atoi(argv[1]) : 100;
+    const int jobs = (argc > 2) ? std::atoi(argv[2]) : 8;
+    if ((argc > 3) || (commands <= 0) || (jobs <= 0)) {
+        std::fprintf(stderr, "usage: %s [commands] [jobs]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    {
+        ScriptedBackend backend;
+        BatchRunner runner(backend, 4);
+        runner.Parse("\xEF\xBB\xBF# comment\r\n20 0\r\n\r\n   \t\n  30 1  \n40 -1\n50 0");
+        const auto &parsed = runner.Commands();
+        Check((parsed.size() == 4) && (parsed[0].line == 2) && (parsed[0].text == "20 0") && (parsed[1].line == 5) &&
+                  (parsed[1].text == "30 1") && (parsed[3].line == 7),
+              "manifest lines, comments, CRLF and BOM",
+              &failures);
+
+        std::string text;
+        for (int i = 0; i < 40; i += 1) {
+            text += std::to_string(10 + (i * 7) % 30) + " " + std::to_string(i % 5 == 0 ? 1 : 0) + "\n";
+        }
+
+        runner.Parse(text);
+        std::atomic<bool> reporting{false};
+        bool exclusive = true;
+        size_t reports = 0;
+        runner.Run(std::chrono::milliseconds::max(), [&](size_t index, const BatchRunner::Command &command, const BatchResult &result) {
+            exclusive = exclusive && !reporting.exchange(true);
+            exclusive = exclusive && (result.output == "ran " + runner.Commands()[index].text) && (&command == &runner.Commands()[index]);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            reports += 1;
+            reporting.store(false);
+        });
+
+        Check(backend.Peak() == 4, "at most 4 commands at once, and 4 reached", &failures);
+        Check(exclusive && (reports == 40), "one report per command, one at a time", &failures);
+        Check(runner.Failures() == 8, "failures counted", &failures);
+
+        ScriptedBackend failing;
+        BatchRunner launches(failing, 2);
+        launches.Parse("1 0\n1 -1\n");
+        launches.Run(std::chrono::milliseconds::max());
+        Check(launches.Results()[0].Succeeded() && (launches.Results()[1].status == BatchStatus::LaunchFailed),
+              "failed launches reported",
+              &failures);
+
+        Check((BatchRunner::Tag("[3] ", "a\nb") == "[3] a\n[3] b\n") && BatchRunner::Tag("[3] ", "").empty() &&
+                  (BatchRunner::Tag("[3] ", "a\n\n") == "[3] a\n[3] \n"),
+              "output lines tagged",
+              &failures);
+    }
+
+    {
+        ShellBackend backend;
+        BatchRunner runner(backend, 2);
+        runner.Parse("echo out; echo err >&2; exit 3\nsleep 5\n");
+        const auto start = std::chrono::steady_clock::now();
+        runner.Run(std::chrono::milliseconds(200));
+        const auto &results = runner.Results();
+        Check((results[0].output == "out\n") && (results[0].errorOutput == "err\n") && (results[0].exitCode == 3),
+              "streams and exit code through the shell",
+              &failures);
+
+        Check((results[1].status == BatchStatus::TimedOut) && (Seconds(start) < 2.0), "timed out command stopped", &failures);
+
+        std::string text;
+        for (int i = 0; i < commands; i += 1) {
+            text += "sleep 0.02; echo " + std::to_string(i) + "\n";
+        }
+
+        BatchRunner serial(backend, 1);
+        serial.Parse(text);
+        auto begin = std::chrono::steady_clock::now();
+        serial.Run(std::chrono::milliseconds::max());
+        const double serialSeconds = Seconds(begin);
+
+        BatchRunner parallel(backend, static_cast<unsigned int>(jobs));
+        parallel.Parse(text);
+        begin = std::chrono::steady_clock::now();
+        parallel.Run(std::chrono::milliseconds::max());
+        const double parallelSeconds = Seconds(begin);
+
+        bool complete = (serial.Failures() == 0) && (parallel.Failures() == 0);
+        for (int i = 0; i < commands; i += 1) {
+            complete = complete && (parallel.Results()[i].output == std::to_string(i) + "\n");
+        }
+
+        Check(complete, "every command's output kept with it", &failures);
+        std::printf("%d commands: %.3f s one at a time, %.3f s with %d at once\n", commands, serialSeconds, parallelSeconds, jobs);
+    }
+
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
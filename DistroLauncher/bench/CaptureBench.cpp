@@ -0,0 +1,103 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Checks and measures output capture with the epoll backend, the launcher's
+// overlapped one having the same structure:
+//
+//     capture-bench [megabytes] [iterations]
+//
+// Each run starts a shell writing the given amount to both of its streams at
+// once, far more than a pipe holds, and checks that every byte arrives. A
+// last run checks that a silent child makes Read time out, and that reading
+// resumes and ends once the child is gone.
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "PipeCapture.h"
+
+namespace {
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    pid_t Spawn(PipeCapture &capture, const std::string &command)
+    {
+        const pid_t child = ::fork();
+        if (child == 0) {
+            ::dup2(capture.OutputWriter(), STDOUT_FILENO);
+            ::dup2(capture.ErrorWriter(), STDERR_FILENO);
+            ::execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char *>(nullptr));
+            ::_exit(127);
+        }
+
+        capture.CloseWriters();
+        return child;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const long megabytes = (argc > 1) ? std::atol(argv[1]) : 64;
+    const int iterations = (argc > 2) ? std::atoi(argv[2]) : 3;
+    if ((argc > 3) || (megabytes <= 0) || (iterations <= 0)) {
+        std::fprintf(stderr, "usage: %s [megabytes] [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const size_t bytes = static_cast<size_t>(megabytes) << 20;
+    const std::string count = std::to_string(bytes);
+    const std::string command = "head -c " + count + " /dev/zero >&2 & head -c " + count + " /dev/zero; wait";
+    for (int iteration = 0; iteration < iterations; iteration += 1) {
+        PipeCapture capture;
+        if (!capture.Open(true, true)) {
+            std::fprintf(stderr, "%s\n", capture.Error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const pid_t child = Spawn(capture, command);
+        const CaptureStatus status = capture.Read();
+        const double seconds = Seconds(start);
+        ::waitpid(child, nullptr, 0);
+        if ((status != CaptureStatus::Ok) || (capture.Output().size() != bytes) || (capture.ErrorOutput().size() != bytes)) {
+            std::fprintf(stderr, "run %d: got %zu and %zu bytes out of %zu: %s\n",
+                         iteration + 1,
+                         capture.Output().size(),
+                         capture.ErrorOutput().size(),
+                         bytes,
+                         capture.Error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        std::printf("run %d: %.3f s, %.1f MiB/s across both streams\n", iteration + 1, seconds, 2.0 * megabytes / seconds);
+    }
+
+    PipeCapture capture;
+    if (!capture.Open(true, true)) {
+        std::fprintf(stderr, "%s\n", capture.Error().c_str());
+        return EXIT_FAILURE;
+    }
+
+    const pid_t child = Spawn(capture, "echo started; exec sleep 30");
+    auto start = std::chrono::steady_clock::now();
+    const CaptureStatus timedOut = capture.Read(std::chrono::milliseconds(200));
+    const double waited = Seconds(start);
+    ::kill(child, SIGKILL);
+    ::waitpid(child, nullptr, 0);
+    const CaptureStatus ended = capture.Read(std::chrono::milliseconds(1000));
+    if ((timedOut != CaptureStatus::TimedOut) || (ended != CaptureStatus::Ok) || (capture.Output() != "started\n")) {
+        std::fprintf(stderr, "timeout: wrong outcome after %.3f s: %s\n", waited, capture.Error().c_str());
+        return EXIT_FAILURE;
+    }
+
+    std::printf("timeout: timed out after %.3f s, output kept, ended once the child was killed\n", waited);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Measures how much a chunk store saves across releases, and how fast rootfses
+// are rebuilt from it:
+//
+//     chunk-store-bench <store> <manifest>...
+//
+// Manifests and the store come from `prepare-build chunk`. For each manifest,
+// the rootfs is assembled and validated without being written anywhere; the
+// summary compares the data shared by all the manifests with their total.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+
+#include "ChunkStore.h"
+
+namespace {
+    class CountingSink : public TarSink
+    {
+      public:
+        bool OnEntry(const TarEntry &) override
+        {
+            entries += 1;
+            return true;
+        }
+
+        bool OnData(const uint8_t *, size_t) override { return true; }
+        bool OnEntryEnd() override { return true; }
+        bool OnArchiveEnd() override { return true; }
+
+        uint64_t entries = 0;
+    };
+
+    double Megabytes(uint64_t bytes)
+    {
+        return static_cast<double>(bytes) / 1e6;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        std::fprintf(stderr, "usage: %s <store> <manifest>...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    ChunkStore store(argv[1]);
+    std::set<std::string> unique;
+    uint64_t totalBytes = 0;
+    uint64_t uniqueBytes = 0;
+    std::printf("%-40s %8s %10s %10s %10s %10s\n", "manifest", "chunks", "new", "tar MB", "seconds", "MB/s");
+    for (int index = 2; index < argc; index += 1) {
+        ChunkManifest manifest;
+        if (!manifest.Load(argv[index])) {
+            std::fprintf(stderr, "%s: %s\n", argv[index], manifest.Error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        // Chunks not seen in an earlier manifest are what installing this
+        // release after the previous ones would have to fetch.
+        uint64_t newChunks = 0;
+        for (const ChunkRef &chunk : manifest.Chunks()) {
+            if (unique.insert(ChunkStore::ChunkPath(chunk).u8string()).second) {
+                newChunks += 1;
+                uniqueBytes += chunk.size;
+            }
+        }
+
+        totalBytes += manifest.Size();
+        CountingSink sink;
+        const auto start = std::chrono::steady_clock::now();
+        if (store.Import(manifest, sink) != RootfsStatus::Ok) {
+            std::fprintf(stderr, "%s: %s\n", argv[index], store.Error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("%-40s %8zu %10llu %10.1f %10.3f %10.1f\n",
+                    argv[index],
+                    manifest.Chunks().size(),
+                    static_cast<unsigned long long>(newChunks),
+                    Megabytes(manifest.Size()),
+                    seconds,
+                    (seconds > 0) ? Megabytes(manifest.Size()) / seconds : 0.0);
+    }
+
+    std::printf("total %.1f MB of rootfses, %.1f MB of distinct chunks (%.1f%% saved)\n",
+                Megabytes(totalBytes),
+                Megabytes(uniqueBytes),
+                (totalBytes > 0) ? 100.0 * (1.0 - static_cast<double>(uniqueBytes) / totalBytes) : 0.0);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,211 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Checks ConsoleWriter and measures what buffering the launcher's output
+// saves on a message-heavy run:
+//
+//     console-bench [commands]
+//
+// The checks cover both encodings: wide text written as UTF-8, output from
+// the distribution converted to UTF-16 as a console takes it, and buffers
+// filling up. The measurement prints what `run --batch` prints for the given
+// number of commands, a tagged line of output and an exit code message from
+// the catalog each, into a pipe read by another thread as a redirected log
+// would be: first with a write for every message, as printing with wprintf
+// did, then with one write for every command, as the launcher now does.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include "ConsoleWriter.h"
+#include "MessageCatalog.h"
+
+namespace {
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool Check(bool passed, const char *what, int *failures)
+    {
+        std::printf("  %-48s %s\n", what, passed ? "ok" : "FAILED");
+        *failures += passed ? 0 : 1;
+        return passed;
+    }
+
+    // Everything written to a writer, read back through a temporary file.
+    class Capture
+    {
+      public:
+        Capture()
+        {
+            char path[] = "/tmp/console-bench-XXXXXX";
+            _fd = ::mkstemp(path);
+            ::unlink(path);
+        }
+
+        ~Capture() { ::close(_fd); }
+
+        int Fd() const { return _fd; }
+
+        std::string Contents() const
+        {
+            std::string contents;
+            char buffer[4096];
+            ssize_t count;
+            for (off_t offset = 0; (count = ::pread(_fd, buffer, sizeof(buffer), offset)) > 0; offset += count) {
+                contents.append(buffer, static_cast<size_t>(count));
+            }
+
+            return contents;
+        }
+
+      private:
+        int _fd;
+    };
+
+    std::string Utf16(std::initializer_list<char16_t> units)
+    {
+        const std::u16string text(units);
+        return std::string(reinterpret_cast<const char *>(text.data()), text.size() * sizeof(char16_t));
+    }
+
+    void CheckEncoding(int *failures)
+    {
+        {
+            Capture capture;
+            {
+                ConsoleWriter writer(capture.Fd());
+                const wchar_t text[] = {L'c', 0xe9, L' ', 0x20ac, L' ', static_cast<wchar_t>(0x1f600), L' ', static_cast<wchar_t>(0xd800), L'!'};
+                writer.Append(text, sizeof(text) / sizeof(text[0]));
+            }
+
+            Check(capture.Contents() == "c\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 \xef\xbf\xbd!", "wide text written as UTF-8", failures);
+        }
+
+        {
+            Capture capture;
+            ConsoleWriter writer(capture.Fd(), ConsoleWriter::Encoding::Utf16);
+            const std::string text = "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80";
+            for (const char c : text) {
+                writer.AppendUtf8(&c, 1);
+            }
+
+            writer.AppendUtf8("\xff\xe2\x82" "A\xed\xa0\x80\xc0\xaf", 9);
+            writer.Flush();
+            Check(capture.Contents() == Utf16({0xe9, 0x20ac, 0xd83d, 0xde00, 0xfffd, 0xfffd, u'A', 0xfffd, 0xfffd, 0xfffd}),
+                  "UTF-8 converted, split and invalid",
+                  failures);
+        }
+
+        {
+            Capture capture;
+            ConsoleWriter writer(capture.Fd());
+            for (int index = 0; index < 100; index += 1) {
+                writer.Append(L"a message\r\n");
+                writer.AppendUtf8("some output\n", 12);
+            }
+
+            Check(writer.Flush() && (writer.Writes() == 1) && (capture.Contents().size() == 100 * 23), "a phase in one write", failures);
+            Check(writer.Flush() && (writer.Writes() == 1), "nothing to flush, nothing written", failures);
+        }
+
+        {
+            Capture capture;
+            std::wstring wide;
+            std::string expected;
+            for (int index = 0; index < 1000; index += 1) {
+                wide += static_cast<wchar_t>(L'a' + (index % 26));
+                expected += static_cast<char>('a' + (index % 26));
+            }
+
+            ConsoleWriter writer(capture.Fd(), 64);
+            writer.Append(wide);
+            writer.AppendUtf8(expected.data(), expected.size());
+            writer.Flush();
+            Check((capture.Contents() == expected + expected) && (writer.Writes() > 20) && (writer.Pending() == 0), "larger than the buffer, in order", failures);
+        }
+    }
+
+    // Prints what a batch of commands prints through the writer, flushing
+    // after every message or after every command.
+    void PrintBatch(ConsoleWriter *writer, size_t commands, bool everyMessage)
+    {
+        // MSG_BATCH_EXIT_CODE.
+        const wchar_t *exitCode = MessageCatalog::Text(1016);
+        wchar_t buffer[MessageFormat::BufferSize];
+        for (size_t command = 0; command < commands; command += 1) {
+            const std::string line = "[" + std::to_string(command + 1) + "] make: *** [Makefile:12: all] Error 2\n";
+            writer->AppendUtf8(line.data(), line.size());
+            if (everyMessage) {
+                writer->Flush();
+            }
+
+            const MessageValue values[] = {MessageValue(command + 1), MessageValue(2)};
+            writer->Append(buffer, MessageFormat::Format(exitCode, values, 2, buffer, MessageFormat::BufferSize));
+            writer->Flush();
+        }
+    }
+
+    double Measure(const char *name, size_t commands, bool everyMessage, uint64_t *writes, uint64_t *bytes)
+    {
+        int fds[2];
+        if (::pipe(fds) != 0) {
+            return 0;
+        }
+
+        *bytes = 0;
+        std::thread reader([&] {
+            char buffer[64 << 10];
+            ssize_t count;
+            while ((count = ::read(fds[0], buffer, sizeof(buffer))) > 0) {
+                *bytes += static_cast<uint64_t>(count);
+            }
+        });
+
+        const auto start = std::chrono::steady_clock::now();
+        {
+            ConsoleWriter writer(fds[1]);
+            PrintBatch(&writer, commands, everyMessage);
+            *writes = writer.Writes();
+        }
+
+        ::close(fds[1]);
+        reader.join();
+        const double seconds = Seconds(start);
+        ::close(fds[0]);
+        std::printf("%-24s %8.1f ns/command, %llu writes\n", name, 1e9 * seconds / commands, static_cast<unsigned long long>(*writes));
+        return seconds;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const long commands = (argc > 1) ? std::atol(argv[1]) : 200000;
+    if ((argc > 2) || (commands <= 0)) {
+        std::fprintf(stderr, "usage: %s [commands]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    CheckEncoding(&failures);
+
+    uint64_t messageWrites;
+    uint64_t messageBytes;
+    uint64_t phaseWrites;
+    uint64_t phaseBytes;
+    std::printf("%ld batch commands into a pipe:\n", commands);
+    const double perMessage = Measure("a write a message", static_cast<size_t>(commands), true, &messageWrites, &messageBytes);
+    const double perPhase = Measure("a write a command", static_cast<size_t>(commands), false, &phaseWrites, &phaseBytes);
+    Check((messageBytes == phaseBytes) && (phaseWrites == static_cast<uint64_t>(commands)) && (messageWrites == 2 * phaseWrites),
+          "same output, half the writes",
+          &failures);
+
+    std::printf("buffered: %.2fx as fast\n", perMessage / perPhase);
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
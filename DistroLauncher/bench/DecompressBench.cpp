@@ -0,0 +1,283 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Compares decompression speed across archive formats:
+//
+//     decompress-bench [--fixtures <dir>] [--dict <file>] [--iterations <n>] [<archive>...]
+//
+// Each archive is loaded into memory first so that only decoding is timed,
+// and the best of the iterations is reported. Speedups are relative to the
+// first archive, so pass the gzip rootfs first to compare against it:
+//
+//     decompress-bench install.tar.gz install.tar.zst install.tar.xz
+//
+// --fixtures first checks the zstd and xz decoders against the small archives
+// of testdata/, each of which decompresses to testdata/status. They were made
+// with the zstd and xz tools:
+//
+//     zstd -19 status -o status.zst
+//     zstd -3 -c <first 9000 bytes> > status.frames.zst
+//     zstd -19 -c <the rest> >> status.frames.zst
+//     zstd --train <dpkg status samples> --maxdict=2048 -o status.dict
+//     zstd -19 -D status.dict status -o status.dict.zst
+//     xz -9 -kc status > status.xz
+//     xz -6 --check=crc32 --block-size=4KiB -kc status > status.blocks.xz
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "Decompress.h"
+
+namespace {
+    // Hands out the in-memory archive in read-sized chunks, like the pipeline does.
+    class ChunkedSource : public ByteSource
+    {
+      public:
+        explicit ChunkedSource(const std::vector<uint8_t> &data, size_t chunkSize = 1 << 20) :
+            _data(data),
+            _chunkSize(chunkSize)
+        {
+        }
+
+        bool Next(const uint8_t **data, size_t *size) override
+        {
+            if (_offset == _data.size()) {
+                return false;
+            }
+
+            const size_t count = ((_data.size() - _offset) < _chunkSize) ? (_data.size() - _offset) : _chunkSize;
+            *data = _data.data() + _offset;
+            *size = count;
+            _offset += count;
+            return true;
+        }
+
+      private:
+        const std::vector<uint8_t> &_data;
+        size_t _chunkSize;
+        size_t _offset = 0;
+    };
+
+    class CountingSink : public ByteSink
+    {
+      public:
+        bool Write(const uint8_t *, size_t size) override
+        {
+            bytes += size;
+            return true;
+        }
+
+        uint64_t bytes = 0;
+    };
+
+    class VectorSink : public ByteSink
+    {
+      public:
+        bool Write(const uint8_t *data, size_t size) override
+        {
+            bytes.insert(bytes.end(), data, data + size);
+            return true;
+        }
+
+        std::vector<uint8_t> bytes;
+    };
+
+    bool ReadFile(const std::filesystem::path &path, std::vector<uint8_t> *contents)
+    {
+        std::ifstream file(path, std::ios::binary);
+        contents->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return static_cast<bool>(file) || file.eof();
+    }
+
+    bool Check(bool passed, const std::string &what, int *failures)
+    {
+        std::printf("  %-56s %s\n", what.c_str(), passed ? "ok" : "FAILED");
+        *failures += passed ? 0 : 1;
+        return passed;
+    }
+
+    InflateStatus Decode(const std::vector<uint8_t> &archive, const std::vector<uint8_t> &dictionary, size_t chunkSize,
+                         std::vector<uint8_t> *output, CompressionFormat *format = nullptr)
+    {
+        ChunkedSource source(archive, chunkSize);
+        VectorSink sink;
+        DecompressOptions options;
+        options.flushSize = 4096;
+        options.dictionary = dictionary;
+        Decompressor decoder(source, options);
+        const InflateStatus status = decoder.Decode(sink);
+        if (format != nullptr) {
+            *format = decoder.Format();
+        }
+
+        *output = std::move(sink.bytes);
+        return status;
+    }
+
+    // Whether an archive decodes to the expected content, handed over in one
+    // piece and in chunks small enough to split every header.
+    bool Decodes(const std::vector<uint8_t> &archive, const std::vector<uint8_t> &dictionary, CompressionFormat expectedFormat,
+                 const std::vector<uint8_t> &expected)
+    {
+        for (const size_t chunkSize : {size_t{1} << 20, size_t{13}}) {
+            std::vector<uint8_t> output;
+            CompressionFormat format;
+            if ((Decode(archive, dictionary, chunkSize, &output, &format) != InflateStatus::Ok) || (format != expectedFormat) ||
+                (output != expected)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void CheckFixtures(const std::filesystem::path &directory, int *failures)
+    {
+        std::printf("checks:\n");
+        std::vector<uint8_t> expected;
+        std::vector<uint8_t> dictionary;
+        if (!Check(ReadFile(directory / "status", &expected) && !expected.empty() && ReadFile(directory / "status.dict", &dictionary) &&
+                       !dictionary.empty(),
+                   "fixtures found", failures)) {
+            return;
+        }
+
+        const struct
+        {
+            const char *file;
+            CompressionFormat format;
+            bool dictionary;
+            const char *what;
+        } fixtures[] = {
+            {"status.zst", CompressionFormat::Zstd, false, "zstd frame"},
+            {"status.frames.zst", CompressionFormat::Zstd, false, "zstd frames of two levels"},
+            {"status.dict.zst", CompressionFormat::Zstd, true, "zstd frame with a trained dictionary"},
+            {"status.xz", CompressionFormat::Xz, false, "xz stream"},
+            {"status.blocks.xz", CompressionFormat::Xz, false, "xz blocks with CRC-32 checks"},
+        };
+
+        std::vector<std::vector<uint8_t>> archives;
+        for (const auto &fixture : fixtures) {
+            archives.emplace_back();
+            Check(ReadFile(directory / fixture.file, &archives.back()) &&
+                      Decodes(archives.back(), fixture.dictionary ? dictionary : std::vector<uint8_t>(), fixture.format, expected),
+                  fixture.what, failures);
+        }
+
+        // The dictionary is named by its ID in the frame header, which a
+        // dictionary of raw content does not have.
+        std::vector<uint8_t> output;
+        Check(Decode(archives[2], {}, 1 << 20, &output) != InflateStatus::Ok, "zstd frame without its dictionary rejected", failures);
+        Check(Decode(archives[2], expected, 1 << 20, &output) != InflateStatus::Ok, "zstd frame with another dictionary rejected",
+              failures);
+
+        for (const size_t index : {size_t{0}, size_t{3}}) {
+            const std::string format = CompressionName(fixtures[index].format);
+            std::vector<uint8_t> damaged = archives[index];
+            damaged[damaged.size() / 2] ^= 0x10;
+            Check(Decode(damaged, {}, 1 << 20, &output) != InflateStatus::Ok, format + ": damaged stream rejected", failures);
+
+            damaged = archives[index];
+            damaged.resize(damaged.size() - 10);
+            Check(Decode(damaged, {}, 1 << 20, &output) == InflateStatus::Truncated, format + ": truncated stream rejected", failures);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = 5;
+    const char *fixtures = nullptr;
+    std::vector<uint8_t> dictionary;
+    std::vector<const char *> archives;
+    for (int index = 1; index < argc; index += 1) {
+        if ((std::strcmp(argv[index], "--fixtures") == 0) && (index + 1 < argc)) {
+            fixtures = argv[++index];
+
+        } else if ((std::strcmp(argv[index], "--dict") == 0) && (index + 1 < argc)) {
+            if (!ReadFile(argv[++index], &dictionary)) {
+                std::fprintf(stderr, "cannot read %s\n", argv[index]);
+                return EXIT_FAILURE;
+            }
+
+        } else if ((std::strcmp(argv[index], "--iterations") == 0) && (index + 1 < argc)) {
+            iterations = std::atoi(argv[++index]);
+
+        } else {
+            archives.push_back(argv[index]);
+        }
+    }
+
+    if (((fixtures == nullptr) && archives.empty()) || (iterations < 1)) {
+        std::fprintf(stderr, "usage: %s [--fixtures <dir>] [--dict <file>] [--iterations <n>] [<archive>...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    if (fixtures != nullptr) {
+        CheckFixtures(fixtures, &failures);
+    }
+
+    if (archives.empty() || (failures != 0)) {
+        return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    std::printf("%-8s %12s %12s %8s %12s %12s %8s  %s\n",
+                "format", "in MB", "out MB", "ratio", "in MB/s", "out MB/s", "speedup", "archive");
+    double baseline = 0;
+    for (const char *path : archives) {
+        std::vector<uint8_t> archive;
+        if (!ReadFile(path, &archive)) {
+            std::fprintf(stderr, "cannot read %s\n", path);
+            return EXIT_FAILURE;
+        }
+
+        double best = 0;
+        uint64_t output = 0;
+        CompressionFormat format = CompressionFormat::Unknown;
+        for (int iteration = 0; iteration < iterations; iteration += 1) {
+            ChunkedSource source(archive);
+            CountingSink sink;
+            DecompressOptions options;
+            options.dictionary = dictionary;
+            Decompressor decoder(source, options);
+            const auto start = std::chrono::steady_clock::now();
+            if (decoder.Decode(sink) != InflateStatus::Ok) {
+                std::fprintf(stderr, "decoding %s failed: %s\n", path, decoder.Error().c_str());
+                return EXIT_FAILURE;
+            }
+
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if ((iteration == 0) || (seconds < best)) {
+                best = seconds;
+            }
+
+            output = sink.bytes;
+            format = decoder.Format();
+        }
+
+        if (baseline == 0) {
+            baseline = best;
+        }
+
+        std::printf("%-8s %12.1f %12.1f %8.2f %12.1f %12.1f %7.2fx  %s\n",
+                    CompressionName(format),
+                    archive.size() / 1e6,
+                    output / 1e6,
+                    archive.empty() ? 0.0 : static_cast<double>(output) / archive.size(),
+                    archive.size() / 1e6 / best,
+                    output / 1e6 / best,
+                    baseline / best,
+                    path);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Launcher.h"
+
+// A console with its input scripted and everything printed recorded.
+class FakeConsole : public LauncherConsole
+{
+  public:
+    // Thrown when the launcher asks for more input than was scripted, where
+    // a real console would wait for it.
+    struct OutOfInput : std::runtime_error
+    {
+        OutOfInput() : std::runtime_error("out of input") {}
+    };
+
+    void Print(LauncherMessage message, const std::vector<MessageArgument> &arguments = {}) override;
+    std::wstring Format(LauncherMessage message, const std::vector<MessageArgument> &arguments = {}) override;
+    void SetJsonOutput(bool json) override;
+    void PrintError(LauncherResult result) override;
+    void Write(Stream stream, const std::string &data) override;
+    std::wstring ReadWord(LauncherMessage prompt, size_t maxCharacters, bool showPrompt = true) override;
+    void WaitForKey() override;
+    void Flush() override;
+
+    bool Printed(LauncherMessage message) const;
+
+    // Words returned by ReadWord in turn.
+    std::vector<std::wstring> input;
+
+    std::vector<LauncherMessage> messages;
+    std::vector<std::vector<MessageArgument>> arguments;
+    std::vector<LauncherResult> errors;
+    std::string output;
+    std::string errorOutput;
+    size_t keyWaits = 0;
+    bool json = false;
+
+    // Whether anything was printed since the last flush.
+    bool pending = false;
+
+  private:
+    size_t _read = 0;
+};
+
+// WSL as far as the launcher can tell, kept in memory: whether the
+// distribution is registered, its user accounts and default user. Launched
+// commands are recognised by what the launcher sends: account creation and
+// UID and name queries act on the accounts, as do provisioning scripts;
+// snapshots stream a root file system whose /etc/passwd lists the accounts,
+// and registering one brings them back, along with the sizes of its files;
+// batch commands `exit <code>` and
+// `hang` exit or time out, and anything else is echoed, as are commands
+// run for their output with --output=json.
+class FakeWsl : public WslBackend
+{
+  public:
+    bool IsOptionalComponentInstalled() override;
+    bool IsDistributionRegistered() override;
+    LauncherResult RegisterDistribution() override;
+    LauncherResult RegisterSnapshot(const std::filesystem::path &snapshot) override;
+    LauncherResult ConfigureDistribution(uint32_t defaultUid) override;
+    LauncherResult GetDefaultUid(uint32_t *defaultUid) override;
+    LauncherResult LaunchInteractive(const std::wstring &command, bool useCurrentWorkingDirectory, uint32_t *exitCode) override;
+    LauncherResult LaunchForOutput(const std::wstring &command,
+                                   std::string *output,
+                                   uint32_t *exitCode,
+                                   std::chrono::milliseconds timeout) override;
+    LauncherResult LaunchForStreamAsRoot(const std::wstring &command, ByteSink &output, uint32_t *exitCode) override;
+    LauncherResult RunCommandForStream(const std::wstring &command, ByteSink &output, uint32_t *exitCode) override;
+    BatchResult Run(const std::string &command, std::chrono::milliseconds timeout) override;
+
+    bool componentInstalled = true;
+    bool registered = false;
+
+    // What registering and launching fail with, if anything.
+    LauncherResult registerResult = LauncherResults::Ok;
+    LauncherResult launchResult = LauncherResults::Ok;
+
+    // What interactive launches exit with; account creation creates none
+    // if not 0.
+    uint32_t exitCode = 0;
+
+    // What provisioning scripts exit with, before creating any account if
+    // not 0.
+    unsigned long provisionExitCode = 0;
+
+    // Bytes of data in the file snapshots have besides /etc/passwd, and
+    // what their tar exits with, after half the stream if not 0.
+    size_t snapshotDataSize = 1 << 20;
+    uint32_t snapshotExitCode = 0;
+
+    std::map<std::string, uint32_t> users{{"root", 0}};
+    uint32_t defaultUid = 0;
+
+    // How many times the default user was set.
+    size_t configurations = 0;
+
+    // The regular files of the last snapshot registered, by path, with their
+    // sizes; host keys made since are added.
+    std::map<std::string, uint64_t> files;
+
+    // Every command launched and snapshot registered, in order, and how many
+    // calls were made at all.
+    std::vector<std::wstring> launched;
+    std::vector<std::string> provisioned;
+    std::vector<std::filesystem::path> snapshots;
+    size_t calls = 0;
+
+    // The console the launcher prints to, if any, and how many times it was
+    // given to WSL with something printed but not flushed.
+    const FakeConsole *console = nullptr;
+    size_t unflushed = 0;
+
+  private:
+    uint32_t AddUser(const std::string &name);
+
+    std::mutex _lock;
+};
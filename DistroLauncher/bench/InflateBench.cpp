@@ -0,0 +1,289 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Checks the inflater and both gzip decoders against streams compressed
+// here, then reports gzip decompression throughput for a range of thread
+// counts:
+//
+//     inflate-bench [<archive.tar.gz> [threads...]]
+//
+// The archive is loaded into memory first so that only decoding is timed.
+// Only block-indexed archives (see `prepare-build repack`) scale with threads.
+// Without an archive, only the checks run.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Deflate.h"
+#include "ParallelInflate.h"
+
+namespace {
+    // Hands out the in-memory archive in read-sized chunks, like the pipeline does.
+    class ChunkedSource : public ByteSource
+    {
+      public:
+        explicit ChunkedSource(const std::vector<uint8_t> &data, size_t chunkSize = 1 << 20) :
+            _data(data),
+            _chunkSize(chunkSize)
+        {
+        }
+
+        bool Next(const uint8_t **data, size_t *size) override
+        {
+            if (_offset == _data.size()) {
+                return false;
+            }
+
+            const size_t count = ((_data.size() - _offset) < _chunkSize) ? (_data.size() - _offset) : _chunkSize;
+            *data = _data.data() + _offset;
+            *size = count;
+            _offset += count;
+            return true;
+        }
+
+      private:
+        const std::vector<uint8_t> &_data;
+        size_t _chunkSize;
+        size_t _offset = 0;
+    };
+
+    class CountingSink : public ByteSink
+    {
+      public:
+        bool Write(const uint8_t *, size_t size) override
+        {
+            bytes += size;
+            return true;
+        }
+
+        uint64_t bytes = 0;
+    };
+
+    class VectorSink : public ByteSink
+    {
+      public:
+        bool Write(const uint8_t *data, size_t size) override
+        {
+            bytes.insert(bytes.end(), data, data + size);
+            return true;
+        }
+
+        std::vector<uint8_t> bytes;
+    };
+
+    struct Sample
+    {
+        const char *name;
+        std::vector<uint8_t> data;
+    };
+
+    // Inputs that lead Deflate to each kind of block: text with repeats for
+    // dynamic codes, a short string for the fixed codes, noise for stored
+    // blocks, and long runs for matches at distance 1 and of the longest length.
+    std::vector<Sample> Samples()
+    {
+        std::vector<uint8_t> text;
+        for (unsigned line = 0; text.size() < (300 << 10); line += 1) {
+            const std::string entry = "drwxr-xr-x root/root 0 2024-04-23 ./usr/share/doc/package-" + std::to_string(line % 997) + "/\n";
+            text.insert(text.end(), entry.begin(), entry.end());
+        }
+
+        std::vector<uint8_t> noise(200 << 10);
+        uint32_t state = 2463534242u;
+        for (uint8_t &byte : noise) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            byte = static_cast<uint8_t>(state);
+        }
+
+        std::vector<uint8_t> runs(100 << 10, 0);
+        for (size_t index = 0; index < runs.size(); index += 4099) {
+            runs[index] = static_cast<uint8_t>(index);
+        }
+
+        const std::string word = "abc";
+        std::vector<uint8_t> mixed = text;
+        mixed.insert(mixed.end(), noise.begin(), noise.begin() + (50 << 10));
+        mixed.insert(mixed.end(), runs.begin(), runs.end());
+        return {
+            {"empty", {}},
+            {"short string", std::vector<uint8_t>(word.begin(), word.end())},
+            {"text", text},
+            {"noise", noise},
+            {"runs", runs},
+            {"text, noise and runs", mixed},
+        };
+    }
+
+    bool Check(bool passed, const std::string &what, int *failures)
+    {
+        std::printf("  %-56s %s\n", what.c_str(), passed ? "ok" : "FAILED");
+        *failures += passed ? 0 : 1;
+        return passed;
+    }
+
+    std::vector<uint8_t> CompressMembers(const std::vector<uint8_t> &data, size_t blockSize, uint64_t *members)
+    {
+        VectorSink output;
+        GzipBlockWriter writer(output, 4, blockSize);
+        if (!writer.Write(data.data(), data.size()) || !writer.Close()) {
+            return {};
+        }
+
+        *members = writer.Members();
+        return output.bytes;
+    }
+
+    // Decodes a gzip stream handed over in chunks of the given size, with
+    // GzipDecoder when threads is 0 and ParallelGzipDecoder otherwise.
+    InflateStatus Decode(const std::vector<uint8_t> &gzip, unsigned threads, size_t chunkSize, std::vector<uint8_t> *output,
+                         uint64_t *members = nullptr)
+    {
+        ChunkedSource source(gzip, chunkSize);
+        VectorSink sink;
+        InflateStatus status;
+        uint64_t decoded;
+        if (threads == 0) {
+            GzipDecoder decoder(source, 64 << 10);
+            status = decoder.Decode(sink);
+            decoded = decoder.Members();
+
+        } else {
+            ParallelGzipDecoder decoder(source, threads, 64 << 10);
+            status = decoder.Decode(sink);
+            decoded = decoder.Members();
+        }
+
+        if (members != nullptr) {
+            *members = decoded;
+        }
+
+        *output = std::move(sink.bytes);
+        return status;
+    }
+
+    bool RoundTrips(const std::vector<uint8_t> &gzip, const std::vector<uint8_t> &data, uint64_t members)
+    {
+        const struct
+        {
+            unsigned threads;
+            size_t chunkSize;
+        } decoders[] = {{0, 1 << 20}, {0, 7}, {1, 1 << 20}, {4, 1 << 20}, {4, 7}};
+
+        for (const auto &decoder : decoders) {
+            std::vector<uint8_t> output;
+            uint64_t decoded = 0;
+            if ((Decode(gzip, decoder.threads, decoder.chunkSize, &output, &decoded) != InflateStatus::Ok) || (output != data) ||
+                (decoded != members)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool InflatesRaw(const std::vector<uint8_t> &data)
+    {
+        std::vector<uint8_t> deflated;
+        Deflate(data.data(), data.size(), &deflated);
+        ChunkedSource source(deflated, 5);
+        BitReader reader(source);
+        Inflater inflater(64 << 10);
+        VectorSink sink;
+        return (inflater.Inflate(reader, sink) == InflateStatus::Ok) && (sink.bytes == data) &&
+               (inflater.Total() == data.size()) && (inflater.Crc() == Crc32(0, data.data(), data.size())) && reader.AtEnd();
+    }
+
+    void CheckRoundTrips(int *failures)
+    {
+        std::printf("checks:\n");
+        for (const Sample &sample : Samples()) {
+            const std::string name = sample.name;
+            Check(InflatesRaw(sample.data), name + ": raw DEFLATE", failures);
+
+            uint64_t members = 0;
+            std::vector<uint8_t> gzip = CompressMembers(sample.data, GzipBlockWriter::DefaultBlockSize, &members);
+            Check((members == 1) && RoundTrips(gzip, sample.data, members), name + ": one member", failures);
+
+            gzip = CompressMembers(sample.data, 32 << 10, &members);
+            const uint64_t expected = (sample.data.size() <= (32 << 10)) ? 1 : (sample.data.size() + (32 << 10) - 1) / (32 << 10);
+            Check((members == expected) && RoundTrips(gzip, sample.data, members), name + ": members of 32 KiB", failures);
+        }
+
+        // Damage is reported by both decoders rather than passed on.
+        const std::vector<uint8_t> data = Samples()[5].data;
+        uint64_t members = 0;
+        const std::vector<uint8_t> gzip = CompressMembers(data, 32 << 10, &members);
+        for (const unsigned threads : {0u, 4u}) {
+            const std::string decoder = (threads == 0) ? "GzipDecoder" : "ParallelGzipDecoder";
+            std::vector<uint8_t> damaged = gzip;
+            damaged[damaged.size() - 5] ^= 1;
+            std::vector<uint8_t> output;
+            Check(Decode(damaged, threads, 1 << 20, &output) == InflateStatus::Corrupt, decoder + ": CRC mismatch rejected", failures);
+
+            damaged = gzip;
+            damaged.resize(damaged.size() - 100);
+            Check(Decode(damaged, threads, 1 << 20, &output) == InflateStatus::Truncated, decoder + ": truncated stream rejected",
+                  failures);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int failures = 0;
+    CheckRoundTrips(&failures);
+    if ((argc < 2) || (failures != 0)) {
+        return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    std::ifstream file(argv[1], std::ios::binary);
+    const std::vector<uint8_t> archive((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!file && !file.eof()) {
+        std::fprintf(stderr, "cannot read %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<unsigned> threadCounts;
+    for (int index = 2; index < argc; index += 1) {
+        threadCounts.push_back(static_cast<unsigned>(std::atoi(argv[index])));
+    }
+
+    if (threadCounts.empty()) {
+        const unsigned hardware = (std::thread::hardware_concurrency() > 0) ? std::thread::hardware_concurrency() : 1;
+        for (unsigned count = 1; count < hardware; count *= 2) {
+            threadCounts.push_back(count);
+        }
+
+        threadCounts.push_back(hardware);
+    }
+
+    std::printf("%-8s %-8s %12s %12s\n", "threads", "members", "in MB/s", "out MB/s");
+    for (const unsigned threads : threadCounts) {
+        ChunkedSource source(archive);
+        CountingSink sink;
+        ParallelGzipDecoder decoder(source, threads);
+        const auto start = std::chrono::steady_clock::now();
+        if (decoder.Decode(sink) != InflateStatus::Ok) {
+            std::fprintf(stderr, "decoding failed: %s\n", decoder.Error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("%-8u %-8llu %12.1f %12.1f\n",
+                    decoder.Threads(),
+                    static_cast<unsigned long long>(decoder.Members()),
+                    archive.size() / 1e6 / seconds,
+                    sink.bytes / 1e6 / seconds);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#include "LatencyStats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+
+namespace {
+    std::string Number(double value)
+    {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.3f", value);
+        return text;
+    }
+
+    std::string Quote(const std::string &text)
+    {
+        std::string quoted = "\"";
+        for (const char c : text) {
+            if ((c == '"') || (c == '\\')) {
+                quoted += '\\';
+                quoted += c;
+
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char escape[8];
+                std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+                quoted += escape;
+
+            } else {
+                quoted += c;
+            }
+        }
+
+        return quoted + "\"";
+    }
+}
+
+void LatencyStats::Add(const std::string &name, double milliseconds)
+{
+    auto &samples = _samples[name];
+    if (samples.empty()) {
+        _order.push_back(name);
+    }
+
+    samples.push_back(milliseconds);
+}
+
+std::vector<LatencySummary> LatencyStats::Summarize() const
+{
+    std::vector<LatencySummary> summaries;
+    for (const std::string &name : _order) {
+        std::vector<double> sorted = _samples.at(name);
+        std::sort(sorted.begin(), sorted.end());
+
+        LatencySummary summary;
+        summary.name = name;
+        summary.count = sorted.size();
+        summary.min = sorted.front();
+        summary.mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+        summary.p50 = Percentile(sorted, 0.50);
+        summary.p90 = Percentile(sorted, 0.90);
+        summary.p99 = Percentile(sorted, 0.99);
+        summary.max = sorted.back();
+        summaries.push_back(summary);
+    }
+
+    return summaries;
+}
+
+std::string LatencyStats::Json(const std::string &label) const
+{
+    std::string json = "{\n  \"benchmark\": " + Quote(label) + ",\n  \"unit\": \"ms\",\n  \"phases\": [";
+    const std::vector<LatencySummary> summaries = Summarize();
+    for (size_t i = 0; i < summaries.size(); i += 1) {
+        const LatencySummary &summary = summaries[i];
+        json += (i == 0) ? "\n" : ",\n";
+        json += "    {\"name\": " + Quote(summary.name) + ", \"count\": " + std::to_string(summary.count) +
+                ", \"min\": " + Number(summary.min) + ", \"mean\": " + Number(summary.mean) + ", \"p50\": " + Number(summary.p50) +
+                ", \"p90\": " + Number(summary.p90) + ", \"p99\": " + Number(summary.p99) + ", \"max\": " + Number(summary.max) + "}";
+    }
+
+    return json + "\n  ]\n}\n";
+}
+
+std::string LatencyStats::Csv() const
+{
+    std::string csv = "phase,count,min,mean,p50,p90,p99,max\n";
+    for (const LatencySummary &summary : Summarize()) {
+        csv += summary.name + "," + std::to_string(summary.count) + "," + Number(summary.min) + "," + Number(summary.mean) + "," +
+               Number(summary.p50) + "," + Number(summary.p90) + "," + Number(summary.p99) + "," + Number(summary.max) + "\n";
+    }
+
+    return csv;
+}
+
+double LatencyStats::Percentile(const std::vector<double> &sorted, double fraction)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+
+    const double position = fraction * (sorted.size() - 1);
+    const size_t below = static_cast<size_t>(position);
+    const size_t above = std::min(below + 1, sorted.size() - 1);
+    return sorted[below] + (sorted[above] - sorted[below]) * (position - below);
+}
@@ -0,0 +1,48 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+struct LatencySummary
+{
+    std::string name;
+    size_t count = 0;
+    double min = 0;
+    double mean = 0;
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double max = 0;
+};
+
+// Collects latency samples, in milliseconds, for named phases, and sums them
+// up as percentiles for benchmark reports. Phases are reported in the order
+// they were first seen.
+class LatencyStats
+{
+  public:
+    void Add(const std::string &name, double milliseconds);
+
+    std::vector<LatencySummary> Summarize() const;
+
+    // The summaries as a JSON object, with the label as its "benchmark".
+    std::string Json(const std::string &label) const;
+
+    // The summaries as CSV, one line per phase after a header.
+    std::string Csv() const;
+
+    // The value below which the given fraction of samples fall, interpolating
+    // between the two nearest; the samples must be sorted.
+    static double Percentile(const std::vector<double> &sorted, double fraction);
+
+  private:
+    std::vector<std::string> _order;
+    std::map<std::string, std::vector<double>> _samples;
+};
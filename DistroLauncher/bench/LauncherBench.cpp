@@ -0,0 +1,594 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Checks the launcher's install and launch flows against an in-memory WSL,
+// fuzzes its command line and measures how fast the flows themselves are:
+//
+//     launcher-bench [iterations] [seed]
+//
+// Scripted flows check first runs with user creation, installs without and
+// from a provisioning file, the errors WSL may answer with, setting the
+// default user, `run`, `run --batch`, snapshots and clones, and their events
+// with --output=json. The given number of random command lines is then run
+// against WSL in random states, some with --output=json, checking that what
+// the launcher did agrees with them.
+// Last, first runs and `run` are timed over the same number of iterations,
+// and a snapshot and clone of a larger distribution once.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "FakeWsl.h"
+
+namespace {
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool Check(bool passed, const char *what, int *failures)
+    {
+        std::printf("  %-48s %s\n", what, passed ? "ok" : "FAILED");
+        *failures += passed ? 0 : 1;
+        return passed;
+    }
+
+    // The names of the events printed with --output=json, or none if any
+    // line is not an event.
+    std::vector<std::string> Events(const std::string &output)
+    {
+        const std::string prefix = "{\"event\":\"";
+        std::vector<std::string> events;
+        for (size_t start = 0; start < output.size();) {
+            const size_t end = output.find('\n', start);
+            if ((end == std::string::npos) || (output.compare(start, prefix.size(), prefix) != 0) || (output[end - 1] != '}')) {
+                return {};
+            }
+
+            const size_t name = start + prefix.size();
+            events.push_back(output.substr(name, output.find('"', name) - name));
+            start = end + 1;
+        }
+
+        return events;
+    }
+
+    bool Contains(const std::string &text, const std::string &part)
+    {
+        return text.find(part) != std::string::npos;
+    }
+
+    uint32_t Main(FakeConsole &console, FakeWsl &wsl, const std::vector<std::wstring> &arguments)
+    {
+        wsl.console = &console;
+        Launcher launcher(console, wsl);
+        return launcher.Main(arguments);
+    }
+
+    void ScriptedFlows(int *failures)
+    {
+        {
+            FakeConsole console;
+            FakeWsl wsl;
+            const uint32_t exitCode = Main(console, wsl, {L"help"});
+            Check((exitCode == 0) && console.Printed(LauncherMessage::Usage) && (wsl.calls == 0), "help needs no WSL", failures);
+        }
+
+        {
+            FakeConsole console;
+            FakeWsl wsl;
+            const uint32_t exitCode = Main(console, wsl, {L"--bogus"});
+            Check((exitCode == 1) && console.Printed(LauncherMessage::Usage) && (wsl.calls == 0), "unknown commands need no WSL", failures);
+        }
+
+        {
+            FakeConsole console;
+            FakeWsl wsl;
+            wsl.componentInstalled = false;
+            const uint32_t exitCode = Main(console, wsl, {});
+            Check((exitCode == 1) && (console.errors == std::vector<LauncherResult>{LauncherResults::SubsystemNotPresent}) &&
+                      (console.keyWaits == 1),
+                  "missing WSL reported",
+                  failures);
+        }
+
+        {
+            // A rejected name is asked for again.
+            FakeConsole console;
+            FakeWsl wsl;
+            console.input = {L"Not Valid", L"alice"};
+            const uint32_t exitCode = Main(console, wsl, {});
+            Check((exitCode == 0) && wsl.registered && (wsl.users["alice"] == 1000) && (wsl.defaultUid == 1000) &&
+                      console.Printed(LauncherMessage::InstallSuccess),
+                  "first run creates the default user",
+                  failures);
+
+            Check((wsl.launched.size() == 4) && (wsl.launched[2] == L"id -u 'alice'") && wsl.launched.back().empty(),
+                  "first run then starts the shell", failures);
+        }
+
+        {
+            // A password that is not set leaves no account, and the name is
+            // asked for again.
+            FakeConsole console;
+            FakeWsl wsl;
+            wsl.exitCode = 1;
+            console.input = {L"alice"};
+            bool asked = false;
+            try {
+                Main(console, wsl, {});
+
+            } catch (const FakeConsole::OutOfInput &) {
+                asked = true;
+            }
+
+            Check(asked && (wsl.users.count("alice") == 0) && (wsl.launched.size() == 1) && (wsl.defaultUid == 0),
+                  "failed password step creates no user", failures);
+        }
+
+        {
+            FakeConsole console;
+            FakeWsl wsl;
+            const uint32_t exitCode = Main(console, wsl, {L"install", L"--root"});
+            Check((exitCode == 0) && wsl.registered && (wsl.defaultUid == 0) && wsl.launched.empty() &&
+                      !console.Printed(LauncherMessage::EnterUserName),
+                  "install --root creates no user",
+                  failures);
+        }
+
+        {
+            FakeConsole console;
+            FakeWsl wsl;
+            wsl.registerResult = LauncherResults::AlreadyExists;
+            const uint32_t exitCode = Main(console, wsl, {L"install"});
+            Check((exitCode == 1) && console.Printed(LauncherMessage::InstallAlreadyExists), "existing registration reported", failures);
+        }
+
+        {
+            FakeConsole console;
+            FakeWsl wsl;
+            wsl.registerResult = LauncherResults::HyperVNotInstalled;
+            const uint32_t exitCode = Main(console, wsl, {});
+            Check((exitCode == 1) && console.Printed(LauncherMessage::EnableVirtualization) && console.errors.empty() && (console.keyWaits == 1),
+                  "missing virtualization reported",
+                  failures);
+        }
+
+        {
+            // Names are quoted for the shell, whatever they contain.
+            FakeConsole console;
+            FakeWsl wsl;
+            wsl.registered = true;
+            wsl.users["o'brien"] = 1001;
+            uint32_t exitCode = Main(console, wsl, {L"config", L"--default-user", L"o'brien"});
+            Check((exitCode == 0) && (wsl.defaultUid == 1001), "config --default-user", failures);
+
+            exitCode = Main(console, wsl, {L"config", L"--default-user", L"nobody"});
+            Check((exitCode == 1) && (wsl.defaultUid == 1001) && (console.errors == std::vector<LauncherResult>{LauncherResults::InvalidArgument}),
+                  "unknown default user rejected",
+                  failures);
+        }
+
+        {
+            FakeConsole console;
+            FakeWsl wsl;
+            wsl.registered = true;
+            wsl.exitCode = 42;
+            const uint32_t exitCode = Main(console, wsl, {L"run", L"echo", L"hello"});
+            Check((exitCode == 42) && (wsl.launched == std::vector<std::wstring>{L" echo hello"}), "run passes the exit code on", failures);
+
+            FakeConsole json;
+            const uint32_t jsonExitCode = Main(json, wsl, {L"--output=json", L"run", L"echo", L"hello"});
+            Check((jsonExitCode == 42) && json.json && (wsl.launched.back() == L" echo hello") &&
+                      Contains(json.output, "{\"event\":\"output\",\"output\":\" echo hello\\n\"}\n") && !Events(json.output).empty(),
+                  "run output as events",
+                  failures);
+        }
+
+        {
+            const std::filesystem::path manifest = std::filesystem::temp_directory_path() / "launcher-bench-manifest";
+            std::ofstream(manifest) << "echo one\n# skipped\nexit 3\nhang\necho four\n";
+            FakeConsole console;
+            FakeWsl wsl;
+            wsl.registered = true;
+            uint32_t exitCode = Main(console, wsl, {L"run", L"--batch", manifest.wstring(), L"--jobs", L"2"});
+            const auto &summary = console.arguments.back();
+            Check((exitCode == 1) && (console.output == "[1] echo one\n[5] echo four\n" || console.output == "[5] echo four\n[1] echo one\n") &&
+                      console.Printed(LauncherMessage::BatchExitCode) && console.Printed(LauncherMessage::BatchTimedOut) &&
+                      (console.messages.back() == LauncherMessage::BatchSummary) && (summary.size() == 2) && (summary[0].number == 2) &&
+                      (summary[1].number == 4),
+                  "run --batch reports each command",
+                  failures);
+
+            exitCode = Main(console, wsl, {L"run", L"--batch", manifest.wstring(), L"--jobs"});
+            Check((exitCode == 1) && (console.errors.back() == LauncherResults::InvalidArgument), "run --batch option without value", failures);
+
+            FakeConsole json;
+            exitCode = Main(json, wsl, {L"--output=json", L"run", L"--batch", manifest.wstring(), L"--jobs", L"1"});
+            Check((exitCode == 1) && json.messages.empty() &&
+                      (Events(json.output) == std::vector<std::string>{"phase", "phase", "state", "command", "command", "command", "command", "batch", "phase", "exit"}) &&
+                      Contains(json.output, "\"line\":1,\"status\":\"ok\",\"exitCode\":0,\"output\":\"echo one\\n\"") &&
+                      Contains(json.output, "\"line\":4,\"status\":\"timedOut\"") && Contains(json.output, "{\"event\":\"batch\",\"commands\":4,\"succeeded\":2}"),
+                  "run --batch with --output=json",
+                  failures);
+
+            std::filesystem::remove(manifest);
+            exitCode = Main(console, wsl, {L"run", L"--batch", manifest.wstring()});
+            Check((exitCode == 1) && (console.errors.back() == LauncherResults::FileNotFound), "run --batch without manifest", failures);
+        }
+
+        {
+            FakeConsole console;
+            FakeWsl wsl;
+            console.input = {L"Not A Name", L"alice"};
+            const uint32_t exitCode = Main(console, wsl, {L"--output=json", L"install"});
+            Check((exitCode == 0) && console.messages.empty() && (console.keyWaits == 0) &&
+                      (Events(console.output) ==
+                       std::vector<std::string>{"phase", "phase", "state", "message", "message", "prompt", "prompt", "user", "install", "message", "phase", "exit"}) &&
+                      Contains(console.output, "{\"event\":\"state\",\"subsystemInstalled\":true,\"registered\":false}") &&
+                      Contains(console.output, "{\"event\":\"user\",\"name\":\"alice\",\"uid\":1000}") &&
+                      Contains(console.output, "{\"event\":\"install\",\"hresult\":\"0x00000000\",\"ms\":") &&
+                      Contains(console.output, "{\"event\":\"exit\",\"exitCode\":0,\"ms\":"),
+                  "install with --output=json",
+                  failures);
+        }
+
+        {
+            const std::filesystem::path file = std::filesystem::temp_directory_path() / "launcher-bench-provision";
+            std::ofstream(file) << "\xEF\xBB\xBF# Build machines\r\nuser builder\r\ngroups adm,sudo,docker\r\nshell /usr/bin/zsh\r\n"
+                                   "skip-package snapd unattended-upgrades\r\nwsl-conf boot.systemd true\r\n"
+                                   "wsl-conf boot.command service docker start\r\nwsl-conf boot.systemd false\r\n";
+
+            FakeConsole console;
+            FakeWsl wsl;
+            uint32_t exitCode = Main(console, wsl, {L"install", L"--config", file.wstring()});
+            const std::string script = wsl.provisioned.empty() ? "" : wsl.provisioned.front();
+            Check((exitCode == 0) && wsl.registered && (wsl.users["builder"] == 1000) && (wsl.defaultUid == 1000) &&
+                      (wsl.provisioned.size() == 1) && wsl.launched.empty() && console.Printed(LauncherMessage::InstallSuccess) &&
+                      !console.Printed(LauncherMessage::CreateUserPrompt),
+                  "install --config reads no input",
+                  failures);
+
+            Check(Contains(script, "groups='adm,sudo,docker'") && Contains(script, "usermod -s '/usr/bin/zsh'") &&
+                      Contains(script, "for package in 'snapd' 'unattended-upgrades';") &&
+                      Contains(script, "settings='boot.systemd=false\nboot.command=service docker start'") && !Contains(script, "usermod -p"),
+                  "install --config applies it in one launch",
+                  failures);
+
+            FakeConsole json;
+            FakeWsl failing;
+            failing.provisionExitCode = 100;
+            exitCode = Main(json, failing, {L"--output=json", L"install", L"--config", file.wstring()});
+            Check((exitCode == 1) && (failing.defaultUid == 0) && (failing.users.size() == 1) &&
+                      Contains(json.output, "{\"event\":\"provision\",\"hresult\":\"0x80004005\",\"exitCode\":100,") &&
+                      Contains(json.output, "{\"event\":\"message\",\"message\":\"provisionFailed\",\"text\":\"") && !Contains(json.output, "\"user\""),
+                  "failed provisioning reported",
+                  failures);
+
+            std::ofstream(file) << "skip-package snapd\nwsl-conf interop.appendWindowsPath false\n";
+            FakeConsole rootOnly;
+            FakeWsl wsl2;
+            exitCode = Main(rootOnly, wsl2, {L"install", L"--config", file.wstring()});
+            Check((exitCode == 0) && (wsl2.defaultUid == 0) && (wsl2.users.size() == 1) && (wsl2.provisioned.size() == 1) &&
+                      (wsl2.provisioned.front().compare(0, 5, "user=") != 0),
+                  "install --config without a user keeps root",
+                  failures);
+
+            std::ofstream(file) << "user builder\nshell zsh\n";
+            FakeConsole invalid;
+            FakeWsl wsl3;
+            exitCode = Main(invalid, wsl3, {L"install", L"--config", file.wstring()});
+            Check((exitCode == 1) && (wsl3.calls == 0) && invalid.errors.empty() && invalid.Printed(LauncherMessage::ProvisionInvalid) &&
+                      (invalid.arguments.back().size() == 1) && (invalid.arguments.back()[0].text == "launcher-bench-provision line 2: invalid shell zsh"),
+                  "invalid provisioning file needs no WSL",
+                  failures);
+
+            std::filesystem::remove(file);
+            exitCode = Main(invalid, wsl3, {L"install", L"--config", file.wstring()});
+            Check((exitCode == 1) && (wsl3.calls == 0) && (invalid.arguments.back()[0].text == "cannot open launcher-bench-provision"),
+                  "missing provisioning file needs no WSL",
+                  failures);
+
+            const std::vector<std::string> rejected = {"user Builder\n", "user a\nuser b\n", "groups sudo\n", "user a\ngroups sudo,,adm\n",
+                                                       "user a\npassword-hash x:y\n", "skip-package Snapd\n", "skip-package snapd:\n",
+                                                       "wsl-conf boot true\n", "wsl-conf boot.systemd\n", "wsl-conf boot.sys.temd true\n",
+                                                       "user\n", "users a\n"};
+
+            size_t accepted = 0;
+            for (const std::string &text : rejected) {
+                ProvisionConfig config;
+                accepted += config.Parse(text, "test") ? 1 : 0;
+            }
+
+            ProvisionConfig config;
+            Check((accepted == 0) && config.Parse("user a_b-1\ngroups sudo\nskip-package libc++1 g++-12:amd64\n", "test") &&
+                      (config.SkippedPackages() == std::vector<std::string>{"libc++1", "g++-12:amd64"}),
+                  "provisioning files validated",
+                  failures);
+        }
+
+        {
+            const std::filesystem::path file = std::filesystem::temp_directory_path() / "launcher-bench-snapshot";
+            std::filesystem::path partial = file;
+            partial += ".partial";
+            FakeConsole console;
+            FakeWsl wsl;
+            wsl.registered = true;
+            wsl.users["alice"] = 1000;
+            wsl.defaultUid = 1000;
+            uint32_t exitCode = Main(console, wsl, {L"snapshot", file.wstring()});
+            SnapshotReader reader;
+            Check((exitCode == 0) && console.errors.empty() && console.Printed(LauncherMessage::SnapshotSuccess) &&
+                      (console.arguments.back()[0].number == 8) && (wsl.defaultUid == 1000) && !std::filesystem::exists(partial) &&
+                      reader.Load(file) && (reader.Info().defaultUid == 1000) && (reader.Info().defaultUser == "alice"),
+                  "snapshot records the default user",
+                  failures);
+
+            Check((wsl.launched.size() == 2) && (wsl.launched[1].find(L"; tar -C / -cf - ") != std::wstring::npos) &&
+                      (wsl.configurations == 0) && (std::filesystem::file_size(file) < (wsl.snapshotDataSize / 4)),
+                  "snapshot streams the root file system as root, leaving the default user",
+                  failures);
+
+            FakeConsole cloneConsole;
+            FakeWsl clone;
+            exitCode = Main(cloneConsole, clone, {L"clone", file.wstring()});
+            Check((exitCode == 0) && clone.registered && (clone.users["alice"] == 1000) && (clone.defaultUid == 1000) &&
+                      (clone.snapshots.size() == 1) && cloneConsole.Printed(LauncherMessage::InstallSuccess) &&
+                      !cloneConsole.Printed(LauncherMessage::CreateUserPrompt),
+                  "clone registers with the default user",
+                  failures);
+
+            Check((clone.files.count("./etc/machine-id") == 1) && (clone.files["./etc/machine-id"] == 0) &&
+                      (clone.files.count("./etc/ssh/ssh_host_ed25519_key.pub") == 0) && (clone.files["./etc/ssh/sshd_config"] > 0) &&
+                      (clone.launched.size() == 1) && (clone.launched[0].find(L"ssh-keygen -A") != std::wstring::npos) &&
+                      (clone.files.count("./etc/ssh/ssh_host_ed25519_key") == 1),
+                  "clone makes the host keys and machine ID the snapshot leaves out",
+                  failures);
+
+            exitCode = Main(cloneConsole, clone, {L"clone", file.wstring()});
+            Check((exitCode == 1) && (clone.snapshots.size() == 1) && cloneConsole.Printed(LauncherMessage::CloneAlreadyInstalled),
+                  "clone refuses an installed distribution",
+                  failures);
+
+            FakeConsole json;
+            FakeWsl failing;
+            failing.registered = true;
+            failing.users["alice"] = 1000;
+            failing.defaultUid = 1000;
+            failing.snapshotExitCode = 2;
+            std::filesystem::remove(file);
+            exitCode = Main(json, failing, {L"--output=json", L"snapshot", file.wstring()});
+            Check((exitCode == 1) && (failing.defaultUid == 1000) && !std::filesystem::exists(file) && !std::filesystem::exists(partial) &&
+                      Contains(json.output, "{\"event\":\"snapshot\",\"hresult\":\"0x80004005\",\"uid\":1000,\"user\":\"alice\",") &&
+                      Contains(json.output, "\"error\":\"tar exited with 2\"") &&
+                      Contains(json.output, "{\"event\":\"message\",\"message\":\"snapshotFailed\",\"text\":\""),
+                  "failed snapshot leaves nothing behind",
+                  failures);
+
+            std::ofstream(file) << "user builder\n";
+            FakeConsole invalid;
+            FakeWsl empty;
+            exitCode = Main(invalid, empty, {L"clone", file.wstring()});
+            Check((exitCode == 1) && (empty.calls == 0) && invalid.Printed(LauncherMessage::SnapshotInvalid) &&
+                      (invalid.arguments.back()[0].text == "launcher-bench-snapshot is not a snapshot"),
+                  "invalid snapshot needs no WSL",
+                  failures);
+
+            std::filesystem::remove(file);
+            exitCode = Main(invalid, empty, {L"clone", file.wstring()});
+            const uint32_t usage = Main(invalid, empty, {L"snapshot"});
+            Check((exitCode == 1) && (usage == 1) && (empty.calls == 0) &&
+                      (invalid.arguments[invalid.arguments.size() - 2][0].text == "cannot open launcher-bench-snapshot") &&
+                      (invalid.messages.back() == LauncherMessage::Usage),
+                  "missing snapshot needs no WSL",
+                  failures);
+        }
+
+        {
+            FakeConsole console;
+            FakeWsl wsl;
+            wsl.registered = true;
+            uint32_t exitCode = Main(console, wsl, {L"--output=json", L"config", L"--default-user", L"nobody"});
+            Check((exitCode == 1) && console.errors.empty() && Contains(console.output, "{\"event\":\"error\",\"hresult\":\"0x80070057\"}") &&
+                      (Events(console.output).back() == "exit"),
+                  "errors with --output=json",
+                  failures);
+
+            exitCode = Main(console, wsl, {L"--output=xml", L"run"});
+            Check((exitCode == 1) && console.Printed(LauncherMessage::Usage) && (wsl.launched.size() == 1), "unknown output format", failures);
+        }
+    }
+
+    // Runs random command lines against WSL in random states. What the
+    // launcher does must agree with the state and the command line: only
+    // commands it knows reach WSL, the distribution ends up registered when
+    // it can be, only existing users become the default, successes print no
+    // error, and what was printed is flushed before WSL gets the console.
+    void Fuzz(long iterations, unsigned int seed, int *failures)
+    {
+        const std::filesystem::path provision = std::filesystem::temp_directory_path() / "launcher-bench-fuzz-provision";
+        std::ofstream(provision) << "user alice\nwsl-conf boot.systemd true\n";
+        const std::filesystem::path snapshot = std::filesystem::temp_directory_path() / "launcher-bench-fuzz-snapshot";
+        {
+            FakeConsole console;
+            FakeWsl wsl;
+            wsl.registered = true;
+            wsl.snapshotDataSize = 4096;
+            Main(console, wsl, {L"snapshot", snapshot.wstring()});
+        }
+
+        const std::vector<std::wstring> tokens = {L"install", L"--root", L"run", L"-c", L"config", L"--default-user", L"help",
+                                                  L"--batch", L"--jobs", L"0", L"65", L"alice", L"o'brien", L"", L"\xe9t\xe9", L"--timeout",
+                                                  L"--config", provision.wstring(), L"snapshot", L"clone"};
+        const std::vector<LauncherResult> results = {LauncherResults::Ok, LauncherResults::Fail, LauncherResults::AlreadyExists,
+                                                     LauncherResults::HyperVNotInstalled};
+
+        std::mt19937 random(seed);
+        long violations = 0;
+        long waiting = 0;
+        long firstViolation = -1;
+        const auto start = std::chrono::steady_clock::now();
+        for (long iteration = 0; iteration < iterations; iteration += 1) {
+            FakeConsole console;
+            FakeWsl wsl;
+            wsl.componentInstalled = (random() % 8) != 0;
+            wsl.registered = (random() % 2) != 0;
+            wsl.registerResult = results[random() % results.size()];
+            wsl.launchResult = results[random() % results.size()];
+            wsl.exitCode = random() % 3;
+            wsl.snapshotDataSize = 4096;
+            wsl.snapshotExitCode = ((random() % 4) == 0) ? 2 : 0;
+            if ((random() % 2) != 0) {
+                wsl.users["alice"] = 1000;
+            }
+
+            for (unsigned int count = random() % 3; count > 0; count -= 1) {
+                console.input.push_back(tokens[random() % tokens.size()]);
+            }
+
+            std::vector<std::wstring> arguments;
+            for (unsigned int count = random() % 5; count > 0; count -= 1) {
+                arguments.push_back(tokens[random() % tokens.size()]);
+            }
+
+            // Output as JSON must not change what the launcher does.
+            const bool json = (random() % 4) == 0;
+            const bool wasRegistered = wsl.registered;
+            const bool known = arguments.empty() || (arguments[0] == L"install") || (arguments[0] == L"run") || (arguments[0] == L"-c") ||
+                               (arguments[0] == L"config") || (arguments[0] == L"snapshot") || (arguments[0] == L"clone");
+
+            // Snapshots are only ever written to, and cloned from, the one
+            // file, which always holds a snapshot.
+            const bool snapshots = !arguments.empty() && ((arguments[0] == L"snapshot") || (arguments[0] == L"clone"));
+            if (snapshots && (arguments.size() == 2)) {
+                arguments[1] = snapshot.wstring();
+            }
+
+            // Provisioning files that cannot be read are found before WSL is
+            // asked anything, as are snapshot command lines without a file.
+            const bool unreadable = ((arguments.size() > 1) && (arguments[0] == L"install") && (arguments[1] == L"--config") &&
+                                     ((arguments.size() != 3) || (arguments[2] != provision.wstring()))) ||
+                                    (snapshots && (arguments.size() != 2));
+
+            uint32_t exitCode = 0;
+            try {
+                std::vector<std::wstring> commandLine(arguments);
+                if (json) {
+                    commandLine.insert(commandLine.begin(), L"--output=json");
+                }
+
+                exitCode = Main(console, wsl, commandLine);
+
+            } catch (const FakeConsole::OutOfInput &) {
+                // The launcher waits for a name it likes, as it should. It
+                // must have been creating the first user.
+                waiting += 1;
+                if (!wasRegistered && wsl.registered && known) {
+                    continue;
+                }
+
+                exitCode = UINT32_MAX;
+            }
+
+            bool ok = (exitCode != UINT32_MAX);
+            ok = ok && (known || ((wsl.calls == 0) && (exitCode == ((arguments[0] == L"help") ? 0u : 1u))));
+            ok = ok && (!unreadable || ((wsl.calls == 0) && (exitCode == 1)));
+            ok = ok && (wsl.registered ==
+                        (wasRegistered || (known && !unreadable && wsl.componentInstalled && !LauncherResults::Failed(wsl.registerResult))));
+            ok = ok && ((wsl.defaultUid == 0) || (wsl.defaultUid == 1000) || (wsl.defaultUid == 1001));
+            ok = ok && ((exitCode != 0) || console.errors.empty());
+            ok = ok && (wsl.unflushed == 0);
+            ok = ok && (!json || (console.messages.empty() && console.errors.empty() && (console.keyWaits == 0) &&
+                                  !Events(console.output).empty() && (Events(console.output).back() == "exit")));
+            if (!ok) {
+                violations += 1;
+                firstViolation = (firstViolation < 0) ? iteration : firstViolation;
+            }
+        }
+
+        const double seconds = Seconds(start);
+        std::filesystem::remove(provision);
+        std::filesystem::remove(snapshot);
+        Check(violations == 0, "random command lines", failures);
+        std::printf("%ld command lines (seed %u): %.2f us each, %ld waiting for a user name",
+                    iterations,
+                    seed,
+                    1e6 * seconds / iterations,
+                    waiting);
+
+        if (firstViolation >= 0) {
+            std::printf(", %ld disagreeing from iteration %ld", violations, firstViolation);
+        }
+
+        std::printf("\n");
+    }
+
+    void Measure(long iterations)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < iterations; i += 1) {
+            FakeConsole console;
+            FakeWsl wsl;
+            console.input = {L"alice"};
+            Main(console, wsl, {});
+        }
+
+        const double firstRun = Seconds(start);
+        FakeConsole console;
+        FakeWsl wsl;
+        wsl.registered = true;
+        const std::vector<std::wstring> run = {L"run", L"true"};
+        start = std::chrono::steady_clock::now();
+        for (long i = 0; i < iterations; i += 1) {
+            Main(console, wsl, run);
+            wsl.launched.clear();
+        }
+
+        const double runs = Seconds(start);
+        std::printf("first run: %.2f us each, run: %.2f us each\n", 1e6 * firstRun / iterations, 1e6 * runs / iterations);
+
+        // Snapshots of a larger distribution, all of it the same few lines of
+        // text, as compressible as a root file system or more.
+        const std::filesystem::path file = std::filesystem::temp_directory_path() / "launcher-bench-measure-snapshot";
+        FakeWsl source;
+        source.registered = true;
+        source.snapshotDataSize = 64 << 20;
+        start = std::chrono::steady_clock::now();
+        Main(console, source, {L"snapshot", file.wstring()});
+        const double snapshot = Seconds(start);
+        std::error_code error;
+        const double compressed = static_cast<double>(std::filesystem::file_size(file, error));
+        FakeWsl target;
+        start = std::chrono::steady_clock::now();
+        Main(console, target, {L"clone", file.wstring()});
+        const double clone = Seconds(start);
+        std::filesystem::remove(file, error);
+        std::printf("snapshot: %.0f MB/s to %.1f%% of the size, clone: %.0f MB/s\n",
+                    source.snapshotDataSize / snapshot / 1e6,
+                    100 * compressed / source.snapshotDataSize,
+                    source.snapshotDataSize / clone / 1e6);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const long iterations = (argc > 1) ? std::atol(argv[1]) : 100000;
+    const unsigned int seed = (argc > 2) ? static_cast<unsigned int>(std::strtoul(argv[2], nullptr, 10)) : 1;
+    if ((argc > 3) || (iterations <= 0)) {
+        std::fprintf(stderr, "usage: %s [iterations] [seed]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    ScriptedFlows(&failures);
+    Fuzz(iterations, seed, &failures);
+    Measure(iterations);
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
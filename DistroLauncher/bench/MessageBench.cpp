@@ -0,0 +1,205 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Checks MessageFormat against the messages of MessageCatalog.h and measures
+// what formatting one costs:
+//
+//     message-bench [iterations]
+//
+// The inserts of the catalog's messages are checked at compile time, against
+// the arguments the launcher prints them with and against some it must not.
+// Formatting is checked against the text FormatMessageW gives for the same
+// message, and counted to never allocate. Last, the messages the launcher
+// prints most are formatted the given number of times, and again by building
+// a string the way the launcher did before, for comparison.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include "MessageCatalog.h"
+
+namespace {
+    size_t g_allocations = 0;
+}
+
+void *operator new(size_t size)
+{
+    g_allocations += 1;
+    if (void *block = std::malloc((size == 0) ? 1 : size)) {
+        return block;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void *block) noexcept
+{
+    std::free(block);
+}
+
+void operator delete(void *block, size_t) noexcept
+{
+    std::free(block);
+}
+
+namespace {
+    constexpr bool Equal(const char *left, const char *right)
+    {
+        for (; (*left != '\0') && (*left == *right); left += 1, right += 1) {
+        }
+
+        return *left == *right;
+    }
+
+    // The id of a message by its symbolic name, as messages.h is only
+    // generated on Windows.
+    constexpr uint32_t Id(const char *name)
+    {
+        for (const MessageEntry &entry : MessageCatalog::Entries) {
+            if (Equal(entry.name, name)) {
+                return entry.id;
+            }
+        }
+
+        return 0;
+    }
+
+    constexpr const wchar_t *Text(const char *name)
+    {
+        return MessageCatalog::Text(Id(name));
+    }
+
+    constexpr bool AllParse()
+    {
+        for (const MessageEntry &entry : MessageCatalog::Entries) {
+            if (MessageFormat::SlotCount(entry.text) < 0) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static_assert(AllParse(), "every message of the catalog parses");
+    static_assert(MessageFormat::Accepts<>(Text("MSG_USAGE")), "MSG_USAGE takes nothing");
+    static_assert(MessageFormat::Accepts<>(Text("MSG_ENTER_USERNAME")), "MSG_ENTER_USERNAME takes nothing");
+    static_assert(MessageFormat::Accepts<long, wchar_t *>(Text("MSG_ERROR_CODE")), "MSG_ERROR_CODE takes an HRESULT and text");
+    static_assert(MessageFormat::Accepts<const wchar_t *, long>(Text("MSG_WSL_LAUNCH_FAILED")), "MSG_WSL_LAUNCH_FAILED takes text and an HRESULT");
+    static_assert(MessageFormat::Accepts<uint32_t, uint32_t>(Text("MSG_BATCH_EXIT_CODE")), "MSG_BATCH_EXIT_CODE takes two numbers");
+    static_assert(!MessageFormat::Accepts<long>(Text("MSG_ERROR_CODE")), "too few arguments");
+    static_assert(!MessageFormat::Accepts<long, wchar_t *, int>(Text("MSG_ERROR_CODE")), "too many arguments");
+    static_assert(!MessageFormat::Accepts<long, long>(Text("MSG_ERROR_CODE")), "a number for text");
+    static_assert(!MessageFormat::Accepts<const wchar_t *, const wchar_t *>(Text("MSG_ERROR_CODE")), "text for a number");
+    static_assert(!MessageFormat::Accepts<long, const char *>(Text("MSG_ERROR_CODE")), "narrow text");
+    static_assert(!MessageFormat::Accepts<long, std::wstring>(Text("MSG_ERROR_CODE")), "a string object");
+    static_assert(!MessageFormat::Accepts<>(nullptr), "no message");
+    static_assert(MessageFormat::SlotCount(L"%1!q! %2") < 0, "unknown conversion");
+    static_assert(MessageFormat::SlotCount(L"100%% of %1, %0 %2") == 1, "escapes and %0");
+
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool Check(bool passed, const char *what, int *failures)
+    {
+        std::printf("  %-48s %s\n", what, passed ? "ok" : "FAILED");
+        *failures += passed ? 0 : 1;
+        return passed;
+    }
+
+    std::wstring Format(const wchar_t *text, std::initializer_list<MessageValue> values, size_t capacity = MessageFormat::BufferSize)
+    {
+        wchar_t buffer[MessageFormat::BufferSize];
+        const size_t length = MessageFormat::Format(text, values.begin(), values.size(), buffer, capacity);
+        const std::wstring formatted(buffer);
+        return (formatted.size() == std::min(length, capacity - 1)) ? formatted : L"<length " + std::to_wstring(length) + L">";
+    }
+
+    // Formats an exit code message by building strings, the way messages
+    // were put together before the catalog.
+    std::wstring Concatenate(uint32_t line, uint32_t exitCode)
+    {
+        return L"[" + std::to_wstring(line) + L"] exited with " + std::to_wstring(exitCode) + L"\r\n";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const long iterations = (argc > 1) ? std::atol(argv[1]) : 2000000;
+    if ((argc > 2) || (iterations <= 0)) {
+        std::fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    const long invalidParameter = static_cast<long>(0x80070057);
+    wchar_t systemText[] = L"The parameter is incorrect.\r\n";
+    Check(Format(Text("MSG_ERROR_CODE"), {invalidParameter, systemText}) == L"Error: 0x80070057 The parameter is incorrect.\r\n\r\n",
+          "error code in hex with system text",
+          &failures);
+    Check(Format(Text("MSG_WSL_LAUNCH_FAILED"), {L"/bin/bash", invalidParameter}) == L"WslLaunch /bin/bash failed with error: 0x80070057\r\n",
+          "text and number inserts",
+          &failures);
+    Check(Format(Text("MSG_BATCH_SUMMARY"), {7u, 12u}) == L"7 of 12 commands succeeded.\r\n", "unsigned inserts", &failures);
+    Check(Format(Text("MSG_ENTER_USERNAME"), {}) == L"Enter new UNIX username: ", "%0 ends without a line break", &failures);
+    Check(Format(Text("MSG_CREATE_USER_PROMPT"), {}).find(L"username.\r\nFor more") != std::wstring::npos, "lines end as the message compiler ends them", &failures);
+    Check(Format(L"[%1!-5u!|%2!05d!|%3!X!|%4!6s!|%5!d!]", {42u, -17, 0xbeefu, L"ab", -2147483647 - 1}) == L"[42   |-0017|BEEF|    ab|-2147483648]",
+          "flags, widths and signs",
+          &failures);
+    Check(Format(L"100%% %1%n%t%b%.%!%r", {L"x"}) == L"100% x\r\n\t .!\r", "escapes", &failures);
+    Check(Format(L"%1 and %2!u!", {L"one"}) == L"one and %2!u!", "inserts without an argument kept", &failures);
+    Check(Format(L"%1", {static_cast<const wchar_t *>(nullptr)}) == L"", "null text prints nothing", &failures);
+    Check(Format(Text("MSG_INSTALL_SUCCESS"), {}, 8) == L"Install", "cut short and terminated", &failures);
+    Check(MessageFormat::Format(L"abc", nullptr, 0, nullptr, 0) == 3, "length without a buffer", &failures);
+
+    size_t longest = 0;
+    wchar_t buffer[MessageFormat::BufferSize];
+    for (const MessageEntry &entry : MessageCatalog::Entries) {
+        longest = std::max(longest, MessageFormat::Format(entry.text, nullptr, 0, buffer, MessageFormat::BufferSize));
+    }
+
+    Check((longest * 2) <= MessageFormat::BufferSize, "every message fits the stack buffer", &failures);
+
+    const MessageValue exitValues[] = {MessageValue(3u), MessageValue(1u)};
+    const MessageValue errorValues[] = {MessageValue(invalidParameter), MessageValue(systemText)};
+    const wchar_t *exitCode = Text("MSG_BATCH_EXIT_CODE");
+    const wchar_t *errorCode = Text("MSG_ERROR_CODE");
+    const size_t allocations = g_allocations;
+    size_t total = 0;
+    const auto formatStart = std::chrono::steady_clock::now();
+    for (long iteration = 0; iteration < iterations; iteration += 1) {
+        total += MessageFormat::Format(exitCode, exitValues, 2, buffer, MessageFormat::BufferSize);
+        total += MessageFormat::Format(errorCode, errorValues, 2, buffer, MessageFormat::BufferSize);
+    }
+
+    const double formatSeconds = Seconds(formatStart);
+    Check(g_allocations == allocations, "formatting allocates nothing", &failures);
+
+    const size_t concatenateAllocations = g_allocations;
+    size_t concatenated = 0;
+    const auto concatenateStart = std::chrono::steady_clock::now();
+    for (long iteration = 0; iteration < iterations; iteration += 1) {
+        concatenated += Concatenate(3, 1).size();
+        concatenated += (L"Error: 0x80070057 " + std::wstring(systemText) + L"\r\n").size();
+    }
+
+    const double concatenateSeconds = Seconds(concatenateStart);
+    Check(concatenated == total, "same lengths as built strings", &failures);
+
+    const double messages = 2.0 * iterations;
+    std::printf("%ld iterations of two messages:\n", iterations);
+    std::printf("%-28s %8.1f ns/message, %.2f allocations/message\n", "catalog, stack buffer", formatSeconds / messages * 1e9, 0.0);
+    std::printf("%-28s %8.1f ns/message, %.2f allocations/message\n",
+                "built strings",
+                concatenateSeconds / messages * 1e9,
+                (g_allocations - concatenateAllocations) / messages);
+
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
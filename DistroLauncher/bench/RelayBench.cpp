@@ -0,0 +1,241 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Checks StreamRelay and measures what relaying piped data costs against
+// handing the pipe over:
+//
+//     relay-bench [megabytes]
+//
+// A producer thread writes the given amount into a pipe and a consumer thread
+// reads it from another, standing in for the program piping into the launcher
+// and the command in the distribution. The pipe is first handed straight to
+// the consumer, as `run` does with redirected handles; the relay then copies
+// between the two pipes with the buffer size of the old input relay, with
+// its own, and spliced, and into a function as the command server client
+// gets it. Each run checks that every byte arrived in order.
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "StreamRelay.h"
+
+namespace {
+    constexpr size_t PipeSize = 1 << 20;
+
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool Check(bool passed, const char *what, int *failures)
+    {
+        std::printf("  %-48s %s\n", what, passed ? "ok" : "FAILED");
+        *failures += passed ? 0 : 1;
+        return passed;
+    }
+
+    // Pipes as large as Windows gives the launcher's, where the system allows.
+    bool Pipe(int fds[2])
+    {
+        if (::pipe(fds) != 0) {
+            return false;
+        }
+
+        ::fcntl(fds[1], F_SETPIPE_SZ, static_cast<int>(PipeSize));
+        return true;
+    }
+
+    // The stream repeats every 251 bytes, a period no buffer size divides, so
+    // that data lost or reordered does not line up again. Every block starts
+    // somewhere in this pattern, which is long enough for the largest block.
+    constexpr size_t Period = 251;
+
+    const std::vector<char> &Pattern()
+    {
+        static const std::vector<char> pattern = [] {
+            std::vector<char> bytes(PipeSize + Period);
+            for (size_t index = 0; index < bytes.size(); index += 1) {
+                bytes[index] = static_cast<char>((index % Period) * 7);
+            }
+
+            return bytes;
+        }();
+
+        return pattern;
+    }
+
+    void Produce(int fd, uint64_t total)
+    {
+        for (uint64_t offset = 0; offset < total;) {
+            const size_t size = static_cast<size_t>(std::min<uint64_t>(PipeSize, total - offset));
+            const ssize_t written = ::write(fd, Pattern().data() + (offset % Period), size);
+            if (written <= 0) {
+                break;
+            }
+
+            offset += static_cast<uint64_t>(written);
+        }
+
+        ::close(fd);
+    }
+
+    struct Consumed
+    {
+        uint64_t bytes = 0;
+        bool ordered = true;
+    };
+
+    void Verify(const char *data, size_t size, Consumed *consumed)
+    {
+        while (size > 0) {
+            const size_t chunk = std::min(size, PipeSize);
+            consumed->ordered = consumed->ordered && (std::memcmp(data, Pattern().data() + (consumed->bytes % Period), chunk) == 0);
+            consumed->bytes += chunk;
+            data += chunk;
+            size -= chunk;
+        }
+    }
+
+    void Consume(int fd, Consumed *consumed)
+    {
+        std::vector<char> buffer(PipeSize);
+        for (;;) {
+            const ssize_t count = ::read(fd, buffer.data(), buffer.size());
+            if (count <= 0) {
+                break;
+            }
+
+            Verify(buffer.data(), static_cast<size_t>(count), consumed);
+        }
+
+        ::close(fd);
+    }
+
+    // Takes the pattern through the named path and reports its throughput.
+    bool Measure(const char *name, uint64_t total, size_t bufferSize, bool splice, bool handOver, bool sink, double *rate)
+    {
+        int input[2];
+        int output[2];
+        if (!Pipe(input) || !Pipe(output)) {
+            return false;
+        }
+
+        Consumed consumed;
+        bool relayed = true;
+        const auto start = std::chrono::steady_clock::now();
+        std::thread producer(Produce, input[1], total);
+        if (handOver) {
+            ::close(output[0]);
+            ::close(output[1]);
+            Consume(input[0], &consumed);
+
+        } else if (sink) {
+            ::close(output[0]);
+            ::close(output[1]);
+            StreamRelay relay(bufferSize);
+            relayed = relay.Copy(input[0], [&](const char *data, size_t size) {
+                Verify(data, size, &consumed);
+                return true;
+            });
+
+            ::close(input[0]);
+
+        } else {
+            std::thread consumer(Consume, output[0], &consumed);
+            StreamRelay relay(bufferSize);
+            if (!splice) {
+                relay.DisableSplice();
+            }
+
+            relayed = relay.Copy(input[0], output[1]) && (relay.Bytes() == total);
+            ::close(input[0]);
+            ::close(output[1]);
+            consumer.join();
+        }
+
+        producer.join();
+        const double seconds = Seconds(start);
+        *rate = total / seconds / 1e9;
+        std::printf("%-28s %7.2f GB/s\n", name, *rate);
+        return relayed && consumed.ordered && (consumed.bytes == total);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const long megabytes = (argc > 1) ? std::atol(argv[1]) : 4096;
+    if ((argc > 2) || (megabytes <= 0)) {
+        std::fprintf(stderr, "usage: %s [megabytes]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // A consumer that went away shows up as a failed write, not a signal.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    int failures = 0;
+    {
+        int input[2];
+        int output[2];
+        Pipe(input);
+        Pipe(output);
+        ::close(input[1]);
+        StreamRelay relay;
+        Check(relay.Copy(input[0], output[1]) && (relay.Bytes() == 0), "empty input", &failures);
+
+        ::close(output[0]);
+        Pipe(input);
+        ::write(input[1], "data", 4);
+        ::close(input[1]);
+        StreamRelay copy(100);
+        copy.DisableSplice();
+        Check(!copy.Copy(input[0], output[1]) && !copy.Error().empty(), "closed destination reported", &failures);
+        ::close(input[0]);
+        ::close(output[1]);
+    }
+
+    {
+        char path[] = "/tmp/relay-bench-XXXXXX";
+        const int file = ::mkstemp(path);
+        const std::string data(3 * StreamRelay::Alignment + 17, 'x');
+        ::write(file, data.data(), data.size());
+        ::lseek(file, 0, SEEK_SET);
+        ::unlink(path);
+        std::string copied;
+        StreamRelay relay(StreamRelay::Alignment);
+        Check(relay.Copy(file, [&](const char *chunk, size_t size) {
+                  copied.append(chunk, size);
+                  return true;
+              }) && (copied == data),
+              "file read to its end in buffer-sized chunks",
+              &failures);
+
+        ::lseek(file, 0, SEEK_SET);
+        Check(!relay.Copy(file, [](const char *, size_t) { return false; }) && !relay.Error().empty(), "stopped copy reported", &failures);
+        ::close(file);
+    }
+
+    const uint64_t total = static_cast<uint64_t>(megabytes) << 20;
+    double handedOver;
+    double small;
+    double large;
+    double spliced;
+    double sink;
+    std::printf("%ld MiB through pipes of %zu KiB:\n", megabytes, PipeSize >> 10);
+    Check(Measure("handed over", total, 0, false, true, false, &handedOver), "handed over intact", &failures);
+    Check(Measure("relayed, 64 KiB buffer", total, 64 << 10, false, false, false, &small), "relayed intact", &failures);
+    Check(Measure("relayed, 256 KiB buffer", total, StreamRelay::DefaultBufferSize, false, false, false, &large), "relayed with 256 KiB intact", &failures);
+    Check(Measure("spliced", total, StreamRelay::DefaultBufferSize, true, false, false, &spliced), "spliced intact", &failures);
+    Check(Measure("relayed into a function", total, StreamRelay::DefaultBufferSize, false, false, true, &sink), "relayed into a function intact", &failures);
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,133 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Measures the throughput of the rootfs import pipeline on a local tarball:
+//
+//     rootfs-import-bench <install.tar.gz> [iterations] [--write <output.tar>] [--dict <file>] [--sha256 <hex>]
+//                         [--buffered]
+//
+// Without --write, entries go to a fake registration sink that only counts
+// them, so the figures reflect reading, decompression and tar validation.
+// The archive may be compressed with gzip, zstd or xz; --dict names the
+// dictionary of a zstd archive. --sha256 checks the archive against its
+// digest while it is read, as the launcher does with the digest it embeds.
+// --buffered reads the archive through buffers instead of mapping it.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "RootfsImporter.h"
+#include "Sha256.h"
+
+namespace {
+    // Stands in for WslRegisterDistribution: accepts everything, keeps counts.
+    class CountingSink : public TarSink
+    {
+      public:
+        bool OnEntry(const TarEntry &entry) override
+        {
+            entries += 1;
+            if (entry.IsRegularFile()) {
+                files += 1;
+            }
+
+            return true;
+        }
+
+        bool OnData(const uint8_t *, size_t size) override
+        {
+            bytes += size;
+            return true;
+        }
+
+        bool OnEntryEnd() override { return true; }
+        bool OnArchiveEnd() override { return true; }
+
+        uint64_t entries = 0;
+        uint64_t files = 0;
+        uint64_t bytes = 0;
+    };
+
+    double MegabytesPerSecond(uint64_t bytes, double seconds)
+    {
+        return (seconds > 0) ? (static_cast<double>(bytes) / (1024.0 * 1024.0)) / seconds : 0.0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s <install.tar.gz> [iterations] [--write <output.tar>] [--dict <file>] [--sha256 <hex>] [--buffered]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int iterations = 3;
+    const char *output = nullptr;
+    RootfsImportOptions options;
+    for (int index = 2; index < argc; index += 1) {
+        if ((std::strcmp(argv[index], "--write") == 0) && (index + 1 < argc)) {
+            output = argv[++index];
+
+        } else if ((std::strcmp(argv[index], "--dict") == 0) && (index + 1 < argc)) {
+            options.dictionary = argv[++index];
+
+        } else if ((std::strcmp(argv[index], "--sha256") == 0) && (index + 1 < argc)) {
+            options.expectedSha256.resize(Sha256::DigestSize);
+            if (!Sha256::ParseHex(argv[++index], options.expectedSha256.data())) {
+                std::fprintf(stderr, "invalid digest: %s\n", argv[index]);
+                return EXIT_FAILURE;
+            }
+
+        } else if (std::strcmp(argv[index], "--buffered") == 0) {
+            options.mapArchive = false;
+
+        } else {
+            iterations = std::atoi(argv[index]);
+        }
+    }
+
+    if (!options.expectedSha256.empty()) {
+        std::printf("verifying the archive digest with the %s SHA-256 implementation\n", Sha256::Implementation());
+    }
+
+    for (int iteration = 0; iteration < iterations; iteration += 1) {
+        RootfsImporter importer(options);
+        CountingSink counter;
+        const auto start = std::chrono::steady_clock::now();
+        RootfsStatus status;
+        if (output != nullptr) {
+            FileSink file(output);
+            TarWriter writer(file);
+            status = importer.Import(argv[1], writer);
+            if (!file.Close() && (status == RootfsStatus::Ok)) {
+                status = RootfsStatus::IoError;
+            }
+
+        } else {
+            status = importer.Import(argv[1], counter);
+        }
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (status != RootfsStatus::Ok) {
+            std::fprintf(stderr, "import failed: %s\n", importer.Error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        const RootfsImportStats &stats = importer.Stats();
+        std::printf("run %d: %s, %llu entries, %.1f MiB -> %.1f MiB in %.3f s (%.1f MiB/s compressed, %.1f MiB/s uncompressed)\n",
+                    iteration + 1,
+                    CompressionName(stats.format),
+                    static_cast<unsigned long long>(stats.entries),
+                    stats.compressedBytes / (1024.0 * 1024.0),
+                    stats.uncompressedBytes / (1024.0 * 1024.0),
+                    seconds,
+                    MegabytesPerSecond(stats.compressedBytes, seconds),
+                    MegabytesPerSecond(stats.uncompressedBytes, seconds));
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Checks every SHA-256 kernel the processor supports against known answers,
+// then measures how fast each one hashes:
+//
+//     sha256-bench [megabytes]
+//
+// The known answers cover the lengths around the padding boundaries, where
+// the length no longer fits in the last block, and messages fed in pieces
+// that straddle blocks.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Sha256.h"
+
+namespace {
+    struct KnownAnswer
+    {
+        const char *name;
+        std::vector<uint8_t> message;
+        const char *digest;
+    };
+
+    // Bytes that differ from one offset to the next, so that a kernel
+    // loading words in the wrong order cannot get them right.
+    std::vector<uint8_t> Pattern(size_t size)
+    {
+        std::vector<uint8_t> message(size);
+        for (size_t index = 0; index < size; index += 1) {
+            message[index] = static_cast<uint8_t>((index * 7) % 251);
+        }
+
+        return message;
+    }
+
+    std::vector<uint8_t> Text(const char *text)
+    {
+        return std::vector<uint8_t>(text, text + std::strlen(text));
+    }
+
+    // Digests from sha256sum; the first three are those of FIPS 180-4.
+    std::vector<KnownAnswer> KnownAnswers()
+    {
+        return {
+            {"empty", {}, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+            {"\"abc\"", Text("abc"), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+            {"two-block message", Text("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+             "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+            {"55 bytes", Pattern(55), "8af594de0e003fdee5c8bb088216c824349b4137070f559574f4a4bddd27b714"},
+            {"56 bytes", Pattern(56), "db81bc2bfd43620591df192139062da77d4c376f1888ea3d2190bd07c8d901f9"},
+            {"63 bytes", Pattern(63), "bd535b38bf0d0d1a09d370b7e34b2696cea3767801a45d5611a4aaa6954e8527"},
+            {"64 bytes", Pattern(64), "292be91abe8c0909fe3d26575af5755eee74d23816dc68c3ba41765136967654"},
+            {"65 bytes", Pattern(65), "ba65aedf7884642499a59ae124894611d986cf429e69f569488048af3a99e25a"},
+            {"1000 bytes", Pattern(1000), "59425e4412e296fc74736673ce067027f384203f59c0d2c3e6be7b13347b3ffc"},
+            {"one million \"a\"", std::vector<uint8_t>(1000000, 'a'),
+             "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+        };
+    }
+
+    // Hashes a message handed over in pieces of the given sizes, taken in
+    // turn, the last piece getting whatever is left.
+    bool Matches(Sha256::Kernel kernel, const std::vector<uint8_t> &message, const std::vector<size_t> &pieces, const char *hex)
+    {
+        Sha256 hash(kernel);
+        size_t offset = 0;
+        for (size_t index = 0; offset < message.size(); index += 1) {
+            const size_t size = std::min(pieces[index % pieces.size()], message.size() - offset);
+            hash.Update(message.data() + offset, size);
+            offset += size;
+        }
+
+        uint8_t digest[Sha256::DigestSize];
+        uint8_t expected[Sha256::DigestSize];
+        hash.Final(digest);
+        return Sha256::ParseHex(hex, expected) && (std::memcmp(digest, expected, sizeof(digest)) == 0);
+    }
+
+    bool Check(bool passed, const std::string &what, int *failures)
+    {
+        std::printf("  %-56s %s\n", what.c_str(), passed ? "ok" : "FAILED");
+        *failures += passed ? 0 : 1;
+        return passed;
+    }
+
+    void CheckKernel(Sha256::Kernel kernel, const char *name, int *failures)
+    {
+        std::printf("checks (%s):\n", name);
+        const std::vector<KnownAnswer> answers = KnownAnswers();
+        for (const KnownAnswer &answer : answers) {
+            Check(Matches(kernel, answer.message, {answer.message.size() + 1}, answer.digest), answer.name, failures);
+        }
+
+        // Pieces that end inside a block, fill one exactly, and span several.
+        const KnownAnswer &split = answers[8];
+        Check(Matches(kernel, split.message, {1}, split.digest), "1000 bytes, one at a time", failures);
+        Check(Matches(kernel, split.message, {3, 61, 64, 65, 127, 200}, split.digest), "1000 bytes, in pieces across blocks",
+              failures);
+        Check(Matches(kernel, answers[2].message, {0, 55, 0, 1}, answers[2].digest), "two-block message, with empty pieces",
+              failures);
+    }
+
+    void Measure(Sha256::Kernel kernel, const char *name, const std::vector<uint8_t> &data)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        Sha256 hash(kernel);
+        hash.Update(data.data(), data.size());
+        uint8_t digest[Sha256::DigestSize];
+        hash.Final(digest);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("%-10s %10.1f MB/s\n", name, (data.size() / 1e6) / seconds);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const struct
+    {
+        Sha256::Kernel kernel;
+        const char *name;
+    } kernels[] = {
+        {Sha256::Kernel::Portable, "portable"},
+        {Sha256::Kernel::ShaNi, "sha-ni"},
+    };
+
+    int failures = 0;
+    for (const auto &kernel : kernels) {
+        if (!Sha256::Supports(kernel.kernel)) {
+            std::printf("checks (%s): not supported by this processor\n", kernel.name);
+            continue;
+        }
+
+        CheckKernel(kernel.kernel, kernel.name, &failures);
+    }
+
+    std::printf("default kernel: %s\n", Sha256::Implementation());
+    if ((argc < 2) || (failures != 0)) {
+        return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    const std::vector<uint8_t> data = Pattern(static_cast<size_t>(std::atoi(argv[1])) << 20);
+    for (const auto &kernel : kernels) {
+        if (Sha256::Supports(kernel.kernel)) {
+            Measure(kernel.kernel, kernel.name, data);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,381 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Measures how long the launcher takes to start, phase by phase:
+//
+//     startup-bench [--runs <n>] [--warmup <n>] [--format json|csv] -- <launcher> [arguments...]
+//
+// The launcher is started the given number of times with WSL_LAUNCHER_TIMING=1,
+// its input from the null device and both of its streams on pipes. Each run
+// contributes the marks the launcher prints on standard error (main, args,
+// wslapi, registered, launched, exit: milliseconds from the creation of its
+// process, see StartupTiming.h), and two times taken from outside: from just
+// before the process is started to the first byte of its output, and to its
+// exit. The report gives percentiles of each over all runs.
+//
+// On Windows the launcher is the real one, against real WSL, for instance
+// `startup-bench -- ubuntu.exe run true`. Elsewhere it is startup-probe, which
+// goes through the same phases with a fake WslApiLoader.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LatencyStats.h"
+#include "StartupTiming.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    double Milliseconds(Clock::time_point start, Clock::time_point end)
+    {
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    struct Run
+    {
+        Clock::time_point firstOutput;
+        bool output = false;
+        std::string errorOutput;
+    };
+
+#ifdef _WIN32
+    using Handle = HANDLE;
+
+    bool ReadSome(Handle handle, char *buffer, size_t size, size_t *count)
+    {
+        DWORD read;
+        if (!ReadFile(handle, buffer, static_cast<DWORD>(size), &read, nullptr) || (read == 0)) {
+            return false;
+        }
+
+        *count = read;
+        return true;
+    }
+
+    void CloseOne(Handle handle)
+    {
+        CloseHandle(handle);
+    }
+
+    std::wstring Widen(const std::string &text)
+    {
+        const int size = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, nullptr, 0);
+        std::wstring wide(static_cast<size_t>(size), L'\0');
+        MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, wide.data(), size);
+        wide.resize(wcslen(wide.c_str()));
+        return wide;
+    }
+
+    // Quotes an argument the way CommandLineToArgvW splits it back.
+    std::wstring Quote(const std::wstring &argument)
+    {
+        if (!argument.empty() && (argument.find_first_of(L" \t\"") == std::wstring::npos)) {
+            return argument;
+        }
+
+        std::wstring quoted = L"\"";
+        size_t backslashes = 0;
+        for (const wchar_t c : argument) {
+            if (c == L'\\') {
+                backslashes += 1;
+                continue;
+            }
+
+            quoted.append((c == L'"') ? backslashes * 2 + 1 : backslashes, L'\\');
+            quoted += c;
+            backslashes = 0;
+        }
+
+        quoted.append(backslashes * 2, L'\\');
+        return quoted + L"\"";
+    }
+
+    struct Process
+    {
+        HANDLE process = nullptr;
+        Handle output = nullptr;
+        Handle error = nullptr;
+    };
+
+    bool Start(const std::vector<std::string> &command, Process *child)
+    {
+        SECURITY_ATTRIBUTES sa{sizeof(sa), nullptr, true};
+        HANDLE outputWrite;
+        HANDLE errorWrite;
+        if (!CreatePipe(&child->output, &outputWrite, &sa, 0)) {
+            return false;
+        }
+
+        if (!CreatePipe(&child->error, &errorWrite, &sa, 0)) {
+            CloseHandle(child->output);
+            CloseHandle(outputWrite);
+            return false;
+        }
+
+        SetHandleInformation(child->output, HANDLE_FLAG_INHERIT, 0);
+        SetHandleInformation(child->error, HANDLE_FLAG_INHERIT, 0);
+        HANDLE input = CreateFileW(L"NUL", GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+
+        std::wstring commandLine;
+        for (const std::string &argument : command) {
+            commandLine += (commandLine.empty() ? L"" : L" ") + Quote(Widen(argument));
+        }
+
+        STARTUPINFOW startup{};
+        startup.cb = sizeof(startup);
+        startup.dwFlags = STARTF_USESTDHANDLES;
+        startup.hStdInput = input;
+        startup.hStdOutput = outputWrite;
+        startup.hStdError = errorWrite;
+        PROCESS_INFORMATION information;
+        const BOOL started = CreateProcessW(nullptr, commandLine.data(), nullptr, nullptr, true, 0, nullptr, nullptr, &startup, &information);
+        CloseHandle(input);
+        CloseHandle(outputWrite);
+        CloseHandle(errorWrite);
+        if (!started) {
+            CloseHandle(child->output);
+            CloseHandle(child->error);
+            return false;
+        }
+
+        CloseHandle(information.hThread);
+        child->process = information.hProcess;
+        return true;
+    }
+
+    bool Wait(Process *child)
+    {
+        const bool exited = (WaitForSingleObject(child->process, INFINITE) == WAIT_OBJECT_0);
+        CloseHandle(child->process);
+        return exited;
+    }
+
+    void SetVariable(const char *name, const std::string &value)
+    {
+        SetEnvironmentVariableA(name, value.c_str());
+    }
+#else
+    using Handle = int;
+
+    bool ReadSome(Handle handle, char *buffer, size_t size, size_t *count)
+    {
+        const ssize_t read = ::read(handle, buffer, size);
+        if (read <= 0) {
+            return false;
+        }
+
+        *count = static_cast<size_t>(read);
+        return true;
+    }
+
+    void CloseOne(Handle handle)
+    {
+        ::close(handle);
+    }
+
+    struct Process
+    {
+        pid_t process = -1;
+        Handle output = -1;
+        Handle error = -1;
+    };
+
+    bool Start(const std::vector<std::string> &command, Process *child)
+    {
+        int output[2];
+        int error[2];
+        if (::pipe2(output, O_CLOEXEC) != 0) {
+            return false;
+        }
+
+        if (::pipe2(error, O_CLOEXEC) != 0) {
+            ::close(output[0]);
+            ::close(output[1]);
+            return false;
+        }
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, output[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, error[1], STDERR_FILENO);
+
+        std::vector<char *> arguments;
+        for (const std::string &argument : command) {
+            arguments.push_back(const_cast<char *>(argument.c_str()));
+        }
+
+        arguments.push_back(nullptr);
+        const int result = ::posix_spawnp(&child->process, arguments[0], &actions, nullptr, arguments.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        ::close(output[1]);
+        ::close(error[1]);
+        child->output = output[0];
+        child->error = error[0];
+        if (result != 0) {
+            ::close(output[0]);
+            ::close(error[0]);
+            return false;
+        }
+
+        return true;
+    }
+
+    bool Wait(Process *child)
+    {
+        int status;
+        return (::waitpid(child->process, &status, 0) == child->process) && WIFEXITED(status);
+    }
+
+    void SetVariable(const char *name, const std::string &value)
+    {
+        ::setenv(name, value.c_str(), 1);
+    }
+#endif
+
+    // Runs the launcher once, adding what was measured to the statistics.
+    bool Measure(const std::vector<std::string> &command, LatencyStats *stats, std::string *error)
+    {
+        // The launcher takes its own process creation as the origin of its
+        // marks; startup-probe, which cannot tell, takes this instead.
+        Process child;
+        const Clock::time_point start = Clock::now();
+        SetVariable("STARTUP_BENCH_ORIGIN", std::to_string(std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count()));
+        if (!Start(command, &child)) {
+            *error = "cannot start " + command[0];
+            return false;
+        }
+
+        // Both streams are drained at once, so that the launcher never blocks
+        // on a full pipe, and the arrival of the first output byte is noted.
+        Run run;
+        std::thread errors([&] {
+            char buffer[4096];
+            size_t count;
+            while (ReadSome(child.error, buffer, sizeof(buffer), &count)) {
+                run.errorOutput.append(buffer, count);
+            }
+        });
+
+        char buffer[4096];
+        size_t count;
+        while (ReadSome(child.output, buffer, sizeof(buffer), &count)) {
+            if (!run.output) {
+                run.firstOutput = Clock::now();
+                run.output = true;
+            }
+        }
+
+        errors.join();
+        CloseOne(child.output);
+        CloseOne(child.error);
+        const bool exited = Wait(&child);
+        const Clock::time_point end = Clock::now();
+        if (!exited) {
+            *error = command[0] + " did not exit normally";
+            return false;
+        }
+
+        std::vector<StartupMark> marks;
+        bool found = false;
+        for (size_t offset = 0; offset < run.errorOutput.size();) {
+            size_t newline = run.errorOutput.find('\n', offset);
+            newline = (newline == std::string::npos) ? run.errorOutput.size() : newline;
+            if (StartupTiming::Parse(run.errorOutput.substr(offset, newline - offset), &marks)) {
+                found = true;
+            }
+
+            offset = newline + 1;
+        }
+
+        if (!found) {
+            *error = command[0] + " printed no startup timing";
+            return false;
+        }
+
+        for (const StartupMark &mark : marks) {
+            stats->Add(mark.phase, mark.milliseconds);
+        }
+
+        if (run.output) {
+            stats->Add("first-output", Milliseconds(start, run.firstOutput));
+        }
+
+        stats->Add("wall", Milliseconds(start, end));
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int runs = 50;
+    int warmup = 3;
+    std::string format = "json";
+    int index = 1;
+    for (; (index + 1 < argc) && (std::strcmp(argv[index], "--") != 0); index += 2) {
+        if (std::strcmp(argv[index], "--runs") == 0) {
+            runs = std::atoi(argv[index + 1]);
+
+        } else if (std::strcmp(argv[index], "--warmup") == 0) {
+            warmup = std::atoi(argv[index + 1]);
+
+        } else if (std::strcmp(argv[index], "--format") == 0) {
+            format = argv[index + 1];
+
+        } else {
+            break;
+        }
+    }
+
+    if ((index + 1 >= argc) || (std::strcmp(argv[index], "--") != 0) || (runs <= 0) || (warmup < 0) ||
+        ((format != "json") && (format != "csv"))) {
+        std::fprintf(stderr, "usage: %s [--runs <n>] [--warmup <n>] [--format json|csv] -- <launcher> [arguments...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const std::vector<std::string> command(argv + index + 1, argv + argc);
+    std::string label;
+    for (const std::string &argument : command) {
+        label += (label.empty() ? "" : " ") + argument;
+    }
+
+    // Warm-up runs fill the file cache and, against real WSL, start the
+    // utility VM, so that the runs measured are comparable.
+    SetVariable("WSL_LAUNCHER_TIMING", "1");
+    std::string error;
+    LatencyStats discarded;
+    LatencyStats stats;
+    for (int run = 0; run < warmup + runs; run += 1) {
+        if (!Measure(command, (run < warmup) ? &discarded : &stats, &error)) {
+            std::fprintf(stderr, "run %d: %s\n", run + 1, error.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    const std::string report = (format == "json") ? stats.Json(label) : stats.Csv();
+    std::fwrite(report.data(), 1, report.size(), stdout);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Stands in for the launcher under startup-bench where there is no WSL:
+//
+//     startup-probe [run <command line>]
+//
+// It goes through the phases wmain does, marking each the same way, against a
+// fake WslApiLoader: loading the API is opening a shared library, the
+// distribution is registered, and launching runs the command line with
+// /bin/sh. FAKE_WSL_LAUNCH_MS adds that many milliseconds before a launch
+// starts, for what starting a WSL session costs. Marks are taken from
+// STARTUP_BENCH_ORIGIN, the time the bench started the process, when set.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <memory>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "StartupTiming.h"
+
+namespace {
+    // The calls wmain makes, in the shape WslApiLoader has them.
+    class FakeWslApiLoader
+    {
+      public:
+        ~FakeWslApiLoader()
+        {
+            if (_library != nullptr) {
+                ::dlclose(_library);
+            }
+        }
+
+        bool WslIsOptionalComponentInstalled()
+        {
+            _library = ::dlopen("libc.so.6", RTLD_NOW);
+            return (_library != nullptr) && (::dlsym(_library, "posix_spawn") != nullptr);
+        }
+
+        bool WslIsDistributionRegistered() { return ::access("/bin/sh", X_OK) == 0; }
+
+        int WslLaunchInteractive(const std::string &command, unsigned long *exitCode)
+        {
+            const char *delay = std::getenv("FAKE_WSL_LAUNCH_MS");
+            if (delay != nullptr) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(std::atol(delay)));
+            }
+
+            std::fflush(stdout);
+            const pid_t child = ::fork();
+            if (child == 0) {
+                ::execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char *>(nullptr));
+                ::_exit(127);
+            }
+
+            int status;
+            if ((child < 0) || (::waitpid(child, &status, 0) != child)) {
+                return -1;
+            }
+
+            *exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+            return 0;
+        }
+
+      private:
+        void *_library = nullptr;
+    };
+
+    FakeWslApiLoader g_wslApi;
+
+    StartupTiming::Clock::time_point Origin()
+    {
+        const char *origin = std::getenv("STARTUP_BENCH_ORIGIN");
+        if (origin == nullptr) {
+            return StartupTiming::Clock::now();
+        }
+
+        return StartupTiming::Clock::time_point(std::chrono::nanoseconds(std::strtoll(origin, nullptr, 10)));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::unique_ptr<StartupTiming> timing;
+    const char *enabled = std::getenv("WSL_LAUNCHER_TIMING");
+    if ((enabled != nullptr) && (std::string(enabled) == "1")) {
+        timing = std::make_unique<StartupTiming>(Origin());
+    }
+
+    const auto mark = [&](const char *phase) {
+        if (timing != nullptr) {
+            timing->Mark(phase);
+        }
+    };
+
+    mark("main");
+    std::vector<std::string> arguments(argv + 1, argv + argc);
+    mark("args");
+
+    unsigned long exitCode = 1;
+    const bool installed = g_wslApi.WslIsOptionalComponentInstalled();
+    mark("wslapi");
+    const bool registered = installed && g_wslApi.WslIsDistributionRegistered();
+    mark("registered");
+    if (registered) {
+        std::string command;
+        for (size_t index = 1; index < arguments.size(); index += 1) {
+            command += " " + arguments[index];
+        }
+
+        if ((!arguments.empty() && (arguments[0] != "run")) || (g_wslApi.WslLaunchInteractive(command.empty() ? "true" : command, &exitCode) != 0)) {
+            exitCode = 1;
+        }
+    }
+
+    mark("launched");
+    mark("exit");
+    if (timing != nullptr) {
+        std::fprintf(stderr, "%s\n", timing->Format().c_str());
+    }
+
+    return static_cast<int>(exitCode);
+}
@@ -0,0 +1,314 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Checks the pre-registration filter against a policy file and a small
+// archive, then measures what a policy costs on top of the import and what
+// it takes out of the rootfs:
+//
+//     tar-filter-bench [<archive> <policy file> [iterations] [--write <output.tar>]]
+//
+// Each run imports the archive twice, unfiltered and filtered, into a sink
+// that only counts. --write also keeps the filtered tarball, so that the
+// result can be inspected with `tar tvf`. Without an archive, only the
+// checks run.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "RootfsImporter.h"
+#include "TarFilter.h"
+
+namespace {
+    class CountingSink : public TarSink
+    {
+      public:
+        bool OnEntry(const TarEntry &) override
+        {
+            entries += 1;
+            return true;
+        }
+
+        bool OnData(const uint8_t *, size_t size) override
+        {
+            bytes += size;
+            return true;
+        }
+
+        bool OnEntryEnd() override { return true; }
+        bool OnArchiveEnd() override { return true; }
+
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+    };
+
+    // Keeps every entry of a tar stream with its content, in archive order.
+    class RecordingSink : public TarSink
+    {
+      public:
+        struct File
+        {
+            TarEntry entry;
+            std::string content;
+        };
+
+        bool OnEntry(const TarEntry &entry) override
+        {
+            files.push_back({entry, {}});
+            return true;
+        }
+
+        bool OnData(const uint8_t *data, size_t size) override
+        {
+            files.back().content.append(reinterpret_cast<const char *>(data), size);
+            return true;
+        }
+
+        bool OnEntryEnd() override { return true; }
+        bool OnArchiveEnd() override { return true; }
+
+        // The index of the entry at path, or -1 when there is none.
+        int Find(const std::string &path) const
+        {
+            for (size_t index = 0; index < files.size(); index += 1) {
+                if (files[index].entry.path == path) {
+                    return static_cast<int>(index);
+                }
+            }
+
+            return -1;
+        }
+
+        std::vector<File> files;
+    };
+
+    class VectorSink : public ByteSink
+    {
+      public:
+        bool Write(const uint8_t *data, size_t size) override
+        {
+            bytes.insert(bytes.end(), data, data + size);
+            return true;
+        }
+
+        std::vector<uint8_t> bytes;
+    };
+
+    void AppendTarEntry(std::vector<uint8_t> *tar, const std::string &path, char type, const std::string &content,
+                        const std::string &linkTarget = {})
+    {
+        TarEntry entry;
+        entry.path = path;
+        entry.linkTarget = linkTarget;
+        entry.type = type;
+        entry.mode = (type == '5') ? 0755 : 0644;
+        entry.uid = 1000;
+        entry.size = content.size();
+        entry.mtime = 1700000000;
+        const std::vector<uint8_t> header = EncodeTarHeader(entry);
+        tar->insert(tar->end(), header.begin(), header.end());
+        tar->insert(tar->end(), content.begin(), content.end());
+        tar->resize((tar->size() + TarEntry::BlockSize - 1) / TarEntry::BlockSize * TarEntry::BlockSize);
+    }
+
+    // Parses a tar stream into sink, checking that it is well formed, and
+    // ends it as RootfsImporter does.
+    bool Parse(const std::vector<uint8_t> &tar, TarSink &sink)
+    {
+        TarParser parser(sink);
+        return (parser.Feed(tar.data(), tar.size()) == TarStatus::Ok) && (parser.Finish() == TarStatus::Ok) && sink.OnArchiveEnd();
+    }
+
+    bool WriteFile(const std::filesystem::path &path, const std::string &content)
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << content;
+        return static_cast<bool>(file);
+    }
+
+    bool Check(bool passed, const char *what, int *failures)
+    {
+        std::printf("  %-56s %s\n", what, passed ? "ok" : "FAILED");
+        *failures += passed ? 0 : 1;
+        return passed;
+    }
+
+    // Whether a policy file with the given directives fails to load, with an
+    // error naming the line.
+    bool Rejects(const std::filesystem::path &directory, const std::string &directives)
+    {
+        const std::filesystem::path path = directory / "rejected.filter";
+        TarFilterPolicy policy;
+        return WriteFile(path, "# A valid line first.\nremove /etc/motd\n" + directives + "\n") && !policy.Load(path) &&
+               (policy.Error().find("line 3") != std::string::npos);
+    }
+
+    void CheckFilter(int *failures)
+    {
+        std::printf("checks:\n");
+        const std::filesystem::path directory = std::filesystem::temp_directory_path() / "tar-filter-bench";
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        const std::filesystem::path policyPath = directory / "install.filter";
+        const bool written = WriteFile(directory / "hostname", "wsl\n") && WriteFile(directory / "wsl.conf", "[boot]\nsystemd=true\n") &&
+                             WriteFile(policyPath,
+                                       "# Let WSL generate the resolver configuration.\n"
+                                       "remove /etc/resolv.conf\n"
+                                       "remove /usr/share/locale/\n"
+                                       "path-exclude /usr/share/doc/*\n"
+                                       "path-include /usr/share/doc/*/copyright\n"
+                                       "replace /etc/hostname hostname 0600\n"
+                                       "replace /etc/wsl.conf wsl.conf\n");
+
+        TarFilterPolicy policy;
+        Check(written && policy.Load(policyPath), "policy file loads", failures);
+        Check(Rejects(directory, "prune /usr/share/man"), "unknown directive rejected", failures);
+        Check(Rejects(directory, "replace /etc/wsl.conf"), "replace without a file rejected", failures);
+        Check(Rejects(directory, "replace /etc/wsl.conf wsl.conf 0999"), "invalid mode rejected", failures);
+        Check(Rejects(directory, "replace /etc/wsl.conf missing.conf"), "missing replacement file rejected", failures);
+        std::filesystem::remove_all(directory, error);
+
+        std::vector<uint8_t> tar;
+        AppendTarEntry(&tar, "./", '5', "");
+        AppendTarEntry(&tar, "./etc/", '5', "");
+        AppendTarEntry(&tar, "./etc/hostname", '0', "ubuntu\n");
+        AppendTarEntry(&tar, "./etc/resolv.conf", '0', "nameserver 192.0.2.1\n");
+        AppendTarEntry(&tar, "./usr/", '5', "");
+        AppendTarEntry(&tar, "./usr/bin/bash", '0', std::string(3000, 'b'));
+        AppendTarEntry(&tar, "./usr/share/doc/bash/", '5', "");
+        AppendTarEntry(&tar, "./usr/share/doc/bash/README", '0', "Bash is the GNU shell.\n");
+        AppendTarEntry(&tar, "./usr/share/doc/bash/copyright", '0', "GPL-3+\n");
+        AppendTarEntry(&tar, "./usr/share/info/bash.info", '1', "", "./usr/share/doc/bash/README");
+        AppendTarEntry(&tar, "./usr/share/locale/", '5', "");
+        AppendTarEntry(&tar, "./usr/share/locale/fr/LC_MESSAGES/bash.mo", '0', "bonjour\n");
+        AppendTarEntry(&tar, "./usr/share/localedef", '0', "not a locale\n");
+        tar.resize(tar.size() + (2 * TarEntry::BlockSize));
+
+        // The filtered stream is written and parsed again, so that the
+        // headers made for replacements are checked too.
+        VectorSink output;
+        TarWriter writer(output);
+        TarFilter filter(policy, writer);
+        RecordingSink result;
+        Check(Parse(tar, filter) && Parse(output.bytes, result), "filtered archive is well formed", failures);
+
+        const int hostname = result.Find("./etc/hostname");
+        const int bash = result.Find("./usr/bin/bash");
+        Check(result.Find("./etc/resolv.conf") < 0, "remove drops the entry", failures);
+        Check((result.Find("./usr/share/locale/") < 0) && (result.Find("./usr/share/locale/fr/LC_MESSAGES/bash.mo") < 0),
+              "remove drops a directory with what it holds",
+              failures);
+        Check(result.Find("./usr/share/localedef") >= 0, "remove keeps paths it only prefixes", failures);
+        Check(result.Find("./usr/share/doc/bash/README") < 0, "path-exclude prunes files", failures);
+        Check(result.Find("./usr/share/doc/bash/copyright") >= 0, "path-include keeps files back", failures);
+        Check(result.Find("./usr/share/doc/bash/") >= 0, "directories of pruned files are kept", failures);
+        Check(result.Find("./usr/share/info/bash.info") < 0, "hard links to dropped entries are dropped", failures);
+        Check((hostname == 2) && (result.files[hostname].content == "wsl\n") && (result.files[hostname].entry.mode == 0600) &&
+                  (result.files[hostname].entry.uid == 0),
+              "replace writes a root file in place",
+              failures);
+        Check(!result.files.empty() && (result.files.back().entry.path == "./etc/wsl.conf") &&
+                  (result.files.back().content == "[boot]\nsystemd=true\n") && (result.files.back().entry.mode == 0644),
+              "replace adds missing files last, spelled alike",
+              failures);
+        Check((bash >= 0) && (result.files[bash].content == std::string(3000, 'b')) && (result.files[bash].entry.uid == 1000),
+              "other entries pass through unchanged",
+              failures);
+
+        const TarFilterStats &stats = filter.Stats();
+        Check((stats.entries == 13) && (stats.dropped == 5) && (stats.replaced == 1) && (stats.added == 1) &&
+                  (result.files.size() == 9),
+              "stats count what changed",
+              failures);
+    }
+
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 2) {
+        std::fprintf(stderr, "usage: %s [<archive> <policy file> [iterations] [--write <output.tar>]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    CheckFilter(&failures);
+    if ((argc < 3) || (failures != 0)) {
+        return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    int iterations = 3;
+    const char *output = nullptr;
+    for (int index = 3; index < argc; index += 1) {
+        if ((std::strcmp(argv[index], "--write") == 0) && (index + 1 < argc)) {
+            output = argv[++index];
+
+        } else {
+            iterations = std::atoi(argv[index]);
+        }
+    }
+
+    TarFilterPolicy policy;
+    if (!policy.Load(argv[2])) {
+        std::fprintf(stderr, "%s\n", policy.Error().c_str());
+        return EXIT_FAILURE;
+    }
+
+    for (int iteration = 0; iteration < iterations; iteration += 1) {
+        CountingSink plain;
+        RootfsImporter importer;
+        auto start = std::chrono::steady_clock::now();
+        if (importer.Import(argv[1], plain) != RootfsStatus::Ok) {
+            std::fprintf(stderr, "import failed: %s\n", importer.Error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        const double plainSeconds = Seconds(start);
+        CountingSink filtered;
+        TarFilter filter(policy, filtered);
+        start = std::chrono::steady_clock::now();
+        if (importer.Import(argv[1], filter) != RootfsStatus::Ok) {
+            std::fprintf(stderr, "filtered import failed: %s\n", importer.Error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        const double filteredSeconds = Seconds(start);
+        const TarFilterStats &stats = filter.Stats();
+        std::printf("run %d: %.3f s unfiltered, %.3f s filtered; %llu -> %llu entries, %.1f -> %.1f MiB; "
+                    "%llu dropped, %llu replaced, %llu added\n",
+                    iteration + 1,
+                    plainSeconds,
+                    filteredSeconds,
+                    static_cast<unsigned long long>(plain.entries),
+                    static_cast<unsigned long long>(filtered.entries),
+                    plain.bytes / (1024.0 * 1024.0),
+                    filtered.bytes / (1024.0 * 1024.0),
+                    static_cast<unsigned long long>(stats.dropped),
+                    static_cast<unsigned long long>(stats.replaced),
+                    static_cast<unsigned long long>(stats.added));
+    }
+
+    if (output != nullptr) {
+        FileSink file(output);
+        TarWriter writer(file);
+        TarFilter filter(policy, writer);
+        RootfsImporter importer;
+        const RootfsStatus status = importer.Import(argv[1], filter);
+        if (!file.Close() || (status != RootfsStatus::Ok)) {
+            std::fprintf(stderr, "cannot write %s: %s\n", output, importer.Error().c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
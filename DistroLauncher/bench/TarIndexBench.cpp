@@ -0,0 +1,389 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Checks reading single files through an index against a small archive
+// built here, then compares reading them out of a rootfs archive through its
+// index with scanning the archive up to them:
+//
+//     tar-index-bench [[--dict <file>] [--index <file>] <archive> <path>...]
+//
+// The index defaults to the archive path followed by ".index", as written by
+// `prepare-build --index`. Seeks only pay off on archives made of independent
+// gzip members or zstd frames (`--repack-block-size`). Without an archive,
+// only the checks run.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "Deflate.h"
+#include "ParallelInflate.h"
+#include "TarIndex.h"
+#include "TarStream.h"
+
+namespace {
+    class FileSource : public ByteSource
+    {
+      public:
+        explicit FileSource(const char *path) :
+            _file(path, std::ios::binary),
+            _buffer(1 << 20)
+        {
+        }
+
+        bool Next(const uint8_t **data, size_t *size) override
+        {
+            _file.read(reinterpret_cast<char *>(_buffer.data()), static_cast<std::streamsize>(_buffer.size()));
+            *data = _buffer.data();
+            *size = static_cast<size_t>(_file.gcount());
+            return *size > 0;
+        }
+
+      private:
+        std::ifstream _file;
+        std::vector<uint8_t> _buffer;
+    };
+
+    // Parses the tar stream until the wanted entry is complete, then stops it.
+    class FindSink : public TarSink, public ByteSink
+    {
+      public:
+        explicit FindSink(const std::string &path) :
+            _path(path),
+            _parser(*this)
+        {
+        }
+
+        bool Write(const uint8_t *data, size_t size) override
+        {
+            decoded += size;
+            return _parser.Feed(data, size) == TarStatus::Ok;
+        }
+
+        bool OnEntry(const TarEntry &entry) override
+        {
+            std::string path = entry.path;
+            while ((path.compare(0, 2, "./") == 0) || (path.compare(0, 1, "/") == 0)) {
+                path.erase(0, (path[0] == '.') ? 2 : 1);
+            }
+
+            _inside = (path == _path);
+            return true;
+        }
+
+        bool OnData(const uint8_t *, size_t) override { return true; }
+        bool OnEntryEnd() override
+        {
+            found = found || _inside;
+            return !found;
+        }
+
+        bool OnArchiveEnd() override { return true; }
+
+        uint64_t decoded = 0;
+        bool found = false;
+
+      private:
+        std::string _path;
+        TarParser _parser;
+        bool _inside = false;
+    };
+
+    double Milliseconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    class VectorSink : public ByteSink
+    {
+      public:
+        bool Write(const uint8_t *data, size_t size) override
+        {
+            bytes.insert(bytes.end(), data, data + size);
+            return true;
+        }
+
+        std::vector<uint8_t> bytes;
+    };
+
+    // Appends an entry to a tar stream and records it as the index lists it.
+    void AppendEntry(std::vector<uint8_t> *tar, std::vector<TarIndexEntry> *entries, const std::string &path, char type,
+                     const std::string &content, const std::string &linkTarget = {})
+    {
+        TarEntry header;
+        header.path = "./" + path + ((type == '5') ? "/" : "");
+        header.linkTarget = linkTarget;
+        header.type = type;
+        header.mode = (type == '5') ? 0755 : 0644;
+        header.size = content.size();
+        header.mtime = 1700000000;
+        const std::vector<uint8_t> encoded = EncodeTarHeader(header);
+
+        TarIndexEntry entry;
+        entry.path = path;
+        entry.linkTarget = linkTarget;
+        entry.type = type;
+        entry.mode = header.mode;
+        entry.headerOffset = tar->size();
+        entry.dataOffset = tar->size() + encoded.size();
+        entry.size = content.size();
+        if (entry.IsRegularFile()) {
+            Sha256 hash;
+            hash.Update(reinterpret_cast<const uint8_t *>(content.data()), content.size());
+            hash.Final(entry.sha256);
+        }
+
+        entries->push_back(entry);
+        tar->insert(tar->end(), encoded.begin(), encoded.end());
+        tar->insert(tar->end(), content.begin(), content.end());
+        tar->resize((tar->size() + TarEntry::BlockSize - 1) / TarEntry::BlockSize * TarEntry::BlockSize);
+    }
+
+    void Store(std::vector<uint8_t> *data, uint64_t value, size_t size)
+    {
+        for (size_t index = 0; index < size; index += 1) {
+            data->push_back(static_cast<uint8_t>(value >> (8 * index)));
+        }
+    }
+
+    // Lays an index out the way index.go writes it.
+    std::vector<uint8_t> EncodeIndex(std::vector<TarIndexEntry> entries, const std::vector<TarIndexRestart> &restarts,
+                                     uint64_t archiveSize, uint64_t tarSize)
+    {
+        std::sort(entries.begin(), entries.end(), [](const TarIndexEntry &left, const TarIndexEntry &right) {
+            return left.path < right.path;
+        });
+
+        std::string strings;
+        std::vector<uint8_t> records;
+        for (const TarIndexEntry &entry : entries) {
+            Store(&records, strings.size(), 4);
+            Store(&records, entry.path.size(), 4);
+            strings += entry.path;
+            Store(&records, strings.size(), 4);
+            Store(&records, entry.linkTarget.size(), 4);
+            strings += entry.linkTarget;
+            Store(&records, entry.headerOffset, 8);
+            Store(&records, entry.dataOffset, 8);
+            Store(&records, entry.size, 8);
+            Store(&records, entry.mode, 4);
+            Store(&records, static_cast<uint8_t>(entry.type), 4);
+            records.insert(records.end(), entry.sha256, entry.sha256 + sizeof(entry.sha256));
+        }
+
+        std::vector<uint8_t> index = {'W', 'S', 'L', 'T', 'A', 'R', 'I', 'X'};
+        Store(&index, 1, 4);
+        Store(&index, 80, 4);
+        Store(&index, archiveSize, 8);
+        Store(&index, tarSize, 8);
+        Store(&index, restarts.size(), 4);
+        Store(&index, entries.size(), 4);
+        Store(&index, strings.size(), 4);
+        Store(&index, 0, 4);
+        for (const TarIndexRestart &restart : restarts) {
+            Store(&index, restart.compressedOffset, 8);
+            Store(&index, restart.tarOffset, 8);
+        }
+
+        index.insert(index.end(), records.begin(), records.end());
+        index.insert(index.end(), strings.begin(), strings.end());
+        Store(&index, Crc32(0, index.data(), index.size()), 4);
+        return index;
+    }
+
+    bool WriteFile(const std::filesystem::path &path, const std::vector<uint8_t> &content)
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char *>(content.data()), static_cast<std::streamsize>(content.size()));
+        return static_cast<bool>(file);
+    }
+
+    bool Check(bool passed, const char *what, int *failures)
+    {
+        std::printf("  %-56s %s\n", what, passed ? "ok" : "FAILED");
+        *failures += passed ? 0 : 1;
+        return passed;
+    }
+
+    bool Reads(IndexedArchive &archive, const std::string &path, const std::string &expected)
+    {
+        std::string contents;
+        return (archive.ReadFile(path, &contents) == ExtractStatus::Ok) && (contents == expected);
+    }
+
+    // Builds an archive of independent gzip members and its index, then reads
+    // files back through links and restart points.
+    void CheckIndex(int *failures)
+    {
+        std::printf("checks:\n");
+        constexpr size_t BlockSize = 16 << 10;
+        std::string library;
+        for (uint32_t value = 1; library.size() < 5 * BlockSize; value = (value * 1103515245) + 12345) {
+            library += std::to_string(value >> 8) + "\n";
+        }
+
+        std::vector<uint8_t> tar;
+        std::vector<TarIndexEntry> entries;
+        AppendEntry(&tar, &entries, "etc", '5', "");
+        AppendEntry(&tar, &entries, "etc/hosts", '0', "127.0.0.1 localhost\n");
+        AppendEntry(&tar, &entries, "etc/hosts.orig", '1', "", "./etc/hosts");
+        AppendEntry(&tar, &entries, "etc/os-release", '2', "", "../usr/lib/os-release");
+        AppendEntry(&tar, &entries, "bin", '2', "", "usr/bin");
+        AppendEntry(&tar, &entries, "usr/lib/libtest.so", '0', library);
+        AppendEntry(&tar, &entries, "usr/lib/os-release", '0', "NAME=\"Ubuntu\"\n");
+        AppendEntry(&tar, &entries, "usr/bin/true", '0', "");
+        tar.resize(tar.size() + (2 * TarEntry::BlockSize));
+
+        // GzipBlockWriter cuts a member every BlockSize bytes of tar stream.
+        VectorSink gzip;
+        GzipBlockWriter writer(gzip, 2, BlockSize);
+        const bool compressed = writer.Write(tar.data(), tar.size()) && writer.Close();
+        std::vector<TarIndexRestart> restarts;
+        for (size_t offset = 0, memberSize = 0; compressed && (offset < gzip.bytes.size()); offset += memberSize) {
+            ParallelGzipDecoder::PeekMemberSize(gzip.bytes.data() + offset, gzip.bytes.size() - offset, &memberSize);
+            restarts.push_back({offset, restarts.size() * BlockSize});
+            if (memberSize == 0) {
+                break;
+            }
+        }
+
+        const std::vector<uint8_t> encoded = EncodeIndex(entries, restarts, gzip.bytes.size(), tar.size());
+        TarIndex index;
+        Check(compressed && (restarts.size() > 3) && index.Parse(encoded), "index parses", failures);
+        TarIndexEntry entry;
+        Check(index.Find("/usr/lib/os-release", &entry) && (entry.path == "usr/lib/os-release") && (entry.type == '0'),
+              "lookup ignores leading /", failures);
+        Check(index.Resolve("etc/os-release", &entry) && (entry.path == "usr/lib/os-release"), "relative symbolic link followed",
+              failures);
+        Check(index.Resolve("/bin/true", &entry) && (entry.path == "usr/bin/true"), "directory link followed", failures);
+        Check(index.Resolve("etc/hosts.orig", &entry) && (entry.path == "etc/hosts"), "hard link followed", failures);
+        Check(!index.Resolve("etc/shadow", &entry), "missing path not found", failures);
+        const TarIndexRestart restart = index.RestartBefore(3 * BlockSize + 1);
+        Check((restart.tarOffset == 3 * BlockSize) && (restart.compressedOffset == restarts[3].compressedOffset),
+              "restart point before an offset", failures);
+
+        std::vector<uint8_t> damaged = encoded;
+        damaged[damaged.size() / 2] ^= 1;
+        Check(!index.Parse(damaged) && (index.Error() == "tar index checksum mismatch"), "damaged index rejected", failures);
+
+        const std::filesystem::path directory = std::filesystem::temp_directory_path() / "tar-index-bench";
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        const std::filesystem::path archivePath = directory / "install.tar.gz";
+        const std::filesystem::path indexPath = directory / "install.tar.gz.index";
+        IndexedArchive archive;
+        Check(WriteFile(archivePath, gzip.bytes) && WriteFile(indexPath, encoded) &&
+                  (archive.Open(archivePath, indexPath) == ExtractStatus::Ok),
+              "archive opens with its index", failures);
+        Check(Reads(archive, "usr/lib/libtest.so", library), "file spanning several members read", failures);
+        Check(Reads(archive, "etc/os-release", "NAME=\"Ubuntu\"\n") && (archive.DecodedBytes() < tar.size() - 2 * BlockSize),
+              "file read from the member holding it", failures);
+        Check(Reads(archive, "etc/hosts.orig", "127.0.0.1 localhost\n"), "hard link read", failures);
+        Check(Reads(archive, "bin/true", ""), "empty file read", failures);
+        std::string contents;
+        Check(archive.ReadFile("etc", &contents) == ExtractStatus::NotFound, "directory not read", failures);
+
+        // An index whose hash does not match the content, as when the archive
+        // was rebuilt without it.
+        entries[5].sha256[0] ^= 1;
+        Check(WriteFile(indexPath, EncodeIndex(entries, restarts, gzip.bytes.size(), tar.size())) &&
+                  (archive.Open(archivePath, indexPath) == ExtractStatus::Ok) &&
+                  (archive.ReadFile("usr/lib/libtest.so", &contents) == ExtractStatus::CorruptArchive),
+              "content not matching its hash rejected", failures);
+        Check(WriteFile(indexPath, EncodeIndex(entries, restarts, gzip.bytes.size() + 1, tar.size())) &&
+                  (archive.Open(archivePath, indexPath) == ExtractStatus::CorruptArchive),
+              "index of another archive rejected", failures);
+        std::filesystem::remove_all(directory, error);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    DecompressOptions options;
+    std::string indexPath;
+    std::vector<const char *> arguments;
+    for (int index = 1; index < argc; index += 1) {
+        if ((std::strcmp(argv[index], "--dict") == 0) && (index + 1 < argc)) {
+            std::ifstream dictionary(argv[++index], std::ios::binary);
+            options.dictionary.assign(std::istreambuf_iterator<char>(dictionary), std::istreambuf_iterator<char>());
+
+        } else if ((std::strcmp(argv[index], "--index") == 0) && (index + 1 < argc)) {
+            indexPath = argv[++index];
+
+        } else {
+            arguments.push_back(argv[index]);
+        }
+    }
+
+    if (arguments.size() == 1) {
+        std::fprintf(stderr, "usage: %s [[--dict <file>] [--index <file>] <archive> <path>...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    CheckIndex(&failures);
+    if (arguments.empty() || (failures != 0)) {
+        return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    const char *archivePath = arguments[0];
+    if (indexPath.empty()) {
+        indexPath = std::string(archivePath) + ".index";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    IndexedArchive archive(options);
+    if (archive.Open(archivePath, indexPath) != ExtractStatus::Ok) {
+        std::fprintf(stderr, "cannot open index: %s\n", archive.Error().c_str());
+        return EXIT_FAILURE;
+    }
+
+    std::printf("index: %zu entries, %zu restart points, loaded in %.2f ms\n",
+                archive.Index().Entries(), archive.Index().Restarts(), Milliseconds(start));
+    std::printf("%-40s %10s %12s %10s %12s %10s %8s\n",
+                "path", "size", "seek MB", "seek ms", "scan MB", "scan ms", "speedup");
+    for (size_t index = 1; index < arguments.size(); index += 1) {
+        const std::string path = arguments[index];
+        std::string contents;
+        start = std::chrono::steady_clock::now();
+        if (archive.ReadFile(path, &contents) != ExtractStatus::Ok) {
+            std::fprintf(stderr, "cannot read %s: %s\n", path.c_str(), archive.Error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        const double seek = Milliseconds(start);
+
+        // The scan looks for the entry the index resolved the path to.
+        TarIndexEntry entry;
+        archive.Index().Resolve(path, &entry);
+        start = std::chrono::steady_clock::now();
+        FileSource source(archivePath);
+        FindSink finder(entry.path);
+        Decompressor decoder(source, options);
+        decoder.Decode(finder);
+        const double scan = Milliseconds(start);
+        if (!finder.found) {
+            std::fprintf(stderr, "scan did not find %s\n", entry.path.c_str());
+            return EXIT_FAILURE;
+        }
+
+        std::printf("%-40s %10zu %12.1f %10.2f %12.1f %10.2f %7.1fx\n",
+                    path.c_str(),
+                    contents.size(),
+                    archive.DecodedBytes() / 1e6,
+                    seek,
+                    finder.decoded / 1e6,
+                    scan,
+                    (seek > 0) ? scan / seek : 0.0);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Checks tracing and measures what a span costs:
+//
+//     trace-bench [spans] [threads] [trace.json]
+//
+// The given number of spans is timed with tracing off and then on, on one
+// thread and then on several at once. The checks cover nesting, the events of
+// threads that have ended, and ring buffers that have wrapped around keeping
+// the newest events. The trace is written to the file when one is given, to
+// be opened in chrome://tracing or Perfetto.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Trace.h"
+
+namespace {
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool Check(bool passed, const char *what, int *failures)
+    {
+        std::printf("  %-48s %s\n", what, passed ? "ok" : "FAILED");
+        *failures += passed ? 0 : 1;
+        return passed;
+    }
+
+    size_t Count(const std::string &text, const std::string &what)
+    {
+        size_t count = 0;
+        for (size_t offset = text.find(what); offset != std::string::npos; offset = text.find(what, offset + what.size())) {
+            count += 1;
+        }
+
+        return count;
+    }
+
+    void Spans(long count)
+    {
+        for (long i = 0; i < count; i += 1) {
+            TraceSpan span("bench");
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const long spans = (argc > 1) ? std::atol(argv[1]) : 10000000;
+    const int threads = (argc > 2) ? std::atoi(argv[2]) : 4;
+    if ((argc > 4) || (spans <= 0) || (threads <= 0)) {
+        std::fprintf(stderr, "usage: %s [spans] [threads] [trace.json]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Spans(spans);
+    const double disabled = Seconds(start);
+
+    int failures = 0;
+    Check(Trace::ChromeJson().find("\"ph\"") == std::string::npos, "nothing recorded until started", &failures);
+
+    Trace::Start();
+    {
+        TraceSpan outer("outer");
+        TraceSpan inner("inner \"quoted\"");
+        Trace::Instant("instant");
+    }
+
+    std::string json = Trace::ChromeJson();
+    Check((Count(json, "\"ph\":\"X\"") == 2) && (Count(json, "\"ph\":\"i\"") == 1) && (json.find("inner \\\"quoted\\\"") != std::string::npos),
+          "spans, instants and escaped names",
+          &failures);
+
+    // Spans end innermost first, so the outer one is recorded last and
+    // covers the inner one.
+    const size_t inner = json.find("\"inner");
+    const size_t outer = json.find("\"outer");
+    Check((inner != std::string::npos) && (outer != std::string::npos) && (inner < outer), "nested spans recorded as they end", &failures);
+
+    start = std::chrono::steady_clock::now();
+    Spans(spans);
+    const double enabled = Seconds(start);
+
+    std::vector<std::thread> workers;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < threads; i += 1) {
+        workers.emplace_back([spans] { Spans(spans); });
+    }
+
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    const double parallel = Seconds(start);
+    json = Trace::ChromeJson();
+    const size_t kept = std::min<size_t>(static_cast<size_t>(spans) + 3, Trace::Capacity) + threads * std::min<size_t>(spans, Trace::Capacity);
+    Check(Count(json, "\"ph\":") == kept, "every thread's newest events kept", &failures);
+    Check(Count(json, "\"tid\":") == kept, "events of ended threads written", &failures);
+
+    if ((argc > 3) && !Check(Trace::WriteChromeJson(argv[3]), "trace written", &failures)) {
+        return EXIT_FAILURE;
+    }
+
+    std::printf("%ld spans: %.2f ns each off, %.2f ns each on, %.2f ns each on %d threads at once\n",
+                spans,
+                1e9 * disabled / spans,
+                1e9 * enabled / spans,
+                1e9 * parallel / spans,
+                threads);
+
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
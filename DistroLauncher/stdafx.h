@@ -24,11 +24,20 @@
 #include <locale>
 #include <codecvt>
 #include <string_view>
+#include <filesystem>
 #include <vector>
+#include <chrono>
+#include <mutex>
 #include <wslapi.h>
+#include "MessageCatalog.h"
+#include "ConsoleWriter.h"
 #include "WslApiLoader.h"
 #include "Helpers.h"
 #include "DistributionInfo.h"
+#include "Launcher.h"
+#include "Rootfs.h"
+#include "CommandRelay.h"
+#include "WindowsLauncher.h"
 
 // Message strings compiled from .MC file.
 #include "messages.h"
@@ -0,0 +1,244 @@
+//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Generates MessageCatalog.h from messages.mc:
+//
+//     message-catalog <messages.mc> <MessageCatalog.h>
+//
+// The texts are laid out as the message compiler lays them out, every line
+// ending in a carriage return and line feed, so that formatting them gives
+// what FormatMessageW gave. A message whose inserts MessageFormat cannot
+// parse, that is given for another language than English, or that takes up
+// more than half of MessageFormat::BufferSize is an error.
+// The header is checked in, since the Windows build has nothing to run this
+// with; the CMake build runs it and fails if the two differ.
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "MessageFormat.h"
+
+namespace {
+    struct Message
+    {
+        unsigned long id = 0;
+        std::string name;
+        std::vector<std::string> lines;
+        size_t lineNumber = 0;
+    };
+
+    bool Fail(const std::string &path, size_t lineNumber, const std::string &error)
+    {
+        std::fprintf(stderr, "%s:%zu: %s\n", path.c_str(), lineNumber, error.c_str());
+        return false;
+    }
+
+    std::string Trim(const std::string &text)
+    {
+        const size_t start = text.find_first_not_of(" \t");
+        if (start == std::string::npos) {
+            return {};
+        }
+
+        return text.substr(start, text.find_last_not_of(" \t") + 1 - start);
+    }
+
+    // The value of a `Key=value` field of a header line, or empty.
+    std::string Field(const std::string &line, const std::string &key)
+    {
+        std::istringstream fields(line);
+        std::string field;
+        while (fields >> field) {
+            if (field.compare(0, key.size() + 1, key + "=") == 0) {
+                return field.substr(key.size() + 1);
+            }
+        }
+
+        return {};
+    }
+
+    bool Parse(const std::string &path, std::vector<Message> *messages)
+    {
+        std::ifstream input(path, std::ios::binary);
+        if (!input) {
+            std::fprintf(stderr, "cannot open %s\n", path.c_str());
+            return false;
+        }
+
+        std::string line;
+        size_t lineNumber = 0;
+        Message message;
+        bool inHeader = false;
+        bool inText = false;
+        while (std::getline(input, line)) {
+            lineNumber += 1;
+            if (!line.empty() && (line.back() == '\r')) {
+                line.pop_back();
+            }
+
+            if (inText) {
+                if (line == ".") {
+                    messages->push_back(message);
+                    message = Message();
+                    inText = false;
+
+                } else {
+                    message.lines.push_back(line);
+                }
+
+                continue;
+            }
+
+            const std::string trimmed = Trim(line);
+            if (trimmed.empty() || (trimmed[0] == ';') || (trimmed.compare(0, 13, "LanguageNames") == 0)) {
+                continue;
+            }
+
+            if (trimmed.compare(0, 10, "MessageId=") == 0) {
+                const std::string id = Field(trimmed, "MessageId");
+                char *end = nullptr;
+                message.id = std::strtoul(id.c_str(), &end, 0);
+                message.name = Field(trimmed, "SymbolicName");
+                message.lineNumber = lineNumber;
+                if (id.empty() || (*end != '\0') || message.name.empty()) {
+                    return Fail(path, lineNumber, "a message needs a MessageId and a SymbolicName");
+                }
+
+                inHeader = true;
+                continue;
+            }
+
+            if (inHeader && (trimmed.compare(0, 9, "Language=") == 0)) {
+                if (Field(trimmed, "Language") != "English") {
+                    return Fail(path, lineNumber, "only English messages are supported");
+                }
+
+                inHeader = false;
+                inText = true;
+                continue;
+            }
+
+            return Fail(path, lineNumber, "unexpected line: " + trimmed);
+        }
+
+        if (inHeader || inText) {
+            return Fail(path, lineNumber, "the last message does not end");
+        }
+
+        return true;
+    }
+
+    // The line as the contents of a wide string literal; false if it has
+    // characters other than printable ASCII.
+    bool Escape(const std::string &line, std::string *escaped)
+    {
+        for (const char c : line) {
+            if ((c == '\\') || (c == '"')) {
+                escaped->push_back('\\');
+                escaped->push_back(c);
+
+            } else if (c == '\t') {
+                escaped->append("\\t");
+
+            } else if ((c >= 0x20) && (c < 0x7f)) {
+                escaped->push_back(c);
+
+            } else {
+                return false;
+            }
+        }
+
+        escaped->append("\\r\\n");
+        return true;
+    }
+
+    bool Generate(const std::string &path, const std::vector<Message> &messages, std::string *header)
+    {
+        *header += "//\n"
+                   "//    Copyright (C) Canonical Ltd.  All rights reserved.\n"
+                   "// Licensed under the terms described in the LICENSE file in the root of this project.\n"
+                   "//\n"
+                   "// Generated from messages.mc by tools/MessageCatalogGen.cpp; do not edit.\n"
+                   "\n"
+                   "#pragma once\n"
+                   "\n"
+                   "#include \"MessageFormat.h\"\n"
+                   "\n"
+                   "namespace MessageCatalog\n"
+                   "{\n"
+                   "    constexpr MessageEntry Entries[] = {\n";
+
+        for (const Message &message : messages) {
+            std::string text;
+            *header += "        {" + std::to_string(message.id) + ",\n         \"" + message.name + "\",";
+            for (const std::string &line : message.lines) {
+                std::string escaped;
+                if (!Escape(line, &escaped)) {
+                    return Fail(path, message.lineNumber, message.name + " has characters other than printable ASCII");
+                }
+
+                *header += "\n         L\"" + escaped + "\"";
+                text += line + "\r\n";
+            }
+
+            if (message.lines.empty()) {
+                *header += "\n         L\"\"";
+            }
+
+            *header += "},\n";
+            const std::wstring wide(text.begin(), text.end());
+            if (MessageFormat::SlotCount(wide.c_str()) < 0) {
+                return Fail(path, message.lineNumber, message.name + " has an insert that cannot be parsed");
+            }
+
+            if ((wide.size() * 2) > MessageFormat::BufferSize) {
+                return Fail(path, message.lineNumber, message.name + " is too long to be printed from the stack");
+            }
+        }
+
+        *header += "    };\n"
+                   "\n"
+                   "    // The text of a message, or null if there is none with the id.\n"
+                   "    constexpr const wchar_t *Text(uint32_t id)\n"
+                   "    {\n"
+                   "        for (const MessageEntry &entry : Entries) {\n"
+                   "            if (entry.id == id) {\n"
+                   "                return entry.text;\n"
+                   "            }\n"
+                   "        }\n"
+                   "\n"
+                   "        return nullptr;\n"
+                   "    }\n"
+                   "}\n";
+
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        std::fprintf(stderr, "usage: %s <messages.mc> <MessageCatalog.h>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Message> messages;
+    std::string header;
+    if (!Parse(argv[1], &messages) || !Generate(argv[1], messages, &header)) {
+        return EXIT_FAILURE;
+    }
+
+    std::ofstream output(argv[2], std::ios::binary | std::ios::trunc);
+    output << header;
+    if (!output.flush()) {
+        std::fprintf(stderr, "cannot write %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
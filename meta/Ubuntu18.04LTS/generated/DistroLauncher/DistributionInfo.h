@@ -17,10 +17,4 @@ namespace DistributionInfo
 
     // The title bar for the console window while the distribution is installing.
     const std::wstring WindowTitle = L"Ubuntu 18.04.6 LTS";
-
-    // Create and configure a user account.
-    bool CreateUser(std::wstring_view userName);
-
-    // Query the UID of the user account.
-    ULONG QueryUid(std::wstring_view userName);
 }
\ No newline at end of file
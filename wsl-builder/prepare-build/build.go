@@ -4,20 +4,20 @@ import (
 	"bufio"
 	"bytes"
 	"crypto/sha256"
+	"errors"
 	"fmt"
 	"io"
 	"io/fs"
 	"log"
 	"math"
-	"net"
-	"net/http"
 	"net/url"
 	"os"
 	"path"
 	"path/filepath"
+	"sort"
 	"strconv"
 	"strings"
-	"time"
+	"sync"
 
 	shutil "github.com/termie/go-shutil"
 	"github.com/ubuntu/wsl/wsl-builder/common"
@@ -34,7 +34,11 @@ var (
 )
 
 // prepareBuild finds the correct paths of the VS projects, prepare build assets and get rootfs images.
-func prepareBuild(buildIDPath, appID, rootfses string, noChecksum bool, buildID int) error {
+func prepareBuild(buildIDPath, appID, rootfses string, noChecksum bool, buildID int, opts rootfsOptions) error {
+	if err := opts.validate(); err != nil {
+		return err
+	}
+
 	metaPath, err := common.GetPath("meta")
 	if err != nil {
 		return err
@@ -51,11 +55,16 @@ func prepareBuild(buildIDPath, appID, rootfses string, noChecksum bool, buildID
 		buildNumber = fmt.Sprintf("%d", buildID)
 	}
 
-	archs, err := getRootfses(rootPath, rootfses, noChecksum)
+	dl := newDownloader(opts.downloadConnections, opts.downloadCache)
+	archs, digests, err := getRootfses(rootPath, rootfses, noChecksum, dl, opts)
 	if err != nil {
 		return err
 	}
 
+	if err := writeRootfsDigests(filepath.Join(rootPath, "DistroLauncher", "RootfsDigest.h"), digests); err != nil {
+		return err
+	}
+
 	if err := prepareAssets(rootPath, appID, buildNumber, archs); err != nil {
 		return err
 	}
@@ -93,9 +102,10 @@ func extractAndStoreNextBuildNumber(buildIDPath string) (buildNumber string, err
 // getRootfs downloads one rootfs file in tar.gz format and place
 // it where the distro launcher build system expects. If `uri` points to
 // a local regular file, it is copied from disk instead of downloaded.
-func getRootfs(uri, rootPath, winArch string, noChecksum bool) error {
+// It returns the SHA-256 digest of the file, computed while writing it.
+func getRootfs(dl *downloader, uri, rootPath, winArch string, noChecksum bool) ([]byte, error) {
 	if err := os.MkdirAll(winArch, 0755); err != nil {
-		return err
+		return nil, err
 	}
 
 	if isLocalFile(uri) {
@@ -105,34 +115,40 @@ func getRootfs(uri, rootPath, winArch string, noChecksum bool) error {
 		return copyLocalFile(uri, filepath.Join(rootPath, winArch, "install.tar.gz"))
 	}
 
-	if err := downloadFile(uri, filepath.Join(rootPath, winArch, "install.tar.gz")); err != nil {
-		return err
+	digest, err := dl.download(uri, filepath.Join(rootPath, winArch, "install.tar.gz"))
+	if err != nil {
+		return nil, err
 	}
 
 	if noChecksum {
-		return nil
+		return digest, nil
 	}
 
 	u, err := url.Parse(uri)
 	if err != nil {
-		return err
+		return nil, err
 	}
 	u.Path = filepath.Join(path.Dir(u.Path), "SHA256SUMS")
 	checksumURL := strings.ReplaceAll(u.String(), "%5C", "/")
 	checksumDest := filepath.Join(rootPath, winArch, "SHA256SUMS")
-	if err := downloadFile(checksumURL, checksumDest); err != nil {
-		return err
+	if _, err := dl.download(checksumURL, checksumDest); err != nil {
+		return nil, err
 	}
-	if err := checksumMatches(filepath.Join(rootPath, winArch, "install.tar.gz"), filepath.Base(uri), checksumDest); err != nil {
-		return err
+	if err := checksumMatches(filepath.Join(rootPath, winArch, "install.tar.gz"), digest, filepath.Base(uri), checksumDest); err != nil {
+		return nil, err
 	}
-	return nil
+	return digest, nil
 }
 
 // getRootfses returns a list of windows archs we will build on
 // and place rootfses into the path expected by the WSL build process for each arch.
-func getRootfses(rootPath, rootfses string, noChecksum bool) ([]string, error) {
+// Rootfses are then repacked, recompressed and indexed as requested by opts.
+// It also returns the SHA-256 digest of the archive shipped for each arch.
+// Downloads share dl, which bounds the number of requests in flight.
+func getRootfses(rootPath, rootfses string, noChecksum bool, dl *downloader, opts rootfsOptions) ([]string, map[string][]byte, error) {
 	requestedArches := make(map[string]struct{})
+	digests := make(map[string][]byte)
+	var digestsMu sync.Mutex
 
 	var g errgroup.Group
 	for _, rootfs := range strings.Split(rootfses, ",") {
@@ -154,17 +170,34 @@ func getRootfses(rootPath, rootfses string, noChecksum bool) ([]string, error) {
 		case 2:
 			arch = e[1]
 		default:
-			return nil, fmt.Errorf("invalid url/rootfs form. Only one :: separator to arch is allowded. Got: %q", rootfs)
+			return nil, nil, fmt.Errorf("invalid url/rootfs form. Only one :: separator to arch is allowded. Got: %q", rootfs)
 		}
 		winArch, ok := linuxToWindowsArch[arch]
 		if !ok {
-			return nil, fmt.Errorf("arch %q not supported in WSL (no Windows equivalent)", arch)
+			return nil, nil, fmt.Errorf("arch %q not supported in WSL (no Windows equivalent)", arch)
 		}
 		requestedArches[winArch] = struct{}{}
 
 		// Obtains rootfs and checksum it if `noChecksum==false`
 		g.Go(func() error {
-			return getRootfs(rootfsURL, rootPath, winArch, noChecksum)
+			digest, err := getRootfs(dl, rootfsURL, rootPath, winArch, noChecksum)
+			if err != nil {
+				return err
+			}
+			archive, err := prepareRootfs(filepath.Join(rootPath, winArch, "install.tar.gz"), opts)
+			if err != nil {
+				return err
+			}
+			// Only an archive rewritten after download needs hashing again.
+			if opts.rewritesArchive() {
+				if digest, err = fileDigest(archive); err != nil {
+					return err
+				}
+			}
+			digestsMu.Lock()
+			defer digestsMu.Unlock()
+			digests[winArch] = digest
+			return nil
 		})
 	}
 
@@ -173,7 +206,10 @@ func getRootfses(rootPath, rootfses string, noChecksum bool) ([]string, error) {
 		arches = append(arches, a)
 	}
 
-	return arches, g.Wait()
+	if err := g.Wait(); err != nil {
+		return nil, nil, err
+	}
+	return arches, digests, nil
 }
 
 // isLocalFile returns true if `url` points to a regular local file.
@@ -191,12 +227,12 @@ func isLocalFile(url string) bool {
 }
 
 // copyLocalFile copies a regular local file pointed by `url`
-// into a new file created at `dest`.
-func copyLocalFile(url, dest string) (err error) {
+// into a new file created at `dest`, and returns its SHA-256 digest.
+func copyLocalFile(url, dest string) (digest []byte, err error) {
 	log.Printf("copying file %s", url)
 	source, err := os.Open(url)
 	if err != nil {
-		return err
+		return nil, err
 	}
 	defer source.Close()
 
@@ -211,43 +247,6 @@ func copyLocalFile(url, dest string) (err error) {
 	return writeContentInto(source, size, dest)
 }
 
-// downloadFile downloads a file from the address pointed by `url` into `dest`.
-func downloadFile(url, dest string) (err error) {
-	log.Printf("downloading file %s", url)
-	defer func() {
-		if err != nil {
-			err = fmt.Errorf("could not download %q: %v", url, err)
-		}
-	}()
-
-	// Get the data
-	var netTransport = &http.Transport{
-		Dial: (&net.Dialer{
-			Timeout: 5 * time.Second,
-		}).Dial,
-		TLSHandshakeTimeout: 5 * time.Second,
-	}
-	var netClient = &http.Client{
-		Timeout:   30 * time.Minute,
-		Transport: netTransport,
-	}
-	resp, err := netClient.Get(url)
-	if err != nil {
-		return err
-	}
-	defer resp.Body.Close()
-
-	if resp.StatusCode >= 400 {
-		return fmt.Errorf("http request failed with code %d", resp.StatusCode)
-	}
-
-	var size int
-	if size, err = strconv.Atoi(resp.Header.Get("Content-Length")); err != nil {
-		log.Printf("Warning: unknown size for %s: %v", url, err)
-	}
-	return writeContentInto(resp.Body, uint64(size), dest)
-}
-
 type writeCounter struct {
 	f               *os.File
 	name            string
@@ -276,10 +275,16 @@ func (wc *writeCounter) Close() error {
 // writeContentInto writes the content of the `source io.Reader`
 // into a new file created at `dest`.
 // total is the total size of the content to be downloaded.
-func writeContentInto(source io.Reader, total uint64, dest string) (err error) {
+// The content is hashed as it is written, and its SHA-256 digest returned,
+// so that it never has to be read back for checking.
+func writeContentInto(source io.Reader, total uint64, dest string) (digest []byte, err error) {
+	// dest may be a hard link to a cached download, which must not change.
+	if err := os.Remove(dest); err != nil && !errors.Is(err, os.ErrNotExist) {
+		return nil, err
+	}
 	out, err := os.Create(dest)
 	if err != nil {
-		return err
+		return nil, err
 	}
 	wc := &writeCounter{
 		f:     out,
@@ -288,31 +293,23 @@ func writeContentInto(source io.Reader, total uint64, dest string) (err error) {
 	}
 	defer wc.Close()
 
-	_, err = io.Copy(wc, source)
-	return err
+	h := sha256.New()
+	if _, err := io.Copy(io.MultiWriter(wc, h), source); err != nil {
+		return nil, err
+	}
+	return h.Sum(nil), nil
 }
 
-// checksumMatches checks the file pointed by `path` against values
-// provided in the `checksumPath` file.
-func checksumMatches(path, origName, checksumPath string) (err error) {
+// checksumMatches checks the digest of the file pointed by `path` against
+// values provided in the `checksumPath` file.
+func checksumMatches(path string, digest []byte, origName, checksumPath string) (err error) {
 	defer func() {
 		if err != nil {
 			err = fmt.Errorf("error checking checksum for: %q: %v", path, err)
 		}
 	}()
 
-	// Checksum of the rootfs
-	f, err := os.Open(path)
-	if err != nil {
-		return err
-	}
-	defer f.Close()
-
-	h := sha256.New()
-	if _, err := io.Copy(h, f); err != nil {
-		return err
-	}
-	gotChecksum := fmt.Sprintf("%x", h.Sum(nil))
+	gotChecksum := fmt.Sprintf("%x", digest)
 
 	// Load checksum file
 	checksumF, err := os.Open(checksumPath)
@@ -351,6 +348,68 @@ func checksumMatches(path, origName, checksumPath string) (err error) {
 	return nil
 }
 
+// fileDigest returns the SHA-256 digest of the file at path.
+func fileDigest(path string) ([]byte, error) {
+	f, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+
+	h := sha256.New()
+	if _, err := io.Copy(h, f); err != nil {
+		return nil, err
+	}
+	return h.Sum(nil), nil
+}
+
+// rootfsDigestMacros maps windows archs to the macro MSVC defines when
+// building for them.
+var rootfsDigestMacros = map[string]string{
+	"x64":   "_M_X64",
+	"ARM64": "_M_ARM64",
+}
+
+// writeRootfsDigests writes the header embedding the digest of the rootfs
+// archive shipped for each arch into the launcher, which checks the archive
+// against it before registration.
+func writeRootfsDigests(dest string, digests map[string][]byte) error {
+	var arches []string
+	for arch := range digests {
+		arches = append(arches, arch)
+	}
+	sort.Strings(arches)
+
+	var b strings.Builder
+	b.WriteString(`//
+//    Copyright (C) Canonical Ltd.  All rights reserved.
+// Licensed under the terms described in the LICENSE file in the root of this project.
+//
+// Generated by prepare-build: SHA-256 digests of the rootfs archives shipped
+// with each architecture, which the launcher checks the archive it imports
+// against before registering the distribution.
+
+#pragma once
+`)
+	keyword := "#if"
+	for _, arch := range arches {
+		macro, ok := rootfsDigestMacros[arch]
+		if !ok {
+			return fmt.Errorf("no compiler macro known for arch %q", arch)
+		}
+		fmt.Fprintf(&b, "\n%s defined(%s)\n#define ROOTFS_ARCHIVE_SHA256 \"%x\"", keyword, macro, digests[arch])
+		keyword = "#elif"
+	}
+	if len(arches) > 0 {
+		b.WriteString("\n#endif\n")
+	}
+
+	if err := os.WriteFile(dest, []byte(b.String()), 0644); err != nil {
+		return fmt.Errorf("could not write rootfs digests: %v", err)
+	}
+	return nil
+}
+
 // prepareAssets copies metadata and assets files, appending dynamic elements.
 func prepareAssets(rootPath, wslID, buildNumber string, arches []string) (err error) {
 	defer func() {
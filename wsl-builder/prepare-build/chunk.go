@@ -0,0 +1,231 @@
+package main
+
+import (
+	"bufio"
+	"bytes"
+	"compress/gzip"
+	"crypto/sha256"
+	"encoding/hex"
+	"errors"
+	"fmt"
+	"io"
+	"log"
+	"os"
+	"path/filepath"
+	"runtime"
+	"sync"
+
+	"golang.org/x/sync/errgroup"
+)
+
+// Rootfses are split into chunks at content-defined boundaries, so that an
+// insertion or a changed file only affects the chunks around it and the
+// other chunks are shared between releases. The chunk store is a directory
+// holding each chunk gzip-compressed at <store>/<hh>/<sha256>, where sha256
+// is the hexadecimal hash of the uncompressed chunk and hh its first two
+// characters. A manifest lists the chunks making up a rootfs tar stream:
+//
+//	wsl-chunk-manifest 1
+//	size <tar size>
+//	sha256 <tar hash>
+//	<chunk hash> <chunk size>
+//	...
+const (
+	chunkManifestHeader = "wsl-chunk-manifest 1"
+
+	// Chunk size bounds, and the size FastCDC normalizes chunks around.
+	chunkMinSize = 16 << 10
+	chunkAvgSize = 64 << 10
+	chunkMaxSize = 256 << 10
+
+	// Boundary masks with two bits more and two bits fewer than
+	// log2(chunkAvgSize), spread over the upper 48 bits of the hash. They are
+	// used before and after the average size to narrow the size distribution.
+	chunkMaskSmall = 0xa4a4a4a4a4a40000
+	chunkMaskLarge = 0x9224489224480000
+)
+
+// chunkGear maps bytes to the random values mixed into the rolling hash.
+// It is generated from a fixed seed, as boundaries must not change between builds.
+var chunkGear = func() (gear [256]uint64) {
+	seed := uint64(0x9e3779b97f4a7c15)
+	for i := range gear {
+		// splitmix64
+		seed += 0x9e3779b97f4a7c15
+		z := seed
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb
+		gear[i] = z ^ (z >> 31)
+	}
+	return gear
+}()
+
+// nextChunkSize returns the size of the chunk starting at data, using the
+// FastCDC gear rolling hash. data must hold chunkMaxSize bytes unless it is
+// the end of the stream.
+func nextChunkSize(data []byte) int {
+	n := len(data)
+	if n <= chunkMinSize {
+		return n
+	}
+	if n > chunkMaxSize {
+		n = chunkMaxSize
+	}
+	normal := chunkAvgSize
+	if n < normal {
+		normal = n
+	}
+
+	var hash uint64
+	i := chunkMinSize
+	for ; i < normal; i++ {
+		hash = (hash << 1) + chunkGear[data[i]]
+		if hash&chunkMaskSmall == 0 {
+			return i + 1
+		}
+	}
+	for ; i < n; i++ {
+		hash = (hash << 1) + chunkGear[data[i]]
+		if hash&chunkMaskLarge == 0 {
+			return i + 1
+		}
+	}
+	return n
+}
+
+// chunkStats summarizes how much of a rootfs was already in the store.
+type chunkStats struct {
+	chunks, newChunks         int
+	bytes, newBytes, newSpace int64
+}
+
+// chunkRootfs splits the gzip tarball at src into the chunk store at store,
+// adding the chunks it does not hold yet, and writes the manifest of the
+// tar stream to manifest.
+func chunkRootfs(src, store, manifest string) (err error) {
+	defer func() {
+		if err != nil {
+			err = fmt.Errorf("can't chunk %q: %v", src, err)
+		}
+	}()
+
+	in, err := os.Open(src)
+	if err != nil {
+		return err
+	}
+	defer in.Close()
+
+	zr, err := gzip.NewReader(bufio.NewReaderSize(in, 1<<20))
+	if err != nil {
+		return err
+	}
+	defer zr.Close()
+
+	var out bytes.Buffer
+	var stats chunkStats
+	var statsMu sync.Mutex
+	tarHash := sha256.New()
+
+	// Chunks are compressed concurrently, with at most one per CPU in flight.
+	var g errgroup.Group
+	slots := make(chan struct{}, runtime.NumCPU())
+	buf := make([]byte, 0, 2*chunkMaxSize)
+	eof := false
+	for {
+		if !eof && len(buf) < chunkMaxSize {
+			n, err := io.ReadFull(zr, buf[len(buf):cap(buf)])
+			buf = buf[:len(buf)+n]
+			if errors.Is(err, io.EOF) || errors.Is(err, io.ErrUnexpectedEOF) {
+				eof = true
+			} else if err != nil {
+				g.Wait()
+				return err
+			}
+		}
+		if len(buf) == 0 {
+			break
+		}
+
+		size := nextChunkSize(buf)
+		chunk := append([]byte(nil), buf[:size]...)
+		buf = buf[:copy(buf, buf[size:])]
+
+		tarHash.Write(chunk)
+		sum := sha256.Sum256(chunk)
+		name := hex.EncodeToString(sum[:])
+		fmt.Fprintf(&out, "%s %d\n", name, len(chunk))
+		stats.chunks++
+		stats.bytes += int64(len(chunk))
+
+		slots <- struct{}{}
+		g.Go(func() error {
+			defer func() { <-slots }()
+			written, err := storeChunk(store, name, chunk)
+			if err != nil || written == 0 {
+				return err
+			}
+			statsMu.Lock()
+			defer statsMu.Unlock()
+			stats.newChunks++
+			stats.newBytes += int64(len(chunk))
+			stats.newSpace += written
+			return nil
+		})
+	}
+	if err := g.Wait(); err != nil {
+		return err
+	}
+
+	header := fmt.Sprintf("%s\nsize %d\nsha256 %x\n", chunkManifestHeader, stats.bytes, tarHash.Sum(nil))
+	if err := os.WriteFile(manifest, append([]byte(header), out.Bytes()...), 0644); err != nil {
+		return err
+	}
+
+	log.Printf("%s: %d chunks, %d bytes; %d new chunks, %d new bytes stored in %d bytes",
+		src, stats.chunks, stats.bytes, stats.newChunks, stats.newBytes, stats.newSpace)
+	return nil
+}
+
+// storeChunk writes data gzip-compressed to the store under name, unless it
+// is already there. It returns the number of bytes written.
+func storeChunk(store, name string, data []byte) (int64, error) {
+	path := filepath.Join(store, name[:2], name)
+	if _, err := os.Stat(path); err == nil {
+		return 0, nil
+	}
+
+	if err := os.MkdirAll(filepath.Dir(path), 0755); err != nil {
+		return 0, err
+	}
+
+	var compressed bytes.Buffer
+	zw, err := gzip.NewWriterLevel(&compressed, gzip.BestCompression)
+	if err != nil {
+		return 0, err
+	}
+	if _, err := zw.Write(data); err != nil {
+		return 0, err
+	}
+	if err := zw.Close(); err != nil {
+		return 0, err
+	}
+
+	// Chunks appear atomically, so that concurrent runs never see partial ones.
+	tmp, err := os.CreateTemp(filepath.Dir(path), name+".tmp-")
+	if err != nil {
+		return 0, err
+	}
+	defer os.Remove(tmp.Name())
+	if _, err := tmp.Write(compressed.Bytes()); err != nil {
+		tmp.Close()
+		return 0, err
+	}
+	if err := tmp.Close(); err != nil {
+		return 0, err
+	}
+	if err := os.Rename(tmp.Name(), path); err != nil {
+		return 0, err
+	}
+
+	return int64(compressed.Len()), nil
+}
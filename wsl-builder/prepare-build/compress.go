@@ -0,0 +1,247 @@
+package main
+
+import (
+	"archive/tar"
+	"bufio"
+	"bytes"
+	"compress/gzip"
+	"errors"
+	"fmt"
+	"io"
+	"log"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"strings"
+)
+
+const (
+	compressionGzip = "gzip"
+	compressionZstd = "zstd"
+	compressionXz   = "xz"
+
+	// dictionarySamplesDir is where the files used to train a zstd dictionary come from.
+	dictionarySamplesDir = "usr/share/"
+
+	// dictionarySampleMaxSize is the size above which files are not used as training samples.
+	dictionarySampleMaxSize = 16 << 10
+)
+
+// rootfsOptions controls how rootfses are stored in the build tree.
+type rootfsOptions struct {
+	repackBlockSize int    // split rootfses into gzip members or zstd frames of this many bytes; 0 disables.
+	compression     string // compression of the shipped rootfs: gzip, zstd or xz.
+	dictionarySize  int    // size of the zstd dictionary to train; 0 disables.
+	index           bool   // write an index sidecar next to the rootfs.
+
+	downloadConnections int    // range requests in flight at once across all downloads.
+	downloadCache       string // directory caching downloads and partial downloads; empty disables.
+}
+
+// validate checks that the options can be combined.
+func (o rootfsOptions) validate() error {
+	switch o.compression {
+	case compressionGzip, compressionZstd, compressionXz:
+	default:
+		return fmt.Errorf("unsupported rootfs compression %q", o.compression)
+	}
+	if o.repackBlockSize > 0 && o.compression == compressionXz {
+		return errors.New("repacking only applies to gzip and zstd rootfses")
+	}
+	if o.dictionarySize > 0 && o.compression != compressionZstd {
+		return errors.New("dictionaries only apply to zstd rootfses")
+	}
+	return nil
+}
+
+// prepareRootfs turns the gzip tarball downloaded at path into the archive
+// shipped with the application, as requested by opts, and indexes it. It
+// returns the path of that archive.
+func prepareRootfs(path string, opts rootfsOptions) (archive string, err error) {
+	var entries []indexEntry
+	var tarSize uint64
+	if opts.index {
+		if entries, tarSize, err = indexTarball(path); err != nil {
+			return "", err
+		}
+	}
+
+	archive = path
+	switch {
+	case opts.compression != compressionGzip:
+		if archive, err = recompressRootfs(path, opts); err != nil {
+			return "", err
+		}
+	case opts.repackBlockSize > 0:
+		if err := repackRootfsInPlace(path, opts.repackBlockSize); err != nil {
+			return "", err
+		}
+	}
+
+	os.Remove(archive + ".index")
+	if !opts.index {
+		return archive, nil
+	}
+	return archive, writeIndex(archive, entries, tarSize)
+}
+
+// rewritesArchive tells whether preparing a rootfs replaces the downloaded archive.
+func (o rootfsOptions) rewritesArchive() bool {
+	return o.compression != compressionGzip || o.repackBlockSize > 0
+}
+
+// recompressRootfs replaces the gzip tarball at path with an install.tar.zst
+// or install.tar.xz next to it, using the zstd and xz command line tools,
+// and returns the path of the new archive.
+// The launcher picks the format from the archive content.
+// With a zstd dictionary, it is trained on the small files under /usr/share
+// and stored as install.tar.zst.dict, which the launcher loads when present.
+// With a repack block size, zstd rootfses are made of one frame per block so
+// that they can be indexed.
+func recompressRootfs(path string, opts rootfsOptions) (dest string, err error) {
+	dest = filepath.Join(filepath.Dir(path), "install.tar."+map[string]string{
+		compressionZstd: "zst",
+		compressionXz:   "xz",
+	}[opts.compression])
+	defer func() {
+		if err != nil {
+			err = fmt.Errorf("can't recompress %q with %s: %v", path, opts.compression, err)
+			os.Remove(dest)
+		}
+	}()
+
+	var cmd *exec.Cmd
+	switch opts.compression {
+	case compressionZstd:
+		args := []string{"-19", "--long=27", "-T0", "-q", "-f", "-o", dest}
+		dictionary := dest + ".dict"
+		os.Remove(dictionary)
+		if opts.dictionarySize > 0 {
+			if err := trainDictionary(path, dictionary, opts.dictionarySize); err != nil {
+				return "", err
+			}
+			args = append(args, "-D", dictionary)
+		} else {
+			dictionary = ""
+		}
+
+		if opts.repackBlockSize > 0 {
+			log.Printf("recompressing %s to %s in frames of %d bytes", path, dest, opts.repackBlockSize)
+			if err := repackBlocks(path, dest, opts.repackBlockSize, compressZstdFrame(dictionary)); err != nil {
+				return "", err
+			}
+			return dest, os.Remove(path)
+		}
+		cmd = exec.Command("zstd", args...)
+	case compressionXz:
+		cmd = exec.Command("xz", "-9", "-T0", "-c")
+	}
+
+	log.Printf("recompressing %s to %s", path, dest)
+	in, err := os.Open(path)
+	if err != nil {
+		return "", err
+	}
+	defer in.Close()
+
+	zr, err := gzip.NewReader(bufio.NewReaderSize(in, 1<<20))
+	if err != nil {
+		return "", err
+	}
+	defer zr.Close()
+
+	cmd.Stdin = zr
+	cmd.Stderr = os.Stderr
+	if opts.compression == compressionXz {
+		out, err := os.Create(dest)
+		if err != nil {
+			return "", err
+		}
+		defer out.Close()
+		cmd.Stdout = out
+	}
+
+	if err := cmd.Run(); err != nil {
+		return "", err
+	}
+
+	return dest, os.Remove(path)
+}
+
+// compressZstdFrame returns a function compressing a block into a zstd frame
+// of its own, which declares its content size so that it can be indexed.
+func compressZstdFrame(dictionary string) func([]byte) ([]byte, error) {
+	return func(data []byte) ([]byte, error) {
+		args := []string{"-19", "-q", "-c", fmt.Sprintf("--stream-size=%d", len(data))}
+		if dictionary != "" {
+			args = append(args, "-D", dictionary)
+		}
+		cmd := exec.Command("zstd", args...)
+		cmd.Stdin = bytes.NewReader(data)
+		cmd.Stderr = os.Stderr
+		return cmd.Output()
+	}
+}
+
+// trainDictionary trains a zstd dictionary of size bytes on the small regular
+// files found under /usr/share in the gzip tarball src, and writes it to dest.
+func trainDictionary(src, dest string, size int) (err error) {
+	defer func() {
+		if err != nil {
+			err = fmt.Errorf("can't train dictionary: %v", err)
+		}
+	}()
+
+	samplesDir, err := os.MkdirTemp("", "wsl-dictionary-samples-")
+	if err != nil {
+		return err
+	}
+	defer os.RemoveAll(samplesDir)
+
+	in, err := os.Open(src)
+	if err != nil {
+		return err
+	}
+	defer in.Close()
+
+	zr, err := gzip.NewReader(bufio.NewReaderSize(in, 1<<20))
+	if err != nil {
+		return err
+	}
+	defer zr.Close()
+
+	// zstd recommends about a hundred times the dictionary size in samples.
+	budget := int64(size) * 100
+	var samples int
+	tr := tar.NewReader(zr)
+	for budget > 0 {
+		h, err := tr.Next()
+		if errors.Is(err, io.EOF) {
+			break
+		}
+		if err != nil {
+			return err
+		}
+
+		name := strings.TrimPrefix(h.Name, "./")
+		if h.Typeflag != tar.TypeReg || !strings.HasPrefix(name, dictionarySamplesDir) ||
+			h.Size == 0 || h.Size > dictionarySampleMaxSize {
+			continue
+		}
+
+		data, err := io.ReadAll(tr)
+		if err != nil {
+			return err
+		}
+		if err := os.WriteFile(filepath.Join(samplesDir, fmt.Sprintf("%08d", samples)), data, 0600); err != nil {
+			return err
+		}
+		samples++
+		budget -= h.Size
+	}
+
+	log.Printf("training a %d bytes dictionary on %d files from /%s", size, samples, dictionarySamplesDir)
+	cmd := exec.Command("zstd", "--train", "-q", "-r", samplesDir, fmt.Sprintf("--maxdict=%d", size), "-f", "-o", dest)
+	cmd.Stderr = os.Stderr
+	return cmd.Run()
+}
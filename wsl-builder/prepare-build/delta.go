@@ -0,0 +1,382 @@
+package main
+
+import (
+	"archive/tar"
+	"bufio"
+	"bytes"
+	"compress/gzip"
+	"crypto/sha256"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"log"
+	"os"
+	"sort"
+	"strings"
+)
+
+// A rootfs delta turns an extracted rootfs tree into the one of a newer
+// tarball, entry by entry. It is a gzip stream holding, after the magic
+// "WSLDELTA" and a u32 version, a series of records introduced by an op byte:
+//
+//	'D' path                 remove an entry, and its children if it is a directory
+//	'E' meta size data       create or replace an entry with the given content
+//	'M' meta                 update the metadata of an existing entry
+//	'P' meta oldHash newSize newHash instructions
+//	                         rebuild a regular file from its current content
+//	'.'                      end of the delta
+//
+// where meta is: path, type u8, mode u32, uid u32, gid u32, mtime i64,
+// link target, xattr count u32 and that many name/value string pairs.
+// Strings are a u32 length followed by their bytes, integers are
+// little-endian and hashes are SHA-256. Patch instructions are
+// 'C' offset u64 length u64 to copy from the current content,
+// 'I' length u64 data to insert new bytes, and '.' to end the file.
+//
+// Removals come first, children before their parent, then the other records
+// in the order of the new tarball, so that directories exist before their content.
+const (
+	deltaMagic   = "WSLDELTA"
+	deltaVersion = 1
+
+	// deltaBlockSize is the granularity at which unchanged data is found in
+	// the previous version of a file.
+	deltaBlockSize = 16
+
+	// xattrPrefix introduces extended attributes in PAX records.
+	xattrPrefix = "SCHILY.xattr."
+)
+
+// deltaEntry is what the delta records about a tar entry.
+type deltaEntry struct {
+	header *tar.Header
+	hash   [sha256.Size]byte
+}
+
+// sameMeta tells whether two entries only differ by their content.
+func (e deltaEntry) sameMeta(o deltaEntry) bool {
+	a, b := e.header, o.header
+	if a.Typeflag != b.Typeflag || a.Mode != b.Mode || a.Uid != b.Uid || a.Gid != b.Gid ||
+		a.ModTime.Unix() != b.ModTime.Unix() || a.Linkname != b.Linkname {
+		return false
+	}
+	ax, bx := xattrs(a), xattrs(b)
+	if len(ax) != len(bx) {
+		return false
+	}
+	for i := range ax {
+		if ax[i] != bx[i] {
+			return false
+		}
+	}
+	return true
+}
+
+func isRegular(h *tar.Header) bool {
+	return h.Typeflag == tar.TypeReg || h.Typeflag == tar.TypeRegA || h.Typeflag == tar.TypeCont
+}
+
+// xattrs returns the extended attributes of an entry as sorted name, value pairs.
+func xattrs(h *tar.Header) [][2]string {
+	var attrs [][2]string
+	for k, v := range h.PAXRecords {
+		if strings.HasPrefix(k, xattrPrefix) {
+			attrs = append(attrs, [2]string{strings.TrimPrefix(k, xattrPrefix), v})
+		}
+	}
+	sort.Slice(attrs, func(i, j int) bool { return attrs[i][0] < attrs[j][0] })
+	return attrs
+}
+
+// walkTarball calls fn on every entry of the gzip tarball at path, with the
+// entry content when wantContent returns true for it, and its hash.
+func walkTarball(path string, wantContent func(h *tar.Header) bool, fn func(h *tar.Header, hash [sha256.Size]byte, content []byte) error) error {
+	f, err := os.Open(path)
+	if err != nil {
+		return err
+	}
+	defer f.Close()
+
+	zr, err := gzip.NewReader(bufio.NewReaderSize(f, 1<<20))
+	if err != nil {
+		return err
+	}
+	defer zr.Close()
+
+	tr := tar.NewReader(zr)
+	for {
+		h, err := tr.Next()
+		if errors.Is(err, io.EOF) {
+			return nil
+		}
+		if err != nil {
+			return err
+		}
+		h.Name = normalizeTarPath(h.Name)
+		if h.Typeflag == tar.TypeLink {
+			h.Linkname = normalizeTarPath(h.Linkname)
+		}
+
+		var content []byte
+		hash := sha256.New()
+		if wantContent(h) {
+			if content, err = io.ReadAll(tr); err != nil {
+				return err
+			}
+			hash.Write(content)
+		} else if _, err := io.Copy(hash, tr); err != nil {
+			return err
+		}
+
+		var sum [sha256.Size]byte
+		copy(sum[:], hash.Sum(nil))
+		if err := fn(h, sum, content); err != nil {
+			return err
+		}
+	}
+}
+
+// deltaWriter encodes delta records.
+type deltaWriter struct {
+	w   *bufio.Writer
+	err error
+}
+
+func (d *deltaWriter) write(b []byte) {
+	if d.err == nil {
+		_, d.err = d.w.Write(b)
+	}
+}
+
+func (d *deltaWriter) u8(v byte)       { d.write([]byte{v}) }
+func (d *deltaWriter) u32(v uint32)    { d.write(binary.LittleEndian.AppendUint32(nil, v)) }
+func (d *deltaWriter) u64(v uint64)    { d.write(binary.LittleEndian.AppendUint64(nil, v)) }
+func (d *deltaWriter) str(s string)    { d.u32(uint32(len(s))); d.write([]byte(s)) }
+func (d *deltaWriter) hash(h [32]byte) { d.write(h[:]) }
+
+func (d *deltaWriter) meta(h *tar.Header) {
+	d.str(h.Name)
+	d.u8(h.Typeflag)
+	d.u32(uint32(h.Mode))
+	d.u32(uint32(h.Uid))
+	d.u32(uint32(h.Gid))
+	d.u64(uint64(h.ModTime.Unix()))
+	d.str(h.Linkname)
+	attrs := xattrs(h)
+	d.u32(uint32(len(attrs)))
+	for _, a := range attrs {
+		d.str(a[0])
+		d.str(a[1])
+	}
+}
+
+// diffContent returns the patch instructions rebuilding new from old, and
+// the number of bytes they take. Aligned blocks of old are indexed by hash;
+// every match found in new is then extended both ways.
+func diffContent(old, new []byte) ([]byte, int) {
+	blockHash := func(b []byte) uint64 {
+		var h uint64 = 14695981039346656037
+		for _, c := range b {
+			h = (h ^ uint64(c)) * 1099511628211
+		}
+		return h
+	}
+
+	index := make(map[uint64]int, len(old)/deltaBlockSize)
+	for i := 0; i+deltaBlockSize <= len(old); i += deltaBlockSize {
+		if _, ok := index[blockHash(old[i:i+deltaBlockSize])]; !ok {
+			index[blockHash(old[i:i+deltaBlockSize])] = i
+		}
+	}
+
+	var out bytes.Buffer
+	emitInsert := func(data []byte) {
+		if len(data) == 0 {
+			return
+		}
+		out.WriteByte('I')
+		out.Write(binary.LittleEndian.AppendUint64(nil, uint64(len(data))))
+		out.Write(data)
+	}
+
+	literal := 0
+	for i := 0; i+deltaBlockSize <= len(new); {
+		pos, ok := index[blockHash(new[i:i+deltaBlockSize])]
+		if !ok || !bytes.Equal(old[pos:pos+deltaBlockSize], new[i:i+deltaBlockSize]) {
+			i++
+			continue
+		}
+
+		start, oldStart := i, pos
+		for start > literal && oldStart > 0 && new[start-1] == old[oldStart-1] {
+			start--
+			oldStart--
+		}
+		end, oldEnd := i+deltaBlockSize, pos+deltaBlockSize
+		for end < len(new) && oldEnd < len(old) && new[end] == old[oldEnd] {
+			end++
+			oldEnd++
+		}
+
+		emitInsert(new[literal:start])
+		out.WriteByte('C')
+		out.Write(binary.LittleEndian.AppendUint64(nil, uint64(oldStart)))
+		out.Write(binary.LittleEndian.AppendUint64(nil, uint64(end-start)))
+		literal, i = end, end
+	}
+	emitInsert(new[literal:])
+	out.WriteByte('.')
+	return out.Bytes(), out.Len()
+}
+
+// deltaStats counts the records of a delta.
+type deltaStats struct {
+	removed, created, updated, patched int
+}
+
+// computeRootfsDelta writes to dest the delta turning the rootfs of the gzip
+// tarball oldPath into the one of newPath.
+func computeRootfsDelta(oldPath, newPath, dest string) (err error) {
+	defer func() {
+		if err != nil {
+			err = fmt.Errorf("can't compute delta from %q to %q: %v", oldPath, newPath, err)
+		}
+	}()
+
+	noContent := func(*tar.Header) bool { return false }
+
+	// First learn the new entries, then keep the previous content of the
+	// regular files that changed, which are the only ones patched.
+	// As on extraction, the last of duplicate entries wins.
+	newEntries := make(map[string]deltaEntry)
+	occurrences := make(map[string]int)
+	err = walkTarball(newPath, noContent, func(h *tar.Header, hash [sha256.Size]byte, _ []byte) error {
+		newEntries[h.Name] = deltaEntry{header: h, hash: hash}
+		occurrences[h.Name]++
+		return nil
+	})
+	if err != nil {
+		return err
+	}
+
+	oldEntries := make(map[string]deltaEntry)
+	oldContent := make(map[string][]byte)
+	changedFile := func(h *tar.Header) bool {
+		n, ok := newEntries[h.Name]
+		return ok && isRegular(h) && isRegular(n.header)
+	}
+	err = walkTarball(oldPath, changedFile, func(h *tar.Header, hash [sha256.Size]byte, content []byte) error {
+		oldEntries[h.Name] = deltaEntry{header: h, hash: hash}
+		if content != nil && newEntries[h.Name].hash != hash {
+			oldContent[h.Name] = content
+		} else {
+			delete(oldContent, h.Name)
+		}
+		return nil
+	})
+	if err != nil {
+		return err
+	}
+
+	f, err := os.Create(dest)
+	if err != nil {
+		return err
+	}
+	defer func() {
+		if cerr := f.Close(); err == nil {
+			err = cerr
+		}
+		if err != nil {
+			os.Remove(dest)
+		}
+	}()
+
+	zw, err := gzip.NewWriterLevel(f, gzip.BestCompression)
+	if err != nil {
+		return err
+	}
+	d := &deltaWriter{w: bufio.NewWriterSize(zw, 1<<20)}
+	d.write([]byte(deltaMagic))
+	d.u32(deltaVersion)
+
+	// Entries that changed type are removed first too, so that a directory
+	// replaced by a file does not keep its children.
+	var stats deltaStats
+	var removed []string
+	for name, o := range oldEntries {
+		if n, ok := newEntries[name]; !ok || n.header.Typeflag != o.header.Typeflag && !(isRegular(n.header) && isRegular(o.header)) {
+			removed = append(removed, name)
+		}
+	}
+	sort.Sort(sort.Reverse(sort.StringSlice(removed)))
+	for _, name := range removed {
+		d.u8('D')
+		d.str(name)
+		delete(oldEntries, name)
+		stats.removed++
+	}
+
+	// Hard links are recreated when the file they point to is rewritten,
+	// since rewriting it replaces the file rather than editing it.
+	rewritten := make(map[string]bool)
+	err = walkTarball(newPath, isRegular, func(h *tar.Header, hash [sha256.Size]byte, content []byte) error {
+		if occurrences[h.Name]--; occurrences[h.Name] > 0 {
+			return nil
+		}
+
+		o, existed := oldEntries[h.Name]
+		n := deltaEntry{header: h, hash: hash}
+		sameNode := existed && o.hash == hash && o.header.Linkname == h.Linkname
+		switch {
+		case sameNode && o.sameMeta(n) && !(h.Typeflag == tar.TypeLink && rewritten[h.Linkname]):
+			return nil
+		case sameNode && h.Typeflag != tar.TypeLink:
+			d.u8('M')
+			d.meta(h)
+			stats.updated++
+			return nil
+		}
+
+		if old, ok := oldContent[h.Name]; ok && existed && isRegular(h) {
+			patch, size := diffContent(old, content)
+			if size < len(content) {
+				d.u8('P')
+				d.meta(h)
+				d.hash(o.hash)
+				d.u64(uint64(len(content)))
+				d.hash(hash)
+				d.write(patch)
+				rewritten[h.Name] = true
+				stats.patched++
+				return nil
+			}
+		}
+
+		d.u8('E')
+		d.meta(h)
+		d.u64(uint64(len(content)))
+		d.write(content)
+		rewritten[h.Name] = true
+		stats.created++
+		return nil
+	})
+	if err != nil {
+		return err
+	}
+
+	d.u8('.')
+	if d.err != nil {
+		return d.err
+	}
+	if err := d.w.Flush(); err != nil {
+		return err
+	}
+	if err := zw.Close(); err != nil {
+		return err
+	}
+
+	log.Printf("delta from %s to %s: %d removed, %d created or replaced, %d metadata updates, %d patched",
+		oldPath, newPath, stats.removed, stats.created, stats.updated, stats.patched)
+	return nil
+}
@@ -0,0 +1,590 @@
+package main
+
+import (
+	"context"
+	"crypto/sha256"
+	"encoding/hex"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"hash"
+	"io"
+	"log"
+	"math"
+	"net"
+	"net/http"
+	"os"
+	"path/filepath"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"golang.org/x/sync/errgroup"
+)
+
+const (
+	// defaultDownloadConnections is the number of range requests in flight
+	// across all downloads at once.
+	defaultDownloadConnections = 8
+
+	// downloadSegmentSize is the size of each range request, and so the
+	// granularity at which interrupted downloads resume.
+	downloadSegmentSize = 16 << 20
+
+	// segmentAttempts is how many times a failed range request is tried.
+	segmentAttempts = 3
+)
+
+// downloader fetches files over HTTP in parallel byte ranges when the server
+// allows it, resuming partial downloads of files with a strong ETag and
+// caching complete ones on disk by URL and validator (ETag, or else
+// Last-Modified).
+type downloader struct {
+	client *http.Client
+
+	// cacheDir holds complete downloads and partial ones; when empty,
+	// partial downloads are kept next to their destination.
+	cacheDir string
+
+	// slots bounds the number of requests in flight, shared by all the
+	// downloads made with this downloader.
+	slots chan struct{}
+
+	segmentSize int64
+
+	// retryDelay is how long to wait before trying a failed range request
+	// again, times the number of attempts made.
+	retryDelay time.Duration
+}
+
+// newDownloader returns a downloader making at most connections requests at
+// once and keeping its files in cacheDir, if not empty.
+func newDownloader(connections int, cacheDir string) *downloader {
+	if connections < 1 {
+		connections = 1
+	}
+	return &downloader{
+		client: &http.Client{
+			Transport: &http.Transport{
+				Proxy: http.ProxyFromEnvironment,
+				Dial: (&net.Dialer{
+					Timeout: 5 * time.Second,
+				}).Dial,
+				TLSHandshakeTimeout:   5 * time.Second,
+				ResponseHeaderTimeout: 30 * time.Second,
+				MaxIdleConnsPerHost:   connections,
+			},
+		},
+		cacheDir:    cacheDir,
+		slots:       make(chan struct{}, connections),
+		segmentSize: downloadSegmentSize,
+		retryDelay:  time.Second,
+	}
+}
+
+// defaultDownloadCache returns the directory downloads are cached in unless
+// told otherwise, or an empty string if the user has no cache directory.
+func defaultDownloadCache() string {
+	dir, err := os.UserCacheDir()
+	if err != nil {
+		return ""
+	}
+	return filepath.Join(dir, "wsl-builder", "downloads")
+}
+
+// remoteFile is what a HEAD request tells about a file before downloading it.
+type remoteFile struct {
+	size      int64 // -1 when unknown.
+	validator string
+	ranges    bool
+
+	// strong is set when validator is a strong ETag: only then does If-Range
+	// make the server check that ranges come from the same version of the
+	// file, and can a partial download be resumed.
+	strong bool
+}
+
+// partialState records the segments of a partial download already on disk,
+// next to it, so that an interrupted download picks up where it stopped.
+type partialState struct {
+	URL       string `json:"url"`
+	Validator string `json:"validator"`
+	Size      int64  `json:"size"`
+	Segment   int64  `json:"segment"`
+	Done      []bool `json:"done"`
+}
+
+// download fetches url into dest and returns its SHA-256 digest, computed
+// as the file is written. A cached copy is hard-linked to dest, with the
+// digest saved next to it.
+func (d *downloader) download(url, dest string) (digest []byte, err error) {
+	log.Printf("downloading file %s", url)
+	defer func() {
+		if err != nil {
+			err = fmt.Errorf("could not download %q: %v", url, err)
+		}
+	}()
+
+	remote, err := d.stat(url)
+	if err != nil {
+		return nil, err
+	}
+
+	// Without a validator, nothing tells a cached copy is still current.
+	// Each URL has its own directory, holding only its latest version.
+	var key, urlDir string
+	if d.cacheDir != "" && remote.validator != "" {
+		urlHash := sha256.Sum256([]byte(url))
+		validatorHash := sha256.Sum256([]byte(remote.validator))
+		urlDir = filepath.Join(d.cacheDir, hex.EncodeToString(urlHash[:]))
+		key = filepath.Join(urlDir, hex.EncodeToString(validatorHash[:]))
+		if err := os.MkdirAll(urlDir, 0755); err != nil {
+			return nil, err
+		}
+		if fi, err := os.Stat(key); err == nil && (remote.size < 0 || fi.Size() == remote.size) {
+			log.Printf("using cached copy of %s", url)
+			return useCached(key, dest)
+		}
+	}
+
+	part := dest + ".part"
+	if key != "" {
+		part = key + ".part"
+	}
+
+	if remote.ranges && remote.size > d.segmentSize {
+		digest, err = d.fetchSegments(url, part, remote)
+	} else {
+		digest, err = d.fetchWhole(url, part, remote.size)
+	}
+	if err != nil {
+		return nil, err
+	}
+
+	if key == "" {
+		if err := os.Rename(part, dest); err != nil {
+			return nil, err
+		}
+		return digest, nil
+	}
+
+	if err := os.WriteFile(key+".sha256", []byte(hex.EncodeToString(digest)), 0644); err != nil {
+		return nil, err
+	}
+	if err := os.Rename(part, key); err != nil {
+		return nil, err
+	}
+	pruneCache(urlDir, key)
+	return useCached(key, dest)
+}
+
+// useCached hard-links the cached file at key to dest, or copies it where
+// the two are on different file systems, and returns its digest.
+// Cached files are never written to again, and dest is replaced rather
+// than overwritten, so that the link never changes them.
+func useCached(key, dest string) ([]byte, error) {
+	digest, err := cachedDigest(key)
+	if err != nil {
+		return nil, err
+	}
+
+	if err := os.Remove(dest); err != nil && !errors.Is(err, os.ErrNotExist) {
+		return nil, err
+	}
+	if err := os.Link(key, dest); err != nil {
+		return copyLocalFile(key, dest)
+	}
+	return digest, nil
+}
+
+// cachedDigest returns the digest saved with the cached file at key, and
+// saves it if the file was cached without one.
+func cachedDigest(key string) ([]byte, error) {
+	if data, err := os.ReadFile(key + ".sha256"); err == nil {
+		if digest, err := hex.DecodeString(strings.TrimSpace(string(data))); err == nil && len(digest) == sha256.Size {
+			return digest, nil
+		}
+	}
+
+	digest, err := fileDigest(key)
+	if err != nil {
+		return nil, err
+	}
+	return digest, os.WriteFile(key+".sha256", []byte(hex.EncodeToString(digest)), 0644)
+}
+
+// pruneCache removes the files of older versions of a URL from its cache
+// directory, keeping latest and its digest.
+func pruneCache(urlDir, latest string) {
+	entries, err := os.ReadDir(urlDir)
+	if err != nil {
+		return
+	}
+	for _, e := range entries {
+		if p := filepath.Join(urlDir, e.Name()); p != latest && p != latest+".sha256" {
+			os.Remove(p)
+		}
+	}
+}
+
+// stat asks the server for the size and validator of url, and whether it
+// serves byte ranges of it.
+func (d *downloader) stat(url string) (remoteFile, error) {
+	remote := remoteFile{size: -1}
+	resp, err := d.client.Head(url)
+	if err != nil {
+		return remote, err
+	}
+	resp.Body.Close()
+
+	// Some servers refuse HEAD requests: the file is then simply streamed.
+	if resp.StatusCode >= 400 {
+		return remote, nil
+	}
+
+	remote.size = resp.ContentLength
+	remote.validator = validatorOf(resp.Header)
+	remote.strong = isStrongETag(resp.Header.Get("ETag"))
+	remote.ranges = resp.Header.Get("Accept-Ranges") == "bytes" && remote.size > 0
+	return remote, nil
+}
+
+// validatorOf returns the ETag of a response, or else its Last-Modified date.
+func validatorOf(header http.Header) string {
+	if etag := header.Get("ETag"); etag != "" {
+		return etag
+	}
+	return header.Get("Last-Modified")
+}
+
+// isStrongETag tells whether etag is a strong entity tag, as opposed to a
+// weak one, which servers never match in If-Range.
+func isStrongETag(etag string) bool {
+	return strings.HasPrefix(etag, `"`)
+}
+
+// fetchWhole streams url into path with a single request, and returns the
+// SHA-256 digest of what it wrote.
+func (d *downloader) fetchWhole(url, path string, size int64) ([]byte, error) {
+	d.slots <- struct{}{}
+	defer func() { <-d.slots }()
+
+	ctx, cancel := context.WithTimeout(context.Background(), 30*time.Minute)
+	defer cancel()
+	req, err := http.NewRequestWithContext(ctx, http.MethodGet, url, nil)
+	if err != nil {
+		return nil, err
+	}
+	resp, err := d.client.Do(req)
+	if err != nil {
+		return nil, err
+	}
+	defer resp.Body.Close()
+
+	if resp.StatusCode >= 400 {
+		return nil, fmt.Errorf("http request failed with code %d", resp.StatusCode)
+	}
+
+	if size < 0 {
+		size = resp.ContentLength
+	}
+	if size < 0 {
+		log.Printf("Warning: unknown size for %s", url)
+		size = 0
+	}
+
+	out, err := os.Create(path)
+	if err != nil {
+		return nil, err
+	}
+	wc := &writeCounter{
+		f:     out,
+		name:  filepath.Base(url),
+		total: uint64(size),
+	}
+	h := sha256.New()
+	if _, err := io.Copy(wc, io.TeeReader(resp.Body, h)); err != nil {
+		wc.Close()
+		return nil, err
+	}
+	return h.Sum(nil), wc.Close()
+}
+
+// fetchSegments downloads url into path as parallel range requests, and
+// returns the SHA-256 digest of the file. When the file has a strong ETag,
+// the segments a previous attempt completed are skipped; otherwise the
+// download starts from scratch.
+func (d *downloader) fetchSegments(url, path string, remote remoteFile) ([]byte, error) {
+	resume := remote.strong
+	count := (remote.size + d.segmentSize - 1) / d.segmentSize
+	state := partialState{
+		URL:       url,
+		Validator: remote.validator,
+		Size:      remote.size,
+		Segment:   d.segmentSize,
+		Done:      make([]bool, count),
+	}
+
+	statePath := path + ".json"
+	flags := os.O_RDWR | os.O_CREATE
+	if previous, err := loadPartialState(statePath); resume && err == nil && previous.matches(state) {
+		state = previous
+	} else {
+		os.Remove(statePath)
+		flags |= os.O_TRUNC
+	}
+
+	out, err := os.OpenFile(path, flags, 0644)
+	if err != nil {
+		return nil, err
+	}
+	defer out.Close()
+	if err := out.Truncate(remote.size); err != nil {
+		return nil, err
+	}
+
+	progress := &downloadProgress{name: filepath.Base(url), total: remote.size}
+	digest := newSegmentDigest(out, d.segmentSize, remote.size)
+	var missing, done []int64
+	for i, ok := range state.Done {
+		if ok {
+			progress.add(segmentLength(int64(i), d.segmentSize, remote.size))
+			done = append(done, int64(i))
+			continue
+		}
+		missing = append(missing, int64(i))
+	}
+	if len(missing) < len(state.Done) {
+		log.Printf("%s: resuming, %d of %d segments left", progress.name, len(missing), len(state.Done))
+	}
+
+	var stateMu sync.Mutex
+	var g errgroup.Group
+	g.Go(func() error {
+		for _, i := range done {
+			if err := digest.complete(i); err != nil {
+				return err
+			}
+		}
+		return nil
+	})
+	for _, i := range missing {
+		i := i
+		g.Go(func() error {
+			if err := d.fetchSegment(url, remote, out, i, progress); err != nil {
+				return err
+			}
+			if resume {
+				stateMu.Lock()
+				state.Done[i] = true
+				err := state.save(statePath)
+				stateMu.Unlock()
+				if err != nil {
+					return err
+				}
+			}
+			return digest.complete(i)
+		})
+	}
+
+	if err := g.Wait(); err != nil {
+		// A partial download of another version of the file is worthless.
+		if errors.Is(err, errRemoteChanged) {
+			os.Remove(path)
+			os.Remove(statePath)
+		}
+		return nil, err
+	}
+
+	sum, err := digest.sum()
+	if err != nil {
+		return nil, err
+	}
+	if err := out.Close(); err != nil {
+		return nil, err
+	}
+	os.Remove(statePath)
+	return sum, nil
+}
+
+// fetchSegment downloads segment i of url into out, trying again when the
+// request fails unless the file changed on the server.
+func (d *downloader) fetchSegment(url string, remote remoteFile, out *os.File, i int64, progress *downloadProgress) error {
+	d.slots <- struct{}{}
+	defer func() { <-d.slots }()
+
+	offset := i * d.segmentSize
+	length := segmentLength(i, d.segmentSize, remote.size)
+	var err error
+	for attempt := 1; attempt <= segmentAttempts; attempt++ {
+		if err = d.fetchRange(url, remote, out, offset, length, progress); err == nil || errors.Is(err, errRemoteChanged) {
+			return err
+		}
+		log.Printf("%s: segment %d failed (attempt %d/%d): %v", progress.name, i, attempt, segmentAttempts, err)
+		time.Sleep(time.Duration(attempt) * d.retryDelay)
+	}
+	return err
+}
+
+// errRemoteChanged is returned when the file changed on the server while
+// being downloaded.
+var errRemoteChanged = errors.New("file changed on the server during the download")
+
+// fetchRange writes the length bytes of url starting at offset into out.
+func (d *downloader) fetchRange(url string, remote remoteFile, out *os.File, offset, length int64, progress *downloadProgress) error {
+	ctx, cancel := context.WithTimeout(context.Background(), 10*time.Minute)
+	defer cancel()
+	req, err := http.NewRequestWithContext(ctx, http.MethodGet, url, nil)
+	if err != nil {
+		return err
+	}
+	req.Header.Set("Range", fmt.Sprintf("bytes=%d-%d", offset, offset+length-1))
+	// The server answers with the whole, new file rather than a range of it
+	// if it no longer has the version the other ranges come from. It only
+	// compares strong ETags, and would send the whole file for any other
+	// validator.
+	if remote.strong {
+		req.Header.Set("If-Range", remote.validator)
+	}
+
+	resp, err := d.client.Do(req)
+	if err != nil {
+		return err
+	}
+	defer resp.Body.Close()
+
+	switch {
+	case resp.StatusCode == http.StatusOK && remote.strong:
+		return errRemoteChanged
+	case resp.StatusCode != http.StatusPartialContent:
+		return fmt.Errorf("range request failed with code %d", resp.StatusCode)
+	}
+	// Without If-Range, the validator sent with the range is all that tells
+	// which version of the file it comes from.
+	if v := validatorOf(resp.Header); v != "" && v != remote.validator {
+		return errRemoteChanged
+	}
+
+	n, err := io.Copy(io.NewOffsetWriter(out, offset), io.LimitReader(resp.Body, length))
+	progress.add(n)
+	if err != nil {
+		return err
+	}
+	if n != length {
+		progress.add(-n)
+		return fmt.Errorf("short range: got %d bytes out of %d", n, length)
+	}
+	return nil
+}
+
+// segmentDigest hashes a file downloaded in segments, which complete out of
+// order. Each segment is hashed as soon as those before it are, from the
+// file while it is still in the page cache, so that hashing overlaps the
+// rest of the download instead of reading the whole file again after it.
+type segmentDigest struct {
+	file        *os.File
+	segmentSize int64
+	size        int64
+
+	mu      sync.Mutex
+	h       hash.Hash
+	done    []bool
+	next    int64 // The first segment not hashed yet.
+	hashing bool  // Whether a goroutine is hashing segments from next on.
+}
+
+func newSegmentDigest(file *os.File, segmentSize, size int64) *segmentDigest {
+	return &segmentDigest{
+		file:        file,
+		segmentSize: segmentSize,
+		size:        size,
+		h:           sha256.New(),
+		done:        make([]bool, (size+segmentSize-1)/segmentSize),
+	}
+}
+
+// complete records that segment i is on disk, and hashes it along with the
+// segments after it that are too if the ones before it are hashed. Hashing
+// is left to the goroutine already doing it, if any.
+func (s *segmentDigest) complete(i int64) error {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	s.done[i] = true
+	if s.hashing {
+		return nil
+	}
+
+	s.hashing = true
+	defer func() { s.hashing = false }()
+	for s.next < int64(len(s.done)) && s.done[s.next] {
+		section := io.NewSectionReader(s.file, s.next*s.segmentSize, segmentLength(s.next, s.segmentSize, s.size))
+		s.mu.Unlock()
+		_, err := io.Copy(s.h, section)
+		s.mu.Lock()
+		if err != nil {
+			return err
+		}
+		s.next++
+	}
+	return nil
+}
+
+// sum returns the digest of the file once every segment is hashed.
+func (s *segmentDigest) sum() ([]byte, error) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if s.next != int64(len(s.done)) {
+		return nil, fmt.Errorf("only %d of %d segments hashed", s.next, len(s.done))
+	}
+	return s.h.Sum(nil), nil
+}
+
+// segmentLength returns the length of segment i of a file of the given size.
+func segmentLength(i, segmentSize, size int64) int64 {
+	return min(segmentSize, size-i*segmentSize)
+}
+
+func loadPartialState(path string) (partialState, error) {
+	var state partialState
+	data, err := os.ReadFile(path)
+	if err != nil {
+		return state, err
+	}
+	err = json.Unmarshal(data, &state)
+	return state, err
+}
+
+// matches tells whether a saved state describes the same download as s.
+func (s partialState) matches(other partialState) bool {
+	return s.URL == other.URL && s.Validator == other.Validator && s.Size == other.Size &&
+		s.Segment == other.Segment && len(s.Done) == len(other.Done)
+}
+
+func (s partialState) save(path string) error {
+	data, err := json.Marshal(s)
+	if err != nil {
+		return err
+	}
+	return os.WriteFile(path, data, 0644)
+}
+
+// downloadProgress logs the progress of a download made of concurrent
+// requests, every 10 MB like writeCounter does.
+type downloadProgress struct {
+	name            string
+	total           int64
+	current         atomic.Int64
+	previousPrinted atomic.Int64
+}
+
+func (p *downloadProgress) add(n int64) {
+	current := p.current.Add(n)
+	previous := p.previousPrinted.Load()
+	if current < previous+10*(1<<20) || !p.previousPrinted.CompareAndSwap(previous, current) {
+		return
+	}
+	log.Printf("%s: %.0f MB / %.0f MB\n", p.name,
+		math.Floor(float64(current)/(1<<20)),
+		math.Floor(float64(p.total)/(1<<20)))
+}
@@ -0,0 +1,219 @@
+package main
+
+import (
+	"bytes"
+	"crypto/sha256"
+	"fmt"
+	"math/rand"
+	"net/http"
+	"net/http/httptest"
+	"os"
+	"path/filepath"
+	"sync"
+	"testing"
+	"time"
+)
+
+const testSegmentSize = 1000
+
+// testServer serves one file with byte ranges, as http.ServeContent does,
+// and records the range requests made for it.
+type testServer struct {
+	mu      sync.Mutex
+	content []byte
+	etag    string
+
+	// fail, when set, makes the server answer the requests it matches with
+	// an error.
+	fail func(rangeHeader string) bool
+	// served, when set, is called once a request has been answered.
+	served func(s *testServer)
+
+	ranges   []string
+	ifRanges []string
+}
+
+func (s *testServer) ServeHTTP(w http.ResponseWriter, r *http.Request) {
+	s.mu.Lock()
+	content, etag := s.content, s.etag
+	if r.Method == http.MethodGet {
+		s.ranges = append(s.ranges, r.Header.Get("Range"))
+		s.ifRanges = append(s.ifRanges, r.Header.Get("If-Range"))
+	}
+	fail := s.fail != nil && s.fail(r.Header.Get("Range"))
+	s.mu.Unlock()
+
+	if fail {
+		http.Error(w, "failed", http.StatusInternalServerError)
+		return
+	}
+	w.Header().Set("ETag", etag)
+	http.ServeContent(w, r, "install.tar.gz", time.Time{}, bytes.NewReader(content))
+
+	if s.served != nil && r.Method == http.MethodGet {
+		s.mu.Lock()
+		s.served(s)
+		s.mu.Unlock()
+	}
+}
+
+// requests returns the range requests made since the last call.
+func (s *testServer) requests() (ranges, ifRanges []string) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	ranges, ifRanges = s.ranges, s.ifRanges
+	s.ranges, s.ifRanges = nil, nil
+	return ranges, ifRanges
+}
+
+func testContent(seed int64, size int) []byte {
+	content := make([]byte, size)
+	rand.New(rand.NewSource(seed)).Read(content)
+	return content
+}
+
+func segmentRange(i int64, size int) string {
+	return fmt.Sprintf("bytes=%d-%d", i*testSegmentSize, i*testSegmentSize+segmentLength(i, testSegmentSize, int64(size))-1)
+}
+
+func newTestDownloader(t *testing.T, connections int) *downloader {
+	d := newDownloader(connections, t.TempDir())
+	d.segmentSize = testSegmentSize
+	d.retryDelay = 0
+	return d
+}
+
+// checkDownload checks that the file at dest and the digest returned for it
+// are those of content.
+func checkDownload(t *testing.T, dest string, digest, content []byte) {
+	t.Helper()
+	got, err := os.ReadFile(dest)
+	if err != nil {
+		t.Fatalf("cannot read the download: %v", err)
+	}
+	if !bytes.Equal(got, content) {
+		t.Fatalf("downloaded %d bytes that differ from the %d served", len(got), len(content))
+	}
+	if want := sha256.Sum256(content); !bytes.Equal(digest, want[:]) {
+		t.Fatalf("digest is %x, want %x", digest, want)
+	}
+}
+
+func TestDownloadResumesWithStrongETag(t *testing.T) {
+	content := testContent(1, 9500)
+	failed := segmentRange(3, len(content))
+	server := &testServer{content: content, etag: `"v1"`, fail: func(r string) bool { return r == failed }}
+	ts := httptest.NewServer(server)
+	defer ts.Close()
+
+	d := newTestDownloader(t, 4)
+	dest := filepath.Join(t.TempDir(), "install.tar.gz")
+	if _, err := d.download(ts.URL, dest); err == nil {
+		t.Fatal("download succeeded while a segment always fails")
+	}
+	_, ifRanges := server.requests()
+	for _, ifRange := range ifRanges {
+		if ifRange != `"v1"` {
+			t.Fatalf("range requested with If-Range %q, want the ETag", ifRange)
+		}
+	}
+
+	server.mu.Lock()
+	server.fail = nil
+	server.mu.Unlock()
+	digest, err := d.download(ts.URL, dest)
+	if err != nil {
+		t.Fatalf("resumed download failed: %v", err)
+	}
+	checkDownload(t, dest, digest, content)
+	if ranges, _ := server.requests(); len(ranges) != 1 || ranges[0] != failed {
+		t.Fatalf("resuming requested %q, want only %q", ranges, failed)
+	}
+
+	// The cached copy is linked rather than downloaded or copied again.
+	other := filepath.Join(t.TempDir(), "install.tar.gz")
+	digest, err = d.download(ts.URL, other)
+	if err != nil {
+		t.Fatalf("cached download failed: %v", err)
+	}
+	checkDownload(t, other, digest, content)
+	if ranges, _ := server.requests(); len(ranges) != 0 {
+		t.Fatalf("cached download requested %q", ranges)
+	}
+	first, _ := os.Stat(dest)
+	second, _ := os.Stat(other)
+	if !os.SameFile(first, second) {
+		t.Fatal("cached download is not a link to the cached file")
+	}
+}
+
+func TestDownloadRestartsWhenRemoteChanges(t *testing.T) {
+	content := testContent(1, 9500)
+	changed := testContent(2, 9500)
+	server := &testServer{content: content, etag: `"v1"`}
+	// The file changes on the server once the first range is served.
+	server.served = func(s *testServer) {
+		s.content, s.etag = changed, `"v2"`
+	}
+	ts := httptest.NewServer(server)
+	defer ts.Close()
+
+	d := newTestDownloader(t, 1)
+	dest := filepath.Join(t.TempDir(), "install.tar.gz")
+	if _, err := d.download(ts.URL, dest); err == nil {
+		t.Fatal("download mixing two versions of the file succeeded")
+	}
+	parts, err := filepath.Glob(filepath.Join(d.cacheDir, "*", "*.part*"))
+	if err != nil || len(parts) != 0 {
+		t.Fatalf("partial download of the old version left behind: %q", parts)
+	}
+
+	server.mu.Lock()
+	server.served = nil
+	server.mu.Unlock()
+	server.requests()
+	digest, err := d.download(ts.URL, dest)
+	if err != nil {
+		t.Fatalf("download of the new version failed: %v", err)
+	}
+	checkDownload(t, dest, digest, changed)
+	if ranges, _ := server.requests(); len(ranges) != 10 {
+		t.Fatalf("download of the new version requested %d ranges, want all 10", len(ranges))
+	}
+}
+
+func TestDownloadWithWeakETagStartsFromScratch(t *testing.T) {
+	content := testContent(1, 9500)
+	failed := segmentRange(3, len(content))
+	server := &testServer{content: content, etag: `W/"v1"`, fail: func(r string) bool { return r == failed }}
+	ts := httptest.NewServer(server)
+	defer ts.Close()
+
+	d := newTestDownloader(t, 4)
+	dest := filepath.Join(t.TempDir(), "install.tar.gz")
+	if _, err := d.download(ts.URL, dest); err == nil {
+		t.Fatal("download succeeded while a segment always fails")
+	}
+	server.requests()
+
+	server.mu.Lock()
+	server.fail = nil
+	server.mu.Unlock()
+	digest, err := d.download(ts.URL, dest)
+	if err != nil {
+		t.Fatalf("download failed: %v", err)
+	}
+	checkDownload(t, dest, digest, content)
+
+	// Servers never match weak ETags in If-Range, and would send the whole
+	// file for every range.
+	ranges, ifRanges := server.requests()
+	if len(ranges) != 10 {
+		t.Fatalf("download requested %d ranges, want all 10", len(ranges))
+	}
+	for _, ifRange := range ifRanges {
+		if ifRange != "" {
+			t.Fatalf("range requested with If-Range %q and a weak ETag", ifRange)
+		}
+	}
+}
@@ -0,0 +1,380 @@
+package main
+
+import (
+	"archive/tar"
+	"bufio"
+	"bytes"
+	"compress/gzip"
+	"crypto/sha256"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"hash/crc32"
+	"io"
+	"log"
+	"os"
+	"sort"
+	"strings"
+)
+
+// The index sidecar lets the launcher and tooling read single files out of a
+// rootfs archive without decompressing everything in front of them.
+// All integers are little-endian:
+//
+//	header    magic "WSLTARIX", version u32, entry record size u32,
+//	          archive size u64, tar size u64, restart point count u32,
+//	          entry count u32, string table size u32, reserved u32
+//	restarts  compressed offset u64, tar offset u64; ascending
+//	entries   path offset u32, path size u32, link offset u32, link size u32,
+//	          header offset u64, data offset u64, size u64, mode u32,
+//	          type u8, 3 bytes of padding, SHA-256 of the content [32]byte;
+//	          sorted by path
+//	strings   paths and link targets, without separators
+//	trailer   CRC-32 of everything above u32
+//
+// Restart points are offsets of independent gzip members or zstd frames, where
+// decompression can start afresh. Paths are relative to the root, without any
+// leading "./" or trailing "/". Only regular files have a content hash.
+const (
+	indexMagic     = "WSLTARIX"
+	indexVersion   = 1
+	indexEntrySize = 80
+)
+
+// indexEntry describes one tar entry of the rootfs.
+type indexEntry struct {
+	path         string
+	linkTarget   string
+	typeflag     byte
+	mode         uint32
+	headerOffset uint64
+	dataOffset   uint64
+	size         uint64
+	sha256       [sha256.Size]byte
+}
+
+// restartPoint is a place in the archive where decompression can start.
+type restartPoint struct {
+	compressed   uint64
+	uncompressed uint64
+}
+
+// countingReader counts the bytes read through it.
+type countingReader struct {
+	r io.Reader
+	n uint64
+}
+
+func (c *countingReader) Read(p []byte) (int, error) {
+	n, err := c.r.Read(p)
+	c.n += uint64(n)
+	return n, err
+}
+
+// indexTarball lists the entries of the gzip tarball at path, with their
+// offsets in the uncompressed tar stream and the hash of their content.
+// It returns the entries and the size of the tar stream.
+func indexTarball(path string) (entries []indexEntry, tarSize uint64, err error) {
+	defer func() {
+		if err != nil {
+			err = fmt.Errorf("can't index %q: %v", path, err)
+		}
+	}()
+
+	in, err := os.Open(path)
+	if err != nil {
+		return nil, 0, err
+	}
+	defer in.Close()
+
+	zr, err := gzip.NewReader(bufio.NewReaderSize(in, 1<<20))
+	if err != nil {
+		return nil, 0, err
+	}
+	defer zr.Close()
+
+	// archive/tar reads headers block by block, so the count after Next is
+	// exactly where the entry data starts.
+	cr := &countingReader{r: zr}
+	tr := tar.NewReader(cr)
+	byPath := make(map[string]int)
+	var next uint64
+	for {
+		h, err := tr.Next()
+		if errors.Is(err, io.EOF) {
+			break
+		}
+		if err != nil {
+			return nil, 0, err
+		}
+
+		e := indexEntry{
+			path:         normalizeTarPath(h.Name),
+			linkTarget:   h.Linkname,
+			typeflag:     h.Typeflag,
+			mode:         uint32(h.Mode),
+			headerOffset: next,
+			dataOffset:   cr.n,
+			size:         uint64(h.Size),
+		}
+		if e.size > 0 {
+			hash := sha256.New()
+			if _, err := io.Copy(hash, tr); err != nil {
+				return nil, 0, err
+			}
+			if h.Typeflag == tar.TypeReg || h.Typeflag == tar.TypeRegA || h.Typeflag == tar.TypeCont {
+				copy(e.sha256[:], hash.Sum(nil))
+			}
+		}
+		next = e.dataOffset + (e.size+511)/512*512
+
+		// Later entries replace earlier ones when the archive is extracted.
+		if i, ok := byPath[e.path]; ok {
+			entries[i] = e
+			continue
+		}
+		byPath[e.path] = len(entries)
+		entries = append(entries, e)
+	}
+
+	// Drain the end-of-archive blocks so that the tar size is accurate.
+	if _, err := io.Copy(io.Discard, cr); err != nil {
+		return nil, 0, err
+	}
+
+	sort.Slice(entries, func(i, j int) bool { return entries[i].path < entries[j].path })
+	return entries, cr.n, nil
+}
+
+// normalizeTarPath strips the leading "./" or "/" and the trailing "/" of a tar member name.
+func normalizeTarPath(name string) string {
+	for {
+		switch {
+		case strings.HasPrefix(name, "./"):
+			name = name[2:]
+		case strings.HasPrefix(name, "/"):
+			name = name[1:]
+		default:
+			name = strings.TrimSuffix(name, "/")
+			if name == "." {
+				return ""
+			}
+			return name
+		}
+	}
+}
+
+// writeIndex writes the index of archive to archive + ".index", from the
+// entries of the tar stream it holds and the restart points found in it.
+func writeIndex(archive string, entries []indexEntry, tarSize uint64) (err error) {
+	defer func() {
+		if err != nil {
+			err = fmt.Errorf("can't write index of %q: %v", archive, err)
+		}
+	}()
+
+	restarts, archiveSize, err := findRestartPoints(archive)
+	if err != nil {
+		return err
+	}
+
+	var strs bytes.Buffer
+	addString := func(s string) (uint32, uint32) {
+		offset := uint32(strs.Len())
+		strs.WriteString(s)
+		return offset, uint32(len(s))
+	}
+
+	var b []byte
+	b = append(b, indexMagic...)
+	b = binary.LittleEndian.AppendUint32(b, indexVersion)
+	b = binary.LittleEndian.AppendUint32(b, indexEntrySize)
+	b = binary.LittleEndian.AppendUint64(b, archiveSize)
+	b = binary.LittleEndian.AppendUint64(b, tarSize)
+	b = binary.LittleEndian.AppendUint32(b, uint32(len(restarts)))
+	b = binary.LittleEndian.AppendUint32(b, uint32(len(entries)))
+	stringsSizeAt := len(b)
+	b = binary.LittleEndian.AppendUint32(b, 0)
+	b = binary.LittleEndian.AppendUint32(b, 0)
+
+	for _, r := range restarts {
+		b = binary.LittleEndian.AppendUint64(b, r.compressed)
+		b = binary.LittleEndian.AppendUint64(b, r.uncompressed)
+	}
+
+	for _, e := range entries {
+		pathOffset, pathSize := addString(e.path)
+		linkOffset, linkSize := addString(e.linkTarget)
+		b = binary.LittleEndian.AppendUint32(b, pathOffset)
+		b = binary.LittleEndian.AppendUint32(b, pathSize)
+		b = binary.LittleEndian.AppendUint32(b, linkOffset)
+		b = binary.LittleEndian.AppendUint32(b, linkSize)
+		b = binary.LittleEndian.AppendUint64(b, e.headerOffset)
+		b = binary.LittleEndian.AppendUint64(b, e.dataOffset)
+		b = binary.LittleEndian.AppendUint64(b, e.size)
+		b = binary.LittleEndian.AppendUint32(b, e.mode)
+		b = append(b, e.typeflag, 0, 0, 0)
+		b = append(b, e.sha256[:]...)
+	}
+
+	binary.LittleEndian.PutUint32(b[stringsSizeAt:], uint32(strs.Len()))
+	b = append(b, strs.Bytes()...)
+	b = binary.LittleEndian.AppendUint32(b, crc32.ChecksumIEEE(b))
+
+	log.Printf("indexed %d entries of %s with %d restart points", len(entries), archive, len(restarts))
+	return os.WriteFile(archive+".index", b, 0644)
+}
+
+// findRestartPoints returns the offsets of the independent gzip members or
+// zstd frames of archive whose sizes can be read from their headers, along
+// with the archive size. Other archives can only be decompressed from the start.
+func findRestartPoints(archive string) ([]restartPoint, uint64, error) {
+	f, err := os.Open(archive)
+	if err != nil {
+		return nil, 0, err
+	}
+	defer f.Close()
+
+	info, err := f.Stat()
+	if err != nil {
+		return nil, 0, err
+	}
+	archiveSize := uint64(info.Size())
+
+	restarts := []restartPoint{{0, 0}}
+	var compressed, uncompressed uint64
+	for compressed < archiveSize {
+		magic := readAt(f, compressed, 4)
+		var memberSize, contentSize uint64
+		var ok bool
+		switch {
+		case bytes.HasPrefix(magic, []byte{0x1f, 0x8b}):
+			memberSize, contentSize, ok = gzipMemberSize(f, compressed)
+		case bytes.Equal(magic, []byte{0x28, 0xb5, 0x2f, 0xfd}):
+			memberSize, contentSize, ok = zstdFrameSize(f, compressed)
+		}
+		if !ok || compressed+memberSize > archiveSize {
+			break
+		}
+
+		compressed += memberSize
+		uncompressed += contentSize
+		if compressed < archiveSize && contentSize > 0 {
+			restarts = append(restarts, restartPoint{compressed, uncompressed})
+		}
+	}
+
+	return restarts, archiveSize, nil
+}
+
+// readAt returns up to n bytes of r at offset, fewer at the end of the file.
+func readAt(r io.ReaderAt, offset uint64, n int) []byte {
+	b := make([]byte, n)
+	n, _ = r.ReadAt(b, int64(offset))
+	return b[:n]
+}
+
+// gzipMemberSize reads the total size the gzip member at offset records in
+// its "WS" or BGZF "BC" extra subfield, and its uncompressed size from its trailer.
+func gzipMemberSize(r io.ReaderAt, offset uint64) (size, contentSize uint64, ok bool) {
+	const flagExtra = 0x04
+	m := readAt(r, offset, 12)
+	if len(m) < 12 || m[3]&flagExtra == 0 {
+		return 0, 0, false
+	}
+
+	xlen := int(binary.LittleEndian.Uint16(m[10:]))
+	extra := readAt(r, offset+12, xlen)
+	if len(extra) < xlen {
+		return 0, 0, false
+	}
+	for len(extra) >= 4 {
+		id := string(extra[:2])
+		n := int(binary.LittleEndian.Uint16(extra[2:]))
+		if n > len(extra)-4 {
+			return 0, 0, false
+		}
+		field := extra[4 : 4+n]
+		switch {
+		case id == "WS" && n == 4:
+			size = uint64(binary.LittleEndian.Uint32(field))
+		case id == "BC" && n == 2:
+			size = uint64(binary.LittleEndian.Uint16(field)) + 1
+		}
+		extra = extra[4+n:]
+	}
+	if size < uint64(12+xlen+8) {
+		return 0, 0, false
+	}
+
+	trailer := readAt(r, offset+size-4, 4)
+	if len(trailer) < 4 {
+		return 0, 0, false
+	}
+	return size, uint64(binary.LittleEndian.Uint32(trailer)), true
+}
+
+// zstdFrameSize walks the blocks of the zstd frame at offset and returns its
+// size and the content size declared in its header.
+func zstdFrameSize(r io.ReaderAt, offset uint64) (size, contentSize uint64, ok bool) {
+	f := readAt(r, offset, 18)
+	if len(f) < 6 {
+		return 0, 0, false
+	}
+
+	descriptor := f[4]
+	singleSegment := descriptor&0x20 != 0
+	pos := 5
+	if !singleSegment {
+		pos++
+	}
+	pos += []int{0, 1, 2, 4}[descriptor&3]
+
+	var fcsSize int
+	switch descriptor >> 6 {
+	case 0:
+		if singleSegment {
+			fcsSize = 1
+		}
+	case 1:
+		fcsSize = 2
+	case 2:
+		fcsSize = 4
+	case 3:
+		fcsSize = 8
+	}
+	// Frames that do not declare their content size cannot be skipped over.
+	if fcsSize == 0 || pos+fcsSize > len(f) {
+		return 0, 0, false
+	}
+	var fcs [8]byte
+	copy(fcs[:], f[pos:pos+fcsSize])
+	contentSize = binary.LittleEndian.Uint64(fcs[:])
+	if fcsSize == 2 {
+		contentSize += 256
+	}
+
+	size = uint64(pos + fcsSize)
+	for {
+		h := readAt(r, offset+size, 3)
+		if len(h) < 3 {
+			return 0, 0, false
+		}
+		header := uint32(h[0]) | uint32(h[1])<<8 | uint32(h[2])<<16
+		size += 3
+		if (header>>1)&3 == 1 {
+			// RLE blocks store a single byte.
+			size++
+		} else {
+			size += uint64(header >> 3)
+		}
+		if header&1 != 0 {
+			break
+		}
+	}
+	if descriptor&0x04 != 0 {
+		size += 4
+	}
+
+	return size, contentSize, true
+}
@@ -40,6 +40,12 @@ func main() {
 
 	var noChecksum *bool
 	var buildID *int
+	var repackBlockSize *int
+	var compression *string
+	var dictionarySize *int
+	var index *bool
+	var downloadConnections *int
+	var downloadCache *string
 	prepareBuildCmd := &cobra.Command{
 		Use:   "prepare BUILDID_PATH APP_ID ROOTFSES",
 		Short: "Prepares the build source before calling msbuild",
@@ -48,12 +54,70 @@ func main() {
 			local file paths or urls each followed by ::<arch>`,
 		Args: cobra.ExactArgs(3),
 		RunE: func(cmd *cobra.Command, args []string) error {
-			return prepareBuild(args[0], args[1], args[2], *noChecksum, *buildID)
+			opts := rootfsOptions{
+				repackBlockSize: *repackBlockSize,
+				compression:     *compression,
+				dictionarySize:  *dictionarySize,
+				index:           *index,
+
+				downloadConnections: *downloadConnections,
+				downloadCache:       *downloadCache,
+			}
+			return prepareBuild(args[0], args[1], args[2], *noChecksum, *buildID, opts)
 		},
 	}
 	rootCmd.AddCommand(prepareBuildCmd)
 	noChecksum = prepareBuildCmd.Flags().Bool("no-checksum", false, "Disable checksum verification on rootfses")
 	buildID = prepareBuildCmd.Flags().Int("build-id", -1, "Force a build ID")
+	repackBlockSize = prepareBuildCmd.Flags().Int("repack-block-size", 0, "Repack rootfses into independent gzip members or zstd frames of this many uncompressed bytes, so that the launcher can decompress gzip ones in parallel and seek into indexed ones (0 disables)")
+	compression = prepareBuildCmd.Flags().String("compression", compressionGzip, "Compression of the shipped rootfses: gzip, zstd or xz (zstd and xz need the matching command line tool)")
+	dictionarySize = prepareBuildCmd.Flags().Int("zstd-dictionary-size", 0, "Train a zstd dictionary of this many bytes on the small files under /usr/share and ship it with the rootfs (0 disables)")
+	index = prepareBuildCmd.Flags().Bool("index", false, "Write an index of the rootfs entries next to it, so that tools can read single files without decompressing the whole archive. It is not packaged")
+	downloadConnections = prepareBuildCmd.Flags().Int("download-connections", defaultDownloadConnections, "Maximum number of HTTP requests in flight, shared by all rootfs downloads, which are split into byte ranges when the server allows it")
+	downloadCache = prepareBuildCmd.Flags().String("download-cache", defaultDownloadCache(), "Directory keeping downloaded rootfses by URL and ETag, and partial downloads to resume (empty disables)")
+
+	var blockSize *int
+	repackCmd := &cobra.Command{
+		Use:   "repack SOURCE DEST",
+		Short: "Recompresses a rootfs into a block-parallel gzip archive",
+		Long: `This recompresses the gzip tarball SOURCE into DEST as a series of
+			independent gzip members recording their own size, which the launcher
+			decompresses on several threads. DEST is readable by any gzip tool.`,
+		Args: cobra.ExactArgs(2),
+		RunE: func(cmd *cobra.Command, args []string) error {
+			return repackRootfs(args[0], args[1], *blockSize)
+		},
+	}
+	rootCmd.AddCommand(repackCmd)
+	blockSize = repackCmd.Flags().Int("block-size", defaultRepackBlockSize, "Uncompressed bytes per gzip member")
+
+	chunkCmd := &cobra.Command{
+		Use:   "chunk STORE ROOTFS MANIFEST",
+		Short: "Adds a rootfs to a content-addressed chunk store",
+		Long: `This splits the gzip tarball ROOTFS into chunks at content-defined
+			boundaries, adds those missing from the STORE directory, and writes
+			the MANIFEST listing them. Chunking the rootfses of several releases
+			into the same store shares the chunks they have in common.`,
+		Args: cobra.ExactArgs(3),
+		RunE: func(cmd *cobra.Command, args []string) error {
+			return chunkRootfs(args[1], args[0], args[2])
+		},
+	}
+	rootCmd.AddCommand(chunkCmd)
+
+	deltaCmd := &cobra.Command{
+		Use:   "delta OLD NEW DELTA",
+		Short: "Computes the update from one rootfs to another",
+		Long: `This compares the gzip tarballs OLD and NEW entry by entry, and writes
+			to DELTA the removals, new entries, metadata changes and binary
+			patches turning a tree extracted from OLD into NEW. The delta is
+			applied in place by the in-distro helper with "wsl-helper apply-delta".`,
+		Args: cobra.ExactArgs(3),
+		RunE: func(cmd *cobra.Command, args []string) error {
+			return computeRootfsDelta(args[0], args[1], args[2])
+		},
+	}
+	rootCmd.AddCommand(deltaCmd)
 
 	err := rootCmd.Execute()
 	if err != nil {
@@ -0,0 +1,161 @@
+package main
+
+import (
+	"bufio"
+	"bytes"
+	"compress/flate"
+	"compress/gzip"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"hash/crc32"
+	"io"
+	"log"
+	"os"
+	"runtime"
+)
+
+const (
+	// defaultRepackBlockSize is the amount of uncompressed data stored in each gzip member.
+	defaultRepackBlockSize = 4 << 20
+
+	// memberOverhead is the size of a repacked member header and trailer.
+	memberOverhead = 10 + 2 + 8 + 8
+)
+
+// repackRootfs recompresses the gzip tarball at src into dest as a series of
+// independent gzip members, each holding blockSize bytes of uncompressed data.
+// Members are compressed in parallel and record their own total size in a
+// "WS" extra subfield, which lets the launcher inflate them on several threads
+// at once. The result remains a valid multi-member gzip file for any other tool.
+func repackRootfs(src, dest string, blockSize int) error {
+	return repackBlocks(src, dest, blockSize, compressMember)
+}
+
+// repackBlocks decompresses the gzip tarball at src and writes it to dest as
+// the concatenation of its blocks of blockSize bytes, each passed through compress.
+func repackBlocks(src, dest string, blockSize int, compress func([]byte) ([]byte, error)) (err error) {
+	defer func() {
+		if err != nil {
+			err = fmt.Errorf("can't repack %q: %v", src, err)
+		}
+	}()
+
+	if blockSize <= 0 || blockSize > 1<<30 {
+		return fmt.Errorf("invalid block size %d", blockSize)
+	}
+
+	log.Printf("repacking %s in blocks of %d bytes", src, blockSize)
+	in, err := os.Open(src)
+	if err != nil {
+		return err
+	}
+	defer in.Close()
+
+	zr, err := gzip.NewReader(bufio.NewReaderSize(in, 1<<20))
+	if err != nil {
+		return err
+	}
+	defer zr.Close()
+
+	out, err := os.Create(dest)
+	if err != nil {
+		return err
+	}
+	defer func() {
+		if cerr := out.Close(); err == nil {
+			err = cerr
+		}
+		if err != nil {
+			os.Remove(dest)
+		}
+	}()
+
+	type member struct {
+		data []byte
+		err  error
+	}
+
+	// Blocks are compressed concurrently; pending keeps their results in
+	// archive order and bounds how many are in flight.
+	pending := make(chan chan member, runtime.NumCPU())
+	var readErr error
+	go func() {
+		defer close(pending)
+		for {
+			block := make([]byte, blockSize)
+			n, err := io.ReadFull(zr, block)
+			if n > 0 {
+				result := make(chan member, 1)
+				pending <- result
+				go func(data []byte) {
+					d, err := compress(data)
+					result <- member{data: d, err: err}
+				}(block[:n])
+			}
+			if errors.Is(err, io.EOF) || errors.Is(err, io.ErrUnexpectedEOF) {
+				return
+			}
+			if err != nil {
+				readErr = err
+				return
+			}
+		}
+	}()
+
+	var writeErr error
+	for result := range pending {
+		m := <-result
+		if writeErr != nil {
+			continue
+		}
+		if m.err != nil {
+			writeErr = m.err
+			continue
+		}
+		_, writeErr = out.Write(m.data)
+	}
+
+	if readErr != nil {
+		return readErr
+	}
+	return writeErr
+}
+
+// repackRootfsInPlace replaces the gzip tarball at path with its block-parallel repack.
+func repackRootfsInPlace(path string, blockSize int) error {
+	tmp := path + ".repack"
+	if err := repackRootfs(path, tmp, blockSize); err != nil {
+		return err
+	}
+	return os.Rename(tmp, path)
+}
+
+// compressMember returns a complete gzip member holding data, with its total
+// size recorded in the "WS" extra subfield.
+func compressMember(data []byte) ([]byte, error) {
+	var body bytes.Buffer
+	fw, err := flate.NewWriter(&body, flate.BestCompression)
+	if err != nil {
+		return nil, err
+	}
+	if _, err := fw.Write(data); err != nil {
+		return nil, err
+	}
+	if err := fw.Close(); err != nil {
+		return nil, err
+	}
+
+	size := memberOverhead + body.Len()
+	m := make([]byte, 0, size)
+	// ID1, ID2, CM=deflate, FLG=FEXTRA, MTIME, XFL, OS=unknown
+	m = append(m, 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 255)
+	m = binary.LittleEndian.AppendUint16(m, 8)
+	m = append(m, 'W', 'S')
+	m = binary.LittleEndian.AppendUint16(m, 4)
+	m = binary.LittleEndian.AppendUint32(m, uint32(size))
+	m = append(m, body.Bytes()...)
+	m = binary.LittleEndian.AppendUint32(m, crc32.ChecksumIEEE(data))
+	m = binary.LittleEndian.AppendUint32(m, uint32(len(data)))
+	return m, nil
+}